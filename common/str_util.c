@@ -263,4 +263,349 @@ const char *c_strnstr(const char *s, const char *find, size_t slen) {
   return NULL;
 }
 
+/*
+ * Shortest round-trip formatting of doubles, using the Grisu2 algorithm from
+ * F. Loitsch, "Printing Floating-Point Numbers Quickly and Accurately with
+ * Integers". The output always reads back as the same double and is the
+ * shortest such string in all but a tiny fraction of cases.
+ */
+
+struct cs_diy_fp {
+  uint64_t f;
+  int e;
+};
+
+/* 64-bit normalized approximations of 10^k, for k = -348, -340, ..., 340 */
+static const struct {
+  uint32_t hi, lo;
+  int16_t e;
+} cs_cached_pow10[] = {
+    {0xfa8fd5a0, 0x081c0288, -1220}, {0xbaaee17f, 0xa23ebf76, -1193},
+    {0x8b16fb20, 0x3055ac76, -1166}, {0xcf42894a, 0x5dce35ea, -1140},
+    {0x9a6bb0aa, 0x55653b2d, -1113}, {0xe61acf03, 0x3d1a45df, -1087},
+    {0xab70fe17, 0xc79ac6ca, -1060}, {0xff77b1fc, 0xbebcdc4f, -1034},
+    {0xbe5691ef, 0x416bd60c, -1007}, {0x8dd01fad, 0x907ffc3c, -980},
+    {0xd3515c28, 0x31559a83, -954}, {0x9d71ac8f, 0xada6c9b5, -927},
+    {0xea9c2277, 0x23ee8bcb, -901}, {0xaecc4991, 0x4078536d, -874},
+    {0x823c1279, 0x5db6ce57, -847}, {0xc2109436, 0x4dfb5637, -821},
+    {0x9096ea6f, 0x3848984f, -794}, {0xd77485cb, 0x25823ac7, -768},
+    {0xa086cfcd, 0x97bf97f4, -741}, {0xef340a98, 0x172aace5, -715},
+    {0xb23867fb, 0x2a35b28e, -688}, {0x84c8d4df, 0xd2c63f3b, -661},
+    {0xc5dd4427, 0x1ad3cdba, -635}, {0x936b9fce, 0xbb25c996, -608},
+    {0xdbac6c24, 0x7d62a584, -582}, {0xa3ab6658, 0x0d5fdaf6, -555},
+    {0xf3e2f893, 0xdec3f126, -529}, {0xb5b5ada8, 0xaaff80b8, -502},
+    {0x87625f05, 0x6c7c4a8b, -475}, {0xc9bcff60, 0x34c13053, -449},
+    {0x964e858c, 0x91ba2655, -422}, {0xdff97724, 0x70297ebd, -396},
+    {0xa6dfbd9f, 0xb8e5b88f, -369}, {0xf8a95fcf, 0x88747d94, -343},
+    {0xb9447093, 0x8fa89bcf, -316}, {0x8a08f0f8, 0xbf0f156b, -289},
+    {0xcdb02555, 0x653131b6, -263}, {0x993fe2c6, 0xd07b7fac, -236},
+    {0xe45c10c4, 0x2a2b3b06, -210}, {0xaa242499, 0x697392d3, -183},
+    {0xfd87b5f2, 0x8300ca0e, -157}, {0xbce50864, 0x92111aeb, -130},
+    {0x8cbccc09, 0x6f5088cc, -103}, {0xd1b71758, 0xe219652c, -77},
+    {0x9c400000, 0x00000000, -50}, {0xe8d4a510, 0x00000000, -24},
+    {0xad78ebc5, 0xac620000, 3}, {0x813f3978, 0xf8940984, 30},
+    {0xc097ce7b, 0xc90715b3, 56}, {0x8f7e32ce, 0x7bea5c70, 83},
+    {0xd5d238a4, 0xabe98068, 109}, {0x9f4f2726, 0x179a2245, 136},
+    {0xed63a231, 0xd4c4fb27, 162}, {0xb0de6538, 0x8cc8ada8, 189},
+    {0x83c7088e, 0x1aab65db, 216}, {0xc45d1df9, 0x42711d9a, 242},
+    {0x924d692c, 0xa61be758, 269}, {0xda01ee64, 0x1a708dea, 295},
+    {0xa26da399, 0x9aef774a, 322}, {0xf209787b, 0xb47d6b85, 348},
+    {0xb454e4a1, 0x79dd1877, 375}, {0x865b8692, 0x5b9bc5c2, 402},
+    {0xc83553c5, 0xc8965d3d, 428}, {0x952ab45c, 0xfa97a0b3, 455},
+    {0xde469fbd, 0x99a05fe3, 481}, {0xa59bc234, 0xdb398c25, 508},
+    {0xf6c69a72, 0xa3989f5c, 534}, {0xb7dcbf53, 0x54e9bece, 561},
+    {0x88fcf317, 0xf22241e2, 588}, {0xcc20ce9b, 0xd35c78a5, 614},
+    {0x98165af3, 0x7b2153df, 641}, {0xe2a0b5dc, 0x971f303a, 667},
+    {0xa8d9d153, 0x5ce3b396, 694}, {0xfb9b7cd9, 0xa4a7443c, 720},
+    {0xbb764c4c, 0xa7a44410, 747}, {0x8bab8eef, 0xb6409c1a, 774},
+    {0xd01fef10, 0xa657842c, 800}, {0x9b10a4e5, 0xe9913129, 827},
+    {0xe7109bfb, 0xa19c0c9d, 853}, {0xac2820d9, 0x623bf429, 880},
+    {0x80444b5e, 0x7aa7cf85, 907}, {0xbf21e440, 0x03acdd2d, 933},
+    {0x8e679c2f, 0x5e44ff8f, 960}, {0xd433179d, 0x9c8cb841, 986},
+    {0x9e19db92, 0xb4e31ba9, 1013}, {0xeb96bf6e, 0xbadf77d9, 1039},
+    {0xaf87023b, 0x9bf0ee6b, 1066},
+};
+
+static const uint32_t cs_pow10_u32[] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000,
+};
+
+static struct cs_diy_fp cs_diy_fp_mul(struct cs_diy_fp x, struct cs_diy_fp y) {
+  struct cs_diy_fp r;
+  uint64_t a = x.f >> 32, b = x.f & 0xffffffff;
+  uint64_t c = y.f >> 32, d = y.f & 0xffffffff;
+  uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+  uint64_t tmp = (bd >> 32) + (ad & 0xffffffff) + (bc & 0xffffffff);
+  tmp += 1U << 31; /* round */
+  r.f = ac + (ad >> 32) + (bc >> 32) + (tmp >> 32);
+  r.e = x.e + y.e + 64;
+  return r;
+}
+
+static void cs_grisu_round(char *digits, int len, uint64_t delta,
+                           uint64_t rest, uint64_t ten_kappa, uint64_t wp_w) {
+  while (rest < wp_w && delta - rest >= ten_kappa &&
+         (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w)) {
+    digits[len - 1]--;
+    rest += ten_kappa;
+  }
+}
+
+/*
+ * Produce the digits of a positive finite `v` into `digits` (at most 17, not
+ * NUL-terminated). Returns the number of digits; `v` == digits * 10^(*K).
+ */
+static int cs_grisu2(double v, char *digits, int *K) {
+  const uint64_t hidden = (uint64_t) 1 << 52;
+  struct cs_diy_fp w, wp, wm, c;
+  uint64_t u, one, delta, wp_w, p2, scale;
+  uint32_t p1;
+  int len = 0, kappa, k, i;
+  double dk;
+
+  memcpy(&u, &v, sizeof(u));
+  w.f = u & (hidden - 1);
+  w.e = (int) ((u >> 52) & 0x7ff);
+  if (w.e != 0) {
+    w.f += hidden;
+    w.e -= 1075;
+  } else {
+    w.e = -1074;
+  }
+
+  /* Boundaries: halfway points to the neighbouring doubles */
+  wp.f = (w.f << 1) + 1;
+  wp.e = w.e - 1;
+  while (!(wp.f & (hidden << 1))) {
+    wp.f <<= 1;
+    wp.e--;
+  }
+  wp.f <<= 10;
+  wp.e -= 10;
+  if (w.f == hidden) {
+    wm.f = (w.f << 2) - 1;
+    wm.e = w.e - 2;
+  } else {
+    wm.f = (w.f << 1) - 1;
+    wm.e = w.e - 1;
+  }
+  wm.f <<= wm.e - wp.e;
+  wm.e = wp.e;
+
+  while (!(w.f & ((uint64_t) 1 << 63))) {
+    w.f <<= 1;
+    w.e--;
+  }
+
+  /* Scale by a cached power of ten so that the exponent is in [-60, -32] */
+  dk = (-61 - wp.e) * 0.30102999566398114 + 347;
+  k = (int) dk;
+  if (dk - k > 0.0) k++;
+  i = (k >> 3) + 1;
+  *K = -(-348 + i * 8);
+  c.f = (uint64_t) cs_cached_pow10[i].hi << 32 | cs_cached_pow10[i].lo;
+  c.e = cs_cached_pow10[i].e;
+
+  w = cs_diy_fp_mul(w, c);
+  wp = cs_diy_fp_mul(wp, c);
+  wm = cs_diy_fp_mul(wm, c);
+  wm.f++;
+  wp.f--;
+
+  /* Generate digits of the upper boundary until they are precise enough */
+  delta = wp.f - wm.f;
+  wp_w = wp.f - w.f;
+  one = (uint64_t) 1 << -wp.e;
+  p1 = (uint32_t)(wp.f >> -wp.e);
+  p2 = wp.f & (one - 1);
+  for (kappa = 1; kappa < 10 && p1 >= cs_pow10_u32[kappa]; kappa++) {
+  }
+
+  while (kappa > 0) {
+    uint32_t d = p1 / cs_pow10_u32[kappa - 1];
+    p1 %= cs_pow10_u32[kappa - 1];
+    if (d != 0 || len != 0) digits[len++] = (char) ('0' + d);
+    kappa--;
+    if (((uint64_t) p1 << -wp.e) + p2 <= delta) {
+      *K += kappa;
+      cs_grisu_round(digits, len, delta, ((uint64_t) p1 << -wp.e) + p2,
+                     (uint64_t) cs_pow10_u32[kappa] << -wp.e, wp_w);
+      return len;
+    }
+  }
+
+  for (;;) {
+    uint32_t d;
+    p2 *= 10;
+    delta *= 10;
+    d = (uint32_t)(p2 >> -wp.e);
+    if (d != 0 || len != 0) digits[len++] = (char) ('0' + d);
+    p2 &= one - 1;
+    kappa--;
+    if (p2 < delta) {
+      *K += kappa;
+      for (scale = 1, i = 0; i < -kappa && i < 20; i++) scale *= 10;
+      cs_grisu_round(digits, len, delta, p2, one, i < 20 ? wp_w * scale : 0);
+      return len;
+    }
+  }
+}
+
+int cs_dtoa(char *buf, size_t buf_size, double v) {
+  char tmp[CS_DTOA_BUF_SIZE], digits[20], *p = tmp;
+  const char *s = NULL;
+  uint64_t u;
+  int len, n, K, i;
+
+  memcpy(&u, &v, sizeof(u));
+  if (((u >> 52) & 0x7ff) == 0x7ff) {
+    if (u & (((uint64_t) 1 << 52) - 1)) {
+      s = "NaN";
+    } else {
+      s = (u >> 63) ? "-Infinity" : "Infinity";
+    }
+  } else if (v == 0) {
+    /* Both 0 and -0 are printed as `0` */
+    s = "0";
+  }
+  if (s != NULL) {
+    len = strlen(s);
+    memcpy(tmp, s, len);
+    p += len;
+    goto out;
+  }
+
+  if (v < 0) {
+    *p++ = '-';
+    v = -v;
+  }
+
+  if (v < 9007199254740992.0 && v == (double) (uint64_t) v) {
+    /* Integers up to 2^53 are printed exactly, digit by digit */
+    uint64_t x = (uint64_t) v;
+    for (len = 0; x != 0; x /= 10) {
+      digits[len++] = (char) ('0' + x % 10);
+    }
+    while (len > 0) *p++ = digits[--len];
+    goto out;
+  }
+
+  len = cs_grisu2(v, digits, &K);
+  /* The value is 0.<digits> * 10^n */
+  n = len + K;
+  if (len <= n && n <= 21) {
+    memcpy(p, digits, len);
+    p += len;
+    for (i = len; i < n; i++) *p++ = '0';
+  } else if (0 < n && n <= 21) {
+    memcpy(p, digits, n);
+    p += n;
+    *p++ = '.';
+    memcpy(p, digits + n, len - n);
+    p += len - n;
+  } else if (-6 < n && n <= 0) {
+    *p++ = '0';
+    *p++ = '.';
+    for (i = n; i < 0; i++) *p++ = '0';
+    memcpy(p, digits, len);
+    p += len;
+  } else {
+    *p++ = digits[0];
+    if (len > 1) {
+      *p++ = '.';
+      memcpy(p, digits + 1, len - 1);
+      p += len - 1;
+    }
+    *p++ = 'e';
+    *p++ = n - 1 < 0 ? '-' : '+';
+    n = n - 1 < 0 ? 1 - n : n - 1;
+    if (n >= 100) *p++ = (char) ('0' + n / 100);
+    if (n >= 10) *p++ = (char) ('0' + n / 10 % 10);
+    *p++ = (char) ('0' + n % 10);
+  }
+
+out:
+  len = p - tmp;
+  if (buf_size > 0) {
+    n = (size_t) len < buf_size ? len : (int) buf_size - 1;
+    memcpy(buf, tmp, n);
+    buf[n] = '\0';
+  }
+  return len;
+}
+
+double cs_strtod(const char *s, char **endptr) {
+  /* Powers of ten which are exactly representable as doubles */
+  static const double exact_pow10[] = {
+      1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+      1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+  };
+  const uint64_t max_exact = (uint64_t) 1 << 53;
+  const char *p = s;
+  uint64_t m = 0;
+  int neg = 0, exp10 = 0, nd = 0, has_digits = 0;
+  double d;
+
+  if (*p == '-' || *p == '+') neg = (*p++ == '-');
+
+  /* Hex, octal and binary prefixes are up to the C library */
+  if (p[0] == '0' && isalnum((unsigned char) p[1]) && (p[1] | 0x20) != 'e') {
+    goto slow;
+  }
+
+  for (; *p >= '0' && *p <= '9'; p++) {
+    has_digits = 1;
+    if (m == 0 && *p == '0') continue;
+    if (nd++ >= 19) goto slow;
+    m = m * 10 + (*p - '0');
+  }
+  if (*p == '.') {
+    for (p++; *p >= '0' && *p <= '9'; p++) {
+      has_digits = 1;
+      exp10--;
+      if (m == 0 && *p == '0') continue;
+      if (nd++ >= 19) goto slow;
+      m = m * 10 + (*p - '0');
+    }
+  }
+  if (!has_digits) goto slow;
+
+  if ((*p | 0x20) == 'e') {
+    const char *q = p + 1;
+    int eneg = 0, e = 0;
+    if (*q == '-' || *q == '+') eneg = (*q++ == '-');
+    if (*q >= '0' && *q <= '9') {
+      for (; *q >= '0' && *q <= '9'; q++) {
+        if (e < 10000) e = e * 10 + (*q - '0');
+      }
+      exp10 += eneg ? -e : e;
+      p = q;
+    }
+  }
+
+  /*
+   * When both the mantissa and the power of ten are exact, a single IEEE
+   * multiplication or division gives the correctly rounded result.
+   */
+  if (m == 0) {
+    d = 0.0;
+  } else if (m > max_exact || exp10 < -22 || exp10 > 22 + 15) {
+    goto slow;
+  } else if (exp10 < 0) {
+    d = (double) m / exact_pow10[-exp10];
+  } else {
+    for (; exp10 > 22; exp10--) {
+      m *= 10;
+      if (m > max_exact) goto slow;
+    }
+    d = (double) m * exact_pow10[exp10];
+  }
+
+  if (endptr != NULL) *endptr = (char *) p;
+  return neg ? -d : d;
+
+slow:
+  return strtod(s, endptr);
+}
+
 #endif /* EXCLUDE_COMMON */
@@ -22,6 +22,27 @@ int c_vsnprintf(char *buf, size_t buf_size, const char *format, va_list ap);
  */
 const char *c_strnstr(const char *s, const char *find, size_t slen);
 
+/* Buffer size which is always enough for `cs_dtoa()`, including the NUL */
+#define CS_DTOA_BUF_SIZE 26
+
+/*
+ * Format `v` using the shortest decimal representation that reads back as
+ * the same double, laid out like ECMAScript's `Number.prototype.toString()`
+ * (e.g. `0.1`, `1e+21`, `-1.5e-7`, `NaN`, `Infinity`).
+ *
+ * Behaves like `snprintf()`: the output is NUL-terminated if `buf_size` is
+ * not zero, and the return value is the length of the full representation.
+ */
+int cs_dtoa(char *buf, size_t buf_size, double v);
+
+/*
+ * Drop-in replacement for `strtod()`. Plain decimal numbers whose digits fit
+ * into 53 bits and whose exponent is small are converted exactly without
+ * calling libc; everything else (hex, `inf`, leading spaces, very long or
+ * very large numbers) is passed on to `strtod()`.
+ */
+double cs_strtod(const char *s, char **endptr);
+
 #ifdef __cplusplus
 }
 #endif
@@ -5,6 +5,8 @@
 
 #ifdef CS_ENABLE_UBJSON
 
+#include <float.h>
+
 #include "common/ubjson.h"
 
 void cs_ubjson_emit_null(struct mbuf *buf) {
@@ -100,10 +102,17 @@ void cs_ubjson_emit_float64(struct mbuf *buf, double v) {
   mbuf_append(buf, b, 1 + sizeof(uint64_t));
 }
 
+/*
+ * Emit `v` using the shortest encoding that decodes to exactly the same
+ * value: an integer if it is integral, a float32 if no bits are lost,
+ * float64 otherwise.
+ */
 void cs_ubjson_emit_autonumber(struct mbuf *buf, double v) {
-  int64_t i = (int64_t) v;
-  if ((double) i == v) {
-    cs_ubjson_emit_autoint(buf, i);
+  if (v >= -9223372036854775808.0 && v < 9223372036854775808.0 &&
+      (double) (int64_t) v == v) {
+    cs_ubjson_emit_autoint(buf, (int64_t) v);
+  } else if (v >= -FLT_MAX && v <= FLT_MAX && (double) (float) v == v) {
+    cs_ubjson_emit_float32(buf, (float) v);
   } else {
     cs_ubjson_emit_float64(buf, v);
   }
@@ -38,8 +38,61 @@ static const char *test_c_snprintf(void) {
   return NULL;
 }
 
+static const char *test_cs_dtoa(void) {
+  char buf[CS_DTOA_BUF_SIZE];
+
+  ASSERT_EQ(cs_dtoa(buf, sizeof(buf), 0.1), 3);
+  ASSERT_STREQ(buf, "0.1");
+  cs_dtoa(buf, sizeof(buf), 0.1 + 0.2);
+  ASSERT_STREQ(buf, "0.30000000000000004");
+  cs_dtoa(buf, sizeof(buf), -0.0);
+  ASSERT_STREQ(buf, "0");
+  cs_dtoa(buf, sizeof(buf), -123456789.0);
+  ASSERT_STREQ(buf, "-123456789");
+  cs_dtoa(buf, sizeof(buf), 1e21);
+  ASSERT_STREQ(buf, "1e+21");
+  cs_dtoa(buf, sizeof(buf), 123e18);
+  ASSERT_STREQ(buf, "123000000000000000000");
+  cs_dtoa(buf, sizeof(buf), 0.000001);
+  ASSERT_STREQ(buf, "0.000001");
+  cs_dtoa(buf, sizeof(buf), 1.5e-7);
+  ASSERT_STREQ(buf, "1.5e-7");
+  cs_dtoa(buf, sizeof(buf), 5e-324);
+  ASSERT_STREQ(buf, "5e-324");
+  ASSERT_EQ(cs_dtoa(buf, sizeof(buf), -1.7976931348623157e308), 24);
+  ASSERT_STREQ(buf, "-1.7976931348623157e+308");
+  cs_dtoa(buf, sizeof(buf), 1.0 / 0.0);
+  ASSERT_STREQ(buf, "Infinity");
+
+  memset(buf, 'x', sizeof(buf));
+  ASSERT_EQ(cs_dtoa(buf, 3, 3.14159), 7);
+  ASSERT_STREQ(buf, "3.");
+
+  return NULL;
+}
+
+static const char *test_cs_strtod(void) {
+  const char *nums[] = {
+      "0.1", "-2.5e-3", "1e22", "9007199254740993", "1e+300", ".5", "5.",
+      "1e", "0x1f", "017", " 12", "4.9e-324", "-0",
+      "123456789012345678901234567890",
+  };
+  size_t i;
+
+  for (i = 0; i < sizeof(nums) / sizeof(nums[0]); i++) {
+    char *e1, *e2;
+    double a = cs_strtod(nums[i], &e1), b = strtod(nums[i], &e2);
+    ASSERT(memcmp(&a, &b, sizeof(a)) == 0);
+    ASSERT(e1 == e2);
+  }
+
+  return NULL;
+}
+
 static const char *run_tests(const char *filter, double *total_elapsed) {
   RUN_TEST(test_c_snprintf);
+  RUN_TEST(test_cs_dtoa);
+  RUN_TEST(test_cs_strtod);
   return NULL;
 }
 
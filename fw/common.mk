@@ -1,6 +1,6 @@
 CFLAGS_EXTRA ?=
 
-COMMON_V7_FEATURES = -DV7_ENABLE__File__require=1
+COMMON_V7_FEATURES = -DV7_ENABLE__File__require=1 -DV7_ENABLE__ArrayBuffer=1
 
 MG_FEATURES_TINY = \
                    -DMG_DISABLE_JSON_RPC \
@@ -199,6 +199,42 @@ static void upload_handler(struct mg_connection *c, int ev, void *p) {
   mg_file_upload_handler(c, ev, p, upload_fname);
 }
 
+#if !defined(CS_DISABLE_JS) && defined(V7_ENABLE_PROFILER)
+static struct v7 *s_profiled_v7;
+
+/*
+ * Replies with JS stacks collected by the sampling profiler, as collapsed
+ * stacks for flame graph tools. With `?interval=N`, (re)starts sampling every
+ * N microseconds of CPU time, or stops it if N is 0, instead.
+ */
+static void profile_handler(struct mg_connection *c, int ev, void *p) {
+  struct http_message *hm = (struct http_message *) p;
+  struct v7 *v7 = s_profiled_v7;
+  char interval[16];
+  if (ev != MG_EV_HTTP_REQUEST) return;
+  LOG(LL_DEBUG, ("Profile requested"));
+  if (mg_get_http_var(&hm->query_string, "interval", interval,
+                      sizeof(interval)) > 0) {
+    int status = 0;
+    if (atoi(interval) > 0) {
+      status = v7_profiler_start(v7, atoi(interval));
+    } else {
+      v7_profiler_stop(v7);
+    }
+    mg_send_head(c, status == 0 ? 200 : 500, -1, JSON_HEADERS);
+    mg_printf_http_chunk(c, "{\"status\": %d}\n", status);
+    mg_printf_http_chunk(c, ""); /* Zero chunk - end of response */
+  } else {
+    size_t len = 0;
+    char *stacks = v7_profiler_dump(v7, &len);
+    mg_send_head(c, 200, len, "Connection: close\r\nContent-Type: text/plain");
+    mg_send(c, stacks, len);
+    free(stacks);
+  }
+  c->flags |= MG_F_SEND_AND_CLOSE;
+}
+#endif
+
 static void mongoose_ev_handler(struct mg_connection *c, int ev, void *p) {
   LOG(LL_VERBOSE_DEBUG,
       ("%p ev %d p %p fl %lx l %lu %lu", c, ev, p, c->flags,
@@ -239,7 +275,7 @@ void device_register_http_endpoint(const char *uri,
   }
 }
 
-static int init_web_server(const struct sys_config *cfg) {
+static int init_web_server(struct v7 *v7, const struct sys_config *cfg) {
   /*
    * Usually, we start to connect/listen in
    * EVENT_STAMODE_GOT_IP/EVENT_SOFTAPMODE_STACONNECTED  handlers
@@ -264,6 +300,12 @@ static int init_web_server(const struct sys_config *cfg) {
     mg_register_http_endpoint(listen_conn, "/reboot", reboot_handler);
     mg_register_http_endpoint(listen_conn, "/ro_vars", ro_vars_handler);
     mg_register_http_endpoint(listen_conn, "/upload", upload_handler);
+#if !defined(CS_DISABLE_JS) && defined(V7_ENABLE_PROFILER)
+    s_profiled_v7 = v7;
+    mg_register_http_endpoint(listen_conn, "/debug/profile", profile_handler);
+#else
+    (void) v7;
+#endif
 
     mg_set_protocol_http_websocket(listen_conn);
     LOG(LL_INFO, ("HTTP server started on [%s]", cfg->http.listen_addr));
@@ -353,7 +395,7 @@ int init_device(struct v7 *v7) {
   result = device_init_platform(v7, get_cfg());
   if (result != 0) {
     if (get_cfg()->http.enable) {
-      result = init_web_server(get_cfg());
+      result = init_web_server(v7, get_cfg());
     }
   } else {
     LOG(LL_ERROR, ("Platform init failed"));
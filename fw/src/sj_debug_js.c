@@ -3,6 +3,8 @@
  * All rights reserved
  */
 
+#include <stdlib.h>
+
 #include "v7/v7.h"
 #include "sj_debug_js.h"
 #include "sj_debug.h"
@@ -53,6 +55,153 @@ SJ_PRIVATE enum v7_err Debug_print(struct v7 *v7, v7_val_t *res) {
   return V7_OK;
 }
 
+#ifdef V7_ENABLE_PROFILER
+/*
+ * Sampling profiler of JS code:
+ * `Debug.profile(interval)` starts sampling JS stacks every `interval`
+ * microseconds of CPU time (0 stops it) and returns whether it succeeded;
+ * `Debug.profile()` returns the stacks collected so far as collapsed stacks,
+ * which flame graph tools take as input.
+ */
+SJ_PRIVATE enum v7_err Debug_profile(struct v7 *v7, v7_val_t *res) {
+  unsigned long argc;
+  const v7_val_t *argv = v7_argv(v7, &argc);
+
+  if (argc > 0) {
+    double interval;
+    if (!v7_is_number(argv[0])) {
+      printf("Interval is not a number\n");
+      *res = v7_mk_boolean(v7, 0);
+      return V7_OK;
+    }
+    interval = v7_get_double(v7, argv[0]);
+    if (interval >= 1) {
+      *res = v7_mk_boolean(v7, v7_profiler_start(v7, interval) == 0);
+    } else {
+      v7_profiler_stop(v7);
+      *res = v7_mk_boolean(v7, 1);
+    }
+  } else {
+    size_t len;
+    char *stacks = v7_profiler_dump(v7, &len);
+    *res = (stacks != NULL ? v7_mk_string(v7, stacks, len, 1) : V7_UNDEFINED);
+    free(stacks);
+  }
+
+  return V7_OK;
+}
+#endif
+
+#ifdef V7_ENABLE_STATS
+/* Sets `obj[name] = count` for each nonzero item of a per-item metric */
+static void sj_set_exec_stat_items(struct v7 *v7, v7_val_t obj,
+                                   enum v7_exec_stat_what what, int n) {
+  int nops = v7_exec_stat(v7, V7_EXEC_STAT_OPCODES, 0);
+  int i;
+
+  for (i = 0; i < n; i++) {
+    unsigned long count = v7_exec_stat(v7, what, i);
+    char name[64];
+    if (count == 0) continue;
+    if (what == V7_EXEC_STAT_OP_PAIR) {
+      snprintf(name, sizeof(name), "%s %s", v7_exec_stat_op_name(i / nops),
+               v7_exec_stat_op_name(i % nops));
+    } else if (what == V7_EXEC_STAT_CFUNC) {
+      snprintf(name, sizeof(name), "%s", v7_exec_stat_cfunc_name(v7, i));
+    } else {
+      snprintf(name, sizeof(name), "%s", v7_exec_stat_op_name(i));
+    }
+    v7_set(v7, obj, name, ~0, v7_mk_number(v7, count));
+  }
+}
+
+/*
+ * Returns an object with the execution counters of the interpreter:
+ *
+ * ops: number of instructions executed
+ * opcodes: instructions executed, by opcode
+ * op_pairs: pairs of consecutive instructions executed, e.g. "GET_VAR CALL"
+ * prop_lookups: property lookups not served by inline caches
+ * prop_lookup_steps: objects visited by these lookups
+ * prop_lookup_depths: lookups by the number of objects visited, from 1
+ * cfunc_calls: calls of C functions
+ * cfuncs: calls of C functions, by name like "Math.max"
+ * gc_cycles, gc_steps: full collections and incremental GC steps
+ * gc_time_us: time spent collecting garbage, microseconds
+ */
+SJ_PRIVATE enum v7_err Debug_stats(struct v7 *v7, v7_val_t *res) {
+  int nops = v7_exec_stat(v7, V7_EXEC_STAT_OPCODES, 0);
+  int ndepths = v7_exec_stat(v7, V7_EXEC_STAT_PROP_LOOKUP_DEPTHS, 0);
+  /* take a snapshot of the stats that would change as we populate the result */
+  unsigned long lookups = v7_exec_stat(v7, V7_EXEC_STAT_PROP_LOOKUPS, 0);
+  unsigned long steps = v7_exec_stat(v7, V7_EXEC_STAT_PROP_LOOKUP_STEPS, 0);
+  v7_val_t depths = v7_mk_array(v7), items = V7_UNDEFINED;
+  int i;
+
+  for (i = 0; i < ndepths; i++) {
+    unsigned long n = v7_exec_stat(v7, V7_EXEC_STAT_PROP_LOOKUP_DEPTH, i);
+    v7_array_push(v7, depths, v7_mk_number(v7, n));
+  }
+
+  *res = v7_mk_object(v7);
+  v7_set(v7, *res, "ops", ~0,
+         v7_mk_number(v7, v7_exec_stat(v7, V7_EXEC_STAT_OPS, 0)));
+  items = v7_mk_object(v7);
+  v7_set(v7, *res, "opcodes", ~0, items);
+  sj_set_exec_stat_items(v7, items, V7_EXEC_STAT_OP, nops);
+  items = v7_mk_object(v7);
+  v7_set(v7, *res, "op_pairs", ~0, items);
+  sj_set_exec_stat_items(v7, items, V7_EXEC_STAT_OP_PAIR, nops * nops);
+
+  v7_set(v7, *res, "prop_lookups", ~0, v7_mk_number(v7, lookups));
+  v7_set(v7, *res, "prop_lookup_steps", ~0, v7_mk_number(v7, steps));
+  v7_set(v7, *res, "prop_lookup_depths", ~0, depths);
+
+  v7_set(v7, *res, "cfunc_calls", ~0,
+         v7_mk_number(v7, v7_exec_stat(v7, V7_EXEC_STAT_CFUNC_CALLS, 0)));
+  items = v7_mk_object(v7);
+  v7_set(v7, *res, "cfuncs", ~0, items);
+  sj_set_exec_stat_items(v7, items, V7_EXEC_STAT_CFUNC,
+                         v7_exec_stat(v7, V7_EXEC_STAT_CFUNCS, 0));
+
+  v7_set(v7, *res, "gc_cycles", ~0,
+         v7_mk_number(v7, v7_exec_stat(v7, V7_EXEC_STAT_GC_CYCLES, 0)));
+  v7_set(v7, *res, "gc_steps", ~0,
+         v7_mk_number(v7, v7_exec_stat(v7, V7_EXEC_STAT_GC_STEPS, 0)));
+  v7_set(v7, *res, "gc_time_us", ~0,
+         v7_mk_number(v7, v7_exec_stat(v7, V7_EXEC_STAT_GC_TIME_US, 0)));
+
+  return V7_OK;
+}
+
+/*
+ * Resets the counters returned by `Debug.stats()`
+ */
+SJ_PRIVATE enum v7_err Debug_resetStats(struct v7 *v7, v7_val_t *res) {
+  (void) res;
+  v7_exec_stat_reset(v7);
+  return V7_OK;
+}
+#endif
+
+#ifdef V7_ENABLE_HEAPLOG
+/*
+ * `Debug.heapLog(true)` starts logging the allocations made in the JS heap
+ * to stderr, along with the JS stacks which made them, and
+ * `Debug.heapLog(false)` stops it. Returns whether it succeeded. The log is
+ * meant for `tools/heaplog_viewer`.
+ */
+SJ_PRIVATE enum v7_err Debug_heapLog(struct v7 *v7, v7_val_t *res) {
+  if (v7_is_truthy(v7, v7_arg(v7, 0))) {
+    *res = v7_mk_boolean(v7, v7_heaplog_start(v7, stderr) == 0);
+  } else {
+    v7_heaplog_stop(v7);
+    *res = v7_mk_boolean(v7, 1);
+  }
+  return V7_OK;
+}
+#endif
+
 void sj_debug_api_setup(struct v7 *v7) {
   v7_val_t debug;
 
@@ -60,6 +209,16 @@ void sj_debug_api_setup(struct v7 *v7) {
   v7_set(v7, v7_get_global(v7), "Debug", 5, debug);
   v7_set_method(v7, debug, "mode", Debug_mode);
   v7_set_method(v7, debug, "print", Debug_print);
+#ifdef V7_ENABLE_PROFILER
+  v7_set_method(v7, debug, "profile", Debug_profile);
+#endif
+#ifdef V7_ENABLE_STATS
+  v7_set_method(v7, debug, "stats", Debug_stats);
+  v7_set_method(v7, debug, "resetStats", Debug_resetStats);
+#endif
+#ifdef V7_ENABLE_HEAPLOG
+  v7_set_method(v7, debug, "heapLog", Debug_heapLog);
+#endif
 
   v7_set(v7, debug, "OFF", 3, v7_mk_number(v7, DEBUG_MODE_OFF));
   v7_set(v7, debug, "OUT", 3, v7_mk_number(v7, DEBUG_MODE_STDOUT));
@@ -109,18 +109,18 @@ clean:
 }
 
 SJ_PRIVATE enum v7_err GPIO_setMode(struct v7 *v7, v7_val_t *res) {
-  v7_val_t pinv = v7_arg(v7, 0);
-  v7_val_t modev = v7_arg(v7, 1);
-  v7_val_t pullv = v7_arg(v7, 2);
+  unsigned long argc;
+  const v7_val_t *argv = v7_argv(v7, &argc);
   int pin, mode, pull;
 
-  if (!v7_is_number(pinv) || !v7_is_number(modev) || !v7_is_number(pullv)) {
+  if (argc < 3 || !v7_is_number(argv[0]) || !v7_is_number(argv[1]) ||
+      !v7_is_number(argv[2])) {
     printf("Invalid arguments\n");
     *res = V7_UNDEFINED;
   } else {
-    pin = v7_get_double(v7, pinv);
-    mode = v7_get_double(v7, modev);
-    pull = v7_get_double(v7, pullv);
+    pin = v7_get_double(v7, argv[0]);
+    mode = v7_get_double(v7, argv[1]);
+    pull = v7_get_double(v7, argv[2]);
     *res = v7_mk_boolean(v7, sj_gpio_set_mode(pin, (enum gpio_mode) mode,
                                               (enum gpio_pull_type) pull) == 0);
   }
@@ -129,21 +129,21 @@ SJ_PRIVATE enum v7_err GPIO_setMode(struct v7 *v7, v7_val_t *res) {
 }
 
 SJ_PRIVATE enum v7_err GPIO_write(struct v7 *v7, v7_val_t *res) {
-  v7_val_t pinv = v7_arg(v7, 0);
-  v7_val_t valv = v7_arg(v7, 1);
+  unsigned long argc;
+  const v7_val_t *argv = v7_argv(v7, &argc);
   int pin, val;
 
-  if (!v7_is_number(pinv)) {
+  if (argc < 1 || !v7_is_number(argv[0])) {
     printf("non-numeric pin\n");
     *res = V7_UNDEFINED;
   } else {
-    pin = v7_get_double(v7, pinv);
+    pin = v7_get_double(v7, argv[0]);
 
     /*
-     * We assume 0 if the value is "falsy",
+     * We assume 0 if the value is "falsy" or missing,
      * and 1 if the value is "truthy"
      */
-    val = !!v7_is_truthy(v7, valv);
+    val = argc > 1 && v7_is_truthy(v7, argv[1]);
 
     *res = v7_mk_boolean(
         v7, sj_gpio_write(pin, val ? GPIO_LEVEL_HIGH : GPIO_LEVEL_LOW) == 0);
@@ -153,14 +153,15 @@ SJ_PRIVATE enum v7_err GPIO_write(struct v7 *v7, v7_val_t *res) {
 }
 
 SJ_PRIVATE enum v7_err GPIO_read(struct v7 *v7, v7_val_t *res) {
-  v7_val_t pinv = v7_arg(v7, 0);
+  unsigned long argc;
+  const v7_val_t *argv = v7_argv(v7, &argc);
   int pin;
 
-  if (!v7_is_number(pinv)) {
+  if (argc < 1 || !v7_is_number(argv[0])) {
     printf("non-numeric pin\n");
     *res = V7_UNDEFINED;
   } else {
-    pin = v7_get_double(v7, pinv);
+    pin = v7_get_double(v7, argv[0]);
     *res = v7_mk_number(v7, sj_gpio_read(pin));
   }
 
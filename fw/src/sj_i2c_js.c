@@ -62,6 +62,7 @@
  * Args:
  *   data: data to send. If "data" is a number between 0 and 255, a single byte
  *   is sent. If "data" is a string, all bytes from the string are sent.
+ *   Likewise for an ArrayBuffer or a typed array.
  *
  * Returns:
  *   Acknowledgement sent by the receiver or I2C.ERR if an error occured.
@@ -144,20 +145,20 @@ SJ_PRIVATE enum v7_err i2cjs_start(struct v7 *v7, v7_val_t *res) {
   enum i2c_rw mode;
   i2c_connection conn;
   v7_val_t this_obj = v7_get_this(v7);
-  v7_val_t addr_val = v7_arg(v7, 0);
-  v7_val_t mode_val = v7_arg(v7, 1);
+  unsigned long argc;
+  const v7_val_t *argv = v7_argv(v7, &argc);
 
   if ((conn = i2cjs_get_conn(v7, this_obj)) == NULL) {
     *res = v7_mk_number(v7, I2C_NONE);
     goto clean;
   }
 
-  if (v7_argc(v7) != 2 || !v7_is_number(addr_val) || !v7_is_number(mode_val)) {
+  if (argc != 2 || !v7_is_number(argv[0]) || !v7_is_number(argv[1])) {
     *res = v7_mk_number(v7, I2C_NONE);
     goto clean;
   }
-  addr = v7_get_double(v7, addr_val);
-  mode = (v7_get_double(v7, mode_val) == I2C_READ ? I2C_READ : I2C_WRITE);
+  addr = v7_get_double(v7, argv[0]);
+  mode = (v7_get_double(v7, argv[1]) == I2C_READ ? I2C_READ : I2C_WRITE);
   *res = v7_mk_number(v7, i2c_start(conn, addr, mode));
   goto clean;
 
@@ -201,6 +202,14 @@ SJ_PRIVATE enum v7_err i2cjs_send(struct v7 *v7, v7_val_t *res) {
   } else if (v7_is_string(data_val)) {
     const char *data = v7_get_string(v7, &data_val, &len);
     result = i2c_send_bytes(conn, (uint8_t *) data, len);
+#if V7_ENABLE__ArrayBuffer
+  } else {
+    /* ArrayBuffer or a view of it: the bytes are sent in place */
+    uint8_t *data = (uint8_t *) v7_get_array_buffer_data(v7, data_val, &len);
+    if (data != NULL) {
+      result = i2c_send_bytes(conn, data, len);
+    }
+#endif
   }
 
   *res = v7_mk_number(v7, result);
@@ -215,19 +224,20 @@ SJ_PRIVATE enum v7_err i2cjs_readByte(struct v7 *v7, v7_val_t *res) {
   v7_val_t this_obj = v7_get_this(v7);
   enum i2c_ack_type ack_type = I2C_ACK;
   i2c_connection conn;
+  unsigned long argc;
+  const v7_val_t *argv = v7_argv(v7, &argc);
 
   if ((conn = i2cjs_get_conn(v7, this_obj)) == NULL) {
     *res = v7_mk_number(v7, I2C_NONE);
     goto clean;
   }
 
-  if (v7_argc(v7) > 0) {
-    v7_val_t ack_val = v7_arg(v7, 0);
-    if (!v7_is_number(ack_val)) {
+  if (argc > 0) {
+    if (!v7_is_number(argv[0])) {
       *res = v7_mk_number(v7, -1);
       goto clean;
     }
-    ack_type = (enum i2c_ack_type) v7_get_double(v7, ack_val);
+    ack_type = (enum i2c_ack_type) v7_get_double(v7, argv[0]);
     if (ack_type != I2C_ACK && ack_type != I2C_NAK && ack_type != I2C_NONE) {
       *res = v7_mk_number(v7, -1);
       goto clean;
@@ -244,7 +254,9 @@ SJ_PRIVATE enum v7_err i2cjs_readString(struct v7 *v7, v7_val_t *res) {
   enum v7_err rcode = V7_OK;
   v7_val_t this_obj = v7_get_this(v7);
   i2c_connection conn;
-  v7_val_t len_val = v7_arg(v7, 0);
+  unsigned long argc;
+  const v7_val_t *argv = v7_argv(v7, &argc);
+  v7_val_t len_val = argc > 0 ? argv[0] : v7_mk_undefined();
   size_t tmp;
   enum i2c_ack_type ack_type = I2C_ACK;
   const char *str;
@@ -259,13 +271,12 @@ SJ_PRIVATE enum v7_err i2cjs_readString(struct v7 *v7, v7_val_t *res) {
     goto clean;
   }
 
-  if (v7_argc(v7) > 1) {
-    v7_val_t ack_val = v7_arg(v7, 1);
-    if (!v7_is_number(ack_val)) {
+  if (argc > 1) {
+    if (!v7_is_number(argv[1])) {
       *res = v7_mk_string(v7, "", 0, 1);
       goto clean;
     }
-    ack_type = (enum i2c_ack_type) v7_get_double(v7, ack_val);
+    ack_type = (enum i2c_ack_type) v7_get_double(v7, argv[1]);
     if (ack_type != I2C_ACK && ack_type != I2C_NAK && ack_type != I2C_NONE) {
       *res = v7_mk_string(v7, "", 0, 1);
       goto clean;
@@ -69,7 +69,8 @@ SJ_PRIVATE enum v7_err spi_js_txn(struct v7 *v7, v7_val_t *res) {
   enum v7_err rcode = V7_OK;
   v7_val_t this_obj = v7_get_this(v7);
   uint32_t params[8], ires;
-  int i;
+  unsigned long i, argc;
+  const v7_val_t *argv = v7_argv(v7, &argc);
 
   spi_connection conn;
   if ((conn = spijs_get_conn(v7, this_obj)) == NULL) {
@@ -77,13 +78,17 @@ SJ_PRIVATE enum v7_err spi_js_txn(struct v7 *v7, v7_val_t *res) {
     goto clean;
   }
 
+  if (argc < 8) {
+    *res = v7_mk_number(v7, -1);
+    goto clean;
+  }
+
   for (i = 0; i < 8; i++) {
-    v7_val_t tmp = v7_arg(v7, i);
-    if (!v7_is_number(tmp)) {
+    if (!v7_is_number(argv[i])) {
       *res = v7_mk_number(v7, -1);
       goto clean;
     }
-    params[i] = v7_get_double(v7, tmp);
+    params[i] = v7_get_double(v7, argv[i]);
   }
 
   ires = spi_txn(conn, params[0], params[1], params[2], params[3], params[4],
@@ -13,18 +13,18 @@
 #ifndef CS_DISABLE_JS
 SJ_PRIVATE enum v7_err sj_set_interval_or_timeout(struct v7 *v7, v7_val_t *res,
                                                   int repeat) {
-  v7_val_t msecsv = v7_arg(v7, 1);
+  unsigned long argc;
+  const v7_val_t *argv = v7_argv(v7, &argc);
   int msecs;
   (void) res;
 
-  if (!v7_is_callable(v7, v7_arg(v7, 0))) {
+  if (argc < 1 || !v7_is_callable(v7, argv[0])) {
     printf("cb is not a function\n");
-  } else if (!v7_is_number(msecsv)) {
+  } else if (argc < 2 || !v7_is_number(argv[1])) {
     printf("msecs is not a number\n");
   } else {
-    v7_val_t cb = v7_arg(v7, 0);
-    msecs = v7_get_double(v7, msecsv);
-    *res = v7_mk_number(v7, sj_set_js_timer(msecs, repeat, v7, cb));
+    msecs = v7_get_double(v7, argv[1]);
+    *res = v7_mk_number(v7, sj_set_js_timer(msecs, repeat, v7, argv[0]));
   }
 
   return V7_OK;
@@ -40,9 +40,11 @@ SJ_PRIVATE enum v7_err global_setInterval(struct v7 *v7, v7_val_t *res) {
 
 SJ_PRIVATE enum v7_err global_clearTimeoutOrInterval(struct v7 *v7,
                                                      v7_val_t *res) {
+  unsigned long argc;
+  const v7_val_t *argv = v7_argv(v7, &argc);
   (void) res;
-  if (v7_is_number(v7_arg(v7, 0))) {
-    sj_clear_timer(v7_get_double(v7, v7_arg(v7, 0)));
+  if (argc > 0 && v7_is_number(argv[0])) {
+    sj_clear_timer(v7_get_double(v7, argv[0]));
   }
   return V7_OK;
 }
@@ -87,6 +87,7 @@ struct cb_info_holder {
 #define UD_F_FOREIGN_SOCK (1 << 4)
 #define UD_F_CLOSE (1 << 5)
 #define UD_F_FORCE_RECV (1 << 6)
+#define UD_F_BINARY (1 << 7)
 
 struct conn_user_data {
   struct v7 *v7;
@@ -157,6 +158,9 @@ static struct conn_user_data *create_conn_user_data(struct v7 *v7,
 static enum v7_err val_to_void(struct v7 *v7, v7_val_t *val, void **buf,
                                int *len, int *free_after_use) {
   enum v7_err rcode = V7_OK;
+#if V7_ENABLE__ArrayBuffer
+  size_t n;
+#endif
   *buf = NULL;
 
   if (v7_is_string(*val)) {
@@ -164,6 +168,12 @@ static enum v7_err val_to_void(struct v7 *v7, v7_val_t *val, void **buf,
     *buf = (void *) v7_get_cstring(v7, val);
     *len = strlen((char *) *buf);
     *free_after_use = 0;
+#if V7_ENABLE__ArrayBuffer
+  } else if ((*buf = v7_get_array_buffer_data(v7, *val, &n)) != NULL) {
+    /* ArrayBuffer or a view of it: the bytes are used in place */
+    *len = n;
+    *free_after_use = 0;
+#endif
   } else if (v7_is_array(v7, *val)) {
     /* Convert JS array to void* with the most stupid way */
     int i;
@@ -188,7 +198,7 @@ static enum v7_err val_to_void(struct v7 *v7, v7_val_t *val, void **buf,
     }
   } else {
     rcode =
-        v7_throwf(v7, "Error", "Data should be either byte array or string");
+        v7_throwf(v7, "Error", "Data should be byte array, buffer or string");
   }
 
   return V7_OK;
@@ -261,6 +271,42 @@ static int trigger_event(struct v7 *v7, struct cb_info_holder *list,
   return ret;
 }
 
+static int has_event_handler(struct cb_info_holder *list, const char *name) {
+  struct cb_info *cb;
+  if (list == NULL) {
+    return 0;
+  }
+
+  SLIST_FOREACH(cb, &list->head, entries) {
+    if (strcmp(cb->name, name) == 0) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/*
+ * Makes the argument of `data` and `message` events out of received data.
+ * In binary mode (see `setEncoding()`) that's an `ArrayBuffer` which takes
+ * over the receive buffer without copying it; `io` is left empty then.
+ */
+static v7_val_t mk_recv_data(struct conn_user_data *ud,
+                             struct cb_info_holder *list, const char *name,
+                             struct mbuf *io) {
+#if V7_ENABLE__ArrayBuffer
+  if (ud->flags & UD_F_BINARY && has_event_handler(list, name)) {
+    v7_val_t ret = v7_mk_array_buffer_external(ud->v7, io->buf, io->len, free);
+    mbuf_init(io, 0);
+    return ret;
+  }
+#else
+  (void) list;
+  (void) name;
+#endif
+  return v7_mk_string(ud->v7, io->buf, io->len, 1);
+}
+
 static void free_obj_cb_info_chain(struct v7 *v7, v7_val_t obj) {
   v7_val_t cbh_v = v7_get(v7, obj, s_callbacks_prop, ~0);
   if (!v7_is_undefined(cbh_v)) {
@@ -489,6 +535,35 @@ static enum v7_err set_paused(struct v7 *v7, v7_val_t *res, int paused) {
   return V7_OK;
 }
 
+/*
+ * `null` encoding switches the socket to binary mode, where received data is
+ * passed to handlers as an `ArrayBuffer`. Any other encoding means strings,
+ * which is the default.
+ */
+static enum v7_err set_encoding(struct v7 *v7, v7_val_t *res) {
+  enum v7_err rcode = V7_OK;
+  struct mg_connection *c;
+  struct conn_user_data *ud;
+  rcode = get_connection(v7, v7_get_this(v7), &c);
+  if (rcode != V7_OK) {
+    return rcode;
+  }
+
+  ud = (struct conn_user_data *) c->user_data;
+  *res = v7_get_this(v7);
+  if (v7_is_null(v7_arg(v7, 0))) {
+#if V7_ENABLE__ArrayBuffer
+    ud->flags |= UD_F_BINARY;
+#else
+    rcode = v7_throwf(v7, "Error", "Binary data is not supported");
+#endif
+  } else {
+    ud->flags &= ~UD_F_BINARY;
+  }
+
+  return rcode;
+}
+
 static enum v7_err udp_tcp_close_conn(struct v7 *v7, v7_val_t *res,
                                       const char *ev_name) {
   enum v7_err rcode = V7_OK;
@@ -564,12 +639,12 @@ static void mg_ev_handler(struct mg_connection *c, int ev, void *ev_data) {
       }
 
       if (ud->flags & UD_F_FORCE_RECV && c->recv_mbuf.len != 0) {
+        struct cb_info_holder *cih =
+            get_cb_info_holder_or_null(ud->v7, ud->sock_obj);
         LOG(LL_VERBOSE_DEBUG, ("Forcing recv for conn %p", c));
-        if (trigger_event(
-                ud->v7, get_cb_info_holder_or_null(ud->v7, ud->sock_obj),
-                s_ev_data,
-                v7_mk_string(ud->v7, c->recv_mbuf.buf, c->recv_mbuf.len, 1),
-                V7_UNDEFINED)) {
+        if (trigger_event(ud->v7, cih, s_ev_data,
+                          mk_recv_data(ud, cih, s_ev_data, &c->recv_mbuf),
+                          V7_UNDEFINED)) {
           mbuf_remove(&c->recv_mbuf, c->recv_mbuf.len);
           ud->flags &= ~UD_F_FORCE_RECV;
         }
@@ -589,8 +664,9 @@ static void mg_ev_handler(struct mg_connection *c, int ev, void *ev_data) {
          * if there isn't existing "connection" for this sender
          * But right after it sends MG_EV_RECV, so, here we just copy user_data
          */
-        c->user_data =
-            create_conn_user_data(ud->v7, ud->sock_obj, UD_F_NO_OBJECT_CONN, 0);
+        c->user_data = create_conn_user_data(
+            ud->v7, ud->sock_obj,
+            UD_F_NO_OBJECT_CONN | (ud->flags & UD_F_BINARY), 0);
       } else {
         /*
          * For TCP we create new Socket object and send it to callback
@@ -626,12 +702,14 @@ static void mg_ev_handler(struct mg_connection *c, int ev, void *ev_data) {
     }
     case MG_EV_RECV: {
       int event_triggered;
+      struct cb_info_holder *cih;
       LOG(LL_VERBOSE_DEBUG, ("RECV %p", c));
       if (ud->flags & UD_F_PAUSED || c->recv_mbuf.len == 0) {
         return;
       }
 
       ud->flags &= ~UD_F_FORCE_RECV;
+      cih = get_cb_info_holder_or_null(ud->v7, ud->sock_obj);
 
       if (c->flags & MG_F_UDP) {
         char *addr = inet_ntoa(c->sa.sin.sin_addr);
@@ -641,14 +719,12 @@ static void mg_ev_handler(struct mg_connection *c, int ev, void *ev_data) {
                v7_mk_number(ud->v7, ntohs(c->sa.sin.sin_port)));
         LOG(LL_VERBOSE_DEBUG, ("Triggering `message`"));
         event_triggered = trigger_event(
-            ud->v7, get_cb_info_holder_or_null(ud->v7, ud->sock_obj),
-            s_ev_message,
-            v7_mk_string(ud->v7, c->recv_mbuf.buf, c->recv_mbuf.len, 1), rinfo);
+            ud->v7, cih, s_ev_message,
+            mk_recv_data(ud, cih, s_ev_message, &c->recv_mbuf), rinfo);
       } else {
         event_triggered = trigger_event(
-            ud->v7, get_cb_info_holder_or_null(ud->v7, ud->sock_obj), s_ev_data,
-            v7_mk_string(ud->v7, c->recv_mbuf.buf, c->recv_mbuf.len, 1),
-            V7_UNDEFINED);
+            ud->v7, cih, s_ev_data,
+            mk_recv_data(ud, cih, s_ev_data, &c->recv_mbuf), V7_UNDEFINED);
       }
 
       LOG(LL_VERBOSE_DEBUG, ("Triggered: %d", event_triggered));
@@ -1153,6 +1229,12 @@ clean:
   return rcode;
 }
 
+/* socket.setEncoding([encoding]) */
+SJ_PRIVATE enum v7_err DGRAM_Socket_setEncoding(struct v7 *v7,
+                                               v7_val_t *res) {
+  return set_encoding(v7, res);
+}
+
 /* socket.close([callback]) */
 SJ_PRIVATE enum v7_err DGRAM_Socket_close(struct v7 *v7, v7_val_t *res) {
   return udp_tcp_close_conn(v7, res, s_ev_close);
@@ -1408,6 +1490,11 @@ SJ_PRIVATE enum v7_err TCP_Socket_pause(struct v7 *v7, v7_val_t *res) {
   return set_paused(v7, res, 1);
 }
 
+/* socket.setEncoding([encoding]) */
+SJ_PRIVATE enum v7_err TCP_Socket_setEncoding(struct v7 *v7, v7_val_t *res) {
+  return set_encoding(v7, res);
+}
+
 /* socket.resume() */
 SJ_PRIVATE enum v7_err TCP_Socket_resume(struct v7 *v7, v7_val_t *res) {
   return set_paused(v7, res, 0);
@@ -1504,6 +1591,8 @@ void sj_udp_tcp_api_setup(struct v7 *v7) {
   v7_set_method(v7, dgram_socket_proto, "bind", DGRAM_Socket_bind);
   v7_set_method(v7, dgram_socket_proto, "close", DGRAM_Socket_close);
   v7_set_method(v7, dgram_socket_proto, "send", DGRAM_Socket_send);
+  v7_set_method(v7, dgram_socket_proto, "setEncoding",
+                DGRAM_Socket_setEncoding);
 
   v7_set(v7, dgram, s_dgram_socket_proto, ~0, dgram_socket_proto);
 
@@ -1565,12 +1654,12 @@ void sj_udp_tcp_api_setup(struct v7 *v7) {
   v7_set_method(v7, tcp_socket_proto, "end", TCP_Socket_end);
   v7_set_method(v7, tcp_socket_proto, "pause", TCP_Socket_pause);
   v7_set_method(v7, tcp_socket_proto, "resume", TCP_Socket_resume);
+  v7_set_method(v7, tcp_socket_proto, "setEncoding", TCP_Socket_setEncoding);
   v7_set_method(v7, tcp_socket_proto, "setTimeout", TCP_Socket_setTimeout);
   v7_set_method(v7, tcp_socket_proto, "write", TCP_Socket_write);
   v7_set_method(v7, tcp_socket_proto, "on", TCP_Socket_on);
   /*
    * Not implemented:
-   * socket.setEncoding([encoding])
    * socket.setKeepAlive([enable][, initialDelay])
    * socket.setNoDelay([noDelay])
    * socket.ref
@@ -17,11 +17,16 @@
 
   var OVERHEAD_BYTES_PER_ALLOC = 8;
 
+  /* Number of rows in the "top retainers by site" table */
+  var SITES_TOP = 20;
+
   var ItemType = {
     NONE: 0,
     MALLOC: 1,
     REALLOC: 2,
-    FREE: 3
+    FREE: 3,
+    JS_ALLOC: 4,
+    JS_FREE: 5
   }
 
   var AllocAction = {
@@ -271,11 +276,54 @@
     jQuery("#cur_alloc_cnt").attr("value", item.stat.allocCnt);
     jQuery("#cur_max_free_block_size").attr("value", item.stat.maxChunkSize);
 
+    guiSitesApply();
+
     // select log item
     $("#log_sel").val( logger.getItemIdx() );
     $("#log_sel").focus();
   }
 
+  /*
+   * Populates the "top retainers by site" table: JS allocation sites sorted
+   * by the number of bytes they hold at the current log item.
+   */
+  function guiSitesApply() {
+    var sitesTbl = jQuery("#sites_tbl")[0];
+    var siteStats = logger.getSiteStats();
+    var ids = Object.keys(siteStats).filter(function(id) {
+      return siteStats[id].cnt > 0;
+    });
+    var i;
+
+    ids.sort(function(a, b) {
+      return siteStats[b].size - siteStats[a].size;
+    });
+
+    while (sitesTbl.rows.length > 1) {
+      sitesTbl.deleteRow(1);
+    }
+
+    for (i = 0; i < ids.length && i < SITES_TOP; i++) {
+      var site = logger.getSite(ids[i]);
+      var tr = sitesTbl.insertRow();
+      tr.insertCell().appendChild(document.createTextNode(ids[i]));
+      tr.insertCell().appendChild(document.createTextNode(
+        site ? site.arena : "?"
+      ));
+      tr.insertCell().appendChild(document.createTextNode(
+        siteStats[ids[i]].cnt
+      ));
+      tr.insertCell().appendChild(document.createTextNode(
+        siteStats[ids[i]].size
+      ));
+      tr.insertCell().appendChild(document.createTextNode(
+        site ? site.stack.join(" → ") : "?"
+      ));
+    }
+
+    jQuery("#sites_none").toggle(ids.length == 0);
+  }
+
   function resetCell(cell) {
     cell.classList.remove("log_area_used");
     cell.classList.remove("log_area_shim");
@@ -371,12 +419,14 @@
     }
   }
 
-  function createLogger(heapStart, heapEnd, logItems, statTotal) {
+  function createLogger(heapStart, heapEnd, logItems, statTotal, sites) {
     var curItemIdx = 0;
     var allocMap = createAllocMap(heapStart, heapEnd, {
       calcStat: false,
       checkAddresses: DEBUG,
     });
+    /* live JS allocations by site id: count and bytes */
+    var siteStats = {};
     var i;
 
     return {
@@ -412,6 +462,13 @@
         return statTotal;
       },
 
+      getSite: function (id) {
+        return sites[id];
+      },
+      getSiteStats: function () {
+        return siteStats;
+      },
+
       setItemIdx: function (newItemIdx) {
         while (newItemIdx > curItemIdx) {
           forward();
@@ -441,6 +498,10 @@
         );
       } else if (item.type == ItemType.FREE) {
         guiDeltaItems.push(allocMap.free(item.addr, item));
+      } else if (item.type == ItemType.JS_ALLOC) {
+        applySiteStat(item, 1);
+      } else if (item.type == ItemType.JS_FREE) {
+        applySiteStat(item.itemWhichAllocated, -1);
       } else if (item.type == ItemType.NONE) {
         /* do nothing */
       } else {
@@ -467,6 +528,10 @@
         guiDeltaItems.push(
           allocMap.malloc(item.addr, item.size, item.shim, item.itemWhichAllocated)
         );
+      } else if (item.type == ItemType.JS_ALLOC) {
+        applySiteStat(item, -1);
+      } else if (item.type == ItemType.JS_FREE) {
+        applySiteStat(item.itemWhichAllocated, 1);
       } else if (item.type == ItemType.NONE) {
         /* do nothing */
       } else {
@@ -475,6 +540,22 @@
 
       curItemIdx--;
     }
+
+    /*
+     * Adds (`sign` is 1) or removes (`sign` is -1) the JS allocation made by
+     * `allocItem` to the stats of its site. `allocItem` is undefined for the
+     * objects allocated before the log was started.
+     */
+    function applySiteStat(allocItem, sign) {
+      if (allocItem) {
+        var stat = siteStats[allocItem.site];
+        if (!stat) {
+          stat = siteStats[allocItem.site] = {cnt: 0, size: 0};
+        }
+        stat.cnt += sign;
+        stat.size += sign * allocItem.size;
+      }
+    }
   }
 
   function parseLogLines(lines) {
@@ -490,11 +571,16 @@
     var curStat = new StatLocal();
 
     var i;
-    var hlog_regexp = new RegExp('hl\{(m|c|z|r|f)\,([a-zA-Z0-9_,]+)\}');
+    var hlog_regexp = new RegExp('hl\{(m|c|z|r|f|j|k)\,([a-zA-Z0-9_,]+)\}');
     var hlog_param_regexp = new RegExp('hlog_param\:(\{[^}]+\})');
     var hlog_calls_regexp = new RegExp('hcs\{([a-zA-Z0-9_ ]*)\}');
+    var hlog_site_regexp = new RegExp('hls\{([0-9]+)\,([^,]*)\,(.*)\}');
     var curCallsArray = emptyArray;
 
+    /* JS allocation sites by id, and live JS allocations by their ids */
+    var sites = {};
+    var jsAllocs = {};
+
     /*
      * Return call stack for an item, prepended by a comma (to be used in
      * `toString()`)
@@ -507,6 +593,13 @@
       }
     }
 
+    /* Returns the description of the site of a JS allocation */
+    var siteDescr = function(item) {
+      var site = sites[item.site];
+      return ", site #" + item.site
+        + (site ? ": " + site.stack.join(" → ") : "");
+    }
+
     /* push initial item */
     var item = new LogItemNone("--- init ---");
     item.stat = curStat;
@@ -557,6 +650,28 @@
       },
     };
 
+    LogItemJsAlloc.prototype = {
+      toString: function() {
+        return "#" + this.idx + " "
+        + "JS alloc: " + this.arena + " " + this.id + ", size: " + this.size
+        + siteDescr(this)
+        ;
+      },
+    };
+
+    LogItemJsFree.prototype = {
+      toString: function() {
+        var allocItem = this.itemWhichAllocated;
+        return "#" + this.idx + " "
+        + "JS free: " + this.id
+        + (allocItem
+          ? ", size: " + allocItem.size + " (by #" + allocItem.idx + ")"
+            + siteDescr(allocItem)
+          : "")
+        ;
+      },
+    };
+
     // parse all lines from device log
     for (i = 0; i < lines.length; i++) {
       parseLine(lines[i]);
@@ -567,7 +682,9 @@
       logItems[i].idx = i;
     }
 
-    return createLogger(heapStart, heapEnd, logItems, allocMap.getStatTotal());
+    return createLogger(
+      heapStart, heapEnd, logItems, allocMap.getStatTotal(), sites
+    );
 
 
 
@@ -609,11 +726,30 @@
       this.itemWhichAllocated = itemWhichAllocated;
     }
 
+    /*
+     * JS heap allocation made at the site `site`: `id` is the address of
+     * the cell, or `s<serial>` for owned strings
+     */
+    function LogItemJsAlloc(id, site, size) {
+      this.type = ItemType.JS_ALLOC;
+      this.id = id;
+      this.site = site;
+      this.size = size;
+      this.arena = sites[site] ? sites[site].arena : "?";
+    }
+
+    function LogItemJsFree(id, itemWhichAllocated) {
+      this.type = ItemType.JS_FREE;
+      this.id = id;
+      this.itemWhichAllocated = itemWhichAllocated;
+    }
+
     function parseLine(line) {
       var item = new LogItemNone();
 
       var match = line.match(hlog_regexp);
       var callsMatch = line.match(hlog_calls_regexp);
+      var siteMatch = line.match(hlog_site_regexp);
       if (match) {
         /* heap log item */
 
@@ -667,11 +803,29 @@
             alloc.item
           );
           delta = allocMap.free(data.ptr, item);
+        } else if (verb == 'j') {
+          /* allocation in the JS heap, which lives in the malloc-ed blocks */
+          var data = {
+            site: dataArr[0],
+            size: parseInt(dataArr[1]),
+            id: dataArr[2],
+          };
+          item = new LogItemJsAlloc(data.id, data.site, data.size);
+          jsAllocs[data.id] = item;
+        } else if (verb == 'k') {
+          /* JS heap allocation reclaimed by the GC */
+          var data = {
+            id: dataArr[0],
+          };
+          item = new LogItemJsFree(data.id, jsAllocs[data.id]);
+          delete jsAllocs[data.id];
         } else {
           throw Error("wrong heaplog verb: " + verb);
         }
 
-        curStat = delta.stat;
+        if (delta) {
+          curStat = delta.stat;
+        }
 
         /* If user text is not empty on this line, add separate item for it */
         var user_text = line.replace(hlog_regexp, '').trim();
@@ -696,6 +850,15 @@
         allocMap.setHeapStartEnd(heapStart, heapEnd);
 
         item.comment = line;
+      } else if (siteMatch){
+        /* JS allocation site, referred to by the following `j` items */
+        sites[siteMatch[1]] = {
+          arena: siteMatch[2],
+          stack: siteMatch[3].split(';'),
+        };
+
+        /* prevent adding current item to the array */
+        item = undefined;
       } else if (callsMatch){
         /* remember call stack, it will be set to the next heaplog item */
         curCallsArray = callsMatch[1].split(' ');
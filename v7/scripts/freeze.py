@@ -346,6 +346,16 @@ def vec(prefix, addr, buf):
     return vec_initializer(prefix, addr, data)
 
 
+def lines_vec(prefix, addr, buf):
+    '''
+    Dump the line number table, which is empty if the frozen build
+    didn't have line numbers.
+    '''
+    if not base64.decodestring(buf):
+        return "{NULL, 0}"
+    return vec(prefix, addr, buf)
+
+
 def lit_vec(prefix, addr, records):
     def val(r):
         if 'val' in r:
@@ -377,12 +387,17 @@ for b in bcodes:
     a = b["addr"]
     ops = vec("fops", a, b["ops"])
     lits = lit_vec("flits", a, b["lit"])
+    lines = lines_vec("flines", a, b.get("lines", ""))
     print ("static const struct bcode fbcode_%(addr)s"
            " = {%(ops)s, %(lits)s\n"
+           "#if !defined(V7_DISABLE_LINE_NUMBERS)\n"
+           ", %(lines)s\n"
+           "#endif\n"
            "#if !defined(V7_DISABLE_FILENAMES)\n"
            ", NULL\n"
            "#endif\n"
-           ", 0xff, %(names_cnt)s, %(args_cnt)s, %(strict_mode)s, 1, 1, 0, %(func_name_present)s\n"
+           ", 0xff, %(names_cnt)s, %(args_cnt)s, %(strict_mode)s, 1, 1, 0, %(func_name_present)s"
+           ", %(frame_slots)s, %(arguments_slot)s\n"
            "#if !defined(V7_DISABLE_FILENAMES)\n"
            ", 0\n"
            "#endif\n"
@@ -390,10 +405,13 @@ for b in bcodes:
         addr = b["addr"],
         ops = ops,
         lits = lits,
+        lines = lines,
         args_cnt = b["args_cnt"],
         names_cnt = b["names_cnt"],
         strict_mode = b["strict_mode"],
         func_name_present = b["func_name_present"],
+        frame_slots = b["frame_slots"],
+        arguments_slot = b["arguments_slot"],
     )
 
 for o in objs:
@@ -0,0 +1,810 @@
+/*
+ * Copyright (c) 2014 Cesanta Software Limited
+ * All rights reserved
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "common/test_util.h"
+#include "v7/v7.h"
+
+/* Evaluates `js` and compares the JSON representation of the result */
+static int check_js_json(struct v7 *v7, const char *js, const char *expected) {
+  v7_val_t res = V7_UNDEFINED;
+  char buf[256], *s;
+  int ok;
+
+  if (v7_exec(v7, js, &res) != V7_OK) {
+    v7_print_error(stdout, v7, js, res);
+    return 0;
+  }
+  s = v7_stringify(v7, res, buf, sizeof(buf), V7_STRINGIFY_JSON);
+  ok = _assert_streq(s, expected);
+  if (s != buf) {
+    free(s);
+  }
+  return ok;
+}
+
+#define ASSERT_EVAL_EQ(v7, js, expected) \
+  ASSERT(check_js_json(v7, js, expected))
+
+/*
+ * Inline caches must not return properties which were unlinked or renamed.
+ * The lookups are warmed up by the first script. A collection would drop
+ * the caches, so the arenas are large enough to need none.
+ */
+static const char *test_inline_cache(void) {
+  struct v7_create_opts opts;
+  struct v7 *v7;
+  v7_val_t res;
+
+  memset(&opts, 0, sizeof(opts));
+  opts.object_arena_size = opts.function_arena_size =
+      opts.property_arena_size = 10000;
+  v7 = v7_create_opt(opts);
+
+  /* elements removed and renamed by `splice()` */
+  ASSERT_EQ(v7_exec(v7,
+                    "var b = []; b[1000] = 'x'; b[2000] = 'z'; b.bar = 1;"
+                    "function rb(k) { return b[k]; }"
+                    "rb('1000'); rb('1000'); rb('2000'); rb('2000');",
+                    &res),
+            V7_OK);
+  ASSERT_EVAL_EQ(v7,
+                 "b.splice(999, 5);"
+                 "[String(rb('1000')), String(b[1000]), String(rb('2000')),"
+                 " b[1995]]",
+                 "[\"undefined\",\"undefined\",\"undefined\",\"z\"]");
+
+  /* elements removed by truncating `length`; only own setters are called */
+  ASSERT_EQ(v7_exec(v7,
+                    "var P = Array.prototype; P.length = 100;"
+                    "P[9] = 'a'; P[50] = 'x'; P.q = 1;"
+                    "function rp(k) { return P[k]; }"
+                    "rp('50'); rp('50');",
+                    &res),
+            V7_OK);
+  ASSERT_EVAL_EQ(v7, "P.length = 10; [String(rp('50')), String(P[50])]",
+                 "[\"undefined\",\"undefined\"]");
+  ASSERT_EVAL_EQ(v7, "P.length = 0; delete P.q; String(P[9]) + String(P.q)",
+                 "\"undefinedundefined\"");
+
+  /* deleted property */
+  ASSERT_EQ(v7_exec(v7,
+                    "var o = {p: 1, q: 2}; function ro() { return o.p; }"
+                    "ro(); ro();",
+                    &res),
+            V7_OK);
+  ASSERT_EVAL_EQ(v7, "delete o.p; String(ro())", "\"undefined\"");
+
+  v7_destroy(v7);
+  return NULL;
+}
+
+/* Global replacements step over empty matches instead of looping on them. */
+static const char *test_string_replace(void) {
+  struct v7 *v7 = v7_create();
+
+  ASSERT_EVAL_EQ(v7, "\"abc\".replace(/x*/g, \"-\") === \"-a-b-c-\"", "true");
+  ASSERT_EVAL_EQ(v7, "\"aaa\".replace(/a*/g, \"-\")", "\"--\"");
+  ASSERT_EVAL_EQ(v7, "\"ab\".replace(/(?:)/g, function() { return \".\"; })",
+                 "\".a.b.\"");
+
+  v7_destroy(v7);
+  return NULL;
+}
+
+/*
+ * The replacer and `toJSON()` run with GC enabled, so the garbage they make
+ * doesn't pile up until the whole value is serialized, and they may delete
+ * properties which are yet to be visited.
+ */
+static const char *test_json_stringify_gc(void) {
+  struct v7 *v7 = v7_create();
+#ifndef V7_GC_STRESS /* heap growth doesn't tell anything there, and is slow */
+  v7_val_t res;
+  int heap_size;
+
+  ASSERT_EQ(v7_exec(v7,
+                    "var a = [];"
+                    "for (var i = 0; i < 1000; i++) a.push({v: i});"
+                    "function r(k, v) {"
+                    "  for (var i = 0; i < 10; i++) var t = {j: [1, 2, 3]};"
+                    "  return v;"
+                    "}"
+                    "JSON.stringify(a, r).length",
+                    &res),
+            V7_OK);
+  heap_size = v7_heap_stat(v7, V7_HEAP_STAT_HEAP_SIZE);
+  ASSERT_EVAL_EQ(v7, "JSON.stringify([a, a, a, a], r).length", "39569");
+  ASSERT(v7_heap_stat(v7, V7_HEAP_STAT_HEAP_SIZE) < heap_size * 2);
+#endif
+
+  ASSERT_EVAL_EQ(v7,
+                 "var o = {a: 1, b: 2, c: 3};"
+                 "o.d = {toJSON: function() { delete o.a; delete o.b; "
+                 "                            delete o.c; return 4; }};"
+                 "JSON.stringify(o)",
+                 "\"{\\\"d\\\":4}\"");
+
+  v7_destroy(v7);
+  return NULL;
+}
+
+/* JSON of a typed array has the same keys as `Object.keys()` reports */
+static const char *test_json_typed_array(void) {
+  struct v7 *v7 = v7_create();
+
+  ASSERT_EVAL_EQ(v7, "var u = new Uint8Array(2); u[1] = 7; Object.keys(u)",
+                 "[\"0\",\"1\"]");
+  ASSERT_EVAL_EQ(v7, "JSON.stringify(u)",
+                 "\"{\\\"0\\\":0,\\\"1\\\":7}\"");
+  ASSERT_EVAL_EQ(v7, "u", "{\"0\":0,\"1\":7}");
+
+  v7_destroy(v7);
+  return NULL;
+}
+
+/* Arrays convert to primitives through `toString()`, dense or not */
+static const char *test_array_to_primitive(void) {
+  struct v7 *v7 = v7_create();
+
+  ASSERT_EVAL_EQ(v7, "'x' + [1, 2]", "\"x1,2\"");
+  ASSERT_EVAL_EQ(v7, "[] + []", "\"\"");
+  ASSERT_EVAL_EQ(v7, "[5] + 1", "\"51\"");
+  ASSERT_EVAL_EQ(v7, "[5] - 0", "5");
+  ASSERT_EVAL_EQ(v7, "[1] == 1", "true");
+  ASSERT_EVAL_EQ(v7, "Number([5])", "5");
+  ASSERT_EVAL_EQ(v7, "var a = [5]; a.valueOf() === a", "true");
+  ASSERT_EVAL_EQ(v7, "var s = []; s[100] = 1; s.valueOf() === s", "true");
+
+  v7_destroy(v7);
+  return NULL;
+}
+
+/*
+ * Arrays go sparse when a write leaves them mostly holes, and dense again
+ * once the holes fill in; elements survive both ways.
+ */
+static const char *test_array_dense_sparse(void) {
+  struct v7 *v7 = v7_create();
+  int to_sparse = v7_heap_stat(v7, V7_HEAP_STAT_ARRAY_DENSE_TO_SPARSE);
+  int to_dense = v7_heap_stat(v7, V7_HEAP_STAT_ARRAY_SPARSE_TO_DENSE);
+
+  ASSERT_EVAL_EQ(v7, "var a = [1, 2, 3]; a[100] = 4; [a.length, a[1], a[100]]",
+                 "[101,2,4]");
+  ASSERT_EVAL_EQ(v7, "String(a[50]) + ' ' + a.indexOf(4)", "\"undefined 100\"");
+  ASSERT_EQ(v7_heap_stat(v7, V7_HEAP_STAT_ARRAY_DENSE_TO_SPARSE),
+            to_sparse + 1);
+  ASSERT_EQ(v7_heap_stat(v7, V7_HEAP_STAT_ARRAY_SPARSE_TO_DENSE), to_dense);
+
+  ASSERT_EVAL_EQ(v7,
+                 "var b = []; b[40] = 40;"
+                 "for (var i = 39; i >= 0; i--) b[i] = i;"
+                 "[b.length, b[0], b[20], b[40]]",
+                 "[41,0,20,40]");
+  ASSERT_EQ(v7_heap_stat(v7, V7_HEAP_STAT_ARRAY_DENSE_TO_SPARSE),
+            to_sparse + 2);
+  ASSERT_EQ(v7_heap_stat(v7, V7_HEAP_STAT_ARRAY_SPARSE_TO_DENSE),
+            to_dense + 1);
+  ASSERT_EVAL_EQ(v7, "b.push(41); b.join('').length", "74");
+
+  v7_destroy(v7);
+  return NULL;
+}
+
+/*
+ * Locals live in frame slots unless their names can be observed at runtime,
+ * e.g. by `eval` or by inner functions; the results are the same either way.
+ */
+static const char *test_frame_slots(void) {
+  struct v7 *v7 = v7_create();
+
+  ASSERT_EVAL_EQ(v7,
+                 "function f(a, b) {"
+                 "  var c = a + b;"
+                 "  function g() { return c * 2; }"
+                 "  return g();"
+                 "}"
+                 "function h(a) { var x = 1; return eval('a + x'); }"
+                 "function m(n) { return n <= 1 ? 1 : n * m(n - 1); }"
+                 "[f(1, 2), h(2), m(5)]",
+                 "[6,3,120]");
+  ASSERT_EVAL_EQ(v7,
+                 "function q(e) { try { throw 3; } catch (e) { var r = e; }"
+                 "                return [e, r]; }"
+                 "function u() { return typeof z + (z = 2, z); var z; }"
+                 "function s(a, b) {"
+                 "  var t = a; a = b; b = t;"
+                 "  return [a, b, arguments.length];"
+                 "}"
+                 "[q(1), u(), s(1, 2, 3)]",
+                 "[[1,3],\"undefined2\",[2,1,3]]");
+  ASSERT_EVAL_EQ(v7,
+                 "function c() {"
+                 "  var n = 0;"
+                 "  return function() { return ++n; };"
+                 "}"
+                 "var inc = c(); inc(); inc()",
+                 "2");
+
+  v7_destroy(v7);
+  return NULL;
+}
+
+/* JSON.parse() and v7_parse_json() accept strict JSON, plus trailing commas */
+static const char *test_json_parse(void) {
+  struct v7 *v7 = v7_create();
+  v7_val_t res;
+
+  ASSERT_EVAL_EQ(v7,
+                 "var o = JSON.parse('{\"a\": [1, -2.5e1, true, null, "
+                 "\"x\\\\u00e9\\\\n\"], \"b\": {\"c\": {}}}');"
+                 "[o.a[1], o.a[2], o.a[3], o.a[4].length, "
+                 " o.a[4].charCodeAt(1), typeof o.b.c]",
+                 "[-25,true,null,3,233,\"object\"]");
+  ASSERT_EVAL_EQ(v7, "JSON.stringify(JSON.parse('[1, {\"a\": 2,},]'))",
+                 "\"[1,{\\\"a\\\":2}]\"");
+  ASSERT_EVAL_EQ(v7,
+                 "JSON.parse('[1, [2, [3]]]', function(k, v) {"
+                 "  return typeof v === 'number' ? v * 10 : v;"
+                 "})",
+                 "[10,[20,[30]]]");
+
+  /* a key used by many objects is read the same each time */
+  ASSERT_EVAL_EQ(v7,
+                 "var a = JSON.parse('[{\"a_rather_long_key\": 1},"
+                 "                    {\"a_rather_long_key\": 2}]');"
+                 "a[0].a_rather_long_key + a[1].a_rather_long_key",
+                 "3");
+
+  ASSERT_EVAL_EQ(v7,
+                 "var s = '', r = [];"
+                 "for (var i = 0; i < 1000; i++) s += '[';"
+                 "['{a: 1}', \"{'a': 1}\", '1 + 1', '[1 2]', '', s]"
+                 "  .forEach(function(s) {"
+                 "    try { JSON.parse(s); r.push(false); }"
+                 "    catch (e) { r.push(e instanceof SyntaxError); }"
+                 "  });"
+                 "r",
+                 "[true,true,true,true,true,true]");
+
+  ASSERT_EQ(v7_parse_json(v7, "{\"x\": [1, 2]}", &res), V7_OK);
+  ASSERT_EQ(v7_array_length(v7, v7_get(v7, res, "x", 1)), 2);
+  ASSERT_EQ(v7_parse_json(v7, "{x: 1}", &res), V7_SYNTAX_ERROR);
+
+  v7_destroy(v7);
+  return NULL;
+}
+
+/*
+ * Objects which stay reachable survive collections, whether they were made
+ * before a collection cycle started or stored into old objects during one.
+ * `make unit_test_incremental_gc` runs this with the incremental collector.
+ */
+static const char *test_gc(void) {
+  struct v7 *v7 = v7_create();
+
+  ASSERT_EVAL_EQ(v7,
+                 "var keep = {next: null, v: -1}, arr = [], o = {};"
+                 "for (var i = 0; i < 20000; i++) {"
+                 "  var junk = {a: [i, i + 1], s: 'junk' + i};"
+                 "  if (i % 100 == 0) keep = {next: keep, v: i};"
+                 "  if (i % 500 == 0) { arr.push({v: i}); o['k' + i] = [i]; }"
+                 "  if (i % 1000 == 0) keep.next.extra = {v: junk.a[1]};"
+                 "}"
+                 "var n = 0, sum = 0, e = 0, ok = 0, p;"
+                 "for (p = keep; p.next != null; p = p.next) {"
+                 "  n++;"
+                 "  sum += p.v;"
+                 "  if (p.extra) e += p.extra.v;"
+                 "}"
+                 "for (var k in o) ok += o[k][0];"
+                 "[n, sum, arr.length, arr[39].v, ok, e]",
+                 "[200,1990000,40,19500,390000,190019]");
+#if defined(V7_ENABLE_INCREMENTAL_GC) && defined(V7_ENABLE_STATS)
+  ASSERT(v7_exec_stat(v7, V7_EXEC_STAT_GC_STEPS, 0) > 0);
+#endif
+
+  v7_destroy(v7);
+  return NULL;
+}
+
+/*
+ * Strings built by appending are ropes until they are read; they read the
+ * same as flat strings, also after a collection.
+ */
+static const char *test_string_ropes(void) {
+  struct v7 *v7 = v7_create();
+  v7_val_t s = V7_UNDEFINED;
+  const char *p;
+  size_t len;
+
+  v7_own(v7, &s);
+  ASSERT_EQ(v7_exec(v7,
+                    "var s = '';"
+                    "for (var i = 0; i < 2000; i++) {"
+                    "  s += String.fromCharCode(97 + i % 26);"
+                    "}"
+                    "s",
+                    &s),
+            V7_OK);
+  v7_gc(v7, 1);
+  p = v7_get_string(v7, &s, &len);
+  ASSERT_EQ(len, 2000);
+  ASSERT(strncmp(p, "abcdef", 6) == 0);
+  ASSERT(strncmp(p + 1994, "stuvwx", 6) == 0);
+  v7_disown(v7, &s);
+
+  ASSERT_EVAL_EQ(v7,
+                 "var t = 'pre' + s, u = s + s, o = {};"
+                 "o[u] = 1;"
+                 "var p = s.concat('!', s);"
+                 "[s.length, s.charAt(1000), s.substr(1995), t.indexOf('xyz'),"
+                 " u.length, u.lastIndexOf('abc'), o[s + s], s === s.slice(0),"
+                 " p.length, p.charAt(2000), s + 1 == s + '1']",
+                 "[2000,\"m\",\"tuvwx\",26,4000,3976,1,true,4001,\"!\",true]");
+
+  v7_destroy(v7);
+  return NULL;
+}
+
+/* Characters of UTF-8 strings are found by index, whatever the access order */
+static const char *test_string_rune_index(void) {
+  struct v7 *v7 = v7_create();
+
+  /* U+00E9 and U+20AC take 2 and 3 bytes */
+  ASSERT_EVAL_EQ(v7,
+                 "var s = '', r = [];"
+                 "for (var i = 0; i < 300; i++) {"
+                 "  s += ['\xc3\xa9', 'a', '\xe2\x82\xac'][i % 3];"
+                 "}"
+                 "[s.length, s.charCodeAt(0), s.charCodeAt(299), s.charAt(151),"
+                 " s.slice(297, 300).length, s.substr(100, 4).charCodeAt(3),"
+                 " s.substr(-2).charCodeAt(0),"
+                 " s.indexOf('a\xe2\x82\xac', 100)]",
+                 "[300,233,8364,\"a\",3,97,97,100]");
+  ASSERT_EVAL_EQ(v7,
+                 "var ok = true;"
+                 "for (var i = 299; i >= 0; i -= 7) {"
+                 "  ok = ok && s.charCodeAt(i) == [233, 97, 8364][i % 3];"
+                 "}"
+                 "ok",
+                 "true");
+  ASSERT_EVAL_EQ(v7,
+                 "var a = 'plain ascii string, long enough to be owned';"
+                 "[a.length, a.charAt(6), a.substr(6, 5), a.slice(-5)]",
+                 "[43,\"a\",\"ascii\",\"owned\"]");
+
+  v7_destroy(v7);
+  return NULL;
+}
+
+/*
+ * Binary bcode files are run in place: names and literals of the code which
+ * stays in the file read the same on every call, also after a collection.
+ */
+static const char *test_exec_bcode_file(void) {
+  struct v7 *v7 = v7_create();
+  const char *path = "unit_test_bcode.bin";
+  FILE *fp = fopen(path, "wb");
+  v7_val_t res;
+
+  ASSERT(fp != NULL);
+  ASSERT_EQ(v7_compile("var long_variable_name = 'a string literal';"
+                       "function greet(who) {"
+                       "  return long_variable_name + ', ' + who + '!';"
+                       "}"
+                       "greet('first')",
+                       1, 1, fp),
+            V7_OK);
+  fclose(fp);
+
+  ASSERT_EQ(v7_exec_file(v7, path, &res), V7_OK);
+  ASSERT(check_js_json(v7, "greet('x')", "\"a string literal, x!\""));
+  v7_gc(v7, 1);
+  ASSERT_EVAL_EQ(v7, "[greet('y'), typeof long_variable_name]",
+                 "[\"a string literal, y!\",\"string\"]");
+
+  v7_destroy(v7);
+  remove(path);
+  return NULL;
+}
+
+#ifdef V7_ENABLE_SNAPSHOT
+/* A snapshot restores functions, closures, arrays, regexps and strings */
+static const char *test_snapshot(void) {
+  struct v7_create_opts opts;
+  struct v7 *v7 = v7_create();
+  const char *path = "unit_test_snapshot.bin";
+  const char *check =
+      "[add(2), next(), next(), dense.join(), sparse[1000], re.test('xaby'),"
+      " long_str.length, obj.kid.hello(), JSON.stringify(JSON.parse('[1]'))]";
+  v7_val_t res;
+
+  memset(&opts, 0, sizeof(opts));
+  ASSERT_EQ(v7_exec(v7,
+                    "function add(x) { return x + base; }"
+                    "var base = 40;"
+                    "var next = (function() {"
+                    "  var n = 0;"
+                    "  return function() { return ++n; };"
+                    "})();"
+                    "var dense = [1, 'two', {three: 3}.three];"
+                    "var sparse = []; sparse[1000] = 'far';"
+                    "var re = /a(b)?/g;"
+                    "var long_str = '';"
+                    "for (var i = 0; i < 300; i++) long_str += 'x';"
+                    "function Proto() {}"
+                    "Proto.prototype.hello = function() { return 'hi'; };"
+                    "var obj = {kid: new Proto()};",
+                    &res),
+            V7_OK);
+  ASSERT_EQ(v7_save_snapshot(v7, path), V7_OK);
+  v7_destroy(v7);
+
+  v7 = v7_create_from_snapshot(path, opts);
+  ASSERT(v7 != NULL);
+  ASSERT_EVAL_EQ(v7, check,
+                 "[42,1,2,\"1,two,3\",\"far\",true,300,\"hi\",\"[1]\"]");
+  v7_gc(v7, 1);
+  ASSERT_EVAL_EQ(v7, "[next(), add(-40), dense.push(4)]", "[3,0,4]");
+  v7_destroy(v7);
+
+  /* array buffers hold foreign memory and can't be saved */
+  v7 = v7_create();
+  ASSERT_EQ(v7_exec(v7, "var ab = new ArrayBuffer(4);", &res), V7_OK);
+  ASSERT_EQ(v7_save_snapshot(v7, path), V7_EXEC_EXCEPTION);
+  v7_destroy(v7);
+
+  remove(path);
+  ASSERT(v7_create_from_snapshot(path, opts) == NULL);
+  return NULL;
+}
+#endif
+
+/*
+ * Fused instructions behave as the ones they replace, and errors report the
+ * lines of the instructions which raised them.
+ */
+static const char *test_bcode_dispatch(void) {
+  struct v7 *v7 = v7_create();
+
+  ASSERT_EVAL_EQ(v7,
+                 "var o = {x: 1, y: {z: 'q'}}, g = 5;"
+                 "function f(a) {"
+                 "  var i = 0, s = 0, t = 'a';"
+                 "  for (i = 0; i < 10; i++) s += i;"
+                 "  var j = 10;"
+                 "  while (j > 0) j--;"
+                 "  var m = a;"
+                 "  m--;"
+                 "  --m;"
+                 "  return [s, j, i++, i, ++i, m, t + 1, 1 + t, a + 0.5, o.y.z,"
+                 "          o.x + 1, i >= 12 ? 'ge' : 'lt'];"
+                 "}"
+                 "g++;"
+                 "++g;"
+                 "var h = g--;"
+                 "[f(3), g, h, o.x < o.y ? 1 : 2, 'a' < 'b']",
+                 "[[45,0,10,11,12,1,\"a1\",\"1a\",3.5,\"q\",2,\"ge\"],"
+                 "6,7,2,true]");
+  ASSERT_EVAL_EQ(v7,
+                 "function thrower() {\n"
+                 "  var a = 1;\n"
+                 "  return a.b.c;\n"
+                 "}\n"
+                 "try {\n"
+                 "  thrower();\n"
+                 "} catch (e) {\n"
+                 "  e.stack\n"
+                 "}",
+                 "\"    at thrower (<no filename>:3)\\n"
+                 "    at <no filename>:6\"");
+
+  v7_destroy(v7);
+  return NULL;
+}
+
+/*
+ * Callbacks of array iteration methods get the array as the third argument,
+ * and `thisArg` or `undefined` as `this`: a built-in constructor used as a
+ * callback must not take the array for the object it constructs.
+ */
+static const char *test_array_iteration(void) {
+  struct v7 *v7 = v7_create();
+
+  ASSERT_EVAL_EQ(v7, "var a = [1, 2, 3]; [a.map(String), a.map(Number), a]",
+                 "[[\"1\",\"2\",\"3\"],[1,2,3],[1,2,3]]");
+  ASSERT_EVAL_EQ(v7,
+                 "var t = {k: 10}, seen = [];"
+                 "a.forEach(function(v, i, arr) {"
+                 "  seen.push(this.k + v, arr === a);"
+                 "}, t);"
+                 "seen",
+                 "[11,true,12,true,13,true]");
+  ASSERT_EVAL_EQ(v7,
+                 "a.filter(function(v, i, arr) {"
+                 "  return arr === a && this === t;"
+                 "}, t).length",
+                 "3");
+
+  v7_destroy(v7);
+  return NULL;
+}
+
+/*
+ * Arithmetic on small integers falls back to doubles on overflow, fractions
+ * and `-0`, and gives the same results as it would on doubles.
+ */
+static const char *test_smi_arith(void) {
+  struct v7 *v7 = v7_create();
+
+  ASSERT_EVAL_EQ(v7,
+                 "var M = 2147483647, m = -2147483648;"
+                 "[M + 1, m - 1, M * 2, 65536 * 65536, -m, 7 / 2, 6 / 3,"
+                 " 7 % -3, -7 % 3, 5.5 % 2, 1e10 % 3, 5 % Infinity,"
+                 " M | 0, (M + 1) | 0, -1 >>> 0, 1 << 31, 5 & 3, 5 ^ 3, ~5,"
+                 " m >> 1, 3 < 4.5, 2 === 2.0, 10 / 4 * 4]",
+                 "[2147483648,-2147483649,4294967294,4294967296,2147483648,"
+                 "3.5,2,1,-1,1.5,1,5,2147483647,-2147483648,4294967295,"
+                 "-2147483648,1,6,-6,-1073741824,true,true,10]");
+
+  /* `1 / x` tells `-0` from `0` */
+  ASSERT_EVAL_EQ(v7,
+                 "var z = 0, a = -1, b = 1, c = -4;"
+                 "[1 / (z * a), 1 / (z / a), 1 / (a % b), 1 / (c % 2),"
+                 " 1 / (z - 0), z === -0].map(String)",
+                 "[\"-Infinity\",\"-Infinity\",\"-Infinity\",\"-Infinity\","
+                 "\"Infinity\",\"true\"]");
+
+  ASSERT_EVAL_EQ(v7,
+                 "var i = 2147483647, d = -2147483648, e = -1;"
+                 "i++; d--; e++;"
+                 "[i, d, String(1 / e), String(-42), [1, 2, 3][1.0]]",
+                 "[2147483648,-2147483649,\"Infinity\",\"-42\",2]");
+
+  v7_destroy(v7);
+  return NULL;
+}
+
+static const char *test_regexp(void) {
+  struct v7 *v7 = v7_create();
+
+  /* the Pike VM keeps nested repetitions linear in the input */
+  ASSERT_EVAL_EQ(v7,
+                 "var aa = ''; for (var i = 0; i < 40; i++) aa += 'a';"
+                 "[/(a+)+b/.test(aa), /(a|aa)+c/.test(aa + 'c')]",
+                 "[false,true]");
+
+  ASSERT_EVAL_EQ(v7,
+                 "['2023-10-17'.match(/(\\d{4})-(\\d{1,2})-(\\d{2})/).slice(1),"
+                 " 'xxfooBARfoo'.replace(/foo/g, 'Z'), 'aXbxc'.split(/x/i),"
+                 " /^abc/.test('zabc'), /^abc/m.test('z\\nabc'),"
+                 " /(\\w)\\1/.exec('abccd')[0], /a(?=b)/.exec('acab').index,"
+                 " /[a-f]+/i.exec('xxDeAdz')[0], /a{2,3}/.exec('aaaa')[0],"
+                 " /a*?b/.exec('aaab')[0], /(a)|(b)/.exec('b')[2],"
+                 " /x*/.exec('abc')[0].length]",
+                 "[[\"2023\",\"10\",\"17\"],\"xxZBARZ\",[\"a\",\"b\",\"c\"],"
+                 "false,true,\"cc\",2,\"DeAd\",\"aaa\",\"aaab\",\"b\",0]");
+
+  /* objects sharing a cached program keep their own `lastIndex` */
+  ASSERT_EVAL_EQ(v7,
+                 "var a = new RegExp('o', 'g'), b = new RegExp('o', 'g');"
+                 "var s = 'foo', n = 0; a.exec(s);"
+                 "for (var i = 0; i < 100; i++)"
+                 "  if (new RegExp('x' + (i % 40)).test('ax' + (i % 40))) n++;"
+                 "[a.lastIndex, b.lastIndex, b.exec(s).index, a.exec(s).index,"
+                 " a === b, n, new RegExp('h.llo', 'i').test('HELLO'),"
+                 " 'x1x'.replace('x', 'y'), 'a+b'.match('a\\\\+b')[0],"
+                 " 'abcabc'.search('ca')]",
+                 "[2,0,1,2,false,100,true,\"y1x\",\"a+b\",2]");
+
+  v7_destroy(v7);
+  return NULL;
+}
+
+static const char *test_array_sort(void) {
+  struct v7 *v7 = v7_create();
+
+  /* equal keys keep their order, on runs long enough to need merging */
+  ASSERT_EVAL_EQ(v7,
+                 "var p = [], i, ok = true, sorted = true;"
+                 "for (i = 0; i < 50; i++) p.push({k: i % 3, i: i});"
+                 "p.sort(function(a, b) { return a.k - b.k; });"
+                 "for (i = 1; i < 50; i++)"
+                 "  if (p[i - 1].k === p[i].k && p[i - 1].i > p[i].i) ok = 0;"
+                 "var big = [];"
+                 "for (i = 0; i < 1000; i++) big.push((i * 7919) % 1000);"
+                 "big.sort(function(a, b) { return a - b; });"
+                 "for (i = 0; i < 1000; i++) if (big[i] !== i) sorted = false;"
+                 "[ok, sorted]",
+                 "[true,true]");
+
+  ASSERT_EVAL_EQ(v7,
+                 "[[10, 9, 1, 2].sort(), ['b', undefined, 'a'].sort().length,"
+                 " [3, 1, 2].sort(function(a, b) { return b - a; }),"
+                 " [].sort().length, [5].sort()]",
+                 "[[1,10,2,9],3,[3,2,1],0,[5]]");
+
+  v7_destroy(v7);
+  return NULL;
+}
+
+/*
+ * Functions are compiled as soon as they are parsed: a script with more
+ * functions than a 8-bit refcount allows, nested closures which need names
+ * from several scopes up, and a syntax error after some functions are done.
+ */
+static const char *test_streaming_compile(void) {
+  struct v7 *v7 = v7_create();
+  size_t size = 300 * 64 + 512, len = 0;
+  char *js = (char *) malloc(size);
+  int i;
+
+  len += snprintf(js + len, size - len, "var base = 1000;");
+  for (i = 0; i < 300; i++) {
+    len += snprintf(js + len, size - len,
+                    "function f%d(x) { return x + %d + base; }", i, i);
+  }
+  snprintf(js + len, size - len,
+           "function o(a) {"
+           "  var b = 2;"
+           "  function m(c) {"
+           "    function i() { return a + b + c + late(); }"
+           "    return i();"
+           "  }"
+           "  return m(3);"
+           "}"
+           "function late() { return 10; }"
+           "var fact = function r(n) { return n < 2 ? 1 : n * r(n - 1); };"
+           "[f0(1) + f299(1), o(1), fact(6), typeof f150,"
+           " (function() { return arguments.length; })(1, 2)]");
+  ASSERT_EVAL_EQ(v7, js, "[2301,16,720,\"function\",2]");
+  free(js);
+
+  ASSERT(v7_exec(v7, "function a() { return 1; } function b( {", NULL) ==
+         V7_SYNTAX_ERROR);
+  v7_gc(v7, 1);
+  ASSERT_EVAL_EQ(v7, "function c() { return 2; } [c(), typeof a]",
+                 "[2,\"undefined\"]");
+
+  v7_destroy(v7);
+  return NULL;
+}
+
+/* Returns the size of the binary bcode of `js`, or -1 on error */
+static long bcode_size(const char *js) {
+  FILE *fp = tmpfile();
+  long size = -1;
+
+  if (fp != NULL && v7_compile(js, 1, 1, fp) == V7_OK) {
+    size = ftell(fp);
+  }
+  if (fp != NULL) {
+    fclose(fp);
+  }
+  return size;
+}
+
+static const char *test_bcode_opt(void) {
+  struct v7 *v7 = v7_create();
+
+#ifndef V7_DISABLE_BCODE_OPT
+  /* folded constants, constant branches and dead code leave no trace */
+  ASSERT_EQ(bcode_size("var r = 2 * 3 + 1;"), bcode_size("var r = 7;"));
+  ASSERT_EQ(bcode_size("var r; if (0) { r = f(g(1), 2); } r = 1;"),
+            bcode_size("var r; r = 1;"));
+  ASSERT_EQ(bcode_size("function f() { return 1; var d = 2; f(d); }"),
+            bcode_size("function f() { return 1; var d; }"));
+#endif
+
+  ASSERT_EVAL_EQ(v7,
+                 "function f() { if (0) { var h = 1; } return typeof h; }"
+                 "function g() { return 1; var dead = 2; }"
+                 "var o = {}, m, n = 0;"
+                 "try { o.foo(); } catch (e) { m = e.message; }"
+                 "while (1) { if (++n > 3) break; }"
+                 "[f(), g(), m, n, 0 && o.x, 1 || o.x, !0 ? 'y' : 'n',"
+                 " '1' + 2 * 3, 2 - '1', String(1 / -0), 7 >>> 1,"
+                 " typeof (3 + 4), 'a' < 'b']",
+                 "[\"undefined\",1,\"o.foo is not a function\",4,0,1,\"y\","
+                 "\"16\",1,\"-Infinity\",3,\"number\",true]");
+
+  v7_destroy(v7);
+  return NULL;
+}
+
+/*
+ * Calls of functions which don't use `arguments` take the args right from
+ * the stack, and unwound call frames are reused.
+ */
+static const char *test_call_args(void) {
+  struct v7 *v7 = v7_create();
+
+  ASSERT_EVAL_EQ(v7,
+                 "function two(a, b) { return [a, typeof b]; }"
+                 "function cnt() { return arguments.length + ':' +"
+                 "                        arguments[1]; }"
+                 "function cap(a) { return function() { return a++; }; }"
+                 "function ev(a) { return eval('a + arguments.length'); }"
+                 "var k = cap(5); k();"
+                 "var o = { v: 3, m: function(x) { return this.v + x; } };"
+                 "[two(1), two(1, 2, 3), cnt(7, 8, 9), cnt(), k(), ev(1, 2),"
+                 " o.m(4), [1, 2].map(function(x, j) { return x + j; })]",
+                 "[[1,\"undefined\"],[1,\"number\"],\"3:8\",\"0:undefined\","
+                 "6,3,7,[1,3]]");
+
+  /* frames unwound by exceptions go back to the cache */
+  ASSERT_EVAL_EQ(v7,
+                 "function thr(n) { if (n === 0) throw n; return thr(n - 1); }"
+                 "function dep(n) { return n === 0 ? 0 : 1 + dep(n - 1); }"
+                 "var caught = 0;"
+                 "for (var i = 0; i < 50; i++) {"
+                 "  try { thr(5); } catch (e) { caught++; }"
+                 "}"
+                 "[caught, dep(500), dep.call(null, 3)]",
+                 "[50,500,3]");
+
+  v7_destroy(v7);
+  return NULL;
+}
+
+static const char *test_buffer_class(void) {
+  struct v7 *v7 = v7_create();
+
+  ASSERT_EVAL_EQ(v7,
+                 "var t = Object.prototype.toString, b = new ArrayBuffer(4);"
+                 "[t.call(new Uint8Array(1)), t.call(b),"
+                 " t.call(new DataView(b)), t.call(new Uint8ClampedArray(b)),"
+                 " t.call(new Float64Array(1)), String(b),"
+                 " t.call(Object.create(Uint8Array.prototype))]",
+                 "[\"[object Uint8Array]\",\"[object ArrayBuffer]\","
+                 "\"[object DataView]\",\"[object Uint8ClampedArray]\","
+                 "\"[object Float64Array]\",\"[object ArrayBuffer]\","
+                 "\"[object Object]\"]");
+
+  v7_destroy(v7);
+  return NULL;
+}
+
+static const char *run_tests(const char *filter, double *total_elapsed) {
+  RUN_TEST(test_inline_cache);
+  RUN_TEST(test_string_replace);
+  RUN_TEST(test_json_stringify_gc);
+  RUN_TEST(test_json_typed_array);
+  RUN_TEST(test_array_to_primitive);
+  RUN_TEST(test_array_dense_sparse);
+  RUN_TEST(test_frame_slots);
+  RUN_TEST(test_json_parse);
+  RUN_TEST(test_gc);
+  RUN_TEST(test_string_ropes);
+  RUN_TEST(test_string_rune_index);
+  RUN_TEST(test_exec_bcode_file);
+#ifdef V7_ENABLE_SNAPSHOT
+  RUN_TEST(test_snapshot);
+#endif
+  RUN_TEST(test_bcode_dispatch);
+  RUN_TEST(test_array_iteration);
+  RUN_TEST(test_smi_arith);
+  RUN_TEST(test_regexp);
+  RUN_TEST(test_array_sort);
+  RUN_TEST(test_streaming_compile);
+  RUN_TEST(test_bcode_opt);
+  RUN_TEST(test_call_args);
+  RUN_TEST(test_buffer_class);
+  return NULL;
+}
+
+int main(int argc, char *argv[]) {
+  const char *fail_msg;
+  const char *filter = argc > 1 ? argv[1] : "";
+  double total_elapsed = 0.0;
+
+  fail_msg = run_tests(filter, &total_elapsed);
+  printf("%s, tests run: %d\n", fail_msg ? "FAIL" : "PASS", num_tests);
+
+  return fail_msg == NULL ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -739,6 +739,27 @@ int c_vsnprintf(char *buf, size_t buf_size, const char *format, va_list ap);
  */
 const char *c_strnstr(const char *s, const char *find, size_t slen);
 
+/* Buffer size which is always enough for `cs_dtoa()`, including the NUL */
+#define CS_DTOA_BUF_SIZE 26
+
+/*
+ * Format `v` using the shortest decimal representation that reads back as
+ * the same double, laid out like ECMAScript's `Number.prototype.toString()`
+ * (e.g. `0.1`, `1e+21`, `-1.5e-7`, `NaN`, `Infinity`).
+ *
+ * Behaves like `snprintf()`: the output is NUL-terminated if `buf_size` is
+ * not zero, and the return value is the length of the full representation.
+ */
+int cs_dtoa(char *buf, size_t buf_size, double v);
+
+/*
+ * Drop-in replacement for `strtod()`. Plain decimal numbers whose digits fit
+ * into 53 bits and whose exponent is small are converted exactly without
+ * calling libc; everything else (hex, `inf`, leading spaces, very long or
+ * very large numbers) is passed on to `strtod()`.
+ */
+double cs_strtod(const char *s, char **endptr);
+
 #ifdef __cplusplus
 }
 #endif
@@ -1748,6 +1769,7 @@ void cr_context_free(struct cr_ctx *p_ctx);
 #endif
 
 #define V7_ENABLE__Array__reduce 1
+#define V7_ENABLE__ArrayBuffer 1
 #define V7_ENABLE__Blob 1
 #define V7_ENABLE__Date 1
 #define V7_ENABLE__Date__UTC 1
@@ -2120,6 +2142,15 @@ v7_val_t v7_arg(struct v7 *v, unsigned long i);
 /* Return the length of `arguments` */
 unsigned long v7_argc(struct v7 *v7);
 
+/*
+ * Return the arguments of the current C function as an array of `*argc`
+ * values, without creating the `arguments` object.
+ *
+ * The array lives on the interpreter stack: it is only valid until the
+ * function calls back into JS code (e.g. `v7_apply()`, `v7_exec()`).
+ */
+const v7_val_t *v7_argv(struct v7 *v7, unsigned long *argc);
+
 /*
  * Tells the GC about a JS value variable/field owned
  * by C code.
@@ -2280,10 +2311,40 @@ V7_PRIVATE void init_error(struct v7 *v7);
 
 typedef void (*gc_cell_destructor_t)(struct v7 *v7, void *);
 
+/*
+ * Incremental marking keeps mark bits aside from the cells, so it can't be
+ * used with the malloc-based heap nor with the freezer, which walks the heap
+ * using the in-cell mark bits.
+ */
+#if defined(V7_ENABLE_INCREMENTAL_GC) && \
+    (defined(V7_MALLOC_GC) || defined(V7_DISABLE_GC) || defined(V7_FREEZE))
+#undef V7_ENABLE_INCREMENTAL_GC
+#endif
+
+/*
+ * Heap snapshots are made of arena images, so they need the arena-based heap
+ * (and a filesystem to be stored on).
+ */
+#if defined(V7_ENABLE_SNAPSHOT) && (defined(V7_MALLOC_GC) || defined(V7_NO_FS))
+#undef V7_ENABLE_SNAPSHOT
+#endif
+
+#ifdef V7_ENABLE_INCREMENTAL_GC
+/* State of the incremental collection cycle, see `gc_step()` */
+enum gc_phase {
+  GC_PHASE_IDLE = 0,
+  GC_PHASE_MARK,
+  GC_PHASE_SWEEP
+};
+#endif
+
 struct gc_block {
   struct gc_block *next;
   struct gc_cell *base;
   size_t size;
+#ifdef V7_ENABLE_INCREMENTAL_GC
+  uint8_t *marks; /* one mark bit per cell, used by incremental cycles */
+#endif
 };
 
 struct gc_arena {
@@ -2292,6 +2353,12 @@ struct gc_arena {
   struct gc_cell *free; /* head of free list */
   size_t cell_size;
 
+#ifdef V7_ENABLE_INCREMENTAL_GC
+  /* position of the incremental sweep */
+  struct gc_block *sweep_block;
+  size_t sweep_idx;
+#endif
+
 #if V7_ENABLE__Memory__stats
   unsigned long allocations; /* cumulative counter of allocations */
   unsigned long garbage;     /* cumulative counter of garbage */
@@ -2387,6 +2454,8 @@ typedef unsigned short v7_prop_attr_t;
  * keep all offsets in one place
  */
 #define _V7_DESC_PRESERVE_VALUE (1 << 8)
+/* not a property, but a string rope node; see `V7_TAG_STRING_R` */
+#define _V7_PROPERTY_ROPE (1 << 9)
 
 /*
  * Internal helpers for `V7_DESC_...` macros
@@ -2511,6 +2580,9 @@ int v7_del(struct v7 *v7, v7_val_t obj, const char *name, size_t name_len);
  *     while ((h = v7_next_prop(h, obj, &name, &val, &attrs)) != NULL) {
  *       ...
  *     }
+ *
+ * Elements of arrays are not necessarily stored as properties: use
+ * `v7_array_length()` and `v7_array_get()` to iterate over them.
  */
 void *v7_next_prop(void *handle, v7_val_t obj, v7_val_t *name, v7_val_t *value,
                    v7_prop_attr_t *attrs);
@@ -2565,6 +2637,109 @@ void v7_set_destructor_cb(struct v7 *v7, v7_val_t obj, v7_destructor_cb_t *d);
 
 #endif /* CS_V7_SRC_OBJECT_PUBLIC_H_ */
 #ifdef V7_MODULE_LINES
+#line 1 "./v7/src/std_typedarray.h"
+#endif
+/*
+ * Copyright (c) 2014 Cesanta Software Limited
+ * All rights reserved
+ */
+
+#ifndef CS_V7_SRC_STD_TYPEDARRAY_H_
+#define CS_V7_SRC_STD_TYPEDARRAY_H_
+
+/* Amalgamated: #include "v7/src/object_public.h" */
+
+#if V7_ENABLE__ArrayBuffer
+
+/*
+ * Kinds of objects backed by an array buffer: the `ArrayBuffer` itself, typed
+ * arrays and `DataView`.
+ */
+enum v7_buf_kind {
+  V7_BUF_ARRAY_BUFFER,
+  V7_BUF_INT8,
+  V7_BUF_UINT8,
+  V7_BUF_UINT8_CLAMPED,
+  V7_BUF_INT16,
+  V7_BUF_UINT16,
+  V7_BUF_INT32,
+  V7_BUF_UINT32,
+  V7_BUF_FLOAT32,
+  V7_BUF_FLOAT64,
+  V7_BUF_DATA_VIEW,
+
+  V7_BUF_KIND_MAX
+};
+
+#define V7_BUF_IS_TYPED_ARRAY(kind) \
+  ((kind) != V7_BUF_ARRAY_BUFFER && (kind) != V7_BUF_DATA_VIEW)
+
+/*
+ * Storage of an `ArrayBuffer`. It lives outside of the JS heap, so C code can
+ * read and fill it in place.
+ */
+struct v7_array_buffer {
+  uint8_t *data;
+  size_t len;
+  /* Called with `data` when the buffer is collected, unless NULL */
+  v7_destructor_cb_t *free_cb;
+};
+
+/*
+ * State of an object which has the `V7_OBJ_BUFFER` attribute; it is kept in
+ * the hidden property of the object.
+ *
+ * An `ArrayBuffer` owns its `ab`. Views share the `ab` of the buffer they
+ * were made for, and keep that buffer alive through their `buffer` property.
+ */
+struct v7_buffer_view {
+  enum v7_buf_kind kind;
+  struct v7_array_buffer *ab;
+  size_t offset; /* in bytes */
+  size_t length; /* in elements */
+};
+
+#if defined(__cplusplus)
+extern "C" {
+#endif /* __cplusplus */
+
+V7_PRIVATE void init_typedarray(struct v7 *v7);
+
+/* Returns the state of a buffer-backed object, or NULL for other values */
+V7_PRIVATE struct v7_buffer_view *buffer_view(struct v7 *v7, v7_val_t obj);
+
+/* Like `buffer_view()`, but returns NULL unless `obj` is a typed array */
+V7_PRIVATE struct v7_buffer_view *typed_array_view(struct v7 *v7,
+                                                   v7_val_t obj);
+
+/* Frees the state of a buffer-backed object, see `V7_OBJ_BUFFER` */
+V7_PRIVATE void buffer_view_free(struct v7_buffer_view *bv);
+
+/* Returns the name of the constructor of `kind` objects, e.g. "Uint8Array" */
+V7_PRIVATE const char *buffer_kind_name(enum v7_buf_kind kind);
+
+/* Returns the element `index` of a typed array; it must be in range */
+V7_PRIVATE v7_val_t
+typed_array_get(struct v7 *v7, struct v7_buffer_view *bv, unsigned long index);
+
+/*
+ * Converts `v` to a number and stores it as the element `index` of the typed
+ * array `obj`. Writes out of range are dropped, setting `res` to -1; on
+ * success, `res` is set to 0. `res` is allowed to be `NULL`.
+ */
+WARN_UNUSED_RESULT
+V7_PRIVATE enum v7_err typed_array_set(struct v7 *v7, v7_val_t obj,
+                                       unsigned long index, v7_val_t v,
+                                       int *res);
+
+#if defined(__cplusplus)
+}
+#endif /* __cplusplus */
+
+#endif /* V7_ENABLE__ArrayBuffer */
+
+#endif /* CS_V7_SRC_STD_TYPEDARRAY_H_ */
+#ifdef V7_MODULE_LINES
 #line 1 "./v7/src/tokenizer.h"
 #endif
 /*
@@ -2954,6 +3129,23 @@ enum opcode {
    */
   OP_SAFE_GET_VAR,
 
+  /*
+   * Takes a varint argument -- index of the frame slot of the current
+   * function (see `bcode->frame_slots`). Pushes the slot value onto the stack.
+   *
+   * `( -- a )`
+   */
+  OP_GET_LOCAL,
+
+  /*
+   * Takes 1 value from the stack and a varint argument -- index of the frame
+   * slot of the current function. Stores the value in the slot and pushes it
+   * back to the stack.
+   *
+   * `( a -- a )`
+   */
+  OP_SET_LOCAL,
+
   /*
    * ==== Jumps
    *
@@ -3206,10 +3398,73 @@ enum opcode {
    */
   OP_EXIT_CATCH,
 
+  /*
+   * ==== Superinstructions
+   *
+   * They replace the hottest instruction sequences emitted by the compiler.
+   * Most of them are fused from the preceding instruction by `bcode_op()`,
+   * see `bcode_fuse_op()`.
+   */
+
+  /*
+   * `OP_PUSH_LIT` + `OP_GET`. Takes a varint argument -- the property name,
+   * encoded like the argument of `OP_PUSH_LIT`.
+   *
+   * `( a -- a.b )`
+   */
+  OP_GET_PROP,
+
+  /*
+   * `OP_GET_VAR` + `OP_GET_PROP`. Takes two varint arguments: the variable
+   * name and the property name.
+   *
+   * `( -- a.b )`
+   */
+  OP_GET_VAR_PROP,
+
+  /*
+   * `OP_PUSH_LIT` + `OP_ADD`. Takes a varint argument encoded like the
+   * argument of `OP_PUSH_LIT`.
+   *
+   * `( a -- a+b )`
+   */
+  OP_ADD_LIT,
+
+  /*
+   * Comparison + `OP_JMP_TRUE` (or `OP_JMP_FALSE`). Takes a 1-byte argument --
+   * one of `OP_EQ_EQ` .. `OP_GE`, and a jump offset like `OP_JMP_TRUE`.
+   *
+   * `( a b -- )`
+   */
+  OP_CMP_JMP_TRUE,
+  OP_CMP_JMP_FALSE,
+
+  /*
+   * `a++`, `a--`, `++a` or `--a` on a frame slot. Takes a varint argument --
+   * index of the frame slot, and a 1-byte argument -- `enum inc_flag` bits.
+   *
+   * `( -- a )`, or `( -- )` with `INC_FLAG_DROP`
+   */
+  OP_INC_LOCAL,
+
+  /*
+   * Like `OP_INC_LOCAL`, but for a variable found in the scope chain: takes
+   * a varint argument -- the variable name (see `OP_GET_VAR`), and flags.
+   */
+  OP_INC_VAR,
+
   OP_MAX,
 };
 
-#define _OP_LINE_NO 0x80
+/* Flags of `OP_INC_LOCAL` and `OP_INC_VAR` */
+enum inc_flag {
+  /* Decrement instead of increment */
+  INC_FLAG_DEC = (1 << 0),
+  /* Push the old value instead of the new one, like `a++` does */
+  INC_FLAG_POST = (1 << 1),
+  /* Push nothing: the result is dropped anyway */
+  INC_FLAG_DROP = (1 << 2),
+};
 
 #endif /* CS_V7_SRC_OPCODES_H_ */
 #ifdef V7_MODULE_LINES
@@ -3230,6 +3485,7 @@ enum opcode {
 /* Amalgamated: #include "v7/src/mm.h" */
 /* Amalgamated: #include "v7/src/parser.h" */
 /* Amalgamated: #include "v7/src/object_public.h" */
+/* Amalgamated: #include "v7/src/std_typedarray.h" */
 /* Amalgamated: #include "v7/src/tokenizer.h" */
 /* Amalgamated: #include "v7/src/opcodes.h" */
 
@@ -3311,8 +3567,21 @@ typedef unsigned char entity_id_part_t;
 #define V7_TAG_STRING_D MAKE_TAG(1, 0x3)  /* Dictionary string  */
 #define V7_TAG_REGEXP MAKE_TAG(1, 0x2)    /* Regex */
 #define V7_TAG_NOVALUE MAKE_TAG(1, 0x1)   /* Sentinel for no value */
+#define V7_TAG_STRING_R MAKE_TAG(0, 0x6)  /* String rope */
+#define V7_TAG_STRING_M MAKE_TAG(0, 0x7)  /* Foreign string with varint len */
+#define V7_TAG_SMI MAKE_TAG(0, 0x1)       /* Small integer, see below */
 #define V7_TAG_MASK MAKE_TAG(1, 0xF)
 
+/*
+ * Numbers which are int32 (except -0) are stored as small integers: the tag
+ * `V7_TAG_SMI` and the int32 in the lower 32 bits. `mk_number()` always
+ * produces them, so that every number has exactly one representation, and
+ * numbers can be compared bitwise, like before.
+ */
+#define IS_SMI(v) (((v) & V7_TAG_MASK) == V7_TAG_SMI)
+#define MK_SMI(i) ((uint64_t)(uint32_t)(int32_t)(i) | V7_TAG_SMI)
+#define GET_SMI(v) ((int32_t)(uint32_t)(v))
+
 #define _V7_NULL V7_TAG_FOREIGN
 #define _V7_UNDEFINED V7_TAG_UNDEFINED
 
@@ -3328,6 +3597,7 @@ typedef unsigned char v7_obj_attr_t;
 #define V7_OBJ_FUNCTION (1 << 2)       /* function object */
 #define V7_OBJ_OFF_HEAP (1 << 3)       /* object not managed by V7 HEAP */
 #define V7_OBJ_HAS_DESTRUCTOR (1 << 4) /* has user data */
+#define V7_OBJ_BUFFER (1 << 5)         /* backed by an array buffer */
 
 /*
  * JavaScript value is either a primitive, or an object.
@@ -3402,9 +3672,6 @@ struct v7_call_frame_base {
   /* See comment for `v7_call_frame_mask_t` */
   v7_call_frame_mask_t type_mask : 3;
 
-  /* Belongs to `struct v7_call_frame_private` */
-  unsigned int line_no : 16;
-
   /* Belongs to `struct v7_call_frame_bcode` */
   unsigned is_constructor : 1;
 };
@@ -3444,7 +3711,18 @@ struct v7_call_frame_bcode {
     val_t this_obj;
   } vals;
   struct bcode *bcode;
+
+  /*
+   * Position in `bcode`: the return address while the frame is calling
+   * another one; otherwise, the position saved by `bcode_save_ops()`.
+   */
   char *bcode_ops;
+
+  /*
+   * Offset in `v7->stack` at which the frame slots start; used only if
+   * `bcode->frame_slots` is set.
+   */
+  size_t slots_base;
 };
 
 /*
@@ -3479,6 +3757,9 @@ struct v7_vals {
   val_t number_prototype;
   val_t date_prototype;
   val_t function_prototype;
+#if V7_ENABLE__ArrayBuffer
+  val_t buffer_prototypes[V7_BUF_KIND_MAX];
+#endif
 
   /*
    * temporary register for `OP_STASH` and `OP_UNSTASH` instructions. Valid if
@@ -3505,6 +3786,174 @@ struct v7_vals {
   val_t call_check_ex;
 };
 
+#if !CS_ENABLE_UTF8 && !defined(V7_DISABLE_STRING_RUNE_INDEX)
+#define V7_DISABLE_STRING_RUNE_INDEX
+#endif
+
+#ifndef V7_DISABLE_STRING_RUNE_INDEX
+/* Distance, in runes, between two entries of a rune index */
+#ifndef V7_RUNE_INDEX_STEP
+#define V7_RUNE_INDEX_STEP 32
+#endif
+
+/* Number of rune indices kept at a time */
+#ifndef V7_RUNE_INDEX_CACHE_SIZE
+#define V7_RUNE_INDEX_CACHE_SIZE 2
+#endif
+
+/*
+ * Sparse rune index of a non-ASCII string: `offsets[i]` is the byte offset
+ * of the rune number `i * V7_RUNE_INDEX_STEP`. Indices are built lazily by
+ * the string functions which access characters by index, and are dropped on
+ * each GC, since the string might have been moved or collected.
+ */
+struct v7_rune_index {
+  val_t s;         /* owned string or rope, or `V7_UNDEFINED` if unused */
+  size_t runes;    /* total number of runes */
+  size_t *offsets; /* `runes / V7_RUNE_INDEX_STEP + 1` entries */
+};
+#endif
+
+/* Number of unwound bcode call frames kept for reuse */
+#ifndef V7_CALL_FRAME_CACHE_SIZE
+#define V7_CALL_FRAME_CACHE_SIZE 16
+#endif
+
+#if !V7_ENABLE__RegExp && !defined(V7_DISABLE_REGEXP_CACHE)
+#define V7_DISABLE_REGEXP_CACHE
+#endif
+
+#ifndef V7_DISABLE_REGEXP_CACHE
+/* Number of compiled regular expressions kept for reuse */
+#ifndef V7_REGEXP_CACHE_SIZE
+#define V7_REGEXP_CACHE_SIZE 8
+#endif
+
+/*
+ * Compiled regular expression, keyed by its source and flags, so that a
+ * pattern built over and over, e.g. by `new RegExp(str)` or by passing a
+ * string to `String.prototype.replace()` in a loop, is compiled only once.
+ * Regexp literals don't need it: they are compiled along with the code.
+ */
+struct v7_regexp_cache {
+  char *key; /* source followed by flags, or NULL if the slot is unused */
+  size_t src_len;
+  size_t flags_len;
+  struct slre_prog *prog; /* the cache holds a reference, see `slre_retain` */
+};
+#endif
+
+#ifdef V7_ENABLE_PROFILER
+/* Number of distinct stacks kept by the sampling profiler (a power of 2) */
+#ifndef V7_PROFILER_MAX_STACKS
+#define V7_PROFILER_MAX_STACKS 512
+#endif
+
+/* Number of innermost frames recorded per sample */
+#ifndef V7_PROFILER_MAX_DEPTH
+#define V7_PROFILER_MAX_DEPTH 64
+#endif
+
+/* Sampling interval of `v7 -prof`, see `v7_profiler_start()` */
+#ifndef V7_PROFILER_DEFAULT_INTERVAL
+#define V7_PROFILER_DEFAULT_INTERVAL 1000
+#endif
+
+/* Distinct JS stack seen by the sampling profiler, see `profiler_sample()` */
+struct v7_prof_entry {
+  char *stack; /* frames from the outermost one, separated by `;` */
+  uint32_t hash;
+  unsigned long count; /* number of samples */
+};
+#endif
+
+#ifdef V7_ENABLE_STATS
+/* Number of distinct C functions whose calls are counted one by one */
+#ifndef V7_STATS_MAX_CFUNCS
+#define V7_STATS_MAX_CFUNCS 128
+#endif
+
+/*
+ * Property lookups are grouped by the number of objects they visit, up to
+ * this number; see `V7_EXEC_STAT_PROP_LOOKUP_DEPTH`.
+ */
+#ifndef V7_STATS_PROP_DEPTHS
+#define V7_STATS_PROP_DEPTHS 8
+#endif
+
+/* Calls of a C function, see `stats_count_cfunc()` */
+struct v7_cfunc_stat {
+  v7_cfunction_t *func;
+  unsigned long calls;
+  char *name; /* resolved by `v7_exec_stat_cfunc_name()`, or NULL */
+};
+
+/*
+ * Execution counters, see `v7_exec_stat()`. Mind the size: there are
+ * `OP_MAX * OP_MAX` counters of opcode pairs.
+ */
+struct v7_stats {
+  unsigned long ops[OP_MAX];
+  unsigned long op_pairs[OP_MAX][OP_MAX];
+  uint8_t prev_op; /* the previous instruction executed */
+
+  unsigned long prop_lookups;
+  unsigned long prop_lookup_steps; /* objects visited by all the lookups */
+  unsigned long prop_depths[V7_STATS_PROP_DEPTHS];
+
+  unsigned long cfunc_calls;
+  struct v7_cfunc_stat cfuncs[V7_STATS_MAX_CFUNCS];
+  int cfuncs_cnt;
+  /* open addressing index of `cfuncs`: 1-based indices, 0 for free slots */
+  uint16_t cfunc_slots[V7_STATS_MAX_CFUNCS * 2];
+
+  unsigned long gc_cycles;
+  unsigned long gc_steps;
+  double gc_time_us;
+};
+#endif
+
+#ifdef V7_ENABLE_HEAPLOG
+/* Number of distinct allocation sites (a power of 2), see `heaplog_site()` */
+#ifndef V7_HEAPLOG_MAX_SITES
+#define V7_HEAPLOG_MAX_SITES 1024
+#endif
+
+/* Number of innermost frames which tell apart allocation sites */
+#ifndef V7_HEAPLOG_MAX_DEPTH
+#define V7_HEAPLOG_MAX_DEPTH 8
+#endif
+
+/* Allocation site: the arena and the JS stack of an allocation */
+struct v7_heaplog_site {
+  char *key; /* `arena,stack` as in the `hls{}` line, or NULL if unused */
+  uint32_t hash;
+  unsigned int id;
+};
+
+/*
+ * Owned string allocated while logging. Owned strings are moved by
+ * compaction, so the log refers to them by serial number.
+ */
+struct v7_heaplog_str {
+  size_t offset; /* of the string in `owned_strings` */
+  unsigned long serial;
+};
+#endif
+
+#ifndef V7_DISABLE_STRING_INTERNING
+/* Initial number of slots in the table of interned strings (a power of 2) */
+#ifndef V7_INTERNED_MIN_SIZE
+#define V7_INTERNED_MIN_SIZE 64
+#endif
+
+/* Slot of the table of interned strings, see `intern_string()` */
+struct v7_interned {
+  val_t s;       /* owned or dictionary string, or 0 if the slot is free */
+  uint32_t hash; /* hash of the contents of `s` */
+};
+#endif
+
 struct v7 {
   struct v7_vals vals;
 
@@ -3539,14 +3988,56 @@ struct v7 {
    */
   struct v7_call_frame_base *bottom_call_frame;
 
+  /*
+   * Unwound bcode call frames kept for reuse, linked through `prev`, so that
+   * calls of JS functions don't hit the allocator. At most
+   * `V7_CALL_FRAME_CACHE_SIZE` frames are kept.
+   */
+  struct v7_call_frame_base *free_call_frames;
+  int free_call_frames_cnt;
+
   struct mbuf stack; /* value stack for bcode interpreter */
 
+  /*
+   * Arguments of the running C function: `cfunc_argc` values in `stack`,
+   * starting at the offset `cfunc_args`. The `arguments` array
+   * (`vals.arguments`) is only created on demand, see `v7_get_arguments()`.
+   */
+  size_t cfunc_args;
+  unsigned long cfunc_argc;
+
   struct mbuf owned_strings;   /* Sequence of (varint len, char data[]) */
   struct mbuf foreign_strings; /* Sequence of (varint len, char *data) */
 
+#ifndef V7_DISABLE_STRING_RUNE_INDEX
+  struct v7_rune_index rune_index[V7_RUNE_INDEX_CACHE_SIZE];
+  int rune_index_next; /* Next slot to evict */
+#endif
+
+#ifndef V7_DISABLE_REGEXP_CACHE
+  struct v7_regexp_cache regexp_cache[V7_REGEXP_CACHE_SIZE];
+  int regexp_cache_next; /* Next slot to evict */
+#endif
+
+#ifndef V7_DISABLE_STRING_INTERNING
+  /*
+   * Interned strings: open addressing hash table of `interned_size` slots
+   * (a power of 2), of which `interned_cnt` are used. The table doesn't keep
+   * strings alive, see `gc_sweep_interned()`.
+   */
+  struct v7_interned *interned;
+  size_t interned_size;
+  size_t interned_cnt;
+#endif
+
   struct mbuf tmp_stack; /* Stack of val_t* elements, used as root set */
   int need_gc;           /* Set to true to trigger GC when safe */
 
+#ifdef V7_ENABLE_INCREMENTAL_GC
+  enum gc_phase gc_phase;
+  struct mbuf gc_gray; /* objects marked but not scanned yet (val_t) */
+#endif
+
   struct gc_arena generic_object_arena;
   struct gc_arena function_arena;
   struct gc_arena property_arena;
@@ -3555,6 +4046,8 @@ struct v7 {
   size_t bcode_ops_size;
   size_t bcode_lit_total_size;
   size_t bcode_lit_deser_size;
+  size_t array_sparse_to_dense;
+  size_t array_dense_to_sparse;
 #endif
   struct mbuf owned_values; /* buffer for GC roots owned by C code */
 
@@ -3567,6 +4060,14 @@ struct v7 {
    */
   struct mbuf act_bcodes;
 
+#ifndef V7_DISABLE_STREAMING_COMPILE
+  /*
+   * AST which is being parsed and compiled by `b_exec()`: the functions which
+   * are already compiled aren't reachable from anywhere else yet.
+   */
+  struct ast *stream_ast;
+#endif
+
   char error_msg[80]; /* Exception message */
 
   struct mbuf json_visited_stack; /* Detecting cycle in to_json */
@@ -3592,7 +4093,49 @@ struct v7 {
   /* singleton, pointer because of amalgamation */
   struct v7_property *cur_dense_prop;
 
+#ifndef V7_DISABLE_INLINE_CACHE
+  /*
+   * Incremented whenever property pointers remembered by the inline caches
+   * may become stale: on property deletion and on each GC.
+   */
+  uint32_t ic_epoch;
+#endif
+
   volatile int interrupted;
+
+#ifdef V7_ENABLE_PROFILER
+  /*
+   * Sampling profiler, see `v7_profiler_start()`. When `prof_tick` is set
+   * (by the `SIGPROF` handler, or once `prof_countdown` reaches zero where
+   * there are no signals), the interpreter samples the stack at the next
+   * safepoint.
+   */
+  volatile int prof_tick;
+  unsigned int prof_interval;
+  unsigned int prof_countdown;
+  struct v7_prof_entry *prof_stacks; /* `V7_PROFILER_MAX_STACKS` slots */
+  int prof_stacks_cnt;
+  unsigned long prof_dropped; /* samples of the stacks which didn't fit */
+  struct mbuf prof_buf;       /* the stack being sampled */
+#endif
+
+#ifdef V7_ENABLE_STATS
+  struct v7_stats stats;
+#endif
+
+#ifdef V7_ENABLE_HEAPLOG
+  /*
+   * Heap log, see `v7_heaplog_start()`. `heaplog_strs` holds the owned
+   * strings allocated since, sorted by offset.
+   */
+  FILE *heaplog;
+  struct v7_heaplog_site *heaplog_sites; /* `V7_HEAPLOG_MAX_SITES` slots */
+  unsigned int heaplog_sites_cnt;
+  struct mbuf heaplog_strs; /* of `struct v7_heaplog_str` */
+  unsigned long heaplog_str_serial;
+  struct mbuf heaplog_buf; /* the site being looked up */
+#endif
+
 #ifdef V7_STACK_SIZE
   void *sp_limit;
   void *sp_lwm;
@@ -3635,6 +4178,11 @@ struct v7 {
   FILE *freeze_file;
 #endif
 
+#ifdef V7_ENABLE_SNAPSHOT
+  /* ops of the bcodes restored from a snapshot, see `snapshot.c` */
+  char *snapshot_ops;
+#endif
+
   /*
    * true if exception is currently being created. Needed to avoid recursive
    * exception creation
@@ -3657,7 +4205,6 @@ struct v7 {
   /* true if precompiling; affects compiler bcode choices */
   unsigned int is_precompiling : 1;
 
-  enum opcode last_ops[2]; /* trace of last ops, used for error reporting */
 };
 
 struct v7_property {
@@ -3781,6 +4328,12 @@ V7_PRIVATE v7_val_t get_scope(struct v7 *v7);
  */
 V7_PRIVATE uint8_t is_strict_mode(struct v7 *v7);
 
+/*
+ * Allocates a V7 instance with empty heaps, without initializing the standard
+ * library. GC is inhibited in the returned instance.
+ */
+V7_PRIVATE struct v7 *v7_create_empty(struct v7_create_opts opts);
+
 #if defined(__cplusplus)
 }
 #endif /* __cplusplus */
@@ -4020,6 +4573,31 @@ const char *v7_get_cstring(struct v7 *v7, v7_val_t *v);
  */
 #define _V7_STRING_BUF_RESERVE 500
 
+/*
+ * Concatenation results at least that long are built as ropes: the operands
+ * are linked together, and only copied into a flat string once the result is
+ * read. This keeps loops building up a string linear. Shorter appends to a
+ * rope are merged into its last piece.
+ */
+#ifndef V7_STRING_ROPE_MIN_LEN
+#define V7_STRING_ROPE_MIN_LEN 128
+#endif
+
+/* frozen heaps can't refer to rope nodes, which are allocated at runtime */
+#if defined(V7_FREEZE) && !defined(V7_DISABLE_STRING_ROPES)
+#define V7_DISABLE_STRING_ROPES
+#endif
+
+/*
+ * The varint header of an owned string holds its length shifted left by
+ * `_V7_OSTR_FLAGS_BITS`; the low bits are flags. ASCII flags are computed
+ * lazily when the string is first accessed by character index.
+ */
+#define _V7_OSTR_FLAGS_BITS 3
+#define _V7_OSTR_CHECKED (1 << 0)  /* `_V7_OSTR_ASCII` is valid */
+#define _V7_OSTR_ASCII (1 << 1)    /* no bytes above 0x7f */
+#define _V7_OSTR_INTERNED (1 << 2) /* see `intern_string()` */
+
 #if defined(__cplusplus)
 extern "C" {
 #endif /* __cplusplus */
@@ -4030,6 +4608,79 @@ V7_PRIVATE enum v7_err v7_char_code_at(struct v7 *v7, v7_val_t s, v7_val_t at,
 V7_PRIVATE int s_cmp(struct v7 *, val_t a, val_t b);
 V7_PRIVATE val_t s_concat(struct v7 *, val_t, val_t);
 
+/*
+ * Makes a foreign string for the string data in unmanaged memory (ROM, or
+ * an mmapped bcode file) which is prefixed by its varint length, and so
+ * `hdr` points to `[varint len][char data[]]`. Unlike foreign strings made
+ * by `v7_mk_string()`, these don't take any room in `v7->foreign_strings`,
+ * so they can be made over and over again without growing the heap.
+ */
+V7_PRIVATE val_t mk_mapped_string(struct v7 *v7, const char *hdr);
+
+/*
+ * Equivalents of `utfnlen()` and `utfnshift()` for the string `v`, whose data
+ * is `p` (as returned by `v7_get_string()`) and length is `n` bytes. They
+ * avoid walking ASCII strings, and keep a rune index for longer non-ASCII
+ * ones, so that index-based access is O(1) amortized.
+ */
+V7_PRIVATE size_t s_utfnlen(struct v7 *v7, val_t v, const char *p, size_t n);
+V7_PRIVATE const char *s_utfnshift(struct v7 *v7, val_t v, const char *p,
+                                   size_t n, size_t idx);
+
+#ifndef V7_DISABLE_STRING_RUNE_INDEX
+/* Drops all cached rune indices */
+V7_PRIVATE void rune_index_reset(struct v7 *v7);
+#endif
+
+/*
+ * Property names are interned: there is only one string with any given
+ * contents among the names of all the properties, so that names can be
+ * compared by value, and objects with the same keys share the key strings.
+ *
+ * Short and dictionary strings are unique by construction. Owned strings are
+ * made unique by the table of interned strings, and are flagged with
+ * `_V7_OSTR_INTERNED`. Foreign and mapped strings and ropes are not interned,
+ * so property names of those kinds are compared by contents.
+ */
+
+/* Returns the interned string with the given contents, making it if needed */
+V7_PRIVATE val_t intern_string(struct v7 *v7, const char *p, size_t len);
+
+/*
+ * Returns the interned string with the same contents as `v`. An owned string
+ * which is not interned yet becomes interned itself, and strings which can't
+ * be interned are returned as is.
+ */
+V7_PRIVATE val_t intern_string_v(struct v7 *v7, val_t v);
+
+/*
+ * Like `intern_string()`, but doesn't intern anything new: if there is no
+ * interned string with the given contents, returns `V7_UNDEFINED`.
+ */
+V7_PRIVATE val_t find_interned(struct v7 *v7, const char *p, size_t len);
+
+/*
+ * Returns true if the property name `v` is interned, so that it can't be
+ * equal to a name with a different value.
+ */
+V7_PRIVATE int is_interned_name(val_t v);
+
+#ifndef V7_DISABLE_STRING_INTERNING
+/*
+ * Removes unreachable strings from the table of interned strings. Called by
+ * the GC after marking, so that the compaction of strings updates the table.
+ */
+V7_PRIVATE void gc_sweep_interned(struct v7 *v7);
+
+#ifdef V7_ENABLE_SNAPSHOT
+/*
+ * Empties the table of interned strings, and clears `_V7_OSTR_INTERNED` of
+ * all the owned strings.
+ */
+V7_PRIVATE void interned_reset(struct v7 *v7);
+#endif
+#endif
+
 /*
  * Convert a C string to to an unsigned integer.
  * `ok` will be set to true if the string conforms to
@@ -4049,9 +4700,18 @@ V7_PRIVATE enum v7_err str_to_ulong(struct v7 *v7, val_t v, int *ok,
  */
 V7_PRIVATE unsigned long cstr_to_ulong(const char *s, size_t len, int *ok);
 
+/*
+ * Returns true if the string is the canonical form of an array index (i.e.
+ * has no sign, spaces or leading zeros, and is less than 2^32 - 1), and
+ * stores the index in `res`.
+ */
+V7_PRIVATE int cstr_to_array_index(const char *s, size_t len,
+                                   unsigned long *res);
+
 enum embstr_flags {
   EMBSTR_ZERO_TERM = (1 << 0),
   EMBSTR_UNESCAPE = (1 << 1),
+  EMBSTR_OWNED = (1 << 2), /* leave room for `_V7_OSTR_*` flags in the len */
 };
 
 V7_PRIVATE void embed_string(struct mbuf *m, size_t offset, const char *p,
@@ -4059,6 +4719,11 @@ V7_PRIVATE void embed_string(struct mbuf *m, size_t offset, const char *p,
 
 V7_PRIVATE size_t unescape(const char *s, size_t len, char *to);
 
+#ifndef V7_DISABLE_STRING_ROPES
+/* Frees the data of a rope node, called when the node is collected */
+V7_PRIVATE void rope_destroy(struct v7 *v7, struct v7_property *r);
+#endif
+
 #if defined(__cplusplus)
 }
 #endif /* __cplusplus */
@@ -4260,29 +4925,45 @@ V7_PRIVATE struct v7_property *v7_get_own_property(struct v7 *v7, val_t obj,
                                                    const char *name,
                                                    size_t len);
 
+/*
+ * Like `v7_next_prop()`, but also visits elements of dense arrays and typed
+ * arrays, before the ordinary properties. Element names are created as strings.
+ *
+ * Handles of elements are odd, unlike property pointers: the element index is
+ * kept in the upper bits.
+ */
+#define DENSE_ITER(idx) ((void *) (uintptr_t)((idx) << 1 | 1))
+#define IS_DENSE_ITER(h) ((uintptr_t)(h) &1)
+#define DENSE_ITER_IDX(h) ((unsigned long) ((uintptr_t)(h) >> 1))
+
+V7_PRIVATE void *v7_next_prop2(struct v7 *v7, void *handle, v7_val_t obj,
+                               v7_val_t *name, v7_val_t *value,
+                               v7_prop_attr_t *attrs);
+
 /*
  * If `len` is -1/MAXUINT/~0, then `name` must be 0-terminated
  *
  * Returns a pointer to the property structure, given an object and a name of
  * the property as a pointer to string buffer and length.
- *
- * See also `v7_get_property_v`
  */
 V7_PRIVATE struct v7_property *v7_get_property(struct v7 *v7, val_t obj,
                                                const char *name, size_t len);
 
-/*
- * Just like `v7_get_property`, but takes name as a `v7_val_t`
- */
-V7_PRIVATE enum v7_err v7_get_property_v(struct v7 *v7, val_t obj,
-                                         v7_val_t name,
-                                         struct v7_property **res);
-
 WARN_UNUSED_RESULT
 V7_PRIVATE enum v7_err v7_get_throwing_v(struct v7 *v7, v7_val_t obj,
                                          v7_val_t name, v7_val_t *res);
 
-V7_PRIVATE void v7_destroy_property(struct v7_property **p);
+/*
+ * Unlinks the property `*p` from its object. It could be remembered by the
+ * inline caches, so they are invalidated.
+ */
+V7_PRIVATE void v7_destroy_property(struct v7 *v7, struct v7_property **p);
+
+/*
+ * Invalidates the inline caches; must be called whenever properties are
+ * unlinked from objects or renamed, since the caches only notice additions.
+ */
+V7_PRIVATE void v7_invalidate_ic(struct v7 *v7);
 
 WARN_UNUSED_RESULT
 V7_PRIVATE enum v7_err v7_invoke_setter(struct v7 *v7, struct v7_property *prop,
@@ -4565,6 +5246,37 @@ enum v7_err v7_array_set_throwing(struct v7 *v7, v7_val_t arr,
 /* Delete value in array `arr` at index `index`, if it exists. */
 void v7_array_del(struct v7 *v7, v7_val_t arr, unsigned long index);
 
+#if V7_ENABLE__ArrayBuffer
+
+/*
+ * Make an `ArrayBuffer` holding a copy of `len` bytes at `data`. If `data` is
+ * NULL, the buffer is filled with zeros. Returns undefined if out of memory.
+ */
+v7_val_t v7_mk_array_buffer(struct v7 *v7, const void *data, size_t len);
+
+/*
+ * Make an `ArrayBuffer` which uses `len` bytes at `data` as its storage,
+ * without copying. `data` must stay valid until the buffer is garbage
+ * collected; at that point `free_cb`, if not NULL, is called with `data`.
+ * E.g., pass `free` to hand over a malloc-ed block.
+ */
+v7_val_t v7_mk_array_buffer_external(struct v7 *v7, void *data, size_t len,
+                                     v7_destructor_cb_t *free_cb);
+
+/* Returns true if given value is an `ArrayBuffer` object */
+int v7_is_array_buffer(struct v7 *v7, v7_val_t v);
+
+/*
+ * Returns a pointer to the bytes of an `ArrayBuffer`, or to the bytes viewed
+ * by a typed array or a `DataView`, and stores their number in `len`. The
+ * bytes can be read and modified in place, while the object is alive.
+ *
+ * Returns NULL if `v` is none of those objects.
+ */
+void *v7_get_array_buffer_data(struct v7 *v7, v7_val_t v, size_t *len);
+
+#endif /* V7_ENABLE__ArrayBuffer */
+
 #if defined(__cplusplus)
 }
 #endif /* __cplusplus */
@@ -4593,6 +5305,18 @@ V7_PRIVATE v7_val_t v7_mk_dense_array(struct v7 *v7);
 V7_PRIVATE val_t
 v7_array_get2(struct v7 *v7, v7_val_t arr, unsigned long index, int *has);
 
+/*
+ * Returns the buffer holding the elements of a dense array, or NULL if `arr`
+ * is not a dense array or has no elements yet.
+ */
+V7_PRIVATE struct mbuf *dense_array_buf(struct v7 *v7, v7_val_t arr);
+
+/*
+ * Moves the elements of a dense array into ordinary properties; the array
+ * stops being dense.
+ */
+V7_PRIVATE void dense_array_to_sparse(struct v7 *v7, v7_val_t arr);
+
 #if defined(__cplusplus)
 }
 #endif /* __cplusplus */
@@ -4678,6 +5402,23 @@ enum v7_err v7_stringify_throwing(struct v7 *v7, v7_val_t v, char *buf,
  */
 #define v7_to_json(a, b, c, d) v7_stringify(a, b, c, d, V7_STRINGIFY_JSON)
 
+/*
+ * Callback which receives consecutive chunks of output of
+ * `v7_stringify_to_cb()`.
+ */
+typedef void(v7_stringify_cb_t)(const char *data, size_t len, void *user_data);
+
+/*
+ * Generate JSON representation of `v` like `JSON.stringify()` does, passing
+ * it to `cb` in chunks as it's being generated, so that the whole string
+ * never has to be kept in memory. If an exception is thrown in the middle,
+ * the output is incomplete. If `v` has no JSON representation (e.g. it's
+ * `undefined`), `cb` is not called at all.
+ */
+WARN_UNUSED_RESULT
+enum v7_err v7_stringify_to_cb(struct v7 *v7, v7_val_t v,
+                               v7_stringify_cb_t *cb, void *user_data);
+
 /* Returns true if given value evaluates to true, as in `if (v)` statement. */
 int v7_is_truthy(struct v7 *v7, v7_val_t v);
 
@@ -4896,6 +5637,16 @@ V7_PRIVATE enum v7_err to_json_or_debug(struct v7 *v7, val_t v, char *buf,
                                         size_t size, size_t *res_len,
                                         uint8_t is_debug);
 
+/*
+ * Generate JSON like `JSON.stringify(v, replacer, space)` does, and append it
+ * to the mbuf `m`. `*emitted` is set to 0 if `v` has no JSON representation,
+ * in which case nothing is appended.
+ */
+WARN_UNUSED_RESULT
+V7_PRIVATE enum v7_err json_stringify_to_mbuf(struct v7 *v7, val_t v,
+                                              val_t replacer, val_t space,
+                                              struct mbuf *m, int *emitted);
+
 /*
  * Calls `valueOf()` on given object `v`
  */
@@ -5147,10 +5898,6 @@ struct bcode;
 
 V7_PRIVATE enum v7_type val_type(struct v7 *v7, val_t v);
 
-#ifndef V7_DISABLE_LINE_NUMBERS
-V7_PRIVATE uint8_t msb_lsb_swap(uint8_t b);
-#endif
-
 /*
  * At the moment, all other utility functions are public, and are declared in
  * `util_public.h`
@@ -5458,6 +6205,8 @@ enum ast_tag {
 
   AST_USE_STRICT,
 
+  AST_COMPILED_FUNC,
+
   AST_MAX_TAG
 };
 
@@ -5465,8 +6214,25 @@ struct ast {
   struct mbuf mbuf;
   int refcnt;
   int has_overflow;
+#ifndef V7_DISABLE_STREAMING_COMPILE
+  /*
+   * If not NULL, functions are compiled as soon as they are parsed, and their
+   * subtrees are replaced with `AST_COMPILED_FUNC` nodes, see
+   * `compile_parsed_function()`. Function bcodes take the filename of `script`.
+   */
+  struct bcode *script;
+  struct mbuf funcs; /* of `struct ast_compiled_func` */
+#endif
 };
 
+#ifndef V7_DISABLE_STREAMING_COMPILE
+/* Function referred to by an `AST_COMPILED_FUNC` node */
+struct ast_compiled_func {
+  struct bcode *bcode; /* retained */
+  int line_no;         /* line number at the end of the function */
+};
+#endif
+
 typedef unsigned long ast_off_t;
 
 #if __GNUC__ >= 4 && __GNUC_MINOR__ >= 8
@@ -5662,7 +6428,7 @@ V7_PRIVATE void release_ast(struct v7 *v7, struct ast *a);
 #ifndef CS_V7_SRC_BCODE_H_
 #define CS_V7_SRC_BCODE_H_
 
-#define BIN_BCODE_SIGNATURE "V\007BCODE:"
+#define BIN_BCODE_SIGNATURE "V\007BCODE3"
 
 #if !defined(V7_NAMES_CNT_WIDTH)
 #define V7_NAMES_CNT_WIDTH 10
@@ -5697,6 +6463,43 @@ extern "C" {
 
 typedef uint32_t bcode_off_t;
 
+/* Invalid bcode offset, used by the builder for "no instruction" */
+#define BCODE_NO_OP ((bcode_off_t) ~0)
+
+#ifndef V7_DISABLE_INLINE_CACHE
+
+/* Max number of inline cache entries per bcode (should be a power of 2) */
+#ifndef V7_IC_MAX_ENTRIES
+#define V7_IC_MAX_ENTRIES 64
+#endif
+
+/*
+ * Inline cache entry: remembers where the property `name` of the object
+ * `obj` was found by the instruction at `off`, so that the next lookup made
+ * by the same instruction on the same object costs a few compares instead of
+ * walking the property list.
+ *
+ * The property lives either in `obj` itself or in its direct prototype
+ * (`holder`). The entry is valid while `v7->ic_epoch` stays the same (see
+ * `v7_invalidate_ic()`, it also changes on each GC) and while
+ * `obj->properties` is still `head` (i.e. nothing was added to the object).
+ *
+ * Entries are keyed on the object itself: objects don't share a layout, so
+ * an instruction which sees a new object every time (e.g. a method reading
+ * `this.x` of many instances) misses on each of them.
+ */
+struct bcode_ic_entry {
+  bcode_off_t off;
+  uint32_t epoch;
+  val_t name;
+  struct v7_object *obj;
+  struct v7_property *head;
+  struct v7_object *holder;
+  struct v7_property *prop;
+};
+
+#endif
+
 /*
  * Each JS function will have one bcode structure
  * containing the instruction stream, a literal table, and function
@@ -5723,6 +6526,15 @@ struct bcode {
   /* Literal table */
   struct v7_vec lit;
 
+#ifndef V7_DISABLE_LINE_NUMBERS
+  /*
+   * Line number table: pairs of varints `(offset delta, line number)`, one
+   * per line change, sorted by the offset in `ops`. Instructions before the
+   * first entry are at line 1. See `bcode_get_line_no()`.
+   */
+  struct v7_vec lines;
+#endif
+
 #ifndef V7_DISABLE_FILENAMES
   /* Name of the file from which this bcode was generated (used for debug) */
   void *filename;
@@ -5744,7 +6556,7 @@ struct bcode {
    */
   unsigned int frozen : 1;
 
-  /* If set, `ops.buf` points to ROM, so we shouldn't free it */
+  /* If set, `ops.buf` and `lines.buf` point to ROM, so we shouldn't free it */
   unsigned int ops_in_rom : 1;
   /* Set for deserialized bcode. Used for metrics only */
   unsigned int deserialized : 1;
@@ -5752,10 +6564,38 @@ struct bcode {
   /* Set when `ops` contains function name as the first `name` */
   unsigned int func_name_present : 1;
 
+  /*
+   * Set when the function's name, args and locals live in the frame slots
+   * on the data stack instead of the scope object, and are accessed with
+   * `OP_GET_LOCAL` / `OP_SET_LOCAL`. Slot `i` corresponds to the `i`th name.
+   */
+  unsigned int frame_slots : 1;
+
+  /*
+   * Set (along with `frame_slots`) when the function refers to `arguments`:
+   * the arguments array then lives in the extra slot `names_cnt`.
+   */
+  unsigned int arguments_slot : 1;
+
+  /*
+   * Set for the functions without `frame_slots` which never refer to
+   * `arguments`: calls don't create the `arguments` object then.
+   */
+  unsigned int no_arguments : 1;
+
 #ifndef V7_DISABLE_FILENAMES
   /* If set, `filename` points to ROM, so we shouldn't free it */
   unsigned int filename_in_rom : 1;
 #endif
+
+#ifndef V7_DISABLE_INLINE_CACHE
+  /*
+   * Inline caches of the property access instructions, allocated on first
+   * use; an instruction at offset `off` uses the entry `off & ic_mask`.
+   */
+  struct bcode_ic_entry *ic;
+  uint8_t ic_mask;
+#endif
 };
 
 /*
@@ -5768,6 +6608,19 @@ struct bcode_builder {
 
   struct mbuf ops; /* names + instruction opcode */
   struct mbuf lit; /* literal table */
+#ifndef V7_DISABLE_LINE_NUMBERS
+  struct mbuf lines;     /* line number table */
+  bcode_off_t lines_off; /* offset of the last line number table entry */
+#endif
+
+  /*
+   * Offsets of the last two instructions, used to fuse superinstructions:
+   * `BCODE_NO_OP` if unknown. `label` is the last offset which might be a
+   * branch target, see `bcode_pos()`.
+   */
+  bcode_off_t last_op;
+  bcode_off_t prev_op;
+  bcode_off_t label;
 };
 
 enum bcode_ser_lit_tag {
@@ -5909,6 +6762,13 @@ V7_PRIVATE void bcode_op(struct bcode_builder *bbuilder, uint8_t op);
 #ifndef V7_DISABLE_LINE_NUMBERS
 V7_PRIVATE void bcode_append_lineno(struct bcode_builder *bbuilder,
                                     int line_no);
+
+/*
+ * Returns the line number of the instruction right before `ops`, which is a
+ * position saved in a bcode call frame (see `bcode_save_ops()`), or 1 if
+ * `ops` is NULL.
+ */
+V7_PRIVATE int bcode_get_line_no(struct bcode *bcode, const char *ops);
 #endif
 
 /*
@@ -5979,6 +6839,13 @@ bcode_op_target(struct bcode_builder *bbuilder, uint8_t op);
 V7_PRIVATE void bcode_patch_target(struct bcode_builder *bbuilder,
                                    bcode_off_t label, bcode_off_t target);
 
+/*
+ * Appends `len` bytes from `buf` to the ops being built, keeping the memory
+ * stats up to date. With `buf` being NULL the space is left uninitialized.
+ */
+V7_PRIVATE size_t bcode_ops_append(struct bcode_builder *bbuilder,
+                                   const void *buf, size_t len);
+
 V7_PRIVATE void bcode_add_varint(struct bcode_builder *bbuilder, size_t value);
 /*
  * Reads varint-encoded integer from the provided pointer, and adjusts
@@ -6046,7 +6913,10 @@ enum v7_heap_stat_what {
   V7_HEAP_STAT_BCODE_LIT_TOTAL_SIZE,
   V7_HEAP_STAT_BCODE_LIT_DESER_SIZE,
   V7_HEAP_STAT_FUNC_OWNED,
-  V7_HEAP_STAT_FUNC_OWNED_MAX
+  V7_HEAP_STAT_FUNC_OWNED_MAX,
+  /* Number of times an ordinary array became dense, and vice versa */
+  V7_HEAP_STAT_ARRAY_SPARSE_TO_DENSE,
+  V7_HEAP_STAT_ARRAY_DENSE_TO_SPARSE
 };
 
 /* Returns a given heap statistics */
@@ -6090,11 +6960,48 @@ void v7_gc(struct v7 *v7, int full);
 /*
  * Similar to `MARK()` / `UNMARK()` / `MARKED()`, but `.._FREE` counterparts
  * are intended to mark free cells (as opposed to used ones), so they use
- * bit 1.
+ * bit 1. Cells on the free list always carry this mark, so the link to the
+ * next free cell has to be read with `FREE_LINK()`.
  */
 #define MARK_FREE(p) (((struct gc_cell *) (p))->head.word |= 2)
 #define UNMARK_FREE(p) (((struct gc_cell *) (p))->head.word &= ~2)
 #define MARKED_FREE(p) (((struct gc_cell *) (p))->head.word & 2)
+#define FREE_LINK(p) \
+  ((struct gc_cell *) (((struct gc_cell *) (p))->head.word & ~(uintptr_t) 2))
+
+#ifdef V7_ENABLE_INCREMENTAL_GC
+/*
+ * Amount of work done by a single incremental GC step: number of objects,
+ * properties and values scanned while marking, or cells visited while
+ * sweeping.
+ */
+#ifndef V7_GC_STEP_BUDGET
+#define V7_GC_STEP_BUDGET 256
+#endif
+
+/*
+ * Write barrier: must be invoked whenever a value is stored into a heap
+ * cell (property value, prototype, scope, dense array slot, bcode literal),
+ * and whenever a property is linked into an object. While an incremental
+ * cycle is marking, it makes sure that already scanned objects never end up
+ * pointing to unmarked ones.
+ */
+#define GC_WRITE_BARRIER(v7, v)                              \
+  do {                                                       \
+    if ((v7)->gc_phase == GC_PHASE_MARK) gc_shade((v7), (v)); \
+  } while (0)
+#define GC_WRITE_BARRIER_PROP(v7, p)                              \
+  do {                                                            \
+    if ((v7)->gc_phase == GC_PHASE_MARK) gc_shade_prop((v7), (p)); \
+  } while (0)
+#else
+#define GC_WRITE_BARRIER(v7, v) \
+  do {                          \
+  } while (0)
+#define GC_WRITE_BARRIER_PROP(v7, p) \
+  do {                               \
+  } while (0)
+#endif
 
 /*
  * performs arithmetics on gc_cell pointers as if they were arena->cell_size
@@ -6124,6 +7031,7 @@ V7_PRIVATE struct v7_property *new_property(struct v7 *);
 V7_PRIVATE struct v7_js_function *new_function(struct v7 *);
 
 V7_PRIVATE void gc_mark(struct v7 *, val_t);
+void gc_mark_string(struct v7 *, val_t *);
 
 V7_PRIVATE void gc_arena_init(struct gc_arena *, size_t, size_t, size_t,
                               const char *);
@@ -6131,6 +7039,19 @@ V7_PRIVATE void gc_arena_destroy(struct v7 *, struct gc_arena *a);
 V7_PRIVATE void gc_sweep(struct v7 *, struct gc_arena *, size_t);
 V7_PRIVATE void *gc_alloc_cell(struct v7 *, struct gc_arena *);
 
+#ifdef V7_ENABLE_SNAPSHOT
+/*
+ * Drops all blocks of an arena without running destructors, and gives it a
+ * single block of `n` cells, whose base is returned. The caller fills the
+ * block in (free cells marked with `MARK_FREE()`) and calls
+ * `gc_arena_relink()`.
+ */
+V7_PRIVATE struct gc_cell *gc_arena_reset(struct gc_arena *a, size_t n);
+
+/* Rebuilds the free list of an arena from the cells marked as free */
+V7_PRIVATE void gc_arena_relink(struct gc_arena *a);
+#endif
+
 V7_PRIVATE struct gc_tmp_frame new_tmp_frame(struct v7 *);
 V7_PRIVATE void tmp_frame_cleanup(struct gc_tmp_frame *);
 V7_PRIVATE void tmp_stack_push(struct gc_tmp_frame *, val_t *);
@@ -6139,6 +7060,20 @@ V7_PRIVATE void compute_need_gc(struct v7 *);
 /* perform gc if not inhibited */
 V7_PRIVATE void maybe_gc(struct v7 *);
 
+#ifdef V7_ENABLE_INCREMENTAL_GC
+/*
+ * Performs at most `budget` units of work of the incremental GC cycle,
+ * starting a new cycle if none is in progress.
+ */
+V7_PRIVATE void gc_step(struct v7 *, size_t budget);
+
+/* Marks the object `v` (if it is one) and queues it for scanning */
+V7_PRIVATE void gc_shade(struct v7 *, val_t v);
+
+/* Marks the property cell and its value */
+V7_PRIVATE void gc_shade_prop(struct v7 *, struct v7_property *p);
+#endif
+
 #ifndef V7_DISABLE_STR_ALLOC_SEQ
 V7_PRIVATE uint16_t
 gc_next_allocation_seqn(struct v7 *v7, const char *str, size_t len);
@@ -6184,8 +7119,8 @@ V7_PRIVATE size_t gc_arena_size(struct gc_arena *);
 
 #if !defined(V7_DISABLE_FILENAMES) && !defined(V7_DISABLE_LINE_NUMBERS)
 struct shdata {
-  /* Reference count */
-  uint8_t refcnt;
+  /* Reference count: each function's bcode holds the filename of its script */
+  uint32_t refcnt;
 
   /*
    * Note: we'd use `unsigned char payload[];` here, but we can't, since this
@@ -6240,14 +7175,19 @@ extern "C" {
 
 WARN_UNUSED_RESULT
 V7_PRIVATE enum v7_err eval_bcode(struct v7 *v7, struct bcode *bcode,
-                                  val_t this_object, uint8_t reset_line_no,
-                                  val_t *_res);
+                                  val_t this_object, val_t *_res);
 
 WARN_UNUSED_RESULT
 V7_PRIVATE enum v7_err b_apply(struct v7 *v7, v7_val_t func, v7_val_t this_obj,
                                v7_val_t args, uint8_t is_constructor,
                                v7_val_t *res);
 
+WARN_UNUSED_RESULT
+V7_PRIVATE enum v7_err call_cfunction(struct v7 *v7, val_t func,
+                                      val_t this_object, val_t args,
+                                      unsigned long argc,
+                                      uint8_t is_constructor, val_t *res);
+
 WARN_UNUSED_RESULT
 V7_PRIVATE enum v7_err b_exec(struct v7 *v7, const char *src, size_t src_len,
                               const char *filename, val_t func, val_t args,
@@ -6265,6 +7205,18 @@ V7_PRIVATE enum v7_err b_exec(struct v7 *v7, const char *src, size_t src_len,
 V7_PRIVATE struct v7_call_frame_base *find_call_frame(struct v7 *v7,
                                                       uint8_t type_mask);
 
+#ifndef V7_DISABLE_BCODE_OPT
+/*
+ * Evaluates the instruction `op` on primitive values exactly like
+ * `eval_bcode()` does. `op` is one of the arithmetic, bitwise or comparison
+ * instructions, `OP_ADD`, or a unary one, which takes just `v2`. Used by
+ * the optimizer to fold constants.
+ */
+WARN_UNUSED_RESULT
+V7_PRIVATE enum v7_err eval_const_op(struct v7 *v7, enum opcode op, val_t v1,
+                                     val_t v2, val_t *res);
+#endif
+
 #if defined(__cplusplus)
 }
 #endif /* __cplusplus */
@@ -6295,12 +7247,410 @@ V7_PRIVATE enum v7_err compile_script(struct v7 *v7, struct ast *a,
 V7_PRIVATE enum v7_err compile_expr(struct v7 *v7, struct ast *a,
                                     ast_off_t *ppos, struct bcode *bcode);
 
+#ifndef V7_DISABLE_STREAMING_COMPILE
+/*
+ * Compiles the function whose `AST_FUNC` node, starting at `pos`, is the
+ * last thing in the AST, and replaces the node with an `AST_COMPILED_FUNC`
+ * one. `line_no` is the line the function starts at.
+ *
+ * Called by the parser for each function as soon as it's parsed, so that
+ * the AST holds at most one function body at a time.
+ */
+V7_PRIVATE enum v7_err compile_parsed_function(struct v7 *v7, struct ast *a,
+                                               ast_off_t pos, int line_no);
+#endif
+
 #if defined(__cplusplus)
 }
 #endif /* __cplusplus */
 
 #endif /* CS_V7_SRC_COMPILER_H_ */
 #ifdef V7_MODULE_LINES
+#line 1 "./v7/src/bcode_opt.h"
+#endif
+/*
+ * Copyright (c) 2014 Cesanta Software Limited
+ * All rights reserved
+ */
+
+#ifndef CS_V7_SRC_BCODE_OPT_H_
+#define CS_V7_SRC_BCODE_OPT_H_
+
+/* Amalgamated: #include "v7/src/internal.h" */
+/* Amalgamated: #include "v7/src/bcode.h" */
+
+#if defined(__cplusplus)
+extern "C" {
+#endif /* __cplusplus */
+
+#ifndef V7_DISABLE_BCODE_OPT
+/*
+ * Rewrites the instructions emitted into `bbuilder` into equivalent, but
+ * shorter and faster ones: folds constant expressions, drops branches on
+ * constant conditions, threads jumps to jumps, and removes unreachable code
+ * and redundant stack shuffling. Jump targets, the line number table and the
+ * literal table are updated accordingly.
+ *
+ * Should be called when the whole function or script is compiled, right
+ * before `bcode_builder_finalize()`. Leaves the code intact if it can't be
+ * decoded.
+ */
+V7_PRIVATE void bcode_optimize(struct bcode_builder *bbuilder);
+#endif
+
+#if defined(__cplusplus)
+}
+#endif /* __cplusplus */
+
+#endif /* CS_V7_SRC_BCODE_OPT_H_ */
+#ifdef V7_MODULE_LINES
+#line 1 "./v7/src/profiler.h"
+#endif
+/*
+ * Copyright (c) 2014 Cesanta Software Limited
+ * All rights reserved
+ */
+
+#ifndef CS_V7_SRC_PROFILER_H_
+#define CS_V7_SRC_PROFILER_H_
+
+/* Amalgamated: #include "v7/src/internal.h" */
+/* Amalgamated: #include "v7/src/core.h" */
+/* Amalgamated: #include "v7/src/profiler_public.h" */
+
+#ifdef V7_ENABLE_PROFILER
+
+#if CS_PLATFORM == CS_P_UNIX
+#define V7_PROFILER_SIGPROF
+#endif
+
+/*
+ * Checked by the interpreter at each safepoint: whether it's time to take a
+ * sample with `profiler_sample()`.
+ */
+#ifdef V7_PROFILER_SIGPROF
+#define PROFILER_TICK(v7) ((v7)->prof_tick)
+#else
+#define PROFILER_TICK(v7) \
+  ((v7)->prof_countdown != 0 && --(v7)->prof_countdown == 0)
+#endif
+
+#if defined(__cplusplus)
+extern "C" {
+#endif /* __cplusplus */
+
+/*
+ * Records the current JS stack. The position in the topmost bcode frame
+ * should be saved in the frame beforehand.
+ */
+V7_PRIVATE void profiler_sample(struct v7 *v7);
+
+/* Stops profiling and frees the collected samples */
+V7_PRIVATE void profiler_destroy(struct v7 *v7);
+
+#if defined(__cplusplus)
+}
+#endif /* __cplusplus */
+
+#endif /* V7_ENABLE_PROFILER */
+
+#if defined(V7_ENABLE_PROFILER) || defined(V7_ENABLE_HEAPLOG)
+
+#if defined(__cplusplus)
+extern "C" {
+#endif /* __cplusplus */
+
+/* Helpers to name JS stacks, shared with the heap log */
+V7_PRIVATE uint32_t prof_hash(const char *p, size_t len);
+V7_PRIVATE void prof_append_str(struct mbuf *m, const char *str);
+V7_PRIVATE void prof_append_frame(struct mbuf *m,
+                                  struct v7_call_frame_base *cf);
+
+#if defined(__cplusplus)
+}
+#endif /* __cplusplus */
+
+#endif
+
+#endif /* CS_V7_SRC_PROFILER_H_ */
+#ifdef V7_MODULE_LINES
+#line 1 "./v7/src/stats_public.h"
+#endif
+/*
+ * Copyright (c) 2014 Cesanta Software Limited
+ * All rights reserved
+ */
+
+/*
+ * === Execution statistics
+ *
+ * Counters of what the interpreter does: instructions and pairs of
+ * consecutive instructions executed, property lookups along prototype
+ * chains, calls of C functions and garbage collections. They tell which
+ * paths of the interpreter are worth optimizing for the given scripts.
+ *
+ * Counting slows the interpreter down, so it's only available if V7 is
+ * built with `V7_ENABLE_STATS`.
+ */
+
+#ifndef CS_V7_SRC_STATS_PUBLIC_H_
+#define CS_V7_SRC_STATS_PUBLIC_H_
+
+/* Amalgamated: #include "v7/src/core_public.h" */
+
+#ifdef V7_ENABLE_STATS
+
+#if defined(__cplusplus)
+extern "C" {
+#endif /* __cplusplus */
+
+/* Execution metric id, see `v7_exec_stat()` */
+enum v7_exec_stat_what {
+  /* Number of opcodes, i.e. the range of `idx` for the opcode counters */
+  V7_EXEC_STAT_OPCODES,
+  /* Instructions executed */
+  V7_EXEC_STAT_OPS,
+  /* Times the opcode `idx` was executed */
+  V7_EXEC_STAT_OP,
+  /*
+   * Times the opcode `idx % V7_EXEC_STAT_OPCODES` was executed right after
+   * the opcode `idx / V7_EXEC_STAT_OPCODES`
+   */
+  V7_EXEC_STAT_OP_PAIR,
+  /* Property lookups which weren't served by inline caches */
+  V7_EXEC_STAT_PROP_LOOKUPS,
+  /* Objects visited by these lookups along prototype chains */
+  V7_EXEC_STAT_PROP_LOOKUP_STEPS,
+  /* Number of groups of lookups below, i.e. the range of `idx` */
+  V7_EXEC_STAT_PROP_LOOKUP_DEPTHS,
+  /*
+   * Lookups which visited `idx + 1` objects, or more than that for the last
+   * group
+   */
+  V7_EXEC_STAT_PROP_LOOKUP_DEPTH,
+  /* Calls of C functions */
+  V7_EXEC_STAT_CFUNC_CALLS,
+  /* Number of C functions counted one by one, i.e. the range of `idx` */
+  V7_EXEC_STAT_CFUNCS,
+  /* Calls of the C function `idx`, see `v7_exec_stat_cfunc_name()` */
+  V7_EXEC_STAT_CFUNC,
+  /* Stop-the-world garbage collections */
+  V7_EXEC_STAT_GC_CYCLES,
+  /* Steps of incremental garbage collection */
+  V7_EXEC_STAT_GC_STEPS,
+  /* Time spent collecting garbage, in microseconds */
+  V7_EXEC_STAT_GC_TIME_US
+};
+
+/*
+ * Returns a given execution statistics; `idx` is only used by the per-item
+ * metrics. Returns 0 if `idx` is out of range.
+ */
+unsigned long v7_exec_stat(struct v7 *v7, enum v7_exec_stat_what what,
+                           int idx);
+
+/* Returns the name of a given opcode, or NULL if `op` is out of range */
+const char *v7_exec_stat_op_name(int op);
+
+/*
+ * Returns the name of a given C function counted by `V7_EXEC_STAT_CFUNC`,
+ * i.e. the path to it from the global object like `Math.max` or
+ * `Array.prototype.push`, or its address if it wasn't found there. Returns
+ * NULL if `idx` is out of range. The name is valid until the counters are
+ * reset.
+ */
+const char *v7_exec_stat_cfunc_name(struct v7 *v7, int idx);
+
+/* Resets all the counters */
+void v7_exec_stat_reset(struct v7 *v7);
+
+#if defined(__cplusplus)
+}
+#endif /* __cplusplus */
+
+#endif /* V7_ENABLE_STATS */
+
+#endif /* CS_V7_SRC_STATS_PUBLIC_H_ */
+#ifdef V7_MODULE_LINES
+#line 1 "./v7/src/stats.h"
+#endif
+/*
+ * Copyright (c) 2014 Cesanta Software Limited
+ * All rights reserved
+ */
+
+#ifndef CS_V7_SRC_STATS_H_
+#define CS_V7_SRC_STATS_H_
+
+/* Amalgamated: #include "v7/src/internal.h" */
+/* Amalgamated: #include "v7/src/core.h" */
+/* Amalgamated: #include "v7/src/stats_public.h" */
+
+#ifdef V7_ENABLE_STATS
+
+/* Counts an instruction about to be executed, along with the previous one */
+#define STATS_OP(v7, op)                                  \
+  do {                                                    \
+    struct v7_stats *_s = &(v7)->stats;                   \
+    if ((uint8_t)(op) < OP_MAX) {                         \
+      _s->ops[(uint8_t)(op)]++;                           \
+      _s->op_pairs[_s->prev_op][(uint8_t)(op)]++;         \
+      _s->prev_op = (uint8_t)(op);                        \
+    }                                                     \
+  } while (0)
+
+#if defined(__cplusplus)
+extern "C" {
+#endif /* __cplusplus */
+
+/* Counts a property lookup which has visited `depth` objects */
+V7_PRIVATE void stats_count_prop_lookup(struct v7 *v7, unsigned long depth);
+
+/* Counts a call of a C function */
+V7_PRIVATE void stats_count_cfunc(struct v7 *v7, v7_cfunction_t *func);
+
+/*
+ * Returns the current time in microseconds, to measure the time spent in
+ * the garbage collector; see `stats_count_gc()`.
+ */
+V7_PRIVATE double stats_now_us(void);
+
+/* Counts a collection, or a step of one, which has started at `start_us` */
+V7_PRIVATE void stats_count_gc(struct v7 *v7, int is_step, double start_us);
+
+/* Frees the names of C functions */
+V7_PRIVATE void stats_destroy(struct v7 *v7);
+
+#if defined(__cplusplus)
+}
+#endif /* __cplusplus */
+
+#else
+
+#define STATS_OP(v7, op)
+
+#endif /* V7_ENABLE_STATS */
+
+#endif /* CS_V7_SRC_STATS_H_ */
+#ifdef V7_MODULE_LINES
+#line 1 "./v7/src/heaplog_public.h"
+#endif
+/*
+ * Copyright (c) 2014 Cesanta Software Limited
+ * All rights reserved
+ */
+
+/*
+ * === Heap log
+ *
+ * Log of the allocations made in the JS heap, attributed to the JS code
+ * which made them. It's meant to be read with `tools/heaplog_viewer`,
+ * possibly interleaved with the `malloc` log of the firmware. The lines are:
+ *
+ * - `hls{<site>,<arena>,<stack>}`: defines the allocation site `<site>`,
+ *   i.e. allocations in the arena `<arena>` (`object`, `function`,
+ *   `property` or `string`) made by the JS stack `<stack>`, which lists the
+ *   innermost frames from the outermost one, separated by `;`. Site 0 stands
+ *   for the allocations made after the table of sites got full.
+ * - `hl{j,<site>,<size>,<id>}`: allocation of `<size>` bytes, where `<id>`
+ *   is the hex address of an arena cell, or `s<serial>` for an owned string.
+ * - `hl{k,<id>}`: the allocation `<id>` was reclaimed by the GC.
+ *
+ * Logging slows allocations down considerably, so it's only available if V7
+ * is built with `V7_ENABLE_HEAPLOG`.
+ */
+
+#ifndef CS_V7_SRC_HEAPLOG_PUBLIC_H_
+#define CS_V7_SRC_HEAPLOG_PUBLIC_H_
+
+/* Amalgamated: #include "v7/src/core_public.h" */
+
+#ifdef V7_ENABLE_HEAPLOG
+
+#if defined(__cplusplus)
+extern "C" {
+#endif /* __cplusplus */
+
+/*
+ * Starts logging the heap allocations to `fp`, which should stay open until
+ * `v7_heaplog_stop()`. Returns 0 on success, or -1 if the heap is already
+ * being logged or there is not enough memory.
+ */
+int v7_heaplog_start(struct v7 *v7, FILE *fp);
+
+/* Stops logging the heap allocations. The log is flushed but not closed. */
+void v7_heaplog_stop(struct v7 *v7);
+
+#if defined(__cplusplus)
+}
+#endif /* __cplusplus */
+
+#endif /* V7_ENABLE_HEAPLOG */
+
+#endif /* CS_V7_SRC_HEAPLOG_PUBLIC_H_ */
+#ifdef V7_MODULE_LINES
+#line 1 "./v7/src/heaplog.h"
+#endif
+/*
+ * Copyright (c) 2014 Cesanta Software Limited
+ * All rights reserved
+ */
+
+#ifndef CS_V7_SRC_HEAPLOG_H_
+#define CS_V7_SRC_HEAPLOG_H_
+
+/* Amalgamated: #include "v7/src/internal.h" */
+/* Amalgamated: #include "v7/src/core.h" */
+/* Amalgamated: #include "v7/src/gc.h" */
+/* Amalgamated: #include "v7/src/heaplog_public.h" */
+
+#ifdef V7_ENABLE_HEAPLOG
+
+/* Position of `gc_compact_strings()` in `heaplog_strs` */
+struct heaplog_compact_ctx {
+  size_t pos;  /* next string to look at */
+  size_t kept; /* strings which are still alive */
+};
+
+#if defined(__cplusplus)
+extern "C" {
+#endif /* __cplusplus */
+
+/* Logs the allocation of `cell` in the arena `a` */
+V7_PRIVATE void heaplog_alloc_cell(struct v7 *v7, struct gc_arena *a,
+                                   void *cell);
+
+/* Logs that `cell` was reclaimed */
+V7_PRIVATE void heaplog_free_cell(struct v7 *v7, void *cell);
+
+/* Logs the allocation of an owned string of `size` bytes at `offset` */
+V7_PRIVATE void heaplog_alloc_str(struct v7 *v7, size_t offset, size_t size);
+
+/*
+ * Tells that `gc_compact_strings()` has met the string at `offset`, which
+ * is moved to `new_offset` if `live`, or reclaimed otherwise. Strings are
+ * expected in the order of offsets.
+ */
+V7_PRIVATE void heaplog_compact_str(struct v7 *v7,
+                                    struct heaplog_compact_ctx *ctx,
+                                    size_t offset, size_t new_offset,
+                                    int live);
+
+/* Called once `gc_compact_strings()` is done */
+V7_PRIVATE void heaplog_compact_done(struct v7 *v7,
+                                     struct heaplog_compact_ctx *ctx);
+
+/* Stops logging and frees the sites */
+V7_PRIVATE void heaplog_destroy(struct v7 *v7);
+
+#if defined(__cplusplus)
+}
+#endif /* __cplusplus */
+
+#endif /* V7_ENABLE_HEAPLOG */
+
+#endif /* CS_V7_SRC_HEAPLOG_H_ */
+#ifdef V7_MODULE_LINES
 #line 1 "./v7/src/cyg_profile.h"
 #endif
 /*
@@ -6437,6 +7787,8 @@ int slre_compile(const char *regexp, size_t regexp_len, const char *flags,
 int slre_exec(struct slre_prog *prog, int flag_g, const char *start,
               const char *end, struct slre_loot *loot);
 void slre_free(struct slre_prog *prog);
+/* Adds a reference to the program, which is freed by the last `slre_free()` */
+void slre_retain(struct slre_prog *prog);
 
 int slre_match(const char *, size_t, const char *, size_t, const char *, size_t,
                struct slre_loot *);
@@ -6584,6 +7936,10 @@ int v7_is_regexp(struct v7 *v7, v7_val_t v);
 V7_PRIVATE struct v7_regexp *v7_to_regexp(struct v7 *, v7_val_t);
 #endif /* V7_ENABLE__RegExp */
 
+#ifndef V7_DISABLE_REGEXP_CACHE
+V7_PRIVATE void regexp_cache_reset(struct v7 *v7);
+#endif
+
 #endif /* CS_V7_SRC_REGEXP_H_ */
 #ifdef V7_MODULE_LINES
 #line 1 "./v7/src/freeze.h"
@@ -6618,6 +7974,139 @@ V7_PRIVATE void freeze_prop(struct v7 *v7, FILE *f, struct v7_property *prop);
 
 #endif /* CS_V7_SRC_FREEZE_H_ */
 #ifdef V7_MODULE_LINES
+#line 1 "./v7/src/snapshot_public.h"
+#endif
+/*
+ * Copyright (c) 2014 Cesanta Software Limited
+ * All rights reserved
+ */
+
+/*
+ * === Heap snapshots
+ *
+ * A snapshot is a binary image of the whole JS heap of an instance: objects,
+ * functions, properties, strings and the bcode of the functions. It is meant
+ * to be saved once an instance is initialized (standard library, init
+ * scripts), and loaded on the next start instead of doing the same
+ * initialization over again.
+ *
+ * Since C functions are saved by address, a snapshot can only be loaded by
+ * the same build of the same executable which saved it.
+ *
+ * Snapshots are available if V7 is built with `V7_ENABLE_SNAPSHOT`.
+ */
+
+#ifndef CS_V7_SRC_SNAPSHOT_PUBLIC_H_
+#define CS_V7_SRC_SNAPSHOT_PUBLIC_H_
+
+/* Amalgamated: #include "v7/src/core_public.h" */
+
+#ifdef V7_ENABLE_SNAPSHOT
+
+#if defined(__cplusplus)
+extern "C" {
+#endif /* __cplusplus */
+
+/*
+ * Saves a snapshot of the heap of `v7` into the file `path`. Must not be
+ * called while some code is being executed.
+ *
+ * Values owned by C code (see `v7_own()`) are not saved. The heap must not
+ * contain foreign pointers (`v7_mk_foreign()`, user data, destructors, array
+ * buffers), apart from the ones used internally by arrays, regexps and
+ * strings.
+ *
+ * Returns V7_OK on success, or V7_EXEC_EXCEPTION if the heap can't be saved
+ * or the file can't be written.
+ */
+WARN_UNUSED_RESULT
+enum v7_err v7_save_snapshot(struct v7 *v7, const char *path);
+
+/*
+ * Creates a V7 instance from a snapshot saved by `v7_save_snapshot()`,
+ * instead of initializing the standard library. The arenas get the size they
+ * had when the snapshot was saved, so arena sizes from `opts` are ignored.
+ *
+ * Returns NULL if the file can't be read, or wasn't saved by this build.
+ */
+struct v7 *v7_create_from_snapshot(const char *path,
+                                   struct v7_create_opts opts);
+
+#if defined(__cplusplus)
+}
+#endif /* __cplusplus */
+
+#endif /* V7_ENABLE_SNAPSHOT */
+
+#endif /* CS_V7_SRC_SNAPSHOT_PUBLIC_H_ */
+#ifdef V7_MODULE_LINES
+#line 1 "./v7/src/profiler_public.h"
+#endif
+/*
+ * Copyright (c) 2014 Cesanta Software Limited
+ * All rights reserved
+ */
+
+/*
+ * === Sampling profiler
+ *
+ * The profiler periodically records the JS call stack of an instance. It
+ * reports how many times each distinct stack was seen, in the "collapsed
+ * stacks" format understood by flame graph tools (e.g. `flamegraph.pl`).
+ * There is one line per stack: the frames from the outermost one, separated
+ * by `;`, then a space and the number of samples:
+ *
+ *     app.js:10;loop (app.js:4);work (app.js:2) 42
+ *
+ * On POSIX systems, a sample is taken on each `SIGPROF`, i.e. every
+ * `interval` microseconds of CPU time used by the process. Elsewhere, a
+ * sample is taken every `interval` jumps, calls and returns made by the
+ * interpreter.
+ *
+ * Samples are taken by the interpreter itself, so the time spent in C
+ * functions is attributed to the JS code around the call.
+ *
+ * The profiler is available if V7 is built with `V7_ENABLE_PROFILER`.
+ */
+
+#ifndef CS_V7_SRC_PROFILER_PUBLIC_H_
+#define CS_V7_SRC_PROFILER_PUBLIC_H_
+
+/* Amalgamated: #include "v7/src/core_public.h" */
+
+#ifdef V7_ENABLE_PROFILER
+
+#if defined(__cplusplus)
+extern "C" {
+#endif /* __cplusplus */
+
+/*
+ * Starts profiling `v7`, dropping the samples collected so far. Only one
+ * instance can be profiled at a time, since `SIGPROF` is process-wide.
+ *
+ * Returns 0 on success, or -1 if `interval` is 0, another instance is being
+ * profiled or the timer can't be set up.
+ */
+int v7_profiler_start(struct v7 *v7, unsigned int interval);
+
+/* Stops profiling `v7`. The samples collected so far are kept. */
+void v7_profiler_stop(struct v7 *v7);
+
+/*
+ * Returns the samples collected so far as collapsed stacks, see above. The
+ * text is NUL-terminated, and its length is stored in `*len` unless `len` is
+ * NULL. The caller should `free()` it.
+ */
+char *v7_profiler_dump(struct v7 *v7, size_t *len);
+
+#if defined(__cplusplus)
+}
+#endif /* __cplusplus */
+
+#endif /* V7_ENABLE_PROFILER */
+
+#endif /* CS_V7_SRC_PROFILER_PUBLIC_H_ */
+#ifdef V7_MODULE_LINES
 #line 1 "./v7/src/std_array.h"
 #endif
 /*
@@ -6735,6 +8224,14 @@ extern "C" {
 
 V7_PRIVATE void init_json(struct v7 *v7);
 
+/*
+ * Parses JSON text `src` of length `len` and builds the corresponding value
+ * in `res`. Throws `SyntaxError` if the text is not valid JSON.
+ */
+WARN_UNUSED_RESULT
+V7_PRIVATE enum v7_err json_parse(struct v7 *v7, const char *src, size_t len,
+                                  v7_val_t *res);
+
 #if defined(__cplusplus)
 }
 #endif /* __cplusplus */
@@ -7329,6 +8826,351 @@ const char *c_strnstr(const char *s, const char *find, size_t slen) {
   return NULL;
 }
 
+/*
+ * Shortest round-trip formatting of doubles, using the Grisu2 algorithm from
+ * F. Loitsch, "Printing Floating-Point Numbers Quickly and Accurately with
+ * Integers". The output always reads back as the same double and is the
+ * shortest such string in all but a tiny fraction of cases.
+ */
+
+struct cs_diy_fp {
+  uint64_t f;
+  int e;
+};
+
+/* 64-bit normalized approximations of 10^k, for k = -348, -340, ..., 340 */
+static const struct {
+  uint32_t hi, lo;
+  int16_t e;
+} cs_cached_pow10[] = {
+    {0xfa8fd5a0, 0x081c0288, -1220}, {0xbaaee17f, 0xa23ebf76, -1193},
+    {0x8b16fb20, 0x3055ac76, -1166}, {0xcf42894a, 0x5dce35ea, -1140},
+    {0x9a6bb0aa, 0x55653b2d, -1113}, {0xe61acf03, 0x3d1a45df, -1087},
+    {0xab70fe17, 0xc79ac6ca, -1060}, {0xff77b1fc, 0xbebcdc4f, -1034},
+    {0xbe5691ef, 0x416bd60c, -1007}, {0x8dd01fad, 0x907ffc3c, -980},
+    {0xd3515c28, 0x31559a83, -954}, {0x9d71ac8f, 0xada6c9b5, -927},
+    {0xea9c2277, 0x23ee8bcb, -901}, {0xaecc4991, 0x4078536d, -874},
+    {0x823c1279, 0x5db6ce57, -847}, {0xc2109436, 0x4dfb5637, -821},
+    {0x9096ea6f, 0x3848984f, -794}, {0xd77485cb, 0x25823ac7, -768},
+    {0xa086cfcd, 0x97bf97f4, -741}, {0xef340a98, 0x172aace5, -715},
+    {0xb23867fb, 0x2a35b28e, -688}, {0x84c8d4df, 0xd2c63f3b, -661},
+    {0xc5dd4427, 0x1ad3cdba, -635}, {0x936b9fce, 0xbb25c996, -608},
+    {0xdbac6c24, 0x7d62a584, -582}, {0xa3ab6658, 0x0d5fdaf6, -555},
+    {0xf3e2f893, 0xdec3f126, -529}, {0xb5b5ada8, 0xaaff80b8, -502},
+    {0x87625f05, 0x6c7c4a8b, -475}, {0xc9bcff60, 0x34c13053, -449},
+    {0x964e858c, 0x91ba2655, -422}, {0xdff97724, 0x70297ebd, -396},
+    {0xa6dfbd9f, 0xb8e5b88f, -369}, {0xf8a95fcf, 0x88747d94, -343},
+    {0xb9447093, 0x8fa89bcf, -316}, {0x8a08f0f8, 0xbf0f156b, -289},
+    {0xcdb02555, 0x653131b6, -263}, {0x993fe2c6, 0xd07b7fac, -236},
+    {0xe45c10c4, 0x2a2b3b06, -210}, {0xaa242499, 0x697392d3, -183},
+    {0xfd87b5f2, 0x8300ca0e, -157}, {0xbce50864, 0x92111aeb, -130},
+    {0x8cbccc09, 0x6f5088cc, -103}, {0xd1b71758, 0xe219652c, -77},
+    {0x9c400000, 0x00000000, -50}, {0xe8d4a510, 0x00000000, -24},
+    {0xad78ebc5, 0xac620000, 3}, {0x813f3978, 0xf8940984, 30},
+    {0xc097ce7b, 0xc90715b3, 56}, {0x8f7e32ce, 0x7bea5c70, 83},
+    {0xd5d238a4, 0xabe98068, 109}, {0x9f4f2726, 0x179a2245, 136},
+    {0xed63a231, 0xd4c4fb27, 162}, {0xb0de6538, 0x8cc8ada8, 189},
+    {0x83c7088e, 0x1aab65db, 216}, {0xc45d1df9, 0x42711d9a, 242},
+    {0x924d692c, 0xa61be758, 269}, {0xda01ee64, 0x1a708dea, 295},
+    {0xa26da399, 0x9aef774a, 322}, {0xf209787b, 0xb47d6b85, 348},
+    {0xb454e4a1, 0x79dd1877, 375}, {0x865b8692, 0x5b9bc5c2, 402},
+    {0xc83553c5, 0xc8965d3d, 428}, {0x952ab45c, 0xfa97a0b3, 455},
+    {0xde469fbd, 0x99a05fe3, 481}, {0xa59bc234, 0xdb398c25, 508},
+    {0xf6c69a72, 0xa3989f5c, 534}, {0xb7dcbf53, 0x54e9bece, 561},
+    {0x88fcf317, 0xf22241e2, 588}, {0xcc20ce9b, 0xd35c78a5, 614},
+    {0x98165af3, 0x7b2153df, 641}, {0xe2a0b5dc, 0x971f303a, 667},
+    {0xa8d9d153, 0x5ce3b396, 694}, {0xfb9b7cd9, 0xa4a7443c, 720},
+    {0xbb764c4c, 0xa7a44410, 747}, {0x8bab8eef, 0xb6409c1a, 774},
+    {0xd01fef10, 0xa657842c, 800}, {0x9b10a4e5, 0xe9913129, 827},
+    {0xe7109bfb, 0xa19c0c9d, 853}, {0xac2820d9, 0x623bf429, 880},
+    {0x80444b5e, 0x7aa7cf85, 907}, {0xbf21e440, 0x03acdd2d, 933},
+    {0x8e679c2f, 0x5e44ff8f, 960}, {0xd433179d, 0x9c8cb841, 986},
+    {0x9e19db92, 0xb4e31ba9, 1013}, {0xeb96bf6e, 0xbadf77d9, 1039},
+    {0xaf87023b, 0x9bf0ee6b, 1066},
+};
+
+static const uint32_t cs_pow10_u32[] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000,
+};
+
+static struct cs_diy_fp cs_diy_fp_mul(struct cs_diy_fp x, struct cs_diy_fp y) {
+  struct cs_diy_fp r;
+  uint64_t a = x.f >> 32, b = x.f & 0xffffffff;
+  uint64_t c = y.f >> 32, d = y.f & 0xffffffff;
+  uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+  uint64_t tmp = (bd >> 32) + (ad & 0xffffffff) + (bc & 0xffffffff);
+  tmp += 1U << 31; /* round */
+  r.f = ac + (ad >> 32) + (bc >> 32) + (tmp >> 32);
+  r.e = x.e + y.e + 64;
+  return r;
+}
+
+static void cs_grisu_round(char *digits, int len, uint64_t delta,
+                           uint64_t rest, uint64_t ten_kappa, uint64_t wp_w) {
+  while (rest < wp_w && delta - rest >= ten_kappa &&
+         (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w)) {
+    digits[len - 1]--;
+    rest += ten_kappa;
+  }
+}
+
+/*
+ * Produce the digits of a positive finite `v` into `digits` (at most 17, not
+ * NUL-terminated). Returns the number of digits; `v` == digits * 10^(*K).
+ */
+static int cs_grisu2(double v, char *digits, int *K) {
+  const uint64_t hidden = (uint64_t) 1 << 52;
+  struct cs_diy_fp w, wp, wm, c;
+  uint64_t u, one, delta, wp_w, p2, scale;
+  uint32_t p1;
+  int len = 0, kappa, k, i;
+  double dk;
+
+  memcpy(&u, &v, sizeof(u));
+  w.f = u & (hidden - 1);
+  w.e = (int) ((u >> 52) & 0x7ff);
+  if (w.e != 0) {
+    w.f += hidden;
+    w.e -= 1075;
+  } else {
+    w.e = -1074;
+  }
+
+  /* Boundaries: halfway points to the neighbouring doubles */
+  wp.f = (w.f << 1) + 1;
+  wp.e = w.e - 1;
+  while (!(wp.f & (hidden << 1))) {
+    wp.f <<= 1;
+    wp.e--;
+  }
+  wp.f <<= 10;
+  wp.e -= 10;
+  if (w.f == hidden) {
+    wm.f = (w.f << 2) - 1;
+    wm.e = w.e - 2;
+  } else {
+    wm.f = (w.f << 1) - 1;
+    wm.e = w.e - 1;
+  }
+  wm.f <<= wm.e - wp.e;
+  wm.e = wp.e;
+
+  while (!(w.f & ((uint64_t) 1 << 63))) {
+    w.f <<= 1;
+    w.e--;
+  }
+
+  /* Scale by a cached power of ten so that the exponent is in [-60, -32] */
+  dk = (-61 - wp.e) * 0.30102999566398114 + 347;
+  k = (int) dk;
+  if (dk - k > 0.0) k++;
+  i = (k >> 3) + 1;
+  *K = -(-348 + i * 8);
+  c.f = (uint64_t) cs_cached_pow10[i].hi << 32 | cs_cached_pow10[i].lo;
+  c.e = cs_cached_pow10[i].e;
+
+  w = cs_diy_fp_mul(w, c);
+  wp = cs_diy_fp_mul(wp, c);
+  wm = cs_diy_fp_mul(wm, c);
+  wm.f++;
+  wp.f--;
+
+  /* Generate digits of the upper boundary until they are precise enough */
+  delta = wp.f - wm.f;
+  wp_w = wp.f - w.f;
+  one = (uint64_t) 1 << -wp.e;
+  p1 = (uint32_t)(wp.f >> -wp.e);
+  p2 = wp.f & (one - 1);
+  for (kappa = 1; kappa < 10 && p1 >= cs_pow10_u32[kappa]; kappa++) {
+  }
+
+  while (kappa > 0) {
+    uint32_t d = p1 / cs_pow10_u32[kappa - 1];
+    p1 %= cs_pow10_u32[kappa - 1];
+    if (d != 0 || len != 0) digits[len++] = (char) ('0' + d);
+    kappa--;
+    if (((uint64_t) p1 << -wp.e) + p2 <= delta) {
+      *K += kappa;
+      cs_grisu_round(digits, len, delta, ((uint64_t) p1 << -wp.e) + p2,
+                     (uint64_t) cs_pow10_u32[kappa] << -wp.e, wp_w);
+      return len;
+    }
+  }
+
+  for (;;) {
+    uint32_t d;
+    p2 *= 10;
+    delta *= 10;
+    d = (uint32_t)(p2 >> -wp.e);
+    if (d != 0 || len != 0) digits[len++] = (char) ('0' + d);
+    p2 &= one - 1;
+    kappa--;
+    if (p2 < delta) {
+      *K += kappa;
+      for (scale = 1, i = 0; i < -kappa && i < 20; i++) scale *= 10;
+      cs_grisu_round(digits, len, delta, p2, one, i < 20 ? wp_w * scale : 0);
+      return len;
+    }
+  }
+}
+
+int cs_dtoa(char *buf, size_t buf_size, double v) {
+  char tmp[CS_DTOA_BUF_SIZE], digits[20], *p = tmp;
+  const char *s = NULL;
+  uint64_t u;
+  int len, n, K, i;
+
+  memcpy(&u, &v, sizeof(u));
+  if (((u >> 52) & 0x7ff) == 0x7ff) {
+    if (u & (((uint64_t) 1 << 52) - 1)) {
+      s = "NaN";
+    } else {
+      s = (u >> 63) ? "-Infinity" : "Infinity";
+    }
+  } else if (v == 0) {
+    /* Both 0 and -0 are printed as `0` */
+    s = "0";
+  }
+  if (s != NULL) {
+    len = strlen(s);
+    memcpy(tmp, s, len);
+    p += len;
+    goto out;
+  }
+
+  if (v < 0) {
+    *p++ = '-';
+    v = -v;
+  }
+
+  if (v < 9007199254740992.0 && v == (double) (uint64_t) v) {
+    /* Integers up to 2^53 are printed exactly, digit by digit */
+    uint64_t x = (uint64_t) v;
+    for (len = 0; x != 0; x /= 10) {
+      digits[len++] = (char) ('0' + x % 10);
+    }
+    while (len > 0) *p++ = digits[--len];
+    goto out;
+  }
+
+  len = cs_grisu2(v, digits, &K);
+  /* The value is 0.<digits> * 10^n */
+  n = len + K;
+  if (len <= n && n <= 21) {
+    memcpy(p, digits, len);
+    p += len;
+    for (i = len; i < n; i++) *p++ = '0';
+  } else if (0 < n && n <= 21) {
+    memcpy(p, digits, n);
+    p += n;
+    *p++ = '.';
+    memcpy(p, digits + n, len - n);
+    p += len - n;
+  } else if (-6 < n && n <= 0) {
+    *p++ = '0';
+    *p++ = '.';
+    for (i = n; i < 0; i++) *p++ = '0';
+    memcpy(p, digits, len);
+    p += len;
+  } else {
+    *p++ = digits[0];
+    if (len > 1) {
+      *p++ = '.';
+      memcpy(p, digits + 1, len - 1);
+      p += len - 1;
+    }
+    *p++ = 'e';
+    *p++ = n - 1 < 0 ? '-' : '+';
+    n = n - 1 < 0 ? 1 - n : n - 1;
+    if (n >= 100) *p++ = (char) ('0' + n / 100);
+    if (n >= 10) *p++ = (char) ('0' + n / 10 % 10);
+    *p++ = (char) ('0' + n % 10);
+  }
+
+out:
+  len = p - tmp;
+  if (buf_size > 0) {
+    n = (size_t) len < buf_size ? len : (int) buf_size - 1;
+    memcpy(buf, tmp, n);
+    buf[n] = '\0';
+  }
+  return len;
+}
+
+double cs_strtod(const char *s, char **endptr) {
+  /* Powers of ten which are exactly representable as doubles */
+  static const double exact_pow10[] = {
+      1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+      1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+  };
+  const uint64_t max_exact = (uint64_t) 1 << 53;
+  const char *p = s;
+  uint64_t m = 0;
+  int neg = 0, exp10 = 0, nd = 0, has_digits = 0;
+  double d;
+
+  if (*p == '-' || *p == '+') neg = (*p++ == '-');
+
+  /* Hex, octal and binary prefixes are up to the C library */
+  if (p[0] == '0' && isalnum((unsigned char) p[1]) && (p[1] | 0x20) != 'e') {
+    goto slow;
+  }
+
+  for (; *p >= '0' && *p <= '9'; p++) {
+    has_digits = 1;
+    if (m == 0 && *p == '0') continue;
+    if (nd++ >= 19) goto slow;
+    m = m * 10 + (*p - '0');
+  }
+  if (*p == '.') {
+    for (p++; *p >= '0' && *p <= '9'; p++) {
+      has_digits = 1;
+      exp10--;
+      if (m == 0 && *p == '0') continue;
+      if (nd++ >= 19) goto slow;
+      m = m * 10 + (*p - '0');
+    }
+  }
+  if (!has_digits) goto slow;
+
+  if ((*p | 0x20) == 'e') {
+    const char *q = p + 1;
+    int eneg = 0, e = 0;
+    if (*q == '-' || *q == '+') eneg = (*q++ == '-');
+    if (*q >= '0' && *q <= '9') {
+      for (; *q >= '0' && *q <= '9'; q++) {
+        if (e < 10000) e = e * 10 + (*q - '0');
+      }
+      exp10 += eneg ? -e : e;
+      p = q;
+    }
+  }
+
+  /*
+   * When both the mantissa and the power of ten are exact, a single IEEE
+   * multiplication or division gives the correctly rounded result.
+   */
+  if (m == 0) {
+    d = 0.0;
+  } else if (m > max_exact || exp10 < -22 || exp10 > 22 + 15) {
+    goto slow;
+  } else if (exp10 < 0) {
+    d = (double) m / exact_pow10[-exp10];
+  } else {
+    for (; exp10 > 22; exp10--) {
+      m *= 10;
+      if (m > max_exact) goto slow;
+    }
+    d = (double) m * exact_pow10[exp10];
+  }
+
+  if (endptr != NULL) *endptr = (char *) p;
+  return neg ? -d : d;
+
+slow:
+  return strtod(s, endptr);
+}
+
 #endif /* EXCLUDE_COMMON */
 #ifdef V7_MODULE_LINES
 #line 1 "./src/../../common/utf.c"
@@ -9547,6 +11389,8 @@ typedef int cs_dirent_dummy;
 
 #ifdef CS_ENABLE_UBJSON
 
+#include <float.h>
+
 /* Amalgamated: #include "common/ubjson.h" */
 
 void cs_ubjson_emit_null(struct mbuf *buf) {
@@ -9642,10 +11486,17 @@ void cs_ubjson_emit_float64(struct mbuf *buf, double v) {
   mbuf_append(buf, b, 1 + sizeof(uint64_t));
 }
 
+/*
+ * Emit `v` using the shortest encoding that decodes to exactly the same
+ * value: an integer if it is integral, a float32 if no bits are lost,
+ * float64 otherwise.
+ */
 void cs_ubjson_emit_autonumber(struct mbuf *buf, double v) {
-  int64_t i = (int64_t) v;
-  if ((double) i == v) {
-    cs_ubjson_emit_autoint(buf, i);
+  if (v >= -9223372036854775808.0 && v < 9223372036854775808.0 &&
+      (double) (int64_t) v == v) {
+    cs_ubjson_emit_autoint(buf, (int64_t) v);
+  } else if (v >= -FLT_MAX && v <= FLT_MAX && (double) (float) v == v) {
+    cs_ubjson_emit_float32(buf, (float) v);
   } else {
     cs_ubjson_emit_float64(buf, v);
   }
@@ -11023,7 +12874,15 @@ V7_PRIVATE enum v7_err Bin_send(struct v7 *v7, v7_val_t *res) {
     rcode = v7_throwf(v7, "Error", "UBJSON context closed\n");
     goto clean;
   }
+#if V7_ENABLE__ArrayBuffer
+  /* binary data can also come in an ArrayBuffer or a typed array */
+  s = (const char *) v7_get_array_buffer_data(v7, arg, &n);
+  if (s == NULL) {
+    s = v7_get_string(v7, &arg, &n);
+  }
+#else
   s = v7_get_string(v7, &arg, &n);
+#endif
   if (n > ctx->bytes_left) {
     n = ctx->bytes_left;
   } else {
@@ -11275,7 +13134,7 @@ static enum v7_tok punct3(const char **s, int ch1, enum v7_tok tok1, int ch2,
 }
 
 static void parse_number(const char *s, const char **end, double *num) {
-  *num = strtod(s, (char **) end);
+  *num = cs_strtod(s, (char **) end);
 }
 
 static enum v7_tok parse_str_literal(const char **p) {
@@ -12198,6 +14057,23 @@ const struct ast_node_def ast_node_defs[] = {
     AST_ENTRY("NULL", 0, 0, 0, 0),       /* struct {} */
     AST_ENTRY("UNDEF", 0, 0, 0, 0),      /* struct {} */
     AST_ENTRY("USE_STRICT", 0, 0, 0, 0), /* struct {} */
+    /*
+     * Function which was compiled right after it was parsed; the layout
+     * of skips is the same as that of `AST_FUNC`, so that it looks like a
+     * function which declares nothing and refers to the names its code
+     * takes from the outer scopes.
+     *
+     * struct {
+     *   ast_skip_t end;
+     *   ast_skip_t first_var;
+     *   ast_skip_t body;
+     *   varint func;         // index in `ast->funcs`
+     * body:
+     *   child free_names[];  // AST_IDENT
+     * end:
+     * }
+     */
+    AST_ENTRY("COMPILED_FUNC", 1, 0, 3, 0),
 };
 
 /*
@@ -12442,7 +14318,7 @@ V7_PRIVATE double ast_get_num(struct ast *a, ast_off_t pos) {
   }
   strncpy(p, str, str_len);
   p[str_len] = '\0';
-  ret = strtod(p, NULL);
+  ret = cs_strtod(p, NULL);
   if (p != buf) free(p);
   return ret;
 }
@@ -12545,6 +14421,10 @@ V7_PRIVATE void ast_init(struct ast *ast, size_t len) {
   mbuf_init(&ast->mbuf, len);
   ast->refcnt = 0;
   ast->has_overflow = 0;
+#ifndef V7_DISABLE_STREAMING_COMPILE
+  ast->script = NULL;
+  mbuf_init(&ast->funcs, 0);
+#endif
 }
 
 V7_PRIVATE void ast_optimize(struct ast *ast) {
@@ -12559,6 +14439,9 @@ V7_PRIVATE void ast_free(struct ast *ast) {
   mbuf_free(&ast->mbuf);
   ast->refcnt = 0;
   ast->has_overflow = 0;
+#ifndef V7_DISABLE_STREAMING_COMPILE
+  mbuf_free(&ast->funcs);
+#endif
 }
 
 V7_PRIVATE void release_ast(struct v7 *v7, struct ast *a) {
@@ -12569,6 +14452,15 @@ V7_PRIVATE void release_ast(struct v7 *v7, struct ast *a) {
   if (a->refcnt == 0) {
 #if V7_ENABLE__Memory__stats
     v7->function_arena_ast_size -= a->mbuf.size;
+#endif
+#ifndef V7_DISABLE_STREAMING_COMPILE
+    {
+      struct ast_compiled_func *f = (struct ast_compiled_func *) a->funcs.buf;
+      size_t i;
+      for (i = 0; i < a->funcs.len / sizeof(*f); i++) {
+        release_bcode(v7, f[i].bcode);
+      }
+    }
 #endif
     ast_free(a);
     free(a);
@@ -12591,6 +14483,7 @@ V7_PRIVATE void release_ast(struct v7 *v7, struct ast *a) {
 /* Amalgamated: #include "v7/src/function.h" */
 /* Amalgamated: #include "v7/src/util.h" */
 /* Amalgamated: #include "v7/src/shdata.h" */
+/* Amalgamated: #include "v7/src/stats.h" */
 
 /*
  * TODO(dfrank): implement `bcode_serialize_*` more generically, so that they
@@ -12600,7 +14493,8 @@ V7_PRIVATE void release_ast(struct v7 *v7, struct ast *a) {
 #include <sys/mman.h>
 #endif
 
-#if defined(V7_BCODE_DUMP) || defined(V7_BCODE_TRACE)
+#if defined(V7_BCODE_DUMP) || defined(V7_BCODE_TRACE) || \
+    defined(V7_ENABLE_STATS)
 /* clang-format off */
 static const char *op_names[] = {
   "DROP",
@@ -12649,6 +14543,8 @@ static const char *op_names[] = {
   "SET_VAR",
   "GET_VAR",
   "SAFE_GET_VAR",
+  "GET_LOCAL",
+  "SET_LOCAL",
   "JMP",
   "JMP_TRUE",
   "JMP_FALSE",
@@ -12675,17 +14571,29 @@ static const char *op_names[] = {
   "CONTINUE",
   "ENTER_CATCH",
   "EXIT_CATCH",
+  "GET_PROP",
+  "GET_VAR_PROP",
+  "ADD_LIT",
+  "CMP_JMP_TRUE",
+  "CMP_JMP_FALSE",
+  "INC_LOCAL",
+  "INC_VAR",
 };
 /* clang-format on */
 
 V7_STATIC_ASSERT(OP_MAX == ARRAY_SIZE(op_names), bad_op_names);
-V7_STATIC_ASSERT(OP_MAX <= _OP_LINE_NO, bad_OP_LINE_NO);
+#endif
+
+#ifdef V7_ENABLE_STATS
+const char *v7_exec_stat_op_name(int op) {
+  return (op >= 0 && op < OP_MAX) ? op_names[op] : NULL;
+}
 #endif
 
 static void bcode_serialize_func(struct v7 *v7, struct bcode *bcode, FILE *out);
 
-static size_t bcode_ops_append(struct bcode_builder *bbuilder, const void *buf,
-                               size_t len) {
+V7_PRIVATE size_t bcode_ops_append(struct bcode_builder *bbuilder,
+                                   const void *buf, size_t len) {
   size_t ret;
 #if V7_ENABLE__Memory__stats
   bbuilder->v7->bcode_ops_size -= bbuilder->ops.len;
@@ -12713,6 +14621,12 @@ V7_PRIVATE void bcode_builder_init(struct v7 *v7,
 
   mbuf_init(&bbuilder->ops, 0);
   mbuf_init(&bbuilder->lit, 0);
+#ifndef V7_DISABLE_LINE_NUMBERS
+  mbuf_init(&bbuilder->lines, 0);
+#endif
+
+  bbuilder->last_op = BCODE_NO_OP;
+  bbuilder->prev_op = BCODE_NO_OP;
 }
 
 /*
@@ -12730,10 +14644,28 @@ V7_PRIVATE void bcode_builder_finalize(struct bcode_builder *bbuilder) {
   bbuilder->bcode->lit.len = bbuilder->lit.len;
   mbuf_init(&bbuilder->lit, 0);
 
+#ifndef V7_DISABLE_LINE_NUMBERS
+  mbuf_trim(&bbuilder->lines);
+  bbuilder->bcode->lines.p = bbuilder->lines.buf;
+  bbuilder->bcode->lines.len = bbuilder->lines.len;
+  mbuf_init(&bbuilder->lines, 0);
+#endif
+
   memset(bbuilder, 0x00, sizeof(*bbuilder));
 }
 
 #if defined(V7_BCODE_DUMP) || defined(V7_BCODE_TRACE)
+/* Prints the literal argument of the instruction at `*ops`, skipping it */
+static void dump_lit(struct v7 *v7, FILE *f, struct bcode *bcode, char **ops) {
+  val_t v = bcode_decode_lit(v7, bcode, ops);
+  if (is_js_function(v)) {
+    /* half-done function: it can't be stringified */
+    fprintf(f, "<function>");
+  } else {
+    v7_fprint(f, v7, v);
+  }
+}
+
 V7_PRIVATE void dump_op(struct v7 *v7, FILE *f, struct bcode *bcode,
                         char **ops) {
   char *p = *ops;
@@ -12744,10 +14676,45 @@ V7_PRIVATE void dump_op(struct v7 *v7, FILE *f, struct bcode *bcode,
     case OP_PUSH_LIT:
     case OP_SAFE_GET_VAR:
     case OP_GET_VAR:
-    case OP_SET_VAR: {
+    case OP_SET_VAR:
+    case OP_GET_PROP:
+    case OP_ADD_LIT:
+    case OP_ENTER_CATCH:
+    case OP_INC_VAR: {
+      uint8_t op = *p;
+      fprintf(f, ": ");
+      dump_lit(v7, f, bcode, &p);
+      if (op == OP_INC_VAR) {
+        fprintf(f, " (flags %lu)", (unsigned long) bcode_get_varint(&p));
+      }
+      break;
+    }
+    case OP_GET_VAR_PROP:
+      fprintf(f, ": ");
+      dump_lit(v7, f, bcode, &p);
+      fprintf(f, ".");
+      dump_lit(v7, f, bcode, &p);
+      break;
+    case OP_GET_LOCAL:
+    case OP_SET_LOCAL:
+    case OP_INC_LOCAL: {
+      uint8_t op = *p;
       size_t idx = bcode_get_varint(&p);
-      fprintf(f, "(%lu): ", (unsigned long) idx);
-      v7_fprint(f, v7, ((val_t *) bcode->lit.p)[idx]);
+      fprintf(f, "(%lu)", (unsigned long) idx);
+      if (op == OP_INC_LOCAL) {
+        fprintf(f, " (flags %lu)", (unsigned long) bcode_get_varint(&p));
+      }
+      break;
+    }
+    case OP_CMP_JMP_TRUE:
+    case OP_CMP_JMP_FALSE: {
+      bcode_off_t target;
+      p++;
+      fprintf(f, " %s", op_names[(uint8_t) *p]);
+      p++;
+      memcpy(&target, p, sizeof(target));
+      fprintf(f, "(%lu)", (unsigned long) target);
+      p += sizeof(target) - 1;
       break;
     }
     case OP_CALL:
@@ -12819,8 +14786,19 @@ V7_PRIVATE void bcode_free(struct v7 *v7, struct bcode *bcode) {
 
   if (!bcode->ops_in_rom) {
     free(bcode->ops.p);
+#ifndef V7_DISABLE_LINE_NUMBERS
+    free(bcode->lines.p);
+#endif
   }
   memset(&bcode->ops, 0x00, sizeof(bcode->ops));
+#ifndef V7_DISABLE_LINE_NUMBERS
+  memset(&bcode->lines, 0x00, sizeof(bcode->lines));
+#endif
+
+#ifndef V7_DISABLE_INLINE_CACHE
+  free(bcode->ic);
+  bcode->ic = NULL;
+#endif
 
   free(bcode->lit.p);
   memset(&bcode->lit, 0x00, sizeof(bcode->lit));
@@ -12881,17 +14859,118 @@ V7_PRIVATE void bcode_copy_filename_from(struct bcode *dst, struct bcode *src) {
 #endif
 }
 
+/*
+ * Tries to fuse `op` with the last emitted instruction(s) into a
+ * superinstruction. Returns 1 if `op` was fused and thus should not be
+ * appended.
+ *
+ * Instructions are never fused across a possible branch target or a line
+ * number change, see `bcode_pos()`.
+ */
+static int bcode_fuse_op(struct bcode_builder *bbuilder, uint8_t op) {
+  char *last;
+
+  if (bbuilder->last_op == BCODE_NO_OP ||
+      bbuilder->label == bbuilder->ops.len) {
+    return 0;
+  }
+
+  last = bbuilder->ops.buf + bbuilder->last_op;
+
+  switch (op) {
+    case OP_GET:
+      if (*last != OP_PUSH_LIT) break;
+
+      if (bbuilder->prev_op != BCODE_NO_OP &&
+          bbuilder->ops.buf[bbuilder->prev_op] == OP_GET_VAR &&
+          bbuilder->label != bbuilder->last_op) {
+        /* `GET_VAR a; PUSH_LIT b; GET`: drop the opcode of `PUSH_LIT` */
+        memmove(last, last + 1, bbuilder->ops.len - bbuilder->last_op - 1);
+        bbuilder->ops.len--;
+#if V7_ENABLE__Memory__stats
+        bbuilder->v7->bcode_ops_size--;
+#endif
+        bbuilder->ops.buf[bbuilder->prev_op] = OP_GET_VAR_PROP;
+        bbuilder->last_op = bbuilder->prev_op;
+        bbuilder->prev_op = BCODE_NO_OP;
+      } else {
+        *last = OP_GET_PROP;
+      }
+      return 1;
+
+    case OP_ADD:
+      if (*last != OP_PUSH_LIT) break;
+      *last = OP_ADD_LIT;
+      return 1;
+
+    case OP_JMP_TRUE:
+    case OP_JMP_FALSE:
+      if (*last >= OP_EQ_EQ && *last <= OP_GE) {
+        /* the comparison becomes the argument; the target follows */
+        uint8_t cmp = *last;
+        *last = (op == OP_JMP_TRUE) ? OP_CMP_JMP_TRUE : OP_CMP_JMP_FALSE;
+        bcode_ops_append(bbuilder, &cmp, 1);
+        return 1;
+      }
+      break;
+
+    case OP_DROP:
+      /* the last byte of `OP_INC_*` is the flags argument */
+      if ((*last == OP_INC_LOCAL || *last == OP_INC_VAR) &&
+          !(bbuilder->ops.buf[bbuilder->ops.len - 1] & INC_FLAG_DROP)) {
+        bbuilder->ops.buf[bbuilder->ops.len - 1] |= INC_FLAG_DROP;
+        return 1;
+      }
+      break;
+  }
+
+  return 0;
+}
+
 V7_PRIVATE void bcode_op(struct bcode_builder *bbuilder, uint8_t op) {
+  if (bcode_fuse_op(bbuilder, op)) {
+    return;
+  }
+
+  bbuilder->prev_op = bbuilder->last_op;
+  bbuilder->last_op = bbuilder->ops.len;
   bcode_ops_append(bbuilder, &op, 1);
 }
 
 #ifndef V7_DISABLE_LINE_NUMBERS
 V7_PRIVATE void bcode_append_lineno(struct bcode_builder *bbuilder,
                                     int line_no) {
-  int offset = bbuilder->ops.len;
-  bcode_add_varint(bbuilder, (line_no << 1) | 1);
-  bbuilder->ops.buf[offset] = msb_lsb_swap(bbuilder->ops.buf[offset]);
-  assert(bbuilder->ops.buf[offset] & _OP_LINE_NO);
+  unsigned char buf[16];
+  int len;
+
+  len = encode_varint(bbuilder->ops.len - bbuilder->lines_off, buf);
+  len += encode_varint(line_no, buf + len);
+  mbuf_append(&bbuilder->lines, buf, len);
+
+  bbuilder->lines_off = bbuilder->ops.len;
+  bbuilder->label = bbuilder->ops.len;
+}
+
+V7_PRIVATE int bcode_get_line_no(struct bcode *bcode, const char *ops) {
+  const unsigned char *p = (const unsigned char *) bcode->lines.p;
+  const unsigned char *end = p + bcode->lines.len;
+  size_t pos, off = 0;
+  int line_no = 1, llen;
+
+  if (ops == NULL) {
+    return line_no;
+  }
+  pos = ops - 1 - bcode->ops.p;
+
+  while (p < end) {
+    off += decode_varint(p, &llen);
+    if (off > pos) break;
+    p += llen;
+    line_no = decode_varint(p, &llen);
+    p += llen;
+  }
+
+  return line_no;
 }
 #endif
 
@@ -12952,6 +15031,7 @@ V7_PRIVATE lit_t bcode_add_lit(struct bcode_builder *bbuilder, val_t val) {
 #endif
 
     mbuf_append(&bbuilder->lit, &val, sizeof(val));
+    GC_WRITE_BARRIER(bbuilder->v7, val);
 
     /*
      * immediately propagate current lit buffer to the bcode, so that GC will
@@ -12988,10 +15068,15 @@ bcode_decode_lit(struct v7 *v7, struct bcode *bcode, char **ops) {
   switch (idx) {
     case BCODE_INLINE_STRING_TYPE_TAG: {
       val_t res;
+      const char *hdr = *ops + 1; /* points to the varint `len` */
       size_t len = bcode_get_varint(ops);
-      res = v7_mk_string(
-          v7, (const char *) *ops + 1 /*skip BCODE_INLINE_STRING_TYPE_TAG*/,
-          len, !bcode->ops_in_rom);
+      if (bcode->ops_in_rom) {
+        res = mk_mapped_string(v7, hdr);
+      } else {
+        res = v7_mk_string(
+            v7, (const char *) *ops + 1 /*skip BCODE_INLINE_STRING_TYPE_TAG*/,
+            len, 1);
+      }
       *ops += len + 1;
       return res;
     }
@@ -13195,7 +15280,7 @@ V7_PRIVATE char *bcode_next_name(char *ops, char **pname, size_t *plen) {
 
 V7_PRIVATE char *bcode_next_name_v(struct v7 *v7, struct bcode *bcode,
                                    char *ops, val_t *res) {
-  char *name;
+  char *name, *hdr = ops;
   size_t len;
 
   ops = bcode_next_name(ops, &name, &len);
@@ -13204,12 +15289,21 @@ V7_PRIVATE char *bcode_next_name_v(struct v7 *v7, struct bcode *bcode,
    * If `ops` is in RAM, we create owned string, since the string may outlive
    * bcode. Otherwise (`ops` is in ROM), we create foreign string.
    */
-  *res = v7_mk_string(v7, name, len, !bcode->ops_in_rom);
+  if (bcode->ops_in_rom) {
+    *res = mk_mapped_string(v7, hdr);
+  } else {
+    *res = v7_mk_string(v7, name, len, 1);
+  }
 
   return ops;
 }
 
+/*
+ * Returns the current position, to be used as a branch target. Since the
+ * next instruction may be jumped to, it won't be fused with the previous one.
+ */
 V7_PRIVATE bcode_off_t bcode_pos(struct bcode_builder *bbuilder) {
+  bbuilder->label = bbuilder->ops.len;
   return bbuilder->ops.len;
 }
 
@@ -13219,7 +15313,7 @@ V7_PRIVATE bcode_off_t bcode_pos(struct bcode_builder *bbuilder) {
  * To be issued following a JMP_* bytecode
  */
 V7_PRIVATE bcode_off_t bcode_add_target(struct bcode_builder *bbuilder) {
-  bcode_off_t pos = bcode_pos(bbuilder);
+  bcode_off_t pos = bbuilder->ops.len;
   bcode_off_t zero = 0;
   bcode_ops_append(bbuilder, &zero, sizeof(bcode_off_t));
   return pos;
@@ -13265,9 +15359,8 @@ static void bcode_serialize_lit(struct v7 *v7, val_t v, FILE *out) {
   switch (t) {
     case V7_TYPE_NUMBER: {
       double num = v7_get_double(v7, v);
-      char buf[18];
-      const char *fmt = num > 1e10 ? "%.21g" : "%.10g";
-      size_t len = snprintf(buf, sizeof(buf), fmt, num);
+      char buf[CS_DTOA_BUF_SIZE];
+      size_t len = cs_dtoa(buf, sizeof(buf), num);
 
       bcode_serialize_emit_type_tag(BCODE_SER_NUMBER, out);
       bcode_serialize_varint(len, out);
@@ -13323,6 +15416,14 @@ static void bcode_serialize_func(struct v7 *v7, struct bcode *bcode,
   /* func_name_present */
   bcode_serialize_varint(bcode->func_name_present, out);
 
+  /*
+   * frame slots: bit 0 is `frame_slots`, bit 1 is `arguments_slot`, bit 2 is
+   * `no_arguments`
+   */
+  bcode_serialize_varint(bcode->frame_slots | (bcode->arguments_slot << 1) |
+                             (bcode->no_arguments << 2),
+                         out);
+
   /*
    * bcode:
    * <varint> // opcodes length
@@ -13331,6 +15432,19 @@ static void bcode_serialize_func(struct v7 *v7, struct bcode *bcode,
   vec = &bcode->ops;
   bcode_serialize_varint(vec->len, out);
   fwrite(vec->p, vec->len, 1, out);
+
+  /*
+   * line number table:
+   * <varint> // table length
+   * <byte>*
+   */
+#ifndef V7_DISABLE_LINE_NUMBERS
+  vec = &bcode->lines;
+  bcode_serialize_varint(vec->len, out);
+  fwrite(vec->p, vec->len, 1, out);
+#else
+  bcode_serialize_varint(0, out);
+#endif
 }
 
 V7_PRIVATE void bcode_serialize(struct v7 *v7, struct bcode *bcode, FILE *out) {
@@ -13414,6 +15528,14 @@ static const char *bcode_deserialize_func(struct v7 *v7, struct bcode *bcode,
   /* get whether the function name is present in `names` */
   bcode->func_name_present = bcode_deserialize_varint(&data);
 
+  /* get frame slots flags */
+  {
+    size_t slots = bcode_deserialize_varint(&data);
+    bcode->frame_slots = !!(slots & 1);
+    bcode->arguments_slot = !!(slots & 2);
+    bcode->no_arguments = !!(slots & 4);
+  }
+
   /* get opcode size */
   size = bcode_deserialize_varint(&data);
 
@@ -13425,6 +15547,16 @@ static const char *bcode_deserialize_func(struct v7 *v7, struct bcode *bcode,
 
   data += size;
 
+  /* get line number table, which is also used in place */
+  size = bcode_deserialize_varint(&data);
+#ifndef V7_DISABLE_LINE_NUMBERS
+  bbuilder.lines.buf = (char *) data;
+  bbuilder.lines.size = size;
+  bbuilder.lines.len = size;
+#endif
+
+  data += size;
+
   bcode_builder_finalize(&bbuilder);
   return data;
 }
@@ -13459,6 +15591,8 @@ V7_PRIVATE void bcode_deserialize(struct v7 *v7, struct bcode *bcode,
 /* Amalgamated: #include "v7/src/exceptions.h" */
 /* Amalgamated: #include "v7/src/conversion.h" */
 /* Amalgamated: #include "v7/src/varint.h" */
+/* Amalgamated: #include "v7/src/profiler.h" */
+/* Amalgamated: #include "v7/src/stats.h" */
 
 /*
  * Bcode offsets in "try stack" are stored in JS numbers, i.e.  in `double`s.
@@ -13555,6 +15689,13 @@ V7_STATIC_ASSERT((sizeof(bcode_off_t) * 8) == LBLOCK_OFFSET_WIDTH,
 #define TOS() stack_tos(&v7->stack)
 #define SP() stack_sp(&v7->stack)
 
+/* Value `n` positions below the top of the stack, `STACK_PEEK(0)` is TOS */
+#define STACK_PEEK(n) \
+  (((val_t *) (v7->stack.buf + v7->stack.len))[-1 - (int) (n)])
+
+/* Frame slot `idx` of the function being executed, see `OP_GET_LOCAL` */
+#define FRAME_SLOT(r, idx) (((val_t *) (v7->stack.buf + (r).slots_base))[idx])
+
 /*
  * Local-to-function block types that we might want to consider when unwinding
  * stack for whatever reason. see `unwind_local_blocks_stack()`.
@@ -13576,8 +15717,10 @@ enum local_block {
  */
 #define BTRY(call)                                                            \
   do {                                                                        \
-    enum v7_err _e = call;                                                    \
+    enum v7_err _e;                                                           \
     (void) _you_should_use_BTRY_in_eval_bcode_only;                           \
+    bcode_save_ops(&r);                                                       \
+    _e = call;                                                                \
     if (_e != V7_OK) {                                                        \
       V7_TRY(bcode_perform_throw(v7, &r, 0 /*don't take value from stack*/)); \
       goto op_done;                                                           \
@@ -13692,10 +15835,8 @@ static double b_num_bin_op(enum opcode op, double a, double b) {
     case OP_SUB:
       return a - b;
     case OP_REM:
-      if (b == 0 || isnan(b) || isnan(a) || isinf(b) || isinf(a)) {
-        return NAN;
-      }
-      return (int) a % (int) b;
+      /* like C `fmod()`: the sign is that of `a`, so `-4 % 2` is `-0` */
+      return fmod(a, b);
     case OP_MUL:
       return a * b;
     case OP_DIV:
@@ -13717,6 +15858,86 @@ static double b_num_bin_op(enum opcode op, double a, double b) {
   return 0;
 }
 
+/*
+ * Evaluates arithmetic or bitwise `op` on small integers `a` and `b`, without
+ * going through doubles. Returns 0 if the result is not a small integer
+ * (overflow, `-0` or a fraction); the caller should use `b_num_bin_op()` then.
+ */
+static int b_smi_bin_op(enum opcode op, int32_t a, int32_t b, val_t *res) {
+  int64_t r;
+
+  switch (op) {
+    case OP_ADD:
+      r = (int64_t) a + b;
+      break;
+    case OP_SUB:
+      r = (int64_t) a - b;
+      break;
+    case OP_MUL:
+      r = (int64_t) a * b;
+      /* `-1 * 0` is `-0` */
+      if (r == 0 && (a < 0 || b < 0)) return 0;
+      break;
+    case OP_DIV:
+      /* `0 / -1` is `-0`, and `INT32_MIN / -1` overflows */
+      if (b == 0 || b == -1 || (a == 0 && b < 0) || a % b != 0) return 0;
+      r = a / b;
+      break;
+    case OP_REM:
+      if (b == 0 || b == -1) return 0;
+      r = a % b;
+      /* `-4 % 2` is `-0` */
+      if (r == 0 && a < 0) return 0;
+      break;
+    case OP_LSHIFT:
+      r = (int32_t)((uint32_t) a << ((uint32_t) b & 31));
+      break;
+    case OP_RSHIFT:
+      r = a >> ((uint32_t) b & 31);
+      break;
+    case OP_URSHIFT:
+      r = (uint32_t) a >> ((uint32_t) b & 31);
+      break;
+    case OP_OR:
+      r = a | b;
+      break;
+    case OP_XOR:
+      r = a ^ b;
+      break;
+    case OP_AND:
+      r = a & b;
+      break;
+    default:
+      return 0;
+  }
+
+  if (r < INT32_MIN || r > INT32_MAX) return 0;
+  *res = MK_SMI(r);
+  return 1;
+}
+
+static int b_smi_bool_bin_op(enum opcode op, int32_t a, int32_t b) {
+  switch (op) {
+    case OP_EQ:
+    case OP_EQ_EQ:
+      return a == b;
+    case OP_NE:
+    case OP_NE_NE:
+      return a != b;
+    case OP_LT:
+      return a < b;
+    case OP_LE:
+      return a <= b;
+    case OP_GT:
+      return a > b;
+    case OP_GE:
+      return a >= b;
+    default:
+      assert(0);
+  }
+  return 0;
+}
+
 static int b_bool_bin_op(enum opcode op, double a, double b) {
 #ifdef V7_BROKEN_NAN
   if (isnan(a) || isnan(b)) return op == OP_NE || op == OP_NE_NE;
@@ -13753,13 +15974,15 @@ static bcode_off_t bcode_get_target(char **ops) {
 
 struct bcode_registers {
   /*
-   * TODO(dfrank): make it contain `struct v7_call_frame_bcode *`
-   * and use `bcode_ops` in-place, or probably drop the `bcode_registers`
-   * whatsoever
+   * TODO(dfrank): use `bcode_ops` of the `frame` in-place, or probably drop
+   * the `bcode_registers` whatsoever
    */
+  struct v7_call_frame_bcode *frame;
   struct bcode *bcode;
   char *ops;
   char *end;
+  /* Copy of `slots_base` of the current bcode call frame */
+  size_t slots_base;
   unsigned int need_inc_ops : 1;
 };
 
@@ -13783,8 +16006,11 @@ static void bcode_adjust_retval(struct v7 *v7, uint8_t is_explicit_return) {
   }
 }
 
-static void bcode_restore_registers(struct v7 *v7, struct bcode *bcode,
+static void bcode_restore_registers(struct v7 *v7,
+                                    struct v7_call_frame_bcode *call_frame,
                                     struct bcode_registers *r) {
+  struct bcode *bcode = call_frame->bcode;
+  r->frame = call_frame;
   r->bcode = bcode;
   r->ops = bcode->ops.p;
   r->end = r->ops + bcode->ops.len;
@@ -13792,6 +16018,20 @@ static void bcode_restore_registers(struct v7 *v7, struct bcode *bcode,
   (void) v7;
 }
 
+/*
+ * Remembers the current position in the bcode call frame, so that the line
+ * number can be found if an exception is created, see `bcode_get_line_no()`.
+ * Like the return address saved by `init_call_frame_bcode()`, it points right
+ * after the byte being executed.
+ */
+static void bcode_save_ops(struct bcode_registers *r) {
+#ifndef V7_DISABLE_LINE_NUMBERS
+  r->frame->bcode_ops = r->ops + 1;
+#else
+  (void) r;
+#endif
+}
+
 V7_PRIVATE struct v7_call_frame_base *find_call_frame(struct v7 *v7,
                                                       uint8_t type_mask) {
   struct v7_call_frame_base *ret = v7->call_stack;
@@ -13824,16 +16064,20 @@ static struct v7_call_frame_base *create_call_frame(struct v7 *v7,
                                                     size_t size) {
   struct v7_call_frame_base *call_frame_base = NULL;
 
-  call_frame_base = (struct v7_call_frame_base *) calloc(1, size);
+  if (size == sizeof(struct v7_call_frame_bcode) &&
+      v7->free_call_frames != NULL) {
+    /* reuse one of the previously unwound bcode frames */
+    call_frame_base = v7->free_call_frames;
+    v7->free_call_frames = call_frame_base->prev;
+    v7->free_call_frames_cnt--;
+    memset(call_frame_base, 0, size);
+  } else {
+    call_frame_base = (struct v7_call_frame_base *) calloc(1, size);
+  }
 
   /* save previous call frame */
   call_frame_base->prev = v7->call_stack;
 
-  /* by default, inherit line_no from the previous frame */
-  if (v7->call_stack != NULL) {
-    call_frame_base->line_no = v7->call_stack->line_no;
-  }
-
   return call_frame_base;
 }
 
@@ -13879,6 +16123,9 @@ static void init_call_frame_bcode(struct v7 *v7,
   call_frame->bcode = bcode;
   call_frame->vals.this_obj = this_obj;
   call_frame->base.base.is_constructor = is_constructor;
+
+  /* frame slots, if any, are pushed right after the frame is created */
+  call_frame->slots_base = v7->stack.len;
 }
 
 /*
@@ -13933,14 +16180,25 @@ static enum v7_err bcode_perform_call(struct v7 *v7, v7_val_t scope_frame,
                                       struct bcode_registers *r,
                                       val_t this_object, char *ops,
                                       uint8_t is_constructor) {
-  /* new scope_frame will inherit from the function's scope */
-  obj_prototype_set(v7, get_object_struct(scope_frame), &func->scope->base);
+  if (func->bcode->frame_slots) {
+    /*
+     * locals live in the frame slots, so the function is executed right in
+     * its own scope; the caller populates the slots after this call.
+     */
+    scope_frame = (func->scope != NULL)
+                      ? v7_object_to_value(&func->scope->base)
+                      : v7->vals.global_object;
+  } else {
+    /* new scope_frame will inherit from the function's scope */
+    obj_prototype_set(v7, get_object_struct(scope_frame), &func->scope->base);
+  }
 
   /* create new `call_frame` which will replace `v7->call_stack` */
   append_call_frame_bcode(v7, r->ops + 1, func->bcode, this_object, scope_frame,
                           is_constructor);
 
-  bcode_restore_registers(v7, func->bcode, r);
+  bcode_restore_registers(v7, (struct v7_call_frame_bcode *) v7->call_stack, r);
+  r->slots_base = ((struct v7_call_frame_bcode *) v7->call_stack)->slots_base;
 
   /* adjust `ops` since names were already read from it */
   r->ops = ops;
@@ -13951,6 +16209,228 @@ static enum v7_err bcode_perform_call(struct v7 *v7, v7_val_t scope_frame,
   return V7_OK;
 }
 
+/*
+ * Returns whether a call of the function with the given `bcode` needs the
+ * arguments collected into an array, which becomes the `arguments` object.
+ * Otherwise, they are taken right from the stack.
+ */
+static int bcode_needs_args_array(struct bcode *bcode) {
+  return bcode->frame_slots ? bcode->arguments_slot : !bcode->no_arguments;
+}
+
+/*
+ * Pops `this`, the function and its `nargs` arguments from the stack, moving
+ * the function and the arguments down in place of `this`: that's where the
+ * frame slots of the function start, so that `bcode_push_frame_slots()` just
+ * takes them back.
+ *
+ * In between, only `bcode_perform_call()` may be called, since it doesn't
+ * touch the stack nor allocate values.
+ */
+static void bcode_pop_call_args(struct v7 *v7, int nargs) {
+  val_t *base = &STACK_PEEK(nargs + 1);
+  memmove(base, base + 1, (nargs + 1) * sizeof(val_t));
+  v7->stack.len -= (nargs + 2) * sizeof(val_t);
+}
+
+/*
+ * Populates frame slots of the function which was just called with
+ * `bcode_perform_call()`: the function itself, the arguments, the locals
+ * (initially `undefined`) and, if needed, the `arguments` array.
+ *
+ * If `args` is `undefined`, the function and its `nargs` arguments were left
+ * in place by `bcode_pop_call_args()`.
+ */
+static void bcode_push_frame_slots(struct v7 *v7, struct bcode *bcode,
+                                   val_t func, val_t args, int nargs) {
+  int i;
+
+  if (v7_is_undefined(args)) {
+    if (nargs > bcode->args_cnt) {
+      nargs = bcode->args_cnt;
+    }
+    v7->stack.len += (nargs + 1 /* func */) * sizeof(val_t);
+    for (i = nargs; i < bcode->args_cnt; i++) {
+      PUSH(V7_UNDEFINED);
+    }
+  } else {
+    PUSH(func);
+    for (i = 0; i < bcode->args_cnt; i++) {
+      PUSH(v7_array_get(v7, args, i));
+    }
+  }
+  for (i = bcode->args_cnt + 1 /*func name*/; i < bcode->names_cnt; i++) {
+    PUSH(V7_UNDEFINED);
+  }
+  if (bcode->arguments_slot) {
+    PUSH(args);
+  }
+}
+
+/*
+ * Returns the name of the given frame slot of the `bcode`; used for error
+ * reporting only.
+ */
+static val_t bcode_frame_slot_name(struct v7 *v7, struct bcode *bcode,
+                                   size_t idx) {
+  val_t res = V7_UNDEFINED;
+
+  if (idx >= bcode->names_cnt) {
+    /* it's the `arguments` slot */
+    return v7_mk_string(v7, "arguments", 9, 1);
+  }
+
+  bcode_next_name_v(v7, bcode, bcode_end_names(bcode->ops.p, idx), &res);
+  return res;
+}
+
+#ifndef V7_DISABLE_INLINE_CACHE
+/*
+ * Returns inline cache entry for the instruction at `op`, allocating the
+ * cache if needed; or `NULL` if the bcode can't have a cache.
+ */
+static struct bcode_ic_entry *bcode_ic_entry(struct bcode *bcode,
+                                             const char *op) {
+  if (bcode->ic == NULL) {
+    size_t n = 4;
+
+    if (bcode->frozen) {
+      /* frozen bcode lives in ROM */
+      return NULL;
+    }
+
+    /* roughly one entry per 32 bytes of ops */
+    while (n < V7_IC_MAX_ENTRIES && n * 32 < bcode->ops.len) {
+      n <<= 1;
+    }
+
+    bcode->ic = (struct bcode_ic_entry *) calloc(n, sizeof(*bcode->ic));
+    if (bcode->ic == NULL) {
+      return NULL;
+    }
+    bcode->ic_mask = n - 1;
+  }
+
+  return &bcode->ic[(op - bcode->ops.p) & bcode->ic_mask];
+}
+
+static int obj_has_own_prop_ptr(struct v7_object *o, struct v7_property *p) {
+  struct v7_property *cur;
+  for (cur = o->properties; cur != NULL; cur = cur->next) {
+    if (cur == p) {
+      return 1;
+    }
+  }
+  return 0;
+}
+#endif
+
+/*
+ * Returns the property `name` of the object `o` remembered by the inline
+ * cache of the instruction at `op`, or `NULL` if there is no valid entry.
+ * If `own_only` is non-zero, properties found in the prototype are ignored.
+ */
+static struct v7_property *bcode_ic_find(struct v7 *v7, struct bcode *bcode,
+                                         const char *op, struct v7_object *o,
+                                         val_t name, uint8_t own_only) {
+#ifndef V7_DISABLE_INLINE_CACHE
+  struct bcode_ic_entry *e;
+
+  if (bcode->ic == NULL) {
+    return NULL;
+  }
+
+  e = &bcode->ic[(op - bcode->ops.p) & bcode->ic_mask];
+  if (e->obj == o && e->name == name && e->head == o->properties &&
+      e->epoch == v7->ic_epoch && e->off == (bcode_off_t)(op - bcode->ops.p) &&
+      (e->holder == o || (!own_only && e->holder == obj_prototype(v7, o)))) {
+    return e->prop;
+  }
+#else
+  (void) v7;
+  (void) bcode;
+  (void) op;
+  (void) o;
+  (void) name;
+  (void) own_only;
+#endif
+  return NULL;
+}
+
+/*
+ * Remembers in the inline cache of the instruction at `op` that the property
+ * `name` of the object `o` is `p`. Does nothing unless `p` is an own property
+ * of `o` or of its direct prototype.
+ */
+static void bcode_ic_fill(struct v7 *v7, struct bcode *bcode, const char *op,
+                          struct v7_object *o, val_t name,
+                          struct v7_property *p) {
+#ifndef V7_DISABLE_INLINE_CACHE
+  struct bcode_ic_entry *e;
+  struct v7_object *holder = o;
+
+  if (p == NULL || p == v7->cur_dense_prop) {
+    return;
+  }
+
+  if (o->attributes & V7_OBJ_DENSE_ARRAY) {
+    /* index names are served by the dense storage, which has no list head */
+    size_t len;
+    unsigned long idx;
+    const char *s = v7_get_string(v7, &name, &len);
+    if (cstr_to_array_index(s, len, &idx)) {
+      return;
+    }
+  }
+
+  if (!obj_has_own_prop_ptr(o, p)) {
+    holder = obj_prototype(v7, o);
+    if (holder == NULL || !obj_has_own_prop_ptr(holder, p)) {
+      return;
+    }
+  }
+
+  e = bcode_ic_entry(bcode, op);
+  if (e != NULL) {
+    e->off = op - bcode->ops.p;
+    e->epoch = v7->ic_epoch;
+    e->name = name;
+    e->obj = o;
+    e->head = o->properties;
+    e->holder = holder;
+    e->prop = p;
+  }
+#else
+  (void) v7;
+  (void) bcode;
+  (void) op;
+  (void) o;
+  (void) name;
+  (void) p;
+#endif
+}
+
+/*
+ * Like `v7_get_property()`, but takes the name as a string `val_t`, and uses
+ * the inline cache of the instruction at `op`.
+ */
+static struct v7_property *bcode_ic_get_property(struct v7 *v7,
+                                                 struct bcode *bcode,
+                                                 const char *op, val_t obj,
+                                                 val_t name) {
+  struct v7_object *o = get_object_struct(obj);
+  struct v7_property *p = bcode_ic_find(v7, bcode, op, o, name, 0);
+
+  if (p == NULL) {
+    size_t name_len;
+    const char *s = v7_get_string(v7, &name, &name_len);
+    p = v7_get_property(v7, obj, s, name_len);
+    bcode_ic_fill(v7, bcode, op, o, name, p);
+  }
+
+  return p;
+}
+
 /*
  * Apply data from the "private" call frame, typically after some other frame
  * was just unwound.
@@ -13988,8 +16468,9 @@ static void apply_frame_bcode(struct v7 *v7,
      */
     assert(call_frame != NULL);
 
-    bcode_restore_registers(v7, call_frame->bcode, r);
+    bcode_restore_registers(v7, call_frame, r);
     r->ops = call_frame->bcode_ops;
+    r->slots_base = call_frame->slots_base;
   }
 }
 
@@ -14011,7 +16492,15 @@ static v7_call_frame_mask_t unwind_stack_1level(struct v7 *v7,
   {
     struct v7_call_frame_base *tmp = v7->call_stack;
     v7->call_stack = v7->call_stack->prev;
-    free(tmp);
+    if ((type_mask & V7_CALL_FRAME_MASK_BCODE) &&
+        v7->free_call_frames_cnt < V7_CALL_FRAME_CACHE_SIZE) {
+      /* keep the frame for the next call, see `create_call_frame()` */
+      tmp->prev = v7->free_call_frames;
+      v7->free_call_frames = tmp;
+      v7->free_call_frames_cnt++;
+    } else {
+      free(tmp);
+    }
   }
 
   /*
@@ -14316,6 +16805,7 @@ static enum v7_err bcode_throw_reference_error(struct v7 *v7,
   assert(v7_is_string(var_name));
   s = v7_get_string(v7, &var_name, &name_len);
 
+  bcode_save_ops(r);
   rcode = v7_throwf(v7, REFERENCE_ERROR, "[%.*s] is not defined",
                     (int) name_len, s);
   (void) rcode;
@@ -14365,28 +16855,53 @@ static val_t bcode_instantiate_function(struct v7 *v7, val_t func) {
      */
     res = func;
     f->scope = scope;
+    GC_WRITE_BARRIER(v7, v7_object_to_value(&scope->base));
   }
 
   return res;
 }
 
 /**
- * Call C function `func` with given `this_object` and array of arguments
- * `args`. `func` should be a C function pointer, not C function object.
- */
-static enum v7_err call_cfunction(struct v7 *v7, val_t func, val_t this_object,
-                                  val_t args, uint8_t is_constructor,
-                                  val_t *res) {
+ * Call C function `func` with given `this_object` and arguments: either the
+ * array `args`, or, if `args` is `undefined`, `argc` topmost values of the
+ * data stack (they are left there). `func` should be a C function pointer,
+ * not C function object.
+ *
+ * Either way, the function gets the arguments as a slice of the data stack,
+ * see `v7_argv()`; the `arguments` array is created only if the function asks
+ * for it.
+ */
+V7_PRIVATE enum v7_err call_cfunction(struct v7 *v7, val_t func,
+                                      val_t this_object, val_t args,
+                                      unsigned long argc,
+                                      uint8_t is_constructor, val_t *res) {
   enum v7_err rcode = V7_OK;
   uint8_t saved_inhibit_gc = v7->inhibit_gc;
   val_t saved_arguments = v7->vals.arguments;
+  size_t saved_cfunc_args = v7->cfunc_args;
+  unsigned long saved_cfunc_argc = v7->cfunc_argc;
+  size_t saved_stack_len = v7->stack.len;
   struct gc_tmp_frame tf = new_tmp_frame(v7);
   v7_cfunction_t *cfunc = get_cfunction_ptr(v7, func);
 
   *res = V7_UNDEFINED;
 
+#ifdef V7_ENABLE_STATS
+  stats_count_cfunc(v7, cfunc);
+#endif
+
   tmp_stack_push(&tf, &saved_arguments);
 
+  if (!v7_is_undefined(args)) {
+    /* copy the args to the data stack, the array is `arguments` already */
+    unsigned long i;
+    argc = v7_array_length(v7, args);
+    for (i = 0; i < argc; i++) {
+      val_t v = v7_array_get(v7, args, i);
+      mbuf_append(&v7->stack, &v, sizeof(v));
+    }
+  }
+
   append_call_frame_cfunc(v7, this_object, cfunc);
 
   /*
@@ -14394,6 +16909,8 @@ static enum v7_err call_cfunction(struct v7 *v7, val_t func, val_t this_object,
    */
   v7->inhibit_gc = 1;
   v7->vals.arguments = args;
+  v7->cfunc_args = v7->stack.len - argc * sizeof(val_t);
+  v7->cfunc_argc = argc;
 
   /* call C function */
   rcode = cfunc(v7, res);
@@ -14408,10 +16925,15 @@ static enum v7_err call_cfunction(struct v7 *v7, val_t func, val_t this_object,
 
 clean:
   v7->vals.arguments = saved_arguments;
+  v7->cfunc_args = saved_cfunc_args;
+  v7->cfunc_argc = saved_cfunc_argc;
   v7->inhibit_gc = saved_inhibit_gc;
 
   unwind_stack_1level(v7, NULL);
 
+  /* drop the args copied from the array, if any */
+  v7->stack.len = saved_stack_len;
+
   tmp_frame_cleanup(&tf);
   return rcode;
 }
@@ -14510,16 +17032,343 @@ static void disown_bcode(struct v7 *v7, struct bcode *p) {
   v7->act_bcodes.len -= sizeof(p);
 }
 
-/* Keeps track of last evaluated bcodes in order to improve error reporting */
-static void push_bcode_history(struct v7 *v7, enum opcode op) {
-  size_t i;
+/*
+ * Runs the GC if it's needed, and advances the incremental GC cycle in
+ * progress, if any. Instead of polling before each instruction, `eval_bcode()`
+ * calls it on taken jumps, calls and returns only: straight-line code always
+ * reaches one of them soon.
+ */
+static void bcode_gc_safepoint(struct v7 *v7) {
+  if (v7->need_gc
+#ifdef V7_ENABLE_INCREMENTAL_GC
+      || v7->gc_phase != GC_PHASE_IDLE
+#endif
+      ) {
+    maybe_gc(v7);
+    v7->need_gc = 0;
+  }
+}
 
-  if (op == OP_CHECK_CALL || op == OP_CALL || op == OP_NEW) return;
+/*
+ * Evaluates `v1 + v2` for `OP_ADD` and friends.
+ */
+WARN_UNUSED_RESULT
+static enum v7_err bcode_add(struct v7 *v7, val_t v1, val_t v2, val_t *res) {
+  enum v7_err rcode = V7_OK;
+  struct gc_tmp_frame tf;
+
+  if (IS_SMI(v1) && IS_SMI(v2) &&
+      b_smi_bin_op(OP_ADD, GET_SMI(v1), GET_SMI(v2), res)) {
+    return V7_OK;
+  }
+
+  if (v7_is_number(v1) && v7_is_number(v2)) {
+    *res = v7_mk_number(v7, b_num_bin_op(OP_ADD, v7_get_double(v7, v1),
+                                         v7_get_double(v7, v2)));
+    return V7_OK;
+  }
+
+  tf = new_tmp_frame(v7);
+  tmp_stack_push(&tf, &v1);
+  tmp_stack_push(&tf, &v2);
+
+  /*
+   * If either operand is an object, convert both of them to primitives
+   */
+  if (v7_is_object(v1) || v7_is_object(v2)) {
+    V7_TRY(to_primitive(v7, v1, V7_TO_PRIMITIVE_HINT_AUTO, &v1));
+    V7_TRY(to_primitive(v7, v2, V7_TO_PRIMITIVE_HINT_AUTO, &v2));
+  }
+
+  if (v7_is_string(v1) || v7_is_string(v2)) {
+    /* Convert both operands to strings, and concatenate */
+
+    V7_TRY(primitive_to_str(v7, v1, &v1, NULL, 0, NULL));
+    V7_TRY(primitive_to_str(v7, v2, &v2, NULL, 0, NULL));
+
+    *res = s_concat(v7, v1, v2);
+  } else {
+    /* Convert both operands to numbers, and sum */
+
+    V7_TRY(primitive_to_number(v7, v1, &v1));
+    V7_TRY(primitive_to_number(v7, v2, &v2));
+
+    *res = v7_mk_number(v7, b_num_bin_op(OP_ADD, v7_get_double(v7, v1),
+                                         v7_get_double(v7, v2)));
+  }
+
+clean:
+  tmp_frame_cleanup(&tf);
+  return rcode;
+}
+
+/*
+ * Evaluates comparison `op` (one of `OP_EQ_EQ` .. `OP_GE`) of `v1` and `v2`.
+ */
+WARN_UNUSED_RESULT
+static enum v7_err bcode_compare(struct v7 *v7, enum opcode op, val_t v1,
+                                 val_t v2, int *res) {
+  enum v7_err rcode = V7_OK;
+  struct gc_tmp_frame tf;
+
+  if (IS_SMI(v1) && IS_SMI(v2)) {
+    *res = b_smi_bool_bin_op(op, GET_SMI(v1), GET_SMI(v2));
+    return V7_OK;
+  }
+
+  /* numbers are strictly equal if they are numerically equal: `0 === -0` */
+  if (v7_is_number(v1) && v7_is_number(v2)) {
+    *res = b_bool_bin_op(op, v7_get_double(v7, v1), v7_get_double(v7, v2));
+    return V7_OK;
+  }
+
+  tf = new_tmp_frame(v7);
+  tmp_stack_push(&tf, &v1);
+  tmp_stack_push(&tf, &v2);
+
+  switch (op) {
+    case OP_EQ_EQ:
+      if (v7_is_string(v1) && v7_is_string(v2)) {
+        *res = s_cmp(v7, v1, v2) == 0;
+      } else if (v1 == v2 && v1 == V7_TAG_NAN) {
+        *res = 0;
+      } else {
+        *res = v1 == v2;
+      }
+      break;
+    case OP_NE_NE:
+      if (v7_is_string(v1) && v7_is_string(v2)) {
+        *res = s_cmp(v7, v1, v2) != 0;
+      } else if (v1 == v2 && v1 == V7_TAG_NAN) {
+        *res = 1;
+      } else {
+        *res = v1 != v2;
+      }
+      break;
+    case OP_EQ:
+    case OP_NE:
+      /*
+       * TODO(dfrank) : it's not really correct. Fix it accordingly to
+       * the p. 4.9 of The Definitive Guide (page 71)
+       */
+      if (((v7_is_object(v1) || v7_is_object(v2)) && v1 == v2)) {
+        *res = op == OP_EQ;
+        break;
+      } else if (v7_is_undefined(v1) || v7_is_null(v1)) {
+        *res = (op != OP_EQ) ^ (v7_is_undefined(v2) || v7_is_null(v2));
+        break;
+      } else if (v7_is_undefined(v2) || v7_is_null(v2)) {
+        *res = (op != OP_EQ) ^ (v7_is_undefined(v1) || v7_is_null(v1));
+        break;
+      }
+
+      if (v7_is_string(v1) && v7_is_string(v2)) {
+        int cmp = s_cmp(v7, v1, v2);
+        *res = (op == OP_EQ) ? (cmp == 0) : (cmp != 0);
+      } else {
+        /* Convert both operands to numbers */
+
+        V7_TRY(to_number_v(v7, v1, &v1));
+        V7_TRY(to_number_v(v7, v2, &v2));
+
+        *res = b_bool_bin_op(op, v7_get_double(v7, v1), v7_get_double(v7, v2));
+      }
+      break;
+    case OP_LT:
+    case OP_LE:
+    case OP_GT:
+    case OP_GE:
+      V7_TRY(to_primitive(v7, v1, V7_TO_PRIMITIVE_HINT_NUMBER, &v1));
+      V7_TRY(to_primitive(v7, v2, V7_TO_PRIMITIVE_HINT_NUMBER, &v2));
+
+      if (v7_is_string(v1) && v7_is_string(v2)) {
+        int cmp = s_cmp(v7, v1, v2);
+        switch (op) {
+          case OP_LT:
+            *res = cmp < 0;
+            break;
+          case OP_LE:
+            *res = cmp <= 0;
+            break;
+          case OP_GT:
+            *res = cmp > 0;
+            break;
+          case OP_GE:
+            *res = cmp >= 0;
+            break;
+          default:
+            /* should never be here */
+            assert(0);
+        }
+      } else {
+        /* Convert both operands to numbers */
+
+        V7_TRY(to_number_v(v7, v1, &v1));
+        V7_TRY(to_number_v(v7, v2, &v2));
+
+        *res = b_bool_bin_op(op, v7_get_double(v7, v1), v7_get_double(v7, v2));
+      }
+      break;
+    default:
+      /* should never be here */
+      assert(0);
+  }
+
+clean:
+  tmp_frame_cleanup(&tf);
+  return rcode;
+}
+
+#ifndef V7_DISABLE_BCODE_OPT
+V7_PRIVATE enum v7_err eval_const_op(struct v7 *v7, enum opcode op, val_t v1,
+                                     val_t v2, val_t *res) {
+  enum v7_err rcode = V7_OK;
+  int cmp;
+
+  switch (op) {
+    case OP_LOGICAL_NOT:
+      *res = v7_mk_boolean(v7, !v7_is_truthy(v7, v2));
+      break;
+    case OP_NOT:
+      V7_TRY(to_number_v(v7, v2, &v2));
+      if (IS_SMI(v2)) {
+        *res = MK_SMI(~GET_SMI(v2));
+      } else {
+        *res = v7_mk_number(v7, ~(int32_t) v7_get_double(v7, v2));
+      }
+      break;
+    case OP_NEG:
+      V7_TRY(to_number_v(v7, v2, &v2));
+      *res = v7_mk_number(v7, -v7_get_double(v7, v2));
+      break;
+    case OP_POS:
+      V7_TRY(to_number_v(v7, v2, res));
+      break;
+    case OP_ADD:
+      V7_TRY(bcode_add(v7, v1, v2, res));
+      break;
+    case OP_SUB:
+    case OP_REM:
+    case OP_MUL:
+    case OP_DIV:
+    case OP_LSHIFT:
+    case OP_RSHIFT:
+    case OP_URSHIFT:
+    case OP_OR:
+    case OP_XOR:
+    case OP_AND:
+      if (IS_SMI(v1) && IS_SMI(v2) &&
+          b_smi_bin_op(op, GET_SMI(v1), GET_SMI(v2), res)) {
+        break;
+      }
+      V7_TRY(to_number_v(v7, v1, &v1));
+      V7_TRY(to_number_v(v7, v2, &v2));
+      *res = v7_mk_number(
+          v7, b_num_bin_op(op, v7_get_double(v7, v1), v7_get_double(v7, v2)));
+      break;
+    case OP_EQ_EQ:
+    case OP_NE_NE:
+    case OP_EQ:
+    case OP_NE:
+    case OP_LT:
+    case OP_LE:
+    case OP_GT:
+    case OP_GE:
+      V7_TRY(bcode_compare(v7, op, v1, v2, &cmp));
+      *res = v7_mk_boolean(v7, cmp);
+      break;
+    default:
+      rcode = V7_INTERNAL_ERROR;
+      break;
+  }
+
+clean:
+  return rcode;
+}
+#endif
+
+/*
+ * Like `bcode_inc()`, but `v` must be a number.
+ */
+static val_t bcode_inc_number(struct v7 *v7, val_t v, uint8_t flags) {
+  enum opcode op = (flags & INC_FLAG_DEC) ? OP_SUB : OP_ADD;
+  val_t res;
+
+  if (IS_SMI(v) && b_smi_bin_op(op, GET_SMI(v), 1, &res)) {
+    return res;
+  }
+  return v7_mk_number(v7, b_num_bin_op(op, v7_get_double(v7, v), 1));
+}
+
+/*
+ * Computes the new value for `OP_INC_LOCAL` / `OP_INC_VAR`: like `OP_ADD` or
+ * `OP_SUB` with `1`, depending on the `INC_FLAG_DEC` bit of `flags`.
+ */
+WARN_UNUSED_RESULT
+static enum v7_err bcode_inc(struct v7 *v7, val_t v, uint8_t flags,
+                             val_t *res) {
+  enum v7_err rcode = V7_OK;
 
-  for (i = ARRAY_SIZE(v7->last_ops) - 1; i > 0; i--) {
-    v7->last_ops[i] = v7->last_ops[i - 1];
+  if (flags & INC_FLAG_DEC) {
+    V7_TRY(to_number_v(v7, v, &v));
+    *res = bcode_inc_number(v7, v, flags);
+  } else {
+    V7_TRY(bcode_add(v7, v, v7_mk_number(v7, 1), res));
   }
-  v7->last_ops[0] = op;
+
+clean:
+  return rcode;
+}
+
+/*
+ * Sets the variable `name` in the current scope, like `OP_SET_VAR` at
+ * `op_ptr` does.
+ */
+WARN_UNUSED_RESULT
+static enum v7_err bcode_set_var(struct v7 *v7, struct bcode *bcode,
+                                 char *op_ptr, val_t name, val_t val) {
+  enum v7_err rcode = V7_OK;
+  val_t scope = get_scope(v7);
+  struct v7_property *prop =
+      bcode_ic_get_property(v7, bcode, op_ptr, scope, name);
+
+  if (prop != NULL) {
+    /* Property already exists: update its value */
+    /*
+     * TODO(dfrank): currently we can't use `def_property_v()` here,
+     * because if the property was already found somewhere in the
+     * prototype chain, then it should be updated, instead of creating a
+     * new one on the top of the scope.
+     *
+     * Probably we need to make `def_property_v()` more generic and
+     * use it here; or split `def_property_v()` into smaller pieces and
+     * use one of them here.
+     */
+    if (!(prop->attributes & V7_PROPERTY_NON_WRITABLE)) {
+      prop->value = val;
+      GC_WRITE_BARRIER(v7, val);
+    }
+  } else if (!bcode->strict_mode) {
+    /*
+     * Property does not exist: since we're not in strict mode, let's
+     * create new property at Global Object
+     */
+    V7_TRY(set_property_v(v7, v7_get_global(v7), name, val, NULL));
+  } else {
+    /*
+     * In strict mode, throw reference error instead of polluting Global
+     * Object
+     */
+    const char *s;
+    size_t name_len;
+
+    s = v7_get_string(v7, &name, &name_len);
+    rcode = v7_throwf(v7, REFERENCE_ERROR, "[%.*s] is not defined",
+                      (int) name_len, s);
+  }
+
+clean:
+  return rcode;
 }
 
 #ifndef V7_DISABLE_CALL_ERROR_CONTEXT
@@ -14535,14 +17384,104 @@ static void reset_last_name(struct v7 *v7) {
 #endif
 
 /*
- * Evaluates given `bcode`. If `reset_line_no` is non-zero, the line number
- * is initially reset to 1; otherwise, it is inherited from the previous call
- * frame.
+ * Threaded dispatch: with GCC's "labels as values", each instruction jumps
+ * right to the handler of the next one, see `BCODE_NEXT()`. Otherwise, it's
+ * a plain `switch` in a loop.
+ */
+#if defined(__GNUC__) && !defined(V7_DISABLE_COMPUTED_GOTO) && \
+    !defined(V7_BCODE_TRACE)
+#define V7_COMPUTED_GOTO 1
+#endif
+
+#ifdef V7_COMPUTED_GOTO
+#define BCODE_CASE(op) \
+  case op:             \
+    lbl_##op
+#define BCODE_DISPATCH()                    \
+  do {                                      \
+    STATS_OP(v7, op);                       \
+    BCODE_HEAPLOG_POINT();                  \
+    if ((uint8_t) op < OP_MAX) {            \
+      goto *dispatch_table[(uint8_t) op];   \
+    }                                       \
+    goto lbl_unknown;                       \
+  } while (0)
+/* Finishes the instruction and goes on with the next one */
+#define BCODE_NEXT()                 \
+  do {                               \
+    if (r.ops + 1 < r.end) {         \
+      op = (enum opcode) * ++r.ops;  \
+      BCODE_DISPATCH();              \
+    }                                \
+    goto op_done;                    \
+  } while (0)
+#else
+#define BCODE_CASE(op) case op
+#define BCODE_NEXT() break
+#endif
+
+/*
+ * Samples the JS stack if the profiler asks for it; checked along with
+ * `bcode_gc_safepoint()`.
+ */
+#ifdef V7_ENABLE_PROFILER
+#define BCODE_PROFILER_POINT() \
+  do {                         \
+    if (PROFILER_TICK(v7)) {   \
+      bcode_save_ops(&r);      \
+      profiler_sample(v7);     \
+    }                          \
+  } while (0)
+#else
+#define BCODE_PROFILER_POINT()
+#endif
+
+/*
+ * Keeps the position of the current frame up to date while the heap is
+ * logged, so that allocations are attributed to the right lines.
+ */
+#ifdef V7_ENABLE_HEAPLOG
+#define BCODE_HEAPLOG_POINT()     \
+  do {                            \
+    if (v7->heaplog != NULL) {    \
+      bcode_save_ops(&r);         \
+    }                             \
+  } while (0)
+#else
+#define BCODE_HEAPLOG_POINT()
+#endif
+
+/* Transfers control to the `target` offset of the current bcode */
+#define BCODE_JUMP(target)                     \
+  do {                                         \
+    r.ops = r.bcode->ops.p + (target) - 1;     \
+    BCODE_CLEAR_CALL_CTX();                    \
+    bcode_gc_safepoint(v7);                    \
+    BCODE_PROFILER_POINT();                    \
+  } while (0)
+
+/*
+ * Remembers the instruction which has just pushed a (probably) callee, to
+ * be able to name it if `OP_CHECK_CALL` follows; see `reset_last_name()`.
+ */
+#ifndef V7_DISABLE_CALL_ERROR_CONTEXT
+#define BCODE_SET_CALL_CTX(op) \
+  do {                         \
+    call_ctx_end = r.ops + 1;  \
+    call_ctx_op = (op);        \
+  } while (0)
+#define BCODE_CLEAR_CALL_CTX() (call_ctx_end = NULL)
+#else
+#define BCODE_SET_CALL_CTX(op)
+#define BCODE_CLEAR_CALL_CTX()
+#endif
+
+/*
+ * Evaluates given `bcode`.
  */
 WARN_UNUSED_RESULT
 V7_PRIVATE enum v7_err eval_bcode(struct v7 *v7, struct bcode *bcode,
-                                  val_t this_object, uint8_t reset_line_no,
-                                  val_t *_res) {
+                                  val_t this_object, val_t *_res) {
   struct bcode_registers r;
   enum v7_err rcode = V7_OK;
   struct v7_call_frame_base *saved_bottom_call_frame = v7->bottom_call_frame;
@@ -14559,11 +17498,100 @@ V7_PRIVATE enum v7_err eval_bcode(struct v7 *v7, struct bcode *bcode,
         v3 = V7_UNDEFINED, v4 = V7_UNDEFINED, scope_frame = V7_UNDEFINED;
   struct gc_tmp_frame tf = new_tmp_frame(v7);
 
-  append_call_frame_bcode(v7, NULL, bcode, this_object, get_scope(v7), 0);
+#ifndef V7_DISABLE_CALL_ERROR_CONTEXT
+  char *call_ctx_end = NULL;
+  enum opcode call_ctx_op = OP_MAX;
+#endif
 
-  if (reset_line_no) {
-    v7->call_stack->line_no = 1;
-  }
+#ifdef V7_COMPUTED_GOTO
+  /* clang-format off */
+  static const void *const dispatch_table[OP_MAX] = {
+    [OP_DROP] = &&lbl_OP_DROP,
+    [OP_DUP] = &&lbl_OP_DUP,
+    [OP_2DUP] = &&lbl_OP_2DUP,
+    [OP_SWAP] = &&lbl_OP_SWAP,
+    [OP_STASH] = &&lbl_OP_STASH,
+    [OP_UNSTASH] = &&lbl_OP_UNSTASH,
+    [OP_SWAP_DROP] = &&lbl_OP_SWAP_DROP,
+    [OP_PUSH_UNDEFINED] = &&lbl_OP_PUSH_UNDEFINED,
+    [OP_PUSH_NULL] = &&lbl_OP_PUSH_NULL,
+    [OP_PUSH_THIS] = &&lbl_OP_PUSH_THIS,
+    [OP_PUSH_TRUE] = &&lbl_OP_PUSH_TRUE,
+    [OP_PUSH_FALSE] = &&lbl_OP_PUSH_FALSE,
+    [OP_PUSH_ZERO] = &&lbl_OP_PUSH_ZERO,
+    [OP_PUSH_ONE] = &&lbl_OP_PUSH_ONE,
+    [OP_PUSH_LIT] = &&lbl_OP_PUSH_LIT,
+    [OP_NOT] = &&lbl_OP_NOT,
+    [OP_LOGICAL_NOT] = &&lbl_OP_LOGICAL_NOT,
+    [OP_NEG] = &&lbl_OP_NEG,
+    [OP_POS] = &&lbl_OP_POS,
+    [OP_ADD] = &&lbl_OP_ADD,
+    [OP_SUB] = &&lbl_OP_SUB,
+    [OP_REM] = &&lbl_OP_REM,
+    [OP_MUL] = &&lbl_OP_MUL,
+    [OP_DIV] = &&lbl_OP_DIV,
+    [OP_LSHIFT] = &&lbl_OP_LSHIFT,
+    [OP_RSHIFT] = &&lbl_OP_RSHIFT,
+    [OP_URSHIFT] = &&lbl_OP_URSHIFT,
+    [OP_OR] = &&lbl_OP_OR,
+    [OP_XOR] = &&lbl_OP_XOR,
+    [OP_AND] = &&lbl_OP_AND,
+    [OP_EQ_EQ] = &&lbl_OP_EQ_EQ,
+    [OP_EQ] = &&lbl_OP_EQ,
+    [OP_NE] = &&lbl_OP_NE,
+    [OP_NE_NE] = &&lbl_OP_NE_NE,
+    [OP_LT] = &&lbl_OP_LT,
+    [OP_LE] = &&lbl_OP_LE,
+    [OP_GT] = &&lbl_OP_GT,
+    [OP_GE] = &&lbl_OP_GE,
+    [OP_INSTANCEOF] = &&lbl_OP_INSTANCEOF,
+    [OP_TYPEOF] = &&lbl_OP_TYPEOF,
+    [OP_IN] = &&lbl_OP_IN,
+    [OP_GET] = &&lbl_OP_GET,
+    [OP_SET] = &&lbl_OP_SET,
+    [OP_SET_VAR] = &&lbl_OP_SET_VAR,
+    [OP_GET_VAR] = &&lbl_OP_GET_VAR,
+    [OP_SAFE_GET_VAR] = &&lbl_OP_SAFE_GET_VAR,
+    [OP_GET_LOCAL] = &&lbl_OP_GET_LOCAL,
+    [OP_SET_LOCAL] = &&lbl_OP_SET_LOCAL,
+    [OP_JMP] = &&lbl_OP_JMP,
+    [OP_JMP_TRUE] = &&lbl_OP_JMP_TRUE,
+    [OP_JMP_FALSE] = &&lbl_OP_JMP_FALSE,
+    [OP_JMP_TRUE_DROP] = &&lbl_OP_JMP_TRUE_DROP,
+    [OP_JMP_IF_CONTINUE] = &&lbl_OP_JMP_IF_CONTINUE,
+    [OP_CREATE_OBJ] = &&lbl_OP_CREATE_OBJ,
+    [OP_CREATE_ARR] = &&lbl_OP_CREATE_ARR,
+    [OP_NEXT_PROP] = &&lbl_OP_NEXT_PROP,
+    [OP_FUNC_LIT] = &&lbl_OP_FUNC_LIT,
+    [OP_CHECK_CALL] = &&lbl_OP_CHECK_CALL,
+    [OP_CALL] = &&lbl_OP_CALL,
+    [OP_NEW] = &&lbl_OP_NEW,
+    [OP_RET] = &&lbl_OP_RET,
+    [OP_DELETE] = &&lbl_OP_DELETE,
+    [OP_DELETE_VAR] = &&lbl_OP_DELETE_VAR,
+    [OP_TRY_PUSH_CATCH] = &&lbl_OP_TRY_PUSH_CATCH,
+    [OP_TRY_PUSH_FINALLY] = &&lbl_OP_TRY_PUSH_FINALLY,
+    [OP_TRY_PUSH_LOOP] = &&lbl_OP_TRY_PUSH_LOOP,
+    [OP_TRY_PUSH_SWITCH] = &&lbl_OP_TRY_PUSH_SWITCH,
+    [OP_TRY_POP] = &&lbl_OP_TRY_POP,
+    [OP_AFTER_FINALLY] = &&lbl_OP_AFTER_FINALLY,
+    [OP_THROW] = &&lbl_OP_THROW,
+    [OP_BREAK] = &&lbl_OP_BREAK,
+    [OP_CONTINUE] = &&lbl_OP_CONTINUE,
+    [OP_ENTER_CATCH] = &&lbl_OP_ENTER_CATCH,
+    [OP_EXIT_CATCH] = &&lbl_OP_EXIT_CATCH,
+    [OP_GET_PROP] = &&lbl_OP_GET_PROP,
+    [OP_GET_VAR_PROP] = &&lbl_OP_GET_VAR_PROP,
+    [OP_ADD_LIT] = &&lbl_OP_ADD_LIT,
+    [OP_CMP_JMP_TRUE] = &&lbl_OP_CMP_JMP_TRUE,
+    [OP_CMP_JMP_FALSE] = &&lbl_OP_CMP_JMP_FALSE,
+    [OP_INC_LOCAL] = &&lbl_OP_INC_LOCAL,
+    [OP_INC_VAR] = &&lbl_OP_INC_VAR,
+  };
+  /* clang-format on */
+#endif
+
+  append_call_frame_bcode(v7, NULL, bcode, this_object, get_scope(v7), 0);
 
   /*
    * Set current call stack as the "bottom" call stack, so that bcode evaluator
@@ -14571,7 +17599,9 @@ V7_PRIVATE enum v7_err eval_bcode(struct v7 *v7, struct bcode *bcode,
    */
   v7->bottom_call_frame = v7->call_stack;
 
-  bcode_restore_registers(v7, bcode, &r);
+  bcode_restore_registers(v7, (struct v7_call_frame_bcode *) v7->call_stack,
+                          &r);
+  r.slots_base = v7->stack.len;
 
   tmp_stack_push(&tf, &res);
   tmp_stack_push(&tf, &v1);
@@ -14595,45 +17625,12 @@ V7_PRIVATE enum v7_err eval_bcode(struct v7 *v7, struct bcode *bcode,
     }
   }
 
+  bcode_gc_safepoint(v7);
+
 restart:
   while (r.ops < r.end && rcode == V7_OK) {
     enum opcode op = (enum opcode) * r.ops;
 
-#ifndef V7_DISABLE_LINE_NUMBERS
-    if ((uint8_t) op >= _OP_LINE_NO) {
-      unsigned char buf[sizeof(size_t)];
-      int len;
-      size_t max_llen = sizeof(buf);
-
-      /* ASAN doesn't like out of bound reads */
-      if (r.ops + max_llen > r.end) {
-        max_llen = r.end - r.ops;
-      }
-
-      /*
-       * before we decode varint, we'll have to swap MSB and LSB, but we can't
-       * do it in place since we're decoding from constant memory, so, we also
-       * have to copy the data to the temp buffer first. 4 bytes should be
-       * enough for everyone's line number.
-       */
-      memcpy(buf, r.ops, max_llen);
-      buf[0] = msb_lsb_swap(buf[0]);
-
-      v7->call_stack->line_no = decode_varint(buf, &len) >> 1;
-      assert((size_t) len <= sizeof(buf));
-      r.ops += len;
-
-      continue;
-    }
-#endif
-
-    push_bcode_history(v7, op);
-
-    if (v7->need_gc) {
-      maybe_gc(v7);
-      v7->need_gc = 0;
-    }
-
     r.need_inc_ops = 1;
 #ifdef V7_BCODE_TRACE
     {
@@ -14643,75 +17640,82 @@ restart:
     }
 #endif
 
+#ifdef V7_COMPUTED_GOTO
+    BCODE_DISPATCH();
+#else
+    STATS_OP(v7, op);
+    BCODE_HEAPLOG_POINT();
+#endif
+
     switch (op) {
-      case OP_DROP:
+      BCODE_CASE(OP_DROP):
         POP();
-        break;
-      case OP_DUP:
+        BCODE_NEXT();
+      BCODE_CASE(OP_DUP):
         v1 = POP();
         PUSH(v1);
         PUSH(v1);
-        break;
-      case OP_2DUP:
+        BCODE_NEXT();
+      BCODE_CASE(OP_2DUP):
         v2 = POP();
         v1 = POP();
         PUSH(v1);
         PUSH(v2);
         PUSH(v1);
         PUSH(v2);
-        break;
-      case OP_SWAP:
+        BCODE_NEXT();
+      BCODE_CASE(OP_SWAP):
         v1 = POP();
         v2 = POP();
         PUSH(v1);
         PUSH(v2);
-        break;
-      case OP_STASH:
+        BCODE_NEXT();
+      BCODE_CASE(OP_STASH):
         assert(!v7->is_stashed);
         v7->vals.stash = TOS();
         v7->is_stashed = 1;
-        break;
-      case OP_UNSTASH:
+        BCODE_NEXT();
+      BCODE_CASE(OP_UNSTASH):
         assert(v7->is_stashed);
         POP();
         PUSH(v7->vals.stash);
         v7->vals.stash = V7_UNDEFINED;
         v7->is_stashed = 0;
-        break;
+        BCODE_NEXT();
 
-      case OP_SWAP_DROP:
+      BCODE_CASE(OP_SWAP_DROP):
         v1 = POP();
         POP();
         PUSH(v1);
-        break;
+        BCODE_NEXT();
 
-      case OP_PUSH_UNDEFINED:
+      BCODE_CASE(OP_PUSH_UNDEFINED):
         PUSH(V7_UNDEFINED);
-        break;
-      case OP_PUSH_NULL:
+        BCODE_NEXT();
+      BCODE_CASE(OP_PUSH_NULL):
         PUSH(V7_NULL);
-        break;
-      case OP_PUSH_THIS:
+        BCODE_NEXT();
+      BCODE_CASE(OP_PUSH_THIS):
         PUSH(v7_get_this(v7));
         reset_last_name(v7);
-        break;
-      case OP_PUSH_TRUE:
+        BCODE_NEXT();
+      BCODE_CASE(OP_PUSH_TRUE):
         PUSH(v7_mk_boolean(v7, 1));
         reset_last_name(v7);
-        break;
-      case OP_PUSH_FALSE:
+        BCODE_NEXT();
+      BCODE_CASE(OP_PUSH_FALSE):
         PUSH(v7_mk_boolean(v7, 0));
         reset_last_name(v7);
-        break;
-      case OP_PUSH_ZERO:
+        BCODE_NEXT();
+      BCODE_CASE(OP_PUSH_ZERO):
         PUSH(v7_mk_number(v7, 0));
         reset_last_name(v7);
-        break;
-      case OP_PUSH_ONE:
+        BCODE_NEXT();
+      BCODE_CASE(OP_PUSH_ONE):
         PUSH(v7_mk_number(v7, 1));
         reset_last_name(v7);
-        break;
-      case OP_PUSH_LIT: {
+        BCODE_NEXT();
+      BCODE_CASE(OP_PUSH_LIT): {
         PUSH(bcode_decode_lit(v7, r.bcode, &r.ops));
 #ifndef V7_DISABLE_CALL_ERROR_CONTEXT
         /* name tracking */
@@ -14719,196 +17723,83 @@ restart:
           reset_last_name(v7);
         }
 #endif
-        break;
+        BCODE_NEXT();
       }
-      case OP_LOGICAL_NOT:
+      BCODE_CASE(OP_LOGICAL_NOT):
         v1 = POP();
         PUSH(v7_mk_boolean(v7, !v7_is_truthy(v7, v1)));
         break;
-      case OP_NOT: {
+      BCODE_CASE(OP_NOT): {
         v1 = POP();
         BTRY(to_number_v(v7, v1, &v1));
+        if (IS_SMI(v1)) {
+          PUSH(MK_SMI(~GET_SMI(v1)));
+          break;
+        }
         PUSH(v7_mk_number(v7, ~(int32_t) v7_get_double(v7, v1)));
         break;
       }
-      case OP_NEG: {
+      BCODE_CASE(OP_NEG): {
         v1 = POP();
         BTRY(to_number_v(v7, v1, &v1));
         PUSH(v7_mk_number(v7, -v7_get_double(v7, v1)));
         break;
       }
-      case OP_POS: {
+      BCODE_CASE(OP_POS): {
         v1 = POP();
         BTRY(to_number_v(v7, v1, &v1));
         PUSH(v1);
         break;
       }
-      case OP_ADD: {
+      BCODE_CASE(OP_ADD): {
         v2 = POP();
         v1 = POP();
-
-        /*
-         * If either operand is an object, convert both of them to primitives
-         */
-        if (v7_is_object(v1) || v7_is_object(v2)) {
-          BTRY(to_primitive(v7, v1, V7_TO_PRIMITIVE_HINT_AUTO, &v1));
-          BTRY(to_primitive(v7, v2, V7_TO_PRIMITIVE_HINT_AUTO, &v2));
-        }
-
-        if (v7_is_string(v1) || v7_is_string(v2)) {
-          /* Convert both operands to strings, and concatenate */
-
-          BTRY(primitive_to_str(v7, v1, &v1, NULL, 0, NULL));
-          BTRY(primitive_to_str(v7, v2, &v2, NULL, 0, NULL));
-
-          PUSH(s_concat(v7, v1, v2));
-        } else {
-          /* Convert both operands to numbers, and sum */
-
-          BTRY(primitive_to_number(v7, v1, &v1));
-          BTRY(primitive_to_number(v7, v2, &v2));
-
-          PUSH(v7_mk_number(v7, b_num_bin_op(op, v7_get_double(v7, v1),
-                                             v7_get_double(v7, v2))));
-        }
-        break;
+        BTRY(bcode_add(v7, v1, v2, &res));
+        PUSH(res);
+        BCODE_NEXT();
       }
-      case OP_SUB:
-      case OP_REM:
-      case OP_MUL:
-      case OP_DIV:
-      case OP_LSHIFT:
-      case OP_RSHIFT:
-      case OP_URSHIFT:
-      case OP_OR:
-      case OP_XOR:
-      case OP_AND: {
+      BCODE_CASE(OP_SUB):
+      BCODE_CASE(OP_REM):
+      BCODE_CASE(OP_MUL):
+      BCODE_CASE(OP_DIV):
+      BCODE_CASE(OP_LSHIFT):
+      BCODE_CASE(OP_RSHIFT):
+      BCODE_CASE(OP_URSHIFT):
+      BCODE_CASE(OP_OR):
+      BCODE_CASE(OP_XOR):
+      BCODE_CASE(OP_AND): {
         v2 = POP();
         v1 = POP();
 
+        if (IS_SMI(v1) && IS_SMI(v2) &&
+            b_smi_bin_op(op, GET_SMI(v1), GET_SMI(v2), &res)) {
+          PUSH(res);
+          BCODE_NEXT();
+        }
+
         BTRY(to_number_v(v7, v1, &v1));
         BTRY(to_number_v(v7, v2, &v2));
 
         PUSH(v7_mk_number(v7, b_num_bin_op(op, v7_get_double(v7, v1),
                                            v7_get_double(v7, v2))));
-        break;
+        BCODE_NEXT();
       }
-      case OP_EQ_EQ: {
+      BCODE_CASE(OP_EQ_EQ):
+      BCODE_CASE(OP_NE_NE):
+      BCODE_CASE(OP_EQ):
+      BCODE_CASE(OP_NE):
+      BCODE_CASE(OP_LT):
+      BCODE_CASE(OP_LE):
+      BCODE_CASE(OP_GT):
+      BCODE_CASE(OP_GE): {
+        int cmp;
         v2 = POP();
         v1 = POP();
-        if (v7_is_string(v1) && v7_is_string(v2)) {
-          res = v7_mk_boolean(v7, s_cmp(v7, v1, v2) == 0);
-        } else if (v1 == v2 && v1 == V7_TAG_NAN) {
-          res = v7_mk_boolean(v7, 0);
-        } else {
-          res = v7_mk_boolean(v7, v1 == v2);
-        }
-        PUSH(res);
-        break;
+        BTRY(bcode_compare(v7, op, v1, v2, &cmp));
+        PUSH(v7_mk_boolean(v7, cmp));
+        BCODE_NEXT();
       }
-      case OP_NE_NE: {
-        v2 = POP();
-        v1 = POP();
-        if (v7_is_string(v1) && v7_is_string(v2)) {
-          res = v7_mk_boolean(v7, s_cmp(v7, v1, v2) != 0);
-        } else if (v1 == v2 && v1 == V7_TAG_NAN) {
-          res = v7_mk_boolean(v7, 1);
-        } else {
-          res = v7_mk_boolean(v7, v1 != v2);
-        }
-        PUSH(res);
-        break;
-      }
-      case OP_EQ:
-      case OP_NE: {
-        v2 = POP();
-        v1 = POP();
-        /*
-         * TODO(dfrank) : it's not really correct. Fix it accordingly to
-         * the p. 4.9 of The Definitive Guide (page 71)
-         */
-        if (((v7_is_object(v1) || v7_is_object(v2)) && v1 == v2)) {
-          res = v7_mk_boolean(v7, op == OP_EQ);
-          PUSH(res);
-          break;
-        } else if (v7_is_undefined(v1) || v7_is_null(v1)) {
-          res = v7_mk_boolean(
-              v7, (op != OP_EQ) ^ (v7_is_undefined(v2) || v7_is_null(v2)));
-          PUSH(res);
-          break;
-        } else if (v7_is_undefined(v2) || v7_is_null(v2)) {
-          res = v7_mk_boolean(
-              v7, (op != OP_EQ) ^ (v7_is_undefined(v1) || v7_is_null(v1)));
-          PUSH(res);
-          break;
-        }
-
-        if (v7_is_string(v1) && v7_is_string(v2)) {
-          int cmp = s_cmp(v7, v1, v2);
-          switch (op) {
-            case OP_EQ:
-              res = v7_mk_boolean(v7, cmp == 0);
-              break;
-            case OP_NE:
-              res = v7_mk_boolean(v7, cmp != 0);
-              break;
-            default:
-              /* should never be here */
-              assert(0);
-          }
-        } else {
-          /* Convert both operands to numbers */
-
-          BTRY(to_number_v(v7, v1, &v1));
-          BTRY(to_number_v(v7, v2, &v2));
-
-          res = v7_mk_boolean(v7, b_bool_bin_op(op, v7_get_double(v7, v1),
-                                                v7_get_double(v7, v2)));
-        }
-        PUSH(res);
-        break;
-      }
-      case OP_LT:
-      case OP_LE:
-      case OP_GT:
-      case OP_GE: {
-        v2 = POP();
-        v1 = POP();
-        BTRY(to_primitive(v7, v1, V7_TO_PRIMITIVE_HINT_NUMBER, &v1));
-        BTRY(to_primitive(v7, v2, V7_TO_PRIMITIVE_HINT_NUMBER, &v2));
-
-        if (v7_is_string(v1) && v7_is_string(v2)) {
-          int cmp = s_cmp(v7, v1, v2);
-          switch (op) {
-            case OP_LT:
-              res = v7_mk_boolean(v7, cmp < 0);
-              break;
-            case OP_LE:
-              res = v7_mk_boolean(v7, cmp <= 0);
-              break;
-            case OP_GT:
-              res = v7_mk_boolean(v7, cmp > 0);
-              break;
-            case OP_GE:
-              res = v7_mk_boolean(v7, cmp >= 0);
-              break;
-            default:
-              /* should never be here */
-              assert(0);
-          }
-        } else {
-          /* Convert both operands to numbers */
-
-          BTRY(to_number_v(v7, v1, &v1));
-          BTRY(to_number_v(v7, v2, &v2));
-
-          res = v7_mk_boolean(v7, b_bool_bin_op(op, v7_get_double(v7, v1),
-                                                v7_get_double(v7, v2)));
-        }
-        PUSH(res);
-        break;
-      }
-      case OP_INSTANCEOF: {
+      BCODE_CASE(OP_INSTANCEOF): {
         v2 = POP();
         v1 = POP();
         if (!v7_is_callable(v7, v2)) {
@@ -14921,7 +17812,7 @@ restart:
         }
         break;
       }
-      case OP_TYPEOF:
+      BCODE_CASE(OP_TYPEOF):
         v1 = POP();
         switch (val_type(v7, v1)) {
           case V7_TYPE_NUMBER:
@@ -14947,7 +17838,7 @@ restart:
         }
         PUSH(res);
         break;
-      case OP_IN: {
+      BCODE_CASE(OP_IN): {
         struct v7_property *prop = NULL;
         v2 = POP();
         v1 = POP();
@@ -14955,36 +17846,130 @@ restart:
         prop = v7_get_property(v7, v2, buf, ~0);
         PUSH(v7_mk_boolean(v7, prop != NULL));
       } break;
-      case OP_GET:
+      BCODE_CASE(OP_GET):
         v2 = POP();
         v1 = POP();
-        BTRY(v7_get_throwing_v(v7, v1, v2, &v3));
+        if (v7_is_object(v1) && v7_is_string(v2)) {
+          struct v7_property *p =
+              bcode_ic_get_property(v7, r.bcode, r.ops, v1, v2);
+          BTRY(v7_property_value(v7, v1, p, &v3));
+        } else {
+          BTRY(v7_get_throwing_v(v7, v1, v2, &v3));
+        }
         PUSH(v3);
 #ifndef V7_DISABLE_CALL_ERROR_CONTEXT
         v7->vals.last_name[1] = v7->vals.last_name[0];
         v7->vals.last_name[0] = v2;
 #endif
         break;
-      case OP_SET: {
+      BCODE_CASE(OP_GET_PROP):
+      BCODE_CASE(OP_GET_VAR_PROP): {
+        char *op_ptr = r.ops;
+        if (op == OP_GET_VAR_PROP) {
+          struct v7_property *p;
+          v4 = bcode_decode_lit(v7, r.bcode, &r.ops);
+          p = bcode_ic_get_property(v7, r.bcode, op_ptr, get_scope(v7), v4);
+          if (p == NULL) {
+            /* variable does not exist: Reference Error */
+            V7_TRY(bcode_throw_reference_error(v7, &r, v4));
+            goto op_done;
+          }
+          BTRY(v7_property_value(v7, get_scope(v7), p, &v1));
+          /* the property name is looked up in the cache by the next byte */
+          op_ptr++;
+        } else {
+          v1 = POP();
+        }
+        v2 = bcode_decode_lit(v7, r.bcode, &r.ops);
+        if (v7_is_object(v1) && v7_is_string(v2)) {
+          struct v7_property *p =
+              bcode_ic_get_property(v7, r.bcode, op_ptr, v1, v2);
+          BTRY(v7_property_value(v7, v1, p, &v3));
+        } else {
+          BTRY(v7_get_throwing_v(v7, v1, v2, &v3));
+        }
+        PUSH(v3);
+#ifndef V7_DISABLE_CALL_ERROR_CONTEXT
+        /* track the names like `OP_GET_VAR`, `OP_PUSH_LIT` and `OP_GET` do */
+        if (op == OP_GET_VAR_PROP) {
+          v7->vals.last_name[0] = v4;
+        }
+        if (!v7_is_string(v2)) {
+          reset_last_name(v7);
+        }
+        v7->vals.last_name[1] = v7->vals.last_name[0];
+        v7->vals.last_name[0] = v2;
+#endif
+        BCODE_SET_CALL_CTX(op);
+        BCODE_NEXT();
+      }
+      BCODE_CASE(OP_ADD_LIT): {
+        v1 = POP();
+        v2 = bcode_decode_lit(v7, r.bcode, &r.ops);
+        BTRY(bcode_add(v7, v1, v2, &res));
+        PUSH(res);
+        BCODE_NEXT();
+      }
+      BCODE_CASE(OP_SET): {
         v3 = POP();
         v2 = POP();
         v1 = POP();
 
+        if (IS_SMI(v2) && GET_SMI(v2) >= 0 && v7_is_object(v1) &&
+            ((get_object_struct(v1)->attributes & V7_OBJ_DENSE_ARRAY) ||
+             v7_is_array(v7, v1))) {
+          /* integer index of an array: set the element directly */
+          BTRY(v7_array_set_throwing(v7, v1, GET_SMI(v2), v3, NULL));
+          PUSH(v3);
+          break;
+        }
+
+#if V7_ENABLE__ArrayBuffer
+        if (IS_SMI(v2) && GET_SMI(v2) >= 0 && v7_is_object(v1) &&
+            (get_object_struct(v1)->attributes & V7_OBJ_BUFFER) &&
+            typed_array_view(v7, v1) != NULL) {
+          /* element of a typed array: store it in the buffer */
+          BTRY(typed_array_set(v7, v1, GET_SMI(v2), v3, NULL));
+          PUSH(v3);
+          break;
+        }
+#endif
+
         /* convert name to string, if it's not already */
         BTRY(to_string(v7, v2, &v2, NULL, 0, NULL));
 
-        /* set value */
-        BTRY(set_property_v(v7, v1, v2, v3, NULL));
+        if (v7_is_object(v1)) {
+          struct v7_object *o = get_object_struct(v1);
+          struct v7_property *p = bcode_ic_find(v7, r.bcode, r.ops, o, v2, 1);
+
+          if (p != NULL &&
+              !(p->attributes & (V7_PROPERTY_NON_WRITABLE | V7_PROPERTY_SETTER |
+                                 V7_PROPERTY_GETTER))) {
+            /* plain own data property: just update its value */
+            p->value = v3;
+            GC_WRITE_BARRIER(v7, v3);
+          } else {
+            BTRY(set_property_v(v7, v1, v2, v3, &p));
+            if (p != NULL && !(p->attributes & (V7_PROPERTY_GETTER |
+                                                V7_PROPERTY_SETTER))) {
+              bcode_ic_fill(v7, r.bcode, r.ops, o, v2, p);
+            }
+          }
+        } else {
+          /* set value */
+          BTRY(set_property_v(v7, v1, v2, v3, NULL));
+        }
 
         PUSH(v3);
         break;
       }
-      case OP_GET_VAR:
-      case OP_SAFE_GET_VAR: {
+      BCODE_CASE(OP_GET_VAR):
+      BCODE_CASE(OP_SAFE_GET_VAR): {
         struct v7_property *p = NULL;
+        char *op_ptr = r.ops;
         assert(r.ops < r.end - 1);
         v1 = bcode_decode_lit(v7, r.bcode, &r.ops);
-        BTRY(v7_get_property_v(v7, get_scope(v7), v1, &p));
+        p = bcode_ic_get_property(v7, r.bcode, op_ptr, get_scope(v7), v1);
         if (p == NULL) {
           if (op == OP_SAFE_GET_VAR) {
             PUSH(V7_UNDEFINED);
@@ -15001,96 +17986,141 @@ restart:
 #ifndef V7_DISABLE_CALL_ERROR_CONTEXT
         v7->vals.last_name[0] = v1;
         v7->vals.last_name[1] = V7_UNDEFINED;
+        if (op == OP_GET_VAR) {
+          BCODE_SET_CALL_CTX(OP_GET_VAR);
+        }
 #endif
-        break;
+        BCODE_NEXT();
       }
-      case OP_SET_VAR: {
-        struct v7_property *prop;
+      BCODE_CASE(OP_GET_LOCAL): {
+        size_t idx = bcode_get_varint(&r.ops);
+        PUSH(FRAME_SLOT(r, idx));
+#ifndef V7_DISABLE_CALL_ERROR_CONTEXT
+        /* the name is resolved by `OP_CHECK_CALL` only when needed */
+        v7->vals.last_name[0] = v7_mk_number(v7, idx);
+        v7->vals.last_name[1] = V7_UNDEFINED;
+#endif
+        BCODE_SET_CALL_CTX(OP_GET_LOCAL);
+        BCODE_NEXT();
+      }
+      BCODE_CASE(OP_SET_LOCAL): {
+        size_t idx = bcode_get_varint(&r.ops);
+        FRAME_SLOT(r, idx) = TOS();
+        BCODE_NEXT();
+      }
+      BCODE_CASE(OP_SET_VAR): {
+        char *op_ptr = r.ops;
         v3 = POP();
         v2 = bcode_decode_lit(v7, r.bcode, &r.ops);
-        v1 = get_scope(v7);
-
-        BTRY(to_string(v7, v2, NULL, buf, sizeof(buf), NULL));
-        prop = v7_get_property(v7, v1, buf, strlen(buf));
-        if (prop != NULL) {
-          /* Property already exists: update its value */
-          /*
-           * TODO(dfrank): currently we can't use `def_property_v()` here,
-           * because if the property was already found somewhere in the
-           * prototype chain, then it should be updated, instead of creating a
-           * new one on the top of the scope.
-           *
-           * Probably we need to make `def_property_v()` more generic and
-           * use it here; or split `def_property_v()` into smaller pieces and
-           * use one of them here.
-           */
-          if (!(prop->attributes & V7_PROPERTY_NON_WRITABLE)) {
-            prop->value = v3;
-          }
-        } else if (!r.bcode->strict_mode) {
-          /*
-           * Property does not exist: since we're not in strict mode, let's
-           * create new property at Global Object
-           */
-          BTRY(set_property_v(v7, v7_get_global(v7), v2, v3, NULL));
+        BTRY(bcode_set_var(v7, r.bcode, op_ptr, v2, v3));
+        PUSH(v3);
+        BCODE_NEXT();
+      }
+      BCODE_CASE(OP_INC_LOCAL): {
+        size_t idx = bcode_get_varint(&r.ops);
+        uint8_t flags = (uint8_t) bcode_get_varint(&r.ops);
+        v1 = FRAME_SLOT(r, idx);
+        if (v7_is_number(v1)) {
+          v2 = bcode_inc_number(v7, v1, flags);
         } else {
-          /*
-           * In strict mode, throw reference error instead of polluting Global
-           * Object
-           */
-          V7_TRY(bcode_throw_reference_error(v7, &r, v2));
+          BTRY(bcode_inc(v7, v1, flags, &v2));
+        }
+        FRAME_SLOT(r, idx) = v2;
+        if (!(flags & INC_FLAG_DROP)) {
+          PUSH((flags & INC_FLAG_POST) ? v1 : v2);
+        }
+        BCODE_NEXT();
+      }
+      BCODE_CASE(OP_INC_VAR): {
+        struct v7_property *p;
+        char *op_ptr = r.ops;
+        uint8_t flags;
+        v3 = bcode_decode_lit(v7, r.bcode, &r.ops);
+        flags = (uint8_t) bcode_get_varint(&r.ops);
+        p = bcode_ic_get_property(v7, r.bcode, op_ptr, get_scope(v7), v3);
+        if (p == NULL) {
+          /* variable does not exist: Reference Error */
+          V7_TRY(bcode_throw_reference_error(v7, &r, v3));
           goto op_done;
         }
-        PUSH(v3);
-        break;
+        BTRY(v7_property_value(v7, get_scope(v7), p, &v1));
+        if (v7_is_number(v1) &&
+            !(p->attributes & (V7_PROPERTY_NON_WRITABLE | V7_PROPERTY_GETTER |
+                               V7_PROPERTY_SETTER))) {
+          /* plain numeric variable: update it in place */
+          v2 = bcode_inc_number(v7, v1, flags);
+          p->value = v2;
+          GC_WRITE_BARRIER(v7, v2);
+        } else {
+          /* the property might be gone by now, so look it up once again */
+          BTRY(bcode_inc(v7, v1, flags, &v2));
+          BTRY(bcode_set_var(v7, r.bcode, op_ptr, v3, v2));
+        }
+        if (!(flags & INC_FLAG_DROP)) {
+          PUSH((flags & INC_FLAG_POST) ? v1 : v2);
+        }
+        BCODE_NEXT();
       }
-      case OP_JMP: {
+      BCODE_CASE(OP_JMP): {
         bcode_off_t target = bcode_get_target(&r.ops);
-        r.ops = r.bcode->ops.p + target - 1;
-        break;
+        BCODE_JUMP(target);
+        BCODE_NEXT();
       }
-      case OP_JMP_FALSE: {
+      BCODE_CASE(OP_JMP_FALSE): {
         bcode_off_t target = bcode_get_target(&r.ops);
         v1 = POP();
         if (!v7_is_truthy(v7, v1)) {
-          r.ops = r.bcode->ops.p + target - 1;
+          BCODE_JUMP(target);
         }
-        break;
+        BCODE_NEXT();
       }
-      case OP_JMP_TRUE: {
+      BCODE_CASE(OP_JMP_TRUE): {
         bcode_off_t target = bcode_get_target(&r.ops);
         v1 = POP();
         if (v7_is_truthy(v7, v1)) {
-          r.ops = r.bcode->ops.p + target - 1;
+          BCODE_JUMP(target);
         }
-        break;
+        BCODE_NEXT();
+      }
+      BCODE_CASE(OP_CMP_JMP_TRUE):
+      BCODE_CASE(OP_CMP_JMP_FALSE): {
+        enum opcode cmp_op = (enum opcode) * ++r.ops;
+        bcode_off_t target = bcode_get_target(&r.ops);
+        int cmp;
+        v2 = POP();
+        v1 = POP();
+        BTRY(bcode_compare(v7, cmp_op, v1, v2, &cmp));
+        if (cmp == (op == OP_CMP_JMP_TRUE)) {
+          BCODE_JUMP(target);
+        }
+        BCODE_NEXT();
       }
-      case OP_JMP_TRUE_DROP: {
+      BCODE_CASE(OP_JMP_TRUE_DROP): {
         bcode_off_t target = bcode_get_target(&r.ops);
         v1 = POP();
         if (v7_is_truthy(v7, v1)) {
-          r.ops = r.bcode->ops.p + target - 1;
           v1 = POP();
           POP();
           PUSH(v1);
+          BCODE_JUMP(target);
         }
         break;
       }
-      case OP_JMP_IF_CONTINUE: {
+      BCODE_CASE(OP_JMP_IF_CONTINUE): {
         bcode_off_t target = bcode_get_target(&r.ops);
         if (v7->is_continuing) {
-          r.ops = r.bcode->ops.p + target - 1;
+          BCODE_JUMP(target);
         }
         v7->is_continuing = 0;
         break;
       }
-      case OP_CREATE_OBJ:
+      BCODE_CASE(OP_CREATE_OBJ):
         PUSH(v7_mk_object(v7));
         break;
-      case OP_CREATE_ARR:
-        PUSH(v7_mk_array(v7));
+      BCODE_CASE(OP_CREATE_ARR):
+        PUSH(v7_mk_dense_array(v7));
         break;
-      case OP_NEXT_PROP: {
+      BCODE_CASE(OP_NEXT_PROP): {
         void *h = NULL;
         v1 = POP(); /* handle */
         v2 = POP(); /* object */
@@ -15104,7 +18134,7 @@ restart:
           do {
             /* iterate properties until we find a non-hidden enumerable one */
             do {
-              h = v7_next_prop(h, v2, &res, NULL, &attrs);
+              h = v7_next_prop2(v7, h, v2, &res, NULL, &attrs);
             } while (h != NULL && (attrs & (_V7_PROPERTY_HIDDEN |
                                             V7_PROPERTY_NON_ENUMERABLE)));
 
@@ -15125,13 +18155,13 @@ restart:
         }
         break;
       }
-      case OP_FUNC_LIT: {
+      BCODE_CASE(OP_FUNC_LIT): {
         v1 = POP();
         v2 = bcode_instantiate_function(v7, v1);
         PUSH(v2);
         break;
       }
-      case OP_CHECK_CALL:
+      BCODE_CASE(OP_CHECK_CALL):
         v1 = TOS();
         if (!v7_is_callable(v7, v1)) {
           int arity = 0;
@@ -15145,27 +18175,37 @@ restart:
            * but defer actual throw when process the incriminated call
            * in order to evaluate the arguments as required by the spec.
            */
-          if (v7->last_ops[0] == OP_GET_VAR) {
-            arity = 1;
-          } else if (v7->last_ops[0] == OP_GET &&
-                     v7->last_ops[1] == OP_PUSH_LIT) {
-            /*
-             * OP_PUSH_LIT is used to both push property names for OP_GET
-             * and for pushing actual literals. During PUSH_LIT push lit
-             * evaluation we reset the last name variable in case the literal
-             * is not a string, such as in `[].foo()`.
-             * Unfortunately it doesn't handle `"foo".bar()`; could be
-             * solved by adding another bytecode for property literals but
-             * probably it doesn't matter much.
-             */
-            if (v7_is_undefined(v7->vals.last_name[1])) {
-              arity = 1;
-            } else {
-              arity = 2;
+          if (call_ctx_end == r.ops) {
+            /* the callee was pushed by the previous instruction */
+            switch (call_ctx_op) {
+              case OP_GET_VAR:
+                arity = 1;
+                break;
+              case OP_GET_LOCAL:
+                v7->vals.last_name[0] = bcode_frame_slot_name(
+                    v7, r.bcode,
+                    (size_t) v7_get_double(v7, v7->vals.last_name[0]));
+                arity = 1;
+                break;
+              default:
+                /*
+                 * `OP_GET_PROP` or `OP_GET_VAR_PROP`. They reset the last
+                 * name in case the property name literal is not a string,
+                 * such as in `[].foo()`. Unfortunately it doesn't handle
+                 * `"foo".bar()`.
+                 */
+                if (v7_is_undefined(v7->vals.last_name[1])) {
+                  arity = 1;
+                } else {
+                  arity = 2;
+                }
+                break;
             }
           }
 #endif
 
+          bcode_save_ops(&r);
+
           switch (arity) {
             case 0:
               ignore = v7_throwf(v7, TYPE_ERROR, "value is not a function");
@@ -15189,25 +18229,46 @@ restart:
           (void) ignore;
         }
         break;
-      case OP_CALL:
-      case OP_NEW: {
-        /* Naive implementation pending stack frame redesign */
+      BCODE_CASE(OP_CALL):
+      BCODE_CASE(OP_NEW): {
         int args = (int) *(++r.ops);
         uint8_t is_constructor = (op == OP_NEW);
+        /* whether `this`, the function and the args are still on the stack */
+        uint8_t args_on_stack = 0;
+
+        bcode_gc_safepoint(v7);
+        BCODE_PROFILER_POINT();
 
         if (SP() < (args + 1 /*func*/ + 1 /*this*/)) {
           BTRY(v7_throwf(v7, INTERNAL_ERROR, "stack underflow"));
           goto op_done;
         } else {
-          v2 = v7_mk_dense_array(v7);
-          while (args > 0) {
-            BTRY(v7_array_set_throwing(v7, v2, --args, POP(), NULL));
-          }
-          /* pop function to call */
-          v1 = POP();
+          /* function to call */
+          v1 = STACK_PEEK(args);
+
+          if (is_js_function(v1)
+                  ? !bcode_needs_args_array(get_js_function_struct(v1)->bcode)
+                  : (is_cfunction_lite(v1) || is_cfunction_obj(v7, v1))) {
+            /*
+             * The function doesn't need the `arguments` array: the args stay
+             * on the stack until they are moved to the frame slots or the
+             * scope object, or, for cfunctions, until the call returns (see
+             * `v7_argv()`).
+             */
+            args_on_stack = 1;
+            v2 = V7_UNDEFINED;
+            v3 = STACK_PEEK(args + 1);
+          } else {
+            v2 = v7_mk_dense_array(v7);
+            while (args > 0) {
+              BTRY(v7_array_set_throwing(v7, v2, --args, POP(), NULL));
+            }
+            /* pop function to call */
+            v1 = POP();
 
-          /* pop `this` */
-          v3 = POP();
+            /* pop `this` */
+            v3 = POP();
+          }
 
           /*
            * adjust `this` if the function is called with the constructor
@@ -15263,7 +18324,12 @@ restart:
             }
 
             BTRY(call_cfunction(v7, v1 /*func*/, v3 /*this*/, v2 /*args*/,
-                                is_constructor, &v4));
+                                args, is_constructor, &v4));
+
+            if (args_on_stack) {
+              /* pop the args, the function and `this` */
+              v7->stack.len -= (args + 2) * sizeof(val_t);
+            }
 
             /* push value returned from C function to bcode stack */
             PUSH(v4);
@@ -15282,6 +18348,23 @@ restart:
               v3 = v7->vals.global_object;
             }
 
+            if (func->bcode->frame_slots) {
+              /*
+               * The function keeps its name, args and locals in the frame
+               * slots, so there's no need in the scope object: skip the names
+               * and transfer control to the function right away.
+               */
+              ops = bcode_end_names(func->bcode->ops.p,
+                                    func->bcode->names_cnt);
+              if (args_on_stack) {
+                bcode_pop_call_args(v7, args);
+              }
+              V7_TRY(bcode_perform_call(v7, V7_UNDEFINED, func, &r,
+                                        v3 /*this*/, ops, is_constructor));
+              bcode_push_frame_slots(v7, func->bcode, v1, v2, args);
+              break;
+            }
+
             scope_frame = v7_mk_object(v7);
 
             /*
@@ -15308,14 +18391,25 @@ restart:
             {
               int arg_num;
               for (arg_num = 0; arg_num < func->bcode->args_cnt; ++arg_num) {
+                val_t arg;
+                if (!args_on_stack) {
+                  arg = v7_array_get(v7, v2, arg_num);
+                } else if (arg_num < args) {
+                  arg = STACK_PEEK(args - 1 - arg_num);
+                } else {
+                  arg = V7_UNDEFINED;
+                }
                 ops = bcode_next_name_v(v7, func->bcode, ops, &v4);
-                BTRY(def_property_v(
-                    v7, scope_frame, v4, V7_DESC_CONFIGURABLE(0),
-                    v7_array_get(v7, v2, arg_num), 0 /*not assign*/, NULL));
+                BTRY(def_property_v(v7, scope_frame, v4,
+                                    V7_DESC_CONFIGURABLE(0), arg,
+                                    0 /*not assign*/, NULL));
               }
             }
 
-            /* populate `arguments` object */
+            /*
+             * populate `arguments` object, unless the function doesn't need
+             * it, see `bcode->no_arguments`
+             */
 
             /*
              * TODO(dfrank): it's actually much more complicated than that:
@@ -15327,8 +18421,10 @@ restart:
              *
              * should yield 2. Currently, it yields 1.
              */
-            v7_def(v7, scope_frame, "arguments", 9, V7_DESC_CONFIGURABLE(0),
-                   v2);
+            if (!args_on_stack) {
+              v7_def(v7, scope_frame, "arguments", 9, V7_DESC_CONFIGURABLE(0),
+                     v2);
+            }
 
             /* populate local variables */
             {
@@ -15343,6 +18439,11 @@ restart:
               }
             }
 
+            if (args_on_stack) {
+              /* pop the args, the function and `this` */
+              v7->stack.len -= (args + 2) * sizeof(val_t);
+            }
+
             /* transfer control to the function */
             V7_TRY(bcode_perform_call(v7, scope_frame, func, &r, v3 /*this*/,
                                       ops, is_constructor));
@@ -15352,12 +18453,14 @@ restart:
         }
         break;
       }
-      case OP_RET:
+      BCODE_CASE(OP_RET):
+        bcode_gc_safepoint(v7);
+        BCODE_PROFILER_POINT();
         bcode_adjust_retval(v7, 1 /*explicit return*/);
         V7_TRY(bcode_perform_return(v7, &r, 1 /*take value from stack*/));
         break;
-      case OP_DELETE:
-      case OP_DELETE_VAR: {
+      BCODE_CASE(OP_DELETE):
+      BCODE_CASE(OP_DELETE_VAR): {
         size_t name_len;
         struct v7_property *prop;
 
@@ -15423,16 +18526,16 @@ restart:
         PUSH(res);
         break;
       }
-      case OP_TRY_PUSH_CATCH:
-      case OP_TRY_PUSH_FINALLY:
-      case OP_TRY_PUSH_LOOP:
-      case OP_TRY_PUSH_SWITCH:
+      BCODE_CASE(OP_TRY_PUSH_CATCH):
+      BCODE_CASE(OP_TRY_PUSH_FINALLY):
+      BCODE_CASE(OP_TRY_PUSH_LOOP):
+      BCODE_CASE(OP_TRY_PUSH_SWITCH):
         eval_try_push(v7, op, &r);
         break;
-      case OP_TRY_POP:
+      BCODE_CASE(OP_TRY_POP):
         V7_TRY(eval_try_pop(v7));
         break;
-      case OP_AFTER_FINALLY:
+      BCODE_CASE(OP_AFTER_FINALLY):
         /*
          * exited from `finally` block: if some value is currently being
          * returned, continue returning it.
@@ -15452,17 +18555,17 @@ restart:
           bcode_perform_break(v7, &r);
         }
         break;
-      case OP_THROW:
+      BCODE_CASE(OP_THROW):
         V7_TRY(bcode_perform_throw(v7, &r, 1 /*take thrown value*/));
         goto op_done;
-      case OP_BREAK:
+      BCODE_CASE(OP_BREAK):
         bcode_perform_break(v7, &r);
         break;
-      case OP_CONTINUE:
+      BCODE_CASE(OP_CONTINUE):
         v7->is_continuing = 1;
         bcode_perform_break(v7, &r);
         break;
-      case OP_ENTER_CATCH: {
+      BCODE_CASE(OP_ENTER_CATCH): {
         /* pop thrown value from stack */
         v1 = POP();
         /* get the name of the thrown value */
@@ -15489,7 +18592,7 @@ restart:
 
         break;
       }
-      case OP_EXIT_CATCH: {
+      BCODE_CASE(OP_EXIT_CATCH): {
         v7_call_frame_mask_t frame_type_mask;
         /* unwind 1 frame */
         frame_type_mask = unwind_stack_1level(v7, &r);
@@ -15501,6 +18604,9 @@ restart:
         break;
       }
       default:
+#ifdef V7_COMPUTED_GOTO
+      lbl_unknown:
+#endif
         BTRY(v7_throwf(v7, INTERNAL_ERROR, "Unknown opcode: %d", (int) op));
         goto op_done;
     }
@@ -15544,6 +18650,7 @@ restart:
 #ifdef V7_BCODE_TRACE
     fprintf(stderr, "return implicitly\n");
 #endif
+    bcode_gc_safepoint(v7);
     bcode_adjust_retval(v7, 0 /*implicit return*/);
     V7_TRY(bcode_perform_return(v7, &r, 1));
     goto restart;
@@ -15641,8 +18748,7 @@ V7_PRIVATE enum v7_err b_exec(struct v7 *v7, const char *src, size_t src_len,
 #endif
   struct {
     unsigned noopt : 1;
-    unsigned line_no_reset : 1;
-  } flags = {0, 0};
+  } flags = {0};
 
   (void) filename;
 
@@ -15681,8 +18787,6 @@ V7_PRIVATE enum v7_err b_exec(struct v7 *v7, const char *src, size_t src_len,
   if (src != NULL) {
     /* Caller provided some source code, so, handle it somehow */
 
-    flags.line_no_reset = 1;
-
     if (src_len >= sizeof(BIN_BCODE_SIGNATURE) &&
         strncmp(BIN_BCODE_SIGNATURE, src, sizeof(BIN_BCODE_SIGNATURE)) == 0) {
       /* we have a serialized bcode */
@@ -15715,6 +18819,13 @@ V7_PRIVATE enum v7_err b_exec(struct v7 *v7, const char *src, size_t src_len,
         }
       } else {
         /* we have regular JavaScript source, so, parse it */
+#ifndef V7_DISABLE_STREAMING_COMPILE
+        if (!is_json) {
+          /* compile functions while parsing, see `compile_parsed_function()` */
+          a->script = bcode;
+          v7->stream_ast = a;
+        }
+#endif
         V7_TRY(parse(v7, a, src, is_json));
       }
 
@@ -15737,6 +18848,11 @@ V7_PRIVATE enum v7_err b_exec(struct v7 *v7, const char *src, size_t src_len,
         ast_off_t pos = 0;
         V7_TRY(compile_expr(v7, a, &pos, bcode));
       }
+
+#ifndef V7_DISABLE_STREAMING_COMPILE
+      /* the compiled functions are reachable from `bcode` now */
+      v7->stream_ast = NULL;
+#endif
     }
 
   } else if (is_js_function(func)) {
@@ -15780,8 +18896,8 @@ V7_PRIVATE enum v7_err b_exec(struct v7 *v7, const char *src, size_t src_len,
   } else if (is_cfunction_lite(func) || is_cfunction_obj(v7, func)) {
     /* call cfunction */
 
-    V7_TRY(
-        call_cfunction(v7, func, this_object, args, 0 /* not a ctor */, &_res));
+    V7_TRY(call_cfunction(v7, func, this_object, args, 0 /* argc */,
+                          0 /* not a ctor */, &_res));
 
     goto clean;
   } else {
@@ -15800,10 +18916,14 @@ V7_PRIVATE enum v7_err b_exec(struct v7 *v7, const char *src, size_t src_len,
   a = NULL;
 
   /* Evaluate bcode */
-  V7_TRY(eval_bcode(v7, bcode, this_object, flags.line_no_reset, &_res));
+  V7_TRY(eval_bcode(v7, bcode, this_object, &_res));
 
 clean:
 
+#ifndef V7_DISABLE_STREAMING_COMPILE
+  v7->stream_ast = NULL;
+#endif
+
   /* free `src` if needed */
   /*
    * TODO(dfrank) : free it above, just after parsing, and make sure you use
@@ -15904,11 +19024,15 @@ V7_PRIVATE enum v7_err b_apply(struct v7 *v7, v7_val_t func, v7_val_t this_obj,
 /* Amalgamated: #include "v7/src/primitive.h" */
 /* Amalgamated: #include "v7/src/array.h" */
 /* Amalgamated: #include "v7/src/slre.h" */
+/* Amalgamated: #include "v7/src/regexp.h" */
 /* Amalgamated: #include "v7/src/bcode.h" */
 /* Amalgamated: #include "v7/src/stdlib.h" */
 /* Amalgamated: #include "v7/src/gc.h" */
 /* Amalgamated: #include "v7/src/heapusage.h" */
 /* Amalgamated: #include "v7/src/eval.h" */
+/* Amalgamated: #include "v7/src/profiler.h" */
+/* Amalgamated: #include "v7/src/stats.h" */
+/* Amalgamated: #include "v7/src/heaplog.h" */
 
 #ifdef V7_THAW
 extern struct v7_vals *fr_vals;
@@ -15952,6 +19076,14 @@ static void generic_object_destructor(struct v7 *v7, void *ptr) {
     }
   }
 
+#if V7_ENABLE__ArrayBuffer
+  if (o->base.attributes & V7_OBJ_BUFFER) {
+    if (p != NULL && v7_get_ptr(v7, p->value) != NULL) {
+      buffer_view_free((struct v7_buffer_view *) v7_get_ptr(v7, p->value));
+    }
+  }
+#endif
+
   if (o->base.attributes & V7_OBJ_HAS_DESTRUCTOR) {
     struct v7_property *p;
     for (p = o->base.properties; p != NULL; p = p->next) {
@@ -15987,13 +19119,21 @@ static void function_destructor(struct v7 *v7, void *ptr) {
 #endif
 }
 
-#if defined(V7_ENABLE_ENTITY_IDS)
+#if defined(V7_ENABLE_ENTITY_IDS) || !defined(V7_DISABLE_STRING_ROPES)
 static void property_destructor(struct v7 *v7, void *ptr) {
   struct v7_property *p = (struct v7_property *) ptr;
   (void) v7;
   if (p == NULL) return;
 
+#ifndef V7_DISABLE_STRING_ROPES
+  if (p->attributes & _V7_PROPERTY_ROPE) {
+    rope_destroy(v7, p);
+  }
+#endif
+
+#if defined(V7_ENABLE_ENTITY_IDS)
   p->entity_id = V7_ENTITY_ID_NONE;
+#endif
 }
 #endif
 
@@ -16003,7 +19143,7 @@ struct v7 *v7_create(void) {
   return v7_create_opt(opts);
 }
 
-struct v7 *v7_create_opt(struct v7_create_opts opts) {
+V7_PRIVATE struct v7 *v7_create_empty(struct v7_create_opts opts) {
   struct v7 *v7 = NULL;
   char z = 0;
 
@@ -16051,7 +19191,7 @@ struct v7 *v7_create_opt(struct v7_create_opts opts) {
     v7->function_arena.destructor = function_destructor;
     gc_arena_init(&v7->property_arena, sizeof(struct v7_property),
                   opts.property_arena_size, 10, "property");
-#if defined(V7_ENABLE_ENTITY_IDS)
+#if defined(V7_ENABLE_ENTITY_IDS) || !defined(V7_DISABLE_STRING_ROPES)
     v7->property_arena.destructor = property_destructor;
 #endif
 
@@ -16066,7 +19206,15 @@ struct v7 *v7_create_opt(struct v7_create_opts opts) {
 
     v7->call_stack = NULL;
     v7->bottom_call_frame = NULL;
+  }
+
+  return v7;
+}
+
+struct v7 *v7_create_opt(struct v7_create_opts opts) {
+  struct v7 *v7 = v7_create_empty(opts);
 
+  if (v7 != NULL) {
 #if defined(V7_THAW) && !defined(V7_FREEZE_NOT_READONLY)
     {
       struct v7_generic_object *obj;
@@ -16101,18 +19249,51 @@ val_t v7_get_global(struct v7 *v7) {
 
 void v7_destroy(struct v7 *v7) {
   if (v7 == NULL) return;
+#ifdef V7_ENABLE_HEAPLOG
+  /* the teardown isn't logged */
+  heaplog_destroy(v7);
+#endif
   gc_arena_destroy(v7, &v7->generic_object_arena);
   gc_arena_destroy(v7, &v7->function_arena);
   gc_arena_destroy(v7, &v7->property_arena);
 
+#ifndef V7_DISABLE_STRING_RUNE_INDEX
+  rune_index_reset(v7);
+#endif
+#ifndef V7_DISABLE_REGEXP_CACHE
+  regexp_cache_reset(v7);
+#endif
+#ifndef V7_DISABLE_STRING_INTERNING
+  free(v7->interned);
+#endif
   mbuf_free(&v7->owned_strings);
   mbuf_free(&v7->owned_values);
   mbuf_free(&v7->foreign_strings);
   mbuf_free(&v7->json_visited_stack);
   mbuf_free(&v7->tmp_stack);
+#ifdef V7_ENABLE_INCREMENTAL_GC
+  mbuf_free(&v7->gc_gray);
+#endif
   mbuf_free(&v7->act_bcodes);
   mbuf_free(&v7->stack);
 
+#ifdef V7_ENABLE_PROFILER
+  profiler_destroy(v7);
+#endif
+#ifdef V7_ENABLE_STATS
+  stats_destroy(v7);
+#endif
+
+  while (v7->free_call_frames != NULL) {
+    struct v7_call_frame_base *tmp = v7->free_call_frames;
+    v7->free_call_frames = tmp->prev;
+    free(tmp);
+  }
+#ifdef V7_ENABLE_SNAPSHOT
+  /* restored bcodes point there; they are all released with the arenas */
+  free(v7->snapshot_ops);
+#endif
+
 #if defined(V7_CYG_PROFILE_ON)
   /* delete this v7 */
   {
@@ -16179,15 +19360,32 @@ V7_PRIVATE uint8_t is_strict_mode(struct v7 *v7) {
 }
 
 v7_val_t v7_get_arguments(struct v7 *v7) {
+  if (v7_is_undefined(v7->vals.arguments) && v7->call_stack != NULL &&
+      (v7->call_stack->type_mask & V7_CALL_FRAME_MASK_CFUNC)) {
+    /* the function was called with the args on the stack: make the array */
+    unsigned long i;
+    v7->vals.arguments = v7_mk_dense_array(v7);
+    for (i = 0; i < v7->cfunc_argc; i++) {
+      v7_array_set(v7, v7->vals.arguments, i, v7_arg(v7, i));
+    }
+  }
   return v7->vals.arguments;
 }
 
+const v7_val_t *v7_argv(struct v7 *v7, unsigned long *argc) {
+  *argc = v7->cfunc_argc;
+  return (const val_t *) (v7->stack.buf + v7->cfunc_args);
+}
+
 v7_val_t v7_arg(struct v7 *v7, unsigned long n) {
-  return v7_array_get(v7, v7->vals.arguments, n);
+  if (n >= v7->cfunc_argc) {
+    return V7_UNDEFINED;
+  }
+  return ((val_t *) (v7->stack.buf + v7->cfunc_args))[n];
 }
 
 unsigned long v7_argc(struct v7 *v7) {
-  return v7_array_length(v7, v7->vals.arguments);
+  return v7->cfunc_argc;
 }
 
 void v7_own(struct v7 *v7, v7_val_t *v) {
@@ -16255,6 +19453,9 @@ NOINSTR static v7_val_t mk_number(double v) {
   /* not every NaN is a JS NaN */
   if (isnan(v)) {
     res = V7_TAG_NAN;
+  } else if (v >= INT32_MIN && v <= INT32_MAX && v == (int32_t) v &&
+             (v != 0 || !signbit(v))) {
+    res = MK_SMI(v);
   } else {
     union {
       double d;
@@ -16271,6 +19472,9 @@ NOINSTR static double get_double(val_t v) {
     double d;
     val_t v;
   } u;
+  if (IS_SMI(v)) {
+    return GET_SMI(v);
+  }
   u.v = v;
   /* Due to NaN packing, any non-numeric value is already a valid NaN value */
   return u.d;
@@ -16300,11 +19504,14 @@ NOINSTR double v7_get_double(struct v7 *v7, v7_val_t v) {
 
 NOINSTR int v7_get_int(struct v7 *v7, v7_val_t v) {
   (void) v7;
+  if (IS_SMI(v)) {
+    return GET_SMI(v);
+  }
   return (int) get_double(v);
 }
 
 int v7_is_number(val_t v) {
-  return v == V7_TAG_NAN || !isnan(get_double(v));
+  return IS_SMI(v) || v == V7_TAG_NAN || !isnan(get_double(v));
 }
 
 V7_PRIVATE int is_finite(struct v7 *v7, val_t v) {
@@ -16598,12 +19805,50 @@ enum v7_err v7_exec_opt(struct v7 *v7, const char *js_code,
                 opts->is_json, 0, 0, res);
 }
 
+/*
+ * Parses JSON with the native JSON parser, following the `v7_exec()`
+ * conventions about the thrown value.
+ */
+static enum v7_err exec_json(struct v7 *v7, const char *src, size_t len,
+                             v7_val_t *res) {
+  enum v7_err rcode = json_parse(v7, src, len, res);
+
+  if (rcode != V7_OK) {
+    *res = v7->vals.thrown_error;
+    if (v7->act_bcodes.len == 0) {
+      v7->vals.thrown_error = V7_UNDEFINED;
+      v7->is_thrown = 0;
+    }
+  }
+
+  return rcode;
+}
+
 enum v7_err v7_parse_json(struct v7 *v7, const char *str, v7_val_t *res) {
-  return b_exec(v7, str, 0, NULL, V7_UNDEFINED, V7_UNDEFINED, V7_UNDEFINED, 1,
-                0, 0, res);
+  return exec_json(v7, str, strlen(str), res);
 }
 
 #ifndef V7_NO_FS
+static int is_bcode(const char *p, size_t len) {
+  return len >= sizeof(BIN_BCODE_SIGNATURE) &&
+         memcmp(p, BIN_BCODE_SIGNATURE, sizeof(BIN_BCODE_SIGNATURE)) == 0;
+}
+
+#ifdef CS_MMAP
+/* Returns true if the file at `path` contains serialized bcode */
+static int is_bcode_file(const char *path) {
+  char sig[sizeof(BIN_BCODE_SIGNATURE)];
+  FILE *fp = fopen(path, "rb");
+  int ret = 0;
+
+  if (fp != NULL) {
+    ret = is_bcode(sig, fread(sig, 1, sizeof(sig), fp));
+    fclose(fp);
+  }
+  return ret;
+}
+#endif
+
 static enum v7_err exec_file(struct v7 *v7, const char *path, val_t *res,
                              int is_json) {
   enum v7_err rcode = V7_OK;
@@ -16623,6 +19868,15 @@ static enum v7_err exec_file(struct v7 *v7, const char *path, val_t *res,
     rd = cs_read_file;
   }
 #endif
+#endif
+#ifdef CS_MMAP
+  /*
+   * Serialized bcode is executed in place: ops and strings point right into
+   * the file data, so map the file instead of copying it to the heap.
+   */
+  if (rd != cs_mmap_file && !is_json && is_bcode_file(path)) {
+    rd = cs_mmap_file;
+  }
 #endif
 
   if ((p = rd(path, &file_size)) == NULL) {
@@ -16637,13 +19891,24 @@ static enum v7_err exec_file(struct v7 *v7, const char *path, val_t *res,
     if (res != NULL) *res = v7_get_thrown_value(v7, NULL);
     goto clean;
   } else {
-#ifndef V7_MMAP_EXEC
-    int fr = 1;
-#else
-    int fr = 0;
-#endif
-    rcode = b_exec(v7, p, file_size, path, V7_UNDEFINED, V7_UNDEFINED,
-                   V7_UNDEFINED, is_json, fr, 0, res);
+    int fr = (rd == cs_read_file);
+    if (fr && !is_json && is_bcode(p, file_size)) {
+      /*
+       * Deserialized bcode points into the file data, so it has to stay
+       * around just like a mapped file does: we don't know when the last
+       * function defined in it becomes garbage.
+       */
+      fr = 0;
+    }
+    if (is_json) {
+      rcode = exec_json(v7, p, file_size, res);
+      if (fr) {
+        free(p);
+      }
+    } else {
+      rcode = b_exec(v7, p, file_size, path, V7_UNDEFINED, V7_UNDEFINED,
+                     V7_UNDEFINED, is_json, fr, 0, res);
+    }
     if (rcode != V7_OK) {
       goto clean;
     }
@@ -16827,6 +20092,8 @@ V7_PRIVATE enum v7_type val_type(struct v7 *v7, val_t v) {
     case V7_TAG_STRING_F >> 48:
     case V7_TAG_STRING_D >> 48:
     case V7_TAG_STRING_5 >> 48:
+    case V7_TAG_STRING_R >> 48:
+    case V7_TAG_STRING_M >> 48:
       return V7_TYPE_STRING;
     case V7_TAG_BOOLEAN >> 48:
       return V7_TYPE_BOOLEAN;
@@ -16841,15 +20108,6 @@ V7_PRIVATE enum v7_type val_type(struct v7 *v7, val_t v) {
       return V7_TYPE_UNDEFINED;
   }
 }
-
-#ifndef V7_DISABLE_LINE_NUMBERS
-V7_PRIVATE uint8_t msb_lsb_swap(uint8_t b) {
-  if ((b & 0x01) != (b >> 7)) {
-    b ^= 0x81;
-  }
-  return b;
-}
-#endif
 #ifdef V7_MODULE_LINES
 #line 1 "./src/string.c"
 #endif
@@ -16868,6 +20126,7 @@ V7_PRIVATE uint8_t msb_lsb_swap(uint8_t b) {
 /* Amalgamated: #include "v7/src/primitive.h" */
 /* Amalgamated: #include "v7/src/slre.h" */
 /* Amalgamated: #include "v7/src/heapusage.h" */
+/* Amalgamated: #include "v7/src/heaplog.h" */
 
 /* TODO(lsm): NaN payload location depends on endianness, make crossplatform */
 #define GET_VAL_NAN_PAYLOAD(v) ((char *) &(v))
@@ -17086,6 +20345,178 @@ static int v_find_string_in_dictionary(const char *s, size_t len) {
   return -1;
 }
 
+#if CS_ENABLE_UTF8
+
+static int is_ascii(const char *p, size_t n) {
+  const uchar *s = (const uchar *) p, *end = s + n;
+  for (; s < end; s++) {
+    if (*s >= Runeself) return 0;
+  }
+  return 1;
+}
+
+/*
+ * Returns true if the string is known to be ASCII-only. Owned strings remember
+ * the answer in their header, so they are scanned at most once; ropes and
+ * foreign strings aren't scanned at all.
+ */
+static int s_is_ascii(struct v7 *v7, val_t v, const char *p, size_t n) {
+  uint64_t tag = v & V7_TAG_MASK;
+
+  if (tag == V7_TAG_STRING_O) {
+    uint8_t *h = (uint8_t *) v7->owned_strings.buf +
+                 (size_t) gc_string_val_to_offset(v);
+    int llen;
+    size_t hdr = decode_varint(h, &llen);
+
+    if (!(hdr & _V7_OSTR_CHECKED)) {
+      hdr |= _V7_OSTR_CHECKED | (is_ascii(p, n) ? _V7_OSTR_ASCII : 0);
+      /* flags don't change the varint size, so it can be rewritten in place */
+      encode_varint(hdr, h);
+    }
+    return (hdr & _V7_OSTR_ASCII) != 0;
+  } else if (tag == V7_TAG_STRING_I || tag == V7_TAG_STRING_5 ||
+             tag == V7_TAG_STRING_D) {
+    return is_ascii(p, n);
+  }
+  return 0;
+}
+
+#ifndef V7_DISABLE_STRING_RUNE_INDEX
+
+V7_PRIVATE void rune_index_reset(struct v7 *v7) {
+  int i;
+  for (i = 0; i < V7_RUNE_INDEX_CACHE_SIZE; i++) {
+    free(v7->rune_index[i].offsets);
+    v7->rune_index[i].offsets = NULL;
+    v7->rune_index[i].s = 0;
+  }
+}
+
+/*
+ * Returns the rune index of the string `v`, building it if needed, or NULL if
+ * the string isn't worth indexing. Only owned strings and ropes are indexed:
+ * the contents of foreign strings can change behind our back. An index with
+ * NULL `offsets` means the string is ASCII-only.
+ */
+static struct v7_rune_index *rune_index_get(struct v7 *v7, val_t v,
+                                            const char *p, size_t n) {
+  uint64_t tag = v & V7_TAG_MASK;
+  struct v7_rune_index *ri;
+  size_t runes, i, *offsets = NULL;
+  const char *s = p;
+  Rune r;
+  int k;
+
+  if ((tag != V7_TAG_STRING_O && tag != V7_TAG_STRING_R) ||
+      n < 2 * V7_RUNE_INDEX_STEP) {
+    return NULL;
+  }
+
+  for (k = 0; k < V7_RUNE_INDEX_CACHE_SIZE; k++) {
+    if (v7->rune_index[k].s == v) {
+      return &v7->rune_index[k];
+    }
+  }
+
+  runes = utfnlen(p, n);
+  if (runes != n) {
+    offsets = (size_t *) malloc(sizeof(*offsets) *
+                                (runes / V7_RUNE_INDEX_STEP + 1));
+    if (offsets == NULL) return NULL;
+
+    for (i = 0; i < runes; i++) {
+      if (i % V7_RUNE_INDEX_STEP == 0) {
+        offsets[i / V7_RUNE_INDEX_STEP] = s - p;
+      }
+      s += (*(uchar *) s < Runeself) ? 1 : chartorune(&r, s);
+    }
+    if (runes % V7_RUNE_INDEX_STEP == 0) {
+      offsets[runes / V7_RUNE_INDEX_STEP] = s - p;
+    }
+  }
+
+  ri = &v7->rune_index[v7->rune_index_next];
+  v7->rune_index_next = (v7->rune_index_next + 1) % V7_RUNE_INDEX_CACHE_SIZE;
+  free(ri->offsets);
+  ri->s = v;
+  ri->runes = runes;
+  ri->offsets = offsets;
+  return ri;
+}
+
+#ifndef V7_DISABLE_STRING_ROPES
+/* Forgets the rune index of the string `v`, which is being collected */
+static void rune_index_drop(struct v7 *v7, val_t v) {
+  int i;
+  for (i = 0; i < V7_RUNE_INDEX_CACHE_SIZE; i++) {
+    if (v7->rune_index[i].s == v) {
+      free(v7->rune_index[i].offsets);
+      v7->rune_index[i].offsets = NULL;
+      v7->rune_index[i].s = 0;
+    }
+  }
+}
+#endif
+
+#endif /* V7_DISABLE_STRING_RUNE_INDEX */
+
+V7_PRIVATE size_t s_utfnlen(struct v7 *v7, val_t v, const char *p, size_t n) {
+#ifndef V7_DISABLE_STRING_RUNE_INDEX
+  struct v7_rune_index *ri;
+#endif
+
+  if (s_is_ascii(v7, v, p, n)) {
+    return n;
+  }
+#ifndef V7_DISABLE_STRING_RUNE_INDEX
+  if ((ri = rune_index_get(v7, v, p, n)) != NULL) {
+    return ri->runes;
+  }
+#endif
+  return utfnlen(p, n);
+}
+
+V7_PRIVATE const char *s_utfnshift(struct v7 *v7, val_t v, const char *p,
+                                   size_t n, size_t idx) {
+#ifndef V7_DISABLE_STRING_RUNE_INDEX
+  struct v7_rune_index *ri;
+#endif
+
+  if (s_is_ascii(v7, v, p, n)) {
+    return p + idx;
+  }
+#ifndef V7_DISABLE_STRING_RUNE_INDEX
+  if ((ri = rune_index_get(v7, v, p, n)) != NULL) {
+    if (ri->offsets == NULL) {
+      return p + idx;
+    }
+    assert(idx <= ri->runes);
+    return utfnshift(p + ri->offsets[idx / V7_RUNE_INDEX_STEP],
+                     idx % V7_RUNE_INDEX_STEP);
+  }
+#endif
+  return utfnshift(p, idx);
+}
+
+#else /* CS_ENABLE_UTF8 */
+
+V7_PRIVATE size_t s_utfnlen(struct v7 *v7, val_t v, const char *p, size_t n) {
+  (void) v7;
+  (void) v;
+  return utfnlen(p, n);
+}
+
+V7_PRIVATE const char *s_utfnshift(struct v7 *v7, val_t v, const char *p,
+                                   size_t n, size_t idx) {
+  (void) v7;
+  (void) v;
+  (void) n;
+  return utfnshift(p, idx);
+}
+
+#endif /* CS_ENABLE_UTF8 */
+
 WARN_UNUSED_RESULT
 V7_PRIVATE enum v7_err v7_char_code_at(struct v7 *v7, val_t obj, val_t arg,
                                        double *res) {
@@ -17104,10 +20535,9 @@ V7_PRIVATE enum v7_err v7_char_code_at(struct v7 *v7, val_t obj, val_t arg,
 
   p = v7_get_string(v7, &s, &n);
 
-  n = utfnlen(p, n);
-  if (v7_is_number(arg) && at >= 0 && at < n) {
+  if (v7_is_number(arg) && at >= 0 && at < s_utfnlen(v7, s, p, n)) {
     Rune r = 0;
-    p = utfnshift(p, at);
+    p = s_utfnshift(v7, s, p, n, (size_t) at);
     chartorune(&r, (char *) p);
     *res = r;
     goto clean;
@@ -17139,11 +20569,138 @@ V7_PRIVATE int s_cmp(struct v7 *v7, val_t a, val_t b) {
   }
 }
 
+#ifndef V7_DISABLE_STRING_ROPES
+
+/*
+ * Ropes.
+ *
+ * A rope is a string made of two strings, stored in a property cell marked
+ * with `_V7_PROPERTY_ROPE`: `name` is the left string and `value` the right
+ * one. Only the left string can be another unread rope, so the ropes built by
+ * appending in a loop are lists, which can be walked without recursion.
+ *
+ * The first time a rope is read it's flattened: the string data is copied into
+ * a malloc-ed buffer, which is then owned by the cell (`value` points to it,
+ * and `name` holds the length), and the rest of the rope can be collected.
+ * The buffer isn't in the owned strings mbuf, so flattening a rope doesn't
+ * invalidate pointers to other strings, nor does it move.
+ */
+
+static int is_rope(val_t v) {
+  return (v & V7_TAG_MASK) == V7_TAG_STRING_R;
+}
+
+static struct v7_property *rope_node(val_t v) {
+  return (struct v7_property *) get_ptr(v);
+}
+
+/* Returns true if the rope wasn't read yet, and so it's still a list */
+static int rope_is_open(val_t v) {
+  return is_rope(v) && v7_is_string(rope_node(v)->name);
+}
+
+static val_t mk_rope(struct v7 *v7, val_t left, val_t right) {
+  struct gc_tmp_frame tf = new_tmp_frame(v7);
+  struct v7_property *r;
+
+  tmp_stack_push(&tf, &left);
+  tmp_stack_push(&tf, &right);
+
+  r = v7_mk_property(v7);
+  r->attributes = _V7_PROPERTY_ROPE;
+  r->name = left;
+  r->value = right;
+
+  tmp_frame_cleanup(&tf);
+  return pointer_to_value(r) | V7_TAG_STRING_R;
+}
+
+/* Flattens the rope if it's not already, and returns its node */
+static struct v7_property *rope_flatten(struct v7 *v7, val_t v) {
+  struct v7_property *r = rope_node(v), *n;
+  size_t len = 0, piece_len;
+  const char *piece;
+  char *buf, *end;
+  val_t s;
+
+  if (!rope_is_open(v)) {
+    return r;
+  }
+
+  for (s = v; rope_is_open(s); s = n->name) {
+    n = rope_node(s);
+    v7_get_string(v7, &n->value, &piece_len);
+    len += piece_len;
+  }
+  v7_get_string(v7, &s, &piece_len);
+  len += piece_len;
+
+  heapusage_dont_count(1);
+  buf = (char *) malloc(len + 1);
+  heapusage_dont_count(0);
+  if (buf == NULL) abort();
+
+  /* fill the buffer from the end, walking the list from the rightmost piece */
+  end = buf + len;
+  *end = '\0';
+  for (s = v; rope_is_open(s); s = n->name) {
+    n = rope_node(s);
+    piece = v7_get_string(v7, &n->value, &piece_len);
+    end -= piece_len;
+    memcpy(end, piece, piece_len);
+  }
+  piece = v7_get_string(v7, &s, &piece_len);
+  memcpy(buf, piece, piece_len);
+
+  r->name = v7_mk_number(v7, len);
+  r->value = v7_mk_foreign(v7, buf);
+  return r;
+}
+
+V7_PRIVATE void rope_destroy(struct v7 *v7, struct v7_property *r) {
+  if (v7_is_foreign(r->value)) {
+    free(get_ptr(r->value));
+  }
+#ifndef V7_DISABLE_STRING_RUNE_INDEX
+  rune_index_drop(v7, pointer_to_value(r) | V7_TAG_STRING_R);
+#else
+  (void) v7;
+#endif
+}
+
+#endif /* V7_DISABLE_STRING_ROPES */
+
 V7_PRIVATE val_t s_concat(struct v7 *v7, val_t a, val_t b) {
   size_t a_len, b_len, res_len;
   const char *a_ptr, *b_ptr, *res_ptr;
   val_t res;
 
+#ifndef V7_DISABLE_STRING_ROPES
+  /*
+   * Appending to a rope which wasn't read yet just links the new piece. The
+   * right side is read first, so that it's never an open rope.
+   */
+  v7_get_string(v7, &b, &b_len);
+  if (rope_is_open(a)) {
+    struct v7_property *r = rope_node(a);
+    size_t r_len;
+
+    /* short appends are merged into the last piece, to keep pieces long */
+    v7_get_string(v7, &r->value, &r_len);
+    if (r_len + b_len < V7_STRING_ROPE_MIN_LEN) {
+      return mk_rope(v7, r->name, s_concat(v7, r->value, b));
+    }
+    return mk_rope(v7, a, b);
+  }
+  v7_get_string(v7, &a, &a_len);
+  if (a_len + b_len >= V7_STRING_ROPE_MIN_LEN) {
+    if (a_len == 0 || b_len == 0) {
+      return a_len == 0 ? b : a;
+    }
+    return mk_rope(v7, a, b);
+  }
+#endif
+
   /* Find out lengths of both srtings */
   a_ptr = v7_get_string(v7, &a, &a_len);
   b_ptr = v7_get_string(v7, &b, &b_len);
@@ -17170,6 +20727,25 @@ V7_PRIVATE unsigned long cstr_to_ulong(const char *s, size_t len, int *ok) {
   return res;
 }
 
+V7_PRIVATE int cstr_to_array_index(const char *s, size_t len,
+                                   unsigned long *res) {
+  uint64_t n = 0;
+  size_t i;
+
+  if (len == 0 || len > 10 || (s[0] == '0' && len > 1)) {
+    return 0;
+  }
+  for (i = 0; i < len; i++) {
+    if (s[i] < '0' || s[i] > '9') return 0;
+    n = n * 10 + (s[i] - '0');
+  }
+  if (n >= 0xffffffffUL) {
+    return 0;
+  }
+  *res = (unsigned long) n;
+  return 1;
+}
+
 WARN_UNUSED_RESULT
 V7_PRIVATE enum v7_err str_to_ulong(struct v7 *v7, val_t v, int *ok,
                                     unsigned long *res) {
@@ -17191,9 +20767,10 @@ V7_PRIVATE void embed_string(struct mbuf *m, size_t offset, const char *p,
   char *old_base = m->buf;
   uint8_t p_backed_by_mbuf = p >= old_base && p < old_base + m->len;
   size_t n = (flags & EMBSTR_UNESCAPE) ? unescape(p, len, NULL) : len;
+  size_t hdr = (flags & EMBSTR_OWNED) ? n << _V7_OSTR_FLAGS_BITS : n;
 
   /* Calculate how many bytes length takes */
-  int k = calc_llen(n);
+  int k = calc_llen(hdr);
 
   /* total length: varing length + string len + zero-term */
   size_t tot_len = k + n + !!(flags & EMBSTR_ZERO_TERM);
@@ -17209,7 +20786,7 @@ V7_PRIVATE void embed_string(struct mbuf *m, size_t offset, const char *p,
   }
 
   /* Write length */
-  encode_varint(n, (unsigned char *) m->buf + offset);
+  encode_varint(hdr, (unsigned char *) m->buf + offset);
 
   /* Write string */
   if (p != 0) {
@@ -17226,6 +20803,23 @@ V7_PRIVATE void embed_string(struct mbuf *m, size_t offset, const char *p,
   }
 }
 
+#ifdef V7_GC_STRESS
+/*
+ * Moves the owned strings buffer to a new location, as if it was resized, so
+ * that pointers into it, held across a string allocation, can be caught.
+ */
+static void owned_strings_move(struct mbuf *m) {
+  char *buf;
+  heapusage_dont_count(1);
+  buf = (char *) malloc(m->size);
+  heapusage_dont_count(0);
+  if (buf == NULL) abort();
+  memcpy(buf, m->buf, m->len);
+  free(m->buf);
+  m->buf = buf;
+}
+#endif
+
 /* Create a string */
 v7_val_t v7_mk_string(struct v7 *v7, const char *p, size_t len, int copy) {
   struct mbuf *m = copy ? &v7->owned_strings : &v7->foreign_strings;
@@ -17258,6 +20852,10 @@ v7_val_t v7_mk_string(struct v7 *v7, const char *p, size_t len, int copy) {
     GET_VAL_NAN_PAYLOAD(offset)[0] = dict_index;
     tag = V7_TAG_STRING_D;
   } else if (copy) {
+    /* `p` might point to another owned string, see below */
+    const char *old_base = m->buf;
+    uint8_t p_backed_by_mbuf = p >= old_base && p < old_base + m->len;
+
     compute_need_gc(v7);
 
     /*
@@ -17270,8 +20868,24 @@ v7_val_t v7_mk_string(struct v7 *v7, const char *p, size_t len, int copy) {
       mbuf_resize(m, m->len + len + _V7_STRING_BUF_RESERVE);
       heapusage_dont_count(0);
     }
-    embed_string(m, m->len, p, len, EMBSTR_ZERO_TERM);
+#ifdef V7_GC_STRESS
+    else {
+      owned_strings_move(m);
+    }
+#endif
+
+    /* Fixup p if it was relocated by the reallocation above */
+    if (p_backed_by_mbuf) {
+      p = m->buf + (p - old_base);
+    }
+
+    embed_string(m, m->len, p, len, EMBSTR_ZERO_TERM | EMBSTR_OWNED);
     tag = V7_TAG_STRING_O;
+#ifdef V7_ENABLE_HEAPLOG
+    if (v7->heaplog != NULL) {
+      heaplog_alloc_str(v7, (size_t) offset, m->len - (size_t) offset);
+    }
+#endif
 #ifndef V7_DISABLE_STR_ALLOC_SEQ
     /* TODO(imax): panic if offset >= 2^32. */
     offset |= ((val_t) gc_next_allocation_seqn(v7, p, len)) << 32;
@@ -17301,10 +20915,261 @@ v7_val_t v7_mk_string(struct v7 *v7, const char *p, size_t len, int copy) {
   return (offset & ~V7_TAG_MASK) | tag;
 }
 
+V7_PRIVATE val_t mk_mapped_string(struct v7 *v7, const char *hdr) {
+  int llen;
+  size_t len = decode_varint((const unsigned char *) hdr, &llen);
+
+  /* short and dictionary strings don't need the data at all */
+  if (len <= 5 || v_find_string_in_dictionary(hdr + llen, len) >= 0) {
+    return v7_mk_string(v7, hdr + llen, len, 0);
+  }
+  return pointer_to_value((void *) hdr) | V7_TAG_STRING_M;
+}
+
+#ifndef V7_DISABLE_STRING_INTERNING
+
+static uint32_t intern_hash(const char *p, size_t len) {
+  uint32_t h = 2166136261U; /* FNV-1a */
+  while (len-- > 0) {
+    h = (h ^ (uint8_t) *p++) * 16777619U;
+  }
+  return h;
+}
+
+static uint8_t *ostr_hdr(struct v7 *v7, val_t v) {
+  return (uint8_t *) v7->owned_strings.buf + gc_string_val_to_offset(v);
+}
+
+/*
+ * Returns the slot which holds the string with the given contents, or the
+ * free slot where it should go.
+ */
+static struct v7_interned *intern_slot(struct v7 *v7, const char *p,
+                                       size_t len, uint32_t hash) {
+  size_t mask = v7->interned_size - 1, i;
+  for (i = hash & mask;; i = (i + 1) & mask) {
+    struct v7_interned *e = &v7->interned[i];
+    if (e->s == 0) {
+      return e;
+    } else if (e->hash == hash) {
+      size_t n;
+      const char *s = v7_get_string(v7, &e->s, &n);
+      if (n == len && memcmp(s, p, len) == 0) {
+        return e;
+      }
+    }
+  }
+}
+
+/*
+ * Makes sure there is room for one more string, growing the table when it's
+ * 3/4 full. Returns 0 if there's no room at all.
+ */
+static int intern_reserve(struct v7 *v7) {
+  struct v7_interned *tab;
+  size_t size = v7->interned_size, i, j;
+
+  if ((v7->interned_cnt + 1) * 4 <= size * 3) {
+    return 1;
+  }
+
+  size = size == 0 ? V7_INTERNED_MIN_SIZE : size * 2;
+  tab = (struct v7_interned *) calloc(size, sizeof(*tab));
+  if (tab == NULL) {
+    /* keep going with a crowded table, as long as a slot is free */
+    return v7->interned_cnt + 1 < v7->interned_size;
+  }
+
+  for (i = 0; i < v7->interned_size; i++) {
+    struct v7_interned *e = &v7->interned[i];
+    if (e->s == 0) continue;
+    for (j = e->hash & (size - 1); tab[j].s != 0; j = (j + 1) & (size - 1)) {
+    }
+    tab[j] = *e;
+  }
+
+  free(v7->interned);
+  v7->interned = tab;
+  v7->interned_size = size;
+  return 1;
+}
+
+/*
+ * Looks up the string with the given contents, and adds `v` (which might
+ * be `V7_UNDEFINED`, in which case the string is made) if there is none.
+ * Dictionary strings are looked up in the dictionary, and are added to the
+ * table just to be found faster.
+ */
+static val_t intern(struct v7 *v7, const char *p, size_t len, val_t v,
+                    int add) {
+  struct v7_interned *e = NULL;
+  uint32_t hash = intern_hash(p, len);
+  int dict_index;
+
+  if (v7->interned != NULL) {
+    e = intern_slot(v7, p, len, hash);
+    if (e->s != 0) {
+      return e->s;
+    }
+  }
+
+  dict_index = v_find_string_in_dictionary(p, len);
+  if (dict_index < 0 && !add) {
+    return V7_UNDEFINED;
+  } else if (dict_index >= 0 || v == V7_UNDEFINED) {
+    /* makes a dictionary string if it is one */
+    v = v7_mk_string(v7, p, len, 1);
+    /* `p` might have been moved along with the owned strings */
+    p = v7_get_string(v7, &v, &len);
+  }
+
+  if (!intern_reserve(v7)) {
+    /* the table is full and can't grow */
+    if ((v & V7_TAG_MASK) == V7_TAG_STRING_D) {
+      return v;
+    }
+    abort();
+  }
+
+  e = intern_slot(v7, p, len, hash);
+  e->s = v;
+  e->hash = hash;
+  v7->interned_cnt++;
+  if ((v & V7_TAG_MASK) == V7_TAG_STRING_O) {
+    *ostr_hdr(v7, v) |= _V7_OSTR_INTERNED;
+  }
+  return v;
+}
+
+V7_PRIVATE val_t intern_string(struct v7 *v7, const char *p, size_t len) {
+  if (len <= 5) {
+    return v7_mk_string(v7, p, len, 1);
+  }
+  return intern(v7, p, len, V7_UNDEFINED, 1);
+}
+
+V7_PRIVATE val_t intern_string_v(struct v7 *v7, val_t v) {
+  const char *p;
+  size_t len;
+
+  if ((v & V7_TAG_MASK) != V7_TAG_STRING_O ||
+      (*ostr_hdr(v7, v) & _V7_OSTR_INTERNED)) {
+    return v;
+  }
+
+  p = v7_get_string(v7, &v, &len);
+  return intern(v7, p, len, v, 1);
+}
+
+V7_PRIVATE val_t find_interned(struct v7 *v7, const char *p, size_t len) {
+  if (len <= 5) {
+    return v7_mk_string(v7, p, len, 1);
+  }
+  return intern(v7, p, len, V7_UNDEFINED, 0);
+}
+
+V7_PRIVATE int is_interned_name(val_t v) {
+  uint64_t tag = v & V7_TAG_MASK;
+  return tag == V7_TAG_STRING_I || tag == V7_TAG_STRING_5 ||
+         tag == V7_TAG_STRING_D || tag == V7_TAG_STRING_O;
+}
+
+V7_PRIVATE void gc_sweep_interned(struct v7 *v7) {
+  size_t mask = v7->interned_size - 1, i, j, k, hole;
+  struct v7_interned *tab = v7->interned;
+
+  if (tab == NULL) {
+    return;
+  }
+#ifdef V7_FREEZE
+  if (v7->freeze_file != NULL) {
+    /* strings are not marked while freezing */
+    return;
+  }
+#endif
+
+  for (i = 0; i <= mask;) {
+    val_t v = tab[i].s;
+    if ((v & V7_TAG_MASK) != V7_TAG_STRING_O || ostr_hdr(v7, v)[-1] == 1) {
+      /* not an owned string, or it's marked */
+      i++;
+      continue;
+    }
+
+    /*
+     * Unreachable: remove it, shifting back the following strings of the
+     * cluster which can be moved closer to their home slots. The slot `i`
+     * is checked again, since it might get a new string.
+     */
+    v7->interned_cnt--;
+    for (hole = j = i;;) {
+      tab[hole].s = 0;
+      do {
+        j = (j + 1) & mask;
+        if (tab[j].s == 0) break;
+        k = tab[j].hash & mask;
+        /* the string at `j` stays if its home is cyclically in (hole, j] */
+      } while (hole <= j ? (hole < k && k <= j) : (hole < k || k <= j));
+      if (tab[j].s == 0) break;
+      tab[hole] = tab[j];
+      hole = j;
+    }
+  }
+
+  /* strings which remain in the table will be updated when relocated */
+  for (i = 0; i <= mask; i++) {
+    gc_mark_string(v7, &tab[i].s);
+  }
+}
+
+#ifdef V7_ENABLE_SNAPSHOT
+V7_PRIVATE void interned_reset(struct v7 *v7) {
+  char *p = v7->owned_strings.buf + 1;
+  int llen;
+
+  free(v7->interned);
+  v7->interned = NULL;
+  v7->interned_size = v7->interned_cnt = 0;
+
+  while (p < v7->owned_strings.buf + v7->owned_strings.len) {
+    size_t len = decode_varint((uint8_t *) p, &llen) >> _V7_OSTR_FLAGS_BITS;
+    *p &= ~_V7_OSTR_INTERNED;
+    p += llen + len + 1;
+  }
+}
+#endif
+
+#else
+
+V7_PRIVATE val_t intern_string(struct v7 *v7, const char *p, size_t len) {
+  return v7_mk_string(v7, p, len, 1);
+}
+
+V7_PRIVATE val_t intern_string_v(struct v7 *v7, val_t v) {
+  (void) v7;
+  return v;
+}
+
+V7_PRIVATE val_t find_interned(struct v7 *v7, const char *p, size_t len) {
+  if (len <= 5 || v_find_string_in_dictionary(p, len) >= 0) {
+    return v7_mk_string(v7, p, len, 1);
+  }
+  return V7_UNDEFINED;
+}
+
+V7_PRIVATE int is_interned_name(val_t v) {
+  uint64_t tag = v & V7_TAG_MASK;
+  return tag == V7_TAG_STRING_I || tag == V7_TAG_STRING_5 ||
+         tag == V7_TAG_STRING_D;
+}
+
+#endif /* V7_DISABLE_STRING_INTERNING */
+
 int v7_is_string(val_t v) {
   uint64_t t = v & V7_TAG_MASK;
   return t == V7_TAG_STRING_I || t == V7_TAG_STRING_F || t == V7_TAG_STRING_O ||
-         t == V7_TAG_STRING_5 || t == V7_TAG_STRING_D;
+         t == V7_TAG_STRING_5 || t == V7_TAG_STRING_D || t == V7_TAG_STRING_R ||
+         t == V7_TAG_STRING_M;
 }
 
 /* Get a pointer to string and string length. */
@@ -17336,7 +21201,7 @@ const char *v7_get_string(struct v7 *v7, val_t *v, size_t *sizep) {
     gc_check_valid_allocation_seqn(v7, (*v >> 32) & 0xFFFF);
 #endif
 
-    size = decode_varint((uint8_t *) s, &llen);
+    size = decode_varint((uint8_t *) s, &llen) >> _V7_OSTR_FLAGS_BITS;
     p = s + llen;
   } else if (tag == V7_TAG_STRING_F) {
     /*
@@ -17365,6 +21230,17 @@ const char *v7_get_string(struct v7 *v7, val_t *v, size_t *sizep) {
       size = decode_varint((uint8_t *) s, &llen);
       memcpy(&p, s + llen, sizeof(p));
     }
+  } else if (tag == V7_TAG_STRING_M) {
+    const char *s = (const char *) get_ptr(*v);
+
+    size = decode_varint((const uint8_t *) s, &llen);
+    p = s + llen;
+#ifndef V7_DISABLE_STRING_ROPES
+  } else if (tag == V7_TAG_STRING_R) {
+    struct v7_property *r = rope_flatten(v7, *v);
+    size = (size_t) v7_get_double(v7, r->name);
+    p = (const char *) get_ptr(r->value);
+#endif
   } else {
     assert(0);
   }
@@ -17428,21 +21304,20 @@ int v7_is_array(struct v7 *v7, val_t v) {
 }
 
 /*
- * Dense arrays are backed by mbuf. Currently the array can only grow by
- * appending (i.e. setting an element whose index == array.length)
+ * Dense arrays keep their elements in an mbuf referenced by a hidden property;
+ * missing elements (holes) are stored as `V7_TAG_NOVALUE`. Other properties
+ * of a dense array are ordinary properties.
  *
- * TODO(mkm): automatically promote dense arrays to normal objects
- *            when they are used as sparse arrays or to store arbitrary keys
- *            (perhaps a hybrid approach)
- * TODO(mkm): small sparsness doesn't have to promote the array,
- *            we can just fill empty slots with a tag. In JS missing array
- *            indices are subtly different from indices with an undefined value
- *            (key iteration).
- * TODO(mkm): change the interpreter so it can set elements in dense arrays
+ * A dense array is turned into an ordinary one when it can't be represented
+ * this way anymore: when an element gets attributes or accessors, or when a
+ * write would leave it mostly made of holes. Conversely, an ordinary array
+ * becomes dense again once it fills in, see `array_maybe_densify()`.
+ *
+ * Define `V7_DISABLE_DENSE_ARRAYS` to keep all arrays ordinary objects.
  */
 V7_PRIVATE val_t v7_mk_dense_array(struct v7 *v7) {
   val_t a = v7_mk_array(v7);
-#ifdef V7_ENABLE_DENSE_ARRAYS
+#ifndef V7_DISABLE_DENSE_ARRAYS
   v7_own(v7, &a);
   v7_def(v7, a, "", 0, _V7_DESC_HIDDEN(1), V7_NULL);
 
@@ -17473,13 +21348,8 @@ val_t v7_array_get2(struct v7 *v7, val_t arr, unsigned long index, int *has) {
   }
   if (v7_is_object(arr)) {
     if (get_object_struct(arr)->attributes & V7_OBJ_DENSE_ARRAY) {
-      struct v7_property *p =
-          v7_get_own_property2(v7, arr, "", 0, _V7_PROPERTY_HIDDEN);
-      struct mbuf *abuf = NULL;
+      struct mbuf *abuf = dense_array_buf(v7, arr);
       unsigned long len;
-      if (p != NULL) {
-        abuf = (struct mbuf *) v7_get_ptr(v7, p->value);
-      }
       if (abuf == NULL) {
         res = V7_UNDEFINED;
         goto clean;
@@ -17515,101 +21385,115 @@ clean:
   return res;
 }
 
-#if V7_ENABLE_DENSE_ARRAYS
+V7_PRIVATE struct mbuf *dense_array_buf(struct v7 *v7, val_t arr) {
+  struct v7_property *p;
 
-/* Create V7 strings for integers such as array indices */
-static val_t ulong_to_str(struct v7 *v7, unsigned long n) {
-  char buf[100];
-  int len;
-  len = c_snprintf(buf, sizeof(buf), "%lu", n);
-  return v7_mk_string(v7, buf, len, 1);
+  if (!v7_is_object(arr) ||
+      !(get_object_struct(arr)->attributes & V7_OBJ_DENSE_ARRAY)) {
+    return NULL;
+  }
+  p = v7_get_own_property2(v7, arr, "", 0, _V7_PROPERTY_HIDDEN);
+  return p == NULL ? NULL : (struct mbuf *) v7_get_ptr(v7, p->value);
 }
 
-/*
- * Pack 15-bit length and 15 bit index, leaving 2 bits for tag. the LSB has to
- * be set to distinguish it from a prop pointer.
- * In alternative we just fetch the length from obj at each call to v7_next_prop
- * and just stuff the index here (e.g. on 8/16-bit platforms).
- * TODO(mkm): conditional for 16-bit platforms
- */
-#define PACK_ITER(len, idx) \
-  ((struct v7_property *) ((len) << 17 | (idx) << 1 | 1))
+V7_PRIVATE void dense_array_to_sparse(struct v7 *v7, val_t arr) {
+  struct v7_object *o = get_object_struct(arr);
+  struct v7_property *hp =
+      v7_get_own_property2(v7, arr, "", 0, _V7_PROPERTY_HIDDEN);
+  struct v7_property **pp;
+  struct mbuf *abuf;
+  uint8_t saved_inhibit_gc = v7->inhibit_gc;
+  unsigned long i;
 
-#define UNPACK_ITER_LEN(p) (((uintptr_t) p) >> 17)
-#define UNPACK_ITER_IDX(p) ((((uintptr_t) p) >> 1) & 0x7FFF)
-#define IS_PACKED_ITER(p) ((uintptr_t) p & 1)
+  assert(o->attributes & V7_OBJ_DENSE_ARRAY);
+  assert(hp != NULL);
+  abuf = (struct mbuf *) v7_get_ptr(v7, hp->value);
 
-void *v7_next_prop(struct v7 *v7, val_t obj, void *h, val_t *name, val_t *val,
-                   v7_prop_attr_t *attrs) {
-  struct v7_property *p = (struct v7_property *) h;
+  /* Elements are unreachable for GC while they are being moved */
+  v7->inhibit_gc = 1;
 
-  if (get_object_struct(obj)->attributes & V7_OBJ_DENSE_ARRAY) {
-    /* This is a dense array. Find backing mbuf and fetch values from there */
-    struct v7_property *hp =
-        v7_get_own_property2(v7, obj, "", 0, _V7_PROPERTY_HIDDEN);
-    struct mbuf *abuf = NULL;
-    unsigned long len, idx;
-    if (hp != NULL) {
-      abuf = (struct mbuf *) v7_get_ptr(v7, hp->value);
-    }
-    if (abuf == NULL) return NULL;
-    len = abuf->len / sizeof(val_t);
-    if (len == 0) return NULL;
-    idx = (p == NULL) ? 0 : UNPACK_ITER_IDX(p) + 1;
-    p = (idx == len) ? get_object_struct(obj)->properties : PACK_ITER(len, idx);
-    if (val != NULL) *val = ((val_t *) abuf->buf)[idx];
-    if (attrs != NULL) *attrs = 0;
-    if (name != NULL) {
-      char buf[20];
-      int n = v_sprintf_s(buf, sizeof(buf), "%lu", index);
-      *name = v7_mk_string(v7, buf, n, 1);
+  for (pp = &o->properties; *pp != NULL; pp = &(*pp)->next) {
+    if (*pp == hp) {
+      *pp = hp->next;
+      break;
     }
-  } else {
-    /* Ordinary object */
-    p = (p == NULL) ? get_object_struct(obj)->properties : p->next;
-    if (p != NULL) {
-      if (name != NULL) *name = p->name;
-      if (val != NULL) *val = p->value;
-      if (attrs != NULL) *attrs = p->attributes;
+  }
+  o->attributes &= ~V7_OBJ_DENSE_ARRAY;
+
+  if (abuf != NULL) {
+    /* Prepend in reverse, so that elements are kept in ascending order */
+    for (i = abuf->len / sizeof(val_t); i-- > 0;) {
+      val_t v = ((val_t *) abuf->buf)[i];
+      if (v != V7_TAG_NOVALUE) {
+        char buf[20];
+        int n = v_sprintf_s(buf, sizeof(buf), "%lu", i);
+        struct v7_property *p = v7_mk_property(v7);
+        p->name = intern_string(v7, buf, n);
+        p->value = v;
+        p->next = o->properties;
+        o->properties = p;
+        GC_WRITE_BARRIER_PROP(v7, p);
+      }
     }
+    mbuf_free(abuf);
+    free(abuf);
   }
 
-  return p;
-}
-
-V7_PRIVATE val_t
-v7_iter_get_value(struct v7 *v7, val_t obj, struct v7_property *p) {
-  return IS_PACKED_ITER(p) ? v7_array_get(v7, obj, UNPACK_ITER_IDX(p))
-                           : p->value;
-}
-
-V7_PRIVATE val_t v7_iter_get_name(struct v7 *v7, struct v7_property *p) {
-  return IS_PACKED_ITER(p) ? ulong_to_str(v7, UNPACK_ITER_IDX(p)) : p->name;
+  v7->inhibit_gc = saved_inhibit_gc;
+  v7_invalidate_ic(v7);
+#if V7_ENABLE__Memory__stats
+  v7->array_dense_to_sparse++;
+#endif
 }
 
-V7_PRIVATE uint8_t v7_iter_get_attrs(struct v7_property *p) {
-  return IS_PACKED_ITER(p) ? 0 : p->attributes;
-}
+#ifndef V7_DISABLE_DENSE_ARRAYS
+/*
+ * Turns an ordinary array into a dense one, provided it has no holes and no
+ * properties other than plain elements.
+ */
+static void array_maybe_densify(struct v7 *v7, val_t arr) {
+  struct v7_object *o = get_object_struct(arr);
+  struct v7_property *p;
+  struct mbuf *abuf;
+  unsigned long n = 0, len = 0, idx;
+  uint8_t saved_inhibit_gc;
+  const char *s;
+  size_t slen;
 
-/* return array index as number or undefined. works with iterators */
-V7_PRIVATE enum v7_err v7_iter_get_index(struct v7 *v7, struct v7_property *p,
-                                         val_t *res) {
-  enum v7_err rcode = V7_OK;
-  int ok;
-  unsigned long res;
-  if (IS_PACKED_ITER(p)) {
-    *res = v7_mk_number(v7, UNPACK_ITER_IDX(p));
-    goto clean;
+  if (o->attributes & (V7_OBJ_DENSE_ARRAY | V7_OBJ_FUNCTION |
+                       V7_OBJ_NOT_EXTENSIBLE | V7_OBJ_OFF_HEAP) ||
+      !v7_is_array(v7, arr)) {
+    return;
   }
-  V7_TRY(str_to_ulong(v7, p->name, &ok, &res));
-  if (!ok || res >= UINT32_MAX) {
-    goto clean;
+  for (p = o->properties; p != NULL; p = p->next, n++) {
+    if (p->attributes != 0) return;
+    s = v7_get_string(v7, &p->name, &slen);
+    if (!cstr_to_array_index(s, slen, &idx)) return;
+    if (idx >= len) len = idx + 1;
   }
-  *res = v7_mk_number(v7, res);
-  goto clean;
+  if (n != len) return;
 
-clean:
-  return rcode;
+  abuf = (struct mbuf *) malloc(sizeof(*abuf));
+  mbuf_init(abuf, len * sizeof(val_t));
+  abuf->len = len * sizeof(val_t);
+  for (p = o->properties; p != NULL; p = p->next) {
+    s = v7_get_string(v7, &p->name, &slen);
+    cstr_to_array_index(s, slen, &idx);
+    ((val_t *) abuf->buf)[idx] = p->value;
+  }
+
+  /* Element values are only referenced by `abuf` until it is attached */
+  saved_inhibit_gc = v7->inhibit_gc;
+  v7->inhibit_gc = 1;
+  o->properties = NULL;
+  v7_def(v7, arr, "", 0, _V7_DESC_HIDDEN(1), v7_mk_foreign(v7, abuf));
+  o->attributes |= V7_OBJ_DENSE_ARRAY;
+  v7->inhibit_gc = saved_inhibit_gc;
+
+  v7_invalidate_ic(v7);
+#if V7_ENABLE__Memory__stats
+  v7->array_sparse_to_dense++;
+#endif
 }
 #endif
 
@@ -17624,24 +21508,11 @@ unsigned long v7_array_length(struct v7 *v7, val_t v) {
     goto clean;
   }
 
-#if V7_ENABLE_DENSE_ARRAYS
   if (get_object_struct(v)->attributes & V7_OBJ_DENSE_ARRAY) {
-    struct v7_property *p =
-        v7_get_own_property2(v7, v, "", 0, _V7_PROPERTY_HIDDEN);
-    struct mbuf *abuf;
-    if (p == NULL) {
-      len = 0;
-      goto clean;
-    }
-    abuf = (struct mbuf *) v7_get_ptr(v7, p->value);
-    if (abuf == NULL) {
-      len = 0;
-      goto clean;
-    }
-    len = abuf->len / sizeof(val_t);
+    struct mbuf *abuf = dense_array_buf(v7, v);
+    len = abuf == NULL ? 0 : abuf->len / sizeof(val_t);
     goto clean;
   }
-#endif
 
   for (p = get_object_struct(v)->properties; p != NULL; p = p->next) {
     int ok = 0;
@@ -17690,14 +21561,24 @@ enum v7_err v7_array_set_throwing(struct v7 *v7, val_t arr, unsigned long index,
       unsigned long len;
       assert(p != NULL);
       abuf = (struct mbuf *) v7_get_ptr(v7, p->value);
+      len = abuf == NULL ? 0 : abuf->len / sizeof(val_t);
+
+      if (index >= len || ((val_t *) abuf->buf)[index] == V7_TAG_NOVALUE) {
+        if (get_object_struct(arr)->attributes & V7_OBJ_NOT_EXTENSIBLE) {
+          if (is_strict_mode(v7)) {
+            rcode = v7_throwf(v7, TYPE_ERROR, "Object is not extensible");
+            goto clean;
+          }
 
-      if (get_object_struct(arr)->attributes & V7_OBJ_NOT_EXTENSIBLE) {
-        if (is_strict_mode(v7)) {
-          rcode = v7_throwf(v7, TYPE_ERROR, "Object is not extensible");
           goto clean;
         }
 
-        goto clean;
+        if (index > 2 * len + 16) {
+          /* Mostly holes: not worth keeping dense */
+          dense_array_to_sparse(v7, arr);
+          rcode = v7_array_set_throwing(v7, arr, index, v, &ires);
+          goto clean;
+        }
       }
 
       if (abuf == NULL) {
@@ -17705,8 +21586,6 @@ enum v7_err v7_array_set_throwing(struct v7 *v7, val_t arr, unsigned long index,
         mbuf_init(abuf, sizeof(val_t) * (index + 1));
         p->value = v7_mk_foreign(v7, abuf);
       }
-      len = abuf->len / sizeof(val_t);
-      /* TODO(mkm): possibly promote to sparse array */
       if (index > len) {
         unsigned long i;
         val_t s = V7_TAG_NOVALUE;
@@ -17721,17 +21600,29 @@ enum v7_err v7_array_set_throwing(struct v7 *v7, val_t arr, unsigned long index,
       } else {
         memcpy(abuf->buf + index * sizeof(val_t), &v, sizeof(val_t));
       }
+      GC_WRITE_BARRIER(v7, v);
+      ires = 0;
     } else {
       char buf[20];
       int n = v_sprintf_s(buf, sizeof(buf), "%lu", index);
-      {
-        struct v7_property *tmp = NULL;
-        rcode = set_property(v7, arr, buf, n, v, &tmp);
-        ires = (tmp == NULL) ? -1 : 0;
-      }
+      struct v7_property *tmp_prop = NULL;
+      rcode = set_property(v7, arr, buf, n, v, &tmp_prop);
+      ires = (tmp_prop == NULL) ? -1 : 0;
       if (rcode != V7_OK) {
         goto clean;
       }
+#ifndef V7_DISABLE_DENSE_ARRAYS
+      /*
+       * Check whether the array has filled in when a new element is added at
+       * index 0 or at a power of two minus one: that is enough to catch both
+       * ascending and descending fills, while keeping the cost of checks
+       * amortized O(1) per added element.
+       */
+      if (ires == 0 && ((index + 1) & index) == 0 &&
+          get_object_struct(arr)->properties == tmp_prop) {
+        array_maybe_densify(v7, arr);
+      }
+#endif
     }
   }
 
@@ -17773,9 +21664,11 @@ enum v7_err v7_array_push_throwing(struct v7 *v7, v7_val_t arr, v7_val_t v,
 /* Amalgamated: #include "v7/src/object.h" */
 /* Amalgamated: #include "v7/src/string.h" */
 /* Amalgamated: #include "v7/src/array.h" */
+/* Amalgamated: #include "v7/src/std_typedarray.h" */
 /* Amalgamated: #include "v7/src/eval.h" */
 /* Amalgamated: #include "v7/src/exceptions.h" */
 /* Amalgamated: #include "v7/src/conversion.h" */
+/* Amalgamated: #include "v7/src/stats.h" */
 
 /*
  * Default property attributes (see `v7_prop_attr_t`)
@@ -17871,19 +21764,19 @@ V7_PRIVATE struct v7_property *v7_mk_property(struct v7 *v7) {
   return p;
 }
 
-V7_PRIVATE struct v7_property *v7_get_own_property2(struct v7 *v7, val_t obj,
-                                                    const char *name,
-                                                    size_t len,
-                                                    v7_prop_attr_t attrs) {
+/*
+ * Looks up the own property `name` of `obj`, whose interned counterpart is
+ * `key` (or `V7_UNDEFINED` if there is none, see `find_interned()`).
+ */
+static struct v7_property *get_own_property_key(struct v7 *v7, val_t obj,
+                                                const char *name, size_t len,
+                                                val_t key,
+                                                v7_prop_attr_t attrs) {
   struct v7_property *p;
   struct v7_object *o;
-  val_t ss;
   if (!v7_is_object(obj)) {
     return NULL;
   }
-  if (len == (size_t) ~0) {
-    len = strlen(name);
-  }
 
   o = get_object_struct(obj);
   /*
@@ -17892,38 +21785,48 @@ V7_PRIVATE struct v7_property *v7_get_own_property2(struct v7 *v7, val_t obj,
    * a zero length string anyway, so this will change.
    */
   if (o->attributes & V7_OBJ_DENSE_ARRAY && len > 0) {
-    int ok, has;
-    unsigned long i = cstr_to_ulong(name, len, &ok);
-    if (ok) {
+    int has;
+    unsigned long i;
+    if (cstr_to_array_index(name, len, &i)) {
       v7->cur_dense_prop->value = v7_array_get2(v7, obj, i, &has);
       return has ? v7->cur_dense_prop : NULL;
     }
   }
 
-  if (len <= 5) {
-    ss = v7_mk_string(v7, name, len, 1);
-    for (p = o->properties; p != NULL; p = p->next) {
-#if defined(V7_ENABLE_ENTITY_IDS)
-      if (p->entity_id != V7_ENTITY_ID_PROP) {
-        fprintf(stderr, "not a prop!=0x%x\n", p->entity_id);
-        abort();
+#if V7_ENABLE__ArrayBuffer
+  /* elements of typed arrays are stored in the array buffer */
+  if (o->attributes & V7_OBJ_BUFFER && len > 0) {
+    struct v7_buffer_view *bv = typed_array_view(v7, obj);
+    unsigned long i;
+    if (bv != NULL && cstr_to_array_index(name, len, &i)) {
+      if (i >= bv->length) {
+        return NULL;
       }
+      v7->cur_dense_prop->value = typed_array_get(v7, bv, i);
+      return v7->cur_dense_prop;
+    }
+  }
 #endif
-      if (p->name == ss && (attrs == 0 || (p->attributes & attrs))) {
+
+  /*
+   * Interned names are equal only if they are the same value; the others
+   * (which are longer than 5 chars) have to be compared by contents.
+   */
+  for (p = o->properties; p != NULL; p = p->next) {
+#if defined(V7_ENABLE_ENTITY_IDS)
+    if (p->entity_id != V7_ENTITY_ID_PROP) {
+      fprintf(stderr, "not a prop!=0x%x\n", p->entity_id);
+      abort();
+    }
+#endif
+    if (p->name == key && key != V7_UNDEFINED) {
+      if (attrs == 0 || (p->attributes & attrs)) {
         return p;
       }
-    }
-  } else {
-    for (p = o->properties; p != NULL; p = p->next) {
+    } else if (len > 5 && !is_interned_name(p->name)) {
       size_t n;
       const char *s = v7_get_string(v7, &p->name, &n);
-#if defined(V7_ENABLE_ENTITY_IDS)
-      if (p->entity_id != V7_ENTITY_ID_PROP) {
-        fprintf(stderr, "not a prop!=0x%x\n", p->entity_id);
-        abort();
-      }
-#endif
-      if (n == len && strncmp(s, name, len) == 0 &&
+      if (n == len && memcmp(s, name, len) == 0 &&
           (attrs == 0 || (p->attributes & attrs))) {
         return p;
       }
@@ -17932,55 +21835,56 @@ V7_PRIVATE struct v7_property *v7_get_own_property2(struct v7 *v7, val_t obj,
   return NULL;
 }
 
+V7_PRIVATE struct v7_property *v7_get_own_property2(struct v7 *v7, val_t obj,
+                                                    const char *name,
+                                                    size_t len,
+                                                    v7_prop_attr_t attrs) {
+  if (!v7_is_object(obj)) {
+    return NULL;
+  }
+  if (len == (size_t) ~0) {
+    len = strlen(name);
+  }
+  return get_own_property_key(v7, obj, name, len, find_interned(v7, name, len),
+                              attrs);
+}
+
 V7_PRIVATE struct v7_property *v7_get_own_property(struct v7 *v7, val_t obj,
                                                    const char *name,
                                                    size_t len) {
   return v7_get_own_property2(v7, obj, name, len, 0);
 }
 
-V7_PRIVATE struct v7_property *v7_get_property(struct v7 *v7, val_t obj,
-                                               const char *name, size_t len) {
-  if (!v7_is_object(obj)) {
-    return NULL;
-  }
+static struct v7_property *get_property_key(struct v7 *v7, val_t obj,
+                                            const char *name, size_t len,
+                                            val_t key) {
+  struct v7_property *prop = NULL;
+#ifdef V7_ENABLE_STATS
+  unsigned long depth = 0;
+#endif
   for (; obj != V7_NULL; obj = obj_prototype_v(v7, obj)) {
-    struct v7_property *prop;
-    if ((prop = v7_get_own_property(v7, obj, name, len)) != NULL) {
-      return prop;
+#ifdef V7_ENABLE_STATS
+    depth++;
+#endif
+    if ((prop = get_own_property_key(v7, obj, name, len, key, 0)) != NULL) {
+      break;
     }
   }
-  return NULL;
+#ifdef V7_ENABLE_STATS
+  stats_count_prop_lookup(v7, depth);
+#endif
+  return prop;
 }
 
-V7_PRIVATE enum v7_err v7_get_property_v(struct v7 *v7, val_t obj,
-                                         v7_val_t name,
-                                         struct v7_property **res) {
-  enum v7_err rcode = V7_OK;
-  size_t name_len;
-  STATIC char buf[8];
-  const char *s = buf;
-  uint8_t fr = 0;
-
-  if (v7_is_string(name)) {
-    s = v7_get_string(v7, &name, &name_len);
-  } else {
-    char *stmp;
-    V7_TRY(v7_stringify_throwing(v7, name, buf, sizeof(buf),
-                                 V7_STRINGIFY_DEFAULT, &stmp));
-    s = stmp;
-    if (s != buf) {
-      fr = 1;
-    }
-    name_len = strlen(s);
+V7_PRIVATE struct v7_property *v7_get_property(struct v7 *v7, val_t obj,
+                                               const char *name, size_t len) {
+  if (!v7_is_object(obj)) {
+    return NULL;
   }
-
-  *res = v7_get_property(v7, obj, s, name_len);
-
-clean:
-  if (fr) {
-    free((void *) s);
+  if (len == (size_t) ~0) {
+    len = strlen(name);
   }
-  return rcode;
+  return get_property_key(v7, obj, name, len, find_interned(v7, name, len));
 }
 
 WARN_UNUSED_RESULT
@@ -18060,8 +21964,33 @@ V7_PRIVATE enum v7_err v7_get_throwing_v(struct v7 *v7, v7_val_t obj,
     }
   }
 
+  /* integer index of a dense array: no need to make a property name */
+  if (IS_SMI(name) && GET_SMI(name) >= 0 && v7_is_object(obj) &&
+      (get_object_struct(obj)->attributes & V7_OBJ_DENSE_ARRAY)) {
+    int has;
+    *res = v7_array_get2(v7, obj, GET_SMI(name), &has);
+    if (has) {
+      goto clean;
+    }
+  }
+
+#if V7_ENABLE__ArrayBuffer
+  /* same for typed arrays */
+  if (IS_SMI(name) && GET_SMI(name) >= 0 && v7_is_object(obj) &&
+      (get_object_struct(obj)->attributes & V7_OBJ_BUFFER)) {
+    struct v7_buffer_view *bv = typed_array_view(v7, obj);
+    if (bv != NULL && (unsigned long) GET_SMI(name) < bv->length) {
+      *res = typed_array_get(v7, bv, GET_SMI(name));
+      goto clean;
+    }
+  }
+#endif
+
   if (v7_is_string(name)) {
     s = v7_get_string(v7, &name, &name_len);
+  } else if (IS_SMI(name) && GET_SMI(name) >= 0 && GET_SMI(name) < 10000000) {
+    /* integer index which fits in `buf` */
+    name_len = c_snprintf(buf, sizeof(buf), "%d", GET_SMI(name));
   } else {
     char *stmp;
     V7_TRY(v7_stringify_throwing(v7, name, buf, sizeof(buf),
@@ -18081,8 +22010,17 @@ clean:
   return rcode;
 }
 
-V7_PRIVATE void v7_destroy_property(struct v7_property **p) {
+V7_PRIVATE void v7_destroy_property(struct v7 *v7, struct v7_property **p) {
   *p = NULL;
+  v7_invalidate_ic(v7);
+}
+
+V7_PRIVATE void v7_invalidate_ic(struct v7 *v7) {
+#ifndef V7_DISABLE_INLINE_CACHE
+  v7->ic_epoch++;
+#else
+  (void) v7;
+#endif
 }
 
 WARN_UNUSED_RESULT
@@ -18205,7 +22143,11 @@ V7_PRIVATE enum v7_err def_property_v(struct v7 *v7, val_t obj, val_t name,
   enum v7_err rcode = V7_OK;
   struct v7_property *prop = NULL;
   size_t len;
-  const char *n = v7_get_string(v7, &name, &len);
+  const char *n;
+
+  /* new properties are named with the interned string */
+  name = intern_string_v(v7, name);
+  n = v7_get_string(v7, &name, &len);
 
   v7_own(v7, &name);
   v7_own(v7, &val);
@@ -18215,7 +22157,48 @@ V7_PRIVATE enum v7_err def_property_v(struct v7 *v7, val_t obj, val_t name,
     goto clean;
   }
 
-  prop = v7_get_own_property(v7, obj, n, len);
+  if (get_object_struct(obj)->attributes & V7_OBJ_DENSE_ARRAY) {
+    unsigned long idx;
+    if (cstr_to_array_index(n, len, &idx)) {
+      if (attrs_desc == 0) {
+        /* Plain element: store it in the dense array buffer */
+        int ires = -1;
+        V7_TRY(v7_array_set_throwing(v7, obj, idx, val, &ires));
+        prop = NULL;
+        if (ires == 0) {
+          prop = v7->cur_dense_prop;
+          prop->value = val;
+        }
+        goto clean;
+      }
+      /* Elements with attributes can't be kept in a dense array */
+      dense_array_to_sparse(v7, obj);
+      n = v7_get_string(v7, &name, &len);
+    }
+  }
+
+#if V7_ENABLE__ArrayBuffer
+  if (get_object_struct(obj)->attributes & V7_OBJ_BUFFER) {
+    unsigned long idx;
+    if (cstr_to_array_index(n, len, &idx) &&
+        typed_array_view(v7, obj) != NULL) {
+      int ires = -1;
+      if (attrs_desc != 0) {
+        V7_THROW(v7_throwf(v7, TYPE_ERROR,
+                           "Cannot redefine typed array element"));
+      }
+      V7_TRY(typed_array_set(v7, obj, idx, val, &ires));
+      prop = NULL;
+      if (ires == 0) {
+        prop = v7->cur_dense_prop;
+        prop->value = val;
+      }
+      goto clean;
+    }
+  }
+#endif
+
+  prop = get_own_property_key(v7, obj, n, len, name, 0);
   if (prop == NULL) {
     /*
      * The own property with given `name` doesn't exist yet: try to create it,
@@ -18246,6 +22229,7 @@ V7_PRIVATE enum v7_err def_property_v(struct v7 *v7, val_t obj, val_t name,
 
     prop->next = get_object_struct(obj)->properties;
     get_object_struct(obj)->properties = prop;
+    GC_WRITE_BARRIER_PROP(v7, prop);
     goto clean;
   } else {
     /* Property already exists */
@@ -18313,6 +22297,7 @@ V7_PRIVATE enum v7_err def_property_v(struct v7 *v7, val_t obj, val_t name,
     /* Set value and apply attrs delta */
     if (!(attrs_desc & V7_DESC_PRESERVE_VALUE)) {
       prop->value = val;
+      GC_WRITE_BARRIER(v7, val);
     }
     prop->attributes = apply_attrs_desc(attrs_desc, prop->attributes);
   }
@@ -18385,6 +22370,28 @@ int v7_del(struct v7 *v7, val_t obj, const char *name, size_t len) {
   if (len == (size_t) ~0) {
     len = strlen(name);
   }
+  if (get_object_struct(obj)->attributes & V7_OBJ_DENSE_ARRAY) {
+    struct mbuf *abuf = dense_array_buf(v7, obj);
+    unsigned long idx;
+    if (cstr_to_array_index(name, len, &idx)) {
+      /*
+       * Deleted elements of dense arrays become holes; trailing holes are
+       * trimmed, since the length of ordinary arrays is also derived from
+       * the largest index.
+       */
+      if (abuf == NULL || idx >= abuf->len / sizeof(val_t) ||
+          ((val_t *) abuf->buf)[idx] == V7_TAG_NOVALUE) {
+        return -1;
+      }
+      ((val_t *) abuf->buf)[idx] = V7_TAG_NOVALUE;
+      while (abuf->len > 0 &&
+             *(val_t *) (abuf->buf + abuf->len - sizeof(val_t)) ==
+                 V7_TAG_NOVALUE) {
+        abuf->len -= sizeof(val_t);
+      }
+      return 0;
+    }
+  }
   for (prev = NULL, prop = get_object_struct(obj)->properties; prop != NULL;
        prev = prop, prop = prop->next) {
     size_t n;
@@ -18395,7 +22402,7 @@ int v7_del(struct v7 *v7, val_t obj, const char *name, size_t len) {
       } else {
         get_object_struct(obj)->properties = prop->next;
       }
-      v7_destroy_property(&prop);
+      v7_destroy_property(v7, &prop);
       return 0;
     }
   }
@@ -18444,6 +22451,47 @@ void *v7_next_prop(void *handle, v7_val_t obj, v7_val_t *name, v7_val_t *value,
   return p;
 }
 
+/* Reports an element which is not stored as a property, see `v7_next_prop2` */
+static void *next_prop_elem(struct v7 *v7, unsigned long idx, val_t v,
+                            val_t *name, val_t *value, v7_prop_attr_t *attrs) {
+  if (value != NULL) *value = v;
+  if (attrs != NULL) *attrs = 0;
+  if (name != NULL) {
+    char buf[20];
+    int n = c_snprintf(buf, sizeof(buf), "%lu", idx);
+    *name = v7_mk_string(v7, buf, n, 1);
+  }
+  return DENSE_ITER(idx);
+}
+
+V7_PRIVATE void *v7_next_prop2(struct v7 *v7, void *handle, val_t obj,
+                               val_t *name, val_t *value,
+                               v7_prop_attr_t *attrs) {
+  if (handle == NULL || IS_DENSE_ITER(handle)) {
+    struct mbuf *abuf = dense_array_buf(v7, obj);
+    unsigned long idx = handle == NULL ? 0 : DENSE_ITER_IDX(handle) + 1;
+
+    for (; abuf != NULL && idx < abuf->len / sizeof(val_t); idx++) {
+      val_t v = ((val_t *) abuf->buf)[idx];
+      if (v != V7_TAG_NOVALUE) {
+        return next_prop_elem(v7, idx, v, name, value, attrs);
+      }
+    }
+#if V7_ENABLE__ArrayBuffer
+    {
+      struct v7_buffer_view *bv = typed_array_view(v7, obj);
+      if (bv != NULL && idx < bv->length) {
+        return next_prop_elem(v7, idx, typed_array_get(v7, bv, idx), name,
+                              value, attrs);
+      }
+    }
+#endif
+    /* No more elements: proceed to the ordinary properties */
+    handle = NULL;
+  }
+  return v7_next_prop(handle, obj, name, value, attrs);
+}
+
 /* }}} Object properties */
 
 /* Object prototypes {{{ */
@@ -18457,6 +22505,7 @@ V7_PRIVATE int obj_prototype_set(struct v7 *v7, struct v7_object *obj,
     ret = -1;
   } else {
     ((struct v7_generic_object *) obj)->prototype = proto;
+    GC_WRITE_BARRIER(v7, v7_object_to_value(proto));
     ret = 0;
   }
 
@@ -18558,6 +22607,7 @@ static struct v7_property *get_or_create_user_data_property(struct v7 *v7,
 
   p->next = o->properties;
   o->properties = p;
+  GC_WRITE_BARRIER_PROP(v7, p);
 
   return p;
 }
@@ -18615,6 +22665,83 @@ void v7_set_destructor_cb(struct v7 *v7, v7_val_t obj, v7_destructor_cb_t *d) {
 /* Amalgamated: #include "v7/src/slre.h" */
 
 #if V7_ENABLE__RegExp
+
+#ifndef V7_DISABLE_REGEXP_CACHE
+V7_PRIVATE void regexp_cache_reset(struct v7 *v7) {
+  int i;
+  for (i = 0; i < V7_REGEXP_CACHE_SIZE; i++) {
+    free(v7->regexp_cache[i].key);
+    slre_free(v7->regexp_cache[i].prog);
+    memset(&v7->regexp_cache[i], 0, sizeof(v7->regexp_cache[i]));
+  }
+}
+
+static struct v7_regexp_cache *regexp_cache_find(struct v7 *v7, const char *re,
+                                                 size_t re_len,
+                                                 const char *flags,
+                                                 size_t flags_len) {
+  int i;
+  for (i = 0; i < V7_REGEXP_CACHE_SIZE; i++) {
+    struct v7_regexp_cache *c = &v7->regexp_cache[i];
+    if (c->key != NULL && c->src_len == re_len && c->flags_len == flags_len &&
+        memcmp(c->key, re, re_len) == 0 &&
+        (flags_len == 0 || memcmp(c->key + re_len, flags, flags_len) == 0)) {
+      return c;
+    }
+  }
+  return NULL;
+}
+
+static void regexp_cache_add(struct v7 *v7, const char *re, size_t re_len,
+                             const char *flags, size_t flags_len,
+                             struct slre_prog *prog) {
+  struct v7_regexp_cache *c = &v7->regexp_cache[v7->regexp_cache_next];
+  char *key = (char *) malloc(re_len + flags_len + 1);
+
+  if (key == NULL) return;
+  memcpy(key, re, re_len);
+  if (flags_len > 0) memcpy(key + re_len, flags, flags_len);
+
+  v7->regexp_cache_next = (v7->regexp_cache_next + 1) % V7_REGEXP_CACHE_SIZE;
+  free(c->key);
+  slre_free(c->prog);
+  c->key = key;
+  c->src_len = re_len;
+  c->flags_len = flags_len;
+  c->prog = prog;
+  slre_retain(prog);
+}
+#endif
+
+/*
+ * Compiles the regexp, or takes the already compiled one from the cache.
+ * Returns the program, which the caller has to `slre_free()`, or NULL if the
+ * regexp is invalid.
+ */
+static struct slre_prog *regexp_compile(struct v7 *v7, const char *re,
+                                        size_t re_len, const char *flags,
+                                        size_t flags_len) {
+  struct slre_prog *p = NULL;
+#ifndef V7_DISABLE_REGEXP_CACHE
+  struct v7_regexp_cache *c =
+      regexp_cache_find(v7, re, re_len, flags, flags_len);
+  if (c != NULL) {
+    slre_retain(c->prog);
+    return c->prog;
+  }
+#else
+  (void) v7;
+#endif
+
+  if (slre_compile(re, re_len, flags, flags_len, &p, 1) != SLRE_OK) {
+    return NULL;
+  }
+#ifndef V7_DISABLE_REGEXP_CACHE
+  if (p != NULL) regexp_cache_add(v7, re, re_len, flags, flags_len, p);
+#endif
+  return p;
+}
+
 enum v7_err v7_mk_regexp(struct v7 *v7, const char *re, size_t re_len,
                          const char *flags, size_t flags_len, v7_val_t *res) {
   enum v7_err rcode = V7_OK;
@@ -18623,8 +22750,7 @@ enum v7_err v7_mk_regexp(struct v7 *v7, const char *re, size_t re_len,
 
   if (re_len == ~((size_t) 0)) re_len = strlen(re);
 
-  if (slre_compile(re, re_len, flags, flags_len, &p, 1) != SLRE_OK ||
-      p == NULL) {
+  if ((p = regexp_compile(v7, re, re_len, flags, flags_len)) == NULL) {
     rcode = v7_throwf(v7, TYPE_ERROR, "Invalid regex");
     goto clean;
   } else {
@@ -18814,10 +22940,6 @@ clean:
 /* Amalgamated: #include "v7/src/array.h" */
 /* Amalgamated: #include "v7/src/object.h" */
 
-#ifdef V7_TEMP_OFF
-int double_to_str(char *buf, size_t buf_size, double val, int prec);
-#endif
-
 static void save_val(struct v7 *v7, const char *str, size_t str_len,
                      val_t *dst_v, char *dst, size_t dst_size, int wanted_len,
                      size_t *res_wanted_len) {
@@ -18846,7 +22968,7 @@ V7_PRIVATE enum v7_err primitive_to_str(struct v7 *v7, val_t v, val_t *res,
                                         char *buf, size_t buf_size,
                                         size_t *res_len) {
   enum v7_err rcode = V7_OK;
-  char tmp_buf[25];
+  char tmp_buf[CS_DTOA_BUF_SIZE];
   double num;
   size_t wanted_len;
 
@@ -18909,6 +23031,12 @@ V7_PRIVATE enum v7_err primitive_to_str(struct v7 *v7, val_t v, val_t *res,
         save_val(v7, tmp_buf, strlen(tmp_buf), res, buf, buf_size, -1, res_len);
         goto clean;
       }
+      if (IS_SMI(v)) {
+        wanted_len = c_snprintf(tmp_buf, sizeof(tmp_buf), "%d", GET_SMI(v));
+        save_val(v7, tmp_buf, strlen(tmp_buf), res, buf, buf_size, wanted_len,
+                 res_len);
+        goto clean;
+      }
       num = v7_get_double(v7, v);
       if (isinf(num)) {
         if (num < 0.0) {
@@ -18919,22 +23047,10 @@ V7_PRIVATE enum v7_err primitive_to_str(struct v7 *v7, val_t v, val_t *res,
         save_val(v7, tmp_buf, strlen(tmp_buf), res, buf, buf_size, -1, res_len);
         goto clean;
       }
-      {
-/*
- * ESP8266's sprintf doesn't support double & float.
- * TODO(alashkin): fix this
- */
-#ifndef V7_TEMP_OFF
-        const char *fmt = num > 1e10 ? "%.21g" : "%.10g";
-        wanted_len = snprintf(tmp_buf, sizeof(tmp_buf), fmt, num);
-#else
-        const int prec = num > 1e10 ? 21 : 10;
-        wanted_len = double_to_str(tmp_buf, sizeof(tmp_buf), num, prec);
-#endif
-        save_val(v7, tmp_buf, strlen(tmp_buf), res, buf, buf_size, wanted_len,
-                 res_len);
-        goto clean;
-      }
+      wanted_len = cs_dtoa(tmp_buf, sizeof(tmp_buf), num);
+      save_val(v7, tmp_buf, strlen(tmp_buf), res, buf, buf_size, wanted_len,
+               res_len);
+      goto clean;
     case V7_TYPE_CFUNCTION:
 #ifdef V7_UNIT_TEST
       wanted_len = c_snprintf(tmp_buf, sizeof(tmp_buf), "cfunc_xxxxxx");
@@ -19003,7 +23119,7 @@ V7_PRIVATE enum v7_err primitive_to_number(struct v7 *v7, val_t v, val_t *res) {
       /*
        * TODO(dfrank) handle Infinity
        */
-      d = strtod(s, &e);
+      d = cs_strtod(s, &e);
       if (e - n != s) {
         d = NAN;
       }
@@ -19114,6 +23230,10 @@ V7_PRIVATE enum v7_err to_number_v(struct v7 *v7, val_t v, val_t *res) {
 
   *res = v;
 
+  if (v7_is_number(v)) {
+    goto clean;
+  }
+
   /*
    * Convert value to primitive if needed, calling `valueOf()` first
    */
@@ -19146,6 +23266,11 @@ V7_PRIVATE enum v7_err to_long(struct v7 *v7, val_t v, long default_value,
     goto clean;
   }
 
+  if (IS_SMI(v)) {
+    *res = GET_SMI(v);
+    goto clean;
+  }
+
   /* Try to convert value to number */
   rcode = to_number_v(v7, v, &v);
   if (rcode != V7_OK) {
@@ -19494,6 +23619,393 @@ clean:
   return rcode;
 }
 
+/* Size of the buffer which accumulates JSON output before it's flushed */
+#ifndef V7_JSON_OUT_BUF_SIZE
+#define V7_JSON_OUT_BUF_SIZE 128
+#endif
+
+struct json_out {
+  struct v7 *v7;
+  v7_stringify_cb_t *cb;
+  void *user_data;
+  val_t replacer;  /* replacer function, or `undefined` */
+  val_t prop_list; /* array of property names to serialize, or `undefined` */
+  char gap[11];    /* indentation unit, as given by the `space` argument */
+  int depth;
+  size_t len;
+  char buf[V7_JSON_OUT_BUF_SIZE];
+};
+
+static void json_out_flush(struct json_out *out) {
+  if (out->len > 0) {
+    out->cb(out->buf, out->len, out->user_data);
+    out->len = 0;
+  }
+}
+
+static void json_out(struct json_out *out, const char *s, size_t len) {
+  if (out->len + len > sizeof(out->buf)) {
+    json_out_flush(out);
+    if (len > sizeof(out->buf)) {
+      /* too big to be buffered */
+      out->cb(s, len, out->user_data);
+      return;
+    }
+  }
+  memcpy(out->buf + out->len, s, len);
+  out->len += len;
+}
+
+static void json_out_str(struct json_out *out, const char *s) {
+  json_out(out, s, strlen(s));
+}
+
+static void json_out_newline(struct json_out *out) {
+  int i;
+  if (out->gap[0] != '\0') {
+    json_out(out, "\n", 1);
+    for (i = 0; i < out->depth; i++) {
+      json_out_str(out, out->gap);
+    }
+  }
+}
+
+/* Writes quoted JSON string, escaping as required by ECMA-262 15.12.3 */
+static void json_out_quote(struct json_out *out, const char *s, size_t len) {
+  const char *end = s + len, *run = s;
+
+  json_out(out, "\"", 1);
+  for (; s < end; s++) {
+    unsigned char c = (unsigned char) *s;
+    char esc[7];
+    size_t n = 2;
+
+    if (c == '"' || c == '\\') {
+      esc[1] = c;
+    } else if (c == '\b') {
+      esc[1] = 'b';
+    } else if (c == '\t') {
+      esc[1] = 't';
+    } else if (c == '\n') {
+      esc[1] = 'n';
+    } else if (c == '\f') {
+      esc[1] = 'f';
+    } else if (c == '\r') {
+      esc[1] = 'r';
+    } else if (c < ' ') {
+      n = c_snprintf(esc, sizeof(esc), "\\u%04x", c);
+    } else {
+      continue;
+    }
+    esc[0] = '\\';
+
+    json_out(out, run, s - run);
+    json_out(out, esc, n);
+    run = s + 1;
+  }
+  json_out(out, run, s - run);
+  json_out(out, "\"", 1);
+}
+
+/*
+ * Applies `toJSON()` and the replacer function to the value `*v` of the
+ * property `key` of `holder`, and unwraps primitive wrapper objects; see
+ * ECMA-262 15.12.3, steps 2-4 of the abstract operation Str.
+ */
+WARN_UNUSED_RESULT
+static enum v7_err json_prepare_value(struct json_out *out, val_t holder,
+                                      val_t key, val_t *v) {
+  struct v7 *v7 = out->v7;
+  enum v7_err rcode = V7_OK;
+  struct gc_tmp_frame tf = new_tmp_frame(v7);
+  val_t func = V7_UNDEFINED, args = V7_UNDEFINED;
+
+  tmp_stack_push(&tf, &holder);
+  tmp_stack_push(&tf, &key);
+  tmp_stack_push(&tf, &func);
+  tmp_stack_push(&tf, &args);
+
+  if (v7_is_object(*v)) {
+    V7_TRY(v7_get_throwing(v7, *v, "toJSON", 6, &func));
+    if (!v7_is_callable(v7, func) &&
+        val_type(v7, *v) == V7_TYPE_DATE_OBJECT) {
+      /* Dates are always serialized as strings */
+      V7_TRY(v7_get_throwing(v7, *v, "toString", 8, &func));
+    }
+    if (v7_is_callable(v7, func)) {
+      V7_TRY(to_string(v7, key, &key, NULL, 0, NULL));
+      args = v7_mk_dense_array(v7);
+      v7_array_push(v7, args, key);
+      V7_TRY(b_apply(v7, func, *v, args, 0, v));
+    }
+  }
+
+  if (v7_is_callable(v7, out->replacer)) {
+    V7_TRY(to_string(v7, key, &key, NULL, 0, NULL));
+    args = v7_mk_dense_array(v7);
+    v7_array_push(v7, args, key);
+    v7_array_push(v7, args, *v);
+    V7_TRY(b_apply(v7, out->replacer, holder, args, 0, v));
+  }
+
+  switch (val_type(v7, *v)) {
+    case V7_TYPE_NUMBER_OBJECT:
+    case V7_TYPE_STRING_OBJECT:
+    case V7_TYPE_BOOLEAN_OBJECT:
+      V7_TRY(obj_value_of(v7, *v, v));
+      break;
+    default:
+      break;
+  }
+
+clean:
+  tmp_frame_cleanup(&tf);
+  return rcode;
+}
+
+WARN_UNUSED_RESULT
+static enum v7_err json_out_value(struct json_out *out, val_t v);
+
+WARN_UNUSED_RESULT
+static enum v7_err json_out_object(struct json_out *out, val_t obj) {
+  struct v7 *v7 = out->v7;
+  enum v7_err rcode = V7_OK;
+  struct gc_tmp_frame tf = new_tmp_frame(v7);
+  val_t name = V7_UNDEFINED, val = V7_UNDEFINED, keys = out->prop_list;
+  int is_array = v7_is_array(v7, obj), first = 1;
+  unsigned long i, len;
+
+  tmp_stack_push(&tf, &obj);
+  tmp_stack_push(&tf, &name);
+  tmp_stack_push(&tf, &val);
+  tmp_stack_push(&tf, &keys);
+
+  json_out(out, is_array ? "[" : "{", 1);
+  out->depth++;
+
+  if (!is_array && v7_is_undefined(keys)) {
+    /*
+     * `toJSON()` and the replacer may delete properties, so collect the names
+     * first rather than holding a property pointer across the calls. Elements
+     * of typed arrays go first, as in `Object.keys()`.
+     */
+    void *h = NULL;
+    v7_prop_attr_t attrs;
+    keys = v7_mk_dense_array(v7);
+    while ((h = v7_next_prop2(v7, h, obj, &name, NULL, &attrs)) != NULL) {
+      if (!(attrs & (_V7_PROPERTY_HIDDEN | V7_PROPERTY_NON_ENUMERABLE))) {
+        v7_array_push(v7, keys, name);
+      }
+    }
+  }
+  len = v7_array_length(v7, is_array ? obj : keys);
+
+  for (i = 0; i < len; i++) {
+    if (is_array) {
+      name = v7_mk_number(v7, i);
+      val = v7_array_get(v7, obj, i);
+    } else {
+      size_t n;
+      const char *s;
+      name = v7_array_get(v7, keys, i);
+      s = v7_get_string(v7, &name, &n);
+      V7_TRY(v7_get_throwing(v7, obj, s, n, &val));
+    }
+
+    V7_TRY(json_prepare_value(out, obj, name, &val));
+    if (should_skip_for_json(val_type(v7, val)) && !is_array) {
+      continue;
+    }
+
+    if (!first) {
+      json_out(out, ",", 1);
+    }
+    first = 0;
+    json_out_newline(out);
+
+    if (!is_array) {
+      size_t n;
+      const char *s = v7_get_string(v7, &name, &n);
+      json_out_quote(out, s, n);
+      json_out(out, ":", 1);
+      if (out->gap[0] != '\0') {
+        json_out(out, " ", 1);
+      }
+    }
+
+    if (should_skip_for_json(val_type(v7, val))) {
+      json_out(out, "null", 4);
+    } else {
+      V7_TRY(json_out_value(out, val));
+    }
+  }
+
+  out->depth--;
+  if (!first) {
+    json_out_newline(out);
+  }
+  json_out(out, is_array ? "]" : "}", 1);
+
+clean:
+  tmp_frame_cleanup(&tf);
+  return rcode;
+}
+
+/* Writes JSON of a value which was already processed by `json_prepare_value` */
+WARN_UNUSED_RESULT
+static enum v7_err json_out_value(struct json_out *out, val_t v) {
+  struct v7 *v7 = out->v7;
+  enum v7_err rcode = V7_OK;
+
+  switch (val_type(v7, v)) {
+    case V7_TYPE_STRING: {
+      size_t n;
+      const char *s = v7_get_string(v7, &v, &n);
+      json_out_quote(out, s, n);
+      break;
+    }
+    case V7_TYPE_NUMBER:
+      if (!is_finite(v7, v)) {
+        json_out(out, "null", 4);
+        break;
+      }
+    /* fall through */
+    case V7_TYPE_NULL:
+    case V7_TYPE_BOOLEAN: {
+      char buf[32];
+      size_t n;
+      V7_TRY(primitive_to_str(v7, v, NULL, buf, sizeof(buf), &n));
+      json_out(out, buf, n);
+      break;
+    }
+    default: {
+      char *vp;
+      for (vp = v7->json_visited_stack.buf;
+           vp < v7->json_visited_stack.buf + v7->json_visited_stack.len;
+           vp += sizeof(val_t)) {
+        if (*(val_t *) vp == v) {
+          rcode = v7_throwf(v7, TYPE_ERROR, "Cyclic object value");
+          goto clean;
+        }
+      }
+
+      mbuf_append(&v7->json_visited_stack, (char *) &v, sizeof(v));
+      rcode = json_out_object(out, v);
+      v7->json_visited_stack.len -= sizeof(v);
+      break;
+    }
+  }
+
+clean:
+  return rcode;
+}
+
+WARN_UNUSED_RESULT
+V7_PRIVATE enum v7_err json_stringify(struct v7 *v7, val_t v, val_t replacer,
+                                      val_t space, v7_stringify_cb_t *cb,
+                                      void *user_data, int *emitted) {
+  enum v7_err rcode = V7_OK;
+  struct gc_tmp_frame tf = new_tmp_frame(v7);
+  struct json_out out;
+  val_t holder = V7_UNDEFINED, name = V7_UNDEFINED;
+  size_t saved_visited_len = v7->json_visited_stack.len;
+
+  memset(&out, 0, sizeof(out));
+  out.v7 = v7;
+  out.cb = cb;
+  out.user_data = user_data;
+  out.replacer = V7_UNDEFINED;
+  out.prop_list = V7_UNDEFINED;
+
+  tmp_stack_push(&tf, &v);
+  tmp_stack_push(&tf, &replacer);
+  tmp_stack_push(&tf, &space);
+  tmp_stack_push(&tf, &holder);
+  tmp_stack_push(&tf, &name);
+  tmp_stack_push(&tf, &out.replacer);
+  tmp_stack_push(&tf, &out.prop_list);
+
+  *emitted = 0;
+
+  if (v7_is_callable(v7, replacer)) {
+    out.replacer = replacer;
+  } else if (v7_is_array(v7, replacer)) {
+    /* collect unique property names in the order of the array */
+    unsigned long i, j, len = v7_array_length(v7, replacer);
+    out.prop_list = v7_mk_dense_array(v7);
+    for (i = 0; i < len; i++) {
+      name = v7_array_get(v7, replacer, i);
+      switch (val_type(v7, name)) {
+        case V7_TYPE_STRING:
+        case V7_TYPE_NUMBER:
+        case V7_TYPE_STRING_OBJECT:
+        case V7_TYPE_NUMBER_OBJECT:
+          V7_TRY(to_string(v7, name, &name, NULL, 0, NULL));
+          break;
+        default:
+          continue;
+      }
+      for (j = 0; j < v7_array_length(v7, out.prop_list); j++) {
+        if (s_cmp(v7, name, v7_array_get(v7, out.prop_list, j)) == 0) break;
+      }
+      if (j == v7_array_length(v7, out.prop_list)) {
+        v7_array_push(v7, out.prop_list, name);
+      }
+    }
+  }
+
+  if (val_type(v7, space) == V7_TYPE_NUMBER_OBJECT ||
+      val_type(v7, space) == V7_TYPE_STRING_OBJECT) {
+    V7_TRY(obj_value_of(v7, space, &space));
+  }
+  if (v7_is_number(space)) {
+    double n = v7_get_double(v7, space);
+    int i;
+    for (i = 0; i < 10 && i < n; i++) {
+      out.gap[i] = ' ';
+    }
+  } else if (v7_is_string(space)) {
+    size_t n;
+    const char *s = v7_get_string(v7, &space, &n);
+    memcpy(out.gap, s, n < 10 ? n : 10);
+  }
+
+  if (!v7_is_undefined(out.replacer)) {
+    /* the replacer is called with the wrapper object as `this` */
+    holder = v7_mk_object(v7);
+    V7_TRY(set_property(v7, holder, "", 0, v, NULL));
+  }
+  V7_TRY(json_prepare_value(&out, holder, v7_mk_string(v7, "", 0, 1), &v));
+  if (!should_skip_for_json(val_type(v7, v))) {
+    V7_TRY(json_out_value(&out, v));
+    json_out_flush(&out);
+    *emitted = 1;
+  }
+
+clean:
+  v7->json_visited_stack.len = saved_visited_len;
+  tmp_frame_cleanup(&tf);
+  return rcode;
+}
+
+static void json_mbuf_cb(const char *data, size_t len, void *user_data) {
+  mbuf_append((struct mbuf *) user_data, data, len);
+}
+
+WARN_UNUSED_RESULT
+V7_PRIVATE enum v7_err json_stringify_to_mbuf(struct v7 *v7, val_t v,
+                                              val_t replacer, val_t space,
+                                              struct mbuf *m, int *emitted) {
+  return json_stringify(v7, v, replacer, space, json_mbuf_cb, m, emitted);
+}
+
+enum v7_err v7_stringify_to_cb(struct v7 *v7, v7_val_t v,
+                               v7_stringify_cb_t *cb, void *user_data) {
+  int emitted;
+  return json_stringify(v7, v, V7_UNDEFINED, V7_UNDEFINED, cb, user_data,
+                        &emitted);
+}
+
 WARN_UNUSED_RESULT
 V7_PRIVATE val_t to_boolean_v(struct v7 *v7, val_t v) {
   size_t len;
@@ -19547,9 +24059,29 @@ enum v7_err v7_stringify_throwing(struct v7 *v7, val_t v, char *buf,
       V7_TRY(to_string(v7, v, NULL, buf, size, &len));
       break;
 
-    case V7_STRINGIFY_JSON:
-      V7_TRY(to_json_or_debug(v7, v, buf, size, &len, 0));
-      break;
+    case V7_STRINGIFY_JSON: {
+      struct mbuf m;
+      int emitted;
+      mbuf_init(&m, 0);
+      rcode = json_stringify_to_mbuf(v7, v, V7_UNDEFINED, V7_UNDEFINED, &m,
+                                     &emitted);
+      if (rcode != V7_OK) {
+        mbuf_free(&m);
+        goto clean;
+      }
+      if (m.len < size) {
+        memcpy(buf, m.buf, m.len);
+        buf[m.len] = '\0';
+        mbuf_free(&m);
+      } else {
+        /* hand the mbuf data over to the caller */
+        mbuf_append(&m, "", 1);
+        mbuf_trim(&m);
+        p = m.buf;
+      }
+      *res = p;
+      goto clean;
+    }
 
     case V7_STRINGIFY_DEBUG:
       V7_TRY(to_json_or_debug(v7, v, buf, size, &len, 1));
@@ -19646,6 +24178,8 @@ V7_PRIVATE void *shdata_get_payload(struct shdata *p) {
 /* Amalgamated: #include "v7/src/util.h" */
 /* Amalgamated: #include "v7/src/primitive.h" */
 /* Amalgamated: #include "v7/src/heapusage.h" */
+/* Amalgamated: #include "v7/src/stats.h" */
+/* Amalgamated: #include "v7/src/heaplog.h" */
 
 #include <stdio.h>
 
@@ -19653,10 +24187,15 @@ V7_PRIVATE void *shdata_get_payload(struct shdata *p) {
 void *v7_sp_limit = NULL;
 #endif
 
-void gc_mark_string(struct v7 *, val_t *);
-
 static struct gc_block *gc_new_block(struct gc_arena *a, size_t size);
 static void gc_free_block(struct gc_block *b);
+#ifndef V7_MALLOC_GC
+static struct gc_block *gc_find_block(const struct gc_arena *a,
+                                      const void *ptr);
+#endif
+#ifdef V7_ENABLE_INCREMENTAL_GC
+static int gc_set_mark_bit(const struct gc_arena *a, const void *ptr);
+#endif
 static void gc_mark_mbuf_pt(struct v7 *v7, const struct mbuf *mbuf);
 static void gc_mark_mbuf_val(struct v7 *v7, const struct mbuf *mbuf);
 static void gc_mark_vec_val(struct v7 *v7, const struct v7_vec *vec);
@@ -19721,7 +24260,58 @@ V7_PRIVATE void gc_arena_destroy(struct v7 *v7, struct gc_arena *a) {
   }
 }
 
+#ifdef V7_ENABLE_SNAPSHOT
+V7_PRIVATE struct gc_cell *gc_arena_reset(struct gc_arena *a, size_t n) {
+  struct gc_block *b;
+
+  for (b = a->blocks; b != NULL;) {
+    struct gc_block *tmp = b;
+    b = b->next;
+    gc_free_block(tmp);
+  }
+  a->blocks = NULL;
+  a->free = NULL;
+#ifdef V7_ENABLE_INCREMENTAL_GC
+  a->sweep_block = NULL;
+  a->sweep_idx = 0;
+#endif
+#if V7_ENABLE__Memory__stats
+  a->alive = 0;
+#endif
+
+  if (n == 0) return NULL;
+  a->blocks = gc_new_block(a, n);
+  a->free = NULL;
+  return a->blocks->base;
+}
+
+V7_PRIVATE void gc_arena_relink(struct gc_arena *a) {
+  struct gc_block *b;
+  struct gc_cell *cur;
+
+  a->free = NULL;
+  for (b = a->blocks; b != NULL; b = b->next) {
+    for (cur = GC_CELL_OP(a, b->base, +, b->size); cur > b->base;) {
+      cur = GC_CELL_OP(a, cur, -, 1);
+      if (!MARKED_FREE(cur)) {
+#if V7_ENABLE__Memory__stats
+        a->alive++;
+        a->allocations++;
+#endif
+        continue;
+      }
+      cur->head.link = a->free;
+      MARK_FREE(cur);
+      a->free = cur;
+    }
+  }
+}
+#endif
+
 static void gc_free_block(struct gc_block *b) {
+#ifdef V7_ENABLE_INCREMENTAL_GC
+  free(b->marks);
+#endif
   free(b->base);
   free(b);
 }
@@ -19741,10 +24331,18 @@ static struct gc_block *gc_new_block(struct gc_arena *a, size_t size) {
   heapusage_dont_count(0);
   if (b->base == NULL) abort();
 
+#ifdef V7_ENABLE_INCREMENTAL_GC
+  heapusage_dont_count(1);
+  b->marks = (uint8_t *) calloc((b->size + 7) / 8, 1);
+  heapusage_dont_count(0);
+  if (b->marks == NULL) abort();
+#endif
+
   for (cur = GC_CELL_OP(a, b->base, +, 0);
        cur < GC_CELL_OP(a, b->base, +, b->size);
        cur = GC_CELL_OP(a, cur, +, 1)) {
     cur->head.link = a->free;
+    MARK_FREE(cur);
     a->free = cur;
   }
 
@@ -19759,9 +24357,19 @@ V7_PRIVATE void *gc_alloc_cell(struct v7 *v7, struct gc_arena *a) {
   r = (struct gc_cell *) calloc(1, a->cell_size);
   heapusage_dont_count(0);
   mbuf_append(&v7->malloc_trace, &r, sizeof(r));
+#ifdef V7_ENABLE_HEAPLOG
+  if (v7->heaplog != NULL) {
+    heaplog_alloc_cell(v7, a, r);
+  }
+#endif
   return r;
 #else
   struct gc_cell *r;
+#ifdef V7_GC_STRESS
+  if (!v7->inhibit_gc) {
+    v7_gc(v7, 0);
+  }
+#endif
   if (a->free == NULL) {
     maybe_gc(v7);
 
@@ -19773,9 +24381,7 @@ V7_PRIVATE void *gc_alloc_cell(struct v7 *v7, struct gc_arena *a) {
   }
   r = a->free;
 
-  UNMARK(r);
-
-  a->free = r->head.link;
+  a->free = FREE_LINK(r);
 
 #if V7_ENABLE__Memory__stats
   a->allocations++;
@@ -19787,6 +24393,18 @@ V7_PRIVATE void *gc_alloc_cell(struct v7 *v7, struct gc_arena *a) {
    * are overwritten downstream, but not worth the yak shave time
    * when fields are added to GC-able structures */
   memset(r, 0, a->cell_size);
+
+#ifdef V7_ENABLE_INCREMENTAL_GC
+  if (v7->gc_phase == GC_PHASE_SWEEP) {
+    /* the sweeper must not reclaim cells allocated behind its back */
+    gc_set_mark_bit(a, r);
+  }
+#endif
+#ifdef V7_ENABLE_HEAPLOG
+  if (v7->heaplog != NULL) {
+    heaplog_alloc_cell(v7, a, r);
+  }
+#endif
   return (void *) r;
 #endif
 }
@@ -19806,6 +24424,11 @@ void gc_sweep_malloc(struct v7 *v7) {
     if (MARKED(*cur)) {
       UNMARK(*cur);
     } else {
+#ifdef V7_ENABLE_HEAPLOG
+      if (v7->heaplog != NULL) {
+        heaplog_free_cell(v7, *cur);
+      }
+#endif
       free(*cur);
       /* TODO(mkm): compact malloc trace buffer */
       *cur = NULL;
@@ -19829,16 +24452,9 @@ void gc_sweep(struct v7 *v7, struct gc_arena *a, size_t start) {
 #endif
 
   /*
-   * Before we sweep, we should mark all free cells in a way that is
+   * Free cells are always marked with `MARK_FREE()`, so they are
    * distinguishable from marked used cells.
    */
-  {
-    struct gc_cell *next;
-    for (cur = a->free; cur != NULL; cur = next) {
-      next = cur->head.link;
-      MARK_FREE(cur);
-    }
-  }
 
   /*
    * We'll rebuild the whole `free` list, so initially we just reset it
@@ -19870,10 +24486,7 @@ void gc_sweep(struct v7 *v7, struct gc_arena *a, size_t start) {
          * - garbage that's about to be freed
          */
 
-        if (MARKED_FREE(cur)) {
-          /* The cell is free, so, just unmark it */
-          UNMARK_FREE(cur);
-        } else {
+        if (!MARKED_FREE(cur)) {
           /*
            * The cell is used and should be freed: call the destructor and
            * reset the memory
@@ -19881,11 +24494,17 @@ void gc_sweep(struct v7 *v7, struct gc_arena *a, size_t start) {
           if (a->destructor != NULL) {
             a->destructor(v7, cur);
           }
+#ifdef V7_ENABLE_HEAPLOG
+          if (v7->heaplog != NULL) {
+            heaplog_free_cell(v7, cur);
+          }
+#endif
           memset(cur, 0, a->cell_size);
         }
 
         /* Add this cell to the `free` list */
         cur->head.link = a->free;
+        MARK_FREE(cur);
         a->free = cur;
         freed_in_block++;
 #if V7_ENABLE__Memory__stats
@@ -19911,40 +24530,84 @@ void gc_sweep(struct v7 *v7, struct gc_arena *a, size_t start) {
   }
 }
 
+#ifndef V7_MALLOC_GC
 /*
- * dense arrays contain only one property pointing to an mbuf with array values.
+ * Makes sure that at least an eighth of the arena is free after a collection,
+ * adding a block if needed. Otherwise, once live cells fill up the arena, each
+ * of the next few allocations would trigger another collection.
  */
-V7_PRIVATE void gc_mark_dense_array(struct v7 *v7,
-                                    struct v7_generic_object *obj) {
-  val_t v;
-  struct mbuf *mbuf;
-  val_t *vp;
+static void gc_reserve_cells(struct gc_arena *a) {
+  struct gc_block *b;
+  struct gc_cell *cur;
+  size_t total = 0, nfree = 0;
 
-#if 0
-  /* TODO(mkm): use this when dense array promotion is implemented */
-  v = obj->properties->value;
-#else
-  v = v7_get(v7, v7_object_to_value(&obj->base), "", 0);
-#endif
+  for (b = a->blocks; b != NULL; b = b->next) {
+    total += b->size;
+  }
+  for (cur = a->free; cur != NULL && nfree < total / 8; cur = FREE_LINK(cur)) {
+    nfree++;
+  }
 
-  mbuf = (struct mbuf *) v7_get_ptr(v7, v);
+  if (nfree < total / 8) {
+    size_t size = total / 8 - nfree;
+    b = gc_new_block(a, size > a->size_increment ? size : a->size_increment);
+    b->next = a->blocks;
+    a->blocks = b;
+  }
+}
+#endif
 
-  /* function scope pointer is aliased to the object's prototype pointer */
-  gc_mark(v7, v7_object_to_value(obj_prototype(v7, &obj->base)));
-  MARK(obj);
+/*
+ * dense arrays keep their elements in an mbuf referenced by a hidden property;
+ * the mbuf is looked up by the caller before the property list gets marked.
+ */
+V7_PRIVATE void gc_mark_dense_array(struct v7 *v7, struct mbuf *mbuf) {
+  val_t *vp;
 
-  if (mbuf == NULL) return;
   for (vp = (val_t *) mbuf->buf; (char *) vp < mbuf->buf + mbuf->len; vp++) {
     gc_mark(v7, *vp);
     gc_mark_string(v7, vp);
   }
-  UNMARK(obj);
 }
 
+#ifndef V7_DISABLE_STRING_ROPES
+/*
+ * Marks the rope nodes and the strings they refer to. Open ropes are lists
+ * linked through the left side, which is followed iteratively.
+ */
+static void gc_mark_rope(struct v7 *v7, val_t v) {
+  while ((v & V7_TAG_MASK) == V7_TAG_STRING_R) {
+    struct v7_property *r = (struct v7_property *) get_ptr(v);
+
+    if (!gc_check_ptr(&v7->property_arena, r)) {
+      abort();
+    }
+
+    if (MARKED(r)) return;
+    MARK(r);
+
+    /* the right side is either a flat string or a flattened rope */
+    gc_mark(v7, r->value);
+    gc_mark_string(v7, &r->value);
+
+    v = r->name;
+    gc_mark_string(v7, &r->name);
+  }
+}
+#endif
+
 V7_PRIVATE void gc_mark(struct v7 *v7, val_t v) {
   struct v7_object *obj_base;
   struct v7_property *prop;
   struct v7_property *next;
+  struct mbuf *abuf = NULL;
+
+#ifndef V7_DISABLE_STRING_ROPES
+  if ((v & V7_TAG_MASK) == V7_TAG_STRING_R) {
+    gc_mark_rope(v7, v);
+    return;
+  }
+#endif
 
   if (!v7_is_object(v)) {
     return;
@@ -19976,8 +24639,8 @@ V7_PRIVATE void gc_mark(struct v7 *v7, val_t v) {
 #endif
 
   if (obj_base->attributes & V7_OBJ_DENSE_ARRAY) {
-    struct v7_generic_object *obj = get_generic_object_struct(v);
-    gc_mark_dense_array(v7, obj);
+    /* marking sets the low bit of `next` pointers: look it up beforehand */
+    abuf = dense_array_buf(v7, v);
   }
 
   /* mark object itself, and its properties */
@@ -20005,6 +24668,10 @@ V7_PRIVATE void gc_mark(struct v7 *v7, val_t v) {
     MARK(prop);
   }
 
+  if (abuf != NULL) {
+    gc_mark_dense_array(v7, abuf);
+  }
+
   /* mark object's prototype */
   gc_mark(v7, obj_prototype_v(v7, v));
 
@@ -20081,6 +24748,10 @@ int v7_heap_stat(struct v7 *v7, enum v7_heap_stat_what what) {
       return v7->owned_values.len / sizeof(val_t *);
     case V7_HEAP_STAT_FUNC_OWNED_MAX:
       return v7->owned_values.size / sizeof(val_t *);
+    case V7_HEAP_STAT_ARRAY_SPARSE_TO_DENSE:
+      return v7->array_sparse_to_dense;
+    case V7_HEAP_STAT_ARRAY_DENSE_TO_SPARSE:
+      return v7->array_dense_to_sparse;
   }
 
   return -1;
@@ -20252,6 +24923,9 @@ void gc_compact_strings(struct v7 *v7) {
   char *p = v7->owned_strings.buf + 1;
   uint64_t h, next, head = 1;
   int len, llen;
+#ifdef V7_ENABLE_HEAPLOG
+  struct heaplog_compact_ctx hctx = {0, 0};
+#endif
 
 #ifndef V7_DISABLE_STR_ALLOC_SEQ
   v7->gc_min_asn = v7->gc_next_asn;
@@ -20287,7 +24961,7 @@ void gc_compact_strings(struct v7 *v7) {
        * the tail contains the first 6 bytes we stole from
        * the actual string.
        */
-      len = decode_varint((unsigned char *) &h, &llen);
+      len = decode_varint((unsigned char *) &h, &llen) >> _V7_OSTR_FLAGS_BITS;
       len += llen + 1;
 
       /*
@@ -20296,6 +24970,10 @@ void gc_compact_strings(struct v7 *v7) {
        */
       memcpy(p, &h, sizeof(h) - 2);
 
+#ifdef V7_ENABLE_HEAPLOG
+      heaplog_compact_str(v7, &hctx, p - v7->owned_strings.buf, head, 1);
+#endif
+
       /*
        * and relocate the string data by packing it to the left.
        */
@@ -20308,12 +24986,18 @@ void gc_compact_strings(struct v7 *v7) {
       p += len;
       head += len;
     } else {
-      len = decode_varint((unsigned char *) p, &llen);
+      len = decode_varint((unsigned char *) p, &llen) >> _V7_OSTR_FLAGS_BITS;
       len += llen + 1;
 
+#ifdef V7_ENABLE_HEAPLOG
+      heaplog_compact_str(v7, &hctx, p - v7->owned_strings.buf, 0, 0);
+#endif
       p += len;
     }
   }
+#ifdef V7_ENABLE_HEAPLOG
+  heaplog_compact_done(v7, &hctx);
+#endif
 
 #if defined(V7_GC_VERBOSE) && !defined(V7_DISABLE_STR_ALLOC_SEQ)
   fprintf(stderr, "GC valid ASN range: [%d,%d)\n", v7->gc_min_asn,
@@ -20355,6 +25039,22 @@ V7_PRIVATE void compute_need_gc(struct v7 *v7) {
 
 V7_PRIVATE void maybe_gc(struct v7 *v7) {
   if (!v7->inhibit_gc) {
+#ifdef V7_ENABLE_INCREMENTAL_GC
+    /*
+     * Strings are compacted by full collections only, so the string heap
+     * pressure still results in a stop-the-world collection.
+     */
+    if (!v7->need_gc) {
+#ifdef V7_ENABLE_STATS
+      double start_us = stats_now_us();
+#endif
+      gc_step(v7, V7_GC_STEP_BUDGET);
+#ifdef V7_ENABLE_STATS
+      stats_count_gc(v7, 1, start_us);
+#endif
+      return;
+    }
+#endif
     v7_gc(v7, 0);
   }
 }
@@ -20362,14 +25062,30 @@ V7_PRIVATE void maybe_gc(struct v7 *v7) {
 static int gc_pass = 0;
 #endif
 
+/*
+ * mark a value slot: the value itself, and the string it points to, if any.
+ *
+ * Incremental cycles leave strings alone and just queue objects for
+ * scanning.
+ */
+static void gc_mark_slot(struct v7 *v7, val_t *vp) {
+#ifdef V7_ENABLE_INCREMENTAL_GC
+  if (v7->gc_phase == GC_PHASE_MARK) {
+    gc_shade(v7, *vp);
+    return;
+  }
+#endif
+  gc_mark(v7, *vp);
+  gc_mark_string(v7, vp);
+}
+
 /*
  * mark an array of `val_t` values (*not pointers* to them)
  */
 static void gc_mark_val_array(struct v7 *v7, val_t *vals, size_t len) {
   val_t *vp;
   for (vp = vals; vp < vals + len; vp++) {
-    gc_mark(v7, *vp);
-    gc_mark_string(v7, vp);
+    gc_mark_slot(v7, vp);
   }
 }
 
@@ -20379,8 +25095,7 @@ static void gc_mark_val_array(struct v7 *v7, val_t *vals, size_t len) {
 static void gc_mark_mbuf_pt(struct v7 *v7, const struct mbuf *mbuf) {
   val_t **vp;
   for (vp = (val_t **) mbuf->buf; (char *) vp < mbuf->buf + mbuf->len; vp++) {
-    gc_mark(v7, **vp);
-    gc_mark_string(v7, *vp);
+    gc_mark_slot(v7, *vp);
   }
 }
 
@@ -20450,6 +25165,301 @@ static void gc_mark_call_stack(struct v7 *v7,
   }
 }
 
+/*
+ * mark everything directly reachable from the interpreter state
+ */
+static void gc_mark_roots(struct v7 *v7) {
+  gc_mark_call_stack(v7, v7->call_stack);
+
+  gc_mark_val_array(v7, (val_t *) &v7->vals, sizeof(v7->vals) / sizeof(val_t));
+  /* mark all items on bcode stack */
+  gc_mark_mbuf_val(v7, &v7->stack);
+
+  /* mark literals and names of all the active bcodes */
+  gc_mark_mbuf_bcode_pt(v7, &v7->act_bcodes);
+
+#ifndef V7_DISABLE_STREAMING_COMPILE
+  if (v7->stream_ast != NULL) {
+    const struct mbuf *funcs = &v7->stream_ast->funcs;
+    struct ast_compiled_func *f;
+    for (f = (struct ast_compiled_func *) funcs->buf;
+         (char *) f < funcs->buf + funcs->len; f++) {
+      gc_mark_vec_val(v7, &f->bcode->lit);
+    }
+  }
+#endif
+
+  gc_mark_mbuf_pt(v7, &v7->tmp_stack);
+  gc_mark_mbuf_pt(v7, &v7->owned_values);
+}
+
+#ifdef V7_ENABLE_INCREMENTAL_GC
+
+/*
+ * Incremental GC.
+ *
+ * A cycle is split in steps of bounded work, run by `maybe_gc()` at bcode
+ * safepoints (see `bcode_gc_safepoint()`) and when an arena runs out of free
+ * cells:
+ *
+ * - `GC_PHASE_MARK`: objects are marked in the per-block side bitmaps (the
+ *   in-cell mark bits can't be used, since the mutator keeps reading the
+ *   words they live in), and queued on the gray stack; each step scans a
+ *   few queued objects. The write barrier (`GC_WRITE_BARRIER()`) marks the
+ *   values stored into the heap meanwhile. Roots are not covered by the
+ *   barrier, so the phase ends with an atomic rescan of the roots.
+ * - `GC_PHASE_SWEEP`: unmarked cells are reclaimed, a few at a time. Cells
+ *   allocated during this phase are marked by `gc_alloc_cell()`.
+ *
+ * Strings are not traced (rope nodes are, since they are cells); they are
+ * compacted by the stop-the-world collection, which `maybe_gc()` still
+ * performs when the string heap fills up, and which is also what `v7_gc()`
+ * always does.
+ */
+
+/*
+ * Sets the side mark bit of the given cell. Returns 1 if it wasn't set
+ * before.
+ */
+static int gc_set_mark_bit(const struct gc_arena *a, const void *ptr) {
+  struct gc_block *b = gc_find_block(a, ptr);
+  size_t i;
+  uint8_t mask;
+
+  if (b == NULL) {
+    abort();
+  }
+
+  i = ((const char *) ptr - (const char *) b->base) / a->cell_size;
+  mask = 1 << (i & 7);
+  if (b->marks[i >> 3] & mask) {
+    return 0;
+  }
+  b->marks[i >> 3] |= mask;
+  return 1;
+}
+
+V7_PRIVATE void gc_shade(struct v7 *v7, val_t v) {
+  struct v7_object *obj_base;
+
+#ifndef V7_DISABLE_STRING_ROPES
+  if ((v & V7_TAG_MASK) == V7_TAG_STRING_R) {
+    if (gc_set_mark_bit(&v7->property_arena, get_ptr(v))) {
+      mbuf_append(&v7->gc_gray, &v, sizeof(v));
+    }
+    return;
+  }
+#endif
+
+  if (!v7_is_object(v)) {
+    return;
+  }
+  obj_base = get_object_struct(v);
+
+  if (obj_base->attributes & V7_OBJ_OFF_HEAP) {
+    return;
+  }
+
+  if (gc_set_mark_bit(is_js_function(v) ? &v7->function_arena
+                                        : &v7->generic_object_arena,
+                      obj_base)) {
+    mbuf_append(&v7->gc_gray, &v, sizeof(v));
+  }
+}
+
+V7_PRIVATE void gc_shade_prop(struct v7 *v7, struct v7_property *p) {
+  if (p->attributes & _V7_PROPERTY_OFF_HEAP) {
+    return;
+  }
+  gc_set_mark_bit(&v7->property_arena, p);
+  gc_shade(v7, p->value);
+}
+
+/*
+ * Scans the object taken from the gray stack. Returns the amount of work
+ * done.
+ */
+static size_t gc_inc_scan(struct v7 *v7, val_t v) {
+  struct v7_object *obj_base;
+  struct v7_property *prop;
+  size_t work = 1;
+
+#ifndef V7_DISABLE_STRING_ROPES
+  if ((v & V7_TAG_MASK) == V7_TAG_STRING_R) {
+    prop = (struct v7_property *) get_ptr(v);
+    gc_shade(v7, prop->name);
+    gc_shade(v7, prop->value);
+    return work;
+  }
+#endif
+
+  obj_base = get_object_struct(v);
+
+  if (obj_base->attributes & V7_OBJ_DENSE_ARRAY) {
+    struct mbuf *mbuf = dense_array_buf(v7, v);
+    if (mbuf != NULL) {
+      gc_mark_mbuf_val(v7, mbuf);
+      work += mbuf->len / sizeof(val_t);
+    }
+  }
+
+  for (prop = obj_base->properties; prop != NULL; prop = prop->next) {
+    if (prop->attributes & _V7_PROPERTY_OFF_HEAP) {
+      break;
+    }
+    gc_shade_prop(v7, prop);
+    work++;
+  }
+
+  gc_shade(v7, obj_prototype_v(v7, v));
+
+  if (is_js_function(v)) {
+    struct v7_js_function *func = get_js_function_struct(v);
+
+    gc_shade(v7, v7_object_to_value(&func->scope->base));
+
+    if (func->bcode != NULL) {
+      gc_mark_vec_val(v7, &func->bcode->lit);
+      work += func->bcode->lit.len / sizeof(val_t);
+    }
+  }
+
+  return work;
+}
+
+/*
+ * Scans objects from the gray stack until it's empty or the budget is
+ * exhausted. Returns the budget left.
+ */
+static size_t gc_inc_mark(struct v7 *v7, size_t budget) {
+  while (budget > 0 && v7->gc_gray.len > 0) {
+    val_t v;
+    size_t work;
+
+    v7->gc_gray.len -= sizeof(v);
+    memcpy(&v, v7->gc_gray.buf + v7->gc_gray.len, sizeof(v));
+
+    work = gc_inc_scan(v7, v);
+    budget -= (work < budget) ? work : budget;
+  }
+  return budget;
+}
+
+/*
+ * Reclaims unmarked cells of the arena, starting from the sweep position.
+ * Returns the budget left, which is non-zero only if the arena is done.
+ */
+static size_t gc_inc_sweep(struct v7 *v7, struct gc_arena *a, size_t budget) {
+  int freed = 0;
+
+  while (budget > 0 && a->sweep_block != NULL) {
+    struct gc_block *b = a->sweep_block;
+
+    for (; budget > 0 && a->sweep_idx < b->size; a->sweep_idx++, budget--) {
+      size_t i = a->sweep_idx;
+      struct gc_cell *cur = GC_CELL_OP(a, b->base, +, i);
+
+      if ((b->marks[i >> 3] & (1 << (i & 7))) || MARKED_FREE(cur)) {
+        continue;
+      }
+
+      if (a->destructor != NULL) {
+        a->destructor(v7, cur);
+      }
+#ifdef V7_ENABLE_HEAPLOG
+      if (v7->heaplog != NULL) {
+        heaplog_free_cell(v7, cur);
+      }
+#endif
+      memset(cur, 0, a->cell_size);
+
+      cur->head.link = a->free;
+      MARK_FREE(cur);
+      a->free = cur;
+      freed = 1;
+#if V7_ENABLE__Memory__stats
+      a->alive--;
+      a->garbage++;
+#endif
+    }
+
+    if (a->sweep_idx == b->size) {
+      a->sweep_block = b->next;
+      a->sweep_idx = 0;
+    }
+  }
+
+#ifndef V7_DISABLE_INLINE_CACHE
+  if (freed) {
+    v7->ic_epoch++;
+  }
+#else
+  (void) freed;
+#endif
+
+  return budget;
+}
+
+static void gc_inc_clear_marks(struct gc_arena *a) {
+  struct gc_block *b;
+  for (b = a->blocks; b != NULL; b = b->next) {
+    memset(b->marks, 0, (b->size + 7) / 8);
+  }
+}
+
+static void gc_inc_start_sweep(struct gc_arena *a) {
+  a->sweep_block = a->blocks;
+  a->sweep_idx = 0;
+}
+
+V7_PRIVATE void gc_step(struct v7 *v7, size_t budget) {
+  switch (v7->gc_phase) {
+    case GC_PHASE_IDLE:
+      gc_inc_clear_marks(&v7->generic_object_arena);
+      gc_inc_clear_marks(&v7->function_arena);
+      gc_inc_clear_marks(&v7->property_arena);
+
+      v7->gc_gray.len = 0;
+      v7->gc_phase = GC_PHASE_MARK;
+      gc_mark_roots(v7);
+      break;
+
+    case GC_PHASE_MARK:
+      if (gc_inc_mark(v7, budget) == 0) {
+        break;
+      }
+
+      /*
+       * Gray stack is drained: rescan the roots and finish marking in one
+       * go.
+       */
+      gc_mark_roots(v7);
+      gc_inc_mark(v7, ~((size_t) 0));
+
+      gc_inc_start_sweep(&v7->generic_object_arena);
+      gc_inc_start_sweep(&v7->function_arena);
+      gc_inc_start_sweep(&v7->property_arena);
+      v7->gc_phase = GC_PHASE_SWEEP;
+      break;
+
+    case GC_PHASE_SWEEP:
+      /*
+       * Arenas are swept in the same order as by `v7_gc()`: object
+       * destructors need the properties to be still there.
+       */
+      budget = gc_inc_sweep(v7, &v7->generic_object_arena, budget);
+      budget = gc_inc_sweep(v7, &v7->function_arena, budget);
+      budget = gc_inc_sweep(v7, &v7->property_arena, budget);
+
+      if (budget > 0) {
+        v7->gc_phase = GC_PHASE_IDLE;
+      }
+      break;
+  }
+}
+
+#endif /* V7_ENABLE_INCREMENTAL_GC */
+
 /* Perform garbage collection */
 void v7_gc(struct v7 *v7, int full) {
 #ifdef V7_DISABLE_GC
@@ -20457,28 +25467,37 @@ void v7_gc(struct v7 *v7, int full) {
   (void) full;
   return;
 #else
+#ifdef V7_ENABLE_STATS
+  double start_us = stats_now_us();
+#endif
 
 #if defined(V7_GC_VERBOSE)
   fprintf(stderr, "V7 GC pass %d\n", ++gc_pass);
 #endif
 
+#ifdef V7_ENABLE_INCREMENTAL_GC
+  /*
+   * Stop-the-world collection supersedes the incremental cycle in progress,
+   * if any: side mark bits are reset when the next cycle starts.
+   */
+  v7->gc_phase = GC_PHASE_IDLE;
+  v7->gc_gray.len = 0;
+#endif
+
   gc_dump_arena_stats("Before GC objects", &v7->generic_object_arena);
   gc_dump_arena_stats("Before GC functions", &v7->function_arena);
   gc_dump_arena_stats("Before GC properties", &v7->property_arena);
 
-  gc_mark_call_stack(v7, v7->call_stack);
-
-  gc_mark_val_array(v7, (val_t *) &v7->vals, sizeof(v7->vals) / sizeof(val_t));
-  /* mark all items on bcode stack */
-  gc_mark_mbuf_val(v7, &v7->stack);
-
-  /* mark literals and names of all the active bcodes */
-  gc_mark_mbuf_bcode_pt(v7, &v7->act_bcodes);
-
-  gc_mark_mbuf_pt(v7, &v7->tmp_stack);
-  gc_mark_mbuf_pt(v7, &v7->owned_values);
+  gc_mark_roots(v7);
 
+#ifndef V7_DISABLE_STRING_INTERNING
+  gc_sweep_interned(v7);
+#endif
   gc_compact_strings(v7);
+#ifndef V7_DISABLE_STRING_RUNE_INDEX
+  /* indexed strings might have been moved */
+  rune_index_reset(v7);
+#endif
 
 #ifdef V7_MALLOC_GC
   gc_sweep_malloc(v7);
@@ -20486,6 +25505,15 @@ void v7_gc(struct v7 *v7, int full) {
   gc_sweep(v7, &v7->generic_object_arena, 0);
   gc_sweep(v7, &v7->function_arena, 0);
   gc_sweep(v7, &v7->property_arena, 0);
+
+  gc_reserve_cells(&v7->generic_object_arena);
+  gc_reserve_cells(&v7->function_arena);
+  gc_reserve_cells(&v7->property_arena);
+#endif
+
+#ifndef V7_DISABLE_INLINE_CACHE
+  /* objects and strings might have been freed or moved: drop inline caches */
+  v7->ic_epoch++;
 #endif
 
   gc_dump_arena_stats("After GC objects", &v7->generic_object_arena);
@@ -20504,7 +25532,23 @@ void v7_gc(struct v7 *v7, int full) {
       mbuf_resize(&v7->owned_strings, trimmed_size);
       heapusage_dont_count(0);
     }
+  } else if (v7->owned_strings.size <
+             v7->owned_strings.len + v7->owned_strings.len / 4) {
+    /*
+     * Live strings almost fill the buffer (see `compute_need_gc()`): grow it
+     * in proportion to them, otherwise each of the next few string allocations
+     * would trigger another collection.
+     */
+    heapusage_dont_count(1);
+    mbuf_resize(&v7->owned_strings, v7->owned_strings.len +
+                                        v7->owned_strings.len / 4 +
+                                        _V7_STRING_BUF_RESERVE);
+    heapusage_dont_count(0);
   }
+
+#ifdef V7_ENABLE_STATS
+  stats_count_gc(v7, 0, start_us);
+#endif
 #endif /* V7_DISABLE_GC */
 }
 
@@ -20517,20 +25561,28 @@ V7_PRIVATE int gc_check_val(struct v7 *v7, val_t v) {
   return 1;
 }
 
-V7_PRIVATE int gc_check_ptr(const struct gc_arena *a, const void *ptr) {
-#ifdef V7_MALLOC_GC
-  (void) a;
-  (void) ptr;
-  return 1;
-#else
+#ifndef V7_MALLOC_GC
+/* returns the block which contains the given pointer, or NULL */
+static struct gc_block *gc_find_block(const struct gc_arena *a,
+                                      const void *ptr) {
   const struct gc_cell *p = (const struct gc_cell *) ptr;
   struct gc_block *b;
   for (b = a->blocks; b != NULL; b = b->next) {
     if (p >= b->base && p < GC_CELL_OP(a, b->base, +, b->size)) {
-      return 1;
+      return b;
     }
   }
-  return 0;
+  return NULL;
+}
+#endif
+
+V7_PRIVATE int gc_check_ptr(const struct gc_arena *a, const void *ptr) {
+#ifdef V7_MALLOC_GC
+  (void) a;
+  (void) ptr;
+  return 1;
+#else
+  return gc_find_block(a, ptr) != NULL;
 #endif
 }
 #ifdef V7_MODULE_LINES
@@ -20546,6 +25598,7 @@ V7_PRIVATE int gc_check_ptr(const struct gc_arena *a, const void *ptr) {
 /* Amalgamated: #include "v7/src/util.h" */
 /* Amalgamated: #include "v7/src/freeze.h" */
 /* Amalgamated: #include "v7/src/bcode.h" */
+/* Amalgamated: #include "v7/src/array.h" */
 /* Amalgamated: #include "v7/src/gc.h" */
 /* Amalgamated: #include "common/base64.h" */
 /* Amalgamated: #include "v7/src/object.h" */
@@ -20556,10 +25609,24 @@ V7_PRIVATE int gc_check_ptr(const struct gc_arena *a, const void *ptr) {
 
 V7_PRIVATE void freeze(struct v7 *v7, char *filename) {
   size_t i;
+  struct gc_block *b;
+  struct gc_cell *cur;
+  struct gc_arena *a = &v7->generic_object_arena;
 
   v7->freeze_file = fopen(filename, "w");
   assert(v7->freeze_file != NULL);
 
+  /* Frozen objects can't refer to mbufs: turn dense arrays into sparse ones */
+  for (b = a->blocks; b != NULL; b = b->next) {
+    for (cur = b->base; cur < GC_CELL_OP(a, b->base, +, b->size);
+         cur = GC_CELL_OP(a, cur, +, 1)) {
+      struct v7_generic_object *o = (struct v7_generic_object *) cur;
+      if (!MARKED_FREE(cur) && (o->base.attributes & V7_OBJ_DENSE_ARRAY)) {
+        dense_array_to_sparse(v7, v7_object_to_value(&o->base));
+      }
+    }
+  }
+
 #ifndef V7_FREEZE_NOT_READONLY
   /*
    * We have to remove `global` from the global object since
@@ -20627,10 +25694,19 @@ V7_PRIVATE void freeze_obj(struct v7 *v7, FILE *f, v7_val_t v) {
     fprintf(f,
             "{\"type\":\"bcode\", \"addr\":\"%p\", \"args_cnt\":%d, "
             "\"names_cnt\":%d, "
-            "\"strict_mode\": %d, \"func_name_present\": %d, \"ops\":%s, "
-            "\"lit\": [",
+            "\"strict_mode\": %d, \"func_name_present\": %d, "
+            "\"frame_slots\": %d, \"arguments_slot\": %d, \"ops\":%s, ",
             (void *) bcode, bcode->args_cnt, bcode->names_cnt,
-            bcode->strict_mode, bcode->func_name_present, jops);
+            bcode->strict_mode, bcode->func_name_present, bcode->frame_slots,
+            bcode->arguments_slot, jops);
+#ifndef V7_DISABLE_LINE_NUMBERS
+    {
+      char *jlines = freeze_vec(&bcode->lines);
+      fprintf(f, "\"lines\":%s, ", jlines);
+      free(jlines);
+    }
+#endif
+    fprintf(f, "\"lit\": [");
 
     for (i = 0; (size_t) i < bcode->lit.len / sizeof(val_t); i++) {
       val_t v = ((val_t *) bcode->lit.p)[i];
@@ -20703,2661 +25779,4327 @@ V7_PRIVATE void freeze_prop(struct v7 *v7, FILE *f, struct v7_property *prop) {
 
 #endif
 #ifdef V7_MODULE_LINES
-#line 1 "./src/parser.c"
+#line 1 "./src/snapshot.c"
 #endif
 /*
  * Copyright (c) 2014 Cesanta Software Limited
  * All rights reserved
  */
 
-/* Amalgamated: #include "common/coroutine.h" */
 /* Amalgamated: #include "v7/src/internal.h" */
-/* Amalgamated: #include "v7/src/parser.h" */
-/* Amalgamated: #include "v7/src/tokenizer.h" */
+/* Amalgamated: #include "v7/src/snapshot_public.h" */
 /* Amalgamated: #include "v7/src/core.h" */
-/* Amalgamated: #include "v7/src/exceptions.h" */
-/* Amalgamated: #include "v7/src/ast.h" */
+/* Amalgamated: #include "v7/src/gc.h" */
+/* Amalgamated: #include "v7/src/bcode.h" */
+/* Amalgamated: #include "v7/src/object.h" */
 /* Amalgamated: #include "v7/src/primitive.h" */
-/* Amalgamated: #include "v7/src/cyg_profile.h" */
+/* Amalgamated: #include "v7/src/string.h" */
+/* Amalgamated: #include "v7/src/regexp.h" */
+/* Amalgamated: #include "v7/src/exceptions.h" */
+/* Amalgamated: #include "v7/src/shdata.h" */
+/* Amalgamated: #include "common/mbuf.h" */
 
-#define ACCEPT(t) (((v7)->cur_tok == (t)) ? next_tok((v7)), 1 : 0)
+#include <stdio.h>
 
-#define EXPECT(t)                            \
-  do {                                       \
-    if ((v7)->cur_tok != (t)) {              \
-      CR_THROW(PARSER_EXC_ID__SYNTAX_ERROR); \
-    }                                        \
-    next_tok(v7);                            \
-  } while (0)
+#ifdef V7_ENABLE_SNAPSHOT
 
-#define PARSE_WITH_OPT_ARG(tag, arg_tag, arg_parser, label) \
-  do {                                                      \
-    if (end_of_statement(v7) == V7_OK) {                    \
-      add_node(v7, a, (tag));                               \
-    } else {                                                \
-      add_node(v7, a, (arg_tag));                           \
-      arg_parser(label);                                    \
-    }                                                       \
-  } while (0)
+/*
+ * Snapshot file layout:
+ *
+ * - `struct snapshot_hdr`;
+ * - owned strings buffer, verbatim;
+ * - images of all cells of the object, function and property arenas;
+ * - bcodes: `struct bcode` image, ops, literals, filename length and data;
+ * - dense array buffers: number of values, values;
+ * - regexps: `struct snapshot_regexp`;
+ * - `struct v7_vals`;
+ * - string table: length, data.
+ *
+ * Cell pointers, in cell fields as well as in values, are saved as cell
+ * references (see `SNAPSHOT_REF()`). Values pointing outside of the heap
+ * are saved as indices in the tables above: foreign, mapped and rope strings
+ * become strings of the string table (tagged as foreign strings), and C
+ * functions are saved relative to `v7_create()`.
+ */
 
-#define N (CR_ARG_RET_PT()->arg)
+#define SNAPSHOT_MAGIC "V7SNAP01"
+
+enum snapshot_arena {
+  SNAPSHOT_OBJECTS,
+  SNAPSHOT_FUNCTIONS,
+  SNAPSHOT_PROPERTIES,
+
+  SNAPSHOT_ARENAS_CNT
+};
 
 /*
- * User functions
- * (as well as other in-function entry points)
+ * Reference to the cell `idx` of the arena `a`. The two lowest bits are kept
+ * clear, since the first word of a cell holds the free and mark bits.
  */
-enum my_fid {
-  fid_none = CR_FID__NONE,
+#define SNAPSHOT_REF(a, idx) ((((uint64_t)(idx) + 1) << 4) | ((a) << 2))
+#define SNAPSHOT_REF_ARENA(r) ((int) (((r) >> 2) & 3))
+#define SNAPSHOT_REF_IDX(r) ((size_t)((r) >> 4) - 1)
 
-  /* parse_script function */
-  fid_parse_script = CR_FID__USER,
-  fid_p_script_1,
-  fid_p_script_2,
-  fid_p_script_3,
-  fid_p_script_4,
+#define SNAPSHOT_PAYLOAD(v) ((v) & ~V7_TAG_MASK)
 
-  /* parse_use_strict function */
-  fid_parse_use_strict,
+/* Everything that must match between the saving and the loading build */
+struct snapshot_build {
+  char magic[8];
+  uint32_t val_size;
+  uint32_t vals_size;
+  uint32_t cell_size[SNAPSHOT_ARENAS_CNT];
+  uint32_t bcode_size;
+  uint64_t code_size; /* distance between `v7_create()` and `v7_destroy()` */
+};
 
-  /* parse_body function */
-  fid_parse_body,
-  fid_p_body_1,
-  fid_p_body_2,
+struct snapshot_hdr {
+  struct snapshot_build build;
+  uint64_t anchor; /* address of `v7_create()` */
+  uint32_t cells_cnt[SNAPSHOT_ARENAS_CNT];
+  uint32_t owned_strings_len;
+  uint32_t bcodes_cnt;
+  uint32_t ops_len; /* total length of the ops and line tables of bcodes */
+  uint32_t bufs_cnt;
+  uint32_t regexps_cnt;
+  uint32_t strings_cnt;
+  uint16_t gc_next_asn;
+  uint16_t gc_min_asn;
+};
 
-  /* parse_statement function */
-  fid_parse_statement,
-  fid_p_stat_1,
-  fid_p_stat_2,
-  fid_p_stat_3,
-  fid_p_stat_4,
-  fid_p_stat_5,
-  fid_p_stat_6,
-  fid_p_stat_7,
-  fid_p_stat_8,
-  fid_p_stat_9,
-  fid_p_stat_10,
-  fid_p_stat_11,
-  fid_p_stat_12,
-  fid_p_stat_13,
-  fid_p_stat_14,
+struct snapshot_regexp {
+  val_t regexp_string;
+  int64_t last_index;
+  int32_t flags;
+};
 
-  /* parse_expression function */
-  fid_parse_expression,
-  fid_p_expr_1,
+union snapshot_cell {
+  struct gc_cell cell;
+  struct v7_generic_object obj;
+  struct v7_js_function func;
+  struct v7_property prop;
+};
 
-  /* parse_assign function */
-  fid_parse_assign,
-  fid_p_assign_1,
+static uintptr_t snapshot_anchor(void) {
+  union {
+    struct v7 *(*f)(void);
+    void *v;
+  } u;
+  u.f = v7_create;
+  return (uintptr_t) u.v;
+}
 
-  /* parse_binary function */
-  fid_parse_binary,
-  fid_p_binary_1,
-  fid_p_binary_2,
-  fid_p_binary_3,
-  fid_p_binary_4,
-  fid_p_binary_5,
-  fid_p_binary_6,
+static void snapshot_build(struct v7 *v7, struct snapshot_build *b) {
+  union {
+    void (*f)(struct v7 *);
+    void *v;
+  } u;
 
-  /* parse_prefix function */
-  fid_parse_prefix,
-  fid_p_prefix_1,
+  memset(b, 0, sizeof(*b));
+  memcpy(b->magic, SNAPSHOT_MAGIC, sizeof(b->magic));
+  b->val_size = sizeof(val_t);
+  b->vals_size = sizeof(struct v7_vals);
+  b->cell_size[SNAPSHOT_OBJECTS] = v7->generic_object_arena.cell_size;
+  b->cell_size[SNAPSHOT_FUNCTIONS] = v7->function_arena.cell_size;
+  b->cell_size[SNAPSHOT_PROPERTIES] = v7->property_arena.cell_size;
+  b->bcode_size = sizeof(struct bcode);
+  u.f = v7_destroy;
+  b->code_size = (uint64_t)((uintptr_t) u.v - snapshot_anchor());
+}
+
+static struct gc_arena *snapshot_arena(struct v7 *v7, int i) {
+  switch (i) {
+    case SNAPSHOT_OBJECTS:
+      return &v7->generic_object_arena;
+    case SNAPSHOT_FUNCTIONS:
+      return &v7->function_arena;
+    default:
+      return &v7->property_arena;
+  }
+}
 
-  /* parse_postfix function */
-  fid_parse_postfix,
-  fid_p_postfix_1,
+static int snapshot_ptr_cmp(const void *a, const void *b) {
+  uintptr_t pa = *(const uintptr_t *) a, pb = *(const uintptr_t *) b;
+  return pa < pb ? -1 : pa > pb;
+}
 
-  /* parse_callexpr function */
-  fid_parse_callexpr,
-  fid_p_callexpr_1,
-  fid_p_callexpr_2,
-  fid_p_callexpr_3,
+/* Returns the index of pointer `p` in a sorted mbuf of pointers, or -1 */
+static long snapshot_ptr_find(const struct mbuf *m, const void *p) {
+  uintptr_t key = (uintptr_t) p;
+  void *res = bsearch(&key, m->buf, m->len / sizeof(void *), sizeof(void *),
+                      snapshot_ptr_cmp);
+  return res == NULL ? -1 : (long) (((char *) res - m->buf) / sizeof(void *));
+}
 
-  /* parse_newexpr function */
-  fid_parse_newexpr,
-  fid_p_newexpr_1,
-  fid_p_newexpr_2,
-  fid_p_newexpr_3,
-  fid_p_newexpr_4,
+static void snapshot_ptr_sort(struct mbuf *m) {
+  size_t i, j, n = m->len / sizeof(void *);
+  void **p = (void **) m->buf;
 
-  /* parse_terminal function */
-  fid_parse_terminal,
-  fid_p_terminal_1,
-  fid_p_terminal_2,
-  fid_p_terminal_3,
-  fid_p_terminal_4,
+  qsort(m->buf, n, sizeof(void *), snapshot_ptr_cmp);
+  for (i = j = 0; i < n; i++) {
+    if (j == 0 || p[j - 1] != p[i]) p[j++] = p[i];
+  }
+  m->len = j * sizeof(void *);
+}
 
-  /* parse_block function */
-  fid_parse_block,
-  fid_p_block_1,
+/* {{{ Saving */
 
-  /* parse_if function */
-  fid_parse_if,
-  fid_p_if_1,
-  fid_p_if_2,
-  fid_p_if_3,
+/* Blocks of an arena sorted by address, along with their first cell index */
+struct snapshot_map {
+  struct gc_arena *a;
+  struct mbuf blocks; /* struct gc_block * */
+  size_t *first;
+  size_t cells_cnt;
+};
 
-  /* parse_while function */
-  fid_parse_while,
-  fid_p_while_1,
-  fid_p_while_2,
+struct snapshot_writer {
+  struct v7 *v7;
+  FILE *fp;
+  uintptr_t anchor;
+  struct snapshot_map maps[SNAPSHOT_ARENAS_CNT];
+  struct mbuf bcodes;  /* struct bcode *, sorted */
+  struct mbuf bufs;    /* struct v7_property * of dense arrays, sorted */
+  struct mbuf regexps; /* struct v7_regexp * */
+  struct mbuf strings; /* val_t, saved into the string table */
+  size_t ops_len;
+  const char *error; /* first error, if any */
+};
 
-  /* parse_ident function */
-  fid_parse_ident,
+static void snapshot_fail(struct snapshot_writer *w, const char *error) {
+  if (w->error == NULL) w->error = error;
+}
 
-  /* parse_ident_allow_reserved_words function */
-  fid_parse_ident_allow_reserved_words,
-  fid_p_ident_arw_1,
+static void snapshot_write(struct snapshot_writer *w, const void *p,
+                           size_t len) {
+  if (len > 0 && fwrite(p, len, 1, w->fp) != 1) {
+    snapshot_fail(w, "write error");
+  }
+}
 
-  /* parse_funcdecl function */
-  fid_parse_funcdecl,
-  fid_p_funcdecl_1,
-  fid_p_funcdecl_2,
-  fid_p_funcdecl_3,
-  fid_p_funcdecl_4,
-  fid_p_funcdecl_5,
-  fid_p_funcdecl_6,
-  fid_p_funcdecl_7,
-  fid_p_funcdecl_8,
-  fid_p_funcdecl_9,
+static void snapshot_write_u32(struct snapshot_writer *w, size_t n) {
+  uint32_t v = (uint32_t) n;
+  snapshot_write(w, &v, sizeof(v));
+}
 
-  /* parse_arglist function */
-  fid_parse_arglist,
-  fid_p_arglist_1,
+static int snapshot_block_cmp(const void *a, const void *b) {
+  const struct gc_cell *pa = (*(struct gc_block * const *) a)->base;
+  const struct gc_cell *pb = (*(struct gc_block * const *) b)->base;
+  return pa < pb ? -1 : pa > pb;
+}
 
-  /* parse_member function */
-  fid_parse_member,
-  fid_p_member_1,
+static void snapshot_map_init(struct snapshot_map *m, struct gc_arena *a) {
+  struct gc_block *b;
+  struct gc_block **blocks;
+  size_t i, n;
 
-  /* parse_memberexpr function */
-  fid_parse_memberexpr,
-  fid_p_memberexpr_1,
-  fid_p_memberexpr_2,
+  m->a = a;
+  mbuf_init(&m->blocks, 0);
+  for (b = a->blocks; b != NULL; b = b->next) {
+    mbuf_append(&m->blocks, &b, sizeof(b));
+  }
+  blocks = (struct gc_block **) m->blocks.buf;
+  n = m->blocks.len / sizeof(*blocks);
+  qsort(blocks, n, sizeof(*blocks), snapshot_block_cmp);
 
-  /* parse_var function */
-  fid_parse_var,
-  fid_p_var_1,
+  m->first = (size_t *) malloc((n + 1) * sizeof(size_t));
+  m->cells_cnt = 0;
+  for (i = 0; i < n; i++) {
+    m->first[i] = m->cells_cnt;
+    m->cells_cnt += blocks[i]->size;
+  }
+}
 
-  /* parse_prop function */
-  fid_parse_prop,
-#ifdef V7_ENABLE_JS_GETTERS
-  fid_p_prop_1_getter,
-#endif
-  fid_p_prop_2,
-#ifdef V7_ENABLE_JS_SETTERS
-  fid_p_prop_3_setter,
-#endif
-  fid_p_prop_4,
+static void snapshot_map_free(struct snapshot_map *m) {
+  mbuf_free(&m->blocks);
+  free(m->first);
+}
 
-  /* parse_dowhile function */
-  fid_parse_dowhile,
-  fid_p_dowhile_1,
-  fid_p_dowhile_2,
+/* Returns the reference to the cell `p` */
+static uint64_t snapshot_ref(struct snapshot_writer *w, const void *p) {
+  int i;
 
-  /* parse_for function */
-  fid_parse_for,
-  fid_p_for_1,
-  fid_p_for_2,
-  fid_p_for_3,
-  fid_p_for_4,
-  fid_p_for_5,
-  fid_p_for_6,
+  if (p == NULL) return 0;
 
-  /* parse_try function */
-  fid_parse_try,
-  fid_p_try_1,
-  fid_p_try_2,
-  fid_p_try_3,
-  fid_p_try_4,
+  for (i = 0; i < SNAPSHOT_ARENAS_CNT; i++) {
+    struct snapshot_map *m = &w->maps[i];
+    struct gc_block **blocks = (struct gc_block **) m->blocks.buf;
+    size_t lo = 0, hi = m->blocks.len / sizeof(*blocks);
+
+    while (lo < hi) {
+      size_t mid = (lo + hi) / 2;
+      struct gc_block *b = blocks[mid];
+      size_t off;
+
+      if ((const char *) p < (const char *) b->base) {
+        hi = mid;
+      } else if ((const char *) p >=
+                 (const char *) GC_CELL_OP(m->a, b->base, +, b->size)) {
+        lo = mid + 1;
+      } else {
+        off = (const char *) p - (const char *) b->base;
+        if (off % m->a->cell_size != 0) break;
+        return SNAPSHOT_REF(i, m->first[mid] + off / m->a->cell_size);
+      }
+    }
+  }
 
-  /* parse_switch function */
-  fid_parse_switch,
-  fid_p_switch_1,
-  fid_p_switch_2,
-  fid_p_switch_3,
-  fid_p_switch_4,
+  snapshot_fail(w, "pointer outside of the heap");
+  return 0;
+}
 
-  /* parse_with function */
-  fid_parse_with,
-  fid_p_with_1,
-  fid_p_with_2,
+/* Returns the index of string `v` in the string table */
+static uint64_t snapshot_string(struct snapshot_writer *w, val_t v) {
+  size_t i, n = w->strings.len / sizeof(val_t);
+  val_t *strings = (val_t *) w->strings.buf;
 
-  MY_FID_CNT
-};
+  for (i = 0; i < n; i++) {
+    if (strings[i] == v) return i;
+  }
+  mbuf_append(&w->strings, &v, sizeof(v));
+  return n;
+}
 
-/*
- * User exception IDs. The first one should have value `CR_EXC_ID__USER`
- */
-enum parser_exc_id {
-  PARSER_EXC_ID__NONE = CR_EXC_ID__NONE,
-  PARSER_EXC_ID__SYNTAX_ERROR = CR_EXC_ID__USER,
-};
+static val_t snapshot_val(struct snapshot_writer *w, val_t v) {
+  uint64_t tag = v & V7_TAG_MASK;
+  size_t i, n;
 
-/* structures with locals and args {{{ */
+  switch (tag) {
+    case V7_TAG_OBJECT:
+    case V7_TAG_FUNCTION:
+      return tag | snapshot_ref(w, get_ptr(v));
+    case V7_TAG_STRING_F:
+    case V7_TAG_STRING_M:
+    case V7_TAG_STRING_R:
+      return V7_TAG_STRING_F | snapshot_string(w, v);
+    case V7_TAG_CFUNCTION:
+      return tag | SNAPSHOT_PAYLOAD(v - w->anchor);
+    case V7_TAG_REGEXP:
+      n = w->regexps.len / sizeof(void *);
+      for (i = 0; i < n; i++) {
+        if (((void **) w->regexps.buf)[i] == get_ptr(v)) break;
+      }
+      if (i == n) {
+        void *rp = get_ptr(v);
+        mbuf_append(&w->regexps, &rp, sizeof(rp));
+      }
+      return tag | (i + 1);
+    case V7_TAG_FOREIGN:
+      if (get_ptr(v) != NULL) snapshot_fail(w, "foreign pointer in the heap");
+      return v;
+    default:
+      return v;
+  }
+}
 
-/* parse_script {{{ */
+static void snapshot_write_cell(struct snapshot_writer *w, int arena,
+                                struct gc_cell *cell) {
+  union snapshot_cell c;
+  size_t cell_size = w->maps[arena].a->cell_size;
+  long idx;
 
-/* parse_script's arguments */
-#if 0
-typedef struct fid_parse_script_arg {
-} fid_parse_script_arg_t;
-#else
-typedef cr_zero_size_type_t fid_parse_script_arg_t;
-#endif
+  memcpy(&c, cell, cell_size);
 
-/* parse_script's data on stack */
-typedef struct fid_parse_script_locals {
-#if 0
-  struct fid_parse_script_arg arg;
+  if (MARKED_FREE(cell)) {
+    memset(&c, 0, cell_size);
+    MARK_FREE(&c.cell);
+  } else if (arena == SNAPSHOT_PROPERTIES) {
+    struct v7_property *p = &c.prop;
+#ifndef V7_DISABLE_STRING_ROPES
+    if (p->attributes & _V7_PROPERTY_ROPE) {
+      /* ropes are saved as flat strings, so rope nodes are not needed */
+      memset(&c, 0, cell_size);
+      MARK_FREE(&c.cell);
+      snapshot_write(w, &c, cell_size);
+      return;
+    }
 #endif
+    if (p->attributes & _V7_PROPERTY_OFF_HEAP) {
+      snapshot_fail(w, "frozen property");
+    }
+    p->next = (struct v7_property *) (uintptr_t) snapshot_ref(w, p->next);
+    p->name = snapshot_val(w, p->name);
+    if (v7_is_foreign(p->value) &&
+        (idx = snapshot_ptr_find(&w->bufs, cell)) >= 0) {
+      p->value = V7_TAG_FOREIGN | (idx + 1);
+    } else {
+      p->value = snapshot_val(w, p->value);
+    }
+  } else {
+    struct v7_object *o = &c.obj.base;
+    if (o->attributes & V7_OBJ_OFF_HEAP) {
+      snapshot_fail(w, "frozen object");
+    }
+    o->properties =
+        (struct v7_property *) (uintptr_t) snapshot_ref(w, o->properties);
+    if (arena == SNAPSHOT_OBJECTS) {
+      c.obj.prototype =
+          (struct v7_object *) (uintptr_t) snapshot_ref(w, c.obj.prototype);
+    } else {
+      c.func.scope = (struct v7_generic_object *) (uintptr_t) snapshot_ref(
+          w, c.func.scope);
+      idx = snapshot_ptr_find(&w->bcodes, c.func.bcode);
+      c.func.bcode = (struct bcode *) (uintptr_t)(idx + 1);
+    }
+  }
 
-  ast_off_t start;
-  ast_off_t outer_last_var_node;
-  int saved_in_strict;
-} fid_parse_script_locals_t;
-
-/* }}} */
+  snapshot_write(w, &c, cell_size);
+}
 
-/* parse_use_strict {{{ */
-/* parse_use_strict's arguments */
-#if 0
-typedef struct fid_parse_use_strict_arg {
-} fid_parse_use_strict_arg_t;
+static void snapshot_write_bcode(struct snapshot_writer *w, struct bcode *b) {
+  struct bcode img = *b;
+  val_t *lit = (val_t *) b->lit.p;
+  size_t i;
+#ifndef V7_DISABLE_FILENAMES
+  const char *filename = bcode_get_filename(b);
 #else
-typedef cr_zero_size_type_t fid_parse_use_strict_arg_t;
+  const char *filename = NULL;
 #endif
 
-/* parse_use_strict's data on stack */
-#if 0
-typedef struct fid_parse_use_strict_locals {
-  struct fid_parse_use_strict_arg arg;
-} fid_parse_use_strict_locals_t;
-#else
-typedef cr_zero_size_type_t fid_parse_use_strict_locals_t;
+  if (b->frozen) snapshot_fail(w, "frozen bcode");
+
+  img.ops.p = NULL;
+  img.lit.p = NULL;
+#ifndef V7_DISABLE_LINE_NUMBERS
+  img.lines.p = NULL;
 #endif
+  img.refcnt = 0;
+#ifndef V7_DISABLE_FILENAMES
+  img.filename = NULL;
+  img.filename_in_rom = 0;
+#endif
+#ifndef V7_DISABLE_INLINE_CACHE
+  img.ic = NULL;
+  img.ic_mask = 0;
+#endif
+  snapshot_write(w, &img, sizeof(img));
+  snapshot_write(w, b->ops.p, b->ops.len);
+#ifndef V7_DISABLE_LINE_NUMBERS
+  snapshot_write(w, b->lines.p, b->lines.len);
+#endif
+  for (i = 0; i < b->lit.len / sizeof(val_t); i++) {
+    val_t v = snapshot_val(w, lit[i]);
+    snapshot_write(w, &v, sizeof(v));
+  }
+  snapshot_write_u32(w, filename == NULL ? 0 : strlen(filename));
+  if (filename != NULL) snapshot_write(w, filename, strlen(filename));
+}
 
-#define CALL_PARSE_USE_STRICT(_label)      \
-  do {                                     \
-    CR_CALL(fid_parse_use_strict, _label); \
-  } while (0)
+/*
+ * Collects bcodes of all functions, and buffers of all dense arrays: the
+ * only foreign pointers which are saved
+ */
+static void snapshot_collect(struct snapshot_writer *w) {
+  struct v7 *v7 = w->v7;
+  struct gc_block *b;
+  struct gc_cell *cur;
+  struct gc_arena *a;
 
-/* }}} */
+  a = &v7->function_arena;
+  for (b = a->blocks; b != NULL; b = b->next) {
+    for (cur = b->base; cur < GC_CELL_OP(a, b->base, +, b->size);
+         cur = GC_CELL_OP(a, cur, +, 1)) {
+      struct v7_js_function *f = (struct v7_js_function *) cur;
+      if (MARKED_FREE(cur) || f->bcode == NULL) continue;
+      mbuf_append(&w->bcodes, &f->bcode, sizeof(f->bcode));
+    }
+  }
+  snapshot_ptr_sort(&w->bcodes);
 
-/* parse_body {{{ */
-/* parse_body's arguments */
-typedef struct fid_parse_body_arg { enum v7_tok end; } fid_parse_body_arg_t;
+  a = &v7->generic_object_arena;
+  for (b = a->blocks; b != NULL; b = b->next) {
+    for (cur = b->base; cur < GC_CELL_OP(a, b->base, +, b->size);
+         cur = GC_CELL_OP(a, cur, +, 1)) {
+      struct v7_generic_object *o = (struct v7_generic_object *) cur;
+      struct v7_property *p;
+      if (MARKED_FREE(cur) || !(o->base.attributes & V7_OBJ_DENSE_ARRAY)) {
+        continue;
+      }
+      p = v7_get_own_property2(v7, v7_object_to_value(&o->base), "", 0,
+                               _V7_PROPERTY_HIDDEN);
+      if (p != NULL && v7_get_ptr(v7, p->value) != NULL) {
+        mbuf_append(&w->bufs, &p, sizeof(p));
+      }
+    }
+  }
+  snapshot_ptr_sort(&w->bufs);
+}
 
-/* parse_body's data on stack */
-typedef struct fid_parse_body_locals {
-  struct fid_parse_body_arg arg;
+enum v7_err v7_save_snapshot(struct v7 *v7, const char *path) {
+  enum v7_err rcode = V7_OK;
+  struct snapshot_writer w;
+  struct snapshot_hdr hdr;
+  struct v7_vals vals;
+  size_t i, j;
 
-  ast_off_t start;
-} fid_parse_body_locals_t;
+  memset(&w, 0, sizeof(w));
+  memset(&hdr, 0, sizeof(hdr));
+  w.v7 = v7;
+  w.anchor = snapshot_anchor();
 
-#define CALL_PARSE_BODY(_end, _label) \
-  do {                                \
-    N.fid_parse_body.end = (_end);    \
-    CR_CALL(fid_parse_body, _label);  \
-  } while (0)
-/* }}} */
+  if (v7->call_stack != NULL) {
+    rcode = v7_throwf(v7, INTERNAL_ERROR, "cannot save snapshot while running");
+    goto clean;
+  }
 
-/* parse_statement {{{ */
-/* parse_statement's arguments */
-#if 0
-typedef struct fid_parse_statement_arg {
-} fid_parse_statement_arg_t;
-#else
-typedef cr_zero_size_type_t fid_parse_statement_arg_t;
-#endif
+  if ((w.fp = fopen(path, "wb")) == NULL) {
+    rcode = v7_throwf(v7, INTERNAL_ERROR, "cannot open [%s]", path);
+    goto clean;
+  }
 
-/* parse_statement's data on stack */
-#if 0
-typedef struct fid_parse_statement_locals {
-  struct fid_parse_statement_arg arg;
-} fid_parse_statement_locals_t;
-#else
-typedef cr_zero_size_type_t fid_parse_statement_locals_t;
+  /* compact the heap; from now on, nothing must be allocated on it */
+  v7_gc(v7, 1);
+
+  for (i = 0; i < SNAPSHOT_ARENAS_CNT; i++) {
+    snapshot_map_init(&w.maps[i], snapshot_arena(v7, i));
+  }
+  snapshot_collect(&w);
+
+  /* header is written last, when all the tables are known */
+  snapshot_write(&w, &hdr, sizeof(hdr));
+
+  snapshot_write(&w, v7->owned_strings.buf, v7->owned_strings.len);
+
+  for (i = 0; i < SNAPSHOT_ARENAS_CNT; i++) {
+    struct snapshot_map *m = &w.maps[i];
+    struct gc_block **blocks = (struct gc_block **) m->blocks.buf;
+    for (j = 0; j < m->blocks.len / sizeof(*blocks); j++) {
+      struct gc_cell *cur;
+      for (cur = blocks[j]->base;
+           cur < GC_CELL_OP(m->a, blocks[j]->base, +, blocks[j]->size);
+           cur = GC_CELL_OP(m->a, cur, +, 1)) {
+        snapshot_write_cell(&w, i, cur);
+      }
+    }
+  }
+
+  for (i = 0; i < w.bcodes.len / sizeof(struct bcode *); i++) {
+    struct bcode *b = ((struct bcode **) w.bcodes.buf)[i];
+    snapshot_write_bcode(&w, b);
+    w.ops_len += b->ops.len;
+#ifndef V7_DISABLE_LINE_NUMBERS
+    w.ops_len += b->lines.len;
 #endif
+  }
 
-#define CALL_PARSE_STATEMENT(_label)      \
-  do {                                    \
-    CR_CALL(fid_parse_statement, _label); \
-  } while (0)
-/* }}} */
+  for (i = 0; i < w.bufs.len / sizeof(struct v7_property *); i++) {
+    struct v7_property *p = ((struct v7_property **) w.bufs.buf)[i];
+    struct mbuf *abuf = (struct mbuf *) get_ptr(p->value);
+    snapshot_write_u32(&w, abuf->len / sizeof(val_t));
+    for (j = 0; j < abuf->len / sizeof(val_t); j++) {
+      val_t v = snapshot_val(&w, ((val_t *) abuf->buf)[j]);
+      snapshot_write(&w, &v, sizeof(v));
+    }
+  }
 
-/* parse_expression {{{ */
-/* parse_expression's arguments */
-#if 0
-typedef struct fid_parse_expression_arg {
-} fid_parse_expression_arg_t;
-#else
-typedef cr_zero_size_type_t fid_parse_expression_arg_t;
+#if V7_ENABLE__RegExp
+  for (i = 0; i < w.regexps.len / sizeof(struct v7_regexp *); i++) {
+    struct v7_regexp *rp = ((struct v7_regexp **) w.regexps.buf)[i];
+    struct snapshot_regexp r;
+    memset(&r, 0, sizeof(r));
+    r.regexp_string = snapshot_val(&w, rp->regexp_string);
+    r.last_index = rp->lastIndex;
+    r.flags = slre_get_flags(rp->compiled_regexp);
+    snapshot_write(&w, &r, sizeof(r));
+  }
 #endif
 
-/* parse_expression's data on stack */
-typedef struct fid_parse_expression_locals {
-#if 0
-  struct fid_parse_expression_arg arg;
+  for (i = 0; i < sizeof(vals) / sizeof(val_t); i++) {
+    ((val_t *) &vals)[i] = snapshot_val(&w, ((val_t *) &v7->vals)[i]);
+  }
+  snapshot_write(&w, &vals, sizeof(vals));
+
+  for (i = 0; i < w.strings.len / sizeof(val_t); i++) {
+    size_t len;
+    const char *s = v7_get_string(v7, &((val_t *) w.strings.buf)[i], &len);
+    snapshot_write_u32(&w, len);
+    snapshot_write(&w, s, len);
+  }
+
+  snapshot_build(v7, &hdr.build);
+  hdr.anchor = w.anchor;
+  for (i = 0; i < SNAPSHOT_ARENAS_CNT; i++) {
+    hdr.cells_cnt[i] = w.maps[i].cells_cnt;
+  }
+  hdr.owned_strings_len = v7->owned_strings.len;
+  hdr.bcodes_cnt = w.bcodes.len / sizeof(struct bcode *);
+  hdr.ops_len = w.ops_len;
+  hdr.bufs_cnt = w.bufs.len / sizeof(struct v7_property *);
+  hdr.regexps_cnt = w.regexps.len / sizeof(struct v7_regexp *);
+  hdr.strings_cnt = w.strings.len / sizeof(val_t);
+#ifndef V7_DISABLE_STR_ALLOC_SEQ
+  hdr.gc_next_asn = v7->gc_next_asn;
+  hdr.gc_min_asn = v7->gc_min_asn;
 #endif
+  if (fseek(w.fp, 0, SEEK_SET) != 0) snapshot_fail(&w, "seek error");
+  snapshot_write(&w, &hdr, sizeof(hdr));
 
-  ast_off_t pos;
-  int group;
-} fid_parse_expression_locals_t;
+  if (fclose(w.fp) != 0) snapshot_fail(&w, "write error");
+  w.fp = NULL;
 
-#define CALL_PARSE_EXPRESSION(_label)      \
-  do {                                     \
-    CR_CALL(fid_parse_expression, _label); \
-  } while (0)
-/* }}} */
+  if (w.error != NULL) {
+    remove(path);
+    rcode = v7_throwf(v7, INTERNAL_ERROR, "cannot save snapshot: %s", w.error);
+  }
 
-/* parse_assign {{{ */
-/* parse_assign's arguments */
-#if 0
-typedef struct fid_parse_assign_arg {
-} fid_parse_assign_arg_t;
-#else
-typedef cr_zero_size_type_t fid_parse_assign_arg_t;
-#endif
+clean:
+  if (w.fp != NULL) fclose(w.fp);
+  for (i = 0; i < SNAPSHOT_ARENAS_CNT; i++) {
+    snapshot_map_free(&w.maps[i]);
+  }
+  mbuf_free(&w.bcodes);
+  mbuf_free(&w.bufs);
+  mbuf_free(&w.regexps);
+  mbuf_free(&w.strings);
+  return rcode;
+}
 
-/* parse_assign's data on stack */
-#if 0
-typedef struct fid_parse_assign_locals {
-  struct fid_parse_assign_arg arg;
-} fid_parse_assign_locals_t;
-#else
-typedef cr_zero_size_type_t fid_parse_assign_locals_t;
-#endif
+/* }}} Saving */
 
-#define CALL_PARSE_ASSIGN(_label)      \
-  do {                                 \
-    CR_CALL(fid_parse_assign, _label); \
-  } while (0)
-/* }}} */
+/* {{{ Loading */
 
-/* parse_binary {{{ */
-/* parse_binary's arguments */
-typedef struct fid_parse_binary_arg {
-  ast_off_t pos;
-  uint8_t min_level;
-} fid_parse_binary_arg_t;
+struct snapshot_reader {
+  struct v7 *v7;
+  FILE *fp;
+  struct snapshot_hdr hdr;
+  uintptr_t anchor;
+  struct gc_cell *bases[SNAPSHOT_ARENAS_CNT];
+  struct bcode **bcodes;
+  struct mbuf **bufs;
+  struct v7_regexp **regexps;
+  val_t *strings;
+  int error;
+};
 
-/* parse_binary's data on stack */
-typedef struct fid_parse_binary_locals {
-  struct fid_parse_binary_arg arg;
+static void snapshot_read(struct snapshot_reader *r, void *p, size_t len) {
+  if (len > 0 && (r->error || fread(p, len, 1, r->fp) != 1)) {
+    memset(p, 0, len);
+    r->error = 1;
+  }
+}
 
-  uint8_t i;
-  /* during iteration, it becomes negative, so should be signed */
-  int8_t level;
-  uint8_t /*enum v7_tok*/ tok;
-  uint8_t /*enum ast_tag*/ ast;
-  ast_off_t saved_mbuf_len;
-} fid_parse_binary_locals_t;
+static size_t snapshot_read_u32(struct snapshot_reader *r) {
+  uint32_t v = 0;
+  snapshot_read(r, &v, sizeof(v));
+  return v;
+}
 
-#define CALL_PARSE_BINARY(_level, _pos, _label) \
-  do {                                          \
-    N.fid_parse_binary.min_level = (_level);    \
-    N.fid_parse_binary.pos = (_pos);            \
-    CR_CALL(fid_parse_binary, _label);          \
-  } while (0)
-/* }}} */
+/* Returns the cell referenced by `ref` (see `SNAPSHOT_REF()`) */
+static void *snapshot_cell(struct snapshot_reader *r, uint64_t ref) {
+  int a = SNAPSHOT_REF_ARENA(ref);
+  size_t idx = SNAPSHOT_REF_IDX(ref);
 
-/* parse_prefix {{{ */
-/* parse_prefix's arguments */
-#if 0
-typedef struct fid_parse_prefix_arg {
-} fid_parse_prefix_arg_t;
-#else
-typedef cr_zero_size_type_t fid_parse_prefix_arg_t;
-#endif
+  if (ref == 0) return NULL;
+  if (a >= SNAPSHOT_ARENAS_CNT || idx >= r->hdr.cells_cnt[a]) {
+    r->error = 1;
+    return NULL;
+  }
+  return GC_CELL_OP(snapshot_arena(r->v7, a), r->bases[a], +, idx);
+}
 
-/* parse_prefix's data on stack */
-#if 0
-typedef struct fid_parse_prefix_locals {
-  struct fid_parse_prefix_arg arg;
-} fid_parse_prefix_locals_t;
-#else
-typedef cr_zero_size_type_t fid_parse_prefix_locals_t;
-#endif
+/* Returns entry `idx` of a pointer table of `n` entries */
+static void *snapshot_entry(struct snapshot_reader *r, void *table,
+                            uint64_t idx, size_t n) {
+  if (idx >= n) {
+    r->error = 1;
+    return NULL;
+  }
+  return ((void **) table)[idx];
+}
 
-#define CALL_PARSE_PREFIX(_label)      \
-  do {                                 \
-    CR_CALL(fid_parse_prefix, _label); \
-  } while (0)
-/* }}} */
+static val_t snapshot_load_val(struct snapshot_reader *r, val_t v) {
+  uint64_t tag = v & V7_TAG_MASK, payload = SNAPSHOT_PAYLOAD(v);
 
-/* parse_postfix {{{ */
-/* parse_postfix's arguments */
-#if 0
-typedef struct fid_parse_postfix_arg {
-} fid_parse_postfix_arg_t;
-#else
-typedef cr_zero_size_type_t fid_parse_postfix_arg_t;
-#endif
+  switch (tag) {
+    case V7_TAG_OBJECT:
+    case V7_TAG_FUNCTION:
+      return tag | pointer_to_value(snapshot_cell(r, payload));
+    case V7_TAG_STRING_F:
+      if (payload >= r->hdr.strings_cnt) {
+        r->error = 1;
+        return V7_UNDEFINED;
+      }
+      return r->strings[payload];
+    case V7_TAG_CFUNCTION:
+      return tag | SNAPSHOT_PAYLOAD(payload + r->anchor);
+    case V7_TAG_REGEXP:
+      return tag | pointer_to_value(snapshot_entry(r, r->regexps, payload - 1,
+                                                   r->hdr.regexps_cnt));
+    case V7_TAG_FOREIGN:
+      if (payload == 0) return v;
+      return tag | pointer_to_value(
+                       snapshot_entry(r, r->bufs, payload - 1, r->hdr.bufs_cnt));
+    default:
+      return v;
+  }
+}
 
-/* parse_postfix's data on stack */
-typedef struct fid_parse_postfix_locals {
-#if 0
-  struct fid_parse_postfix_arg arg;
-#endif
+static void snapshot_load_vals(struct snapshot_reader *r, val_t *v, size_t n) {
+  size_t i;
+  for (i = 0; i < n; i++) {
+    v[i] = snapshot_load_val(r, v[i]);
+  }
+}
 
-  ast_off_t pos;
-} fid_parse_postfix_locals_t;
+static void snapshot_load_cell(struct snapshot_reader *r, int arena,
+                               struct gc_cell *cell) {
+  if (MARKED_FREE(cell)) return;
 
-#define CALL_PARSE_POSTFIX(_label)      \
-  do {                                  \
-    CR_CALL(fid_parse_postfix, _label); \
-  } while (0)
-/* }}} */
+  if (arena == SNAPSHOT_PROPERTIES) {
+    struct v7_property *p = (struct v7_property *) cell;
+    p->next = (struct v7_property *) snapshot_cell(r, (uintptr_t) p->next);
+    p->name = snapshot_load_val(r, p->name);
+    p->value = snapshot_load_val(r, p->value);
+  } else {
+    struct v7_object *o = (struct v7_object *) cell;
+    o->properties =
+        (struct v7_property *) snapshot_cell(r, (uintptr_t) o->properties);
+    if (arena == SNAPSHOT_OBJECTS) {
+      struct v7_generic_object *obj = (struct v7_generic_object *) cell;
+      obj->prototype =
+          (struct v7_object *) snapshot_cell(r, (uintptr_t) obj->prototype);
+    } else {
+      struct v7_js_function *f = (struct v7_js_function *) cell;
+      f->scope =
+          (struct v7_generic_object *) snapshot_cell(r, (uintptr_t) f->scope);
+      if (f->bcode != NULL) {
+        f->bcode = (struct bcode *) snapshot_entry(
+            r, r->bcodes, (uintptr_t) f->bcode - 1, r->hdr.bcodes_cnt);
+        if (f->bcode != NULL) retain_bcode(r->v7, f->bcode);
+      }
+    }
+  }
+}
 
-/* parse_callexpr {{{ */
-/* parse_callexpr's arguments */
-#if 0
-typedef struct fid_parse_callexpr_arg {
-} fid_parse_callexpr_arg_t;
-#else
-typedef cr_zero_size_type_t fid_parse_callexpr_arg_t;
+static void snapshot_load_bcode(struct snapshot_reader *r, size_t i,
+                                char **ops) {
+  struct v7 *v7 = r->v7;
+  struct bcode *b;
+  size_t len;
+
+  b = (struct bcode *) malloc(sizeof(*b));
+  snapshot_read(r, b, sizeof(*b));
+  /* restored ops are never freed separately, see `v7->snapshot_ops` */
+  b->ops_in_rom = 1;
+  b->ops.p = *ops;
+  b->lit.p = NULL;
+#ifndef V7_DISABLE_LINE_NUMBERS
+  b->lines.p = *ops + b->ops.len;
+#endif
+#ifndef V7_DISABLE_FILENAMES
+  b->filename = NULL;
+  b->filename_in_rom = 0;
 #endif
+  b->refcnt = 0;
+  r->bcodes[i] = b;
 
-/* parse_callexpr's data on stack */
-typedef struct fid_parse_callexpr_locals {
-#if 0
-  struct fid_parse_callexpr_arg arg;
+  len = b->ops.len;
+#ifndef V7_DISABLE_LINE_NUMBERS
+  len += b->lines.len;
+#endif
+  if (r->error || len < b->ops.len ||
+      len > (size_t)(v7->snapshot_ops + r->hdr.ops_len - *ops)) {
+    memset(&b->ops, 0, sizeof(b->ops));
+    memset(&b->lit, 0, sizeof(b->lit));
+#ifndef V7_DISABLE_LINE_NUMBERS
+    memset(&b->lines, 0, sizeof(b->lines));
 #endif
+    r->error = 1;
+    return;
+  }
+  /* the line number table follows the ops */
+  snapshot_read(r, *ops, len);
+  *ops += len;
 
-  ast_off_t pos;
-} fid_parse_callexpr_locals_t;
+  if (b->lit.len > 0) {
+    b->lit.p = (char *) malloc(b->lit.len);
+    snapshot_read(r, b->lit.p, b->lit.len);
+  }
+#if V7_ENABLE__Memory__stats
+  v7->bcode_lit_total_size += b->lit.len;
+  if (b->deserialized) {
+    v7->bcode_lit_deser_size += b->lit.len;
+  }
+#endif
 
-#define CALL_PARSE_CALLEXPR(_label)      \
-  do {                                   \
-    CR_CALL(fid_parse_callexpr, _label); \
-  } while (0)
-/* }}} */
+  if ((len = snapshot_read_u32(r)) > 0) {
+    char *filename = (char *) malloc(len + 1);
+    snapshot_read(r, filename, len);
+    filename[len] = '\0';
+#ifndef V7_DISABLE_FILENAMES
+    b->filename = shdata_create_from_string(filename);
+#endif
+    free(filename);
+  }
+}
 
-/* parse_newexpr {{{ */
-/* parse_newexpr's arguments */
-#if 0
-typedef struct fid_parse_newexpr_arg {
-} fid_parse_newexpr_arg_t;
-#else
-typedef cr_zero_size_type_t fid_parse_newexpr_arg_t;
+#if V7_ENABLE__RegExp
+static void snapshot_load_regexp(struct snapshot_reader *r, size_t i,
+                                 const struct snapshot_regexp *sr) {
+  struct v7 *v7 = r->v7;
+  struct v7_regexp *rp;
+  struct slre_prog *prog = NULL;
+  val_t s = snapshot_load_val(r, sr->regexp_string);
+  char flags[3];
+  size_t len, flags_len = 0;
+  const char *re = v7_get_string(v7, &s, &len);
+
+  if (sr->flags & SLRE_FLAG_G) flags[flags_len++] = 'g';
+  if (sr->flags & SLRE_FLAG_I) flags[flags_len++] = 'i';
+  if (sr->flags & SLRE_FLAG_M) flags[flags_len++] = 'm';
+
+  if (r->error || !v7_is_string(s) ||
+      slre_compile(re, len, flags, flags_len, &prog, 1) != SLRE_OK ||
+      prog == NULL) {
+    r->error = 1;
+    return;
+  }
+
+  rp = (struct v7_regexp *) malloc(sizeof(*rp));
+  rp->regexp_string = s;
+  v7_own(v7, &rp->regexp_string);
+  rp->compiled_regexp = prog;
+  rp->lastIndex = (long) sr->last_index;
+  r->regexps[i] = rp;
+}
 #endif
 
-/* parse_newexpr's data on stack */
-typedef struct fid_parse_newexpr_locals {
-#if 0
-  struct fid_parse_newexpr_arg arg;
+/* Frees whatever was loaded, when the snapshot turns out to be unusable */
+static void snapshot_discard(struct snapshot_reader *r) {
+  struct v7 *v7 = r->v7;
+  size_t i;
+
+  for (i = 0; i < SNAPSHOT_ARENAS_CNT; i++) {
+    gc_arena_reset(snapshot_arena(v7, i), 0);
+  }
+  for (i = 0; r->bcodes != NULL && i < r->hdr.bcodes_cnt; i++) {
+    if (r->bcodes[i] == NULL) continue;
+    bcode_free(v7, r->bcodes[i]);
+    free(r->bcodes[i]);
+  }
+  for (i = 0; r->bufs != NULL && i < r->hdr.bufs_cnt; i++) {
+    if (r->bufs[i] == NULL) continue;
+    mbuf_free(r->bufs[i]);
+    free(r->bufs[i]);
+  }
+#if V7_ENABLE__RegExp
+  for (i = 0; r->regexps != NULL && i < r->hdr.regexps_cnt; i++) {
+    if (r->regexps[i] == NULL) continue;
+    slre_free(r->regexps[i]->compiled_regexp);
+    free(r->regexps[i]);
+  }
 #endif
+  v7_destroy(v7);
+}
 
-  ast_off_t start;
-} fid_parse_newexpr_locals_t;
+struct v7 *v7_create_from_snapshot(const char *path,
+                                   struct v7_create_opts opts) {
+  struct snapshot_reader r;
+  struct snapshot_build build;
+  struct snapshot_regexp *regexps = NULL;
+  struct v7 *v7 = NULL;
+  struct mbuf tmp;
+  char *ops;
+  size_t i, j;
 
-#define CALL_PARSE_NEWEXPR(_label)      \
-  do {                                  \
-    CR_CALL(fid_parse_newexpr, _label); \
-  } while (0)
-/* }}} */
+  memset(&r, 0, sizeof(r));
+  mbuf_init(&tmp, 0);
+  r.anchor = snapshot_anchor();
 
-/* parse_terminal {{{ */
-/* parse_terminal's arguments */
-#if 0
-typedef struct fid_parse_terminal_arg {
-} fid_parse_terminal_arg_t;
-#else
-typedef cr_zero_size_type_t fid_parse_terminal_arg_t;
-#endif
+  if ((r.fp = fopen(path, "rb")) == NULL) goto clean;
+  if ((v7 = r.v7 = v7_create_empty(opts)) == NULL) goto clean;
 
-/* parse_terminal's data on stack */
-typedef struct fid_parse_terminal_locals {
-#if 0
-  struct fid_parse_terminal_arg arg;
+  snapshot_build(v7, &build);
+  snapshot_read(&r, &r.hdr, sizeof(r.hdr));
+  if (r.error || memcmp(&r.hdr.build, &build, sizeof(build)) != 0) {
+    r.error = 1;
+    goto clean;
+  }
+
+  r.bcodes = (struct bcode **) calloc(r.hdr.bcodes_cnt + 1, sizeof(void *));
+  r.bufs = (struct mbuf **) calloc(r.hdr.bufs_cnt + 1, sizeof(void *));
+  r.regexps =
+      (struct v7_regexp **) calloc(r.hdr.regexps_cnt + 1, sizeof(void *));
+  r.strings = (val_t *) calloc(r.hdr.strings_cnt + 1, sizeof(val_t));
+  regexps = (struct snapshot_regexp *) calloc(r.hdr.regexps_cnt + 1,
+                                              sizeof(*regexps));
+  v7->snapshot_ops = (char *) malloc(r.hdr.ops_len + 1);
+  if (r.bcodes == NULL || r.bufs == NULL || r.regexps == NULL ||
+      r.strings == NULL || regexps == NULL || v7->snapshot_ops == NULL) {
+    r.error = 1;
+    goto clean;
+  }
+
+  /* strings are loaded verbatim, offsets and sequence numbers stay valid */
+  mbuf_resize(&v7->owned_strings, r.hdr.owned_strings_len);
+  v7->owned_strings.len = r.hdr.owned_strings_len;
+  snapshot_read(&r, v7->owned_strings.buf, v7->owned_strings.len);
+#ifndef V7_DISABLE_STR_ALLOC_SEQ
+  v7->gc_next_asn = r.hdr.gc_next_asn;
+  v7->gc_min_asn = r.hdr.gc_min_asn;
 #endif
 
-  ast_off_t start;
-} fid_parse_terminal_locals_t;
+  for (i = 0; i < SNAPSHOT_ARENAS_CNT; i++) {
+    struct gc_arena *a = snapshot_arena(v7, i);
+    r.bases[i] = gc_arena_reset(a, r.hdr.cells_cnt[i]);
+    snapshot_read(&r, r.bases[i], r.hdr.cells_cnt[i] * a->cell_size);
+  }
 
-#define CALL_PARSE_TERMINAL(_label)      \
-  do {                                   \
-    CR_CALL(fid_parse_terminal, _label); \
-  } while (0)
-/* }}} */
+  for (i = 0, ops = v7->snapshot_ops; i < r.hdr.bcodes_cnt && !r.error; i++) {
+    snapshot_load_bcode(&r, i, &ops);
+  }
 
-/* parse_block {{{ */
-/* parse_block's arguments */
-#if 0
-typedef struct fid_parse_block_arg {
-} fid_parse_block_arg_t;
-#else
-typedef cr_zero_size_type_t fid_parse_block_arg_t;
-#endif
+  for (i = 0; i < r.hdr.bufs_cnt && !r.error; i++) {
+    size_t n = snapshot_read_u32(&r);
+    struct mbuf *abuf = (struct mbuf *) malloc(sizeof(*abuf));
+    mbuf_init(abuf, n * sizeof(val_t));
+    r.bufs[i] = abuf;
+    if (n > 0 && abuf->buf == NULL) {
+      r.error = 1;
+      break;
+    }
+    abuf->len = n * sizeof(val_t);
+    snapshot_read(&r, abuf->buf, abuf->len);
+  }
 
-/* parse_block's data on stack */
-#if 0
-typedef struct fid_parse_block_locals {
-  struct fid_parse_block_arg arg;
-} fid_parse_block_locals_t;
-#else
-typedef cr_zero_size_type_t fid_parse_block_locals_t;
-#endif
+  snapshot_read(&r, regexps, r.hdr.regexps_cnt * sizeof(*regexps));
+  snapshot_read(&r, &v7->vals, sizeof(v7->vals));
 
-#define CALL_PARSE_BLOCK(_label)      \
-  do {                                \
-    CR_CALL(fid_parse_block, _label); \
-  } while (0)
-/* }}} */
+  for (i = 0; i < r.hdr.strings_cnt && !r.error; i++) {
+    size_t len = snapshot_read_u32(&r);
+    mbuf_resize(&tmp, len);
+    snapshot_read(&r, tmp.buf, len);
+    r.strings[i] = v7_mk_string(v7, tmp.buf, len, 1);
+  }
 
-/* parse_if {{{ */
-/* parse_if's arguments */
-#if 0
-typedef struct fid_parse_if_arg {
-} fid_parse_if_arg_t;
-#else
-typedef cr_zero_size_type_t fid_parse_if_arg_t;
+  if (r.error) goto clean;
+
+  /* everything is in memory: turn references back into pointers */
+#if V7_ENABLE__RegExp
+  for (i = 0; i < r.hdr.regexps_cnt; i++) {
+    snapshot_load_regexp(&r, i, &regexps[i]);
+  }
 #endif
+  for (i = 0; i < SNAPSHOT_ARENAS_CNT; i++) {
+    struct gc_arena *a = snapshot_arena(v7, i);
+    for (j = 0; j < r.hdr.cells_cnt[i]; j++) {
+      snapshot_load_cell(&r, i, GC_CELL_OP(a, r.bases[i], +, j));
+    }
+  }
+  for (i = 0; i < r.hdr.bcodes_cnt; i++) {
+    struct bcode *b = r.bcodes[i];
+    snapshot_load_vals(&r, (val_t *) b->lit.p, b->lit.len / sizeof(val_t));
+  }
+  for (i = 0; i < r.hdr.bufs_cnt; i++) {
+    struct mbuf *abuf = r.bufs[i];
+    snapshot_load_vals(&r, (val_t *) abuf->buf, abuf->len / sizeof(val_t));
+  }
+  snapshot_load_vals(&r, (val_t *) &v7->vals, sizeof(v7->vals) / sizeof(val_t));
 
-/* parse_if's data on stack */
-typedef struct fid_parse_if_locals {
-#if 0
-  struct fid_parse_if_arg arg;
+  if (r.error) goto clean;
+
+#ifndef V7_DISABLE_STRING_INTERNING
+  /*
+   * The loaded strings carry the interned flag of the snapshotted instance,
+   * but the table itself isn't saved: rebuild it from the property names.
+   */
+  interned_reset(v7);
+  {
+    struct gc_arena *a = snapshot_arena(v7, SNAPSHOT_PROPERTIES);
+    for (j = 0; j < r.hdr.cells_cnt[SNAPSHOT_PROPERTIES]; j++) {
+      struct v7_property *p = (struct v7_property *) GC_CELL_OP(
+          a, r.bases[SNAPSHOT_PROPERTIES], +, j);
+      if (MARKED_FREE(p) || (p->attributes & _V7_PROPERTY_ROPE)) continue;
+      p->name = intern_string_v(v7, p->name);
+    }
+  }
 #endif
 
-  ast_off_t start;
-} fid_parse_if_locals_t;
+  for (i = 0; i < SNAPSHOT_ARENAS_CNT; i++) {
+    gc_arena_relink(snapshot_arena(v7, i));
+  }
+  v7->inhibit_gc = 0;
 
-#define CALL_PARSE_IF(_label)      \
-  do {                             \
-    CR_CALL(fid_parse_if, _label); \
-  } while (0)
-/* }}} */
+clean:
+  if (r.error && v7 != NULL) {
+    snapshot_discard(&r);
+    v7 = NULL;
+  }
+  if (r.fp != NULL) fclose(r.fp);
+  free(r.bcodes);
+  free(r.bufs);
+  free(r.regexps);
+  free(r.strings);
+  free(regexps);
+  mbuf_free(&tmp);
+  return v7;
+}
 
-/* parse_while {{{ */
-/* parse_while's arguments */
-#if 0
-typedef struct fid_parse_while_arg {
-} fid_parse_while_arg_t;
-#else
-typedef cr_zero_size_type_t fid_parse_while_arg_t;
-#endif
+/* }}} Loading */
 
-/* parse_while's data on stack */
-typedef struct fid_parse_while_locals {
-#if 0
-  struct fid_parse_while_arg arg;
+#endif /* V7_ENABLE_SNAPSHOT */
+#ifdef V7_MODULE_LINES
+#line 1 "./src/profiler.c"
 #endif
+/*
+ * Copyright (c) 2014 Cesanta Software Limited
+ * All rights reserved
+ */
 
-  ast_off_t start;
-  uint8_t saved_in_loop;
-} fid_parse_while_locals_t;
+/* Amalgamated: #include "v7/src/internal.h" */
+/* Amalgamated: #include "v7/src/profiler.h" */
+/* Amalgamated: #include "v7/src/core.h" */
+/* Amalgamated: #include "v7/src/bcode.h" */
+/* Amalgamated: #include "common/mbuf.h" */
 
-#define CALL_PARSE_WHILE(_label)      \
-  do {                                \
-    CR_CALL(fid_parse_while, _label); \
-  } while (0)
-/* }}} */
+#if defined(V7_ENABLE_PROFILER) || defined(V7_ENABLE_HEAPLOG)
 
-/* parse_ident {{{ */
-/* parse_ident's arguments */
-#if 0
-typedef struct fid_parse_ident_arg {
-} fid_parse_ident_arg_t;
-#else
-typedef cr_zero_size_type_t fid_parse_ident_arg_t;
-#endif
+V7_PRIVATE uint32_t prof_hash(const char *p, size_t len) {
+  uint32_t h = 2166136261U; /* FNV-1a */
+  while (len-- > 0) {
+    h = (h ^ (uint8_t) *p++) * 16777619U;
+  }
+  return h;
+}
 
-/* parse_ident's data on stack */
-#if 0
-typedef struct fid_parse_ident_locals {
-  struct fid_parse_ident_arg arg;
-} fid_parse_ident_locals_t;
-#else
-typedef cr_zero_size_type_t fid_parse_ident_locals_t;
-#endif
+V7_PRIVATE void prof_append_str(struct mbuf *m, const char *str) {
+  mbuf_append(m, str, strlen(str));
+}
 
-#define CALL_PARSE_IDENT(_label)      \
-  do {                                \
-    CR_CALL(fid_parse_ident, _label); \
-  } while (0)
-/* }}} */
+/*
+ * Appends the name of a frame: `func (file:line)` for a function,
+ * `file:line` for a script, or `cfunc_<address>` for a C function.
+ */
+V7_PRIVATE void prof_append_frame(struct mbuf *m,
+                                  struct v7_call_frame_base *cf) {
+  char buf[32];
 
-/* parse_ident_allow_reserved_words {{{ */
-/* parse_ident_allow_reserved_words's arguments */
-#if 0
-typedef struct fid_parse_ident_allow_reserved_words_arg {
-} fid_parse_ident_allow_reserved_words_arg_t;
-#else
-typedef cr_zero_size_type_t fid_parse_ident_allow_reserved_words_arg_t;
+  if (cf->type_mask & V7_CALL_FRAME_MASK_BCODE) {
+    struct v7_call_frame_bcode *bcf = (struct v7_call_frame_bcode *) cf;
+    struct bcode *bcode = bcf->bcode;
+    const char *filename = NULL;
+    int line_no = 0;
+
+#ifndef V7_DISABLE_FILENAMES
+    filename = bcode_get_filename(bcode);
+#endif
+#ifndef V7_DISABLE_LINE_NUMBERS
+    line_no = bcode_get_line_no(bcode, bcf->bcode_ops);
 #endif
+    if (filename == NULL) {
+      filename = "<no filename>";
+    }
+
+    if (bcode->func_name_present) {
+      char *funcname;
+      bcode_next_name(bcode->ops.p, &funcname, NULL);
+      prof_append_str(m, funcname[0] != '\0' ? funcname : "<anonymous>");
+      prof_append_str(m, " (");
+    }
+    prof_append_str(m, filename);
+    snprintf(buf, sizeof(buf), ":%d", line_no);
+    prof_append_str(m, buf);
+    if (bcode->func_name_present) {
+      prof_append_str(m, ")");
+    }
+  } else {
+    snprintf(buf, sizeof(buf), "cfunc_%p",
+             (void *) ((struct v7_call_frame_cfunc *) cf)->cfunc);
+    prof_append_str(m, buf);
+  }
+}
 
-/* parse_ident_allow_reserved_words's data on stack */
-#if 0
-typedef struct fid_parse_ident_allow_reserved_words_locals {
-  struct fid_parse_ident_allow_reserved_words_arg arg;
-} fid_parse_ident_allow_reserved_words_locals_t;
-#else
-typedef cr_zero_size_type_t fid_parse_ident_allow_reserved_words_locals_t;
 #endif
 
-#define CALL_PARSE_IDENT_ALLOW_RESERVED_WORDS(_label)      \
-  do {                                                     \
-    CR_CALL(fid_parse_ident_allow_reserved_words, _label); \
-  } while (0)
-/* }}} */
+#ifdef V7_ENABLE_PROFILER
 
-/* parse_funcdecl {{{ */
-/* parse_funcdecl's arguments */
-typedef struct fid_parse_funcdecl_arg {
-  uint8_t require_named;
-  uint8_t reserved_name;
-} fid_parse_funcdecl_arg_t;
+#ifdef V7_PROFILER_SIGPROF
+#include <signal.h>
+#include <sys/time.h>
 
-/* parse_funcdecl's data on stack */
-typedef struct fid_parse_funcdecl_locals {
-  struct fid_parse_funcdecl_arg arg;
+/* Instance being profiled, and the `SIGPROF` action to restore on stop */
+static struct v7 *s_prof_v7;
+static struct sigaction s_prof_saved_action;
 
-  ast_off_t start;
-  ast_off_t outer_last_var_node;
-  uint8_t saved_in_function;
-  uint8_t saved_in_strict;
-} fid_parse_funcdecl_locals_t;
+static void prof_sigprof_handler(int sig) {
+  struct v7 *v7 = s_prof_v7;
+  (void) sig;
+  if (v7 != NULL) {
+    v7->prof_tick = 1;
+  }
+}
+#endif
 
-#define CALL_PARSE_FUNCDECL(_require_named, _reserved_name, _label) \
-  do {                                                              \
-    N.fid_parse_funcdecl.require_named = (_require_named);          \
-    N.fid_parse_funcdecl.reserved_name = (_reserved_name);          \
-    CR_CALL(fid_parse_funcdecl, _label);                            \
-  } while (0)
-/* }}} */
+V7_PRIVATE void profiler_sample(struct v7 *v7) {
+  struct v7_call_frame_base *frames[V7_PROFILER_MAX_DEPTH];
+  struct v7_call_frame_base *cf;
+  struct mbuf *m = &v7->prof_buf;
+  struct v7_prof_entry *e;
+  int i, n = 0;
+  uint32_t hash, mask = V7_PROFILER_MAX_STACKS - 1;
 
-/* parse_arglist {{{ */
-/* parse_arglist's arguments */
-#if 0
-typedef struct fid_parse_arglist_arg {
-} fid_parse_arglist_arg_t;
-#else
-typedef cr_zero_size_type_t fid_parse_arglist_arg_t;
-#endif
-
-/* parse_arglist's data on stack */
-#if 0
-typedef struct fid_parse_arglist_locals {
-  struct fid_parse_arglist_arg arg;
-} fid_parse_arglist_locals_t;
-#else
-typedef cr_zero_size_type_t fid_parse_arglist_locals_t;
-#endif
-
-#define CALL_PARSE_ARGLIST(_label)      \
-  do {                                  \
-    CR_CALL(fid_parse_arglist, _label); \
-  } while (0)
-/* }}} */
-
-/* parse_member {{{ */
-/* parse_member's arguments */
-typedef struct fid_parse_member_arg { ast_off_t pos; } fid_parse_member_arg_t;
+  v7->prof_tick = 0;
+  v7->prof_countdown = v7->prof_interval;
 
-/* parse_member's data on stack */
-typedef struct fid_parse_member_locals {
-  struct fid_parse_member_arg arg;
-} fid_parse_member_locals_t;
+  if (v7->prof_stacks == NULL) {
+    /* a signal which came after `v7_profiler_stop()` */
+    return;
+  }
 
-#define CALL_PARSE_MEMBER(_pos, _label) \
-  do {                                  \
-    N.fid_parse_member.pos = (_pos);    \
-    CR_CALL(fid_parse_member, _label);  \
-  } while (0)
-/* }}} */
+  for (cf = v7->call_stack; cf != NULL && n < V7_PROFILER_MAX_DEPTH;
+       cf = cf->prev) {
+    if ((cf->type_mask & V7_CALL_FRAME_MASK_CFUNC) ||
+        ((cf->type_mask & V7_CALL_FRAME_MASK_BCODE) &&
+         ((struct v7_call_frame_bcode *) cf)->bcode != NULL)) {
+      frames[n++] = cf;
+    }
+  }
 
-/* parse_memberexpr {{{ */
-/* parse_memberexpr's arguments */
-#if 0
-typedef struct fid_parse_memberexpr_arg {
-} fid_parse_memberexpr_arg_t;
-#else
-typedef cr_zero_size_type_t fid_parse_memberexpr_arg_t;
-#endif
+  /* collapsed stack goes from the outermost frame */
+  m->len = 0;
+  for (i = n - 1; i >= 0; i--) {
+    prof_append_frame(m, frames[i]);
+    if (i > 0) {
+      mbuf_append(m, ";", 1);
+    }
+  }
+  hash = prof_hash(m->buf, m->len);
 
-/* parse_memberexpr's data on stack */
-typedef struct fid_parse_memberexpr_locals {
-#if 0
-  struct fid_parse_memberexpr_arg arg;
-#endif
+  for (e = &v7->prof_stacks[hash & mask]; e->stack != NULL;
+       e = &v7->prof_stacks[(e - v7->prof_stacks + 1) & mask]) {
+    if (e->hash == hash && strlen(e->stack) == m->len &&
+        memcmp(e->stack, m->buf, m->len) == 0) {
+      e->count++;
+      return;
+    }
+  }
 
-  ast_off_t pos;
-} fid_parse_memberexpr_locals_t;
+  /* keep the table at most 3/4 full, so that the lookups stay short */
+  if (v7->prof_stacks_cnt >= V7_PROFILER_MAX_STACKS / 4 * 3 ||
+      (e->stack = (char *) malloc(m->len + 1)) == NULL) {
+    v7->prof_dropped++;
+    return;
+  }
+  memcpy(e->stack, m->buf, m->len);
+  e->stack[m->len] = '\0';
+  e->hash = hash;
+  e->count = 1;
+  v7->prof_stacks_cnt++;
+}
 
-#define CALL_PARSE_MEMBEREXPR(_label)      \
-  do {                                     \
-    CR_CALL(fid_parse_memberexpr, _label); \
-  } while (0)
-/* }}} */
+static void prof_free_stacks(struct v7 *v7) {
+  int i;
+  if (v7->prof_stacks != NULL) {
+    for (i = 0; i < V7_PROFILER_MAX_STACKS; i++) {
+      free(v7->prof_stacks[i].stack);
+    }
+    free(v7->prof_stacks);
+    v7->prof_stacks = NULL;
+  }
+  v7->prof_stacks_cnt = 0;
+  v7->prof_dropped = 0;
+}
 
-/* parse_var {{{ */
-/* parse_var's arguments */
-#if 0
-typedef struct fid_parse_var_arg {
-} fid_parse_var_arg_t;
-#else
-typedef cr_zero_size_type_t fid_parse_var_arg_t;
-#endif
+int v7_profiler_start(struct v7 *v7, unsigned int interval) {
+#ifdef V7_PROFILER_SIGPROF
+  struct sigaction sa;
+  struct itimerval it;
 
-/* parse_var's data on stack */
-typedef struct fid_parse_var_locals {
-#if 0
-  struct fid_parse_var_arg arg;
+  if (s_prof_v7 != NULL && s_prof_v7 != v7) {
+    return -1;
+  }
 #endif
 
-  ast_off_t start;
-} fid_parse_var_locals_t;
+  if (interval == 0) {
+    return -1;
+  }
+  v7_profiler_stop(v7);
 
-#define CALL_PARSE_VAR(_label)      \
-  do {                              \
-    CR_CALL(fid_parse_var, _label); \
-  } while (0)
-/* }}} */
+  prof_free_stacks(v7);
+  v7->prof_stacks = (struct v7_prof_entry *) calloc(
+      V7_PROFILER_MAX_STACKS, sizeof(*v7->prof_stacks));
+  if (v7->prof_stacks == NULL) {
+    return -1;
+  }
+  v7->prof_interval = interval;
 
-/* parse_prop {{{ */
-/* parse_prop's arguments */
-#if 0
-typedef struct fid_parse_prop_arg {
-} fid_parse_prop_arg_t;
-#else
-typedef cr_zero_size_type_t fid_parse_prop_arg_t;
-#endif
+#ifdef V7_PROFILER_SIGPROF
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = prof_sigprof_handler;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  s_prof_v7 = v7;
+  if (sigaction(SIGPROF, &sa, &s_prof_saved_action) != 0) {
+    s_prof_v7 = NULL;
+    return -1;
+  }
 
-/* parse_prop's data on stack */
-#if 0
-typedef struct fid_parse_prop_locals {
-  struct fid_parse_prop_arg arg;
-} fid_parse_prop_locals_t;
+  it.it_interval.tv_sec = interval / 1000000;
+  it.it_interval.tv_usec = interval % 1000000;
+  it.it_value = it.it_interval;
+  if (setitimer(ITIMER_PROF, &it, NULL) != 0) {
+    v7_profiler_stop(v7);
+    return -1;
+  }
 #else
-typedef cr_zero_size_type_t fid_parse_prop_locals_t;
+  v7->prof_countdown = interval;
 #endif
 
-#define CALL_PARSE_PROP(_label)      \
-  do {                               \
-    CR_CALL(fid_parse_prop, _label); \
-  } while (0)
-/* }}} */
+  return 0;
+}
 
-/* parse_dowhile {{{ */
-/* parse_dowhile's arguments */
-#if 0
-typedef struct fid_parse_dowhile_arg {
-} fid_parse_dowhile_arg_t;
-#else
-typedef cr_zero_size_type_t fid_parse_dowhile_arg_t;
+void v7_profiler_stop(struct v7 *v7) {
+#ifdef V7_PROFILER_SIGPROF
+  if (s_prof_v7 == v7) {
+    struct itimerval it;
+    memset(&it, 0, sizeof(it));
+    setitimer(ITIMER_PROF, &it, NULL);
+    sigaction(SIGPROF, &s_prof_saved_action, NULL);
+    s_prof_v7 = NULL;
+  }
 #endif
+  v7->prof_countdown = 0;
+  v7->prof_tick = 0;
+}
 
-/* parse_dowhile's data on stack */
-typedef struct fid_parse_dowhile_locals {
-#if 0
-  struct fid_parse_dowhile_arg arg;
-#endif
+char *v7_profiler_dump(struct v7 *v7, size_t *len) {
+  struct mbuf out;
+  char buf[32];
+  int i;
 
-  ast_off_t start;
-  uint8_t saved_in_loop;
-} fid_parse_dowhile_locals_t;
+  mbuf_init(&out, 0);
+  for (i = 0; v7->prof_stacks != NULL && i < V7_PROFILER_MAX_STACKS; i++) {
+    struct v7_prof_entry *e = &v7->prof_stacks[i];
+    if (e->stack != NULL) {
+      prof_append_str(&out, e->stack);
+      snprintf(buf, sizeof(buf), " %lu\n", e->count);
+      prof_append_str(&out, buf);
+    }
+  }
+  if (v7->prof_dropped > 0) {
+    snprintf(buf, sizeof(buf), "[other] %lu\n", v7->prof_dropped);
+    prof_append_str(&out, buf);
+  }
 
-#define CALL_PARSE_DOWHILE(_label)      \
-  do {                                  \
-    CR_CALL(fid_parse_dowhile, _label); \
-  } while (0)
-/* }}} */
+  if (len != NULL) {
+    *len = out.len;
+  }
+  mbuf_append(&out, "", 1);
+  return out.buf;
+}
 
-/* parse_for {{{ */
-/* parse_for's arguments */
-#if 0
-typedef struct fid_parse_for_arg {
-} fid_parse_for_arg_t;
-#else
-typedef cr_zero_size_type_t fid_parse_for_arg_t;
-#endif
+V7_PRIVATE void profiler_destroy(struct v7 *v7) {
+  v7_profiler_stop(v7);
+  prof_free_stacks(v7);
+  mbuf_free(&v7->prof_buf);
+}
 
-/* parse_for's data on stack */
-typedef struct fid_parse_for_locals {
-#if 0
-  struct fid_parse_for_arg arg;
+#endif /* V7_ENABLE_PROFILER */
+#ifdef V7_MODULE_LINES
+#line 1 "./src/stats.c"
 #endif
+/*
+ * Copyright (c) 2014 Cesanta Software Limited
+ * All rights reserved
+ */
 
-  ast_off_t start;
-  uint8_t saved_in_loop;
-} fid_parse_for_locals_t;
+/* Amalgamated: #include "v7/src/internal.h" */
+/* Amalgamated: #include "v7/src/stats.h" */
+/* Amalgamated: #include "v7/src/core.h" */
+/* Amalgamated: #include "v7/src/function.h" */
+/* Amalgamated: #include "v7/src/string.h" */
+/* Amalgamated: #include "v7/src/object.h" */
+/* Amalgamated: #include "v7/src/array.h" */
+/* Amalgamated: #include "common/mbuf.h" */
 
-#define CALL_PARSE_FOR(_label)      \
-  do {                              \
-    CR_CALL(fid_parse_for, _label); \
-  } while (0)
-/* }}} */
+#ifdef V7_ENABLE_STATS
 
-/* parse_try {{{ */
-/* parse_try's arguments */
-#if 0
-typedef struct fid_parse_try_arg {
-} fid_parse_try_arg_t;
+#ifndef _WIN32
+#include <sys/time.h>
 #else
-typedef cr_zero_size_type_t fid_parse_try_arg_t;
-#endif
-
-/* parse_try's data on stack */
-typedef struct fid_parse_try_locals {
-#if 0
-  struct fid_parse_try_arg arg;
+#include <time.h>
 #endif
 
-  ast_off_t start;
-  uint8_t catch_or_finally;
-} fid_parse_try_locals_t;
+/*
+ * C functions are looked up in the global object, and in the objects this
+ * many levels below it: `Array.prototype.push` is 2 levels below.
+ */
+#define STATS_NAME_MAX_DEPTH 3
 
-#define CALL_PARSE_TRY(_label)      \
-  do {                              \
-    CR_CALL(fid_parse_try, _label); \
-  } while (0)
-/* }}} */
+V7_PRIVATE void stats_count_prop_lookup(struct v7 *v7, unsigned long depth) {
+  struct v7_stats *s = &v7->stats;
+  s->prop_lookups++;
+  s->prop_lookup_steps += depth;
+  if (depth > 0) {
+    s->prop_depths[(depth < V7_STATS_PROP_DEPTHS ? depth
+                                                 : V7_STATS_PROP_DEPTHS) -
+                   1]++;
+  }
+}
 
-/* parse_switch {{{ */
-/* parse_switch's arguments */
-#if 0
-typedef struct fid_parse_switch_arg {
-} fid_parse_switch_arg_t;
-#else
-typedef cr_zero_size_type_t fid_parse_switch_arg_t;
-#endif
+/* Returns the counters of a given C function, or NULL if it isn't counted */
+static struct v7_cfunc_stat *stats_find_cfunc(struct v7 *v7,
+                                              v7_cfunction_t *func,
+                                              uint16_t **slot) {
+  struct v7_stats *s = &v7->stats;
+  size_t i = ((uintptr_t) func >> 2) % ARRAY_SIZE(s->cfunc_slots);
 
-/* parse_switch's data on stack */
-typedef struct fid_parse_switch_locals {
-#if 0
-  struct fid_parse_switch_arg arg;
-#endif
+  /* there are twice as many slots as entries, so a free one is always met */
+  while (s->cfunc_slots[i] != 0) {
+    struct v7_cfunc_stat *e = &s->cfuncs[s->cfunc_slots[i] - 1];
+    if (e->func == func) {
+      return e;
+    }
+    i = (i + 1) % ARRAY_SIZE(s->cfunc_slots);
+  }
+  if (slot != NULL) {
+    *slot = &s->cfunc_slots[i];
+  }
+  return NULL;
+}
 
-  ast_off_t start;
-  int saved_in_switch;
-  ast_off_t case_start;
-} fid_parse_switch_locals_t;
+V7_PRIVATE void stats_count_cfunc(struct v7 *v7, v7_cfunction_t *func) {
+  struct v7_stats *s = &v7->stats;
+  uint16_t *slot;
+  struct v7_cfunc_stat *e = stats_find_cfunc(v7, func, &slot);
 
-#define CALL_PARSE_SWITCH(_label)      \
-  do {                                 \
-    CR_CALL(fid_parse_switch, _label); \
-  } while (0)
-/* }}} */
+  s->cfunc_calls++;
+  if (e == NULL) {
+    if (s->cfuncs_cnt == V7_STATS_MAX_CFUNCS) {
+      /* no room: the call is only counted in the total */
+      return;
+    }
+    e = &s->cfuncs[s->cfuncs_cnt++];
+    e->func = func;
+    e->calls = 0;
+    e->name = NULL;
+    *slot = s->cfuncs_cnt;
+  }
+  e->calls++;
+}
 
-/* parse_with {{{ */
-/* parse_with's arguments */
-#if 0
-typedef struct fid_parse_with_arg {
-} fid_parse_with_arg_t;
+V7_PRIVATE double stats_now_us(void) {
+#ifndef _WIN32
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (double) tv.tv_sec * 1000000 + tv.tv_usec;
 #else
-typedef cr_zero_size_type_t fid_parse_with_arg_t;
+  return (double) clock() * 1000000 / CLOCKS_PER_SEC;
 #endif
+}
 
-/* parse_with's data on stack */
-typedef struct fid_parse_with_locals {
-#if 0
-  struct fid_parse_with_arg arg;
-#endif
+V7_PRIVATE void stats_count_gc(struct v7 *v7, int is_step, double start_us) {
+  struct v7_stats *s = &v7->stats;
+  double elapsed = stats_now_us() - start_us;
 
-  ast_off_t start;
-} fid_parse_with_locals_t;
+  if (is_step) {
+    s->gc_steps++;
+  } else {
+    s->gc_cycles++;
+  }
+  if (elapsed > 0) {
+    s->gc_time_us += elapsed;
+  }
+}
 
-#define CALL_PARSE_WITH(_label)      \
-  do {                               \
-    CR_CALL(fid_parse_with, _label); \
-  } while (0)
-/* }}} */
+static void stats_set_cfunc_name(struct v7_cfunc_stat *e, const char *name,
+                                 size_t len) {
+  e->name = (char *) malloc(len + 1);
+  if (e->name != NULL) {
+    memcpy(e->name, name, len);
+    e->name[len] = '\0';
+  }
+}
 
-/* }}} */
+/* Names the C function `func`, if it's counted and isn't named yet */
+static void stats_name_cfunc(struct v7 *v7, val_t func, struct mbuf *path) {
+  v7_cfunction_t *f = get_cfunction_ptr(v7, func);
+  struct v7_cfunc_stat *e = f != NULL ? stats_find_cfunc(v7, f, NULL) : NULL;
+  if (e != NULL && e->name == NULL) {
+    stats_set_cfunc_name(e, path->buf, path->len);
+  }
+}
 
 /*
- * Array of "function" descriptors. Each descriptor contains just a size
- * of "function"'s locals.
+ * Names the counted C functions which are found exactly `depth` levels below
+ * `obj`, whose name is in `path`, after the path to them. Accessors are
+ * named after their property.
  */
-static const struct cr_func_desc _fid_descrs[MY_FID_CNT] = {
+static void stats_name_cfuncs(struct v7 *v7, val_t obj, struct mbuf *path,
+                              int depth) {
+  void *h = NULL;
+  val_t name, value;
+  v7_prop_attr_t attrs;
+  size_t path_len = path->len;
 
-    /* fid_none */
-    {0},
+  while ((h = v7_next_prop(h, obj, &name, &value, &attrs)) != NULL) {
+    size_t n;
+    const char *s;
 
-    /* fid_parse_script ----------------------------------------- */
-    /* fid_parse_script */
-    {CR_LOCALS_SIZEOF(fid_parse_script_locals_t)},
-    /* fid_p_script_1 */
-    {CR_LOCALS_SIZEOF(fid_parse_script_locals_t)},
-    /* fid_p_script_2 */
-    {CR_LOCALS_SIZEOF(fid_parse_script_locals_t)},
-    /* fid_p_script_3 */
-    {CR_LOCALS_SIZEOF(fid_parse_script_locals_t)},
-    /* fid_p_script_4 */
-    {CR_LOCALS_SIZEOF(fid_parse_script_locals_t)},
+    if ((attrs & _V7_PROPERTY_HIDDEN) || !v7_is_string(name)) {
+      continue;
+    }
 
-    /* fid_parse_use_strict ----------------------------------------- */
-    /* fid_parse_use_strict */
-    {CR_LOCALS_SIZEOF(fid_parse_use_strict_locals_t)},
+    s = v7_get_string(v7, &name, &n);
+    if (path_len > 0) {
+      mbuf_append(path, ".", 1);
+    }
+    mbuf_append(path, s, n);
 
-    /* fid_parse_body ----------------------------------------- */
-    /* fid_parse_body */
-    {CR_LOCALS_SIZEOF(fid_parse_body_locals_t)},
-    /* fid_p_body_1 */
-    {CR_LOCALS_SIZEOF(fid_parse_body_locals_t)},
-    /* fid_p_body_2 */
-    {CR_LOCALS_SIZEOF(fid_parse_body_locals_t)},
+    if ((attrs & V7_PROPERTY_GETTER) && (attrs & V7_PROPERTY_SETTER)) {
+      /* the value is an array of the getter and the setter */
+      if (depth == 0) {
+        stats_name_cfunc(v7, v7_array_get(v7, value, 0), path);
+        stats_name_cfunc(v7, v7_array_get(v7, value, 1), path);
+      }
+    } else if (depth == 0) {
+      stats_name_cfunc(v7, value, path);
+    } else if (v7_is_object(value) &&
+               !(attrs & (V7_PROPERTY_GETTER | V7_PROPERTY_SETTER))) {
+      stats_name_cfuncs(v7, value, path, depth - 1);
+    }
 
-    /* fid_parse_statement ----------------------------------------- */
-    /* fid_parse_statement */
-    {CR_LOCALS_SIZEOF(fid_parse_statement_locals_t)},
-    /* fid_p_stat_1 */
-    {CR_LOCALS_SIZEOF(fid_parse_statement_locals_t)},
-    /* fid_p_stat_2 */
-    {CR_LOCALS_SIZEOF(fid_parse_statement_locals_t)},
-    /* fid_p_stat_3 */
-    {CR_LOCALS_SIZEOF(fid_parse_statement_locals_t)},
-    /* fid_p_stat_4 */
-    {CR_LOCALS_SIZEOF(fid_parse_statement_locals_t)},
-    /* fid_p_stat_5 */
-    {CR_LOCALS_SIZEOF(fid_parse_statement_locals_t)},
-    /* fid_p_stat_6 */
-    {CR_LOCALS_SIZEOF(fid_parse_statement_locals_t)},
-    /* fid_p_stat_7 */
-    {CR_LOCALS_SIZEOF(fid_parse_statement_locals_t)},
-    /* fid_p_stat_8 */
-    {CR_LOCALS_SIZEOF(fid_parse_statement_locals_t)},
-    /* fid_p_stat_9 */
-    {CR_LOCALS_SIZEOF(fid_parse_statement_locals_t)},
-    /* fid_p_stat_10 */
-    {CR_LOCALS_SIZEOF(fid_parse_statement_locals_t)},
-    /* fid_p_stat_11 */
-    {CR_LOCALS_SIZEOF(fid_parse_statement_locals_t)},
-    /* fid_p_stat_12 */
-    {CR_LOCALS_SIZEOF(fid_parse_statement_locals_t)},
-    /* fid_p_stat_13 */
-    {CR_LOCALS_SIZEOF(fid_parse_statement_locals_t)},
-    /* fid_p_stat_14 */
-    {CR_LOCALS_SIZEOF(fid_parse_statement_locals_t)},
+    path->len = path_len;
+  }
+}
 
-    /* fid_parse_expression ----------------------------------------- */
-    /* fid_parse_expression */
-    {CR_LOCALS_SIZEOF(fid_parse_expression_locals_t)},
-    /* fid_p_expr_1 */
-    {CR_LOCALS_SIZEOF(fid_parse_expression_locals_t)},
+unsigned long v7_exec_stat(struct v7 *v7, enum v7_exec_stat_what what,
+                           int idx) {
+  struct v7_stats *s = &v7->stats;
 
-    /* fid_parse_assign ----------------------------------------- */
-    /* fid_parse_assign */
-    {CR_LOCALS_SIZEOF(fid_parse_assign_locals_t)},
-    /* fid_p_assign_1 */
-    {CR_LOCALS_SIZEOF(fid_parse_assign_locals_t)},
+  switch (what) {
+    case V7_EXEC_STAT_OPCODES:
+      return OP_MAX;
+    case V7_EXEC_STAT_OPS: {
+      unsigned long ops = 0;
+      int i;
+      for (i = 0; i < OP_MAX; i++) {
+        ops += s->ops[i];
+      }
+      return ops;
+    }
+    case V7_EXEC_STAT_OP:
+      return (idx >= 0 && idx < OP_MAX) ? s->ops[idx] : 0;
+    case V7_EXEC_STAT_OP_PAIR:
+      return (idx >= 0 && idx < OP_MAX * OP_MAX)
+                 ? s->op_pairs[idx / OP_MAX][idx % OP_MAX]
+                 : 0;
+    case V7_EXEC_STAT_PROP_LOOKUPS:
+      return s->prop_lookups;
+    case V7_EXEC_STAT_PROP_LOOKUP_STEPS:
+      return s->prop_lookup_steps;
+    case V7_EXEC_STAT_PROP_LOOKUP_DEPTHS:
+      return V7_STATS_PROP_DEPTHS;
+    case V7_EXEC_STAT_PROP_LOOKUP_DEPTH:
+      return (idx >= 0 && idx < V7_STATS_PROP_DEPTHS) ? s->prop_depths[idx]
+                                                      : 0;
+    case V7_EXEC_STAT_CFUNC_CALLS:
+      return s->cfunc_calls;
+    case V7_EXEC_STAT_CFUNCS:
+      return s->cfuncs_cnt;
+    case V7_EXEC_STAT_CFUNC:
+      return (idx >= 0 && idx < s->cfuncs_cnt) ? s->cfuncs[idx].calls : 0;
+    case V7_EXEC_STAT_GC_CYCLES:
+      return s->gc_cycles;
+    case V7_EXEC_STAT_GC_STEPS:
+      return s->gc_steps;
+    case V7_EXEC_STAT_GC_TIME_US:
+      return (unsigned long) s->gc_time_us;
+  }
 
-    /* fid_parse_binary ----------------------------------------- */
-    /* fid_parse_binary */
-    {CR_LOCALS_SIZEOF(fid_parse_binary_locals_t)},
-    /* fid_p_binary_1 */
-    {CR_LOCALS_SIZEOF(fid_parse_binary_locals_t)},
-    /* fid_p_binary_2 */
-    {CR_LOCALS_SIZEOF(fid_parse_binary_locals_t)},
-    /* fid_p_binary_3 */
-    {CR_LOCALS_SIZEOF(fid_parse_binary_locals_t)},
-    /* fid_p_binary_4 */
-    {CR_LOCALS_SIZEOF(fid_parse_binary_locals_t)},
-    /* fid_p_binary_5 */
-    {CR_LOCALS_SIZEOF(fid_parse_binary_locals_t)},
-    /* fid_p_binary_6 */
-    {CR_LOCALS_SIZEOF(fid_parse_binary_locals_t)},
+  return 0;
+}
 
-    /* fid_parse_prefix ----------------------------------------- */
-    /* fid_parse_prefix */
-    {CR_LOCALS_SIZEOF(fid_parse_prefix_locals_t)},
-    /* fid_p_prefix_1 */
-    {CR_LOCALS_SIZEOF(fid_parse_prefix_locals_t)},
+const char *v7_exec_stat_cfunc_name(struct v7 *v7, int idx) {
+  struct v7_stats *s = &v7->stats;
+  struct v7_cfunc_stat *e;
 
-    /* fid_parse_postfix ----------------------------------------- */
-    /* fid_parse_postfix */
-    {CR_LOCALS_SIZEOF(fid_parse_postfix_locals_t)},
-    /* fid_p_postfix_1 */
-    {CR_LOCALS_SIZEOF(fid_parse_postfix_locals_t)},
+  if (idx < 0 || idx >= s->cfuncs_cnt) {
+    return NULL;
+  }
 
-    /* fid_parse_callexpr ----------------------------------------- */
-    /* fid_parse_callexpr */
-    {CR_LOCALS_SIZEOF(fid_parse_callexpr_locals_t)},
-    /* fid_p_callexpr_1 */
-    {CR_LOCALS_SIZEOF(fid_parse_callexpr_locals_t)},
-    /* fid_p_callexpr_2 */
-    {CR_LOCALS_SIZEOF(fid_parse_callexpr_locals_t)},
-    /* fid_p_callexpr_3 */
-    {CR_LOCALS_SIZEOF(fid_parse_callexpr_locals_t)},
+  e = &s->cfuncs[idx];
+  if (e->name == NULL) {
+    /* the shortest path wins: look at each level in turn */
+    struct mbuf path;
+    int depth;
+    mbuf_init(&path, 0);
+    for (depth = 0; depth <= STATS_NAME_MAX_DEPTH && e->name == NULL;
+         depth++) {
+      stats_name_cfuncs(v7, v7->vals.global_object, &path, depth);
+    }
+    mbuf_free(&path);
+  }
 
-    /* fid_parse_newexpr ----------------------------------------- */
-    /* fid_parse_newexpr */
-    {CR_LOCALS_SIZEOF(fid_parse_newexpr_locals_t)},
-    /* fid_p_newexpr_1 */
-    {CR_LOCALS_SIZEOF(fid_parse_newexpr_locals_t)},
-    /* fid_p_newexpr_2 */
-    {CR_LOCALS_SIZEOF(fid_parse_newexpr_locals_t)},
-    /* fid_p_newexpr_3 */
-    {CR_LOCALS_SIZEOF(fid_parse_newexpr_locals_t)},
-    /* fid_p_newexpr_4 */
-    {CR_LOCALS_SIZEOF(fid_parse_newexpr_locals_t)},
+  if (e->name == NULL) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "cfunc_%p", (void *) e->func);
+    stats_set_cfunc_name(e, buf, strlen(buf));
+  }
 
-    /* fid_parse_terminal ----------------------------------------- */
-    /* fid_parse_terminal */
-    {CR_LOCALS_SIZEOF(fid_parse_terminal_locals_t)},
-    /* fid_p_terminal_1 */
-    {CR_LOCALS_SIZEOF(fid_parse_terminal_locals_t)},
-    /* fid_p_terminal_2 */
-    {CR_LOCALS_SIZEOF(fid_parse_terminal_locals_t)},
-    /* fid_p_terminal_3 */
-    {CR_LOCALS_SIZEOF(fid_parse_terminal_locals_t)},
-    /* fid_p_terminal_4 */
-    {CR_LOCALS_SIZEOF(fid_parse_terminal_locals_t)},
+  return e->name;
+}
 
-    /* fid_parse_block ----------------------------------------- */
-    /* fid_parse_block */
-    {CR_LOCALS_SIZEOF(fid_parse_block_locals_t)},
-    /* fid_p_block_1 */
-    {CR_LOCALS_SIZEOF(fid_parse_block_locals_t)},
+V7_PRIVATE void stats_destroy(struct v7 *v7) {
+  int i;
+  for (i = 0; i < v7->stats.cfuncs_cnt; i++) {
+    free(v7->stats.cfuncs[i].name);
+  }
+}
 
-    /* fid_parse_if ----------------------------------------- */
-    /* fid_parse_if */
-    {CR_LOCALS_SIZEOF(fid_parse_if_locals_t)},
-    /* fid_p_if_1 */
-    {CR_LOCALS_SIZEOF(fid_parse_if_locals_t)},
-    /* fid_p_if_2 */
-    {CR_LOCALS_SIZEOF(fid_parse_if_locals_t)},
-    /* fid_p_if_3 */
-    {CR_LOCALS_SIZEOF(fid_parse_if_locals_t)},
+void v7_exec_stat_reset(struct v7 *v7) {
+  stats_destroy(v7);
+  memset(&v7->stats, 0, sizeof(v7->stats));
+}
 
-    /* fid_parse_while ----------------------------------------- */
-    /* fid_parse_while */
-    {CR_LOCALS_SIZEOF(fid_parse_while_locals_t)},
-    /* fid_p_while_1 */
-    {CR_LOCALS_SIZEOF(fid_parse_while_locals_t)},
-    /* fid_p_while_2 */
-    {CR_LOCALS_SIZEOF(fid_parse_while_locals_t)},
+#endif /* V7_ENABLE_STATS */
+#ifdef V7_MODULE_LINES
+#line 1 "./src/heaplog.c"
+#endif
+/*
+ * Copyright (c) 2014 Cesanta Software Limited
+ * All rights reserved
+ */
 
-    /* fid_parse_ident ----------------------------------------- */
-    /* fid_parse_ident */
-    {CR_LOCALS_SIZEOF(fid_parse_ident_locals_t)},
+/* Amalgamated: #include "v7/src/internal.h" */
+/* Amalgamated: #include "v7/src/heaplog.h" */
+/* Amalgamated: #include "v7/src/profiler.h" */
+/* Amalgamated: #include "v7/src/core.h" */
+/* Amalgamated: #include "v7/src/gc.h" */
+/* Amalgamated: #include "common/mbuf.h" */
 
-    /* fid_parse_ident_allow_reserved_words -------------------- */
-    /* fid_parse_ident_allow_reserved_words */
-    {CR_LOCALS_SIZEOF(fid_parse_ident_allow_reserved_words_locals_t)},
-    /* fid_p_ident_allow_reserved_words_1 */
-    {CR_LOCALS_SIZEOF(fid_parse_ident_allow_reserved_words_locals_t)},
+#ifdef V7_ENABLE_HEAPLOG
 
-    /* fid_parse_funcdecl ----------------------------------------- */
-    /* fid_parse_funcdecl */
-    {CR_LOCALS_SIZEOF(fid_parse_funcdecl_locals_t)},
-    /* fid_p_funcdecl_1 */
-    {CR_LOCALS_SIZEOF(fid_parse_funcdecl_locals_t)},
-    /* fid_p_funcdecl_2 */
-    {CR_LOCALS_SIZEOF(fid_parse_funcdecl_locals_t)},
-    /* fid_p_funcdecl_3 */
-    {CR_LOCALS_SIZEOF(fid_parse_funcdecl_locals_t)},
-    /* fid_p_funcdecl_4 */
-    {CR_LOCALS_SIZEOF(fid_parse_funcdecl_locals_t)},
-    /* fid_p_funcdecl_5 */
-    {CR_LOCALS_SIZEOF(fid_parse_funcdecl_locals_t)},
-    /* fid_p_funcdecl_6 */
-    {CR_LOCALS_SIZEOF(fid_parse_funcdecl_locals_t)},
-    /* fid_p_funcdecl_7 */
-    {CR_LOCALS_SIZEOF(fid_parse_funcdecl_locals_t)},
-    /* fid_p_funcdecl_8 */
-    {CR_LOCALS_SIZEOF(fid_parse_funcdecl_locals_t)},
-    /* fid_p_funcdecl_9 */
-    {CR_LOCALS_SIZEOF(fid_parse_funcdecl_locals_t)},
+/*
+ * Returns the id of the allocation site of the arena `arena` and the current
+ * JS stack, defining it in the log if it's new. Returns 0 once the table of
+ * sites is full.
+ */
+static unsigned int heaplog_site(struct v7 *v7, const char *arena) {
+  struct v7_call_frame_base *frames[V7_HEAPLOG_MAX_DEPTH];
+  struct v7_call_frame_base *cf;
+  struct mbuf *m = &v7->heaplog_buf;
+  struct v7_heaplog_site *site;
+  int i, n = 0;
+  uint32_t hash, mask = V7_HEAPLOG_MAX_SITES - 1;
 
-    /* fid_parse_arglist ----------------------------------------- */
-    /* fid_parse_arglist */
-    {CR_LOCALS_SIZEOF(fid_parse_arglist_locals_t)},
-    /* fid_p_arglist_1 */
-    {CR_LOCALS_SIZEOF(fid_parse_arglist_locals_t)},
+  for (cf = v7->call_stack; cf != NULL && n < V7_HEAPLOG_MAX_DEPTH;
+       cf = cf->prev) {
+    if ((cf->type_mask & V7_CALL_FRAME_MASK_CFUNC) ||
+        ((cf->type_mask & V7_CALL_FRAME_MASK_BCODE) &&
+         ((struct v7_call_frame_bcode *) cf)->bcode != NULL)) {
+      frames[n++] = cf;
+    }
+  }
 
-    /* fid_parse_member ----------------------------------------- */
-    /* fid_parse_member */
-    {CR_LOCALS_SIZEOF(fid_parse_member_locals_t)},
-    /* fid_p_member_1 */
-    {CR_LOCALS_SIZEOF(fid_parse_member_locals_t)},
+  m->len = 0;
+  prof_append_str(m, arena);
+  mbuf_append(m, ",", 1);
+  if (n == 0) {
+    /* e.g. the objects made by `v7_create()` */
+    prof_append_str(m, "[native]");
+  }
+  for (i = n - 1; i >= 0; i--) {
+    prof_append_frame(m, frames[i]);
+    if (i > 0) {
+      mbuf_append(m, ";", 1);
+    }
+  }
+  hash = prof_hash(m->buf, m->len);
 
-    /* fid_parse_memberexpr ----------------------------------------- */
-    /* fid_parse_memberexpr */
-    {CR_LOCALS_SIZEOF(fid_parse_memberexpr_locals_t)},
-    /* fid_p_memberexpr_1 */
-    {CR_LOCALS_SIZEOF(fid_parse_memberexpr_locals_t)},
-    /* fid_p_memberexpr_2 */
-    {CR_LOCALS_SIZEOF(fid_parse_memberexpr_locals_t)},
+  for (site = &v7->heaplog_sites[hash & mask]; site->key != NULL;
+       site = &v7->heaplog_sites[(site - v7->heaplog_sites + 1) & mask]) {
+    if (site->hash == hash && strlen(site->key) == m->len &&
+        memcmp(site->key, m->buf, m->len) == 0) {
+      return site->id;
+    }
+  }
 
-    /* fid_parse_var ----------------------------------------- */
-    /* fid_parse_var */
-    {CR_LOCALS_SIZEOF(fid_parse_var_locals_t)},
-    /* fid_p_var_1 */
-    {CR_LOCALS_SIZEOF(fid_parse_var_locals_t)},
-
-    /* fid_parse_prop ----------------------------------------- */
-    /* fid_parse_prop */
-    {CR_LOCALS_SIZEOF(fid_parse_prop_locals_t)},
-#ifdef V7_ENABLE_JS_GETTERS
-    /* fid_p_prop_1_getter */
-    {CR_LOCALS_SIZEOF(fid_parse_prop_locals_t)},
-#endif
-    /* fid_p_prop_2 */
-    {CR_LOCALS_SIZEOF(fid_parse_prop_locals_t)},
-#ifdef V7_ENABLE_JS_SETTERS
-    /* fid_p_prop_3_setter */
-    {CR_LOCALS_SIZEOF(fid_parse_prop_locals_t)},
-#endif
-    /* fid_p_prop_4 */
-    {CR_LOCALS_SIZEOF(fid_parse_prop_locals_t)},
-
-    /* fid_parse_dowhile ----------------------------------------- */
-    /* fid_parse_dowhile */
-    {CR_LOCALS_SIZEOF(fid_parse_dowhile_locals_t)},
-    /* fid_p_dowhile_1 */
-    {CR_LOCALS_SIZEOF(fid_parse_dowhile_locals_t)},
-    /* fid_p_dowhile_2 */
-    {CR_LOCALS_SIZEOF(fid_parse_dowhile_locals_t)},
-
-    /* fid_parse_for ----------------------------------------- */
-    /* fid_parse_for */
-    {CR_LOCALS_SIZEOF(fid_parse_for_locals_t)},
-    /* fid_p_for_1 */
-    {CR_LOCALS_SIZEOF(fid_parse_for_locals_t)},
-    /* fid_p_for_2 */
-    {CR_LOCALS_SIZEOF(fid_parse_for_locals_t)},
-    /* fid_p_for_3 */
-    {CR_LOCALS_SIZEOF(fid_parse_for_locals_t)},
-    /* fid_p_for_4 */
-    {CR_LOCALS_SIZEOF(fid_parse_for_locals_t)},
-    /* fid_p_for_5 */
-    {CR_LOCALS_SIZEOF(fid_parse_for_locals_t)},
-    /* fid_p_for_6 */
-    {CR_LOCALS_SIZEOF(fid_parse_for_locals_t)},
+  /* keep the table at most 3/4 full, so that the lookups stay short */
+  if (v7->heaplog_sites_cnt >= V7_HEAPLOG_MAX_SITES / 4 * 3 ||
+      (site->key = (char *) malloc(m->len + 1)) == NULL) {
+    return 0;
+  }
+  memcpy(site->key, m->buf, m->len);
+  site->key[m->len] = '\0';
+  site->hash = hash;
+  site->id = ++v7->heaplog_sites_cnt;
+  fprintf(v7->heaplog, "hls{%u,%s}\n", site->id, site->key);
 
-    /* fid_parse_try ----------------------------------------- */
-    /* fid_parse_try */
-    {CR_LOCALS_SIZEOF(fid_parse_try_locals_t)},
-    /* fid_p_try_1 */
-    {CR_LOCALS_SIZEOF(fid_parse_try_locals_t)},
-    /* fid_p_try_2 */
-    {CR_LOCALS_SIZEOF(fid_parse_try_locals_t)},
-    /* fid_p_try_3 */
-    {CR_LOCALS_SIZEOF(fid_parse_try_locals_t)},
-    /* fid_p_try_4 */
-    {CR_LOCALS_SIZEOF(fid_parse_try_locals_t)},
+  return site->id;
+}
 
-    /* fid_parse_switch ----------------------------------------- */
-    /* fid_parse_switch */
-    {CR_LOCALS_SIZEOF(fid_parse_switch_locals_t)},
-    /* fid_p_switch_1 */
-    {CR_LOCALS_SIZEOF(fid_parse_switch_locals_t)},
-    /* fid_p_switch_2 */
-    {CR_LOCALS_SIZEOF(fid_parse_switch_locals_t)},
-    /* fid_p_switch_3 */
-    {CR_LOCALS_SIZEOF(fid_parse_switch_locals_t)},
-    /* fid_p_switch_4 */
-    {CR_LOCALS_SIZEOF(fid_parse_switch_locals_t)},
+V7_PRIVATE void heaplog_alloc_cell(struct v7 *v7, struct gc_arena *a,
+                                   void *cell) {
+  unsigned int id = heaplog_site(v7, a->name);
+  fprintf(v7->heaplog, "hl{j,%u,%lu,%lx}\n", id, (unsigned long) a->cell_size,
+          (unsigned long) (uintptr_t) cell);
+}
 
-    /* fid_parse_with ----------------------------------------- */
-    /* fid_parse_with */
-    {CR_LOCALS_SIZEOF(fid_parse_with_locals_t)},
-    /* fid_p_with_1 */
-    {CR_LOCALS_SIZEOF(fid_parse_with_locals_t)},
-    /* fid_p_with_2 */
-    {CR_LOCALS_SIZEOF(fid_parse_with_locals_t)},
+V7_PRIVATE void heaplog_free_cell(struct v7 *v7, void *cell) {
+  fprintf(v7->heaplog, "hl{k,%lx}\n", (unsigned long) (uintptr_t) cell);
+}
 
-};
+V7_PRIVATE void heaplog_alloc_str(struct v7 *v7, size_t offset, size_t size) {
+  struct v7_heaplog_str s;
+  unsigned int id = heaplog_site(v7, "string");
 
-/*
- * Union of arguments and return values for all existing "functions".
- *
- * Used as an accumulator when we call function, return from function,
- * yield, or resume.
- */
-union user_arg_ret {
-  /* arguments to the next function */
-  union {
-#if 0
-    fid_parse_script_arg_t fid_parse_script;
-    fid_parse_use_strict_arg_t fid_parse_use_strict;
-    fid_parse_statement_arg_t fid_parse_statement;
-    fid_parse_expression_arg_t fid_parse_expression;
-    fid_parse_assign_arg_t fid_parse_assign;
-    fid_parse_prefix_arg_t fid_parse_prefix;
-    fid_parse_postfix_arg_t fid_parse_postfix;
-    fid_parse_callexpr_arg_t fid_parse_callexpr;
-    fid_parse_newexpr_arg_t fid_parse_newexpr;
-    fid_parse_terminal_arg_t fid_parse_terminal;
-    fid_parse_block_arg_t fid_parse_block;
-    fid_parse_if_arg_t fid_parse_if;
-    fid_parse_while_arg_t fid_parse_while;
-    fid_parse_ident_arg_t fid_parse_ident;
-    fid_parse_ident_allow_reserved_words_arg_t
-      fid_parse_ident_allow_reserved_words;
-    fid_parse_arglist_arg_t fid_parse_arglist;
-    fid_parse_memberexpr_arg_t fid_parse_memberexpr;
-    fid_parse_var_arg_t fid_parse_var;
-    fid_parse_prop_arg_t fid_parse_prop;
-    fid_parse_dowhile_arg_t fid_parse_dowhile;
-    fid_parse_for_arg_t fid_parse_for;
-    fid_parse_try_arg_t fid_parse_try;
-    fid_parse_switch_arg_t fid_parse_switch;
-    fid_parse_with_arg_t fid_parse_with;
-#endif
-    fid_parse_body_arg_t fid_parse_body;
-    fid_parse_binary_arg_t fid_parse_binary;
-    fid_parse_funcdecl_arg_t fid_parse_funcdecl;
-    fid_parse_member_arg_t fid_parse_member;
-  } arg;
+  s.offset = offset;
+  s.serial = ++v7->heaplog_str_serial;
+  mbuf_append(&v7->heaplog_strs, &s, sizeof(s));
+  fprintf(v7->heaplog, "hl{j,%u,%lu,s%lu}\n", id, (unsigned long) size,
+          s.serial);
+}
 
-  /* value returned from function */
-  /*
-     union {
-     } ret;
-     */
-};
+V7_PRIVATE void heaplog_compact_str(struct v7 *v7,
+                                    struct heaplog_compact_ctx *ctx,
+                                    size_t offset, size_t new_offset,
+                                    int live) {
+  struct v7_heaplog_str *strs = (struct v7_heaplog_str *) v7->heaplog_strs.buf;
+  size_t n = v7->heaplog_strs.len / sizeof(*strs);
 
-static enum v7_tok next_tok(struct v7 *v7) {
-  int prev_line_no = v7->pstate.prev_line_no;
-  v7->pstate.prev_line_no = v7->pstate.line_no;
-  v7->pstate.line_no += skip_to_next_tok(&v7->pstate.pc);
-  v7->after_newline = prev_line_no != v7->pstate.line_no;
-  v7->tok = v7->pstate.pc;
-  v7->cur_tok = get_tok(&v7->pstate.pc, &v7->cur_tok_dbl, v7->cur_tok);
-  v7->tok_len = v7->pstate.pc - v7->tok;
-  v7->pstate.line_no += skip_to_next_tok(&v7->pstate.pc);
-  return v7->cur_tok;
-}
+  /* strings allocated before the log was started aren't there */
+  if (ctx->pos >= n || strs[ctx->pos].offset != offset) {
+    return;
+  }
 
-#ifndef V7_DISABLE_LINE_NUMBERS
-/*
- * Assumes `offset` points to the byte right after a tag
- */
-static void insert_line_no_if_changed(struct v7 *v7, struct ast *a,
-                                      ast_off_t offset) {
-  if (v7->pstate.prev_line_no != v7->line_no) {
-    v7->line_no = v7->pstate.prev_line_no;
-    ast_add_line_no(a, offset - 1, v7->line_no);
+  if (live) {
+    strs[ctx->kept] = strs[ctx->pos];
+    strs[ctx->kept++].offset = new_offset;
   } else {
-#if V7_AST_FORCE_LINE_NUMBERS
-    /*
-     * This mode is needed for debug only: to make sure AST consumers correctly
-     * consume all nodes with line numbers data encoded
-     */
-    ast_add_line_no(a, offset - 1, 0);
-#endif
+    fprintf(v7->heaplog, "hl{k,s%lu}\n", strs[ctx->pos].serial);
   }
+  ctx->pos++;
 }
-#else
-static void insert_line_no_if_changed(struct v7 *v7, struct ast *a,
-                                      ast_off_t offset) {
-  (void) v7;
-  (void) a;
-  (void) offset;
-}
-#endif
 
-static ast_off_t insert_node(struct v7 *v7, struct ast *a, ast_off_t start,
-                             enum ast_tag tag) {
-  ast_off_t ret = ast_insert_node(a, start, tag);
-  insert_line_no_if_changed(v7, a, ret);
-  return ret;
-}
+V7_PRIVATE void heaplog_compact_done(struct v7 *v7,
+                                     struct heaplog_compact_ctx *ctx) {
+  struct v7_heaplog_str *strs = (struct v7_heaplog_str *) v7->heaplog_strs.buf;
+  size_t n = v7->heaplog_strs.len / sizeof(*strs);
 
-static ast_off_t add_node(struct v7 *v7, struct ast *a, enum ast_tag tag) {
-  return insert_node(v7, a, a->mbuf.len, tag);
+  if (ctx->pos < n) {
+    memmove(strs + ctx->kept, strs + ctx->pos,
+            (n - ctx->pos) * sizeof(*strs));
+  }
+  v7->heaplog_strs.len = (ctx->kept + n - ctx->pos) * sizeof(*strs);
 }
 
-static ast_off_t insert_inlined_node(struct v7 *v7, struct ast *a,
-                                     ast_off_t start, enum ast_tag tag,
-                                     const char *name, size_t len) {
-  ast_off_t ret = ast_insert_inlined_node(a, start, tag, name, len);
-  insert_line_no_if_changed(v7, a, ret);
-  return ret;
-}
+V7_PRIVATE void heaplog_destroy(struct v7 *v7) {
+  int i;
 
-static ast_off_t add_inlined_node(struct v7 *v7, struct ast *a,
-                                  enum ast_tag tag, const char *name,
-                                  size_t len) {
-  return insert_inlined_node(v7, a, a->mbuf.len, tag, name, len);
+  v7_heaplog_stop(v7);
+  if (v7->heaplog_sites != NULL) {
+    for (i = 0; i < V7_HEAPLOG_MAX_SITES; i++) {
+      free(v7->heaplog_sites[i].key);
+    }
+    free(v7->heaplog_sites);
+    v7->heaplog_sites = NULL;
+  }
+  v7->heaplog_sites_cnt = 0;
+  mbuf_free(&v7->heaplog_strs);
+  mbuf_free(&v7->heaplog_buf);
 }
 
-static unsigned long get_column(const char *code, const char *pos) {
-  const char *p = pos;
-  while (p > code && *p != '\n') {
-    p--;
+int v7_heaplog_start(struct v7 *v7, FILE *fp) {
+  if (v7->heaplog != NULL) {
+    return -1;
   }
-  return p == code ? pos - p : pos - (p + 1);
-}
 
-static enum v7_err end_of_statement(struct v7 *v7) {
-  if (v7->cur_tok == TOK_SEMICOLON || v7->cur_tok == TOK_END_OF_INPUT ||
-      v7->cur_tok == TOK_CLOSE_CURLY || v7->after_newline) {
-    return V7_OK;
+  /* sites are numbered anew in each log */
+  heaplog_destroy(v7);
+  v7->heaplog_sites = (struct v7_heaplog_site *) calloc(
+      V7_HEAPLOG_MAX_SITES, sizeof(*v7->heaplog_sites));
+  if (v7->heaplog_sites == NULL) {
+    return -1;
   }
-  return V7_SYNTAX_ERROR;
-}
+  v7->heaplog = fp;
+  fprintf(fp, "hls{0,other,[too many sites]}\n");
 
-static enum v7_tok lookahead(const struct v7 *v7) {
-  const char *s = v7->pstate.pc;
-  double d;
-  return get_tok(&s, &d, v7->cur_tok);
+  return 0;
 }
 
-static int parse_optional(struct v7 *v7, struct ast *a,
-                          enum v7_tok terminator) {
-  if (v7->cur_tok != terminator) {
-    return 1;
+void v7_heaplog_stop(struct v7 *v7) {
+  if (v7->heaplog != NULL) {
+    fflush(v7->heaplog);
+    v7->heaplog = NULL;
   }
-  add_node(v7, a, AST_NOP);
-  return 0;
+  /* strings can't be tracked once the allocations aren't logged */
+  v7->heaplog_strs.len = 0;
 }
 
+#endif /* V7_ENABLE_HEAPLOG */
+#ifdef V7_MODULE_LINES
+#line 1 "./src/parser.c"
+#endif
 /*
- * On ESP8266 'levels' declaration have to be outside of 'parse_binary'
- * in order to prevent reboot on return from this function
- * TODO(alashkin): understand why
+ * Copyright (c) 2014 Cesanta Software Limited
+ * All rights reserved
  */
-#define NONE \
-  { (enum v7_tok) 0, (enum v7_tok) 0, (enum ast_tag) 0 }
 
-static const struct {
-  int len, left_to_right;
-  struct {
-    enum v7_tok start_tok, end_tok;
-    enum ast_tag start_ast;
-  } parts[2];
-} levels[] = {
-    {1, 0, {{TOK_ASSIGN, TOK_URSHIFT_ASSIGN, AST_ASSIGN}, NONE}},
-    {1, 0, {{TOK_QUESTION, TOK_QUESTION, AST_COND}, NONE}},
-    {1, 1, {{TOK_LOGICAL_OR, TOK_LOGICAL_OR, AST_LOGICAL_OR}, NONE}},
-    {1, 1, {{TOK_LOGICAL_AND, TOK_LOGICAL_AND, AST_LOGICAL_AND}, NONE}},
-    {1, 1, {{TOK_OR, TOK_OR, AST_OR}, NONE}},
-    {1, 1, {{TOK_XOR, TOK_XOR, AST_XOR}, NONE}},
-    {1, 1, {{TOK_AND, TOK_AND, AST_AND}, NONE}},
-    {1, 1, {{TOK_EQ, TOK_NE_NE, AST_EQ}, NONE}},
-    {2, 1, {{TOK_LE, TOK_GT, AST_LE}, {TOK_IN, TOK_INSTANCEOF, AST_IN}}},
-    {1, 1, {{TOK_LSHIFT, TOK_URSHIFT, AST_LSHIFT}, NONE}},
-    {1, 1, {{TOK_PLUS, TOK_MINUS, AST_ADD}, NONE}},
-    {1, 1, {{TOK_REM, TOK_DIV, AST_REM}, NONE}}};
+/* Amalgamated: #include "common/coroutine.h" */
+/* Amalgamated: #include "v7/src/internal.h" */
+/* Amalgamated: #include "v7/src/parser.h" */
+/* Amalgamated: #include "v7/src/tokenizer.h" */
+/* Amalgamated: #include "v7/src/core.h" */
+/* Amalgamated: #include "v7/src/exceptions.h" */
+/* Amalgamated: #include "v7/src/ast.h" */
+/* Amalgamated: #include "v7/src/compiler.h" */
+/* Amalgamated: #include "v7/src/primitive.h" */
+/* Amalgamated: #include "v7/src/cyg_profile.h" */
 
-enum cr_status parser_cr_exec(struct cr_ctx *p_ctx, struct v7 *v7,
-                              struct ast *a) {
-  enum cr_status rc = CR_RES__OK;
+#define ACCEPT(t) (((v7)->cur_tok == (t)) ? next_tok((v7)), 1 : 0)
 
-_cr_iter_begin:
+#define EXPECT(t)                            \
+  do {                                       \
+    if ((v7)->cur_tok != (t)) {              \
+      CR_THROW(PARSER_EXC_ID__SYNTAX_ERROR); \
+    }                                        \
+    next_tok(v7);                            \
+  } while (0)
 
-  rc = cr_on_iter_begin(p_ctx);
-  if (rc != CR_RES__OK) {
-    return rc;
-  }
+#define PARSE_WITH_OPT_ARG(tag, arg_tag, arg_parser, label) \
+  do {                                                      \
+    if (end_of_statement(v7) == V7_OK) {                    \
+      add_node(v7, a, (tag));                               \
+    } else {                                                \
+      add_node(v7, a, (arg_tag));                           \
+      arg_parser(label);                                    \
+    }                                                       \
+  } while (0)
 
-  /*
-   * dispatcher switch: depending on the fid, jump to the corresponding label
-   */
-  switch ((enum my_fid) CR_CURR_FUNC()) {
-    CR_DEFINE_ENTRY_POINT(fid_none);
+#define N (CR_ARG_RET_PT()->arg)
 
-    CR_DEFINE_ENTRY_POINT(fid_parse_script);
-    CR_DEFINE_ENTRY_POINT(fid_p_script_1);
-    CR_DEFINE_ENTRY_POINT(fid_p_script_2);
-    CR_DEFINE_ENTRY_POINT(fid_p_script_3);
-    CR_DEFINE_ENTRY_POINT(fid_p_script_4);
+/*
+ * User functions
+ * (as well as other in-function entry points)
+ */
+enum my_fid {
+  fid_none = CR_FID__NONE,
 
-    CR_DEFINE_ENTRY_POINT(fid_parse_use_strict);
+  /* parse_script function */
+  fid_parse_script = CR_FID__USER,
+  fid_p_script_1,
+  fid_p_script_2,
+  fid_p_script_3,
+  fid_p_script_4,
 
-    CR_DEFINE_ENTRY_POINT(fid_parse_body);
-    CR_DEFINE_ENTRY_POINT(fid_p_body_1);
-    CR_DEFINE_ENTRY_POINT(fid_p_body_2);
+  /* parse_use_strict function */
+  fid_parse_use_strict,
 
-    CR_DEFINE_ENTRY_POINT(fid_parse_statement);
-    CR_DEFINE_ENTRY_POINT(fid_p_stat_1);
-    CR_DEFINE_ENTRY_POINT(fid_p_stat_2);
-    CR_DEFINE_ENTRY_POINT(fid_p_stat_3);
-    CR_DEFINE_ENTRY_POINT(fid_p_stat_4);
-    CR_DEFINE_ENTRY_POINT(fid_p_stat_5);
-    CR_DEFINE_ENTRY_POINT(fid_p_stat_6);
-    CR_DEFINE_ENTRY_POINT(fid_p_stat_7);
-    CR_DEFINE_ENTRY_POINT(fid_p_stat_8);
-    CR_DEFINE_ENTRY_POINT(fid_p_stat_9);
-    CR_DEFINE_ENTRY_POINT(fid_p_stat_10);
-    CR_DEFINE_ENTRY_POINT(fid_p_stat_11);
-    CR_DEFINE_ENTRY_POINT(fid_p_stat_12);
-    CR_DEFINE_ENTRY_POINT(fid_p_stat_13);
-    CR_DEFINE_ENTRY_POINT(fid_p_stat_14);
+  /* parse_body function */
+  fid_parse_body,
+  fid_p_body_1,
+  fid_p_body_2,
 
-    CR_DEFINE_ENTRY_POINT(fid_parse_expression);
-    CR_DEFINE_ENTRY_POINT(fid_p_expr_1);
+  /* parse_statement function */
+  fid_parse_statement,
+  fid_p_stat_1,
+  fid_p_stat_2,
+  fid_p_stat_3,
+  fid_p_stat_4,
+  fid_p_stat_5,
+  fid_p_stat_6,
+  fid_p_stat_7,
+  fid_p_stat_8,
+  fid_p_stat_9,
+  fid_p_stat_10,
+  fid_p_stat_11,
+  fid_p_stat_12,
+  fid_p_stat_13,
+  fid_p_stat_14,
 
-    CR_DEFINE_ENTRY_POINT(fid_parse_assign);
-    CR_DEFINE_ENTRY_POINT(fid_p_assign_1);
+  /* parse_expression function */
+  fid_parse_expression,
+  fid_p_expr_1,
 
-    CR_DEFINE_ENTRY_POINT(fid_parse_binary);
-    CR_DEFINE_ENTRY_POINT(fid_p_binary_2);
-    CR_DEFINE_ENTRY_POINT(fid_p_binary_3);
-    CR_DEFINE_ENTRY_POINT(fid_p_binary_4);
-    CR_DEFINE_ENTRY_POINT(fid_p_binary_5);
-    CR_DEFINE_ENTRY_POINT(fid_p_binary_6);
+  /* parse_assign function */
+  fid_parse_assign,
+  fid_p_assign_1,
 
-    CR_DEFINE_ENTRY_POINT(fid_parse_prefix);
-    CR_DEFINE_ENTRY_POINT(fid_p_prefix_1);
+  /* parse_binary function */
+  fid_parse_binary,
+  fid_p_binary_1,
+  fid_p_binary_2,
+  fid_p_binary_3,
+  fid_p_binary_4,
+  fid_p_binary_5,
+  fid_p_binary_6,
 
-    CR_DEFINE_ENTRY_POINT(fid_parse_postfix);
-    CR_DEFINE_ENTRY_POINT(fid_p_postfix_1);
+  /* parse_prefix function */
+  fid_parse_prefix,
+  fid_p_prefix_1,
 
-    CR_DEFINE_ENTRY_POINT(fid_parse_callexpr);
-    CR_DEFINE_ENTRY_POINT(fid_p_callexpr_1);
-    CR_DEFINE_ENTRY_POINT(fid_p_callexpr_2);
-    CR_DEFINE_ENTRY_POINT(fid_p_callexpr_3);
+  /* parse_postfix function */
+  fid_parse_postfix,
+  fid_p_postfix_1,
 
-    CR_DEFINE_ENTRY_POINT(fid_parse_newexpr);
-    CR_DEFINE_ENTRY_POINT(fid_p_newexpr_1);
-    CR_DEFINE_ENTRY_POINT(fid_p_newexpr_2);
-    CR_DEFINE_ENTRY_POINT(fid_p_newexpr_3);
-    CR_DEFINE_ENTRY_POINT(fid_p_newexpr_4);
+  /* parse_callexpr function */
+  fid_parse_callexpr,
+  fid_p_callexpr_1,
+  fid_p_callexpr_2,
+  fid_p_callexpr_3,
 
-    CR_DEFINE_ENTRY_POINT(fid_parse_terminal);
-    CR_DEFINE_ENTRY_POINT(fid_p_terminal_1);
-    CR_DEFINE_ENTRY_POINT(fid_p_terminal_2);
-    CR_DEFINE_ENTRY_POINT(fid_p_terminal_3);
-    CR_DEFINE_ENTRY_POINT(fid_p_terminal_4);
+  /* parse_newexpr function */
+  fid_parse_newexpr,
+  fid_p_newexpr_1,
+  fid_p_newexpr_2,
+  fid_p_newexpr_3,
+  fid_p_newexpr_4,
 
-    CR_DEFINE_ENTRY_POINT(fid_parse_block);
-    CR_DEFINE_ENTRY_POINT(fid_p_block_1);
+  /* parse_terminal function */
+  fid_parse_terminal,
+  fid_p_terminal_1,
+  fid_p_terminal_2,
+  fid_p_terminal_3,
+  fid_p_terminal_4,
 
-    CR_DEFINE_ENTRY_POINT(fid_parse_if);
-    CR_DEFINE_ENTRY_POINT(fid_p_if_1);
-    CR_DEFINE_ENTRY_POINT(fid_p_if_2);
-    CR_DEFINE_ENTRY_POINT(fid_p_if_3);
+  /* parse_block function */
+  fid_parse_block,
+  fid_p_block_1,
 
-    CR_DEFINE_ENTRY_POINT(fid_parse_while);
-    CR_DEFINE_ENTRY_POINT(fid_p_while_1);
-    CR_DEFINE_ENTRY_POINT(fid_p_while_2);
+  /* parse_if function */
+  fid_parse_if,
+  fid_p_if_1,
+  fid_p_if_2,
+  fid_p_if_3,
 
-    CR_DEFINE_ENTRY_POINT(fid_parse_ident);
+  /* parse_while function */
+  fid_parse_while,
+  fid_p_while_1,
+  fid_p_while_2,
 
-    CR_DEFINE_ENTRY_POINT(fid_parse_ident_allow_reserved_words);
-    CR_DEFINE_ENTRY_POINT(fid_p_ident_arw_1);
+  /* parse_ident function */
+  fid_parse_ident,
 
-    CR_DEFINE_ENTRY_POINT(fid_parse_funcdecl);
-    CR_DEFINE_ENTRY_POINT(fid_p_funcdecl_1);
-    CR_DEFINE_ENTRY_POINT(fid_p_funcdecl_2);
-    CR_DEFINE_ENTRY_POINT(fid_p_funcdecl_3);
-    CR_DEFINE_ENTRY_POINT(fid_p_funcdecl_4);
-    CR_DEFINE_ENTRY_POINT(fid_p_funcdecl_5);
-    CR_DEFINE_ENTRY_POINT(fid_p_funcdecl_6);
-    CR_DEFINE_ENTRY_POINT(fid_p_funcdecl_7);
-    CR_DEFINE_ENTRY_POINT(fid_p_funcdecl_8);
-    CR_DEFINE_ENTRY_POINT(fid_p_funcdecl_9);
+  /* parse_ident_allow_reserved_words function */
+  fid_parse_ident_allow_reserved_words,
+  fid_p_ident_arw_1,
 
-    CR_DEFINE_ENTRY_POINT(fid_parse_arglist);
-    CR_DEFINE_ENTRY_POINT(fid_p_arglist_1);
+  /* parse_funcdecl function */
+  fid_parse_funcdecl,
+  fid_p_funcdecl_1,
+  fid_p_funcdecl_2,
+  fid_p_funcdecl_3,
+  fid_p_funcdecl_4,
+  fid_p_funcdecl_5,
+  fid_p_funcdecl_6,
+  fid_p_funcdecl_7,
+  fid_p_funcdecl_8,
+  fid_p_funcdecl_9,
 
-    CR_DEFINE_ENTRY_POINT(fid_parse_member);
-    CR_DEFINE_ENTRY_POINT(fid_p_member_1);
+  /* parse_arglist function */
+  fid_parse_arglist,
+  fid_p_arglist_1,
 
-    CR_DEFINE_ENTRY_POINT(fid_parse_memberexpr);
-    CR_DEFINE_ENTRY_POINT(fid_p_memberexpr_1);
-    CR_DEFINE_ENTRY_POINT(fid_p_memberexpr_2);
+  /* parse_member function */
+  fid_parse_member,
+  fid_p_member_1,
 
-    CR_DEFINE_ENTRY_POINT(fid_parse_var);
-    CR_DEFINE_ENTRY_POINT(fid_p_var_1);
+  /* parse_memberexpr function */
+  fid_parse_memberexpr,
+  fid_p_memberexpr_1,
+  fid_p_memberexpr_2,
 
-    CR_DEFINE_ENTRY_POINT(fid_parse_prop);
+  /* parse_var function */
+  fid_parse_var,
+  fid_p_var_1,
+
+  /* parse_prop function */
+  fid_parse_prop,
 #ifdef V7_ENABLE_JS_GETTERS
-    CR_DEFINE_ENTRY_POINT(fid_p_prop_1_getter);
+  fid_p_prop_1_getter,
 #endif
-    CR_DEFINE_ENTRY_POINT(fid_p_prop_2);
+  fid_p_prop_2,
 #ifdef V7_ENABLE_JS_SETTERS
-    CR_DEFINE_ENTRY_POINT(fid_p_prop_3_setter);
+  fid_p_prop_3_setter,
 #endif
-    CR_DEFINE_ENTRY_POINT(fid_p_prop_4);
+  fid_p_prop_4,
 
-    CR_DEFINE_ENTRY_POINT(fid_parse_dowhile);
-    CR_DEFINE_ENTRY_POINT(fid_p_dowhile_1);
-    CR_DEFINE_ENTRY_POINT(fid_p_dowhile_2);
+  /* parse_dowhile function */
+  fid_parse_dowhile,
+  fid_p_dowhile_1,
+  fid_p_dowhile_2,
 
-    CR_DEFINE_ENTRY_POINT(fid_parse_for);
-    CR_DEFINE_ENTRY_POINT(fid_p_for_1);
-    CR_DEFINE_ENTRY_POINT(fid_p_for_2);
-    CR_DEFINE_ENTRY_POINT(fid_p_for_3);
-    CR_DEFINE_ENTRY_POINT(fid_p_for_4);
-    CR_DEFINE_ENTRY_POINT(fid_p_for_5);
-    CR_DEFINE_ENTRY_POINT(fid_p_for_6);
+  /* parse_for function */
+  fid_parse_for,
+  fid_p_for_1,
+  fid_p_for_2,
+  fid_p_for_3,
+  fid_p_for_4,
+  fid_p_for_5,
+  fid_p_for_6,
 
-    CR_DEFINE_ENTRY_POINT(fid_parse_try);
-    CR_DEFINE_ENTRY_POINT(fid_p_try_1);
-    CR_DEFINE_ENTRY_POINT(fid_p_try_2);
-    CR_DEFINE_ENTRY_POINT(fid_p_try_3);
-    CR_DEFINE_ENTRY_POINT(fid_p_try_4);
+  /* parse_try function */
+  fid_parse_try,
+  fid_p_try_1,
+  fid_p_try_2,
+  fid_p_try_3,
+  fid_p_try_4,
 
-    CR_DEFINE_ENTRY_POINT(fid_parse_switch);
-    CR_DEFINE_ENTRY_POINT(fid_p_switch_1);
-    CR_DEFINE_ENTRY_POINT(fid_p_switch_2);
-    CR_DEFINE_ENTRY_POINT(fid_p_switch_3);
-    CR_DEFINE_ENTRY_POINT(fid_p_switch_4);
+  /* parse_switch function */
+  fid_parse_switch,
+  fid_p_switch_1,
+  fid_p_switch_2,
+  fid_p_switch_3,
+  fid_p_switch_4,
 
-    CR_DEFINE_ENTRY_POINT(fid_parse_with);
-    CR_DEFINE_ENTRY_POINT(fid_p_with_1);
-    CR_DEFINE_ENTRY_POINT(fid_p_with_2);
+  /* parse_with function */
+  fid_parse_with,
+  fid_p_with_1,
+  fid_p_with_2,
 
-    default:
-      /* should never be here */
-      printf("fatal: wrong func id: %d", CR_CURR_FUNC());
-      break;
-  };
+  MY_FID_CNT
+};
 
-/* static enum v7_err parse_script(struct v7 *v7, struct ast *a) */
-fid_parse_script :
-#undef L
-#define L CR_CUR_LOCALS_PT(fid_parse_script_locals_t)
-{
-  L->start = add_node(v7, a, AST_SCRIPT);
-  L->outer_last_var_node = v7->last_var_node;
-  L->saved_in_strict = v7->pstate.in_strict;
+/*
+ * User exception IDs. The first one should have value `CR_EXC_ID__USER`
+ */
+enum parser_exc_id {
+  PARSER_EXC_ID__NONE = CR_EXC_ID__NONE,
+  PARSER_EXC_ID__SYNTAX_ERROR = CR_EXC_ID__USER,
+  PARSER_EXC_ID__COMPILE_ERROR, /* the compiler has thrown already */
+};
 
-  v7->last_var_node = L->start;
-  ast_modify_skip(a, L->start, L->start, AST_FUNC_FIRST_VAR_SKIP);
+/* structures with locals and args {{{ */
 
-  CR_TRY(fid_p_script_1);
-  {
-    CALL_PARSE_USE_STRICT(fid_p_script_3);
-    v7->pstate.in_strict = 1;
-  }
-  CR_CATCH(PARSER_EXC_ID__SYNTAX_ERROR, fid_p_script_1, fid_p_script_2);
-  CR_ENDCATCH(fid_p_script_2);
+/* parse_script {{{ */
 
-  CALL_PARSE_BODY(TOK_END_OF_INPUT, fid_p_script_4);
-  ast_set_skip(a, L->start, AST_END_SKIP);
-  v7->pstate.in_strict = L->saved_in_strict;
-  v7->last_var_node = L->outer_last_var_node;
+/* parse_script's arguments */
+#if 0
+typedef struct fid_parse_script_arg {
+} fid_parse_script_arg_t;
+#else
+typedef cr_zero_size_type_t fid_parse_script_arg_t;
+#endif
 
-  CR_RETURN_VOID();
-}
+/* parse_script's data on stack */
+typedef struct fid_parse_script_locals {
+#if 0
+  struct fid_parse_script_arg arg;
+#endif
 
-/* static enum v7_err parse_use_strict(struct v7 *v7, struct ast *a) */
-fid_parse_use_strict :
-#undef L
-#define L CR_CUR_LOCALS_PT(fid_parse_use_strict_locals_t)
-{
-  if (v7->cur_tok == TOK_STRING_LITERAL &&
-      (strncmp(v7->tok, "\"use strict\"", v7->tok_len) == 0 ||
-       strncmp(v7->tok, "'use strict'", v7->tok_len) == 0)) {
-    next_tok(v7);
-    add_node(v7, a, AST_USE_STRICT);
-    CR_RETURN_VOID();
-  } else {
-    CR_THROW(PARSER_EXC_ID__SYNTAX_ERROR);
-  }
-}
+  ast_off_t start;
+  ast_off_t outer_last_var_node;
+  int saved_in_strict;
+} fid_parse_script_locals_t;
 
-/*
- * static enum v7_err parse_body(struct v7 *v7, struct ast *a,
- *                               enum v7_tok end)
- */
-fid_parse_body :
-#undef L
-#define L CR_CUR_LOCALS_PT(fid_parse_body_locals_t)
-{
-  while (v7->cur_tok != L->arg.end) {
-    if (ACCEPT(TOK_FUNCTION)) {
-      if (v7->cur_tok != TOK_IDENTIFIER) {
-        CR_THROW(PARSER_EXC_ID__SYNTAX_ERROR);
-      }
-      L->start = add_node(v7, a, AST_VAR);
-      ast_modify_skip(a, v7->last_var_node, L->start, AST_FUNC_FIRST_VAR_SKIP);
-      /* zero out var node pointer */
-      ast_modify_skip(a, L->start, L->start, AST_FUNC_FIRST_VAR_SKIP);
-      v7->last_var_node = L->start;
-      add_inlined_node(v7, a, AST_FUNC_DECL, v7->tok, v7->tok_len);
+/* }}} */
 
-      CALL_PARSE_FUNCDECL(1, 0, fid_p_body_1);
-      ast_set_skip(a, L->start, AST_END_SKIP);
-    } else {
-      CALL_PARSE_STATEMENT(fid_p_body_2);
-    }
-  }
-  CR_RETURN_VOID();
-}
+/* parse_use_strict {{{ */
+/* parse_use_strict's arguments */
+#if 0
+typedef struct fid_parse_use_strict_arg {
+} fid_parse_use_strict_arg_t;
+#else
+typedef cr_zero_size_type_t fid_parse_use_strict_arg_t;
+#endif
 
-/* static enum v7_err parse_statement(struct v7 *v7, struct ast *a) */
-fid_parse_statement :
-#undef L
-#define L CR_CUR_LOCALS_PT(fid_parse_statement_locals_t)
-{
-  switch (v7->cur_tok) {
-    case TOK_SEMICOLON:
-      next_tok(v7);
-      /* empty statement */
-      CR_RETURN_VOID();
-    case TOK_OPEN_CURLY: /* block */
-      CALL_PARSE_BLOCK(fid_p_stat_3);
-      /* returning because no semicolon required */
-      CR_RETURN_VOID();
-    case TOK_IF:
-      next_tok(v7);
-      CALL_PARSE_IF(fid_p_stat_4);
-      CR_RETURN_VOID();
-    case TOK_WHILE:
-      next_tok(v7);
-      CALL_PARSE_WHILE(fid_p_stat_5);
-      CR_RETURN_VOID();
-    case TOK_DO:
-      next_tok(v7);
-      CALL_PARSE_DOWHILE(fid_p_stat_10);
-      CR_RETURN_VOID();
-    case TOK_FOR:
-      next_tok(v7);
-      CALL_PARSE_FOR(fid_p_stat_11);
-      CR_RETURN_VOID();
-    case TOK_TRY:
-      next_tok(v7);
-      CALL_PARSE_TRY(fid_p_stat_12);
-      CR_RETURN_VOID();
-    case TOK_SWITCH:
-      next_tok(v7);
-      CALL_PARSE_SWITCH(fid_p_stat_13);
-      CR_RETURN_VOID();
-    case TOK_WITH:
-      next_tok(v7);
-      CALL_PARSE_WITH(fid_p_stat_14);
-      CR_RETURN_VOID();
-    case TOK_BREAK:
-      if (!(v7->pstate.in_loop || v7->pstate.in_switch)) {
-        CR_THROW(PARSER_EXC_ID__SYNTAX_ERROR);
-      }
-      next_tok(v7);
-      PARSE_WITH_OPT_ARG(AST_BREAK, AST_LABELED_BREAK, CALL_PARSE_IDENT,
-                         fid_p_stat_7);
-      break;
-    case TOK_CONTINUE:
-      if (!v7->pstate.in_loop) {
-        CR_THROW(PARSER_EXC_ID__SYNTAX_ERROR);
-      }
-      next_tok(v7);
-      PARSE_WITH_OPT_ARG(AST_CONTINUE, AST_LABELED_CONTINUE, CALL_PARSE_IDENT,
-                         fid_p_stat_8);
-      break;
-    case TOK_RETURN:
-      if (!v7->pstate.in_function) {
-        CR_THROW(PARSER_EXC_ID__SYNTAX_ERROR);
-      }
-      next_tok(v7);
-      PARSE_WITH_OPT_ARG(AST_RETURN, AST_VALUE_RETURN, CALL_PARSE_EXPRESSION,
-                         fid_p_stat_6);
-      break;
-    case TOK_THROW:
-      next_tok(v7);
-      add_node(v7, a, AST_THROW);
-      CALL_PARSE_EXPRESSION(fid_p_stat_2);
-      break;
-    case TOK_DEBUGGER:
-      next_tok(v7);
-      add_node(v7, a, AST_DEBUGGER);
-      break;
-    case TOK_VAR:
-      next_tok(v7);
-      CALL_PARSE_VAR(fid_p_stat_9);
-      break;
-    case TOK_IDENTIFIER:
-      if (lookahead(v7) == TOK_COLON) {
-        add_inlined_node(v7, a, AST_LABEL, v7->tok, v7->tok_len);
-        next_tok(v7);
-        EXPECT(TOK_COLON);
-        CR_RETURN_VOID();
-      }
-    /* fall through */
-    default:
-      CALL_PARSE_EXPRESSION(fid_p_stat_1);
-      break;
-  }
+/* parse_use_strict's data on stack */
+#if 0
+typedef struct fid_parse_use_strict_locals {
+  struct fid_parse_use_strict_arg arg;
+} fid_parse_use_strict_locals_t;
+#else
+typedef cr_zero_size_type_t fid_parse_use_strict_locals_t;
+#endif
 
-  if (end_of_statement(v7) != V7_OK) {
-    CR_THROW(PARSER_EXC_ID__SYNTAX_ERROR);
-  }
-  ACCEPT(TOK_SEMICOLON); /* swallow optional semicolon */
-  CR_RETURN_VOID();
-}
+#define CALL_PARSE_USE_STRICT(_label)      \
+  do {                                     \
+    CR_CALL(fid_parse_use_strict, _label); \
+  } while (0)
 
-/* static enum v7_err parse_expression(struct v7 *v7, struct ast *a) */
-fid_parse_expression :
-#undef L
-#define L CR_CUR_LOCALS_PT(fid_parse_expression_locals_t)
-{
-  L->pos = a->mbuf.len;
-  L->group = 0;
-  while (1) {
-    CALL_PARSE_ASSIGN(fid_p_expr_1);
-    if (ACCEPT(TOK_COMMA)) {
-      L->group = 1;
-    } else {
-      break;
-    }
-  }
-  if (L->group) {
-    insert_node(v7, a, L->pos, AST_SEQ);
-  }
-  CR_RETURN_VOID();
-}
+/* }}} */
 
-/* static enum v7_err parse_assign(struct v7 *v7, struct ast *a) */
-fid_parse_assign :
-#undef L
-#define L CR_CUR_LOCALS_PT(fid_parse_assign_locals_t)
-{
-  CALL_PARSE_BINARY(0, a->mbuf.len, fid_p_assign_1);
-  CR_RETURN_VOID();
-}
+/* parse_body {{{ */
+/* parse_body's arguments */
+typedef struct fid_parse_body_arg { enum v7_tok end; } fid_parse_body_arg_t;
 
-/*
- * static enum v7_err parse_binary(struct v7 *v7, struct ast *a, int level,
- *                                 ast_off_t pos)
- */
-#if 1
-fid_parse_binary :
-#undef L
-#define L CR_CUR_LOCALS_PT(fid_parse_binary_locals_t)
-{
-/*
- * Note: we use macro CUR_POS instead of a local variable, since this
- * function is called really a lot, so, each byte on stack frame counts.
- *
- * It will work a bit slower of course, but slowness is not a problem
- */
-#define CUR_POS ((L->level > L->arg.min_level) ? L->saved_mbuf_len : L->arg.pos)
-  L->saved_mbuf_len = a->mbuf.len;
+/* parse_body's data on stack */
+typedef struct fid_parse_body_locals {
+  struct fid_parse_body_arg arg;
 
-  CALL_PARSE_PREFIX(fid_p_binary_6);
+  ast_off_t start;
+} fid_parse_body_locals_t;
 
-  for (L->level = (int) ARRAY_SIZE(levels) - 1; L->level >= L->arg.min_level;
-       L->level--) {
-    for (L->i = 0; L->i < levels[L->level].len; L->i++) {
-      L->tok = levels[L->level].parts[L->i].start_tok;
-      L->ast = levels[L->level].parts[L->i].start_ast;
-      do {
-        if (v7->pstate.inhibit_in && L->tok == TOK_IN) {
-          continue;
-        }
+#define CALL_PARSE_BODY(_end, _label) \
+  do {                                \
+    N.fid_parse_body.end = (_end);    \
+    CR_CALL(fid_parse_body, _label);  \
+  } while (0)
+/* }}} */
 
-        /*
-         * Ternary operator sits in the middle of the binary operator
-         * precedence chain. Deal with it as an exception and don't break
-         * the chain.
-         */
-        if (L->tok == TOK_QUESTION && v7->cur_tok == TOK_QUESTION) {
-          next_tok(v7);
-          CALL_PARSE_ASSIGN(fid_p_binary_2);
-          EXPECT(TOK_COLON);
-          CALL_PARSE_ASSIGN(fid_p_binary_3);
-          insert_node(v7, a, CUR_POS, AST_COND);
-          CR_RETURN_VOID();
-        } else if (ACCEPT(L->tok)) {
-          if (levels[L->level].left_to_right) {
-            insert_node(v7, a, CUR_POS, (enum ast_tag) L->ast);
-            CALL_PARSE_BINARY(L->level, CUR_POS, fid_p_binary_4);
-          } else {
-            CALL_PARSE_BINARY(L->level, a->mbuf.len, fid_p_binary_5);
-            insert_node(v7, a, CUR_POS, (enum ast_tag) L->ast);
-          }
-        }
-      } while (L->ast = (enum ast_tag)(L->ast + 1),
-               L->tok < levels[L->level].parts[L->i].end_tok &&
-                   (L->tok = (enum v7_tok)(L->tok + 1)));
-    }
-  }
+/* parse_statement {{{ */
+/* parse_statement's arguments */
+#if 0
+typedef struct fid_parse_statement_arg {
+} fid_parse_statement_arg_t;
+#else
+typedef cr_zero_size_type_t fid_parse_statement_arg_t;
+#endif
 
-  CR_RETURN_VOID();
-#undef CUR_POS
-}
+/* parse_statement's data on stack */
+#if 0
+typedef struct fid_parse_statement_locals {
+  struct fid_parse_statement_arg arg;
+} fid_parse_statement_locals_t;
+#else
+typedef cr_zero_size_type_t fid_parse_statement_locals_t;
 #endif
 
-/* enum v7_err parse_prefix(struct v7 *v7, struct ast *a) */
-fid_parse_prefix :
-#undef L
-#define L CR_CUR_LOCALS_PT(fid_parse_prefix_locals_t)
-{
-  for (;;) {
-    switch (v7->cur_tok) {
-      case TOK_PLUS:
-        next_tok(v7);
-        add_node(v7, a, AST_POSITIVE);
-        break;
-      case TOK_MINUS:
-        next_tok(v7);
-        add_node(v7, a, AST_NEGATIVE);
-        break;
-      case TOK_PLUS_PLUS:
-        next_tok(v7);
-        add_node(v7, a, AST_PREINC);
-        break;
-      case TOK_MINUS_MINUS:
-        next_tok(v7);
-        add_node(v7, a, AST_PREDEC);
-        break;
-      case TOK_TILDA:
-        next_tok(v7);
-        add_node(v7, a, AST_NOT);
-        break;
-      case TOK_NOT:
-        next_tok(v7);
-        add_node(v7, a, AST_LOGICAL_NOT);
-        break;
-      case TOK_VOID:
-        next_tok(v7);
-        add_node(v7, a, AST_VOID);
-        break;
-      case TOK_DELETE:
-        next_tok(v7);
-        add_node(v7, a, AST_DELETE);
-        break;
-      case TOK_TYPEOF:
-        next_tok(v7);
-        add_node(v7, a, AST_TYPEOF);
-        break;
-      default:
-        CALL_PARSE_POSTFIX(fid_p_prefix_1);
-        CR_RETURN_VOID();
-    }
-  }
-}
+#define CALL_PARSE_STATEMENT(_label)      \
+  do {                                    \
+    CR_CALL(fid_parse_statement, _label); \
+  } while (0)
+/* }}} */
 
-/* static enum v7_err parse_postfix(struct v7 *v7, struct ast *a) */
-fid_parse_postfix :
-#undef L
-#define L CR_CUR_LOCALS_PT(fid_parse_postfix_locals_t)
-{
-  L->pos = a->mbuf.len;
-  CALL_PARSE_CALLEXPR(fid_p_postfix_1);
+/* parse_expression {{{ */
+/* parse_expression's arguments */
+#if 0
+typedef struct fid_parse_expression_arg {
+} fid_parse_expression_arg_t;
+#else
+typedef cr_zero_size_type_t fid_parse_expression_arg_t;
+#endif
 
-  if (v7->after_newline) {
-    CR_RETURN_VOID();
-  }
-  switch (v7->cur_tok) {
-    case TOK_PLUS_PLUS:
-      next_tok(v7);
-      insert_node(v7, a, L->pos, AST_POSTINC);
-      break;
-    case TOK_MINUS_MINUS:
-      next_tok(v7);
-      insert_node(v7, a, L->pos, AST_POSTDEC);
-      break;
-    default:
-      break; /* nothing */
-  }
-  CR_RETURN_VOID();
-}
+/* parse_expression's data on stack */
+typedef struct fid_parse_expression_locals {
+#if 0
+  struct fid_parse_expression_arg arg;
+#endif
 
-/* static enum v7_err parse_callexpr(struct v7 *v7, struct ast *a) */
-fid_parse_callexpr :
-#undef L
-#define L CR_CUR_LOCALS_PT(fid_parse_callexpr_locals_t)
-{
-  L->pos = a->mbuf.len;
-  CALL_PARSE_NEWEXPR(fid_p_callexpr_1);
+  ast_off_t pos;
+  int group;
+} fid_parse_expression_locals_t;
 
-  for (;;) {
-    switch (v7->cur_tok) {
-      case TOK_DOT:
-      case TOK_OPEN_BRACKET:
-        CALL_PARSE_MEMBER(L->pos, fid_p_callexpr_3);
-        break;
-      case TOK_OPEN_PAREN:
-        next_tok(v7);
-        CALL_PARSE_ARGLIST(fid_p_callexpr_2);
-        EXPECT(TOK_CLOSE_PAREN);
-        insert_node(v7, a, L->pos, AST_CALL);
-        break;
-      default:
-        CR_RETURN_VOID();
-    }
-  }
-}
+#define CALL_PARSE_EXPRESSION(_label)      \
+  do {                                     \
+    CR_CALL(fid_parse_expression, _label); \
+  } while (0)
+/* }}} */
 
-/* static enum v7_err parse_newexpr(struct v7 *v7, struct ast *a) */
-fid_parse_newexpr :
-#undef L
-#define L CR_CUR_LOCALS_PT(fid_parse_newexpr_locals_t)
-{
-  switch (v7->cur_tok) {
-    case TOK_NEW:
-      next_tok(v7);
-      L->start = add_node(v7, a, AST_NEW);
-      CALL_PARSE_MEMBEREXPR(fid_p_newexpr_3);
-      if (ACCEPT(TOK_OPEN_PAREN)) {
-        CALL_PARSE_ARGLIST(fid_p_newexpr_4);
-        EXPECT(TOK_CLOSE_PAREN);
-      }
-      ast_set_skip(a, L->start, AST_END_SKIP);
-      break;
-    case TOK_FUNCTION:
-      next_tok(v7);
-      CALL_PARSE_FUNCDECL(0, 0, fid_p_newexpr_2);
-      break;
-    default:
-      CALL_PARSE_TERMINAL(fid_p_newexpr_1);
-      break;
-  }
-  CR_RETURN_VOID();
-}
+/* parse_assign {{{ */
+/* parse_assign's arguments */
+#if 0
+typedef struct fid_parse_assign_arg {
+} fid_parse_assign_arg_t;
+#else
+typedef cr_zero_size_type_t fid_parse_assign_arg_t;
+#endif
 
-/* static enum v7_err parse_terminal(struct v7 *v7, struct ast *a) */
-fid_parse_terminal :
-#undef L
-#define L CR_CUR_LOCALS_PT(fid_parse_terminal_locals_t)
-{
-  switch (v7->cur_tok) {
-    case TOK_OPEN_PAREN:
-      next_tok(v7);
-      CALL_PARSE_EXPRESSION(fid_p_terminal_1);
-      EXPECT(TOK_CLOSE_PAREN);
-      break;
-    case TOK_OPEN_BRACKET:
-      next_tok(v7);
-      L->start = add_node(v7, a, AST_ARRAY);
-      while (v7->cur_tok != TOK_CLOSE_BRACKET) {
-        if (v7->cur_tok == TOK_COMMA) {
-          /* Array literals allow missing elements, e.g. [,,1,] */
-          add_node(v7, a, AST_NOP);
-        } else {
-          CALL_PARSE_ASSIGN(fid_p_terminal_2);
-        }
-        ACCEPT(TOK_COMMA);
-      }
-      EXPECT(TOK_CLOSE_BRACKET);
-      ast_set_skip(a, L->start, AST_END_SKIP);
-      break;
-    case TOK_OPEN_CURLY:
-      next_tok(v7);
-      L->start = add_node(v7, a, AST_OBJECT);
-      if (v7->cur_tok != TOK_CLOSE_CURLY) {
-        do {
-          if (v7->cur_tok == TOK_CLOSE_CURLY) {
-            break;
-          }
-          CALL_PARSE_PROP(fid_p_terminal_3);
-        } while (ACCEPT(TOK_COMMA));
-      }
-      EXPECT(TOK_CLOSE_CURLY);
-      ast_set_skip(a, L->start, AST_END_SKIP);
-      break;
-    case TOK_THIS:
-      next_tok(v7);
-      add_node(v7, a, AST_THIS);
-      break;
-    case TOK_TRUE:
-      next_tok(v7);
-      add_node(v7, a, AST_TRUE);
-      break;
-    case TOK_FALSE:
-      next_tok(v7);
-      add_node(v7, a, AST_FALSE);
-      break;
-    case TOK_NULL:
-      next_tok(v7);
-      add_node(v7, a, AST_NULL);
-      break;
-    case TOK_STRING_LITERAL:
-      add_inlined_node(v7, a, AST_STRING, v7->tok + 1, v7->tok_len - 2);
-      next_tok(v7);
-      break;
-    case TOK_NUMBER:
-      add_inlined_node(v7, a, AST_NUM, v7->tok, v7->tok_len);
-      next_tok(v7);
-      break;
-    case TOK_REGEX_LITERAL:
-      add_inlined_node(v7, a, AST_REGEX, v7->tok, v7->tok_len);
-      next_tok(v7);
-      break;
-    case TOK_IDENTIFIER:
-      if (v7->tok_len == 9 && strncmp(v7->tok, "undefined", v7->tok_len) == 0) {
-        add_node(v7, a, AST_UNDEFINED);
-        next_tok(v7);
-        break;
-      }
-    /* fall through */
-    default:
-      CALL_PARSE_IDENT(fid_p_terminal_4);
-  }
-  CR_RETURN_VOID();
-}
-
-/* static enum v7_err parse_block(struct v7 *v7, struct ast *a) */
-fid_parse_block :
-#undef L
-#define L CR_CUR_LOCALS_PT(fid_parse_block_locals_t)
-{
-  EXPECT(TOK_OPEN_CURLY);
-  CALL_PARSE_BODY(TOK_CLOSE_CURLY, fid_p_block_1);
-  EXPECT(TOK_CLOSE_CURLY);
-  CR_RETURN_VOID();
-}
+/* parse_assign's data on stack */
+#if 0
+typedef struct fid_parse_assign_locals {
+  struct fid_parse_assign_arg arg;
+} fid_parse_assign_locals_t;
+#else
+typedef cr_zero_size_type_t fid_parse_assign_locals_t;
+#endif
 
-/* static enum v7_err parse_if(struct v7 *v7, struct ast *a) */
-fid_parse_if :
-#undef L
-#define L CR_CUR_LOCALS_PT(fid_parse_if_locals_t)
-{
-  L->start = add_node(v7, a, AST_IF);
-  EXPECT(TOK_OPEN_PAREN);
-  CALL_PARSE_EXPRESSION(fid_p_if_1);
-  EXPECT(TOK_CLOSE_PAREN);
-  CALL_PARSE_STATEMENT(fid_p_if_2);
-  ast_set_skip(a, L->start, AST_END_IF_TRUE_SKIP);
-  if (ACCEPT(TOK_ELSE)) {
-    CALL_PARSE_STATEMENT(fid_p_if_3);
-  }
-  ast_set_skip(a, L->start, AST_END_SKIP);
-  CR_RETURN_VOID();
-}
+#define CALL_PARSE_ASSIGN(_label)      \
+  do {                                 \
+    CR_CALL(fid_parse_assign, _label); \
+  } while (0)
+/* }}} */
 
-/* static enum v7_err parse_while(struct v7 *v7, struct ast *a) */
-fid_parse_while :
-#undef L
-#define L CR_CUR_LOCALS_PT(fid_parse_while_locals_t)
-{
-  L->start = add_node(v7, a, AST_WHILE);
-  L->saved_in_loop = v7->pstate.in_loop;
-  EXPECT(TOK_OPEN_PAREN);
-  CALL_PARSE_EXPRESSION(fid_p_while_1);
-  EXPECT(TOK_CLOSE_PAREN);
-  v7->pstate.in_loop = 1;
-  CALL_PARSE_STATEMENT(fid_p_while_2);
-  ast_set_skip(a, L->start, AST_END_SKIP);
-  v7->pstate.in_loop = L->saved_in_loop;
-  CR_RETURN_VOID();
-}
+/* parse_binary {{{ */
+/* parse_binary's arguments */
+typedef struct fid_parse_binary_arg {
+  ast_off_t pos;
+  uint8_t min_level;
+} fid_parse_binary_arg_t;
 
-/* static enum v7_err parse_ident(struct v7 *v7, struct ast *a) */
-fid_parse_ident :
-#undef L
-#define L CR_CUR_LOCALS_PT(fid_parse_ident_locals_t)
-{
-  if (v7->cur_tok == TOK_IDENTIFIER) {
-    add_inlined_node(v7, a, AST_IDENT, v7->tok, v7->tok_len);
-    next_tok(v7);
-    CR_RETURN_VOID();
-  }
-  CR_THROW(PARSER_EXC_ID__SYNTAX_ERROR);
-}
+/* parse_binary's data on stack */
+typedef struct fid_parse_binary_locals {
+  struct fid_parse_binary_arg arg;
 
-/*
- * static enum v7_err parse_ident_allow_reserved_words(struct v7 *v7,
- *                                                     struct ast *a)
- *
- */
-fid_parse_ident_allow_reserved_words :
-#undef L
-#define L CR_CUR_LOCALS_PT(fid_parse_ident_allow_reserved_words_locals_t)
-{
-  /* Allow reserved words as property names. */
-  if (is_reserved_word_token(v7->cur_tok)) {
-    add_inlined_node(v7, a, AST_IDENT, v7->tok, v7->tok_len);
-    next_tok(v7);
-  } else {
-    CALL_PARSE_IDENT(fid_p_ident_arw_1);
-  }
-  CR_RETURN_VOID();
-}
+  uint8_t i;
+  /* during iteration, it becomes negative, so should be signed */
+  int8_t level;
+  uint8_t /*enum v7_tok*/ tok;
+  uint8_t /*enum ast_tag*/ ast;
+  ast_off_t saved_mbuf_len;
+} fid_parse_binary_locals_t;
 
-/* static enum v7_err parse_funcdecl(struct v7 *, struct ast *, int, int) */
-fid_parse_funcdecl :
-#undef L
-#define L CR_CUR_LOCALS_PT(fid_parse_funcdecl_locals_t)
-{
-  L->start = add_node(v7, a, AST_FUNC);
-  L->outer_last_var_node = v7->last_var_node;
-  L->saved_in_function = v7->pstate.in_function;
-  L->saved_in_strict = v7->pstate.in_strict;
+#define CALL_PARSE_BINARY(_level, _pos, _label) \
+  do {                                          \
+    N.fid_parse_binary.min_level = (_level);    \
+    N.fid_parse_binary.pos = (_pos);            \
+    CR_CALL(fid_parse_binary, _label);          \
+  } while (0)
+/* }}} */
 
-  v7->last_var_node = L->start;
-  ast_modify_skip(a, L->start, L->start, AST_FUNC_FIRST_VAR_SKIP);
+/* parse_prefix {{{ */
+/* parse_prefix's arguments */
+#if 0
+typedef struct fid_parse_prefix_arg {
+} fid_parse_prefix_arg_t;
+#else
+typedef cr_zero_size_type_t fid_parse_prefix_arg_t;
+#endif
 
-  CR_TRY(fid_p_funcdecl_2);
-  {
-    if (L->arg.reserved_name) {
-      CALL_PARSE_IDENT_ALLOW_RESERVED_WORDS(fid_p_funcdecl_1);
-    } else {
-      CALL_PARSE_IDENT(fid_p_funcdecl_9);
-    }
-  }
-  CR_CATCH(PARSER_EXC_ID__SYNTAX_ERROR, fid_p_funcdecl_2, fid_p_funcdecl_3);
-  {
-    if (L->arg.require_named) {
-      /* function name is required, so, rethrow SYNTAX ERROR */
-      CR_THROW(PARSER_EXC_ID__SYNTAX_ERROR);
-    } else {
-      /* it's ok not to have a function name, just insert NOP */
-      add_node(v7, a, AST_NOP);
-    }
-  }
-  CR_ENDCATCH(fid_p_funcdecl_3);
+/* parse_prefix's data on stack */
+#if 0
+typedef struct fid_parse_prefix_locals {
+  struct fid_parse_prefix_arg arg;
+} fid_parse_prefix_locals_t;
+#else
+typedef cr_zero_size_type_t fid_parse_prefix_locals_t;
+#endif
 
-  EXPECT(TOK_OPEN_PAREN);
-  CALL_PARSE_ARGLIST(fid_p_funcdecl_4);
-  EXPECT(TOK_CLOSE_PAREN);
-  ast_set_skip(a, L->start, AST_FUNC_BODY_SKIP);
-  v7->pstate.in_function = 1;
-  EXPECT(TOK_OPEN_CURLY);
+#define CALL_PARSE_PREFIX(_label)      \
+  do {                                 \
+    CR_CALL(fid_parse_prefix, _label); \
+  } while (0)
+/* }}} */
 
-  CR_TRY(fid_p_funcdecl_5);
-  {
-    CALL_PARSE_USE_STRICT(fid_p_funcdecl_7);
-    v7->pstate.in_strict = 1;
-  }
-  CR_CATCH(PARSER_EXC_ID__SYNTAX_ERROR, fid_p_funcdecl_5, fid_p_funcdecl_6);
-  CR_ENDCATCH(fid_p_funcdecl_6);
+/* parse_postfix {{{ */
+/* parse_postfix's arguments */
+#if 0
+typedef struct fid_parse_postfix_arg {
+} fid_parse_postfix_arg_t;
+#else
+typedef cr_zero_size_type_t fid_parse_postfix_arg_t;
+#endif
 
-  CALL_PARSE_BODY(TOK_CLOSE_CURLY, fid_p_funcdecl_8);
-  EXPECT(TOK_CLOSE_CURLY);
-  v7->pstate.in_strict = L->saved_in_strict;
-  v7->pstate.in_function = L->saved_in_function;
-  ast_set_skip(a, L->start, AST_END_SKIP);
-  v7->last_var_node = L->outer_last_var_node;
+/* parse_postfix's data on stack */
+typedef struct fid_parse_postfix_locals {
+#if 0
+  struct fid_parse_postfix_arg arg;
+#endif
 
-  CR_RETURN_VOID();
-}
+  ast_off_t pos;
+} fid_parse_postfix_locals_t;
 
-/* static enum v7_err parse_arglist(struct v7 *v7, struct ast *a) */
-fid_parse_arglist :
-#undef L
-#define L CR_CUR_LOCALS_PT(fid_parse_arglist_locals_t)
-{
-  if (v7->cur_tok != TOK_CLOSE_PAREN) {
-    do {
-      CALL_PARSE_ASSIGN(fid_p_arglist_1);
-    } while (ACCEPT(TOK_COMMA));
-  }
-  CR_RETURN_VOID();
-}
+#define CALL_PARSE_POSTFIX(_label)      \
+  do {                                  \
+    CR_CALL(fid_parse_postfix, _label); \
+  } while (0)
+/* }}} */
 
-/*
- * static enum v7_err parse_member(struct v7 *v7, struct ast *a, ast_off_t pos)
- */
-fid_parse_member :
-#undef L
-#define L CR_CUR_LOCALS_PT(fid_parse_member_locals_t)
-{
-  switch (v7->cur_tok) {
-    case TOK_DOT:
-      next_tok(v7);
-      /* Allow reserved words as member identifiers */
-      if (is_reserved_word_token(v7->cur_tok) ||
-          v7->cur_tok == TOK_IDENTIFIER) {
-        insert_inlined_node(v7, a, L->arg.pos, AST_MEMBER, v7->tok,
-                            v7->tok_len);
-        next_tok(v7);
-      } else {
-        CR_THROW(PARSER_EXC_ID__SYNTAX_ERROR);
-      }
-      break;
-    case TOK_OPEN_BRACKET:
-      next_tok(v7);
-      CALL_PARSE_EXPRESSION(fid_p_member_1);
-      EXPECT(TOK_CLOSE_BRACKET);
-      insert_node(v7, a, L->arg.pos, AST_INDEX);
-      break;
-    default:
-      CR_RETURN_VOID();
-  }
-  /* not necessary, but let it be anyway */
-  CR_RETURN_VOID();
-}
+/* parse_callexpr {{{ */
+/* parse_callexpr's arguments */
+#if 0
+typedef struct fid_parse_callexpr_arg {
+} fid_parse_callexpr_arg_t;
+#else
+typedef cr_zero_size_type_t fid_parse_callexpr_arg_t;
+#endif
 
-/* static enum v7_err parse_memberexpr(struct v7 *v7, struct ast *a) */
-fid_parse_memberexpr :
-#undef L
-#define L CR_CUR_LOCALS_PT(fid_parse_memberexpr_locals_t)
-{
-  L->pos = a->mbuf.len;
-  CALL_PARSE_NEWEXPR(fid_p_memberexpr_1);
+/* parse_callexpr's data on stack */
+typedef struct fid_parse_callexpr_locals {
+#if 0
+  struct fid_parse_callexpr_arg arg;
+#endif
 
-  for (;;) {
-    switch (v7->cur_tok) {
-      case TOK_DOT:
-      case TOK_OPEN_BRACKET:
-        CALL_PARSE_MEMBER(L->pos, fid_p_memberexpr_2);
-        break;
-      default:
-        CR_RETURN_VOID();
-    }
-  }
-}
+  ast_off_t pos;
+} fid_parse_callexpr_locals_t;
 
-/* static enum v7_err parse_var(struct v7 *v7, struct ast *a) */
-fid_parse_var :
-#undef L
-#define L CR_CUR_LOCALS_PT(fid_parse_var_locals_t)
-{
-  L->start = add_node(v7, a, AST_VAR);
-  ast_modify_skip(a, v7->last_var_node, L->start, AST_FUNC_FIRST_VAR_SKIP);
-  /* zero out var node pointer */
-  ast_modify_skip(a, L->start, L->start, AST_FUNC_FIRST_VAR_SKIP);
-  v7->last_var_node = L->start;
-  do {
-    add_inlined_node(v7, a, AST_VAR_DECL, v7->tok, v7->tok_len);
-    EXPECT(TOK_IDENTIFIER);
-    if (ACCEPT(TOK_ASSIGN)) {
-      CALL_PARSE_ASSIGN(fid_p_var_1);
-    } else {
-      add_node(v7, a, AST_NOP);
-    }
-  } while (ACCEPT(TOK_COMMA));
-  ast_set_skip(a, L->start, AST_END_SKIP);
-  CR_RETURN_VOID();
-}
+#define CALL_PARSE_CALLEXPR(_label)      \
+  do {                                   \
+    CR_CALL(fid_parse_callexpr, _label); \
+  } while (0)
+/* }}} */
 
-/* static enum v7_err parse_prop(struct v7 *v7, struct ast *a) */
-fid_parse_prop :
-#undef L
-#define L CR_CUR_LOCALS_PT(fid_parse_prop_locals_t)
-{
-#ifdef V7_ENABLE_JS_GETTERS
-  if (v7->cur_tok == TOK_IDENTIFIER && v7->tok_len == 3 &&
-      strncmp(v7->tok, "get", v7->tok_len) == 0 && lookahead(v7) != TOK_COLON) {
-    next_tok(v7);
-    add_node(v7, a, AST_GETTER);
-    CALL_PARSE_FUNCDECL(1, 1, fid_p_prop_1_getter);
-  } else
+/* parse_newexpr {{{ */
+/* parse_newexpr's arguments */
+#if 0
+typedef struct fid_parse_newexpr_arg {
+} fid_parse_newexpr_arg_t;
+#else
+typedef cr_zero_size_type_t fid_parse_newexpr_arg_t;
 #endif
-      if (v7->cur_tok == TOK_IDENTIFIER && lookahead(v7) == TOK_OPEN_PAREN) {
-    /* ecmascript 6 feature */
-    CALL_PARSE_FUNCDECL(1, 1, fid_p_prop_2);
-#ifdef V7_ENABLE_JS_SETTERS
-  } else if (v7->cur_tok == TOK_IDENTIFIER && v7->tok_len == 3 &&
-             strncmp(v7->tok, "set", v7->tok_len) == 0 &&
-             lookahead(v7) != TOK_COLON) {
-    next_tok(v7);
-    add_node(v7, a, AST_SETTER);
-    CALL_PARSE_FUNCDECL(1, 1, fid_p_prop_3_setter);
+
+/* parse_newexpr's data on stack */
+typedef struct fid_parse_newexpr_locals {
+#if 0
+  struct fid_parse_newexpr_arg arg;
 #endif
-  } else {
-    /* Allow reserved words as property names. */
-    if (is_reserved_word_token(v7->cur_tok) || v7->cur_tok == TOK_IDENTIFIER ||
-        v7->cur_tok == TOK_NUMBER) {
-      add_inlined_node(v7, a, AST_PROP, v7->tok, v7->tok_len);
-    } else if (v7->cur_tok == TOK_STRING_LITERAL) {
-      add_inlined_node(v7, a, AST_PROP, v7->tok + 1, v7->tok_len - 2);
-    } else {
-      CR_THROW(PARSER_EXC_ID__SYNTAX_ERROR);
-    }
-    next_tok(v7);
-    EXPECT(TOK_COLON);
-    CALL_PARSE_ASSIGN(fid_p_prop_4);
-  }
-  CR_RETURN_VOID();
-}
 
-/* static enum v7_err parse_dowhile(struct v7 *v7, struct ast *a) */
-fid_parse_dowhile :
-#undef L
-#define L CR_CUR_LOCALS_PT(fid_parse_dowhile_locals_t)
-{
-  L->start = add_node(v7, a, AST_DOWHILE);
-  L->saved_in_loop = v7->pstate.in_loop;
+  ast_off_t start;
+} fid_parse_newexpr_locals_t;
 
-  v7->pstate.in_loop = 1;
-  CALL_PARSE_STATEMENT(fid_p_dowhile_1);
-  v7->pstate.in_loop = L->saved_in_loop;
-  ast_set_skip(a, L->start, AST_DO_WHILE_COND_SKIP);
-  EXPECT(TOK_WHILE);
-  EXPECT(TOK_OPEN_PAREN);
-  CALL_PARSE_EXPRESSION(fid_p_dowhile_2);
-  EXPECT(TOK_CLOSE_PAREN);
-  ast_set_skip(a, L->start, AST_END_SKIP);
-  CR_RETURN_VOID();
-}
+#define CALL_PARSE_NEWEXPR(_label)      \
+  do {                                  \
+    CR_CALL(fid_parse_newexpr, _label); \
+  } while (0)
+/* }}} */
 
-/* static enum v7_err parse_for(struct v7 *v7, struct ast *a) */
-fid_parse_for :
-#undef L
-#define L CR_CUR_LOCALS_PT(fid_parse_for_locals_t)
-{
-  /* TODO(mkm): for of, for each in */
-  /*
-  ast_off_t start;
-  int saved_in_loop;
-  */
+/* parse_terminal {{{ */
+/* parse_terminal's arguments */
+#if 0
+typedef struct fid_parse_terminal_arg {
+} fid_parse_terminal_arg_t;
+#else
+typedef cr_zero_size_type_t fid_parse_terminal_arg_t;
+#endif
 
-  L->start = add_node(v7, a, AST_FOR);
-  L->saved_in_loop = v7->pstate.in_loop;
+/* parse_terminal's data on stack */
+typedef struct fid_parse_terminal_locals {
+#if 0
+  struct fid_parse_terminal_arg arg;
+#endif
 
-  EXPECT(TOK_OPEN_PAREN);
+  ast_off_t start;
+} fid_parse_terminal_locals_t;
 
-  if (parse_optional(v7, a, TOK_SEMICOLON)) {
-    /*
-     * TODO(mkm): make this reentrant otherwise this pearl won't parse:
-     * for((function(){return 1 in o.a ? o : x})().a in [1,2,3])
-     */
-    v7->pstate.inhibit_in = 1;
-    if (ACCEPT(TOK_VAR)) {
-      CALL_PARSE_VAR(fid_p_for_1);
-    } else {
-      CALL_PARSE_EXPRESSION(fid_p_for_2);
-    }
-    v7->pstate.inhibit_in = 0;
+#define CALL_PARSE_TERMINAL(_label)      \
+  do {                                   \
+    CR_CALL(fid_parse_terminal, _label); \
+  } while (0)
+/* }}} */
 
-    if (ACCEPT(TOK_IN)) {
-      CALL_PARSE_EXPRESSION(fid_p_for_3);
-      add_node(v7, a, AST_NOP);
-      /*
-       * Assumes that for and for in have the same AST format which is
-       * suboptimal but avoids the need of fixing up the var offset chain.
-       * TODO(mkm) improve this
-       */
-      ast_modify_tag(a, L->start - 1, AST_FOR_IN);
-      goto for_loop_body;
-    }
-  }
+/* parse_block {{{ */
+/* parse_block's arguments */
+#if 0
+typedef struct fid_parse_block_arg {
+} fid_parse_block_arg_t;
+#else
+typedef cr_zero_size_type_t fid_parse_block_arg_t;
+#endif
 
-  EXPECT(TOK_SEMICOLON);
-  if (parse_optional(v7, a, TOK_SEMICOLON)) {
-    CALL_PARSE_EXPRESSION(fid_p_for_4);
-  }
-  EXPECT(TOK_SEMICOLON);
-  if (parse_optional(v7, a, TOK_CLOSE_PAREN)) {
-    CALL_PARSE_EXPRESSION(fid_p_for_5);
-  }
+/* parse_block's data on stack */
+#if 0
+typedef struct fid_parse_block_locals {
+  struct fid_parse_block_arg arg;
+} fid_parse_block_locals_t;
+#else
+typedef cr_zero_size_type_t fid_parse_block_locals_t;
+#endif
 
-for_loop_body:
-  EXPECT(TOK_CLOSE_PAREN);
-  ast_set_skip(a, L->start, AST_FOR_BODY_SKIP);
-  v7->pstate.in_loop = 1;
-  CALL_PARSE_STATEMENT(fid_p_for_6);
-  v7->pstate.in_loop = L->saved_in_loop;
-  ast_set_skip(a, L->start, AST_END_SKIP);
-  CR_RETURN_VOID();
-}
+#define CALL_PARSE_BLOCK(_label)      \
+  do {                                \
+    CR_CALL(fid_parse_block, _label); \
+  } while (0)
+/* }}} */
 
-/* static enum v7_err parse_try(struct v7 *v7, struct ast *a) */
-fid_parse_try :
-#undef L
-#define L CR_CUR_LOCALS_PT(fid_parse_try_locals_t)
-{
-  L->start = add_node(v7, a, AST_TRY);
-  L->catch_or_finally = 0;
-  CALL_PARSE_BLOCK(fid_p_try_1);
-  ast_set_skip(a, L->start, AST_TRY_CATCH_SKIP);
-  if (ACCEPT(TOK_CATCH)) {
-    L->catch_or_finally = 1;
-    EXPECT(TOK_OPEN_PAREN);
-    CALL_PARSE_IDENT(fid_p_try_2);
-    EXPECT(TOK_CLOSE_PAREN);
-    CALL_PARSE_BLOCK(fid_p_try_3);
-  }
-  ast_set_skip(a, L->start, AST_TRY_FINALLY_SKIP);
-  if (ACCEPT(TOK_FINALLY)) {
-    L->catch_or_finally = 1;
-    CALL_PARSE_BLOCK(fid_p_try_4);
-  }
-  ast_set_skip(a, L->start, AST_END_SKIP);
+/* parse_if {{{ */
+/* parse_if's arguments */
+#if 0
+typedef struct fid_parse_if_arg {
+} fid_parse_if_arg_t;
+#else
+typedef cr_zero_size_type_t fid_parse_if_arg_t;
+#endif
 
-  /* make sure `catch` and `finally` aren't both missing */
-  if (!L->catch_or_finally) {
-    CR_THROW(PARSER_EXC_ID__SYNTAX_ERROR);
-  }
+/* parse_if's data on stack */
+typedef struct fid_parse_if_locals {
+#if 0
+  struct fid_parse_if_arg arg;
+#endif
 
-  CR_RETURN_VOID();
-}
+  ast_off_t start;
+} fid_parse_if_locals_t;
 
-/* static enum v7_err parse_switch(struct v7 *v7, struct ast *a) */
-fid_parse_switch :
-#undef L
-#define L CR_CUR_LOCALS_PT(fid_parse_switch_locals_t)
-{
-  L->start = add_node(v7, a, AST_SWITCH);
-  L->saved_in_switch = v7->pstate.in_switch;
+#define CALL_PARSE_IF(_label)      \
+  do {                             \
+    CR_CALL(fid_parse_if, _label); \
+  } while (0)
+/* }}} */
 
-  ast_set_skip(a, L->start, AST_SWITCH_DEFAULT_SKIP); /* clear out */
-  EXPECT(TOK_OPEN_PAREN);
-  CALL_PARSE_EXPRESSION(fid_p_switch_1);
-  EXPECT(TOK_CLOSE_PAREN);
-  EXPECT(TOK_OPEN_CURLY);
-  v7->pstate.in_switch = 1;
-  while (v7->cur_tok != TOK_CLOSE_CURLY) {
-    switch (v7->cur_tok) {
-      case TOK_CASE:
-        next_tok(v7);
-        L->case_start = add_node(v7, a, AST_CASE);
-        CALL_PARSE_EXPRESSION(fid_p_switch_2);
-        EXPECT(TOK_COLON);
-        while (v7->cur_tok != TOK_CASE && v7->cur_tok != TOK_DEFAULT &&
-               v7->cur_tok != TOK_CLOSE_CURLY) {
-          CALL_PARSE_STATEMENT(fid_p_switch_3);
-        }
-        ast_set_skip(a, L->case_start, AST_END_SKIP);
-        break;
-      case TOK_DEFAULT:
-        next_tok(v7);
-        EXPECT(TOK_COLON);
-        ast_set_skip(a, L->start, AST_SWITCH_DEFAULT_SKIP);
-        L->case_start = add_node(v7, a, AST_DEFAULT);
-        while (v7->cur_tok != TOK_CASE && v7->cur_tok != TOK_DEFAULT &&
-               v7->cur_tok != TOK_CLOSE_CURLY) {
-          CALL_PARSE_STATEMENT(fid_p_switch_4);
-        }
-        ast_set_skip(a, L->case_start, AST_END_SKIP);
-        break;
-      default:
-        CR_THROW(PARSER_EXC_ID__SYNTAX_ERROR);
-    }
-  }
-  EXPECT(TOK_CLOSE_CURLY);
-  ast_set_skip(a, L->start, AST_END_SKIP);
-  v7->pstate.in_switch = L->saved_in_switch;
-  CR_RETURN_VOID();
-}
+/* parse_while {{{ */
+/* parse_while's arguments */
+#if 0
+typedef struct fid_parse_while_arg {
+} fid_parse_while_arg_t;
+#else
+typedef cr_zero_size_type_t fid_parse_while_arg_t;
+#endif
 
-/* static enum v7_err parse_with(struct v7 *v7, struct ast *a) */
-fid_parse_with :
-#undef L
-#define L CR_CUR_LOCALS_PT(fid_parse_with_locals_t)
-{
-  L->start = add_node(v7, a, AST_WITH);
-  if (v7->pstate.in_strict) {
-    CR_THROW(PARSER_EXC_ID__SYNTAX_ERROR);
-  }
-  EXPECT(TOK_OPEN_PAREN);
-  CALL_PARSE_EXPRESSION(fid_p_with_1);
-  EXPECT(TOK_CLOSE_PAREN);
-  CALL_PARSE_STATEMENT(fid_p_with_2);
-  ast_set_skip(a, L->start, AST_END_SKIP);
-  CR_RETURN_VOID();
-}
+/* parse_while's data on stack */
+typedef struct fid_parse_while_locals {
+#if 0
+  struct fid_parse_while_arg arg;
+#endif
 
-fid_none:
-  /* stack is empty, so we're done; return */
-  return rc;
-}
+  ast_off_t start;
+  uint8_t saved_in_loop;
+} fid_parse_while_locals_t;
 
-V7_PRIVATE enum v7_err parse(struct v7 *v7, struct ast *a, const char *src,
-                             int is_json) {
-  enum v7_err rcode;
-  const char *error_msg = NULL;
-  const char *p;
-  struct cr_ctx cr_ctx;
-  union user_arg_ret arg_retval;
-  enum cr_status rc;
-#if defined(V7_ENABLE_STACK_TRACKING)
-  struct stack_track_ctx stack_track_ctx;
-#endif
-  int saved_line_no = v7->line_no;
+#define CALL_PARSE_WHILE(_label)      \
+  do {                                \
+    CR_CALL(fid_parse_while, _label); \
+  } while (0)
+/* }}} */
 
-#if defined(V7_ENABLE_STACK_TRACKING)
-  v7_stack_track_start(v7, &stack_track_ctx);
+/* parse_ident {{{ */
+/* parse_ident's arguments */
+#if 0
+typedef struct fid_parse_ident_arg {
+} fid_parse_ident_arg_t;
+#else
+typedef cr_zero_size_type_t fid_parse_ident_arg_t;
 #endif
 
-  v7->pstate.source_code = v7->pstate.pc = src;
-  v7->pstate.file_name = "<stdin>";
-  v7->pstate.line_no = 1;
-  v7->pstate.in_function = 0;
-  v7->pstate.in_loop = 0;
-  v7->pstate.in_switch = 0;
+/* parse_ident's data on stack */
+#if 0
+typedef struct fid_parse_ident_locals {
+  struct fid_parse_ident_arg arg;
+} fid_parse_ident_locals_t;
+#else
+typedef cr_zero_size_type_t fid_parse_ident_locals_t;
+#endif
 
-  /*
-   * TODO(dfrank): `v7->parser.line_no` vs `v7->line_no` is confusing.  probaby
-   * we need to refactor it.
-   *
-   * See comment for v7->line_no in core.h for some details.
-   */
-  v7->line_no = 1;
+#define CALL_PARSE_IDENT(_label)      \
+  do {                                \
+    CR_CALL(fid_parse_ident, _label); \
+  } while (0)
+/* }}} */
 
-  next_tok(v7);
-  /*
-   * setup initial state for "after newline" tracking.
-   * next_tok will consume our token and position the current line
-   * position at the beginning of the next token.
-   * While processing the first token, both the leading and the
-   * trailing newlines will be counted and thus it will create a spurious
-   * "after newline" condition at the end of the first token
-   * regardless if there is actually a newline after it.
-   */
-  for (p = src; isspace((int) *p); p++) {
-    if (*p == '\n') {
-      v7->pstate.prev_line_no++;
-    }
-  }
+/* parse_ident_allow_reserved_words {{{ */
+/* parse_ident_allow_reserved_words's arguments */
+#if 0
+typedef struct fid_parse_ident_allow_reserved_words_arg {
+} fid_parse_ident_allow_reserved_words_arg_t;
+#else
+typedef cr_zero_size_type_t fid_parse_ident_allow_reserved_words_arg_t;
+#endif
 
-  /* init cr context */
-  cr_context_init(&cr_ctx, &arg_retval, sizeof(arg_retval), _fid_descrs);
+/* parse_ident_allow_reserved_words's data on stack */
+#if 0
+typedef struct fid_parse_ident_allow_reserved_words_locals {
+  struct fid_parse_ident_allow_reserved_words_arg arg;
+} fid_parse_ident_allow_reserved_words_locals_t;
+#else
+typedef cr_zero_size_type_t fid_parse_ident_allow_reserved_words_locals_t;
+#endif
 
-  /* prepare first function call: fid_mul_sum */
-  if (is_json) {
-    CR_FIRST_CALL_PREPARE_C(&cr_ctx, fid_parse_terminal);
-  } else {
-    CR_FIRST_CALL_PREPARE_C(&cr_ctx, fid_parse_script);
-  }
+#define CALL_PARSE_IDENT_ALLOW_RESERVED_WORDS(_label)      \
+  do {                                                     \
+    CR_CALL(fid_parse_ident_allow_reserved_words, _label); \
+  } while (0)
+/* }}} */
 
-  /* proceed to coroutine execution */
-  rc = parser_cr_exec(&cr_ctx, v7, a);
+/* parse_funcdecl {{{ */
+/* parse_funcdecl's arguments */
+typedef struct fid_parse_funcdecl_arg {
+  uint8_t require_named;
+  uint8_t reserved_name;
+} fid_parse_funcdecl_arg_t;
 
-  /* set `rcode` depending on coroutine state */
-  switch (rc) {
-    case CR_RES__OK:
-      rcode = V7_OK;
-      break;
-    case CR_RES__ERR_UNCAUGHT_EXCEPTION:
-      switch ((enum parser_exc_id) CR_THROWN_C(&cr_ctx)) {
-        case PARSER_EXC_ID__SYNTAX_ERROR:
-          rcode = V7_SYNTAX_ERROR;
-          error_msg = "Syntax error";
-          break;
+/* parse_funcdecl's data on stack */
+typedef struct fid_parse_funcdecl_locals {
+  struct fid_parse_funcdecl_arg arg;
 
-        default:
-          rcode = V7_INTERNAL_ERROR;
-          error_msg = "Internal error: no exception id set";
-          break;
-      }
-      break;
-    default:
-      rcode = V7_INTERNAL_ERROR;
-      error_msg = "Internal error: unexpected parser coroutine return code";
-      break;
-  }
+  ast_off_t start;
+  ast_off_t outer_last_var_node;
+  uint8_t saved_in_function;
+  uint8_t saved_in_strict;
+#ifndef V7_DISABLE_STREAMING_COMPILE
+  int line_no;
+#endif
+} fid_parse_funcdecl_locals_t;
 
-#if defined(V7_TRACK_MAX_PARSER_STACK_SIZE)
-  /* remember how much stack space was consumed */
+#define CALL_PARSE_FUNCDECL(_require_named, _reserved_name, _label) \
+  do {                                                              \
+    N.fid_parse_funcdecl.require_named = (_require_named);          \
+    N.fid_parse_funcdecl.reserved_name = (_reserved_name);          \
+    CR_CALL(fid_parse_funcdecl, _label);                            \
+  } while (0)
+/* }}} */
 
-  if (v7->parser_stack_data_max_size < cr_ctx.stack_data.size) {
-    v7->parser_stack_data_max_size = cr_ctx.stack_data.size;
-#ifndef NO_LIBC
-    printf("parser_stack_data_max_size=%u\n",
-           (unsigned int) v7->parser_stack_data_max_size);
+/* parse_arglist {{{ */
+/* parse_arglist's arguments */
+#if 0
+typedef struct fid_parse_arglist_arg {
+} fid_parse_arglist_arg_t;
+#else
+typedef cr_zero_size_type_t fid_parse_arglist_arg_t;
 #endif
-  }
 
-  if (v7->parser_stack_ret_max_size < cr_ctx.stack_ret.size) {
-    v7->parser_stack_ret_max_size = cr_ctx.stack_ret.size;
-#ifndef NO_LIBC
-    printf("parser_stack_ret_max_size=%u\n",
-           (unsigned int) v7->parser_stack_ret_max_size);
+/* parse_arglist's data on stack */
+#if 0
+typedef struct fid_parse_arglist_locals {
+  struct fid_parse_arglist_arg arg;
+} fid_parse_arglist_locals_t;
+#else
+typedef cr_zero_size_type_t fid_parse_arglist_locals_t;
 #endif
-  }
 
-#if defined(CR_TRACK_MAX_STACK_LEN)
-  if (v7->parser_stack_data_max_len < cr_ctx.stack_data_max_len) {
-    v7->parser_stack_data_max_len = cr_ctx.stack_data_max_len;
-#ifndef NO_LIBC
-    printf("parser_stack_data_max_len=%u\n",
-           (unsigned int) v7->parser_stack_data_max_len);
-#endif
-  }
+#define CALL_PARSE_ARGLIST(_label)      \
+  do {                                  \
+    CR_CALL(fid_parse_arglist, _label); \
+  } while (0)
+/* }}} */
 
-  if (v7->parser_stack_ret_max_len < cr_ctx.stack_ret_max_len) {
-    v7->parser_stack_ret_max_len = cr_ctx.stack_ret_max_len;
-#ifndef NO_LIBC
-    printf("parser_stack_ret_max_len=%u\n",
-           (unsigned int) v7->parser_stack_ret_max_len);
-#endif
-  }
+/* parse_member {{{ */
+/* parse_member's arguments */
+typedef struct fid_parse_member_arg { ast_off_t pos; } fid_parse_member_arg_t;
+
+/* parse_member's data on stack */
+typedef struct fid_parse_member_locals {
+  struct fid_parse_member_arg arg;
+} fid_parse_member_locals_t;
+
+#define CALL_PARSE_MEMBER(_pos, _label) \
+  do {                                  \
+    N.fid_parse_member.pos = (_pos);    \
+    CR_CALL(fid_parse_member, _label);  \
+  } while (0)
+/* }}} */
+
+/* parse_memberexpr {{{ */
+/* parse_memberexpr's arguments */
+#if 0
+typedef struct fid_parse_memberexpr_arg {
+} fid_parse_memberexpr_arg_t;
+#else
+typedef cr_zero_size_type_t fid_parse_memberexpr_arg_t;
 #endif
 
+/* parse_memberexpr's data on stack */
+typedef struct fid_parse_memberexpr_locals {
+#if 0
+  struct fid_parse_memberexpr_arg arg;
 #endif
 
-  /* free resources occupied by context (at least, "stack" arrays) */
-  cr_context_free(&cr_ctx);
+  ast_off_t pos;
+} fid_parse_memberexpr_locals_t;
 
-#if defined(V7_ENABLE_STACK_TRACKING)
-  {
-    int diff = v7_stack_track_end(v7, &stack_track_ctx);
-    if (diff > v7->stack_stat[V7_STACK_STAT_PARSER]) {
-      v7->stack_stat[V7_STACK_STAT_PARSER] = diff;
-    }
-  }
+#define CALL_PARSE_MEMBEREXPR(_label)      \
+  do {                                     \
+    CR_CALL(fid_parse_memberexpr, _label); \
+  } while (0)
+/* }}} */
+
+/* parse_var {{{ */
+/* parse_var's arguments */
+#if 0
+typedef struct fid_parse_var_arg {
+} fid_parse_var_arg_t;
+#else
+typedef cr_zero_size_type_t fid_parse_var_arg_t;
 #endif
 
-  /* Check if AST was overflown */
-  if (a->has_overflow) {
-    rcode = v7_throwf(v7, SYNTAX_ERROR,
-                      "Script too large (try V7_LARGE_AST build option)");
-    V7_THROW(V7_AST_TOO_LARGE);
-  }
+/* parse_var's data on stack */
+typedef struct fid_parse_var_locals {
+#if 0
+  struct fid_parse_var_arg arg;
+#endif
 
-  if (rcode == V7_OK && v7->cur_tok != TOK_END_OF_INPUT) {
-    rcode = V7_SYNTAX_ERROR;
-    error_msg = "Syntax error";
-  }
+  ast_off_t start;
+} fid_parse_var_locals_t;
 
-  if (rcode != V7_OK) {
-    unsigned long col = get_column(v7->pstate.source_code, v7->tok);
-    int line_len = 0;
+#define CALL_PARSE_VAR(_label)      \
+  do {                              \
+    CR_CALL(fid_parse_var, _label); \
+  } while (0)
+/* }}} */
 
-    assert(error_msg != NULL);
+/* parse_prop {{{ */
+/* parse_prop's arguments */
+#if 0
+typedef struct fid_parse_prop_arg {
+} fid_parse_prop_arg_t;
+#else
+typedef cr_zero_size_type_t fid_parse_prop_arg_t;
+#endif
 
-    for (p = v7->tok - col; *p != '\0' && *p != '\n'; p++) {
-      line_len++;
-    }
+/* parse_prop's data on stack */
+#if 0
+typedef struct fid_parse_prop_locals {
+  struct fid_parse_prop_arg arg;
+} fid_parse_prop_locals_t;
+#else
+typedef cr_zero_size_type_t fid_parse_prop_locals_t;
+#endif
 
-    /* fixup line number: line_no points to the beginning of the next token */
-    for (; p < v7->pstate.pc; p++) {
-      if (*p == '\n') {
-        v7->pstate.line_no--;
-      }
-    }
+#define CALL_PARSE_PROP(_label)      \
+  do {                               \
+    CR_CALL(fid_parse_prop, _label); \
+  } while (0)
+/* }}} */
 
-    /*
-     * We already have a proper `rcode`, that's why we discard returned value
-     * of `v7_throwf()`, which is always `V7_EXEC_EXCEPTION`.
-     *
-     * TODO(dfrank): probably get rid of distinct error types, and use just
-     * `V7_JS_EXCEPTION`. However it would be good to have a way to get exact
-     * error type, so probably error object should contain some property with
-     * error code, but it would make exceptions even more expensive, etc, etc.
-     */
-    {
-      enum v7_err _tmp;
-      _tmp = v7_throwf(v7, SYNTAX_ERROR, "%s at line %d col %lu:\n%.*s\n%*s^",
-                       error_msg, v7->pstate.line_no, col, line_len,
-                       v7->tok - col, (int) col - 1, "");
-      (void) _tmp;
-    }
-    V7_THROW(rcode);
-  }
+/* parse_dowhile {{{ */
+/* parse_dowhile's arguments */
+#if 0
+typedef struct fid_parse_dowhile_arg {
+} fid_parse_dowhile_arg_t;
+#else
+typedef cr_zero_size_type_t fid_parse_dowhile_arg_t;
+#endif
 
-clean:
-  v7->line_no = saved_line_no;
-  return rcode;
-}
-#ifdef V7_MODULE_LINES
-#line 1 "./src/compiler.c"
+/* parse_dowhile's data on stack */
+typedef struct fid_parse_dowhile_locals {
+#if 0
+  struct fid_parse_dowhile_arg arg;
 #endif
-/*
- * Copyright (c) 2014 Cesanta Software Limited
- * All rights reserved
- */
 
-/* Amalgamated: #include "v7/src/internal.h" */
+  ast_off_t start;
+  uint8_t saved_in_loop;
+} fid_parse_dowhile_locals_t;
+
+#define CALL_PARSE_DOWHILE(_label)      \
+  do {                                  \
+    CR_CALL(fid_parse_dowhile, _label); \
+  } while (0)
+/* }}} */
+
+/* parse_for {{{ */
+/* parse_for's arguments */
+#if 0
+typedef struct fid_parse_for_arg {
+} fid_parse_for_arg_t;
+#else
+typedef cr_zero_size_type_t fid_parse_for_arg_t;
+#endif
+
+/* parse_for's data on stack */
+typedef struct fid_parse_for_locals {
+#if 0
+  struct fid_parse_for_arg arg;
+#endif
+
+  ast_off_t start;
+  uint8_t saved_in_loop;
+} fid_parse_for_locals_t;
+
+#define CALL_PARSE_FOR(_label)      \
+  do {                              \
+    CR_CALL(fid_parse_for, _label); \
+  } while (0)
+/* }}} */
+
+/* parse_try {{{ */
+/* parse_try's arguments */
+#if 0
+typedef struct fid_parse_try_arg {
+} fid_parse_try_arg_t;
+#else
+typedef cr_zero_size_type_t fid_parse_try_arg_t;
+#endif
+
+/* parse_try's data on stack */
+typedef struct fid_parse_try_locals {
+#if 0
+  struct fid_parse_try_arg arg;
+#endif
+
+  ast_off_t start;
+  uint8_t catch_or_finally;
+} fid_parse_try_locals_t;
+
+#define CALL_PARSE_TRY(_label)      \
+  do {                              \
+    CR_CALL(fid_parse_try, _label); \
+  } while (0)
+/* }}} */
+
+/* parse_switch {{{ */
+/* parse_switch's arguments */
+#if 0
+typedef struct fid_parse_switch_arg {
+} fid_parse_switch_arg_t;
+#else
+typedef cr_zero_size_type_t fid_parse_switch_arg_t;
+#endif
+
+/* parse_switch's data on stack */
+typedef struct fid_parse_switch_locals {
+#if 0
+  struct fid_parse_switch_arg arg;
+#endif
+
+  ast_off_t start;
+  int saved_in_switch;
+  ast_off_t case_start;
+} fid_parse_switch_locals_t;
+
+#define CALL_PARSE_SWITCH(_label)      \
+  do {                                 \
+    CR_CALL(fid_parse_switch, _label); \
+  } while (0)
+/* }}} */
+
+/* parse_with {{{ */
+/* parse_with's arguments */
+#if 0
+typedef struct fid_parse_with_arg {
+} fid_parse_with_arg_t;
+#else
+typedef cr_zero_size_type_t fid_parse_with_arg_t;
+#endif
+
+/* parse_with's data on stack */
+typedef struct fid_parse_with_locals {
+#if 0
+  struct fid_parse_with_arg arg;
+#endif
+
+  ast_off_t start;
+} fid_parse_with_locals_t;
+
+#define CALL_PARSE_WITH(_label)      \
+  do {                               \
+    CR_CALL(fid_parse_with, _label); \
+  } while (0)
+/* }}} */
+
+/* }}} */
+
+/*
+ * Array of "function" descriptors. Each descriptor contains just a size
+ * of "function"'s locals.
+ */
+static const struct cr_func_desc _fid_descrs[MY_FID_CNT] = {
+
+    /* fid_none */
+    {0},
+
+    /* fid_parse_script ----------------------------------------- */
+    /* fid_parse_script */
+    {CR_LOCALS_SIZEOF(fid_parse_script_locals_t)},
+    /* fid_p_script_1 */
+    {CR_LOCALS_SIZEOF(fid_parse_script_locals_t)},
+    /* fid_p_script_2 */
+    {CR_LOCALS_SIZEOF(fid_parse_script_locals_t)},
+    /* fid_p_script_3 */
+    {CR_LOCALS_SIZEOF(fid_parse_script_locals_t)},
+    /* fid_p_script_4 */
+    {CR_LOCALS_SIZEOF(fid_parse_script_locals_t)},
+
+    /* fid_parse_use_strict ----------------------------------------- */
+    /* fid_parse_use_strict */
+    {CR_LOCALS_SIZEOF(fid_parse_use_strict_locals_t)},
+
+    /* fid_parse_body ----------------------------------------- */
+    /* fid_parse_body */
+    {CR_LOCALS_SIZEOF(fid_parse_body_locals_t)},
+    /* fid_p_body_1 */
+    {CR_LOCALS_SIZEOF(fid_parse_body_locals_t)},
+    /* fid_p_body_2 */
+    {CR_LOCALS_SIZEOF(fid_parse_body_locals_t)},
+
+    /* fid_parse_statement ----------------------------------------- */
+    /* fid_parse_statement */
+    {CR_LOCALS_SIZEOF(fid_parse_statement_locals_t)},
+    /* fid_p_stat_1 */
+    {CR_LOCALS_SIZEOF(fid_parse_statement_locals_t)},
+    /* fid_p_stat_2 */
+    {CR_LOCALS_SIZEOF(fid_parse_statement_locals_t)},
+    /* fid_p_stat_3 */
+    {CR_LOCALS_SIZEOF(fid_parse_statement_locals_t)},
+    /* fid_p_stat_4 */
+    {CR_LOCALS_SIZEOF(fid_parse_statement_locals_t)},
+    /* fid_p_stat_5 */
+    {CR_LOCALS_SIZEOF(fid_parse_statement_locals_t)},
+    /* fid_p_stat_6 */
+    {CR_LOCALS_SIZEOF(fid_parse_statement_locals_t)},
+    /* fid_p_stat_7 */
+    {CR_LOCALS_SIZEOF(fid_parse_statement_locals_t)},
+    /* fid_p_stat_8 */
+    {CR_LOCALS_SIZEOF(fid_parse_statement_locals_t)},
+    /* fid_p_stat_9 */
+    {CR_LOCALS_SIZEOF(fid_parse_statement_locals_t)},
+    /* fid_p_stat_10 */
+    {CR_LOCALS_SIZEOF(fid_parse_statement_locals_t)},
+    /* fid_p_stat_11 */
+    {CR_LOCALS_SIZEOF(fid_parse_statement_locals_t)},
+    /* fid_p_stat_12 */
+    {CR_LOCALS_SIZEOF(fid_parse_statement_locals_t)},
+    /* fid_p_stat_13 */
+    {CR_LOCALS_SIZEOF(fid_parse_statement_locals_t)},
+    /* fid_p_stat_14 */
+    {CR_LOCALS_SIZEOF(fid_parse_statement_locals_t)},
+
+    /* fid_parse_expression ----------------------------------------- */
+    /* fid_parse_expression */
+    {CR_LOCALS_SIZEOF(fid_parse_expression_locals_t)},
+    /* fid_p_expr_1 */
+    {CR_LOCALS_SIZEOF(fid_parse_expression_locals_t)},
+
+    /* fid_parse_assign ----------------------------------------- */
+    /* fid_parse_assign */
+    {CR_LOCALS_SIZEOF(fid_parse_assign_locals_t)},
+    /* fid_p_assign_1 */
+    {CR_LOCALS_SIZEOF(fid_parse_assign_locals_t)},
+
+    /* fid_parse_binary ----------------------------------------- */
+    /* fid_parse_binary */
+    {CR_LOCALS_SIZEOF(fid_parse_binary_locals_t)},
+    /* fid_p_binary_1 */
+    {CR_LOCALS_SIZEOF(fid_parse_binary_locals_t)},
+    /* fid_p_binary_2 */
+    {CR_LOCALS_SIZEOF(fid_parse_binary_locals_t)},
+    /* fid_p_binary_3 */
+    {CR_LOCALS_SIZEOF(fid_parse_binary_locals_t)},
+    /* fid_p_binary_4 */
+    {CR_LOCALS_SIZEOF(fid_parse_binary_locals_t)},
+    /* fid_p_binary_5 */
+    {CR_LOCALS_SIZEOF(fid_parse_binary_locals_t)},
+    /* fid_p_binary_6 */
+    {CR_LOCALS_SIZEOF(fid_parse_binary_locals_t)},
+
+    /* fid_parse_prefix ----------------------------------------- */
+    /* fid_parse_prefix */
+    {CR_LOCALS_SIZEOF(fid_parse_prefix_locals_t)},
+    /* fid_p_prefix_1 */
+    {CR_LOCALS_SIZEOF(fid_parse_prefix_locals_t)},
+
+    /* fid_parse_postfix ----------------------------------------- */
+    /* fid_parse_postfix */
+    {CR_LOCALS_SIZEOF(fid_parse_postfix_locals_t)},
+    /* fid_p_postfix_1 */
+    {CR_LOCALS_SIZEOF(fid_parse_postfix_locals_t)},
+
+    /* fid_parse_callexpr ----------------------------------------- */
+    /* fid_parse_callexpr */
+    {CR_LOCALS_SIZEOF(fid_parse_callexpr_locals_t)},
+    /* fid_p_callexpr_1 */
+    {CR_LOCALS_SIZEOF(fid_parse_callexpr_locals_t)},
+    /* fid_p_callexpr_2 */
+    {CR_LOCALS_SIZEOF(fid_parse_callexpr_locals_t)},
+    /* fid_p_callexpr_3 */
+    {CR_LOCALS_SIZEOF(fid_parse_callexpr_locals_t)},
+
+    /* fid_parse_newexpr ----------------------------------------- */
+    /* fid_parse_newexpr */
+    {CR_LOCALS_SIZEOF(fid_parse_newexpr_locals_t)},
+    /* fid_p_newexpr_1 */
+    {CR_LOCALS_SIZEOF(fid_parse_newexpr_locals_t)},
+    /* fid_p_newexpr_2 */
+    {CR_LOCALS_SIZEOF(fid_parse_newexpr_locals_t)},
+    /* fid_p_newexpr_3 */
+    {CR_LOCALS_SIZEOF(fid_parse_newexpr_locals_t)},
+    /* fid_p_newexpr_4 */
+    {CR_LOCALS_SIZEOF(fid_parse_newexpr_locals_t)},
+
+    /* fid_parse_terminal ----------------------------------------- */
+    /* fid_parse_terminal */
+    {CR_LOCALS_SIZEOF(fid_parse_terminal_locals_t)},
+    /* fid_p_terminal_1 */
+    {CR_LOCALS_SIZEOF(fid_parse_terminal_locals_t)},
+    /* fid_p_terminal_2 */
+    {CR_LOCALS_SIZEOF(fid_parse_terminal_locals_t)},
+    /* fid_p_terminal_3 */
+    {CR_LOCALS_SIZEOF(fid_parse_terminal_locals_t)},
+    /* fid_p_terminal_4 */
+    {CR_LOCALS_SIZEOF(fid_parse_terminal_locals_t)},
+
+    /* fid_parse_block ----------------------------------------- */
+    /* fid_parse_block */
+    {CR_LOCALS_SIZEOF(fid_parse_block_locals_t)},
+    /* fid_p_block_1 */
+    {CR_LOCALS_SIZEOF(fid_parse_block_locals_t)},
+
+    /* fid_parse_if ----------------------------------------- */
+    /* fid_parse_if */
+    {CR_LOCALS_SIZEOF(fid_parse_if_locals_t)},
+    /* fid_p_if_1 */
+    {CR_LOCALS_SIZEOF(fid_parse_if_locals_t)},
+    /* fid_p_if_2 */
+    {CR_LOCALS_SIZEOF(fid_parse_if_locals_t)},
+    /* fid_p_if_3 */
+    {CR_LOCALS_SIZEOF(fid_parse_if_locals_t)},
+
+    /* fid_parse_while ----------------------------------------- */
+    /* fid_parse_while */
+    {CR_LOCALS_SIZEOF(fid_parse_while_locals_t)},
+    /* fid_p_while_1 */
+    {CR_LOCALS_SIZEOF(fid_parse_while_locals_t)},
+    /* fid_p_while_2 */
+    {CR_LOCALS_SIZEOF(fid_parse_while_locals_t)},
+
+    /* fid_parse_ident ----------------------------------------- */
+    /* fid_parse_ident */
+    {CR_LOCALS_SIZEOF(fid_parse_ident_locals_t)},
+
+    /* fid_parse_ident_allow_reserved_words -------------------- */
+    /* fid_parse_ident_allow_reserved_words */
+    {CR_LOCALS_SIZEOF(fid_parse_ident_allow_reserved_words_locals_t)},
+    /* fid_p_ident_allow_reserved_words_1 */
+    {CR_LOCALS_SIZEOF(fid_parse_ident_allow_reserved_words_locals_t)},
+
+    /* fid_parse_funcdecl ----------------------------------------- */
+    /* fid_parse_funcdecl */
+    {CR_LOCALS_SIZEOF(fid_parse_funcdecl_locals_t)},
+    /* fid_p_funcdecl_1 */
+    {CR_LOCALS_SIZEOF(fid_parse_funcdecl_locals_t)},
+    /* fid_p_funcdecl_2 */
+    {CR_LOCALS_SIZEOF(fid_parse_funcdecl_locals_t)},
+    /* fid_p_funcdecl_3 */
+    {CR_LOCALS_SIZEOF(fid_parse_funcdecl_locals_t)},
+    /* fid_p_funcdecl_4 */
+    {CR_LOCALS_SIZEOF(fid_parse_funcdecl_locals_t)},
+    /* fid_p_funcdecl_5 */
+    {CR_LOCALS_SIZEOF(fid_parse_funcdecl_locals_t)},
+    /* fid_p_funcdecl_6 */
+    {CR_LOCALS_SIZEOF(fid_parse_funcdecl_locals_t)},
+    /* fid_p_funcdecl_7 */
+    {CR_LOCALS_SIZEOF(fid_parse_funcdecl_locals_t)},
+    /* fid_p_funcdecl_8 */
+    {CR_LOCALS_SIZEOF(fid_parse_funcdecl_locals_t)},
+    /* fid_p_funcdecl_9 */
+    {CR_LOCALS_SIZEOF(fid_parse_funcdecl_locals_t)},
+
+    /* fid_parse_arglist ----------------------------------------- */
+    /* fid_parse_arglist */
+    {CR_LOCALS_SIZEOF(fid_parse_arglist_locals_t)},
+    /* fid_p_arglist_1 */
+    {CR_LOCALS_SIZEOF(fid_parse_arglist_locals_t)},
+
+    /* fid_parse_member ----------------------------------------- */
+    /* fid_parse_member */
+    {CR_LOCALS_SIZEOF(fid_parse_member_locals_t)},
+    /* fid_p_member_1 */
+    {CR_LOCALS_SIZEOF(fid_parse_member_locals_t)},
+
+    /* fid_parse_memberexpr ----------------------------------------- */
+    /* fid_parse_memberexpr */
+    {CR_LOCALS_SIZEOF(fid_parse_memberexpr_locals_t)},
+    /* fid_p_memberexpr_1 */
+    {CR_LOCALS_SIZEOF(fid_parse_memberexpr_locals_t)},
+    /* fid_p_memberexpr_2 */
+    {CR_LOCALS_SIZEOF(fid_parse_memberexpr_locals_t)},
+
+    /* fid_parse_var ----------------------------------------- */
+    /* fid_parse_var */
+    {CR_LOCALS_SIZEOF(fid_parse_var_locals_t)},
+    /* fid_p_var_1 */
+    {CR_LOCALS_SIZEOF(fid_parse_var_locals_t)},
+
+    /* fid_parse_prop ----------------------------------------- */
+    /* fid_parse_prop */
+    {CR_LOCALS_SIZEOF(fid_parse_prop_locals_t)},
+#ifdef V7_ENABLE_JS_GETTERS
+    /* fid_p_prop_1_getter */
+    {CR_LOCALS_SIZEOF(fid_parse_prop_locals_t)},
+#endif
+    /* fid_p_prop_2 */
+    {CR_LOCALS_SIZEOF(fid_parse_prop_locals_t)},
+#ifdef V7_ENABLE_JS_SETTERS
+    /* fid_p_prop_3_setter */
+    {CR_LOCALS_SIZEOF(fid_parse_prop_locals_t)},
+#endif
+    /* fid_p_prop_4 */
+    {CR_LOCALS_SIZEOF(fid_parse_prop_locals_t)},
+
+    /* fid_parse_dowhile ----------------------------------------- */
+    /* fid_parse_dowhile */
+    {CR_LOCALS_SIZEOF(fid_parse_dowhile_locals_t)},
+    /* fid_p_dowhile_1 */
+    {CR_LOCALS_SIZEOF(fid_parse_dowhile_locals_t)},
+    /* fid_p_dowhile_2 */
+    {CR_LOCALS_SIZEOF(fid_parse_dowhile_locals_t)},
+
+    /* fid_parse_for ----------------------------------------- */
+    /* fid_parse_for */
+    {CR_LOCALS_SIZEOF(fid_parse_for_locals_t)},
+    /* fid_p_for_1 */
+    {CR_LOCALS_SIZEOF(fid_parse_for_locals_t)},
+    /* fid_p_for_2 */
+    {CR_LOCALS_SIZEOF(fid_parse_for_locals_t)},
+    /* fid_p_for_3 */
+    {CR_LOCALS_SIZEOF(fid_parse_for_locals_t)},
+    /* fid_p_for_4 */
+    {CR_LOCALS_SIZEOF(fid_parse_for_locals_t)},
+    /* fid_p_for_5 */
+    {CR_LOCALS_SIZEOF(fid_parse_for_locals_t)},
+    /* fid_p_for_6 */
+    {CR_LOCALS_SIZEOF(fid_parse_for_locals_t)},
+
+    /* fid_parse_try ----------------------------------------- */
+    /* fid_parse_try */
+    {CR_LOCALS_SIZEOF(fid_parse_try_locals_t)},
+    /* fid_p_try_1 */
+    {CR_LOCALS_SIZEOF(fid_parse_try_locals_t)},
+    /* fid_p_try_2 */
+    {CR_LOCALS_SIZEOF(fid_parse_try_locals_t)},
+    /* fid_p_try_3 */
+    {CR_LOCALS_SIZEOF(fid_parse_try_locals_t)},
+    /* fid_p_try_4 */
+    {CR_LOCALS_SIZEOF(fid_parse_try_locals_t)},
+
+    /* fid_parse_switch ----------------------------------------- */
+    /* fid_parse_switch */
+    {CR_LOCALS_SIZEOF(fid_parse_switch_locals_t)},
+    /* fid_p_switch_1 */
+    {CR_LOCALS_SIZEOF(fid_parse_switch_locals_t)},
+    /* fid_p_switch_2 */
+    {CR_LOCALS_SIZEOF(fid_parse_switch_locals_t)},
+    /* fid_p_switch_3 */
+    {CR_LOCALS_SIZEOF(fid_parse_switch_locals_t)},
+    /* fid_p_switch_4 */
+    {CR_LOCALS_SIZEOF(fid_parse_switch_locals_t)},
+
+    /* fid_parse_with ----------------------------------------- */
+    /* fid_parse_with */
+    {CR_LOCALS_SIZEOF(fid_parse_with_locals_t)},
+    /* fid_p_with_1 */
+    {CR_LOCALS_SIZEOF(fid_parse_with_locals_t)},
+    /* fid_p_with_2 */
+    {CR_LOCALS_SIZEOF(fid_parse_with_locals_t)},
+
+};
+
+/*
+ * Union of arguments and return values for all existing "functions".
+ *
+ * Used as an accumulator when we call function, return from function,
+ * yield, or resume.
+ */
+union user_arg_ret {
+  /* arguments to the next function */
+  union {
+#if 0
+    fid_parse_script_arg_t fid_parse_script;
+    fid_parse_use_strict_arg_t fid_parse_use_strict;
+    fid_parse_statement_arg_t fid_parse_statement;
+    fid_parse_expression_arg_t fid_parse_expression;
+    fid_parse_assign_arg_t fid_parse_assign;
+    fid_parse_prefix_arg_t fid_parse_prefix;
+    fid_parse_postfix_arg_t fid_parse_postfix;
+    fid_parse_callexpr_arg_t fid_parse_callexpr;
+    fid_parse_newexpr_arg_t fid_parse_newexpr;
+    fid_parse_terminal_arg_t fid_parse_terminal;
+    fid_parse_block_arg_t fid_parse_block;
+    fid_parse_if_arg_t fid_parse_if;
+    fid_parse_while_arg_t fid_parse_while;
+    fid_parse_ident_arg_t fid_parse_ident;
+    fid_parse_ident_allow_reserved_words_arg_t
+      fid_parse_ident_allow_reserved_words;
+    fid_parse_arglist_arg_t fid_parse_arglist;
+    fid_parse_memberexpr_arg_t fid_parse_memberexpr;
+    fid_parse_var_arg_t fid_parse_var;
+    fid_parse_prop_arg_t fid_parse_prop;
+    fid_parse_dowhile_arg_t fid_parse_dowhile;
+    fid_parse_for_arg_t fid_parse_for;
+    fid_parse_try_arg_t fid_parse_try;
+    fid_parse_switch_arg_t fid_parse_switch;
+    fid_parse_with_arg_t fid_parse_with;
+#endif
+    fid_parse_body_arg_t fid_parse_body;
+    fid_parse_binary_arg_t fid_parse_binary;
+    fid_parse_funcdecl_arg_t fid_parse_funcdecl;
+    fid_parse_member_arg_t fid_parse_member;
+  } arg;
+
+  /* value returned from function */
+  /*
+     union {
+     } ret;
+     */
+};
+
+static enum v7_tok next_tok(struct v7 *v7) {
+  int prev_line_no = v7->pstate.prev_line_no;
+  v7->pstate.prev_line_no = v7->pstate.line_no;
+  v7->pstate.line_no += skip_to_next_tok(&v7->pstate.pc);
+  v7->after_newline = prev_line_no != v7->pstate.line_no;
+  v7->tok = v7->pstate.pc;
+  v7->cur_tok = get_tok(&v7->pstate.pc, &v7->cur_tok_dbl, v7->cur_tok);
+  v7->tok_len = v7->pstate.pc - v7->tok;
+  v7->pstate.line_no += skip_to_next_tok(&v7->pstate.pc);
+  return v7->cur_tok;
+}
+
+#ifndef V7_DISABLE_LINE_NUMBERS
+/*
+ * Assumes `offset` points to the byte right after a tag
+ */
+static void insert_line_no_if_changed(struct v7 *v7, struct ast *a,
+                                      ast_off_t offset) {
+  if (v7->pstate.prev_line_no != v7->line_no) {
+    v7->line_no = v7->pstate.prev_line_no;
+    ast_add_line_no(a, offset - 1, v7->line_no);
+  } else {
+#if V7_AST_FORCE_LINE_NUMBERS
+    /*
+     * This mode is needed for debug only: to make sure AST consumers correctly
+     * consume all nodes with line numbers data encoded
+     */
+    ast_add_line_no(a, offset - 1, 0);
+#endif
+  }
+}
+#else
+static void insert_line_no_if_changed(struct v7 *v7, struct ast *a,
+                                      ast_off_t offset) {
+  (void) v7;
+  (void) a;
+  (void) offset;
+}
+#endif
+
+static ast_off_t insert_node(struct v7 *v7, struct ast *a, ast_off_t start,
+                             enum ast_tag tag) {
+  ast_off_t ret = ast_insert_node(a, start, tag);
+  insert_line_no_if_changed(v7, a, ret);
+  return ret;
+}
+
+static ast_off_t add_node(struct v7 *v7, struct ast *a, enum ast_tag tag) {
+  return insert_node(v7, a, a->mbuf.len, tag);
+}
+
+static ast_off_t insert_inlined_node(struct v7 *v7, struct ast *a,
+                                     ast_off_t start, enum ast_tag tag,
+                                     const char *name, size_t len) {
+  ast_off_t ret = ast_insert_inlined_node(a, start, tag, name, len);
+  insert_line_no_if_changed(v7, a, ret);
+  return ret;
+}
+
+static ast_off_t add_inlined_node(struct v7 *v7, struct ast *a,
+                                  enum ast_tag tag, const char *name,
+                                  size_t len) {
+  return insert_inlined_node(v7, a, a->mbuf.len, tag, name, len);
+}
+
+static unsigned long get_column(const char *code, const char *pos) {
+  const char *p = pos;
+  while (p > code && *p != '\n') {
+    p--;
+  }
+  return p == code ? pos - p : pos - (p + 1);
+}
+
+static enum v7_err end_of_statement(struct v7 *v7) {
+  if (v7->cur_tok == TOK_SEMICOLON || v7->cur_tok == TOK_END_OF_INPUT ||
+      v7->cur_tok == TOK_CLOSE_CURLY || v7->after_newline) {
+    return V7_OK;
+  }
+  return V7_SYNTAX_ERROR;
+}
+
+static enum v7_tok lookahead(const struct v7 *v7) {
+  const char *s = v7->pstate.pc;
+  double d;
+  return get_tok(&s, &d, v7->cur_tok);
+}
+
+static int parse_optional(struct v7 *v7, struct ast *a,
+                          enum v7_tok terminator) {
+  if (v7->cur_tok != terminator) {
+    return 1;
+  }
+  add_node(v7, a, AST_NOP);
+  return 0;
+}
+
+/*
+ * On ESP8266 'levels' declaration have to be outside of 'parse_binary'
+ * in order to prevent reboot on return from this function
+ * TODO(alashkin): understand why
+ */
+#define NONE \
+  { (enum v7_tok) 0, (enum v7_tok) 0, (enum ast_tag) 0 }
+
+static const struct {
+  int len, left_to_right;
+  struct {
+    enum v7_tok start_tok, end_tok;
+    enum ast_tag start_ast;
+  } parts[2];
+} levels[] = {
+    {1, 0, {{TOK_ASSIGN, TOK_URSHIFT_ASSIGN, AST_ASSIGN}, NONE}},
+    {1, 0, {{TOK_QUESTION, TOK_QUESTION, AST_COND}, NONE}},
+    {1, 1, {{TOK_LOGICAL_OR, TOK_LOGICAL_OR, AST_LOGICAL_OR}, NONE}},
+    {1, 1, {{TOK_LOGICAL_AND, TOK_LOGICAL_AND, AST_LOGICAL_AND}, NONE}},
+    {1, 1, {{TOK_OR, TOK_OR, AST_OR}, NONE}},
+    {1, 1, {{TOK_XOR, TOK_XOR, AST_XOR}, NONE}},
+    {1, 1, {{TOK_AND, TOK_AND, AST_AND}, NONE}},
+    {1, 1, {{TOK_EQ, TOK_NE_NE, AST_EQ}, NONE}},
+    {2, 1, {{TOK_LE, TOK_GT, AST_LE}, {TOK_IN, TOK_INSTANCEOF, AST_IN}}},
+    {1, 1, {{TOK_LSHIFT, TOK_URSHIFT, AST_LSHIFT}, NONE}},
+    {1, 1, {{TOK_PLUS, TOK_MINUS, AST_ADD}, NONE}},
+    {1, 1, {{TOK_REM, TOK_DIV, AST_REM}, NONE}}};
+
+enum cr_status parser_cr_exec(struct cr_ctx *p_ctx, struct v7 *v7,
+                              struct ast *a) {
+  enum cr_status rc = CR_RES__OK;
+
+_cr_iter_begin:
+
+  rc = cr_on_iter_begin(p_ctx);
+  if (rc != CR_RES__OK) {
+    return rc;
+  }
+
+  /*
+   * dispatcher switch: depending on the fid, jump to the corresponding label
+   */
+  switch ((enum my_fid) CR_CURR_FUNC()) {
+    CR_DEFINE_ENTRY_POINT(fid_none);
+
+    CR_DEFINE_ENTRY_POINT(fid_parse_script);
+    CR_DEFINE_ENTRY_POINT(fid_p_script_1);
+    CR_DEFINE_ENTRY_POINT(fid_p_script_2);
+    CR_DEFINE_ENTRY_POINT(fid_p_script_3);
+    CR_DEFINE_ENTRY_POINT(fid_p_script_4);
+
+    CR_DEFINE_ENTRY_POINT(fid_parse_use_strict);
+
+    CR_DEFINE_ENTRY_POINT(fid_parse_body);
+    CR_DEFINE_ENTRY_POINT(fid_p_body_1);
+    CR_DEFINE_ENTRY_POINT(fid_p_body_2);
+
+    CR_DEFINE_ENTRY_POINT(fid_parse_statement);
+    CR_DEFINE_ENTRY_POINT(fid_p_stat_1);
+    CR_DEFINE_ENTRY_POINT(fid_p_stat_2);
+    CR_DEFINE_ENTRY_POINT(fid_p_stat_3);
+    CR_DEFINE_ENTRY_POINT(fid_p_stat_4);
+    CR_DEFINE_ENTRY_POINT(fid_p_stat_5);
+    CR_DEFINE_ENTRY_POINT(fid_p_stat_6);
+    CR_DEFINE_ENTRY_POINT(fid_p_stat_7);
+    CR_DEFINE_ENTRY_POINT(fid_p_stat_8);
+    CR_DEFINE_ENTRY_POINT(fid_p_stat_9);
+    CR_DEFINE_ENTRY_POINT(fid_p_stat_10);
+    CR_DEFINE_ENTRY_POINT(fid_p_stat_11);
+    CR_DEFINE_ENTRY_POINT(fid_p_stat_12);
+    CR_DEFINE_ENTRY_POINT(fid_p_stat_13);
+    CR_DEFINE_ENTRY_POINT(fid_p_stat_14);
+
+    CR_DEFINE_ENTRY_POINT(fid_parse_expression);
+    CR_DEFINE_ENTRY_POINT(fid_p_expr_1);
+
+    CR_DEFINE_ENTRY_POINT(fid_parse_assign);
+    CR_DEFINE_ENTRY_POINT(fid_p_assign_1);
+
+    CR_DEFINE_ENTRY_POINT(fid_parse_binary);
+    CR_DEFINE_ENTRY_POINT(fid_p_binary_2);
+    CR_DEFINE_ENTRY_POINT(fid_p_binary_3);
+    CR_DEFINE_ENTRY_POINT(fid_p_binary_4);
+    CR_DEFINE_ENTRY_POINT(fid_p_binary_5);
+    CR_DEFINE_ENTRY_POINT(fid_p_binary_6);
+
+    CR_DEFINE_ENTRY_POINT(fid_parse_prefix);
+    CR_DEFINE_ENTRY_POINT(fid_p_prefix_1);
+
+    CR_DEFINE_ENTRY_POINT(fid_parse_postfix);
+    CR_DEFINE_ENTRY_POINT(fid_p_postfix_1);
+
+    CR_DEFINE_ENTRY_POINT(fid_parse_callexpr);
+    CR_DEFINE_ENTRY_POINT(fid_p_callexpr_1);
+    CR_DEFINE_ENTRY_POINT(fid_p_callexpr_2);
+    CR_DEFINE_ENTRY_POINT(fid_p_callexpr_3);
+
+    CR_DEFINE_ENTRY_POINT(fid_parse_newexpr);
+    CR_DEFINE_ENTRY_POINT(fid_p_newexpr_1);
+    CR_DEFINE_ENTRY_POINT(fid_p_newexpr_2);
+    CR_DEFINE_ENTRY_POINT(fid_p_newexpr_3);
+    CR_DEFINE_ENTRY_POINT(fid_p_newexpr_4);
+
+    CR_DEFINE_ENTRY_POINT(fid_parse_terminal);
+    CR_DEFINE_ENTRY_POINT(fid_p_terminal_1);
+    CR_DEFINE_ENTRY_POINT(fid_p_terminal_2);
+    CR_DEFINE_ENTRY_POINT(fid_p_terminal_3);
+    CR_DEFINE_ENTRY_POINT(fid_p_terminal_4);
+
+    CR_DEFINE_ENTRY_POINT(fid_parse_block);
+    CR_DEFINE_ENTRY_POINT(fid_p_block_1);
+
+    CR_DEFINE_ENTRY_POINT(fid_parse_if);
+    CR_DEFINE_ENTRY_POINT(fid_p_if_1);
+    CR_DEFINE_ENTRY_POINT(fid_p_if_2);
+    CR_DEFINE_ENTRY_POINT(fid_p_if_3);
+
+    CR_DEFINE_ENTRY_POINT(fid_parse_while);
+    CR_DEFINE_ENTRY_POINT(fid_p_while_1);
+    CR_DEFINE_ENTRY_POINT(fid_p_while_2);
+
+    CR_DEFINE_ENTRY_POINT(fid_parse_ident);
+
+    CR_DEFINE_ENTRY_POINT(fid_parse_ident_allow_reserved_words);
+    CR_DEFINE_ENTRY_POINT(fid_p_ident_arw_1);
+
+    CR_DEFINE_ENTRY_POINT(fid_parse_funcdecl);
+    CR_DEFINE_ENTRY_POINT(fid_p_funcdecl_1);
+    CR_DEFINE_ENTRY_POINT(fid_p_funcdecl_2);
+    CR_DEFINE_ENTRY_POINT(fid_p_funcdecl_3);
+    CR_DEFINE_ENTRY_POINT(fid_p_funcdecl_4);
+    CR_DEFINE_ENTRY_POINT(fid_p_funcdecl_5);
+    CR_DEFINE_ENTRY_POINT(fid_p_funcdecl_6);
+    CR_DEFINE_ENTRY_POINT(fid_p_funcdecl_7);
+    CR_DEFINE_ENTRY_POINT(fid_p_funcdecl_8);
+    CR_DEFINE_ENTRY_POINT(fid_p_funcdecl_9);
+
+    CR_DEFINE_ENTRY_POINT(fid_parse_arglist);
+    CR_DEFINE_ENTRY_POINT(fid_p_arglist_1);
+
+    CR_DEFINE_ENTRY_POINT(fid_parse_member);
+    CR_DEFINE_ENTRY_POINT(fid_p_member_1);
+
+    CR_DEFINE_ENTRY_POINT(fid_parse_memberexpr);
+    CR_DEFINE_ENTRY_POINT(fid_p_memberexpr_1);
+    CR_DEFINE_ENTRY_POINT(fid_p_memberexpr_2);
+
+    CR_DEFINE_ENTRY_POINT(fid_parse_var);
+    CR_DEFINE_ENTRY_POINT(fid_p_var_1);
+
+    CR_DEFINE_ENTRY_POINT(fid_parse_prop);
+#ifdef V7_ENABLE_JS_GETTERS
+    CR_DEFINE_ENTRY_POINT(fid_p_prop_1_getter);
+#endif
+    CR_DEFINE_ENTRY_POINT(fid_p_prop_2);
+#ifdef V7_ENABLE_JS_SETTERS
+    CR_DEFINE_ENTRY_POINT(fid_p_prop_3_setter);
+#endif
+    CR_DEFINE_ENTRY_POINT(fid_p_prop_4);
+
+    CR_DEFINE_ENTRY_POINT(fid_parse_dowhile);
+    CR_DEFINE_ENTRY_POINT(fid_p_dowhile_1);
+    CR_DEFINE_ENTRY_POINT(fid_p_dowhile_2);
+
+    CR_DEFINE_ENTRY_POINT(fid_parse_for);
+    CR_DEFINE_ENTRY_POINT(fid_p_for_1);
+    CR_DEFINE_ENTRY_POINT(fid_p_for_2);
+    CR_DEFINE_ENTRY_POINT(fid_p_for_3);
+    CR_DEFINE_ENTRY_POINT(fid_p_for_4);
+    CR_DEFINE_ENTRY_POINT(fid_p_for_5);
+    CR_DEFINE_ENTRY_POINT(fid_p_for_6);
+
+    CR_DEFINE_ENTRY_POINT(fid_parse_try);
+    CR_DEFINE_ENTRY_POINT(fid_p_try_1);
+    CR_DEFINE_ENTRY_POINT(fid_p_try_2);
+    CR_DEFINE_ENTRY_POINT(fid_p_try_3);
+    CR_DEFINE_ENTRY_POINT(fid_p_try_4);
+
+    CR_DEFINE_ENTRY_POINT(fid_parse_switch);
+    CR_DEFINE_ENTRY_POINT(fid_p_switch_1);
+    CR_DEFINE_ENTRY_POINT(fid_p_switch_2);
+    CR_DEFINE_ENTRY_POINT(fid_p_switch_3);
+    CR_DEFINE_ENTRY_POINT(fid_p_switch_4);
+
+    CR_DEFINE_ENTRY_POINT(fid_parse_with);
+    CR_DEFINE_ENTRY_POINT(fid_p_with_1);
+    CR_DEFINE_ENTRY_POINT(fid_p_with_2);
+
+    default:
+      /* should never be here */
+      printf("fatal: wrong func id: %d", CR_CURR_FUNC());
+      break;
+  };
+
+/* static enum v7_err parse_script(struct v7 *v7, struct ast *a) */
+fid_parse_script :
+#undef L
+#define L CR_CUR_LOCALS_PT(fid_parse_script_locals_t)
+{
+  L->start = add_node(v7, a, AST_SCRIPT);
+  L->outer_last_var_node = v7->last_var_node;
+  L->saved_in_strict = v7->pstate.in_strict;
+
+  v7->last_var_node = L->start;
+  ast_modify_skip(a, L->start, L->start, AST_FUNC_FIRST_VAR_SKIP);
+
+  CR_TRY(fid_p_script_1);
+  {
+    CALL_PARSE_USE_STRICT(fid_p_script_3);
+    v7->pstate.in_strict = 1;
+  }
+  CR_CATCH(PARSER_EXC_ID__SYNTAX_ERROR, fid_p_script_1, fid_p_script_2);
+  CR_ENDCATCH(fid_p_script_2);
+
+  CALL_PARSE_BODY(TOK_END_OF_INPUT, fid_p_script_4);
+  ast_set_skip(a, L->start, AST_END_SKIP);
+  v7->pstate.in_strict = L->saved_in_strict;
+  v7->last_var_node = L->outer_last_var_node;
+
+  CR_RETURN_VOID();
+}
+
+/* static enum v7_err parse_use_strict(struct v7 *v7, struct ast *a) */
+fid_parse_use_strict :
+#undef L
+#define L CR_CUR_LOCALS_PT(fid_parse_use_strict_locals_t)
+{
+  if (v7->cur_tok == TOK_STRING_LITERAL &&
+      (strncmp(v7->tok, "\"use strict\"", v7->tok_len) == 0 ||
+       strncmp(v7->tok, "'use strict'", v7->tok_len) == 0)) {
+    next_tok(v7);
+    add_node(v7, a, AST_USE_STRICT);
+    CR_RETURN_VOID();
+  } else {
+    CR_THROW(PARSER_EXC_ID__SYNTAX_ERROR);
+  }
+}
+
+/*
+ * static enum v7_err parse_body(struct v7 *v7, struct ast *a,
+ *                               enum v7_tok end)
+ */
+fid_parse_body :
+#undef L
+#define L CR_CUR_LOCALS_PT(fid_parse_body_locals_t)
+{
+  while (v7->cur_tok != L->arg.end) {
+    if (ACCEPT(TOK_FUNCTION)) {
+      if (v7->cur_tok != TOK_IDENTIFIER) {
+        CR_THROW(PARSER_EXC_ID__SYNTAX_ERROR);
+      }
+      L->start = add_node(v7, a, AST_VAR);
+      ast_modify_skip(a, v7->last_var_node, L->start, AST_FUNC_FIRST_VAR_SKIP);
+      /* zero out var node pointer */
+      ast_modify_skip(a, L->start, L->start, AST_FUNC_FIRST_VAR_SKIP);
+      v7->last_var_node = L->start;
+      add_inlined_node(v7, a, AST_FUNC_DECL, v7->tok, v7->tok_len);
+
+      CALL_PARSE_FUNCDECL(1, 0, fid_p_body_1);
+      ast_set_skip(a, L->start, AST_END_SKIP);
+    } else {
+      CALL_PARSE_STATEMENT(fid_p_body_2);
+    }
+  }
+  CR_RETURN_VOID();
+}
+
+/* static enum v7_err parse_statement(struct v7 *v7, struct ast *a) */
+fid_parse_statement :
+#undef L
+#define L CR_CUR_LOCALS_PT(fid_parse_statement_locals_t)
+{
+  switch (v7->cur_tok) {
+    case TOK_SEMICOLON:
+      next_tok(v7);
+      /* empty statement */
+      CR_RETURN_VOID();
+    case TOK_OPEN_CURLY: /* block */
+      CALL_PARSE_BLOCK(fid_p_stat_3);
+      /* returning because no semicolon required */
+      CR_RETURN_VOID();
+    case TOK_IF:
+      next_tok(v7);
+      CALL_PARSE_IF(fid_p_stat_4);
+      CR_RETURN_VOID();
+    case TOK_WHILE:
+      next_tok(v7);
+      CALL_PARSE_WHILE(fid_p_stat_5);
+      CR_RETURN_VOID();
+    case TOK_DO:
+      next_tok(v7);
+      CALL_PARSE_DOWHILE(fid_p_stat_10);
+      CR_RETURN_VOID();
+    case TOK_FOR:
+      next_tok(v7);
+      CALL_PARSE_FOR(fid_p_stat_11);
+      CR_RETURN_VOID();
+    case TOK_TRY:
+      next_tok(v7);
+      CALL_PARSE_TRY(fid_p_stat_12);
+      CR_RETURN_VOID();
+    case TOK_SWITCH:
+      next_tok(v7);
+      CALL_PARSE_SWITCH(fid_p_stat_13);
+      CR_RETURN_VOID();
+    case TOK_WITH:
+      next_tok(v7);
+      CALL_PARSE_WITH(fid_p_stat_14);
+      CR_RETURN_VOID();
+    case TOK_BREAK:
+      if (!(v7->pstate.in_loop || v7->pstate.in_switch)) {
+        CR_THROW(PARSER_EXC_ID__SYNTAX_ERROR);
+      }
+      next_tok(v7);
+      PARSE_WITH_OPT_ARG(AST_BREAK, AST_LABELED_BREAK, CALL_PARSE_IDENT,
+                         fid_p_stat_7);
+      break;
+    case TOK_CONTINUE:
+      if (!v7->pstate.in_loop) {
+        CR_THROW(PARSER_EXC_ID__SYNTAX_ERROR);
+      }
+      next_tok(v7);
+      PARSE_WITH_OPT_ARG(AST_CONTINUE, AST_LABELED_CONTINUE, CALL_PARSE_IDENT,
+                         fid_p_stat_8);
+      break;
+    case TOK_RETURN:
+      if (!v7->pstate.in_function) {
+        CR_THROW(PARSER_EXC_ID__SYNTAX_ERROR);
+      }
+      next_tok(v7);
+      PARSE_WITH_OPT_ARG(AST_RETURN, AST_VALUE_RETURN, CALL_PARSE_EXPRESSION,
+                         fid_p_stat_6);
+      break;
+    case TOK_THROW:
+      next_tok(v7);
+      add_node(v7, a, AST_THROW);
+      CALL_PARSE_EXPRESSION(fid_p_stat_2);
+      break;
+    case TOK_DEBUGGER:
+      next_tok(v7);
+      add_node(v7, a, AST_DEBUGGER);
+      break;
+    case TOK_VAR:
+      next_tok(v7);
+      CALL_PARSE_VAR(fid_p_stat_9);
+      break;
+    case TOK_IDENTIFIER:
+      if (lookahead(v7) == TOK_COLON) {
+        add_inlined_node(v7, a, AST_LABEL, v7->tok, v7->tok_len);
+        next_tok(v7);
+        EXPECT(TOK_COLON);
+        CR_RETURN_VOID();
+      }
+    /* fall through */
+    default:
+      CALL_PARSE_EXPRESSION(fid_p_stat_1);
+      break;
+  }
+
+  if (end_of_statement(v7) != V7_OK) {
+    CR_THROW(PARSER_EXC_ID__SYNTAX_ERROR);
+  }
+  ACCEPT(TOK_SEMICOLON); /* swallow optional semicolon */
+  CR_RETURN_VOID();
+}
+
+/* static enum v7_err parse_expression(struct v7 *v7, struct ast *a) */
+fid_parse_expression :
+#undef L
+#define L CR_CUR_LOCALS_PT(fid_parse_expression_locals_t)
+{
+  L->pos = a->mbuf.len;
+  L->group = 0;
+  while (1) {
+    CALL_PARSE_ASSIGN(fid_p_expr_1);
+    if (ACCEPT(TOK_COMMA)) {
+      L->group = 1;
+    } else {
+      break;
+    }
+  }
+  if (L->group) {
+    insert_node(v7, a, L->pos, AST_SEQ);
+  }
+  CR_RETURN_VOID();
+}
+
+/* static enum v7_err parse_assign(struct v7 *v7, struct ast *a) */
+fid_parse_assign :
+#undef L
+#define L CR_CUR_LOCALS_PT(fid_parse_assign_locals_t)
+{
+  CALL_PARSE_BINARY(0, a->mbuf.len, fid_p_assign_1);
+  CR_RETURN_VOID();
+}
+
+/*
+ * static enum v7_err parse_binary(struct v7 *v7, struct ast *a, int level,
+ *                                 ast_off_t pos)
+ */
+#if 1
+fid_parse_binary :
+#undef L
+#define L CR_CUR_LOCALS_PT(fid_parse_binary_locals_t)
+{
+/*
+ * Note: we use macro CUR_POS instead of a local variable, since this
+ * function is called really a lot, so, each byte on stack frame counts.
+ *
+ * It will work a bit slower of course, but slowness is not a problem
+ */
+#define CUR_POS ((L->level > L->arg.min_level) ? L->saved_mbuf_len : L->arg.pos)
+  L->saved_mbuf_len = a->mbuf.len;
+
+  CALL_PARSE_PREFIX(fid_p_binary_6);
+
+  for (L->level = (int) ARRAY_SIZE(levels) - 1; L->level >= L->arg.min_level;
+       L->level--) {
+    for (L->i = 0; L->i < levels[L->level].len; L->i++) {
+      L->tok = levels[L->level].parts[L->i].start_tok;
+      L->ast = levels[L->level].parts[L->i].start_ast;
+      do {
+        if (v7->pstate.inhibit_in && L->tok == TOK_IN) {
+          continue;
+        }
+
+        /*
+         * Ternary operator sits in the middle of the binary operator
+         * precedence chain. Deal with it as an exception and don't break
+         * the chain.
+         */
+        if (L->tok == TOK_QUESTION && v7->cur_tok == TOK_QUESTION) {
+          next_tok(v7);
+          CALL_PARSE_ASSIGN(fid_p_binary_2);
+          EXPECT(TOK_COLON);
+          CALL_PARSE_ASSIGN(fid_p_binary_3);
+          insert_node(v7, a, CUR_POS, AST_COND);
+          CR_RETURN_VOID();
+        } else if (ACCEPT(L->tok)) {
+          if (levels[L->level].left_to_right) {
+            insert_node(v7, a, CUR_POS, (enum ast_tag) L->ast);
+            CALL_PARSE_BINARY(L->level, CUR_POS, fid_p_binary_4);
+          } else {
+            CALL_PARSE_BINARY(L->level, a->mbuf.len, fid_p_binary_5);
+            insert_node(v7, a, CUR_POS, (enum ast_tag) L->ast);
+          }
+        }
+      } while (L->ast = (enum ast_tag)(L->ast + 1),
+               L->tok < levels[L->level].parts[L->i].end_tok &&
+                   (L->tok = (enum v7_tok)(L->tok + 1)));
+    }
+  }
+
+  CR_RETURN_VOID();
+#undef CUR_POS
+}
+#endif
+
+/* enum v7_err parse_prefix(struct v7 *v7, struct ast *a) */
+fid_parse_prefix :
+#undef L
+#define L CR_CUR_LOCALS_PT(fid_parse_prefix_locals_t)
+{
+  for (;;) {
+    switch (v7->cur_tok) {
+      case TOK_PLUS:
+        next_tok(v7);
+        add_node(v7, a, AST_POSITIVE);
+        break;
+      case TOK_MINUS:
+        next_tok(v7);
+        add_node(v7, a, AST_NEGATIVE);
+        break;
+      case TOK_PLUS_PLUS:
+        next_tok(v7);
+        add_node(v7, a, AST_PREINC);
+        break;
+      case TOK_MINUS_MINUS:
+        next_tok(v7);
+        add_node(v7, a, AST_PREDEC);
+        break;
+      case TOK_TILDA:
+        next_tok(v7);
+        add_node(v7, a, AST_NOT);
+        break;
+      case TOK_NOT:
+        next_tok(v7);
+        add_node(v7, a, AST_LOGICAL_NOT);
+        break;
+      case TOK_VOID:
+        next_tok(v7);
+        add_node(v7, a, AST_VOID);
+        break;
+      case TOK_DELETE:
+        next_tok(v7);
+        add_node(v7, a, AST_DELETE);
+        break;
+      case TOK_TYPEOF:
+        next_tok(v7);
+        add_node(v7, a, AST_TYPEOF);
+        break;
+      default:
+        CALL_PARSE_POSTFIX(fid_p_prefix_1);
+        CR_RETURN_VOID();
+    }
+  }
+}
+
+/* static enum v7_err parse_postfix(struct v7 *v7, struct ast *a) */
+fid_parse_postfix :
+#undef L
+#define L CR_CUR_LOCALS_PT(fid_parse_postfix_locals_t)
+{
+  L->pos = a->mbuf.len;
+  CALL_PARSE_CALLEXPR(fid_p_postfix_1);
+
+  if (v7->after_newline) {
+    CR_RETURN_VOID();
+  }
+  switch (v7->cur_tok) {
+    case TOK_PLUS_PLUS:
+      next_tok(v7);
+      insert_node(v7, a, L->pos, AST_POSTINC);
+      break;
+    case TOK_MINUS_MINUS:
+      next_tok(v7);
+      insert_node(v7, a, L->pos, AST_POSTDEC);
+      break;
+    default:
+      break; /* nothing */
+  }
+  CR_RETURN_VOID();
+}
+
+/* static enum v7_err parse_callexpr(struct v7 *v7, struct ast *a) */
+fid_parse_callexpr :
+#undef L
+#define L CR_CUR_LOCALS_PT(fid_parse_callexpr_locals_t)
+{
+  L->pos = a->mbuf.len;
+  CALL_PARSE_NEWEXPR(fid_p_callexpr_1);
+
+  for (;;) {
+    switch (v7->cur_tok) {
+      case TOK_DOT:
+      case TOK_OPEN_BRACKET:
+        CALL_PARSE_MEMBER(L->pos, fid_p_callexpr_3);
+        break;
+      case TOK_OPEN_PAREN:
+        next_tok(v7);
+        CALL_PARSE_ARGLIST(fid_p_callexpr_2);
+        EXPECT(TOK_CLOSE_PAREN);
+        insert_node(v7, a, L->pos, AST_CALL);
+        break;
+      default:
+        CR_RETURN_VOID();
+    }
+  }
+}
+
+/* static enum v7_err parse_newexpr(struct v7 *v7, struct ast *a) */
+fid_parse_newexpr :
+#undef L
+#define L CR_CUR_LOCALS_PT(fid_parse_newexpr_locals_t)
+{
+  switch (v7->cur_tok) {
+    case TOK_NEW:
+      next_tok(v7);
+      L->start = add_node(v7, a, AST_NEW);
+      CALL_PARSE_MEMBEREXPR(fid_p_newexpr_3);
+      if (ACCEPT(TOK_OPEN_PAREN)) {
+        CALL_PARSE_ARGLIST(fid_p_newexpr_4);
+        EXPECT(TOK_CLOSE_PAREN);
+      }
+      ast_set_skip(a, L->start, AST_END_SKIP);
+      break;
+    case TOK_FUNCTION:
+      next_tok(v7);
+      CALL_PARSE_FUNCDECL(0, 0, fid_p_newexpr_2);
+      break;
+    default:
+      CALL_PARSE_TERMINAL(fid_p_newexpr_1);
+      break;
+  }
+  CR_RETURN_VOID();
+}
+
+/* static enum v7_err parse_terminal(struct v7 *v7, struct ast *a) */
+fid_parse_terminal :
+#undef L
+#define L CR_CUR_LOCALS_PT(fid_parse_terminal_locals_t)
+{
+  switch (v7->cur_tok) {
+    case TOK_OPEN_PAREN:
+      next_tok(v7);
+      CALL_PARSE_EXPRESSION(fid_p_terminal_1);
+      EXPECT(TOK_CLOSE_PAREN);
+      break;
+    case TOK_OPEN_BRACKET:
+      next_tok(v7);
+      L->start = add_node(v7, a, AST_ARRAY);
+      while (v7->cur_tok != TOK_CLOSE_BRACKET) {
+        if (v7->cur_tok == TOK_COMMA) {
+          /* Array literals allow missing elements, e.g. [,,1,] */
+          add_node(v7, a, AST_NOP);
+        } else {
+          CALL_PARSE_ASSIGN(fid_p_terminal_2);
+        }
+        ACCEPT(TOK_COMMA);
+      }
+      EXPECT(TOK_CLOSE_BRACKET);
+      ast_set_skip(a, L->start, AST_END_SKIP);
+      break;
+    case TOK_OPEN_CURLY:
+      next_tok(v7);
+      L->start = add_node(v7, a, AST_OBJECT);
+      if (v7->cur_tok != TOK_CLOSE_CURLY) {
+        do {
+          if (v7->cur_tok == TOK_CLOSE_CURLY) {
+            break;
+          }
+          CALL_PARSE_PROP(fid_p_terminal_3);
+        } while (ACCEPT(TOK_COMMA));
+      }
+      EXPECT(TOK_CLOSE_CURLY);
+      ast_set_skip(a, L->start, AST_END_SKIP);
+      break;
+    case TOK_THIS:
+      next_tok(v7);
+      add_node(v7, a, AST_THIS);
+      break;
+    case TOK_TRUE:
+      next_tok(v7);
+      add_node(v7, a, AST_TRUE);
+      break;
+    case TOK_FALSE:
+      next_tok(v7);
+      add_node(v7, a, AST_FALSE);
+      break;
+    case TOK_NULL:
+      next_tok(v7);
+      add_node(v7, a, AST_NULL);
+      break;
+    case TOK_STRING_LITERAL:
+      add_inlined_node(v7, a, AST_STRING, v7->tok + 1, v7->tok_len - 2);
+      next_tok(v7);
+      break;
+    case TOK_NUMBER:
+      add_inlined_node(v7, a, AST_NUM, v7->tok, v7->tok_len);
+      next_tok(v7);
+      break;
+    case TOK_REGEX_LITERAL:
+      add_inlined_node(v7, a, AST_REGEX, v7->tok, v7->tok_len);
+      next_tok(v7);
+      break;
+    case TOK_IDENTIFIER:
+      if (v7->tok_len == 9 && strncmp(v7->tok, "undefined", v7->tok_len) == 0) {
+        add_node(v7, a, AST_UNDEFINED);
+        next_tok(v7);
+        break;
+      }
+    /* fall through */
+    default:
+      CALL_PARSE_IDENT(fid_p_terminal_4);
+  }
+  CR_RETURN_VOID();
+}
+
+/* static enum v7_err parse_block(struct v7 *v7, struct ast *a) */
+fid_parse_block :
+#undef L
+#define L CR_CUR_LOCALS_PT(fid_parse_block_locals_t)
+{
+  EXPECT(TOK_OPEN_CURLY);
+  CALL_PARSE_BODY(TOK_CLOSE_CURLY, fid_p_block_1);
+  EXPECT(TOK_CLOSE_CURLY);
+  CR_RETURN_VOID();
+}
+
+/* static enum v7_err parse_if(struct v7 *v7, struct ast *a) */
+fid_parse_if :
+#undef L
+#define L CR_CUR_LOCALS_PT(fid_parse_if_locals_t)
+{
+  L->start = add_node(v7, a, AST_IF);
+  EXPECT(TOK_OPEN_PAREN);
+  CALL_PARSE_EXPRESSION(fid_p_if_1);
+  EXPECT(TOK_CLOSE_PAREN);
+  CALL_PARSE_STATEMENT(fid_p_if_2);
+  ast_set_skip(a, L->start, AST_END_IF_TRUE_SKIP);
+  if (ACCEPT(TOK_ELSE)) {
+    CALL_PARSE_STATEMENT(fid_p_if_3);
+  }
+  ast_set_skip(a, L->start, AST_END_SKIP);
+  CR_RETURN_VOID();
+}
+
+/* static enum v7_err parse_while(struct v7 *v7, struct ast *a) */
+fid_parse_while :
+#undef L
+#define L CR_CUR_LOCALS_PT(fid_parse_while_locals_t)
+{
+  L->start = add_node(v7, a, AST_WHILE);
+  L->saved_in_loop = v7->pstate.in_loop;
+  EXPECT(TOK_OPEN_PAREN);
+  CALL_PARSE_EXPRESSION(fid_p_while_1);
+  EXPECT(TOK_CLOSE_PAREN);
+  v7->pstate.in_loop = 1;
+  CALL_PARSE_STATEMENT(fid_p_while_2);
+  ast_set_skip(a, L->start, AST_END_SKIP);
+  v7->pstate.in_loop = L->saved_in_loop;
+  CR_RETURN_VOID();
+}
+
+/* static enum v7_err parse_ident(struct v7 *v7, struct ast *a) */
+fid_parse_ident :
+#undef L
+#define L CR_CUR_LOCALS_PT(fid_parse_ident_locals_t)
+{
+  if (v7->cur_tok == TOK_IDENTIFIER) {
+    add_inlined_node(v7, a, AST_IDENT, v7->tok, v7->tok_len);
+    next_tok(v7);
+    CR_RETURN_VOID();
+  }
+  CR_THROW(PARSER_EXC_ID__SYNTAX_ERROR);
+}
+
+/*
+ * static enum v7_err parse_ident_allow_reserved_words(struct v7 *v7,
+ *                                                     struct ast *a)
+ *
+ */
+fid_parse_ident_allow_reserved_words :
+#undef L
+#define L CR_CUR_LOCALS_PT(fid_parse_ident_allow_reserved_words_locals_t)
+{
+  /* Allow reserved words as property names. */
+  if (is_reserved_word_token(v7->cur_tok)) {
+    add_inlined_node(v7, a, AST_IDENT, v7->tok, v7->tok_len);
+    next_tok(v7);
+  } else {
+    CALL_PARSE_IDENT(fid_p_ident_arw_1);
+  }
+  CR_RETURN_VOID();
+}
+
+/* static enum v7_err parse_funcdecl(struct v7 *, struct ast *, int, int) */
+fid_parse_funcdecl :
+#undef L
+#define L CR_CUR_LOCALS_PT(fid_parse_funcdecl_locals_t)
+{
+  L->start = add_node(v7, a, AST_FUNC);
+  L->outer_last_var_node = v7->last_var_node;
+  L->saved_in_function = v7->pstate.in_function;
+  L->saved_in_strict = v7->pstate.in_strict;
+#ifndef V7_DISABLE_STREAMING_COMPILE
+  L->line_no = v7->line_no;
+#endif
+
+  v7->last_var_node = L->start;
+  ast_modify_skip(a, L->start, L->start, AST_FUNC_FIRST_VAR_SKIP);
+
+  CR_TRY(fid_p_funcdecl_2);
+  {
+    if (L->arg.reserved_name) {
+      CALL_PARSE_IDENT_ALLOW_RESERVED_WORDS(fid_p_funcdecl_1);
+    } else {
+      CALL_PARSE_IDENT(fid_p_funcdecl_9);
+    }
+  }
+  CR_CATCH(PARSER_EXC_ID__SYNTAX_ERROR, fid_p_funcdecl_2, fid_p_funcdecl_3);
+  {
+    if (L->arg.require_named) {
+      /* function name is required, so, rethrow SYNTAX ERROR */
+      CR_THROW(PARSER_EXC_ID__SYNTAX_ERROR);
+    } else {
+      /* it's ok not to have a function name, just insert NOP */
+      add_node(v7, a, AST_NOP);
+    }
+  }
+  CR_ENDCATCH(fid_p_funcdecl_3);
+
+  EXPECT(TOK_OPEN_PAREN);
+  CALL_PARSE_ARGLIST(fid_p_funcdecl_4);
+  EXPECT(TOK_CLOSE_PAREN);
+  ast_set_skip(a, L->start, AST_FUNC_BODY_SKIP);
+  v7->pstate.in_function = 1;
+  EXPECT(TOK_OPEN_CURLY);
+
+  CR_TRY(fid_p_funcdecl_5);
+  {
+    CALL_PARSE_USE_STRICT(fid_p_funcdecl_7);
+    v7->pstate.in_strict = 1;
+  }
+  CR_CATCH(PARSER_EXC_ID__SYNTAX_ERROR, fid_p_funcdecl_5, fid_p_funcdecl_6);
+  CR_ENDCATCH(fid_p_funcdecl_6);
+
+  CALL_PARSE_BODY(TOK_CLOSE_CURLY, fid_p_funcdecl_8);
+  EXPECT(TOK_CLOSE_CURLY);
+  v7->pstate.in_strict = L->saved_in_strict;
+  v7->pstate.in_function = L->saved_in_function;
+  ast_set_skip(a, L->start, AST_END_SKIP);
+  v7->last_var_node = L->outer_last_var_node;
+
+#ifndef V7_DISABLE_STREAMING_COMPILE
+  if (a->script != NULL && !a->has_overflow &&
+      compile_parsed_function(v7, a, L->start - 1, L->line_no) != V7_OK) {
+    CR_THROW(PARSER_EXC_ID__COMPILE_ERROR);
+  }
+#endif
+
+  CR_RETURN_VOID();
+}
+
+/* static enum v7_err parse_arglist(struct v7 *v7, struct ast *a) */
+fid_parse_arglist :
+#undef L
+#define L CR_CUR_LOCALS_PT(fid_parse_arglist_locals_t)
+{
+  if (v7->cur_tok != TOK_CLOSE_PAREN) {
+    do {
+      CALL_PARSE_ASSIGN(fid_p_arglist_1);
+    } while (ACCEPT(TOK_COMMA));
+  }
+  CR_RETURN_VOID();
+}
+
+/*
+ * static enum v7_err parse_member(struct v7 *v7, struct ast *a, ast_off_t pos)
+ */
+fid_parse_member :
+#undef L
+#define L CR_CUR_LOCALS_PT(fid_parse_member_locals_t)
+{
+  switch (v7->cur_tok) {
+    case TOK_DOT:
+      next_tok(v7);
+      /* Allow reserved words as member identifiers */
+      if (is_reserved_word_token(v7->cur_tok) ||
+          v7->cur_tok == TOK_IDENTIFIER) {
+        insert_inlined_node(v7, a, L->arg.pos, AST_MEMBER, v7->tok,
+                            v7->tok_len);
+        next_tok(v7);
+      } else {
+        CR_THROW(PARSER_EXC_ID__SYNTAX_ERROR);
+      }
+      break;
+    case TOK_OPEN_BRACKET:
+      next_tok(v7);
+      CALL_PARSE_EXPRESSION(fid_p_member_1);
+      EXPECT(TOK_CLOSE_BRACKET);
+      insert_node(v7, a, L->arg.pos, AST_INDEX);
+      break;
+    default:
+      CR_RETURN_VOID();
+  }
+  /* not necessary, but let it be anyway */
+  CR_RETURN_VOID();
+}
+
+/* static enum v7_err parse_memberexpr(struct v7 *v7, struct ast *a) */
+fid_parse_memberexpr :
+#undef L
+#define L CR_CUR_LOCALS_PT(fid_parse_memberexpr_locals_t)
+{
+  L->pos = a->mbuf.len;
+  CALL_PARSE_NEWEXPR(fid_p_memberexpr_1);
+
+  for (;;) {
+    switch (v7->cur_tok) {
+      case TOK_DOT:
+      case TOK_OPEN_BRACKET:
+        CALL_PARSE_MEMBER(L->pos, fid_p_memberexpr_2);
+        break;
+      default:
+        CR_RETURN_VOID();
+    }
+  }
+}
+
+/* static enum v7_err parse_var(struct v7 *v7, struct ast *a) */
+fid_parse_var :
+#undef L
+#define L CR_CUR_LOCALS_PT(fid_parse_var_locals_t)
+{
+  L->start = add_node(v7, a, AST_VAR);
+  ast_modify_skip(a, v7->last_var_node, L->start, AST_FUNC_FIRST_VAR_SKIP);
+  /* zero out var node pointer */
+  ast_modify_skip(a, L->start, L->start, AST_FUNC_FIRST_VAR_SKIP);
+  v7->last_var_node = L->start;
+  do {
+    add_inlined_node(v7, a, AST_VAR_DECL, v7->tok, v7->tok_len);
+    EXPECT(TOK_IDENTIFIER);
+    if (ACCEPT(TOK_ASSIGN)) {
+      CALL_PARSE_ASSIGN(fid_p_var_1);
+    } else {
+      add_node(v7, a, AST_NOP);
+    }
+  } while (ACCEPT(TOK_COMMA));
+  ast_set_skip(a, L->start, AST_END_SKIP);
+  CR_RETURN_VOID();
+}
+
+/* static enum v7_err parse_prop(struct v7 *v7, struct ast *a) */
+fid_parse_prop :
+#undef L
+#define L CR_CUR_LOCALS_PT(fid_parse_prop_locals_t)
+{
+#ifdef V7_ENABLE_JS_GETTERS
+  if (v7->cur_tok == TOK_IDENTIFIER && v7->tok_len == 3 &&
+      strncmp(v7->tok, "get", v7->tok_len) == 0 && lookahead(v7) != TOK_COLON) {
+    next_tok(v7);
+    add_node(v7, a, AST_GETTER);
+    CALL_PARSE_FUNCDECL(1, 1, fid_p_prop_1_getter);
+  } else
+#endif
+      if (v7->cur_tok == TOK_IDENTIFIER && lookahead(v7) == TOK_OPEN_PAREN) {
+    /* ecmascript 6 feature */
+    CALL_PARSE_FUNCDECL(1, 1, fid_p_prop_2);
+#ifdef V7_ENABLE_JS_SETTERS
+  } else if (v7->cur_tok == TOK_IDENTIFIER && v7->tok_len == 3 &&
+             strncmp(v7->tok, "set", v7->tok_len) == 0 &&
+             lookahead(v7) != TOK_COLON) {
+    next_tok(v7);
+    add_node(v7, a, AST_SETTER);
+    CALL_PARSE_FUNCDECL(1, 1, fid_p_prop_3_setter);
+#endif
+  } else {
+    /* Allow reserved words as property names. */
+    if (is_reserved_word_token(v7->cur_tok) || v7->cur_tok == TOK_IDENTIFIER ||
+        v7->cur_tok == TOK_NUMBER) {
+      add_inlined_node(v7, a, AST_PROP, v7->tok, v7->tok_len);
+    } else if (v7->cur_tok == TOK_STRING_LITERAL) {
+      add_inlined_node(v7, a, AST_PROP, v7->tok + 1, v7->tok_len - 2);
+    } else {
+      CR_THROW(PARSER_EXC_ID__SYNTAX_ERROR);
+    }
+    next_tok(v7);
+    EXPECT(TOK_COLON);
+    CALL_PARSE_ASSIGN(fid_p_prop_4);
+  }
+  CR_RETURN_VOID();
+}
+
+/* static enum v7_err parse_dowhile(struct v7 *v7, struct ast *a) */
+fid_parse_dowhile :
+#undef L
+#define L CR_CUR_LOCALS_PT(fid_parse_dowhile_locals_t)
+{
+  L->start = add_node(v7, a, AST_DOWHILE);
+  L->saved_in_loop = v7->pstate.in_loop;
+
+  v7->pstate.in_loop = 1;
+  CALL_PARSE_STATEMENT(fid_p_dowhile_1);
+  v7->pstate.in_loop = L->saved_in_loop;
+  ast_set_skip(a, L->start, AST_DO_WHILE_COND_SKIP);
+  EXPECT(TOK_WHILE);
+  EXPECT(TOK_OPEN_PAREN);
+  CALL_PARSE_EXPRESSION(fid_p_dowhile_2);
+  EXPECT(TOK_CLOSE_PAREN);
+  ast_set_skip(a, L->start, AST_END_SKIP);
+  CR_RETURN_VOID();
+}
+
+/* static enum v7_err parse_for(struct v7 *v7, struct ast *a) */
+fid_parse_for :
+#undef L
+#define L CR_CUR_LOCALS_PT(fid_parse_for_locals_t)
+{
+  /* TODO(mkm): for of, for each in */
+  /*
+  ast_off_t start;
+  int saved_in_loop;
+  */
+
+  L->start = add_node(v7, a, AST_FOR);
+  L->saved_in_loop = v7->pstate.in_loop;
+
+  EXPECT(TOK_OPEN_PAREN);
+
+  if (parse_optional(v7, a, TOK_SEMICOLON)) {
+    /*
+     * TODO(mkm): make this reentrant otherwise this pearl won't parse:
+     * for((function(){return 1 in o.a ? o : x})().a in [1,2,3])
+     */
+    v7->pstate.inhibit_in = 1;
+    if (ACCEPT(TOK_VAR)) {
+      CALL_PARSE_VAR(fid_p_for_1);
+    } else {
+      CALL_PARSE_EXPRESSION(fid_p_for_2);
+    }
+    v7->pstate.inhibit_in = 0;
+
+    if (ACCEPT(TOK_IN)) {
+      CALL_PARSE_EXPRESSION(fid_p_for_3);
+      add_node(v7, a, AST_NOP);
+      /*
+       * Assumes that for and for in have the same AST format which is
+       * suboptimal but avoids the need of fixing up the var offset chain.
+       * TODO(mkm) improve this
+       */
+      ast_modify_tag(a, L->start - 1, AST_FOR_IN);
+      goto for_loop_body;
+    }
+  }
+
+  EXPECT(TOK_SEMICOLON);
+  if (parse_optional(v7, a, TOK_SEMICOLON)) {
+    CALL_PARSE_EXPRESSION(fid_p_for_4);
+  }
+  EXPECT(TOK_SEMICOLON);
+  if (parse_optional(v7, a, TOK_CLOSE_PAREN)) {
+    CALL_PARSE_EXPRESSION(fid_p_for_5);
+  }
+
+for_loop_body:
+  EXPECT(TOK_CLOSE_PAREN);
+  ast_set_skip(a, L->start, AST_FOR_BODY_SKIP);
+  v7->pstate.in_loop = 1;
+  CALL_PARSE_STATEMENT(fid_p_for_6);
+  v7->pstate.in_loop = L->saved_in_loop;
+  ast_set_skip(a, L->start, AST_END_SKIP);
+  CR_RETURN_VOID();
+}
+
+/* static enum v7_err parse_try(struct v7 *v7, struct ast *a) */
+fid_parse_try :
+#undef L
+#define L CR_CUR_LOCALS_PT(fid_parse_try_locals_t)
+{
+  L->start = add_node(v7, a, AST_TRY);
+  L->catch_or_finally = 0;
+  CALL_PARSE_BLOCK(fid_p_try_1);
+  ast_set_skip(a, L->start, AST_TRY_CATCH_SKIP);
+  if (ACCEPT(TOK_CATCH)) {
+    L->catch_or_finally = 1;
+    EXPECT(TOK_OPEN_PAREN);
+    CALL_PARSE_IDENT(fid_p_try_2);
+    EXPECT(TOK_CLOSE_PAREN);
+    CALL_PARSE_BLOCK(fid_p_try_3);
+  }
+  ast_set_skip(a, L->start, AST_TRY_FINALLY_SKIP);
+  if (ACCEPT(TOK_FINALLY)) {
+    L->catch_or_finally = 1;
+    CALL_PARSE_BLOCK(fid_p_try_4);
+  }
+  ast_set_skip(a, L->start, AST_END_SKIP);
+
+  /* make sure `catch` and `finally` aren't both missing */
+  if (!L->catch_or_finally) {
+    CR_THROW(PARSER_EXC_ID__SYNTAX_ERROR);
+  }
+
+  CR_RETURN_VOID();
+}
+
+/* static enum v7_err parse_switch(struct v7 *v7, struct ast *a) */
+fid_parse_switch :
+#undef L
+#define L CR_CUR_LOCALS_PT(fid_parse_switch_locals_t)
+{
+  L->start = add_node(v7, a, AST_SWITCH);
+  L->saved_in_switch = v7->pstate.in_switch;
+
+  ast_set_skip(a, L->start, AST_SWITCH_DEFAULT_SKIP); /* clear out */
+  EXPECT(TOK_OPEN_PAREN);
+  CALL_PARSE_EXPRESSION(fid_p_switch_1);
+  EXPECT(TOK_CLOSE_PAREN);
+  EXPECT(TOK_OPEN_CURLY);
+  v7->pstate.in_switch = 1;
+  while (v7->cur_tok != TOK_CLOSE_CURLY) {
+    switch (v7->cur_tok) {
+      case TOK_CASE:
+        next_tok(v7);
+        L->case_start = add_node(v7, a, AST_CASE);
+        CALL_PARSE_EXPRESSION(fid_p_switch_2);
+        EXPECT(TOK_COLON);
+        while (v7->cur_tok != TOK_CASE && v7->cur_tok != TOK_DEFAULT &&
+               v7->cur_tok != TOK_CLOSE_CURLY) {
+          CALL_PARSE_STATEMENT(fid_p_switch_3);
+        }
+        ast_set_skip(a, L->case_start, AST_END_SKIP);
+        break;
+      case TOK_DEFAULT:
+        next_tok(v7);
+        EXPECT(TOK_COLON);
+        ast_set_skip(a, L->start, AST_SWITCH_DEFAULT_SKIP);
+        L->case_start = add_node(v7, a, AST_DEFAULT);
+        while (v7->cur_tok != TOK_CASE && v7->cur_tok != TOK_DEFAULT &&
+               v7->cur_tok != TOK_CLOSE_CURLY) {
+          CALL_PARSE_STATEMENT(fid_p_switch_4);
+        }
+        ast_set_skip(a, L->case_start, AST_END_SKIP);
+        break;
+      default:
+        CR_THROW(PARSER_EXC_ID__SYNTAX_ERROR);
+    }
+  }
+  EXPECT(TOK_CLOSE_CURLY);
+  ast_set_skip(a, L->start, AST_END_SKIP);
+  v7->pstate.in_switch = L->saved_in_switch;
+  CR_RETURN_VOID();
+}
+
+/* static enum v7_err parse_with(struct v7 *v7, struct ast *a) */
+fid_parse_with :
+#undef L
+#define L CR_CUR_LOCALS_PT(fid_parse_with_locals_t)
+{
+  L->start = add_node(v7, a, AST_WITH);
+  if (v7->pstate.in_strict) {
+    CR_THROW(PARSER_EXC_ID__SYNTAX_ERROR);
+  }
+  EXPECT(TOK_OPEN_PAREN);
+  CALL_PARSE_EXPRESSION(fid_p_with_1);
+  EXPECT(TOK_CLOSE_PAREN);
+  CALL_PARSE_STATEMENT(fid_p_with_2);
+  ast_set_skip(a, L->start, AST_END_SKIP);
+  CR_RETURN_VOID();
+}
+
+fid_none:
+  /* stack is empty, so we're done; return */
+  return rc;
+}
+
+V7_PRIVATE enum v7_err parse(struct v7 *v7, struct ast *a, const char *src,
+                             int is_json) {
+  enum v7_err rcode;
+  const char *error_msg = NULL;
+  const char *p;
+  struct cr_ctx cr_ctx;
+  union user_arg_ret arg_retval;
+  enum cr_status rc;
+#if defined(V7_ENABLE_STACK_TRACKING)
+  struct stack_track_ctx stack_track_ctx;
+#endif
+  int saved_line_no = v7->line_no;
+
+#if defined(V7_ENABLE_STACK_TRACKING)
+  v7_stack_track_start(v7, &stack_track_ctx);
+#endif
+
+  v7->pstate.source_code = v7->pstate.pc = src;
+  v7->pstate.file_name = "<stdin>";
+  v7->pstate.line_no = 1;
+  v7->pstate.in_function = 0;
+  v7->pstate.in_loop = 0;
+  v7->pstate.in_switch = 0;
+
+  /*
+   * TODO(dfrank): `v7->parser.line_no` vs `v7->line_no` is confusing.  probaby
+   * we need to refactor it.
+   *
+   * See comment for v7->line_no in core.h for some details.
+   */
+  v7->line_no = 1;
+
+  next_tok(v7);
+  /*
+   * setup initial state for "after newline" tracking.
+   * next_tok will consume our token and position the current line
+   * position at the beginning of the next token.
+   * While processing the first token, both the leading and the
+   * trailing newlines will be counted and thus it will create a spurious
+   * "after newline" condition at the end of the first token
+   * regardless if there is actually a newline after it.
+   */
+  for (p = src; isspace((int) *p); p++) {
+    if (*p == '\n') {
+      v7->pstate.prev_line_no++;
+    }
+  }
+
+  /* init cr context */
+  cr_context_init(&cr_ctx, &arg_retval, sizeof(arg_retval), _fid_descrs);
+
+  /* prepare first function call: fid_mul_sum */
+  if (is_json) {
+    CR_FIRST_CALL_PREPARE_C(&cr_ctx, fid_parse_terminal);
+  } else {
+    CR_FIRST_CALL_PREPARE_C(&cr_ctx, fid_parse_script);
+  }
+
+  /* proceed to coroutine execution */
+  rc = parser_cr_exec(&cr_ctx, v7, a);
+
+  /* set `rcode` depending on coroutine state */
+  switch (rc) {
+    case CR_RES__OK:
+      rcode = V7_OK;
+      break;
+    case CR_RES__ERR_UNCAUGHT_EXCEPTION:
+      switch ((enum parser_exc_id) CR_THROWN_C(&cr_ctx)) {
+        case PARSER_EXC_ID__SYNTAX_ERROR:
+          rcode = V7_SYNTAX_ERROR;
+          error_msg = "Syntax error";
+          break;
+
+        case PARSER_EXC_ID__COMPILE_ERROR:
+          /* the error is thrown by the compiler already */
+          rcode = V7_SYNTAX_ERROR;
+          break;
+
+        default:
+          rcode = V7_INTERNAL_ERROR;
+          error_msg = "Internal error: no exception id set";
+          break;
+      }
+      break;
+    default:
+      rcode = V7_INTERNAL_ERROR;
+      error_msg = "Internal error: unexpected parser coroutine return code";
+      break;
+  }
+
+#if defined(V7_TRACK_MAX_PARSER_STACK_SIZE)
+  /* remember how much stack space was consumed */
+
+  if (v7->parser_stack_data_max_size < cr_ctx.stack_data.size) {
+    v7->parser_stack_data_max_size = cr_ctx.stack_data.size;
+#ifndef NO_LIBC
+    printf("parser_stack_data_max_size=%u\n",
+           (unsigned int) v7->parser_stack_data_max_size);
+#endif
+  }
+
+  if (v7->parser_stack_ret_max_size < cr_ctx.stack_ret.size) {
+    v7->parser_stack_ret_max_size = cr_ctx.stack_ret.size;
+#ifndef NO_LIBC
+    printf("parser_stack_ret_max_size=%u\n",
+           (unsigned int) v7->parser_stack_ret_max_size);
+#endif
+  }
+
+#if defined(CR_TRACK_MAX_STACK_LEN)
+  if (v7->parser_stack_data_max_len < cr_ctx.stack_data_max_len) {
+    v7->parser_stack_data_max_len = cr_ctx.stack_data_max_len;
+#ifndef NO_LIBC
+    printf("parser_stack_data_max_len=%u\n",
+           (unsigned int) v7->parser_stack_data_max_len);
+#endif
+  }
+
+  if (v7->parser_stack_ret_max_len < cr_ctx.stack_ret_max_len) {
+    v7->parser_stack_ret_max_len = cr_ctx.stack_ret_max_len;
+#ifndef NO_LIBC
+    printf("parser_stack_ret_max_len=%u\n",
+           (unsigned int) v7->parser_stack_ret_max_len);
+#endif
+  }
+#endif
+
+#endif
+
+  /* free resources occupied by context (at least, "stack" arrays) */
+  cr_context_free(&cr_ctx);
+
+#if defined(V7_ENABLE_STACK_TRACKING)
+  {
+    int diff = v7_stack_track_end(v7, &stack_track_ctx);
+    if (diff > v7->stack_stat[V7_STACK_STAT_PARSER]) {
+      v7->stack_stat[V7_STACK_STAT_PARSER] = diff;
+    }
+  }
+#endif
+
+  /* Check if AST was overflown */
+  if (a->has_overflow) {
+    rcode = v7_throwf(v7, SYNTAX_ERROR,
+                      "Script too large (try V7_LARGE_AST build option)");
+    V7_THROW(V7_AST_TOO_LARGE);
+  }
+
+  if (rcode == V7_OK && v7->cur_tok != TOK_END_OF_INPUT) {
+    rcode = V7_SYNTAX_ERROR;
+    error_msg = "Syntax error";
+  }
+
+  if (rcode != V7_OK && error_msg != NULL) {
+    unsigned long col = get_column(v7->pstate.source_code, v7->tok);
+    int line_len = 0;
+
+    for (p = v7->tok - col; *p != '\0' && *p != '\n'; p++) {
+      line_len++;
+    }
+
+    /* fixup line number: line_no points to the beginning of the next token */
+    for (; p < v7->pstate.pc; p++) {
+      if (*p == '\n') {
+        v7->pstate.line_no--;
+      }
+    }
+
+    /*
+     * We already have a proper `rcode`, that's why we discard returned value
+     * of `v7_throwf()`, which is always `V7_EXEC_EXCEPTION`.
+     *
+     * TODO(dfrank): probably get rid of distinct error types, and use just
+     * `V7_JS_EXCEPTION`. However it would be good to have a way to get exact
+     * error type, so probably error object should contain some property with
+     * error code, but it would make exceptions even more expensive, etc, etc.
+     */
+    {
+      enum v7_err _tmp;
+      _tmp = v7_throwf(v7, SYNTAX_ERROR, "%s at line %d col %lu:\n%.*s\n%*s^",
+                       error_msg, v7->pstate.line_no, col, line_len,
+                       v7->tok - col, (int) col - 1, "");
+      (void) _tmp;
+    }
+    V7_THROW(rcode);
+  }
+
+clean:
+  v7->line_no = saved_line_no;
+  return rcode;
+}
+#ifdef V7_MODULE_LINES
+#line 1 "./src/compiler.c"
+#endif
+/*
+ * Copyright (c) 2014 Cesanta Software Limited
+ * All rights reserved
+ */
+
+/* Amalgamated: #include "v7/src/internal.h" */
 /* Amalgamated: #include "v7/src/compiler.h" */
 /* Amalgamated: #include "v7/src/std_error.h" */
 /* Amalgamated: #include "v7/src/core.h" */
@@ -23365,1170 +30107,1878 @@ clean:
 /* Amalgamated: #include "v7/src/exceptions.h" */
 /* Amalgamated: #include "v7/src/conversion.h" */
 /* Amalgamated: #include "v7/src/regexp.h" */
+/* Amalgamated: #include "v7/src/bcode_opt.h" */
+
+/*
+ * The bytecode compiler takes an AST as input and produces one or more
+ * bcode structure as output.
+ *
+ * Each script or function body is compiled into it's own bcode structure.
+ *
+ * Each bcode stream produces a new value on the stack, i.e. its overall
+ * stack diagram is: `( -- a)`
+ *
+ * This value will be then popped by the function caller or by v7_exec in case
+ * of scripts.
+ *
+ * In JS, the value of a script is the value of the last statement.
+ * A script with no statement has an `undefined` value.
+ * Functions instead require an explicit return value, so this matters only
+ * for `v7_exec` and JS `eval`.
+ *
+ * Since an empty script has an undefined value, and each script has to
+ * yield a value, the script/function prologue consists of a PUSH_UNDEFINED.
+ *
+ * Each statement will be compiled to push a value on the stack.
+ * When a statement begins evaluating, the current TOS is thus either
+ * the value of the previous statement or `undefined` in case of the first
+ * statement.
+ *
+ * Every statement of a given script/function body always evaluates at the same
+ * stack depth.
+ *
+ * In order to achieve that, after a statement is compiled out, a SWAP_DROP
+ * opcode is emitted, that drops the value of the previous statement (or the
+ * initial `undefined`). Dropping the value after the next statement is
+ * evaluated and not before has allows us to correctly implement exception
+ * behaviour and the break statement.
+ *
+ * Compound statements are constructs such as `if`/`while`/`for`/`try`. These
+ * constructs contain a body consisting of a possibly empty statement list.
+ *
+ * Unlike normal statements, compound statements don't produce a value
+ * themselves. Their value is either the value of their last executed statement
+ * in their body, or the previous statement in case their body is empty or not
+ * evaluated at all.
+ *
+ * An example is:
+ *
+ * [source,js]
+ * ----
+ * try {
+ *   42;
+ *   someUnexistingVariable;
+ * } catch(e) {
+ *   while(true) {}
+ *     if(true) {
+ *     }
+ *     if(false) {
+ *       2;
+ *     }
+ *     break;
+ *   }
+ * }
+ * ----
+ */
+
+static const enum ast_tag assign_ast_map[] = {
+    AST_REM, AST_MUL, AST_DIV,    AST_XOR,    AST_ADD,    AST_SUB,
+    AST_OR,  AST_AND, AST_LSHIFT, AST_RSHIFT, AST_URSHIFT};
+
+#ifdef V7_BCODE_DUMP
+extern void dump_bcode(struct v7 *v7, FILE *f, struct bcode *bcode);
+#endif
+
+V7_PRIVATE enum v7_err compile_expr_builder(struct bcode_builder *bbuilder,
+                                            struct ast *a, ast_off_t *ppos);
+
+V7_PRIVATE enum v7_err compile_function(struct v7 *v7, struct ast *a,
+                                        ast_off_t *ppos, struct bcode *bcode);
+
+V7_PRIVATE enum v7_err binary_op(struct bcode_builder *bbuilder,
+                                 enum ast_tag tag) {
+  uint8_t op;
+  enum v7_err rcode = V7_OK;
+  struct v7 *v7 = bbuilder->v7;
+
+  switch (tag) {
+    case AST_ADD:
+      op = OP_ADD;
+      break;
+    case AST_SUB:
+      op = OP_SUB;
+      break;
+    case AST_REM:
+      op = OP_REM;
+      break;
+    case AST_MUL:
+      op = OP_MUL;
+      break;
+    case AST_DIV:
+      op = OP_DIV;
+      break;
+    case AST_LSHIFT:
+      op = OP_LSHIFT;
+      break;
+    case AST_RSHIFT:
+      op = OP_RSHIFT;
+      break;
+    case AST_URSHIFT:
+      op = OP_URSHIFT;
+      break;
+    case AST_OR:
+      op = OP_OR;
+      break;
+    case AST_XOR:
+      op = OP_XOR;
+      break;
+    case AST_AND:
+      op = OP_AND;
+      break;
+    case AST_EQ_EQ:
+      op = OP_EQ_EQ;
+      break;
+    case AST_EQ:
+      op = OP_EQ;
+      break;
+    case AST_NE:
+      op = OP_NE;
+      break;
+    case AST_NE_NE:
+      op = OP_NE_NE;
+      break;
+    case AST_LT:
+      op = OP_LT;
+      break;
+    case AST_LE:
+      op = OP_LE;
+      break;
+    case AST_GT:
+      op = OP_GT;
+      break;
+    case AST_GE:
+      op = OP_GE;
+      break;
+    case AST_INSTANCEOF:
+      op = OP_INSTANCEOF;
+      break;
+    default:
+      rcode = v7_throwf(bbuilder->v7, SYNTAX_ERROR, "unknown binary ast node");
+      V7_THROW(V7_SYNTAX_ERROR);
+  }
+  bcode_op(bbuilder, op);
+clean:
+  return rcode;
+}
+
+V7_PRIVATE enum v7_err compile_binary(struct bcode_builder *bbuilder,
+                                      struct ast *a, ast_off_t *ppos,
+                                      enum ast_tag tag) {
+  enum v7_err rcode = V7_OK;
+  struct v7 *v7 = bbuilder->v7;
+  V7_TRY(compile_expr_builder(bbuilder, a, ppos));
+  V7_TRY(compile_expr_builder(bbuilder, a, ppos));
+
+  V7_TRY(binary_op(bbuilder, tag));
+clean:
+  return rcode;
+}
+
+/*
+ * `pos` should be an offset of the byte right after a tag
+ */
+static lit_t string_lit(struct bcode_builder *bbuilder, struct ast *a,
+                        ast_off_t pos) {
+  size_t i = 0, name_len;
+  val_t v = V7_UNDEFINED;
+  struct mbuf *m = &bbuilder->lit;
+  char *name = ast_get_inlined_data(a, pos, &name_len);
+
+/* temp disabled because of short lits */
+#if 0
+  for (i = 0; i < m->len / sizeof(val_t); i++) {
+    v = ((val_t *) m->buf)[i];
+    if (v7_is_string(v)) {
+      size_t l;
+      const char *s = v7_get_string(bbuilder->v7, &v, &l);
+      if (name_len == l && memcmp(name, s, name_len) == 0) {
+        lit_t res;
+        memset(&res, 0, sizeof(res));
+        res.idx = i + bcode_max_inline_type_tag;
+        return res;
+      }
+    }
+  }
+#else
+  (void) i;
+  (void) v;
+  (void) m;
+#endif
+  return bcode_add_lit(bbuilder, intern_string(bbuilder->v7, name, name_len));
+}
+
+/*
+ * Returns index of the frame slot which holds the variable `name` of the
+ * function being compiled, or -1 if there's no such slot.
+ *
+ * Args shadow the function name (the last one wins, like in the scope object),
+ * and locals shadow the function name too; but redeclaring an arg with `var`
+ * refers to the arg itself.
+ */
+static int find_frame_slot(struct bcode_builder *bbuilder, const char *name,
+                           size_t name_len) {
+  struct bcode *bcode = bbuilder->bcode;
+  char *ops = bbuilder->ops.buf;
+  char *cur;
+  size_t cur_len, i;
+  int ret = -1;
+
+  for (i = 0; i < bcode->names_cnt; i++) {
+    ops = bcode_next_name(ops, &cur, &cur_len);
+    if (cur_len == name_len && memcmp(cur, name, name_len) == 0) {
+      if (i <= bcode->args_cnt) {
+        ret = i;
+      } else {
+        if (ret <= 0) {
+          ret = i;
+        }
+        break;
+      }
+    }
+  }
+
+  if (ret < 0 && bcode->arguments_slot && name_len == 9 &&
+      memcmp(name, "arguments", 9) == 0) {
+    ret = bcode->names_cnt;
+  }
+
+  return ret;
+}
+
+/*
+ * Emits `OP_GET_VAR`, `OP_SAFE_GET_VAR`, `OP_SET_VAR` or `OP_INC_VAR` for the
+ * identifier whose name is inlined at `pos`. If the variable lives in the
+ * frame slot, `OP_GET_LOCAL`, `OP_SET_LOCAL` or `OP_INC_LOCAL` is emitted
+ * instead.
+ */
+static void compile_var_op(struct bcode_builder *bbuilder, enum opcode op,
+                           struct ast *a, ast_off_t pos) {
+  if (bbuilder->bcode->frame_slots) {
+    size_t name_len;
+    char *name = ast_get_inlined_data(a, pos, &name_len);
+    int slot = find_frame_slot(bbuilder, name, name_len);
+
+    if (slot >= 0) {
+      switch (op) {
+        case OP_SET_VAR:
+          bcode_op(bbuilder, OP_SET_LOCAL);
+          break;
+        case OP_INC_VAR:
+          bcode_op(bbuilder, OP_INC_LOCAL);
+          break;
+        default:
+          bcode_op(bbuilder, OP_GET_LOCAL);
+          break;
+      }
+      bcode_add_varint(bbuilder, slot);
+      return;
+    }
+  }
+
+  bcode_op_lit(bbuilder, op, string_lit(bbuilder, a, pos));
+}
+
+#if V7_ENABLE__RegExp
+WARN_UNUSED_RESULT
+static enum v7_err regexp_lit(struct bcode_builder *bbuilder, struct ast *a,
+                              ast_off_t pos, lit_t *res) {
+  enum v7_err rcode = V7_OK;
+  size_t name_len;
+  char *p;
+  char *name = ast_get_inlined_data(a, pos, &name_len);
+  val_t tmp = V7_UNDEFINED;
+  struct v7 *v7 = bbuilder->v7;
+
+  for (p = name + name_len - 1; *p != '/';) p--;
+
+  V7_TRY(v7_mk_regexp(bbuilder->v7, name + 1, p - (name + 1), p + 1,
+                      (name + name_len) - p - 1, &tmp));
+
+  *res = bcode_add_lit(bbuilder, tmp);
+
+clean:
+  return rcode;
+}
+#endif
+
+#ifndef V7_DISABLE_LINE_NUMBERS
+static void append_lineno_if_changed(struct v7 *v7,
+                                     struct bcode_builder *bbuilder,
+                                     int line_no) {
+  (void) v7;
+  if (line_no != 0 && line_no != v7->line_no) {
+    v7->line_no = line_no;
+    bcode_append_lineno(bbuilder, line_no);
+  }
+}
+#else
+static void append_lineno_if_changed(struct v7 *v7,
+                                     struct bcode_builder *bbuilder,
+                                     int line_no) {
+  (void) v7;
+  (void) bbuilder;
+  (void) line_no;
+}
+#endif
+
+static enum ast_tag fetch_tag(struct v7 *v7, struct bcode_builder *bbuilder,
+                              struct ast *a, ast_off_t *ppos,
+                              ast_off_t *ppos_after_tag) {
+  enum ast_tag ret = ast_fetch_tag(a, ppos);
+  int line_no = ast_get_line_no(a, *ppos);
+  append_lineno_if_changed(v7, bbuilder, line_no);
+  if (ppos_after_tag != NULL) {
+    *ppos_after_tag = *ppos;
+  }
+  ast_move_to_children(a, ppos);
+  return ret;
+}
+
+/*
+ * a++ and a-- need to ignore the updated value.
+ *
+ * Call this before updating the lhs.
+ */
+static void fixup_post_op(struct bcode_builder *bbuilder, enum ast_tag tag) {
+  if (tag == AST_POSTINC || tag == AST_POSTDEC) {
+    bcode_op(bbuilder, OP_UNSTASH);
+  }
+}
+
+/*
+ * evaluate rhs expression.
+ * ++a and a++ are equivalent to a+=1
+ */
+static enum v7_err eval_assign_rhs(struct bcode_builder *bbuilder,
+                                   struct ast *a, ast_off_t *ppos,
+                                   enum ast_tag tag) {
+  enum v7_err rcode = V7_OK;
+  struct v7 *v7 = bbuilder->v7;
+
+  /* a++ and a-- need to preserve initial value. */
+  if (tag == AST_POSTINC || tag == AST_POSTDEC) {
+    bcode_op(bbuilder, OP_STASH);
+  }
+  if (tag >= AST_PREINC && tag <= AST_POSTDEC) {
+    bcode_op(bbuilder, OP_PUSH_ONE);
+  } else {
+    V7_TRY(compile_expr_builder(bbuilder, a, ppos));
+  }
+
+  switch (tag) {
+    case AST_PREINC:
+    case AST_POSTINC:
+      bcode_op(bbuilder, OP_ADD);
+      break;
+    case AST_PREDEC:
+    case AST_POSTDEC:
+      bcode_op(bbuilder, OP_SUB);
+      break;
+    case AST_ASSIGN:
+      /* no operation */
+      break;
+    default:
+      binary_op(bbuilder, assign_ast_map[tag - AST_ASSIGN - 1]);
+  }
+
+clean:
+  return rcode;
+}
+
+static enum v7_err compile_assign(struct bcode_builder *bbuilder, struct ast *a,
+                                  ast_off_t *ppos, enum ast_tag tag) {
+  lit_t lit;
+  enum ast_tag ntag;
+  enum v7_err rcode = V7_OK;
+  struct v7 *v7 = bbuilder->v7;
+  ast_off_t pos_after_tag;
+
+  ntag = fetch_tag(v7, bbuilder, a, ppos, &pos_after_tag);
+
+  switch (ntag) {
+    case AST_IDENT:
+      if (tag >= AST_PREINC && tag <= AST_POSTDEC) {
+        /* `++a`, `a--` etc are done in place by a single instruction */
+        uint8_t flags = 0;
+        if (tag == AST_PREDEC || tag == AST_POSTDEC) {
+          flags |= INC_FLAG_DEC;
+        }
+        if (tag == AST_POSTINC || tag == AST_POSTDEC) {
+          flags |= INC_FLAG_POST;
+        }
+        compile_var_op(bbuilder, OP_INC_VAR, a, pos_after_tag);
+        bcode_add_varint(bbuilder, flags);
+        break;
+      } else if (tag != AST_ASSIGN) {
+        compile_var_op(bbuilder, OP_GET_VAR, a, pos_after_tag);
+      }
+
+      V7_TRY(eval_assign_rhs(bbuilder, a, ppos, tag));
+      compile_var_op(bbuilder, OP_SET_VAR, a, pos_after_tag);
+
+      fixup_post_op(bbuilder, tag);
+      break;
+    case AST_MEMBER:
+    case AST_INDEX:
+      switch (ntag) {
+        case AST_MEMBER:
+          lit = string_lit(bbuilder, a, pos_after_tag);
+          V7_TRY(compile_expr_builder(bbuilder, a, ppos));
+          bcode_push_lit(bbuilder, lit);
+          break;
+        case AST_INDEX:
+          V7_TRY(compile_expr_builder(bbuilder, a, ppos));
+          V7_TRY(compile_expr_builder(bbuilder, a, ppos));
+          break;
+        default:
+          /* unreachable, compilers are dumb */
+          V7_THROW(V7_SYNTAX_ERROR);
+      }
+      if (tag != AST_ASSIGN) {
+        bcode_op(bbuilder, OP_2DUP);
+        bcode_op(bbuilder, OP_GET);
+      }
+
+      V7_TRY(eval_assign_rhs(bbuilder, a, ppos, tag));
+      bcode_op(bbuilder, OP_SET);
+
+      fixup_post_op(bbuilder, tag);
+      break;
+    default:
+      /* We end up here on expressions like `1 = 2;`, it's a ReferenceError */
+      rcode = v7_throwf(bbuilder->v7, REFERENCE_ERROR, "unexpected ast node");
+      V7_THROW(V7_SYNTAX_ERROR);
+  }
+clean:
+  return rcode;
+}
+
+/*
+ * Walks through all declarations (`var` and `function`) in the current scope.
+ *
+ * If `compile_funcs` is zero, names of all of them are added to `bcode->ops`.
+ * Otherwise, `function` declarations are compiled, since they're hoisted in
+ * JS. Names have to be added first, because the code emitted for the
+ * declarations depends on whether the names live in frame slots.
+ */
+static enum v7_err compile_local_vars(struct bcode_builder *bbuilder,
+                                      struct ast *a, ast_off_t start,
+                                      ast_off_t fvar, uint8_t compile_funcs) {
+  ast_off_t next, fvar_end;
+  char *name;
+  size_t name_len;
+  enum v7_err rcode = V7_OK;
+  struct v7 *v7 = bbuilder->v7;
+  size_t names_end = 0;
+  ast_off_t pos_after_tag;
+
+  /* calculate `names_end`: offset at which names in `bcode->ops` end */
+  names_end =
+      (size_t)(bcode_end_names(bbuilder->ops.buf, bbuilder->bcode->names_cnt) -
+               bbuilder->ops.buf);
+
+  if (fvar != start) {
+    /* iterate all `AST_VAR`s in the current scope */
+    do {
+      V7_CHECK_INTERNAL(fetch_tag(v7, bbuilder, a, &fvar, &pos_after_tag) ==
+                        AST_VAR);
+
+      next = ast_get_skip(a, pos_after_tag, AST_VAR_NEXT_SKIP);
+      if (next == pos_after_tag) {
+        next = 0;
+      }
+
+      fvar_end = ast_get_skip(a, pos_after_tag, AST_END_SKIP);
+
+      /*
+       * iterate all `AST_VAR_DECL`s and `AST_FUNC_DECL`s in the current
+       * `AST_VAR`
+       */
+      while (fvar < fvar_end) {
+        enum ast_tag tag = fetch_tag(v7, bbuilder, a, &fvar, &pos_after_tag);
+        V7_CHECK_INTERNAL(tag == AST_VAR_DECL || tag == AST_FUNC_DECL);
+        if (tag == AST_VAR_DECL || !compile_funcs) {
+          /*
+           * it's a `var` declaration, so, skip the value for now, it'll be set
+           * to `undefined` initially
+           */
+          ast_skip_tree(a, &fvar);
+        } else {
+          /*
+           * tag is an AST_FUNC_DECL: since functions in JS are hoisted,
+           * we compile it and put `OP_SET_VAR` directly here
+           */
+          V7_TRY(compile_expr_builder(bbuilder, a, &fvar));
+          compile_var_op(bbuilder, OP_SET_VAR, a, pos_after_tag);
+
+          /* function declarations are stack-neutral */
+          bcode_op(bbuilder, OP_DROP);
+          /*
+           * Note: the `is_stack_neutral` flag will be set by `compile_stmt`
+           * later, when it encounters `AST_FUNC_DECL` again.
+           */
+        }
+        if (!compile_funcs) {
+          name = ast_get_inlined_data(a, pos_after_tag, &name_len);
+          V7_TRY(bcode_add_name(bbuilder, name, name_len, &names_end));
+        }
+      }
+
+      if (next > 0) {
+        fvar = next - 1;
+      }
+
+    } while (next != 0);
+  }
+
+clean:
+  return rcode;
+}
 
 /*
- * The bytecode compiler takes an AST as input and produces one or more
- * bcode structure as output.
- *
- * Each script or function body is compiled into it's own bcode structure.
- *
- * Each bcode stream produces a new value on the stack, i.e. its overall
- * stack diagram is: `( -- a)`
- *
- * This value will be then popped by the function caller or by v7_exec in case
- * of scripts.
- *
- * In JS, the value of a script is the value of the last statement.
- * A script with no statement has an `undefined` value.
- * Functions instead require an explicit return value, so this matters only
- * for `v7_exec` and JS `eval`.
- *
- * Since an empty script has an undefined value, and each script has to
- * yield a value, the script/function prologue consists of a PUSH_UNDEFINED.
- *
- * Each statement will be compiled to push a value on the stack.
- * When a statement begins evaluating, the current TOS is thus either
- * the value of the previous statement or `undefined` in case of the first
- * statement.
- *
- * Every statement of a given script/function body always evaluates at the same
- * stack depth.
- *
- * In order to achieve that, after a statement is compiled out, a SWAP_DROP
- * opcode is emitted, that drops the value of the previous statement (or the
- * initial `undefined`). Dropping the value after the next statement is
- * evaluated and not before has allows us to correctly implement exception
- * behaviour and the break statement.
- *
- * Compound statements are constructs such as `if`/`while`/`for`/`try`. These
- * constructs contain a body consisting of a possibly empty statement list.
- *
- * Unlike normal statements, compound statements don't produce a value
- * themselves. Their value is either the value of their last executed statement
- * in their body, or the previous statement in case their body is empty or not
- * evaluated at all.
+ * Just like `compile_expr_builder`, but it takes additional argument:
+ *`for_call`.
+ * If it's non-zero, the stack is additionally populated with `this` value
+ * for call.
  *
- * An example is:
+ * If there is a refinement (a dot, or a subscript), then it'll be the
+ * appropriate object. Otherwise, it's `undefined`.
  *
- * [source,js]
- * ----
- * try {
- *   42;
- *   someUnexistingVariable;
- * } catch(e) {
- *   while(true) {}
- *     if(true) {
- *     }
- *     if(false) {
- *       2;
- *     }
- *     break;
- *   }
- * }
- * ----
+ * In non-strict mode, `undefined` will be changed to Global Object at runtime,
+ * see `OP_CALL` handling in `eval_bcode()`.
  */
+V7_PRIVATE enum v7_err compile_expr_ext(struct bcode_builder *bbuilder,
+                                        struct ast *a, ast_off_t *ppos,
+                                        uint8_t for_call) {
+  enum v7_err rcode = V7_OK;
+  struct v7 *v7 = bbuilder->v7;
+  ast_off_t pos_after_tag;
+  enum ast_tag tag = fetch_tag(v7, bbuilder, a, ppos, &pos_after_tag);
+
+  switch (tag) {
+    case AST_MEMBER: {
+      lit_t lit = string_lit(bbuilder, a, pos_after_tag);
+      V7_TRY(compile_expr_builder(bbuilder, a, ppos));
+      if (for_call) {
+        /* current TOS will be used as `this` */
+        bcode_op(bbuilder, OP_DUP);
+      }
+      bcode_push_lit(bbuilder, lit);
+      bcode_op(bbuilder, OP_GET);
+      break;
+    }
+
+    case AST_INDEX:
+      V7_TRY(compile_expr_builder(bbuilder, a, ppos));
+      if (for_call) {
+        /* current TOS will be used as `this` */
+        bcode_op(bbuilder, OP_DUP);
+      }
+      V7_TRY(compile_expr_builder(bbuilder, a, ppos));
+      bcode_op(bbuilder, OP_GET);
+      break;
+
+    default:
+      if (for_call) {
+        /*
+         * `this` will be an `undefined` (but it may change to Global Object
+         * at runtime)
+         */
+        bcode_op(bbuilder, OP_PUSH_UNDEFINED);
+      }
+      *ppos = pos_after_tag - 1;
+      V7_TRY(compile_expr_builder(bbuilder, a, ppos));
+      break;
+  }
+
+clean:
+  return rcode;
+}
+
+V7_PRIVATE enum v7_err compile_delete(struct bcode_builder *bbuilder,
+                                      struct ast *a, ast_off_t *ppos) {
+  enum v7_err rcode = V7_OK;
+  struct v7 *v7 = bbuilder->v7;
+  ast_off_t pos_after_tag;
+  enum ast_tag tag = fetch_tag(v7, bbuilder, a, ppos, &pos_after_tag);
+
+  switch (tag) {
+    case AST_MEMBER: {
+      /* Delete a specified property of an object */
+      lit_t lit = string_lit(bbuilder, a, pos_after_tag);
+      /* put an object to delete property from */
+      V7_TRY(compile_expr_builder(bbuilder, a, ppos));
+      /* put a property name */
+      bcode_push_lit(bbuilder, lit);
+      bcode_op(bbuilder, OP_DELETE);
+      break;
+    }
+
+    case AST_INDEX:
+      /* Delete a specified property of an object */
+      /* put an object to delete property from */
+      V7_TRY(compile_expr_builder(bbuilder, a, ppos));
+      /* put a property name */
+      V7_TRY(compile_expr_builder(bbuilder, a, ppos));
+      bcode_op(bbuilder, OP_DELETE);
+      break;
+
+    case AST_IDENT:
+      /* Delete the scope variable (or throw an error if strict mode) */
+      if (!bbuilder->bcode->strict_mode) {
+        size_t name_len;
+        char *name = ast_get_inlined_data(a, pos_after_tag, &name_len);
+        if (bbuilder->bcode->frame_slots &&
+            find_frame_slot(bbuilder, name, name_len) >= 0) {
+          /* frame slot variables are undeletable, just like `var`s */
+          bcode_op(bbuilder, OP_PUSH_FALSE);
+        } else {
+          /* put a property name */
+          bcode_push_lit(bbuilder, string_lit(bbuilder, a, pos_after_tag));
+          bcode_op(bbuilder, OP_DELETE_VAR);
+        }
+      } else {
+        rcode =
+            v7_throwf(bbuilder->v7, SYNTAX_ERROR,
+                      "Delete of an unqualified identifier in strict mode.");
+        V7_THROW(V7_SYNTAX_ERROR);
+      }
+      break;
+
+    case AST_UNDEFINED:
+      /*
+       * `undefined` should actually be an undeletable property of the Global
+       * Object, so, trying to delete it just yields `false`
+       */
+      bcode_op(bbuilder, OP_PUSH_FALSE);
+      break;
+
+    default:
+      /*
+       * For all other cases, we evaluate the expression given to `delete`
+       * for side effects, then drop the result, and yield `true`
+       */
+      *ppos = pos_after_tag - 1;
+      V7_TRY(compile_expr_builder(bbuilder, a, ppos));
+      bcode_op(bbuilder, OP_DROP);
+      bcode_op(bbuilder, OP_PUSH_TRUE);
+      break;
+  }
+
+clean:
+  return rcode;
+}
+
+V7_PRIVATE enum v7_err compile_expr_builder(struct bcode_builder *bbuilder,
+                                            struct ast *a, ast_off_t *ppos) {
+  enum v7_err rcode = V7_OK;
+  struct v7 *v7 = bbuilder->v7;
+  ast_off_t pos_after_tag;
+  enum ast_tag tag = fetch_tag(v7, bbuilder, a, ppos, &pos_after_tag);
+
+  switch (tag) {
+    case AST_ADD:
+    case AST_SUB:
+    case AST_REM:
+    case AST_MUL:
+    case AST_DIV:
+    case AST_LSHIFT:
+    case AST_RSHIFT:
+    case AST_URSHIFT:
+    case AST_OR:
+    case AST_XOR:
+    case AST_AND:
+    case AST_EQ_EQ:
+    case AST_EQ:
+    case AST_NE:
+    case AST_NE_NE:
+    case AST_LT:
+    case AST_LE:
+    case AST_GT:
+    case AST_GE:
+    case AST_INSTANCEOF:
+      V7_TRY(compile_binary(bbuilder, a, ppos, tag));
+      break;
+    case AST_LOGICAL_NOT:
+      V7_TRY(compile_expr_builder(bbuilder, a, ppos));
+      bcode_op(bbuilder, OP_LOGICAL_NOT);
+      break;
+    case AST_NOT:
+      V7_TRY(compile_expr_builder(bbuilder, a, ppos));
+      bcode_op(bbuilder, OP_NOT);
+      break;
+    case AST_POSITIVE:
+      V7_TRY(compile_expr_builder(bbuilder, a, ppos));
+      bcode_op(bbuilder, OP_POS);
+      break;
+    case AST_NEGATIVE:
+      V7_TRY(compile_expr_builder(bbuilder, a, ppos));
+      bcode_op(bbuilder, OP_NEG);
+      break;
+    case AST_IDENT:
+      compile_var_op(bbuilder, OP_GET_VAR, a, pos_after_tag);
+      break;
+    case AST_MEMBER:
+    case AST_INDEX:
+      /*
+       * These two are handled by the "extended" version of this function,
+       * since we may need to put `this` value on stack, for "method pattern
+       * invocation".
+       *
+       * First of all, restore starting AST position, and then call extended
+       * function.
+       */
+      *ppos = pos_after_tag - 1;
+      V7_TRY(compile_expr_ext(bbuilder, a, ppos, 0 /*not for call*/));
+      break;
+    case AST_IN:
+      V7_TRY(compile_expr_builder(bbuilder, a, ppos));
+      V7_TRY(compile_expr_builder(bbuilder, a, ppos));
+      bcode_op(bbuilder, OP_IN);
+      break;
+    case AST_TYPEOF: {
+      ast_off_t lookahead = *ppos;
+      tag = fetch_tag(v7, bbuilder, a, &lookahead, &pos_after_tag);
+      if (tag == AST_IDENT) {
+        *ppos = lookahead;
+        compile_var_op(bbuilder, OP_SAFE_GET_VAR, a, pos_after_tag);
+      } else {
+        V7_TRY(compile_expr_builder(bbuilder, a, ppos));
+      }
+      bcode_op(bbuilder, OP_TYPEOF);
+      break;
+    }
+    case AST_ASSIGN:
+    case AST_PREINC:
+    case AST_PREDEC:
+    case AST_POSTINC:
+    case AST_POSTDEC:
+    case AST_REM_ASSIGN:
+    case AST_MUL_ASSIGN:
+    case AST_DIV_ASSIGN:
+    case AST_XOR_ASSIGN:
+    case AST_PLUS_ASSIGN:
+    case AST_MINUS_ASSIGN:
+    case AST_OR_ASSIGN:
+    case AST_AND_ASSIGN:
+    case AST_LSHIFT_ASSIGN:
+    case AST_RSHIFT_ASSIGN:
+    case AST_URSHIFT_ASSIGN:
+      V7_TRY(compile_assign(bbuilder, a, ppos, tag));
+      break;
+    case AST_COND: {
+      /*
+      * A ? B : C
+      *
+      * ->
+      *
+      *   <A>
+      *   JMP_FALSE false
+      *   <B>
+      *   JMP end
+      * false:
+      *   <C>
+      * end:
+      *
+      */
+      bcode_off_t false_label, end_label;
+      V7_TRY(compile_expr_builder(bbuilder, a, ppos));
+      false_label = bcode_op_target(bbuilder, OP_JMP_FALSE);
+      V7_TRY(compile_expr_builder(bbuilder, a, ppos));
+      end_label = bcode_op_target(bbuilder, OP_JMP);
+      bcode_patch_target(bbuilder, false_label, bcode_pos(bbuilder));
+      V7_TRY(compile_expr_builder(bbuilder, a, ppos));
+      bcode_patch_target(bbuilder, end_label, bcode_pos(bbuilder));
+      break;
+    }
+    case AST_LOGICAL_OR:
+    case AST_LOGICAL_AND: {
+      /*
+       * A && B
+       *
+       * ->
+       *
+       *   <A>
+       *   JMP_FALSE end
+       *   POP
+       *   <B>
+       * end:
+       *
+       */
+      bcode_off_t end_label;
+      V7_TRY(compile_expr_builder(bbuilder, a, ppos));
+      bcode_op(bbuilder, OP_DUP);
+      end_label = bcode_op_target(
+          bbuilder, tag == AST_LOGICAL_AND ? OP_JMP_FALSE : OP_JMP_TRUE);
+      bcode_op(bbuilder, OP_DROP);
+      V7_TRY(compile_expr_builder(bbuilder, a, ppos));
+      bcode_patch_target(bbuilder, end_label, bcode_pos(bbuilder));
+      break;
+    }
+    /*
+     * A, B, C
+     *
+     * ->
+     *
+     * <A>
+     * DROP
+     * <B>
+     * DROP
+     * <C>
+     */
+    case AST_SEQ: {
+      ast_off_t end = ast_get_skip(a, pos_after_tag, AST_END_SKIP);
+      while (*ppos < end) {
+        V7_TRY(compile_expr_builder(bbuilder, a, ppos));
+        if (*ppos < end) {
+          bcode_op(bbuilder, OP_DROP);
+        }
+      }
+      break;
+    }
+    case AST_CALL:
+    case AST_NEW: {
+      /*
+       * f()
+       *
+       * ->
+       *
+       *  PUSH_UNDEFINED (value for `this`)
+       *  GET_VAR "f"
+       *  CHECK_CALL
+       *  CALL 0 args
+       *
+       * ---------------
+       *
+       * f(a, b)
+       *
+       * ->
+       *
+       *  PUSH_UNDEFINED (value for `this`)
+       *  GET_VAR "f"
+       *  CHECK_CALL
+       *  GET_VAR "a"
+       *  GET_VAR "b"
+       *  CALL 2 args
+       *
+       * ---------------
+       *
+       * o.f(a, b)
+       *
+       * ->
+       *
+       *  GET_VAR "o" (so that `this` will be an `o`)
+       *  DUP         (we'll also need `o` for GET below, so, duplicate it)
+       *  PUSH_LIT "f"
+       *  GET         (get property "f" of the object "o")
+       *  CHECK_CALL
+       *  GET_VAR "a"
+       *  GET_VAR "b"
+       *  CALL 2 args
+       *
+       */
+      int args;
+      ast_off_t end = ast_get_skip(a, pos_after_tag, AST_END_SKIP);
+
+      V7_TRY(compile_expr_ext(bbuilder, a, ppos, 1 /*for call*/));
+      bcode_op(bbuilder, OP_CHECK_CALL);
+      for (args = 0; *ppos < end; args++) {
+        V7_TRY(compile_expr_builder(bbuilder, a, ppos));
+      }
+      bcode_op(bbuilder, (tag == AST_CALL ? OP_CALL : OP_NEW));
+      if (args > 0x7f) {
+        rcode = v7_throwf(bbuilder->v7, SYNTAX_ERROR, "too many arguments");
+        V7_THROW(V7_SYNTAX_ERROR);
+      }
+      /* a single byte, since `args` fits in 7 bits */
+      bcode_add_varint(bbuilder, args);
+      break;
+    }
+    case AST_DELETE: {
+      V7_TRY(compile_delete(bbuilder, a, ppos));
+      break;
+    }
+    case AST_OBJECT: {
+      /*
+       * {a:<B>, ...}
+       *
+       * ->
+       *
+       *   CREATE_OBJ
+       *   DUP
+       *   PUSH_LIT "a"
+       *   <B>
+       *   SET
+       *   POP
+       *   ...
+       */
+
+      /*
+       * Literal indices of property names of current object literal.
+       * Needed for strict mode: we need to keep track of the added
+       * properties, since duplicates are not allowed
+       */
+      struct mbuf cur_literals;
+      lit_t lit;
+      ast_off_t end = ast_get_skip(a, pos_after_tag, AST_END_SKIP);
+      mbuf_init(&cur_literals, 0);
+
+      bcode_op(bbuilder, OP_CREATE_OBJ);
+      while (*ppos < end) {
+        tag = fetch_tag(v7, bbuilder, a, ppos, &pos_after_tag);
+        switch (tag) {
+          case AST_PROP:
+            bcode_op(bbuilder, OP_DUP);
+            lit = string_lit(bbuilder, a, pos_after_tag);
+
+/* disabled because we broke get_lit */
+#if 0
+            if (bbuilder->bcode->strict_mode) {
+              /*
+               * In strict mode, check for duplicate property names in
+               * object literals
+               */
+              char *plit;
+              for (plit = (char *) cur_literals.buf;
+                   (char *) plit < cur_literals.buf + cur_literals.len;
+                   plit++) {
+                const char *str1, *str2;
+                size_t size1, size2;
+                v7_val_t val1, val2;
+
+                val1 = bcode_get_lit(bbuilder->bcode, lit);
+                str1 = v7_get_string(bbuilder->v7, &val1, &size1);
+
+                val2 = bcode_get_lit(bbuilder->bcode, *plit);
+                str2 = v7_get_string(bbuilder->v7, &val2, &size2);
+
+                if (size1 == size2 && memcmp(str1, str2, size1) == 0) {
+                  /* found already existing property of the same name */
+                  rcode = v7_throwf(bbuilder->v7, SYNTAX_ERROR,
+                                    "duplicate data property in object literal "
+                                    "is not allowed in strict mode");
+                  V7_THROW2(V7_SYNTAX_ERROR, ast_object_clean);
+                }
+              }
+              mbuf_append(&cur_literals, &lit, sizeof(lit));
+            }
+#endif
+            bcode_push_lit(bbuilder, lit);
+            V7_TRY(compile_expr_builder(bbuilder, a, ppos));
+            bcode_op(bbuilder, OP_SET);
+            bcode_op(bbuilder, OP_DROP);
+            break;
+          default:
+            rcode = v7_throwf(bbuilder->v7, SYNTAX_ERROR, "not implemented");
+            V7_THROW2(V7_SYNTAX_ERROR, ast_object_clean);
+        }
+      }
+
+    ast_object_clean:
+      mbuf_free(&cur_literals);
+      if (rcode != V7_OK) {
+        V7_THROW(rcode);
+      }
+      break;
+    }
+    case AST_ARRAY: {
+      /*
+       * [<A>,,<B>,...]
+       *
+       * ->
+       *
+       *   CREATE_ARR
+       *   PUSH_ZERO
+       *
+       *   2DUP
+       *   <A>
+       *   SET
+       *   POP
+       *   PUSH_ONE
+       *   ADD
+       *
+       *   PUSH_ONE
+       *   ADD
+       *
+       *   2DUP
+       *   <B>
+       *   ...
+       *   POP // tmp index
+       *
+       * TODO(mkm): optimize this out. we can have more compact array push
+       * that uses a special marker value for missing array elements
+       * (which are not the same as undefined btw)
+       */
+      ast_off_t end = ast_get_skip(a, pos_after_tag, AST_END_SKIP);
+      bcode_op(bbuilder, OP_CREATE_ARR);
+      bcode_op(bbuilder, OP_PUSH_ZERO);
+      while (*ppos < end) {
+        ast_off_t lookahead = *ppos;
+        tag = fetch_tag(v7, bbuilder, a, &lookahead, &pos_after_tag);
+        if (tag != AST_NOP) {
+          bcode_op(bbuilder, OP_2DUP);
+          V7_TRY(compile_expr_builder(bbuilder, a, ppos));
+          bcode_op(bbuilder, OP_SET);
+          bcode_op(bbuilder, OP_DROP);
+        } else {
+          *ppos = lookahead; /* skip nop */
+        }
+        bcode_op(bbuilder, OP_PUSH_ONE);
+        bcode_op(bbuilder, OP_ADD);
+      }
+      bcode_op(bbuilder, OP_DROP);
+      break;
+    }
+    case AST_FUNC: {
+      lit_t flit;
 
-static const enum ast_tag assign_ast_map[] = {
-    AST_REM, AST_MUL, AST_DIV,    AST_XOR,    AST_ADD,    AST_SUB,
-    AST_OR,  AST_AND, AST_LSHIFT, AST_RSHIFT, AST_URSHIFT};
+      /*
+       * Create half-done function: without scope and prototype. The real
+       * function will be created from this one during bcode evaluation: see
+       * `bcode_instantiate_function()`.
+       */
+      val_t funv = mk_js_function(bbuilder->v7, NULL, V7_UNDEFINED);
 
-#ifdef V7_BCODE_DUMP
-extern void dump_bcode(struct v7 *v7, FILE *f, struct bcode *bcode);
-#endif
+      /* Create bcode in this half-done function */
+      struct v7_js_function *func = get_js_function_struct(funv);
+      func->bcode = (struct bcode *) calloc(1, sizeof(*bbuilder->bcode));
+      bcode_init(func->bcode, bbuilder->bcode->strict_mode,
+                 NULL /* will be set below */, 0);
+      bcode_copy_filename_from(func->bcode, bbuilder->bcode);
+      retain_bcode(bbuilder->v7, func->bcode);
+      flit = bcode_add_lit(bbuilder, funv);
 
-V7_PRIVATE enum v7_err compile_expr_builder(struct bcode_builder *bbuilder,
-                                            struct ast *a, ast_off_t *ppos);
+      *ppos = pos_after_tag - 1;
+      V7_TRY(compile_function(v7, a, ppos, func->bcode));
+      bcode_push_lit(bbuilder, flit);
+      bcode_op(bbuilder, OP_FUNC_LIT);
+      break;
+    }
+#ifndef V7_DISABLE_STREAMING_COMPILE
+    case AST_COMPILED_FUNC: {
+      struct ast_compiled_func *f;
+      ast_off_t data = pos_after_tag;
+      lit_t flit;
+      val_t funv;
+      int llen;
 
-V7_PRIVATE enum v7_err compile_function(struct v7 *v7, struct ast *a,
-                                        ast_off_t *ppos, struct bcode *bcode);
+      ast_move_to_inlined_data(a, &data);
+      f = (struct ast_compiled_func *) a->funcs.buf +
+          decode_varint((unsigned char *) a->mbuf.buf + data, &llen);
 
-V7_PRIVATE enum v7_err binary_op(struct bcode_builder *bbuilder,
-                                 enum ast_tag tag) {
-  uint8_t op;
-  enum v7_err rcode = V7_OK;
-  struct v7 *v7 = bbuilder->v7;
+      /* half-done function, just like above */
+      funv = mk_js_function(bbuilder->v7, NULL, V7_UNDEFINED);
+      get_js_function_struct(funv)->bcode = f->bcode;
+      retain_bcode(bbuilder->v7, f->bcode);
+      flit = bcode_add_lit(bbuilder, funv);
+      bcode_push_lit(bbuilder, flit);
+      bcode_op(bbuilder, OP_FUNC_LIT);
 
-  switch (tag) {
-    case AST_ADD:
-      op = OP_ADD;
-      break;
-    case AST_SUB:
-      op = OP_SUB;
-      break;
-    case AST_REM:
-      op = OP_REM;
-      break;
-    case AST_MUL:
-      op = OP_MUL;
-      break;
-    case AST_DIV:
-      op = OP_DIV;
-      break;
-    case AST_LSHIFT:
-      op = OP_LSHIFT;
-      break;
-    case AST_RSHIFT:
-      op = OP_RSHIFT;
-      break;
-    case AST_URSHIFT:
-      op = OP_URSHIFT;
-      break;
-    case AST_OR:
-      op = OP_OR;
-      break;
-    case AST_XOR:
-      op = OP_XOR;
+      /* skip the names, and pretend the function's code was walked */
+      *ppos = ast_get_skip(a, pos_after_tag, AST_END_SKIP);
+      v7->line_no = f->line_no;
       break;
-    case AST_AND:
-      op = OP_AND;
-      break;
-    case AST_EQ_EQ:
-      op = OP_EQ_EQ;
+    }
+#endif
+    case AST_THIS:
+      bcode_op(bbuilder, OP_PUSH_THIS);
       break;
-    case AST_EQ:
-      op = OP_EQ;
+    case AST_VOID:
+      V7_TRY(compile_expr_builder(bbuilder, a, ppos));
+      bcode_op(bbuilder, OP_DROP);
+      bcode_op(bbuilder, OP_PUSH_UNDEFINED);
       break;
-    case AST_NE:
-      op = OP_NE;
+    case AST_NULL:
+      bcode_op(bbuilder, OP_PUSH_NULL);
       break;
-    case AST_NE_NE:
-      op = OP_NE_NE;
+    case AST_NOP:
+    case AST_UNDEFINED:
+      bcode_op(bbuilder, OP_PUSH_UNDEFINED);
       break;
-    case AST_LT:
-      op = OP_LT;
+    case AST_TRUE:
+      bcode_op(bbuilder, OP_PUSH_TRUE);
       break;
-    case AST_LE:
-      op = OP_LE;
+    case AST_FALSE:
+      bcode_op(bbuilder, OP_PUSH_FALSE);
       break;
-    case AST_GT:
-      op = OP_GT;
+    case AST_NUM: {
+      double dv = ast_get_num(a, pos_after_tag);
+      if (dv == 0) {
+        bcode_op(bbuilder, OP_PUSH_ZERO);
+      } else if (dv == 1) {
+        bcode_op(bbuilder, OP_PUSH_ONE);
+      } else {
+        bcode_push_lit(bbuilder, bcode_add_lit(bbuilder, v7_mk_number(v7, dv)));
+      }
       break;
-    case AST_GE:
-      op = OP_GE;
+    }
+    case AST_STRING:
+      bcode_push_lit(bbuilder, string_lit(bbuilder, a, pos_after_tag));
       break;
-    case AST_INSTANCEOF:
-      op = OP_INSTANCEOF;
+    case AST_REGEX:
+#if V7_ENABLE__RegExp
+    {
+      lit_t tmp;
+      rcode = regexp_lit(bbuilder, a, pos_after_tag, &tmp);
+      if (rcode != V7_OK) {
+        rcode = V7_SYNTAX_ERROR;
+        goto clean;
+      }
+
+      bcode_push_lit(bbuilder, tmp);
       break;
+    }
+#else
+      rcode =
+          v7_throwf(bbuilder->v7, SYNTAX_ERROR, "Regexp support is disabled");
+      V7_THROW(V7_SYNTAX_ERROR);
+#endif
+    case AST_LABEL:
+    case AST_LABELED_BREAK:
+    case AST_LABELED_CONTINUE:
+      /* TODO(dfrank): implement */
+      rcode = v7_throwf(bbuilder->v7, SYNTAX_ERROR, "not implemented");
+      V7_THROW(V7_SYNTAX_ERROR);
+    case AST_WITH:
+      rcode = v7_throwf(bbuilder->v7, SYNTAX_ERROR, "not implemented");
+      V7_THROW(V7_SYNTAX_ERROR);
     default:
-      rcode = v7_throwf(bbuilder->v7, SYNTAX_ERROR, "unknown binary ast node");
+      /*
+       * We end up here if the AST is broken.
+       *
+       * It might be appropriate to return `V7_INTERNAL_ERROR` here, but since
+       * we might receive AST from network or something, we just interpret
+       * it as SyntaxError.
+       */
+      rcode = v7_throwf(bbuilder->v7, SYNTAX_ERROR, "unknown ast node %d",
+                        (int) tag);
       V7_THROW(V7_SYNTAX_ERROR);
   }
-  bcode_op(bbuilder, op);
 clean:
   return rcode;
 }
 
-V7_PRIVATE enum v7_err compile_binary(struct bcode_builder *bbuilder,
-                                      struct ast *a, ast_off_t *ppos,
-                                      enum ast_tag tag) {
+V7_PRIVATE enum v7_err compile_stmt(struct bcode_builder *bbuilder,
+                                    struct ast *a, ast_off_t *ppos);
+
+V7_PRIVATE enum v7_err compile_stmts(struct bcode_builder *bbuilder,
+                                     struct ast *a, ast_off_t *ppos,
+                                     ast_off_t end) {
   enum v7_err rcode = V7_OK;
   struct v7 *v7 = bbuilder->v7;
-  V7_TRY(compile_expr_builder(bbuilder, a, ppos));
-  V7_TRY(compile_expr_builder(bbuilder, a, ppos));
-
-  V7_TRY(binary_op(bbuilder, tag));
-clean:
-  return rcode;
-}
-
-/*
- * `pos` should be an offset of the byte right after a tag
- */
-static lit_t string_lit(struct bcode_builder *bbuilder, struct ast *a,
-                        ast_off_t pos) {
-  size_t i = 0, name_len;
-  val_t v = V7_UNDEFINED;
-  struct mbuf *m = &bbuilder->lit;
-  char *name = ast_get_inlined_data(a, pos, &name_len);
 
-/* temp disabled because of short lits */
-#if 0
-  for (i = 0; i < m->len / sizeof(val_t); i++) {
-    v = ((val_t *) m->buf)[i];
-    if (v7_is_string(v)) {
-      size_t l;
-      const char *s = v7_get_string(bbuilder->v7, &v, &l);
-      if (name_len == l && memcmp(name, s, name_len) == 0) {
-        lit_t res;
-        memset(&res, 0, sizeof(res));
-        res.idx = i + bcode_max_inline_type_tag;
-        return res;
-      }
+  while (*ppos < end) {
+    V7_TRY(compile_stmt(bbuilder, a, ppos));
+    if (!bbuilder->v7->is_stack_neutral) {
+      bcode_op(bbuilder, OP_SWAP_DROP);
+    } else {
+      bbuilder->v7->is_stack_neutral = 0;
     }
   }
-#else
-  (void) i;
-  (void) v;
-  (void) m;
-#endif
-  return bcode_add_lit(bbuilder, v7_mk_string(bbuilder->v7, name, name_len, 1));
+clean:
+  return rcode;
 }
 
-#if V7_ENABLE__RegExp
-WARN_UNUSED_RESULT
-static enum v7_err regexp_lit(struct bcode_builder *bbuilder, struct ast *a,
-                              ast_off_t pos, lit_t *res) {
+V7_PRIVATE enum v7_err compile_stmt(struct bcode_builder *bbuilder,
+                                    struct ast *a, ast_off_t *ppos) {
+  ast_off_t end;
+  enum ast_tag tag;
+  ast_off_t cond, pos_after_tag;
+  bcode_off_t body_target, body_label, cond_label;
+  struct mbuf case_labels;
   enum v7_err rcode = V7_OK;
-  size_t name_len;
-  char *p;
-  char *name = ast_get_inlined_data(a, pos, &name_len);
-  val_t tmp = V7_UNDEFINED;
   struct v7 *v7 = bbuilder->v7;
 
-  for (p = name + name_len - 1; *p != '/';) p--;
+  tag = fetch_tag(v7, bbuilder, a, ppos, &pos_after_tag);
 
-  V7_TRY(v7_mk_regexp(bbuilder->v7, name + 1, p - (name + 1), p + 1,
-                      (name + name_len) - p - 1, &tmp));
+  mbuf_init(&case_labels, 0);
 
-  *res = bcode_add_lit(bbuilder, tmp);
+  switch (tag) {
+    /*
+     * if(E) {
+     *   BT...
+     * } else {
+     *   BF...
+     * }
+     *
+     * ->
+     *
+     *   <E>
+     *   JMP_FALSE body
+     *   <BT>
+     *   JMP end
+     * body:
+     *   <BF>
+     * end:
+     *
+     * If else clause is omitted, it will emit output equivalent to:
+     *
+     * if(E) {BT} else undefined;
+     */
+    case AST_IF: {
+      ast_off_t if_false;
+      bcode_off_t end_label, if_false_label;
+      end = ast_get_skip(a, pos_after_tag, AST_END_SKIP);
+      if_false = ast_get_skip(a, pos_after_tag, AST_END_IF_TRUE_SKIP);
 
-clean:
-  return rcode;
-}
-#endif
+      V7_TRY(compile_expr_builder(bbuilder, a, ppos));
+      if_false_label = bcode_op_target(bbuilder, OP_JMP_FALSE);
 
-#ifndef V7_DISABLE_LINE_NUMBERS
-static void append_lineno_if_changed(struct v7 *v7,
-                                     struct bcode_builder *bbuilder,
-                                     int line_no) {
-  (void) v7;
-  if (line_no != 0 && line_no != v7->line_no) {
-    v7->line_no = line_no;
-    bcode_append_lineno(bbuilder, line_no);
-  }
-}
-#else
-static void append_lineno_if_changed(struct v7 *v7,
-                                     struct bcode_builder *bbuilder,
-                                     int line_no) {
-  (void) v7;
-  (void) bbuilder;
-  (void) line_no;
-}
-#endif
+      /* body if true */
+      V7_TRY(compile_stmts(bbuilder, a, ppos, if_false));
 
-static enum ast_tag fetch_tag(struct v7 *v7, struct bcode_builder *bbuilder,
-                              struct ast *a, ast_off_t *ppos,
-                              ast_off_t *ppos_after_tag) {
-  enum ast_tag ret = ast_fetch_tag(a, ppos);
-  int line_no = ast_get_line_no(a, *ppos);
-  append_lineno_if_changed(v7, bbuilder, line_no);
-  if (ppos_after_tag != NULL) {
-    *ppos_after_tag = *ppos;
-  }
-  ast_move_to_children(a, ppos);
-  return ret;
-}
+      if (if_false != end) {
+        /* `else` branch is present */
+        end_label = bcode_op_target(bbuilder, OP_JMP);
 
-/*
- * a++ and a-- need to ignore the updated value.
- *
- * Call this before updating the lhs.
- */
-static void fixup_post_op(struct bcode_builder *bbuilder, enum ast_tag tag) {
-  if (tag == AST_POSTINC || tag == AST_POSTDEC) {
-    bcode_op(bbuilder, OP_UNSTASH);
-  }
-}
+        /* will jump here if `false` */
+        bcode_patch_target(bbuilder, if_false_label, bcode_pos(bbuilder));
 
-/*
- * evaluate rhs expression.
- * ++a and a++ are equivalent to a+=1
- */
-static enum v7_err eval_assign_rhs(struct bcode_builder *bbuilder,
-                                   struct ast *a, ast_off_t *ppos,
-                                   enum ast_tag tag) {
-  enum v7_err rcode = V7_OK;
-  struct v7 *v7 = bbuilder->v7;
+        /* body if false */
+        V7_TRY(compile_stmts(bbuilder, a, ppos, end));
 
-  /* a++ and a-- need to preserve initial value. */
-  if (tag == AST_POSTINC || tag == AST_POSTDEC) {
-    bcode_op(bbuilder, OP_STASH);
-  }
-  if (tag >= AST_PREINC && tag <= AST_POSTDEC) {
-    bcode_op(bbuilder, OP_PUSH_ONE);
-  } else {
-    V7_TRY(compile_expr_builder(bbuilder, a, ppos));
-  }
+        bcode_patch_target(bbuilder, end_label, bcode_pos(bbuilder));
+      } else {
+        /*
+         * `else` branch is not present: just remember where we should
+         * jump in case of `false`
+         */
+        bcode_patch_target(bbuilder, if_false_label, bcode_pos(bbuilder));
+      }
 
-  switch (tag) {
-    case AST_PREINC:
-    case AST_POSTINC:
-      bcode_op(bbuilder, OP_ADD);
-      break;
-    case AST_PREDEC:
-    case AST_POSTDEC:
-      bcode_op(bbuilder, OP_SUB);
-      break;
-    case AST_ASSIGN:
-      /* no operation */
+      bbuilder->v7->is_stack_neutral = 1;
       break;
-    default:
-      binary_op(bbuilder, assign_ast_map[tag - AST_ASSIGN - 1]);
-  }
+    }
+    /*
+     * while(C) {
+     *   B...
+     * }
+     *
+     * ->
+     *
+     *   TRY_PUSH_LOOP end
+     *   JMP cond
+     * body:
+     *   <B>
+     * cond:
+     *   <C>
+     *   JMP_TRUE body
+     * end:
+     *   JMP_IF_CONTINUE cond
+     *   TRY_POP
+     *
+     */
+    case AST_WHILE: {
+      bcode_off_t end_label, continue_label, continue_target;
 
-clean:
-  return rcode;
-}
+      end = ast_get_skip(a, pos_after_tag, AST_END_SKIP);
+      cond = *ppos;
+      ast_skip_tree(a, ppos);
 
-static enum v7_err compile_assign(struct bcode_builder *bbuilder, struct ast *a,
-                                  ast_off_t *ppos, enum ast_tag tag) {
-  lit_t lit;
-  enum ast_tag ntag;
-  enum v7_err rcode = V7_OK;
-  struct v7 *v7 = bbuilder->v7;
-  ast_off_t pos_after_tag;
+      end_label = bcode_op_target(bbuilder, OP_TRY_PUSH_LOOP);
 
-  ntag = fetch_tag(v7, bbuilder, a, ppos, &pos_after_tag);
+      /*
+       * Condition check is at the end of the loop, this layout
+       * reduces the number of jumps in the steady state.
+       */
+      cond_label = bcode_op_target(bbuilder, OP_JMP);
+      body_target = bcode_pos(bbuilder);
 
-  switch (ntag) {
-    case AST_IDENT:
-      lit = string_lit(bbuilder, a, pos_after_tag);
-      if (tag != AST_ASSIGN) {
-        bcode_op_lit(bbuilder, OP_GET_VAR, lit);
-      }
+      V7_TRY(compile_stmts(bbuilder, a, ppos, end));
 
-      V7_TRY(eval_assign_rhs(bbuilder, a, ppos, tag));
-      bcode_op_lit(bbuilder, OP_SET_VAR, lit);
+      continue_target = bcode_pos(bbuilder);
+      bcode_patch_target(bbuilder, cond_label, continue_target);
 
-      fixup_post_op(bbuilder, tag);
-      break;
-    case AST_MEMBER:
-    case AST_INDEX:
-      switch (ntag) {
-        case AST_MEMBER:
-          lit = string_lit(bbuilder, a, pos_after_tag);
-          V7_TRY(compile_expr_builder(bbuilder, a, ppos));
-          bcode_push_lit(bbuilder, lit);
-          break;
-        case AST_INDEX:
-          V7_TRY(compile_expr_builder(bbuilder, a, ppos));
-          V7_TRY(compile_expr_builder(bbuilder, a, ppos));
-          break;
-        default:
-          /* unreachable, compilers are dumb */
-          V7_THROW(V7_SYNTAX_ERROR);
-      }
-      if (tag != AST_ASSIGN) {
-        bcode_op(bbuilder, OP_2DUP);
-        bcode_op(bbuilder, OP_GET);
-      }
+      V7_TRY(compile_expr_builder(bbuilder, a, &cond));
+      body_label = bcode_op_target(bbuilder, OP_JMP_TRUE);
+      bcode_patch_target(bbuilder, body_label, body_target);
 
-      V7_TRY(eval_assign_rhs(bbuilder, a, ppos, tag));
-      bcode_op(bbuilder, OP_SET);
+      bcode_patch_target(bbuilder, end_label, bcode_pos(bbuilder));
+      continue_label = bcode_op_target(bbuilder, OP_JMP_IF_CONTINUE);
+      bcode_patch_target(bbuilder, continue_label, continue_target);
+      bcode_op(bbuilder, OP_TRY_POP);
 
-      fixup_post_op(bbuilder, tag);
+      bbuilder->v7->is_stack_neutral = 1;
       break;
-    default:
-      /* We end up here on expressions like `1 = 2;`, it's a ReferenceError */
-      rcode = v7_throwf(bbuilder->v7, REFERENCE_ERROR, "unexpected ast node");
-      V7_THROW(V7_SYNTAX_ERROR);
-  }
-clean:
-  return rcode;
-}
-
-/*
- * Walks through all declarations (`var` and `function`) in the current scope,
- * and adds names of all of them to `bcode->ops`. Additionally, `function`
- * declarations are compiled right here, since they're hoisted in JS.
- */
-static enum v7_err compile_local_vars(struct bcode_builder *bbuilder,
-                                      struct ast *a, ast_off_t start,
-                                      ast_off_t fvar) {
-  ast_off_t next, fvar_end;
-  char *name;
-  size_t name_len;
-  lit_t lit;
-  enum v7_err rcode = V7_OK;
-  struct v7 *v7 = bbuilder->v7;
-  size_t names_end = 0;
-  ast_off_t pos_after_tag;
-
-  /* calculate `names_end`: offset at which names in `bcode->ops` end */
-  names_end =
-      (size_t)(bcode_end_names(bbuilder->ops.buf, bbuilder->bcode->names_cnt) -
-               bbuilder->ops.buf);
+    }
+    case AST_BREAK:
+      bcode_op(bbuilder, OP_BREAK);
+      break;
+    case AST_CONTINUE:
+      bcode_op(bbuilder, OP_CONTINUE);
+      break;
+    /*
+     * Frame objects (`v7->vals.call_stack`) contain one more hidden property:
+     * `____t`, which is an array of offsets in bcode. Each element of the array
+     * is an offset of either `catch` or `finally` block (distinguished by the
+     * tag: `OFFSET_TAG_CATCH` or `OFFSET_TAG_FINALLY`). Let's call this array
+     * as a "try stack". When evaluator enters new `try` block, it adds
+     * appropriate offset(s) at the top of "try stack", and when we unwind the
+     * stack, we can "pop" offsets from "try stack" at each level.
+     *
+     * try {
+     *   TRY_B
+     * } catch (e) {
+     *   CATCH_B
+     * } finally {
+     *   FIN_B
+     * }
+     *
+     * ->
+     *    OP_TRY_PUSH_FINALLY finally
+     *    OP_TRY_PUSH_CATCH catch
+     *    <TRY_B>
+     *    OP_TRY_POP
+     *    JMP finally
+     *  catch:
+     *    OP_TRY_POP
+     *    OP_ENTER_CATCH <e>
+     *    <CATCH_B>
+     *    OP_EXIT_CATCH
+     *  finally:
+     *    OP_TRY_POP
+     *    <FIN_B>
+     *    OP_AFTER_FINALLY
+     *
+     * ---------------
+     *
+     * try {
+     *   TRY_B
+     * } catch (e) {
+     *   CATCH_B
+     * }
+     *
+     * ->
+     *    OP_TRY_PUSH_CATCH catch
+     *    <TRY_B>
+     *    OP_TRY_POP
+     *    JMP end
+     *  catch:
+     *    OP_TRY_POP
+     *    OP_ENTER_CATCH <e>
+     *    <CATCH_B>
+     *    OP_EXIT_CATCH
+     *  end:
+     *
+     * ---------------
+     *
+     * try {
+     *   TRY_B
+     * } finally {
+     *   FIN_B
+     * }
+     *
+     * ->
+     *    OP_TRY_PUSH_FINALLY finally
+     *    <TRY_B>
+     *  finally:
+     *    OP_TRY_POP
+     *    <FIN_B>
+     *    OP_AFTER_FINALLY
+     */
+    case AST_TRY: {
+      ast_off_t acatch, afinally;
+      bcode_off_t finally_label, catch_label;
 
-  if (fvar != start) {
-    /* iterate all `AST_VAR`s in the current scope */
-    do {
-      V7_CHECK_INTERNAL(fetch_tag(v7, bbuilder, a, &fvar, &pos_after_tag) ==
-                        AST_VAR);
+      end = ast_get_skip(a, pos_after_tag, AST_END_SKIP);
+      acatch = ast_get_skip(a, pos_after_tag, AST_TRY_CATCH_SKIP);
+      afinally = ast_get_skip(a, pos_after_tag, AST_TRY_FINALLY_SKIP);
 
-      next = ast_get_skip(a, pos_after_tag, AST_VAR_NEXT_SKIP);
-      if (next == pos_after_tag) {
-        next = 0;
+      if (afinally != end) {
+        /* `finally` clause is present: push its offset */
+        finally_label = bcode_op_target(bbuilder, OP_TRY_PUSH_FINALLY);
       }
 
-      fvar_end = ast_get_skip(a, pos_after_tag, AST_END_SKIP);
-
-      /*
-       * iterate all `AST_VAR_DECL`s and `AST_FUNC_DECL`s in the current
-       * `AST_VAR`
-       */
-      while (fvar < fvar_end) {
-        enum ast_tag tag = fetch_tag(v7, bbuilder, a, &fvar, &pos_after_tag);
-        V7_CHECK_INTERNAL(tag == AST_VAR_DECL || tag == AST_FUNC_DECL);
-        name = ast_get_inlined_data(a, pos_after_tag, &name_len);
-        if (tag == AST_VAR_DECL) {
-          /*
-           * it's a `var` declaration, so, skip the value for now, it'll be set
-           * to `undefined` initially
-           */
-          ast_skip_tree(a, &fvar);
-        } else {
-          /*
-           * tag is an AST_FUNC_DECL: since functions in JS are hoisted,
-           * we compile it and put `OP_SET_VAR` directly here
-           */
-          lit = string_lit(bbuilder, a, pos_after_tag);
-          V7_TRY(compile_expr_builder(bbuilder, a, &fvar));
-          bcode_op_lit(bbuilder, OP_SET_VAR, lit);
-
-          /* function declarations are stack-neutral */
-          bcode_op(bbuilder, OP_DROP);
-          /*
-           * Note: the `is_stack_neutral` flag will be set by `compile_stmt`
-           * later, when it encounters `AST_FUNC_DECL` again.
-           */
-        }
-        V7_TRY(bcode_add_name(bbuilder, name, name_len, &names_end));
+      if (acatch != afinally) {
+        /* `catch` clause is present: push its offset */
+        catch_label = bcode_op_target(bbuilder, OP_TRY_PUSH_CATCH);
       }
 
-      if (next > 0) {
-        fvar = next - 1;
-      }
+      /* compile statements of `try` block */
+      V7_TRY(compile_stmts(bbuilder, a, ppos, acatch));
 
-    } while (next != 0);
-  }
+      if (acatch != afinally) {
+        /* `catch` clause is present: compile it */
+        bcode_off_t after_catch_label;
 
-clean:
-  return rcode;
-}
+        /*
+         * pop offset pushed by OP_TRY_PUSH_CATCH, and jump over the `catch`
+         * block
+         */
+        bcode_op(bbuilder, OP_TRY_POP);
+        after_catch_label = bcode_op_target(bbuilder, OP_JMP);
 
-/*
- * Just like `compile_expr_builder`, but it takes additional argument:
- *`for_call`.
- * If it's non-zero, the stack is additionally populated with `this` value
- * for call.
- *
- * If there is a refinement (a dot, or a subscript), then it'll be the
- * appropriate object. Otherwise, it's `undefined`.
- *
- * In non-strict mode, `undefined` will be changed to Global Object at runtime,
- * see `OP_CALL` handling in `eval_bcode()`.
- */
-V7_PRIVATE enum v7_err compile_expr_ext(struct bcode_builder *bbuilder,
-                                        struct ast *a, ast_off_t *ppos,
-                                        uint8_t for_call) {
-  enum v7_err rcode = V7_OK;
-  struct v7 *v7 = bbuilder->v7;
-  ast_off_t pos_after_tag;
-  enum ast_tag tag = fetch_tag(v7, bbuilder, a, ppos, &pos_after_tag);
+        /* --- catch --- */
 
-  switch (tag) {
-    case AST_MEMBER: {
-      lit_t lit = string_lit(bbuilder, a, pos_after_tag);
-      V7_TRY(compile_expr_builder(bbuilder, a, ppos));
-      if (for_call) {
-        /* current TOS will be used as `this` */
-        bcode_op(bbuilder, OP_DUP);
-      }
-      bcode_push_lit(bbuilder, lit);
-      bcode_op(bbuilder, OP_GET);
-      break;
-    }
+        /* in case of exception in the `try` block above, we'll get here */
+        bcode_patch_target(bbuilder, catch_label, bcode_pos(bbuilder));
 
-    case AST_INDEX:
-      V7_TRY(compile_expr_builder(bbuilder, a, ppos));
-      if (for_call) {
-        /* current TOS will be used as `this` */
-        bcode_op(bbuilder, OP_DUP);
-      }
-      V7_TRY(compile_expr_builder(bbuilder, a, ppos));
-      bcode_op(bbuilder, OP_GET);
-      break;
+        /* pop offset pushed by OP_TRY_PUSH_CATCH */
+        bcode_op(bbuilder, OP_TRY_POP);
 
-    default:
-      if (for_call) {
         /*
-         * `this` will be an `undefined` (but it may change to Global Object
-         * at runtime)
+         * retrieve identifier where to store thrown error, and make sure
+         * it is actually an indentifier (AST_IDENT)
          */
-        bcode_op(bbuilder, OP_PUSH_UNDEFINED);
-      }
-      *ppos = pos_after_tag - 1;
-      V7_TRY(compile_expr_builder(bbuilder, a, ppos));
-      break;
-  }
-
-clean:
-  return rcode;
-}
+        tag = fetch_tag(v7, bbuilder, a, ppos, &pos_after_tag);
+        V7_CHECK(tag == AST_IDENT, V7_SYNTAX_ERROR);
 
-V7_PRIVATE enum v7_err compile_delete(struct bcode_builder *bbuilder,
-                                      struct ast *a, ast_off_t *ppos) {
-  enum v7_err rcode = V7_OK;
-  struct v7 *v7 = bbuilder->v7;
-  ast_off_t pos_after_tag;
-  enum ast_tag tag = fetch_tag(v7, bbuilder, a, ppos, &pos_after_tag);
+        /*
+         * when we enter `catch` block, the TOS contains thrown value.
+         * We should create private frame for the `catch` clause, and populate
+         * a variable with the thrown value there.
+         * The `OP_ENTER_CATCH` opcode does just that.
+         */
+        bcode_op_lit(bbuilder, OP_ENTER_CATCH,
+                     string_lit(bbuilder, a, pos_after_tag));
 
-  switch (tag) {
-    case AST_MEMBER: {
-      /* Delete a specified property of an object */
-      lit_t lit = string_lit(bbuilder, a, pos_after_tag);
-      /* put an object to delete property from */
-      V7_TRY(compile_expr_builder(bbuilder, a, ppos));
-      /* put a property name */
-      bcode_push_lit(bbuilder, lit);
-      bcode_op(bbuilder, OP_DELETE);
-      break;
-    }
+        /*
+         * compile statements until the end of `catch` clause
+         * (`afinally` points to the end of the `catch` clause independently
+         * of whether the `finally` clause is present)
+         */
+        V7_TRY(compile_stmts(bbuilder, a, ppos, afinally));
 
-    case AST_INDEX:
-      /* Delete a specified property of an object */
-      /* put an object to delete property from */
-      V7_TRY(compile_expr_builder(bbuilder, a, ppos));
-      /* put a property name */
-      V7_TRY(compile_expr_builder(bbuilder, a, ppos));
-      bcode_op(bbuilder, OP_DELETE);
-      break;
+        /* pop private frame */
+        bcode_op(bbuilder, OP_EXIT_CATCH);
 
-    case AST_IDENT:
-      /* Delete the scope variable (or throw an error if strict mode) */
-      if (!bbuilder->bcode->strict_mode) {
-        /* put a property name */
-        bcode_push_lit(bbuilder, string_lit(bbuilder, a, pos_after_tag));
-        bcode_op(bbuilder, OP_DELETE_VAR);
-      } else {
-        rcode =
-            v7_throwf(bbuilder->v7, SYNTAX_ERROR,
-                      "Delete of an unqualified identifier in strict mode.");
-        V7_THROW(V7_SYNTAX_ERROR);
+        bcode_patch_target(bbuilder, after_catch_label, bcode_pos(bbuilder));
       }
-      break;
 
-    case AST_UNDEFINED:
-      /*
-       * `undefined` should actually be an undeletable property of the Global
-       * Object, so, trying to delete it just yields `false`
-       */
-      bcode_op(bbuilder, OP_PUSH_FALSE);
-      break;
+      if (afinally != end) {
+        /* `finally` clause is present: compile it */
 
-    default:
-      /*
-       * For all other cases, we evaluate the expression given to `delete`
-       * for side effects, then drop the result, and yield `true`
-       */
-      *ppos = pos_after_tag - 1;
-      V7_TRY(compile_expr_builder(bbuilder, a, ppos));
-      bcode_op(bbuilder, OP_DROP);
-      bcode_op(bbuilder, OP_PUSH_TRUE);
-      break;
-  }
+        /* --- finally --- */
 
-clean:
-  return rcode;
-}
+        /* after the `try` block above executes, we'll get here */
+        bcode_patch_target(bbuilder, finally_label, bcode_pos(bbuilder));
 
-V7_PRIVATE enum v7_err compile_expr_builder(struct bcode_builder *bbuilder,
-                                            struct ast *a, ast_off_t *ppos) {
-  enum v7_err rcode = V7_OK;
-  struct v7 *v7 = bbuilder->v7;
-  ast_off_t pos_after_tag;
-  enum ast_tag tag = fetch_tag(v7, bbuilder, a, ppos, &pos_after_tag);
+        /* pop offset pushed by OP_TRY_PUSH_FINALLY */
+        bcode_op(bbuilder, OP_TRY_POP);
 
-  switch (tag) {
-    case AST_ADD:
-    case AST_SUB:
-    case AST_REM:
-    case AST_MUL:
-    case AST_DIV:
-    case AST_LSHIFT:
-    case AST_RSHIFT:
-    case AST_URSHIFT:
-    case AST_OR:
-    case AST_XOR:
-    case AST_AND:
-    case AST_EQ_EQ:
-    case AST_EQ:
-    case AST_NE:
-    case AST_NE_NE:
-    case AST_LT:
-    case AST_LE:
-    case AST_GT:
-    case AST_GE:
-    case AST_INSTANCEOF:
-      V7_TRY(compile_binary(bbuilder, a, ppos, tag));
-      break;
-    case AST_LOGICAL_NOT:
-      V7_TRY(compile_expr_builder(bbuilder, a, ppos));
-      bcode_op(bbuilder, OP_LOGICAL_NOT);
-      break;
-    case AST_NOT:
-      V7_TRY(compile_expr_builder(bbuilder, a, ppos));
-      bcode_op(bbuilder, OP_NOT);
-      break;
-    case AST_POSITIVE:
-      V7_TRY(compile_expr_builder(bbuilder, a, ppos));
-      bcode_op(bbuilder, OP_POS);
-      break;
-    case AST_NEGATIVE:
-      V7_TRY(compile_expr_builder(bbuilder, a, ppos));
-      bcode_op(bbuilder, OP_NEG);
-      break;
-    case AST_IDENT:
-      bcode_op_lit(bbuilder, OP_GET_VAR,
-                   string_lit(bbuilder, a, pos_after_tag));
-      break;
-    case AST_MEMBER:
-    case AST_INDEX:
-      /*
-       * These two are handled by the "extended" version of this function,
-       * since we may need to put `this` value on stack, for "method pattern
-       * invocation".
-       *
-       * First of all, restore starting AST position, and then call extended
-       * function.
-       */
-      *ppos = pos_after_tag - 1;
-      V7_TRY(compile_expr_ext(bbuilder, a, ppos, 0 /*not for call*/));
-      break;
-    case AST_IN:
-      V7_TRY(compile_expr_builder(bbuilder, a, ppos));
-      V7_TRY(compile_expr_builder(bbuilder, a, ppos));
-      bcode_op(bbuilder, OP_IN);
-      break;
-    case AST_TYPEOF: {
-      ast_off_t lookahead = *ppos;
-      tag = fetch_tag(v7, bbuilder, a, &lookahead, &pos_after_tag);
-      if (tag == AST_IDENT) {
-        *ppos = lookahead;
-        bcode_op_lit(bbuilder, OP_SAFE_GET_VAR,
-                     string_lit(bbuilder, a, pos_after_tag));
-      } else {
-        V7_TRY(compile_expr_builder(bbuilder, a, ppos));
+        /* compile statements until the end of `finally` clause */
+        V7_TRY(compile_stmts(bbuilder, a, ppos, end));
+
+        bcode_op(bbuilder, OP_AFTER_FINALLY);
       }
-      bcode_op(bbuilder, OP_TYPEOF);
-      break;
-    }
-    case AST_ASSIGN:
-    case AST_PREINC:
-    case AST_PREDEC:
-    case AST_POSTINC:
-    case AST_POSTDEC:
-    case AST_REM_ASSIGN:
-    case AST_MUL_ASSIGN:
-    case AST_DIV_ASSIGN:
-    case AST_XOR_ASSIGN:
-    case AST_PLUS_ASSIGN:
-    case AST_MINUS_ASSIGN:
-    case AST_OR_ASSIGN:
-    case AST_AND_ASSIGN:
-    case AST_LSHIFT_ASSIGN:
-    case AST_RSHIFT_ASSIGN:
-    case AST_URSHIFT_ASSIGN:
-      V7_TRY(compile_assign(bbuilder, a, ppos, tag));
-      break;
-    case AST_COND: {
-      /*
-      * A ? B : C
-      *
-      * ->
-      *
-      *   <A>
-      *   JMP_FALSE false
-      *   <B>
-      *   JMP end
-      * false:
-      *   <C>
-      * end:
-      *
-      */
-      bcode_off_t false_label, end_label;
-      V7_TRY(compile_expr_builder(bbuilder, a, ppos));
-      false_label = bcode_op_target(bbuilder, OP_JMP_FALSE);
-      V7_TRY(compile_expr_builder(bbuilder, a, ppos));
-      end_label = bcode_op_target(bbuilder, OP_JMP);
-      bcode_patch_target(bbuilder, false_label, bcode_pos(bbuilder));
-      V7_TRY(compile_expr_builder(bbuilder, a, ppos));
-      bcode_patch_target(bbuilder, end_label, bcode_pos(bbuilder));
+
+      bbuilder->v7->is_stack_neutral = 1;
       break;
     }
-    case AST_LOGICAL_OR:
-    case AST_LOGICAL_AND: {
-      /*
-       * A && B
-       *
-       * ->
-       *
-       *   <A>
-       *   JMP_FALSE end
-       *   POP
-       *   <B>
-       * end:
-       *
-       */
-      bcode_off_t end_label;
-      V7_TRY(compile_expr_builder(bbuilder, a, ppos));
-      bcode_op(bbuilder, OP_DUP);
-      end_label = bcode_op_target(
-          bbuilder, tag == AST_LOGICAL_AND ? OP_JMP_FALSE : OP_JMP_TRUE);
-      bcode_op(bbuilder, OP_DROP);
+
+    case AST_THROW: {
       V7_TRY(compile_expr_builder(bbuilder, a, ppos));
-      bcode_patch_target(bbuilder, end_label, bcode_pos(bbuilder));
+      bcode_op(bbuilder, OP_THROW);
       break;
     }
+
     /*
-     * A, B, C
+     * switch(E) {
+     * default:
+     *   D...
+     * case C1:
+     *   B1...
+     * case C2:
+     *   B2...
+     * }
      *
      * ->
      *
-     * <A>
-     * DROP
-     * <B>
-     * DROP
-     * <C>
+     *   TRY_PUSH_SWITCH end
+     *   <E>
+     *   DUP
+     *   <C1>
+     *   EQ
+     *   JMP_TRUE_DROP l1
+     *   DUP
+     *   <C2>
+     *   EQ
+     *   JMP_TRUE_DROP l2
+     *   DROP
+     *   JMP dfl
+     *
+     * dfl:
+     *   <D>
+     *
+     * l1:
+     *   <B1>
+     *
+     * l2:
+     *   <B2>
+     *
+     * end:
+     *   TRY_POP
+     *
+     * If the default case is missing we treat it as if had an empty body and
+     * placed in last position (i.e. `dfl` label is replaced with `end`).
+     *
+     * Before emitting a case/default block (except the first one) we have to
+     * drop the TOS resulting from evaluating the last expression
      */
-    case AST_SEQ: {
-      ast_off_t end = ast_get_skip(a, pos_after_tag, AST_END_SKIP);
-      while (*ppos < end) {
-        V7_TRY(compile_expr_builder(bbuilder, a, ppos));
-        if (*ppos < end) {
-          bcode_op(bbuilder, OP_DROP);
-        }
-      }
-      break;
-    }
-    case AST_CALL:
-    case AST_NEW: {
-      /*
-       * f()
-       *
-       * ->
-       *
-       *  PUSH_UNDEFINED (value for `this`)
-       *  GET_VAR "f"
-       *  CHECK_CALL
-       *  CALL 0 args
-       *
-       * ---------------
-       *
-       * f(a, b)
-       *
-       * ->
-       *
-       *  PUSH_UNDEFINED (value for `this`)
-       *  GET_VAR "f"
-       *  CHECK_CALL
-       *  GET_VAR "a"
-       *  GET_VAR "b"
-       *  CALL 2 args
-       *
-       * ---------------
-       *
-       * o.f(a, b)
-       *
-       * ->
-       *
-       *  GET_VAR "o" (so that `this` will be an `o`)
-       *  DUP         (we'll also need `o` for GET below, so, duplicate it)
-       *  PUSH_LIT "f"
-       *  GET         (get property "f" of the object "o")
-       *  CHECK_CALL
-       *  GET_VAR "a"
-       *  GET_VAR "b"
-       *  CALL 2 args
-       *
-       */
-      int args;
-      ast_off_t end = ast_get_skip(a, pos_after_tag, AST_END_SKIP);
+    case AST_SWITCH: {
+      bcode_off_t dfl_label, end_label;
+      ast_off_t case_end, case_start;
+      enum ast_tag case_tag;
+      int i, has_default = 0, cases = 0;
 
-      V7_TRY(compile_expr_ext(bbuilder, a, ppos, 1 /*for call*/));
-      bcode_op(bbuilder, OP_CHECK_CALL);
-      for (args = 0; *ppos < end; args++) {
-        V7_TRY(compile_expr_builder(bbuilder, a, ppos));
-      }
-      bcode_op(bbuilder, (tag == AST_CALL ? OP_CALL : OP_NEW));
-      if (args > 0x7f) {
-        rcode = v7_throwf(bbuilder->v7, SYNTAX_ERROR, "too many arguments");
-        V7_THROW(V7_SYNTAX_ERROR);
-      }
-      bcode_op(bbuilder, (uint8_t) args);
-      break;
-    }
-    case AST_DELETE: {
-      V7_TRY(compile_delete(bbuilder, a, ppos));
-      break;
-    }
-    case AST_OBJECT: {
-      /*
-       * {a:<B>, ...}
-       *
-       * ->
-       *
-       *   CREATE_OBJ
-       *   DUP
-       *   PUSH_LIT "a"
-       *   <B>
-       *   SET
-       *   POP
-       *   ...
-       */
+      end = ast_get_skip(a, pos_after_tag, AST_END_SKIP);
 
-      /*
-       * Literal indices of property names of current object literal.
-       * Needed for strict mode: we need to keep track of the added
-       * properties, since duplicates are not allowed
-       */
-      struct mbuf cur_literals;
-      lit_t lit;
-      ast_off_t end = ast_get_skip(a, pos_after_tag, AST_END_SKIP);
-      mbuf_init(&cur_literals, 0);
+      end_label = bcode_op_target(bbuilder, OP_TRY_PUSH_SWITCH);
 
-      bcode_op(bbuilder, OP_CREATE_OBJ);
+      V7_TRY(compile_expr_builder(bbuilder, a, ppos));
+
+      case_start = *ppos;
+      /* first pass: evaluate case expression and generate jump table */
       while (*ppos < end) {
-        tag = fetch_tag(v7, bbuilder, a, ppos, &pos_after_tag);
-        switch (tag) {
-          case AST_PROP:
+        case_tag = fetch_tag(v7, bbuilder, a, ppos, &pos_after_tag);
+        assert(case_tag == AST_DEFAULT || case_tag == AST_CASE);
+
+        case_end = ast_get_skip(a, pos_after_tag, AST_END_SKIP);
+
+        switch (case_tag) {
+          case AST_DEFAULT:
+            /* default jump table entry must be the last one */
+            break;
+          case AST_CASE: {
+            bcode_off_t case_label;
             bcode_op(bbuilder, OP_DUP);
-            lit = string_lit(bbuilder, a, pos_after_tag);
+            V7_TRY(compile_expr_builder(bbuilder, a, ppos));
+            bcode_op(bbuilder, OP_EQ);
+            case_label = bcode_op_target(bbuilder, OP_JMP_TRUE_DROP);
+            cases++;
+            mbuf_append(&case_labels, &case_label, sizeof(case_label));
+            break;
+          }
+          default:
+            assert(case_tag == AST_DEFAULT || case_tag == AST_CASE);
+        }
+        *ppos = case_end;
+      }
 
-/* disabled because we broke get_lit */
-#if 0
-            if (bbuilder->bcode->strict_mode) {
-              /*
-               * In strict mode, check for duplicate property names in
-               * object literals
-               */
-              char *plit;
-              for (plit = (char *) cur_literals.buf;
-                   (char *) plit < cur_literals.buf + cur_literals.len;
-                   plit++) {
-                const char *str1, *str2;
-                size_t size1, size2;
-                v7_val_t val1, val2;
+      /* jmp table epilogue: unconditional jump to default case */
+      bcode_op(bbuilder, OP_DROP);
+      dfl_label = bcode_op_target(bbuilder, OP_JMP);
 
-                val1 = bcode_get_lit(bbuilder->bcode, lit);
-                str1 = v7_get_string(bbuilder->v7, &val1, &size1);
+      *ppos = case_start;
+      /* second pass: emit case bodies and patch jump table */
 
-                val2 = bcode_get_lit(bbuilder->bcode, *plit);
-                str2 = v7_get_string(bbuilder->v7, &val2, &size2);
+      for (i = 0; *ppos < end;) {
+        case_tag = fetch_tag(v7, bbuilder, a, ppos, &pos_after_tag);
+        assert(case_tag == AST_DEFAULT || case_tag == AST_CASE);
+        assert(i <= cases);
 
-                if (size1 == size2 && memcmp(str1, str2, size1) == 0) {
-                  /* found already existing property of the same name */
-                  rcode = v7_throwf(bbuilder->v7, SYNTAX_ERROR,
-                                    "duplicate data property in object literal "
-                                    "is not allowed in strict mode");
-                  V7_THROW2(V7_SYNTAX_ERROR, ast_object_clean);
-                }
-              }
-              mbuf_append(&cur_literals, &lit, sizeof(lit));
-            }
-#endif
-            bcode_push_lit(bbuilder, lit);
-            V7_TRY(compile_expr_builder(bbuilder, a, ppos));
-            bcode_op(bbuilder, OP_SET);
-            bcode_op(bbuilder, OP_DROP);
+        case_end = ast_get_skip(a, pos_after_tag, AST_END_SKIP);
+
+        switch (case_tag) {
+          case AST_DEFAULT:
+            has_default = 1;
+            bcode_patch_target(bbuilder, dfl_label, bcode_pos(bbuilder));
+            V7_TRY(compile_stmts(bbuilder, a, ppos, case_end));
+            break;
+          case AST_CASE: {
+            bcode_off_t case_label = ((bcode_off_t *) case_labels.buf)[i++];
+            bcode_patch_target(bbuilder, case_label, bcode_pos(bbuilder));
+            ast_skip_tree(a, ppos);
+            V7_TRY(compile_stmts(bbuilder, a, ppos, case_end));
             break;
+          }
           default:
-            rcode = v7_throwf(bbuilder->v7, SYNTAX_ERROR, "not implemented");
-            V7_THROW2(V7_SYNTAX_ERROR, ast_object_clean);
+            assert(case_tag == AST_DEFAULT || case_tag == AST_CASE);
         }
+
+        *ppos = case_end;
       }
+      mbuf_free(&case_labels);
 
-    ast_object_clean:
-      mbuf_free(&cur_literals);
-      if (rcode != V7_OK) {
-        V7_THROW(rcode);
+      if (!has_default) {
+        bcode_patch_target(bbuilder, dfl_label, bcode_pos(bbuilder));
       }
+
+      bcode_patch_target(bbuilder, end_label, bcode_pos(bbuilder));
+      bcode_op(bbuilder, OP_TRY_POP);
+
+      bbuilder->v7->is_stack_neutral = 1;
       break;
     }
-    case AST_ARRAY: {
+    /*
+     * for(INIT,COND,IT) {
+     *   B...
+     * }
+     *
+     * ->
+     *
+     *   <INIT>
+     *   DROP
+     *   TRY_PUSH_LOOP end
+     *   JMP cond
+     * body:
+     *   <B>
+     * next:
+     *   <IT>
+     *   DROP
+     * cond:
+     *   <COND>
+     *   JMP_TRUE body
+     * end:
+     *   JMP_IF_CONTINUE next
+     *   TRY_POP
+     *
+     */
+    case AST_FOR: {
+      ast_off_t iter, body, lookahead;
+      bcode_off_t end_label, continue_label, continue_target;
+      end = ast_get_skip(a, pos_after_tag, AST_END_SKIP);
+      body = ast_get_skip(a, pos_after_tag, AST_FOR_BODY_SKIP);
+
+      lookahead = *ppos;
+      tag = fetch_tag(v7, bbuilder, a, &lookahead, &pos_after_tag);
       /*
-       * [<A>,,<B>,...]
-       *
-       * ->
-       *
-       *   CREATE_ARR
-       *   PUSH_ZERO
-       *
-       *   2DUP
-       *   <A>
-       *   SET
-       *   POP
-       *   PUSH_ONE
-       *   ADD
-       *
-       *   PUSH_ONE
-       *   ADD
-       *
-       *   2DUP
-       *   <B>
-       *   ...
-       *   POP // tmp index
-       *
-       * TODO(mkm): optimize this out. we can have more compact array push
-       * that uses a special marker value for missing array elements
-       * (which are not the same as undefined btw)
+       * Support for `var` declaration in INIT
        */
-      ast_off_t end = ast_get_skip(a, pos_after_tag, AST_END_SKIP);
-      bcode_op(bbuilder, OP_CREATE_ARR);
-      bcode_op(bbuilder, OP_PUSH_ZERO);
-      while (*ppos < end) {
-        ast_off_t lookahead = *ppos;
-        tag = fetch_tag(v7, bbuilder, a, &lookahead, &pos_after_tag);
-        if (tag != AST_NOP) {
-          bcode_op(bbuilder, OP_2DUP);
+      if (tag == AST_VAR) {
+        ast_off_t fvar_end, name_pos;
+
+        *ppos = lookahead;
+        fvar_end = ast_get_skip(a, pos_after_tag, AST_END_SKIP);
+
+        /*
+         * Iterate through all vars in the given `var` declaration: they are
+         * just like assigments here
+         */
+        while (*ppos < fvar_end) {
+          tag = fetch_tag(v7, bbuilder, a, ppos, &name_pos);
+          /* Only var declarations are allowed (not function declarations) */
+          V7_CHECK_INTERNAL(tag == AST_VAR_DECL);
           V7_TRY(compile_expr_builder(bbuilder, a, ppos));
-          bcode_op(bbuilder, OP_SET);
+
+          /* Just like an assigment */
+          compile_var_op(bbuilder, OP_SET_VAR, a, name_pos);
+
+          /* INIT is stack-neutral */
           bcode_op(bbuilder, OP_DROP);
-        } else {
-          *ppos = lookahead; /* skip nop */
         }
-        bcode_op(bbuilder, OP_PUSH_ONE);
-        bcode_op(bbuilder, OP_ADD);
+      } else {
+        /* normal expression in INIT (not `var` declaration) */
+        V7_TRY(compile_expr_builder(bbuilder, a, ppos));
+        /* INIT is stack-neutral */
+        bcode_op(bbuilder, OP_DROP);
       }
+      cond = *ppos;
+      ast_skip_tree(a, ppos);
+      iter = *ppos;
+      *ppos = body;
+
+      end_label = bcode_op_target(bbuilder, OP_TRY_PUSH_LOOP);
+      cond_label = bcode_op_target(bbuilder, OP_JMP);
+      body_target = bcode_pos(bbuilder);
+      V7_TRY(compile_stmts(bbuilder, a, ppos, end));
+
+      continue_target = bcode_pos(bbuilder);
+
+      V7_TRY(compile_expr_builder(bbuilder, a, &iter));
       bcode_op(bbuilder, OP_DROP);
-      break;
-    }
-    case AST_FUNC: {
-      lit_t flit;
+
+      bcode_patch_target(bbuilder, cond_label, bcode_pos(bbuilder));
 
       /*
-       * Create half-done function: without scope and prototype. The real
-       * function will be created from this one during bcode evaluation: see
-       * `bcode_instantiate_function()`.
+       * Handle for(INIT;;ITER)
        */
-      val_t funv = mk_js_function(bbuilder->v7, NULL, V7_UNDEFINED);
+      lookahead = cond;
+      tag = fetch_tag(v7, bbuilder, a, &lookahead, &pos_after_tag);
+      if (tag == AST_NOP) {
+        bcode_op(bbuilder, OP_JMP);
+      } else {
+        V7_TRY(compile_expr_builder(bbuilder, a, &cond));
+        bcode_op(bbuilder, OP_JMP_TRUE);
+      }
+      body_label = bcode_add_target(bbuilder);
+      bcode_patch_target(bbuilder, body_label, body_target);
+      bcode_patch_target(bbuilder, end_label, bcode_pos(bbuilder));
 
-      /* Create bcode in this half-done function */
-      struct v7_js_function *func = get_js_function_struct(funv);
-      func->bcode = (struct bcode *) calloc(1, sizeof(*bbuilder->bcode));
-      bcode_init(func->bcode, bbuilder->bcode->strict_mode,
-                 NULL /* will be set below */, 0);
-      bcode_copy_filename_from(func->bcode, bbuilder->bcode);
-      retain_bcode(bbuilder->v7, func->bcode);
-      flit = bcode_add_lit(bbuilder, funv);
+      continue_label = bcode_op_target(bbuilder, OP_JMP_IF_CONTINUE);
+      bcode_patch_target(bbuilder, continue_label, continue_target);
 
-      *ppos = pos_after_tag - 1;
-      V7_TRY(compile_function(v7, a, ppos, func->bcode));
-      bcode_push_lit(bbuilder, flit);
-      bcode_op(bbuilder, OP_FUNC_LIT);
+      bcode_op(bbuilder, OP_TRY_POP);
+
+      bbuilder->v7->is_stack_neutral = 1;
       break;
     }
-    case AST_THIS:
-      bcode_op(bbuilder, OP_PUSH_THIS);
-      break;
-    case AST_VOID:
-      V7_TRY(compile_expr_builder(bbuilder, a, ppos));
-      bcode_op(bbuilder, OP_DROP);
-      bcode_op(bbuilder, OP_PUSH_UNDEFINED);
-      break;
-    case AST_NULL:
-      bcode_op(bbuilder, OP_PUSH_NULL);
-      break;
-    case AST_NOP:
-    case AST_UNDEFINED:
-      bcode_op(bbuilder, OP_PUSH_UNDEFINED);
-      break;
-    case AST_TRUE:
-      bcode_op(bbuilder, OP_PUSH_TRUE);
-      break;
-    case AST_FALSE:
-      bcode_op(bbuilder, OP_PUSH_FALSE);
-      break;
-    case AST_NUM: {
-      double dv = ast_get_num(a, pos_after_tag);
-      if (dv == 0) {
-        bcode_op(bbuilder, OP_PUSH_ZERO);
-      } else if (dv == 1) {
-        bcode_op(bbuilder, OP_PUSH_ONE);
+    /*
+     * for(I in O) {
+     *   B...
+     * }
+     *
+     * ->
+     *
+     *   DUP
+     *   <O>
+     *   SWAP
+     *   STASH
+     *   DROP
+     *   PUSH_NULL
+     *   TRY_PUSH_LOOP brend
+     * loop:
+     *   NEXT_PROP
+     *   JMP_FALSE end
+     *   SET_VAR <I>
+     *   UNSTASH
+     *   <B>
+     * next:
+     *   STASH
+     *   DROP
+     *   JMP loop
+     * end:
+     *   UNSTASH
+     *   JMP try_pop:
+     * brend:
+     *              # got here after a `break` or `continue` from a loop body:
+     *   JMP_IF_CONTINUE next
+     *
+     *              # we're not going to `continue`, so, need to remove an
+     *              # extra stuff that was needed for the NEXT_PROP
+     *
+     *   SWAP_DROP  # drop handle
+     *   SWAP_DROP  # drop <O>
+     *   SWAP_DROP  # drop the value preceding the loop
+     * try_pop:
+     *   TRY_POP
+     *
+     */
+    case AST_FOR_IN: {
+      ast_off_t name_pos;
+      bcode_off_t loop_label, loop_target, end_label, brend_label,
+          continue_label, pop_label, continue_target;
+      ast_off_t end = ast_get_skip(a, pos_after_tag, AST_END_SKIP);
+
+      tag = fetch_tag(v7, bbuilder, a, ppos, &pos_after_tag);
+      /* TODO(mkm) accept any l-value */
+      if (tag == AST_VAR) {
+        tag = fetch_tag(v7, bbuilder, a, ppos, &name_pos);
+        V7_CHECK_INTERNAL(tag == AST_VAR_DECL);
+        ast_skip_tree(a, ppos);
       } else {
-        bcode_push_lit(bbuilder, bcode_add_lit(bbuilder, v7_mk_number(v7, dv)));
-      }
-      break;
-    }
-    case AST_STRING:
-      bcode_push_lit(bbuilder, string_lit(bbuilder, a, pos_after_tag));
-      break;
-    case AST_REGEX:
-#if V7_ENABLE__RegExp
-    {
-      lit_t tmp;
-      rcode = regexp_lit(bbuilder, a, pos_after_tag, &tmp);
-      if (rcode != V7_OK) {
-        rcode = V7_SYNTAX_ERROR;
-        goto clean;
+        V7_CHECK_INTERNAL(tag == AST_IDENT);
+        name_pos = pos_after_tag;
       }
 
-      bcode_push_lit(bbuilder, tmp);
-      break;
-    }
-#else
-      rcode =
-          v7_throwf(bbuilder->v7, SYNTAX_ERROR, "Regexp support is disabled");
-      V7_THROW(V7_SYNTAX_ERROR);
-#endif
-    case AST_LABEL:
-    case AST_LABELED_BREAK:
-    case AST_LABELED_CONTINUE:
-      /* TODO(dfrank): implement */
-      rcode = v7_throwf(bbuilder->v7, SYNTAX_ERROR, "not implemented");
-      V7_THROW(V7_SYNTAX_ERROR);
-    case AST_WITH:
-      rcode = v7_throwf(bbuilder->v7, SYNTAX_ERROR, "not implemented");
-      V7_THROW(V7_SYNTAX_ERROR);
-    default:
       /*
-       * We end up here if the AST is broken.
+       * preserve previous statement value.
+       * We need to feed the previous value into the stash
+       * because it's required for the loop steady state.
        *
-       * It might be appropriate to return `V7_INTERNAL_ERROR` here, but since
-       * we might receive AST from network or something, we just interpret
-       * it as SyntaxError.
+       * The stash register is required to simplify the steady state stack
+       * management, in particular the removal of value in 3rd position in case
+       * a of not taken exit.
+       *
+       * TODO(mkm): consider having a stash OP that moves a value to the stash
+       * register instead of copying it. The current behaviour has been
+       * optimized for the `assign` use case which seems more common.
        */
-      rcode = v7_throwf(bbuilder->v7, SYNTAX_ERROR, "unknown ast node %d",
-                        (int) tag);
-      V7_THROW(V7_SYNTAX_ERROR);
-  }
-clean:
-  return rcode;
-}
+      bcode_op(bbuilder, OP_DUP);
+      V7_TRY(compile_expr_builder(bbuilder, a, ppos));
+      bcode_op(bbuilder, OP_SWAP);
+      bcode_op(bbuilder, OP_STASH);
+      bcode_op(bbuilder, OP_DROP);
 
-V7_PRIVATE enum v7_err compile_stmt(struct bcode_builder *bbuilder,
-                                    struct ast *a, ast_off_t *ppos);
+      /*
+       * OP_NEXT_PROP keeps the current position in an opaque handler.
+       * Feeding a null as initial value.
+       */
+      bcode_op(bbuilder, OP_PUSH_NULL);
 
-V7_PRIVATE enum v7_err compile_stmts(struct bcode_builder *bbuilder,
-                                     struct ast *a, ast_off_t *ppos,
-                                     ast_off_t end) {
-  enum v7_err rcode = V7_OK;
-  struct v7 *v7 = bbuilder->v7;
+      brend_label = bcode_op_target(bbuilder, OP_TRY_PUSH_LOOP);
 
-  while (*ppos < end) {
-    V7_TRY(compile_stmt(bbuilder, a, ppos));
-    if (!bbuilder->v7->is_stack_neutral) {
-      bcode_op(bbuilder, OP_SWAP_DROP);
-    } else {
-      bbuilder->v7->is_stack_neutral = 0;
-    }
-  }
-clean:
-  return rcode;
-}
+      /* loop: */
+      loop_target = bcode_pos(bbuilder);
 
-V7_PRIVATE enum v7_err compile_stmt(struct bcode_builder *bbuilder,
-                                    struct ast *a, ast_off_t *ppos) {
-  ast_off_t end;
-  enum ast_tag tag;
-  ast_off_t cond, pos_after_tag;
-  bcode_off_t body_target, body_label, cond_label;
-  struct mbuf case_labels;
-  enum v7_err rcode = V7_OK;
-  struct v7 *v7 = bbuilder->v7;
+      /*
+       * The loop stead state begins with the following stack layout:
+       * `( S:v o h )`
+       */
 
-  tag = fetch_tag(v7, bbuilder, a, ppos, &pos_after_tag);
+      bcode_op(bbuilder, OP_NEXT_PROP);
+      end_label = bcode_op_target(bbuilder, OP_JMP_FALSE);
+      compile_var_op(bbuilder, OP_SET_VAR, a, name_pos);
 
-  mbuf_init(&case_labels, 0);
+      /*
+       * The stash register contains the value of the previous statement,
+       * being it the statement before the for..in statement or
+       * the previous iteration. We move it to the data stack. It will
+       * be replaced by the values of the body statements as usual.
+       */
+      bcode_op(bbuilder, OP_UNSTASH);
 
-  switch (tag) {
-    /*
-     * if(E) {
-     *   BT...
-     * } else {
-     *   BF...
-     * }
-     *
-     * ->
-     *
-     *   <E>
-     *   JMP_FALSE body
-     *   <BT>
-     *   JMP end
-     * body:
-     *   <BF>
-     * end:
-     *
-     * If else clause is omitted, it will emit output equivalent to:
-     *
-     * if(E) {BT} else undefined;
-     */
-    case AST_IF: {
-      ast_off_t if_false;
-      bcode_off_t end_label, if_false_label;
-      end = ast_get_skip(a, pos_after_tag, AST_END_SKIP);
-      if_false = ast_get_skip(a, pos_after_tag, AST_END_IF_TRUE_SKIP);
+      /*
+       * This node is always a NOP, for compatibility
+       * with the layout of the AST_FOR node.
+       */
+      ast_skip_tree(a, ppos);
 
-      V7_TRY(compile_expr_builder(bbuilder, a, ppos));
-      if_false_label = bcode_op_target(bbuilder, OP_JMP_FALSE);
+      V7_TRY(compile_stmts(bbuilder, a, ppos, end));
 
-      /* body if true */
-      V7_TRY(compile_stmts(bbuilder, a, ppos, if_false));
+      continue_target = bcode_pos(bbuilder);
 
-      if (if_false != end) {
-        /* `else` branch is present */
-        end_label = bcode_op_target(bbuilder, OP_JMP);
+      /*
+       * Save the last body statement. If next evaluation of NEXT_PROP returns
+       * false, we'll unstash it.
+       */
+      bcode_op(bbuilder, OP_STASH);
+      bcode_op(bbuilder, OP_DROP);
 
-        /* will jump here if `false` */
-        bcode_patch_target(bbuilder, if_false_label, bcode_pos(bbuilder));
+      loop_label = bcode_op_target(bbuilder, OP_JMP);
+      bcode_patch_target(bbuilder, loop_label, loop_target);
 
-        /* body if false */
-        V7_TRY(compile_stmts(bbuilder, a, ppos, end));
+      /* end: */
+      bcode_patch_target(bbuilder, end_label, bcode_pos(bbuilder));
+      bcode_op(bbuilder, OP_UNSTASH);
 
-        bcode_patch_target(bbuilder, end_label, bcode_pos(bbuilder));
-      } else {
-        /*
-         * `else` branch is not present: just remember where we should
-         * jump in case of `false`
-         */
-        bcode_patch_target(bbuilder, if_false_label, bcode_pos(bbuilder));
-      }
+      pop_label = bcode_op_target(bbuilder, OP_JMP);
+
+      /* brend: */
+      bcode_patch_target(bbuilder, brend_label, bcode_pos(bbuilder));
+
+      continue_label = bcode_op_target(bbuilder, OP_JMP_IF_CONTINUE);
+      bcode_patch_target(bbuilder, continue_label, continue_target);
+
+      bcode_op(bbuilder, OP_SWAP_DROP);
+      bcode_op(bbuilder, OP_SWAP_DROP);
+      bcode_op(bbuilder, OP_SWAP_DROP);
+
+      /* try_pop: */
+      bcode_patch_target(bbuilder, pop_label, bcode_pos(bbuilder));
+
+      bcode_op(bbuilder, OP_TRY_POP);
 
       bbuilder->v7->is_stack_neutral = 1;
       break;
     }
     /*
-     * while(C) {
+     * do {
      *   B...
-     * }
+     * } while(COND);
      *
      * ->
      *
      *   TRY_PUSH_LOOP end
-     *   JMP cond
      * body:
      *   <B>
      * cond:
-     *   <C>
+     *   <COND>
      *   JMP_TRUE body
      * end:
      *   JMP_IF_CONTINUE cond
      *   TRY_POP
      *
      */
-    case AST_WHILE: {
+    case AST_DOWHILE: {
       bcode_off_t end_label, continue_label, continue_target;
-
-      end = ast_get_skip(a, pos_after_tag, AST_END_SKIP);
-      cond = *ppos;
-      ast_skip_tree(a, ppos);
-
+      end = ast_get_skip(a, pos_after_tag, AST_DO_WHILE_COND_SKIP);
       end_label = bcode_op_target(bbuilder, OP_TRY_PUSH_LOOP);
-
-      /*
-       * Condition check is at the end of the loop, this layout
-       * reduces the number of jumps in the steady state.
-       */
-      cond_label = bcode_op_target(bbuilder, OP_JMP);
       body_target = bcode_pos(bbuilder);
-
       V7_TRY(compile_stmts(bbuilder, a, ppos, end));
 
       continue_target = bcode_pos(bbuilder);
-      bcode_patch_target(bbuilder, cond_label, continue_target);
-
-      V7_TRY(compile_expr_builder(bbuilder, a, &cond));
+      V7_TRY(compile_expr_builder(bbuilder, a, ppos));
       body_label = bcode_op_target(bbuilder, OP_JMP_TRUE);
       bcode_patch_target(bbuilder, body_label, body_target);
 
@@ -24540,822 +31990,1571 @@ V7_PRIVATE enum v7_err compile_stmt(struct bcode_builder *bbuilder,
       bbuilder->v7->is_stack_neutral = 1;
       break;
     }
-    case AST_BREAK:
-      bcode_op(bbuilder, OP_BREAK);
+    case AST_VAR: {
+      /*
+       * Var decls are hoisted when the function frame is created. Vars
+       * declared inside a `with` or `catch` block belong to the function
+       * lexical scope, and although those clauses create an inner frame
+       * no new variables should be created in it. A var decl thus
+       * behaves as a normal assignment at runtime.
+       */
+      ast_off_t name_pos;
+      end = ast_get_skip(a, pos_after_tag, AST_END_SKIP);
+      while (*ppos < end) {
+        tag = fetch_tag(v7, bbuilder, a, ppos, &pos_after_tag);
+        if (tag == AST_FUNC_DECL) {
+          /*
+           * function declarations are already set during hoisting (see
+           * `compile_local_vars()`), so, skip it.
+           *
+           * Plus, they are stack-neutral, so don't forget to set
+           * `is_stack_neutral`.
+           */
+          ast_skip_tree(a, ppos);
+          bbuilder->v7->is_stack_neutral = 1;
+        } else {
+          /*
+           * compile `var` declaration: basically it looks similar to an
+           * assignment, but it differs from an assignment is that it's
+           * stack-neutral: `1; var a = 5;` yields `1`, not `5`.
+           */
+          V7_CHECK_INTERNAL(tag == AST_VAR_DECL);
+          name_pos = pos_after_tag;
+          V7_TRY(compile_expr_builder(bbuilder, a, ppos));
+          compile_var_op(bbuilder, OP_SET_VAR, a, name_pos);
+
+          /* `var` declaration is stack-neutral */
+          bcode_op(bbuilder, OP_DROP);
+          bbuilder->v7->is_stack_neutral = 1;
+        }
+      }
       break;
-    case AST_CONTINUE:
-      bcode_op(bbuilder, OP_CONTINUE);
+    }
+    case AST_RETURN:
+      bcode_op(bbuilder, OP_PUSH_UNDEFINED);
+      bcode_op(bbuilder, OP_RET);
       break;
-    /*
-     * Frame objects (`v7->vals.call_stack`) contain one more hidden property:
-     * `____t`, which is an array of offsets in bcode. Each element of the array
-     * is an offset of either `catch` or `finally` block (distinguished by the
-     * tag: `OFFSET_TAG_CATCH` or `OFFSET_TAG_FINALLY`). Let's call this array
-     * as a "try stack". When evaluator enters new `try` block, it adds
-     * appropriate offset(s) at the top of "try stack", and when we unwind the
-     * stack, we can "pop" offsets from "try stack" at each level.
-     *
-     * try {
-     *   TRY_B
-     * } catch (e) {
-     *   CATCH_B
-     * } finally {
-     *   FIN_B
-     * }
-     *
-     * ->
-     *    OP_TRY_PUSH_FINALLY finally
-     *    OP_TRY_PUSH_CATCH catch
-     *    <TRY_B>
-     *    OP_TRY_POP
-     *    JMP finally
-     *  catch:
-     *    OP_TRY_POP
-     *    OP_ENTER_CATCH <e>
-     *    <CATCH_B>
-     *    OP_EXIT_CATCH
-     *  finally:
-     *    OP_TRY_POP
-     *    <FIN_B>
-     *    OP_AFTER_FINALLY
-     *
-     * ---------------
-     *
-     * try {
-     *   TRY_B
-     * } catch (e) {
-     *   CATCH_B
-     * }
-     *
-     * ->
-     *    OP_TRY_PUSH_CATCH catch
-     *    <TRY_B>
-     *    OP_TRY_POP
-     *    JMP end
-     *  catch:
-     *    OP_TRY_POP
-     *    OP_ENTER_CATCH <e>
-     *    <CATCH_B>
-     *    OP_EXIT_CATCH
-     *  end:
-     *
-     * ---------------
-     *
-     * try {
-     *   TRY_B
-     * } finally {
-     *   FIN_B
-     * }
-     *
-     * ->
-     *    OP_TRY_PUSH_FINALLY finally
-     *    <TRY_B>
-     *  finally:
-     *    OP_TRY_POP
-     *    <FIN_B>
-     *    OP_AFTER_FINALLY
-     */
-    case AST_TRY: {
-      ast_off_t acatch, afinally;
-      bcode_off_t finally_label, catch_label;
+    case AST_VALUE_RETURN:
+      V7_TRY(compile_expr_builder(bbuilder, a, ppos));
+      bcode_op(bbuilder, OP_RET);
+      break;
+    default:
+      *ppos = pos_after_tag - 1;
+      V7_TRY(compile_expr_builder(bbuilder, a, ppos));
+  }
 
-      end = ast_get_skip(a, pos_after_tag, AST_END_SKIP);
-      acatch = ast_get_skip(a, pos_after_tag, AST_TRY_CATCH_SKIP);
-      afinally = ast_get_skip(a, pos_after_tag, AST_TRY_FINALLY_SKIP);
+clean:
+  mbuf_free(&case_labels);
+  return rcode;
+}
 
-      if (afinally != end) {
-        /* `finally` clause is present: push its offset */
-        finally_label = bcode_op_target(bbuilder, OP_TRY_PUSH_FINALLY);
+#ifndef V7_DISABLE_FRAME_SLOTS
+
+/*
+ * Max nesting of inner functions handled by `analyze_frame_slots()`; functions
+ * with deeper nesting keep their names in the scope object.
+ */
+#define FRAME_SLOTS_MAX_NESTING 8
+
+/*
+ * Returns whether the function whose `AST_FUNC` tag ends at `func_pos`
+ * declares the given name: as its own name, an argument or a local.
+ */
+static int ast_func_declares(struct ast *a, ast_off_t func_pos,
+                             const char *name, size_t name_len) {
+  ast_off_t pos = func_pos, pos_after_tag, next, fvar_end;
+  ast_off_t body = ast_get_skip(a, func_pos, AST_FUNC_BODY_SKIP);
+  ast_off_t fvar = ast_get_skip(a, func_pos, AST_FUNC_FIRST_VAR_SKIP) - 1;
+  enum ast_tag tag;
+  char *cur;
+  size_t cur_len;
+
+  /* function name and argument names */
+  ast_move_to_children(a, &pos);
+  while (pos < body) {
+    tag = ast_fetch_tag(a, &pos);
+    pos_after_tag = pos;
+    ast_move_to_children(a, &pos);
+    if (tag == AST_IDENT) {
+      cur = ast_get_inlined_data(a, pos_after_tag, &cur_len);
+      if (cur_len == name_len && memcmp(cur, name, name_len) == 0) {
+        return 1;
       }
+    }
+  }
 
-      if (acatch != afinally) {
-        /* `catch` clause is present: push its offset */
-        catch_label = bcode_op_target(bbuilder, OP_TRY_PUSH_CATCH);
+  /* local names, see `compile_local_vars()` */
+  if (fvar != func_pos - 1) {
+    do {
+      ast_fetch_tag(a, &fvar);
+      pos_after_tag = fvar;
+      ast_move_to_children(a, &fvar);
+
+      next = ast_get_skip(a, pos_after_tag, AST_VAR_NEXT_SKIP);
+      if (next == pos_after_tag) {
+        next = 0;
       }
+      fvar_end = ast_get_skip(a, pos_after_tag, AST_END_SKIP);
 
-      /* compile statements of `try` block */
-      V7_TRY(compile_stmts(bbuilder, a, ppos, acatch));
+      while (fvar < fvar_end) {
+        ast_fetch_tag(a, &fvar);
+        cur = ast_get_inlined_data(a, fvar, &cur_len);
+        if (cur_len == name_len && memcmp(cur, name, name_len) == 0) {
+          return 1;
+        }
+        ast_move_to_children(a, &fvar);
+        ast_skip_tree(a, &fvar);
+      }
 
-      if (acatch != afinally) {
-        /* `catch` clause is present: compile it */
-        bcode_off_t after_catch_label;
+      if (next > 0) {
+        fvar = next - 1;
+      }
+    } while (next != 0);
+  }
 
-        /*
-         * pop offset pushed by OP_TRY_PUSH_CATCH, and jump over the `catch`
-         * block
-         */
-        bcode_op(bbuilder, OP_TRY_POP);
-        after_catch_label = bcode_op_target(bbuilder, OP_JMP);
+  return 0;
+}
 
-        /* --- catch --- */
+/*
+ * Scans the body of the function being compiled (from `pos` to `end`) and
+ * decides whether its names can live in the frame slots (see
+ * `bcode->frame_slots`). Names should be already added to `bcode->ops`.
+ *
+ * Slots are not used if the function refers to `eval` (which may access locals
+ * by name), uses `with`, has a `catch` parameter named like one of the
+ * function's names or a local named `arguments`, or if any of its names is
+ * referred to from an inner function (closures capture the scope object).
+ */
+static void analyze_frame_slots(struct bcode_builder *bbuilder, struct ast *a,
+                                ast_off_t pos, ast_off_t end) {
+  struct bcode *bcode = bbuilder->bcode;
+  /* inner functions we're currently in: positions after tags, and ends */
+  ast_off_t nested[FRAME_SLOTS_MAX_NESTING];
+  ast_off_t nested_end[FRAME_SLOTS_MAX_NESTING];
+  int depth = 0, i;
+  uint8_t uses_arguments = 0;
+  int arguments_slot = find_frame_slot(bbuilder, "arguments", 9);
+  char *name;
+  size_t name_len;
 
-        /* in case of exception in the `try` block above, we'll get here */
-        bcode_patch_target(bbuilder, catch_label, bcode_pos(bbuilder));
+  if (arguments_slot > (int) bcode->args_cnt) {
+    /* local `arguments` would have to alias the arguments object */
+    return;
+  }
 
-        /* pop offset pushed by OP_TRY_PUSH_CATCH */
-        bcode_op(bbuilder, OP_TRY_POP);
+  while (pos < end) {
+    enum ast_tag tag = ast_fetch_tag(a, &pos);
+    ast_off_t pos_after_tag = pos;
+    ast_move_to_children(a, &pos);
 
-        /*
-         * retrieve identifier where to store thrown error, and make sure
-         * it is actually an indentifier (AST_IDENT)
-         */
-        tag = fetch_tag(v7, bbuilder, a, ppos, &pos_after_tag);
-        V7_CHECK(tag == AST_IDENT, V7_SYNTAX_ERROR);
+    /* leave inner functions which are over */
+    while (depth > 0 && pos_after_tag - 1 >= nested_end[depth - 1]) {
+      depth--;
+    }
 
-        /*
-         * when we enter `catch` block, the TOS contains thrown value.
-         * We should create private frame for the `catch` clause, and populate
-         * a variable with the thrown value there.
-         * The `OP_ENTER_CATCH` opcode does just that.
-         */
-        bcode_op_lit(bbuilder, OP_ENTER_CATCH,
-                     string_lit(bbuilder, a, pos_after_tag));
+    switch (tag) {
+      case AST_FUNC:
+#ifndef V7_DISABLE_STREAMING_COMPILE
+      case AST_COMPILED_FUNC:
+#endif
+        if (depth == FRAME_SLOTS_MAX_NESTING) {
+          return;
+        }
+        nested[depth] = pos_after_tag;
+        nested_end[depth] = ast_get_skip(a, pos_after_tag, AST_END_SKIP);
+        depth++;
+        break;
+      case AST_WITH:
+        return;
+      case AST_TRY:
+        if (depth == 0) {
+          ast_off_t acatch = ast_get_skip(a, pos_after_tag, AST_TRY_CATCH_SKIP);
+          if (acatch != ast_get_skip(a, pos_after_tag, AST_TRY_FINALLY_SKIP) &&
+              ast_fetch_tag(a, &acatch) == AST_IDENT) {
+            name = ast_get_inlined_data(a, acatch, &name_len);
+            if (find_frame_slot(bbuilder, name, name_len) >= 0 ||
+                (name_len == 9 && memcmp(name, "arguments", 9) == 0)) {
+              return;
+            }
+          }
+        }
+        break;
+      case AST_IDENT:
+        name = ast_get_inlined_data(a, pos_after_tag, &name_len);
+        if (name_len == 4 && memcmp(name, "eval", 4) == 0) {
+          return;
+        }
+        if (depth == 0) {
+          if (arguments_slot < 0 && name_len == 9 &&
+              memcmp(name, "arguments", 9) == 0) {
+            uses_arguments = 1;
+          }
+        } else if (find_frame_slot(bbuilder, name, name_len) >= 0) {
+          /* make sure the name is shadowed by some of the inner functions */
+          for (i = depth - 1; i >= 0; i--) {
+            if (ast_func_declares(a, nested[i], name, name_len)) {
+              break;
+            }
+          }
+          if (i < 0) {
+            return;
+          }
+        }
+        break;
+      default:
+        break;
+    }
+  }
 
-        /*
-         * compile statements until the end of `catch` clause
-         * (`afinally` points to the end of the `catch` clause independently
-         * of whether the `finally` clause is present)
-         */
-        V7_TRY(compile_stmts(bbuilder, a, ppos, afinally));
+  bcode->frame_slots = 1;
+  bcode->arguments_slot = uses_arguments;
+}
 
-        /* pop private frame */
-        bcode_op(bbuilder, OP_EXIT_CATCH);
+#endif /* V7_DISABLE_FRAME_SLOTS */
 
-        bcode_patch_target(bbuilder, after_catch_label, bcode_pos(bbuilder));
-      }
+/*
+ * Scans the body of the function being compiled (from `pos` to `end`) and
+ * sets `bcode->no_arguments` if it never refers to `arguments`, neither
+ * directly nor via `eval`. Inner functions have their own `arguments`, so they
+ * are skipped.
+ */
+static void analyze_arguments(struct bcode_builder *bbuilder, struct ast *a,
+                              ast_off_t pos, ast_off_t end) {
+  char *name;
+  size_t name_len;
 
-      if (afinally != end) {
-        /* `finally` clause is present: compile it */
+  while (pos < end) {
+    enum ast_tag tag = ast_fetch_tag(a, &pos);
+    ast_off_t pos_after_tag = pos;
 
-        /* --- finally --- */
+    switch (tag) {
+      case AST_FUNC:
+#ifndef V7_DISABLE_STREAMING_COMPILE
+      case AST_COMPILED_FUNC:
+#endif
+        pos = ast_get_skip(a, pos_after_tag, AST_END_SKIP);
+        continue;
+      case AST_IDENT:
+        name = ast_get_inlined_data(a, pos_after_tag, &name_len);
+        if ((name_len == 9 && memcmp(name, "arguments", 9) == 0) ||
+            (name_len == 4 && memcmp(name, "eval", 4) == 0)) {
+          return;
+        }
+        break;
+      default:
+        break;
+    }
+    ast_move_to_children(a, &pos);
+  }
 
-        /* after the `try` block above executes, we'll get here */
-        bcode_patch_target(bbuilder, finally_label, bcode_pos(bbuilder));
+  bbuilder->bcode->no_arguments = 1;
+}
 
-        /* pop offset pushed by OP_TRY_PUSH_FINALLY */
-        bcode_op(bbuilder, OP_TRY_POP);
+static enum v7_err compile_body(struct bcode_builder *bbuilder, struct ast *a,
+                                ast_off_t start, ast_off_t end, ast_off_t body,
+                                ast_off_t fvar, ast_off_t *ppos) {
+  enum v7_err rcode = V7_OK;
+  struct v7 *v7 = bbuilder->v7;
+
+#ifndef V7_FORCE_STRICT_MODE
+  /* check 'use strict' */
+  if (*ppos < end) {
+    ast_off_t tmp_pos = body;
+    if (fetch_tag(v7, bbuilder, a, &tmp_pos, NULL) == AST_USE_STRICT) {
+      bbuilder->bcode->strict_mode = 1;
+      /* move `body` offset, effectively removing `AST_USE_STRICT` from it */
+      body = tmp_pos;
+    }
+  }
+#endif
+
+  /* put initial value for the function body execution */
+  bcode_op(bbuilder, OP_PUSH_UNDEFINED);
+
+  /*
+   * populate `bcode->ops` with function's local variable names. Note that we
+   * should do this *after* `OP_PUSH_UNDEFINED`, since `compile_local_vars`
+   * emits code that assigns the hoisted functions to local variables, and
+   * those statements assume that the stack contains `undefined`.
+   */
+  V7_TRY(compile_local_vars(bbuilder, a, start, fvar, 0 /*names*/));
+
+  if (bbuilder->bcode->func_name_present) {
+#ifndef V7_DISABLE_FRAME_SLOTS
+    analyze_frame_slots(bbuilder, a, body, end);
+#endif
+    if (!bbuilder->bcode->frame_slots) {
+      analyze_arguments(bbuilder, a, body, end);
+    }
+  }
+
+  V7_TRY(compile_local_vars(bbuilder, a, start, fvar, 1 /*functions*/));
+
+  /* compile body */
+  *ppos = body;
+  V7_TRY(compile_stmts(bbuilder, a, ppos, end));
+
+clean:
+  return rcode;
+}
+
+/*
+ * Compiles a given script and populates a bcode structure.
+ * The AST must start with an AST_SCRIPT node.
+ */
+V7_PRIVATE enum v7_err compile_script(struct v7 *v7, struct ast *a,
+                                      struct bcode *bcode) {
+  ast_off_t pos_after_tag, end, fvar, pos = 0;
+  int saved_line_no = v7->line_no;
+  enum v7_err rcode = V7_OK;
+  struct bcode_builder bbuilder;
+  enum ast_tag tag;
+
+  bcode_builder_init(v7, &bbuilder, bcode);
+  v7->line_no = 1;
+
+  tag = fetch_tag(v7, &bbuilder, a, &pos, &pos_after_tag);
+
+  /* first tag should always be AST_SCRIPT */
+  assert(tag == AST_SCRIPT);
+  (void) tag;
+
+  end = ast_get_skip(a, pos_after_tag, AST_END_SKIP);
+  fvar = ast_get_skip(a, pos_after_tag, AST_FUNC_FIRST_VAR_SKIP) - 1;
+
+  V7_TRY(compile_body(&bbuilder, a, pos_after_tag - 1, end, pos /* body */,
+                      fvar, &pos));
+
+clean:
+
+#ifndef V7_DISABLE_BCODE_OPT
+  if (rcode == V7_OK) {
+    bcode_optimize(&bbuilder);
+  }
+#endif
+  bcode_builder_finalize(&bbuilder);
+
+#ifdef V7_BCODE_DUMP
+  if (rcode == V7_OK) {
+    fprintf(stderr, "--- script ---\n");
+    dump_bcode(v7, stderr, bcode);
+  }
+#endif
+
+  v7->line_no = saved_line_no;
+
+  return rcode;
+}
+
+/*
+ * Compiles a given function and populates a bcode structure.
+ * The AST must contain an AST_FUNC node at offset ast_off.
+ */
+V7_PRIVATE enum v7_err compile_function(struct v7 *v7, struct ast *a,
+                                        ast_off_t *ppos, struct bcode *bcode) {
+  ast_off_t pos_after_tag, start, end, body, fvar;
+  const char *name;
+  size_t name_len;
+  size_t args_cnt;
+  enum v7_err rcode = V7_OK;
+  struct bcode_builder bbuilder;
+  enum ast_tag tag;
+  size_t names_end = 0;
+  bcode_builder_init(v7, &bbuilder, bcode);
+  tag = fetch_tag(v7, &bbuilder, a, ppos, &pos_after_tag);
+  start = pos_after_tag - 1;
+
+#ifndef V7_DISABLE_LINE_NUMBERS
+  /* unless told otherwise, the function's code is at its starting line */
+  if (bbuilder.lines.len == 0 && v7->line_no != 1) {
+    bcode_append_lineno(&bbuilder, v7->line_no);
+  }
+#endif
+
+  (void) tag;
+  assert(tag == AST_FUNC);
+  end = ast_get_skip(a, pos_after_tag, AST_END_SKIP);
+  body = ast_get_skip(a, pos_after_tag, AST_FUNC_BODY_SKIP);
+  fvar = ast_get_skip(a, pos_after_tag, AST_FUNC_FIRST_VAR_SKIP) - 1;
+
+  /* retrieve function name */
+  tag = fetch_tag(v7, &bbuilder, a, ppos, &pos_after_tag);
+  if (tag == AST_IDENT) {
+    /* function name is provided */
+    name = ast_get_inlined_data(a, pos_after_tag, &name_len);
+    V7_TRY(bcode_add_name(&bbuilder, name, name_len, &names_end));
+  } else {
+    /* no name: anonymous function */
+    V7_TRY(bcode_add_name(&bbuilder, "", 0, &names_end));
+  }
+
+  /* retrieve function's argument names */
+  for (args_cnt = 0; *ppos < body; args_cnt++) {
+    if (args_cnt > V7_ARGS_CNT_MAX) {
+      /* too many arguments */
+      rcode = v7_throwf(v7, SYNTAX_ERROR, "Too many arguments");
+      V7_THROW(V7_SYNTAX_ERROR);
+    }
+
+    tag = fetch_tag(v7, &bbuilder, a, ppos, &pos_after_tag);
+    /*
+     * TODO(dfrank): it's not actually an internal error, we get here if
+     * we compile e.g. the following: (function(1){})
+     */
+    V7_CHECK_INTERNAL(tag == AST_IDENT);
+    name = ast_get_inlined_data(a, pos_after_tag, &name_len);
+    V7_TRY(bcode_add_name(&bbuilder, name, name_len, &names_end));
+  }
+
+  bcode->args_cnt = args_cnt;
+  bcode->func_name_present = 1;
+
+  V7_TRY(compile_body(&bbuilder, a, start, end, body, fvar, ppos));
+
+clean:
+#ifndef V7_DISABLE_BCODE_OPT
+  if (rcode == V7_OK) {
+    bcode_optimize(&bbuilder);
+  }
+#endif
+  bcode_builder_finalize(&bbuilder);
+
+#ifdef V7_BCODE_DUMP
+  if (rcode == V7_OK) {
+    fprintf(stderr, "--- function ---\n");
+    dump_bcode(v7, stderr, bcode);
+  }
+#endif
+
+  return rcode;
+}
+
+#ifndef V7_DISABLE_STREAMING_COMPILE
+
+#ifndef V7_DISABLE_FRAME_SLOTS
+/*
+ * Appends to the `AST_COMPILED_FUNC` node in `s` an `AST_IDENT` for each name
+ * which the function at `func_pos` (the position after its tag) refers to but
+ * doesn't declare. `analyze_frame_slots()` of the outer functions will see
+ * those names as if it walked the function's code. Uses of `with` are
+ * reported as references to `eval`, which prevent frame slots just as well.
+ */
+static void add_free_names(struct ast *s, struct ast *a, ast_off_t func_pos) {
+  ast_off_t pos = func_pos, end = ast_get_skip(a, func_pos, AST_END_SKIP);
+  ast_off_t body = ast_get_skip(s, 1, AST_FUNC_BODY_SKIP), p;
+  char *name, *cur;
+  size_t name_len, cur_len;
+
+  ast_move_to_children(a, &pos);
+  while (pos < end) {
+    enum ast_tag tag = ast_fetch_tag(a, &pos);
+    ast_off_t pos_after_tag = pos;
+    ast_move_to_children(a, &pos);
+
+    if (tag == AST_WITH) {
+      name = (char *) "eval";
+      name_len = 4;
+    } else if (tag == AST_IDENT) {
+      name = ast_get_inlined_data(a, pos_after_tag, &name_len);
+      if (!(name_len == 4 && memcmp(name, "eval", 4) == 0) &&
+          ast_func_declares(a, func_pos, name, name_len)) {
+        continue;
+      }
+    } else {
+      continue;
+    }
+
+    /* add each name once */
+    for (p = body; p < s->mbuf.len; ast_move_to_children(s, &p)) {
+      ast_fetch_tag(s, &p);
+      cur = ast_get_inlined_data(s, p, &cur_len);
+      if (cur_len == name_len && memcmp(cur, name, name_len) == 0) {
+        break;
+      }
+    }
+    if (p >= s->mbuf.len) {
+      ast_insert_inlined_node(s, s->mbuf.len, AST_IDENT, name, name_len);
+    }
+  }
+}
+#endif
 
-        /* compile statements until the end of `finally` clause */
-        V7_TRY(compile_stmts(bbuilder, a, ppos, end));
+V7_PRIVATE enum v7_err compile_parsed_function(struct v7 *v7, struct ast *a,
+                                               ast_off_t pos, int line_no) {
+  enum v7_err rcode = V7_OK;
+  struct ast_compiled_func f;
+  struct ast s;
+  ast_off_t tmp = pos;
+  size_t idx = a->funcs.len / sizeof(f);
+  int saved_line_no = v7->line_no;
+  unsigned char buf[8];
 
-        bcode_op(bbuilder, OP_AFTER_FINALLY);
-      }
+  f.bcode = (struct bcode *) calloc(1, sizeof(*f.bcode));
+  bcode_init(f.bcode, a->script->strict_mode || v7->pstate.in_strict,
+             NULL /* will be set below */, 0);
+  bcode_copy_filename_from(f.bcode, a->script);
+  retain_bcode(v7, f.bcode);
+  f.line_no = 0;
 
-      bbuilder->v7->is_stack_neutral = 1;
-      break;
-    }
+  /* add it right away: that's how GC finds the literals while compiling */
+  mbuf_append(&a->funcs, &f, sizeof(f));
 
-    case AST_THROW: {
-      V7_TRY(compile_expr_builder(bbuilder, a, ppos));
-      bcode_op(bbuilder, OP_THROW);
-      break;
-    }
+  /* the parser and the compiler share `v7->line_no` */
+  v7->line_no = line_no;
+  rcode = compile_function(v7, a, &tmp, f.bcode);
+  ((struct ast_compiled_func *) a->funcs.buf)[idx].line_no = v7->line_no;
+  v7->line_no = saved_line_no;
+  if (rcode != V7_OK) {
+    a->funcs.len -= sizeof(f);
+    release_bcode(v7, f.bcode);
+    return rcode;
+  }
 
-    /*
-     * switch(E) {
-     * default:
-     *   D...
-     * case C1:
-     *   B1...
-     * case C2:
-     *   B2...
-     * }
-     *
-     * ->
-     *
-     *   TRY_PUSH_SWITCH end
-     *   <E>
-     *   DUP
-     *   <C1>
-     *   EQ
-     *   JMP_TRUE_DROP l1
-     *   DUP
-     *   <C2>
-     *   EQ
-     *   JMP_TRUE_DROP l2
-     *   DROP
-     *   JMP dfl
-     *
-     * dfl:
-     *   <D>
-     *
-     * l1:
-     *   <B1>
-     *
-     * l2:
-     *   <B2>
-     *
-     * end:
-     *   TRY_POP
-     *
-     * If the default case is missing we treat it as if had an empty body and
-     * placed in last position (i.e. `dfl` label is replaced with `end`).
-     *
-     * Before emitting a case/default block (except the first one) we have to
-     * drop the TOS resulting from evaluating the last expression
-     */
-    case AST_SWITCH: {
-      bcode_off_t dfl_label, end_label;
-      ast_off_t case_end, case_start;
-      enum ast_tag case_tag;
-      int i, has_default = 0, cases = 0;
+  /* build the replacement node, see `AST_COMPILED_FUNC` */
+  ast_init(&s, 0);
+  ast_insert_node(&s, 0, AST_COMPILED_FUNC);
+#ifndef V7_DISABLE_LINE_NUMBERS
+  if (ast_get_line_no(a, pos + 1) != 0) {
+    ast_add_line_no(&s, 0, ast_get_line_no(a, pos + 1));
+  }
+#endif
+  mbuf_append(&s.mbuf, buf, encode_varint(idx, buf));
+  ast_modify_skip(&s, 1, 1, AST_FUNC_FIRST_VAR_SKIP);
+  ast_set_skip(&s, 1, AST_FUNC_BODY_SKIP);
+#ifndef V7_DISABLE_FRAME_SLOTS
+  add_free_names(&s, a, pos + 1);
+#endif
+  ast_set_skip(&s, 1, AST_END_SKIP);
 
-      end = ast_get_skip(a, pos_after_tag, AST_END_SKIP);
+  a->mbuf.len = pos;
+  mbuf_append(&a->mbuf, s.mbuf.buf, s.mbuf.len);
+  ast_free(&s);
+  return rcode;
+}
 
-      end_label = bcode_op_target(bbuilder, OP_TRY_PUSH_SWITCH);
+#endif /* V7_DISABLE_STREAMING_COMPILE */
 
-      V7_TRY(compile_expr_builder(bbuilder, a, ppos));
+V7_PRIVATE enum v7_err compile_expr(struct v7 *v7, struct ast *a,
+                                    ast_off_t *ppos, struct bcode *bcode) {
+  enum v7_err rcode = V7_OK;
+  struct bcode_builder bbuilder;
+  int saved_line_no = v7->line_no;
 
-      case_start = *ppos;
-      /* first pass: evaluate case expression and generate jump table */
-      while (*ppos < end) {
-        case_tag = fetch_tag(v7, bbuilder, a, ppos, &pos_after_tag);
-        assert(case_tag == AST_DEFAULT || case_tag == AST_CASE);
+  bcode_builder_init(v7, &bbuilder, bcode);
+  v7->line_no = 1;
 
-        case_end = ast_get_skip(a, pos_after_tag, AST_END_SKIP);
+  rcode = compile_expr_builder(&bbuilder, a, ppos);
 
-        switch (case_tag) {
-          case AST_DEFAULT:
-            /* default jump table entry must be the last one */
-            break;
-          case AST_CASE: {
-            bcode_off_t case_label;
-            bcode_op(bbuilder, OP_DUP);
-            V7_TRY(compile_expr_builder(bbuilder, a, ppos));
-            bcode_op(bbuilder, OP_EQ);
-            case_label = bcode_op_target(bbuilder, OP_JMP_TRUE_DROP);
-            cases++;
-            mbuf_append(&case_labels, &case_label, sizeof(case_label));
-            break;
-          }
-          default:
-            assert(case_tag == AST_DEFAULT || case_tag == AST_CASE);
-        }
-        *ppos = case_end;
-      }
+  bcode_builder_finalize(&bbuilder);
+  v7->line_no = saved_line_no;
+  return rcode;
+}
+#ifdef V7_MODULE_LINES
+#line 1 "./src/bcode_opt.c"
+#endif
+/*
+ * Copyright (c) 2014 Cesanta Software Limited
+ * All rights reserved
+ */
 
-      /* jmp table epilogue: unconditional jump to default case */
-      bcode_op(bbuilder, OP_DROP);
-      dfl_label = bcode_op_target(bbuilder, OP_JMP);
+/* Amalgamated: #include "v7/src/internal.h" */
+/* Amalgamated: #include "v7/src/bcode_opt.h" */
+/* Amalgamated: #include "v7/src/core.h" */
+/* Amalgamated: #include "v7/src/eval.h" */
+/* Amalgamated: #include "v7/src/primitive.h" */
+/* Amalgamated: #include "v7/src/string.h" */
+/* Amalgamated: #include "v7/src/varint.h" */
 
-      *ppos = case_start;
-      /* second pass: emit case bodies and patch jump table */
+#ifndef V7_DISABLE_BCODE_OPT
 
-      for (i = 0; *ppos < end;) {
-        case_tag = fetch_tag(v7, bbuilder, a, ppos, &pos_after_tag);
-        assert(case_tag == AST_DEFAULT || case_tag == AST_CASE);
-        assert(i <= cases);
+/*
+ * The optimizer decodes the instructions into an array of `struct
+ * bopt_insn`, rewrites them in place until nothing changes, and then encodes
+ * the live ones back. Removed instructions are just marked dead, and jumps
+ * refer to instructions by index, so the offsets are only recomputed once,
+ * in the end.
+ *
+ * Folded constants are kept in `struct bopt_insn` until they are encoded,
+ * which is fine since the optimizer never allocates GC cells.
+ */
 
-        case_end = ast_get_skip(a, pos_after_tag, AST_END_SKIP);
+/* Max number of rewriting rounds; each of them is linear */
+#ifndef V7_BCODE_OPT_MAX_ROUNDS
+#define V7_BCODE_OPT_MAX_ROUNDS 8
+#endif
 
-        switch (case_tag) {
-          case AST_DEFAULT:
-            has_default = 1;
-            bcode_patch_target(bbuilder, dfl_label, bcode_pos(bbuilder));
-            V7_TRY(compile_stmts(bbuilder, a, ppos, case_end));
-            break;
-          case AST_CASE: {
-            bcode_off_t case_label = ((bcode_off_t *) case_labels.buf)[i++];
-            bcode_patch_target(bbuilder, case_label, bcode_pos(bbuilder));
-            ast_skip_tree(a, ppos);
-            V7_TRY(compile_stmts(bbuilder, a, ppos, case_end));
-            break;
-          }
-          default:
-            assert(case_tag == AST_DEFAULT || case_tag == AST_CASE);
-        }
+/* Max number of jumps to jumps followed by `bopt_thread_jumps()` */
+#define BOPT_MAX_JUMP_CHAIN 16
 
-        *ppos = case_end;
-      }
-      mbuf_free(&case_labels);
+/* Max number of instructions looked through by `bopt_names_kept()` */
+#define BOPT_MAX_NAMES_SCAN 32
 
-      if (!has_default) {
-        bcode_patch_target(bbuilder, dfl_label, bcode_pos(bbuilder));
-      }
+enum bopt_flag {
+  BOPT_DEAD = (1 << 0),    /* removed */
+  BOPT_LABEL = (1 << 1),   /* a jump target */
+  BOPT_REACHED = (1 << 2), /* see `bopt_sweep_unreachable()` */
+  BOPT_CONST = (1 << 3),   /* pushes `val` instead of the original code */
+  BOPT_TABLE_LIT = (1 << 4) /* refers to the literal table */
+};
 
-      bcode_patch_target(bbuilder, end_label, bcode_pos(bbuilder));
-      bcode_op(bbuilder, OP_TRY_POP);
+struct bopt_insn {
+  bcode_off_t off;     /* offset of the original encoding */
+  bcode_off_t len;     /* length of the current encoding */
+  bcode_off_t new_off; /* offset in the optimized `ops` */
+  bcode_off_t tpos;    /* offset of the jump target in the optimized `ops` */
+  size_t target;       /* index of the target instruction, for jumps */
+  val_t val;           /* value of a `BOPT_CONST` instruction */
+  uint8_t op;
+  uint8_t arg; /* the byte operand, e.g. the comparison of `OP_CMP_JMP_*` */
+  uint8_t flags;
+};
 
-      bbuilder->v7->is_stack_neutral = 1;
-      break;
-    }
-    /*
-     * for(INIT,COND,IT) {
-     *   B...
-     * }
-     *
-     * ->
-     *
-     *   <INIT>
-     *   DROP
-     *   TRY_PUSH_LOOP end
-     *   JMP cond
-     * body:
-     *   <B>
-     * next:
-     *   <IT>
-     *   DROP
-     * cond:
-     *   <COND>
-     *   JMP_TRUE body
-     * end:
-     *   JMP_IF_CONTINUE next
-     *   TRY_POP
-     *
-     */
-    case AST_FOR: {
-      ast_off_t iter, body, lookahead;
-      bcode_off_t end_label, continue_label, continue_target;
-      end = ast_get_skip(a, pos_after_tag, AST_END_SKIP);
-      body = ast_get_skip(a, pos_after_tag, AST_FOR_BODY_SKIP);
+struct bopt {
+  struct bcode_builder *bbuilder;
+  struct v7 *v7;
+  char *ops;         /* original instructions */
+  bcode_off_t start; /* offset of the first instruction, after the names */
+  struct bopt_insn *insns;
+  size_t cnt;
+  int changed;
+};
 
-      lookahead = *ppos;
-      tag = fetch_tag(v7, bbuilder, a, &lookahead, &pos_after_tag);
-      /*
-       * Support for `var` declaration in INIT
-       */
-      if (tag == AST_VAR) {
-        ast_off_t fvar_end;
-        lit_t lit;
+/*
+ * Returns the operands of `op`, a character for each: `L` is a literal (see
+ * `bcode_op_lit()`), `V` is a varint, `B` is a byte and `T` is a jump target.
+ */
+static const char *bopt_operands(uint8_t op) {
+  switch (op) {
+    case OP_PUSH_LIT:
+    case OP_GET_VAR:
+    case OP_SAFE_GET_VAR:
+    case OP_SET_VAR:
+    case OP_GET_PROP:
+    case OP_ADD_LIT:
+    case OP_ENTER_CATCH:
+      return "L";
+    case OP_GET_VAR_PROP:
+      return "LL";
+    case OP_INC_VAR:
+      return "LV";
+    case OP_GET_LOCAL:
+    case OP_SET_LOCAL:
+      return "V";
+    case OP_INC_LOCAL:
+      return "VV";
+    case OP_CALL:
+    case OP_NEW:
+      return "B";
+    case OP_JMP:
+    case OP_JMP_TRUE:
+    case OP_JMP_FALSE:
+    case OP_JMP_TRUE_DROP:
+    case OP_JMP_IF_CONTINUE:
+    case OP_TRY_PUSH_CATCH:
+    case OP_TRY_PUSH_FINALLY:
+    case OP_TRY_PUSH_LOOP:
+    case OP_TRY_PUSH_SWITCH:
+      return "T";
+    case OP_CMP_JMP_TRUE:
+    case OP_CMP_JMP_FALSE:
+      return "BT";
+    default:
+      return "";
+  }
+}
 
-        *ppos = lookahead;
-        fvar_end = ast_get_skip(a, pos_after_tag, AST_END_SKIP);
+static int bopt_is_jump(uint8_t op) {
+  switch (op) {
+    case OP_JMP:
+    case OP_JMP_TRUE:
+    case OP_JMP_FALSE:
+    case OP_JMP_TRUE_DROP:
+    case OP_JMP_IF_CONTINUE:
+    case OP_TRY_PUSH_CATCH:
+    case OP_TRY_PUSH_FINALLY:
+    case OP_TRY_PUSH_LOOP:
+    case OP_TRY_PUSH_SWITCH:
+    case OP_CMP_JMP_TRUE:
+    case OP_CMP_JMP_FALSE:
+      return 1;
+    default:
+      return 0;
+  }
+}
 
-        /*
-         * Iterate through all vars in the given `var` declaration: they are
-         * just like assigments here
-         */
-        while (*ppos < fvar_end) {
-          tag = fetch_tag(v7, bbuilder, a, ppos, &pos_after_tag);
-          /* Only var declarations are allowed (not function declarations) */
-          V7_CHECK_INTERNAL(tag == AST_VAR_DECL);
-          lit = string_lit(bbuilder, a, pos_after_tag);
-          V7_TRY(compile_expr_builder(bbuilder, a, ppos));
+/*
+ * Returns the length of the function serialized by `bcode_serialize_func()`
+ * at `p`, or 0 if it has a literal table, which inlined functions never have.
+ */
+static size_t bopt_func_len(const char *p) {
+  const unsigned char *s = (const unsigned char *) p, *q = s;
+  size_t len;
+  int i, llen;
 
-          /* Just like an assigment */
-          bcode_op_lit(bbuilder, OP_SET_VAR, lit);
+  if (decode_varint(q, &llen) != 0) return 0;
+  q += llen;
+  /* `args_cnt`, `names_cnt`, `func_name_present` and frame slots flags */
+  for (i = 0; i < 4; i++) {
+    decode_varint(q, &llen);
+    q += llen;
+  }
+  /* instructions and line number table */
+  for (i = 0; i < 2; i++) {
+    len = decode_varint(q, &llen);
+    q += llen + len;
+  }
+  return q - s;
+}
 
-          /* INIT is stack-neutral */
-          bcode_op(bbuilder, OP_DROP);
-        }
-      } else {
-        /* normal expression in INIT (not `var` declaration) */
-        V7_TRY(compile_expr_builder(bbuilder, a, ppos));
-        /* INIT is stack-neutral */
-        bcode_op(bbuilder, OP_DROP);
-      }
-      cond = *ppos;
-      ast_skip_tree(a, ppos);
-      iter = *ppos;
-      *ppos = body;
+/* Returns the length of the operand of the given kind at `p`, 0 if unknown */
+static size_t bopt_operand_len(char kind, const char *p) {
+  const unsigned char *s = (const unsigned char *) p;
+  size_t tag, len;
+  int llen, llen2;
 
-      end_label = bcode_op_target(bbuilder, OP_TRY_PUSH_LOOP);
-      cond_label = bcode_op_target(bbuilder, OP_JMP);
-      body_target = bcode_pos(bbuilder);
-      V7_TRY(compile_stmts(bbuilder, a, ppos, end));
+  switch (kind) {
+    case 'L':
+      tag = decode_varint(s, &llen);
+      switch (tag) {
+        case BCODE_INLINE_STRING_TYPE_TAG:
+          len = decode_varint(s + llen, &llen2);
+          return llen + llen2 + len + 1 /* NUL */;
+        case BCODE_INLINE_NUMBER_TYPE_TAG:
+          return llen + sizeof(val_t);
+        case BCODE_INLINE_FUNC_TYPE_TAG:
+          len = bopt_func_len(p + llen);
+          return len == 0 ? 0 : llen + len;
+        default:
+          return llen;
+      }
+    case 'V':
+      decode_varint(s, &llen);
+      return llen;
+    case 'B':
+      return 1;
+    case 'T':
+      return sizeof(bcode_off_t);
+  }
+  return 0;
+}
 
-      continue_target = bcode_pos(bbuilder);
+/* Returns the index of the first live instruction starting from `i` */
+static size_t bopt_live(struct bopt *o, size_t i) {
+  while (i < o->cnt && (o->insns[i].flags & BOPT_DEAD)) i++;
+  return i;
+}
 
-      V7_TRY(compile_expr_builder(bbuilder, a, &iter));
-      bcode_op(bbuilder, OP_DROP);
+/* Returns the index of the live instruction following `i` */
+static size_t bopt_next(struct bopt *o, size_t i) {
+  return bopt_live(o, i + 1);
+}
 
-      bcode_patch_target(bbuilder, cond_label, bcode_pos(bbuilder));
+static void bopt_kill(struct bopt *o, size_t i) {
+  struct bopt_insn *insn = &o->insns[i];
+  size_t next;
+  insn->flags |= BOPT_DEAD;
+  o->changed = 1;
+  /* jumps to the removed instruction land on the next one now */
+  if ((insn->flags & BOPT_LABEL) && (next = bopt_next(o, i)) < o->cnt) {
+    o->insns[next].flags |= BOPT_LABEL;
+  }
+}
 
-      /*
-       * Handle for(INIT;;ITER)
-       */
-      lookahead = cond;
-      tag = fetch_tag(v7, bbuilder, a, &lookahead, &pos_after_tag);
-      if (tag == AST_NOP) {
-        bcode_op(bbuilder, OP_JMP);
-      } else {
-        V7_TRY(compile_expr_builder(bbuilder, a, &cond));
-        bcode_op(bbuilder, OP_JMP_TRUE);
+/* Returns the index of the instruction at `off`, or `o->cnt` if there's none */
+static size_t bopt_find(struct bopt *o, size_t off) {
+  size_t lo = 0, hi = o->cnt;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (o->insns[mid].off < off) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+/* Decodes the instructions into `insns`, returns 0 if they are malformed */
+static int bopt_decode(struct bopt *o, struct mbuf *insns) {
+  size_t ops_len = o->bbuilder->ops.len, i;
+  char *p = o->ops + o->start, *end = o->ops + ops_len;
+  struct bopt_insn insn;
+  const char *d;
+
+  while (p < end) {
+    memset(&insn, 0, sizeof(insn));
+    insn.off = p - o->ops;
+    insn.op = (uint8_t) *p++;
+    if (insn.op >= OP_MAX) return 0;
+    for (d = bopt_operands(insn.op); *d != '\0'; d++) {
+      size_t len = bopt_operand_len(*d, p);
+      if (len == 0 || p + len > end) return 0;
+      if (*d == 'B') {
+        insn.arg = (uint8_t) *p;
+      } else if (*d == 'L') {
+        int llen;
+        if (decode_varint((unsigned char *) p, &llen) >=
+            BCODE_MAX_INLINE_TYPE_TAG) {
+          insn.flags |= BOPT_TABLE_LIT;
+        }
+      } else if (*d == 'T') {
+        bcode_off_t target;
+        memcpy(&target, p, sizeof(target));
+        insn.target = target; /* turned into an index below */
       }
-      body_label = bcode_add_target(bbuilder);
-      bcode_patch_target(bbuilder, body_label, body_target);
-      bcode_patch_target(bbuilder, end_label, bcode_pos(bbuilder));
+      p += len;
+    }
+    insn.len = p - o->ops - insn.off;
+    mbuf_append(insns, &insn, sizeof(insn));
+  }
 
-      continue_label = bcode_op_target(bbuilder, OP_JMP_IF_CONTINUE);
-      bcode_patch_target(bbuilder, continue_label, continue_target);
+  o->insns = (struct bopt_insn *) insns->buf;
+  o->cnt = insns->len / sizeof(insn);
 
-      bcode_op(bbuilder, OP_TRY_POP);
+  for (i = 0; i < o->cnt; i++) {
+    struct bopt_insn *jmp = &o->insns[i];
+    size_t t;
+    if (!bopt_is_jump(jmp->op)) continue;
+    t = bopt_find(o, jmp->target);
+    if (t == o->cnt ? jmp->target != ops_len : o->insns[t].off != jmp->target) {
+      return 0;
+    }
+    jmp->target = t;
+  }
 
-      bbuilder->v7->is_stack_neutral = 1;
-      break;
+  return 1;
+}
+
+/*
+ * Points the jumps to live instructions, and marks their targets: the code
+ * which is jumped to can't be merged with the preceding instructions.
+ */
+static void bopt_mark_labels(struct bopt *o) {
+  size_t i;
+
+  for (i = 0; i < o->cnt; i++) {
+    o->insns[i].flags &= ~BOPT_LABEL;
+  }
+  for (i = bopt_live(o, 0); i < o->cnt; i = bopt_next(o, i)) {
+    struct bopt_insn *jmp = &o->insns[i];
+    if (!bopt_is_jump(jmp->op)) continue;
+    jmp->target = bopt_live(o, jmp->target);
+    if (jmp->target < o->cnt) {
+      o->insns[jmp->target].flags |= BOPT_LABEL;
     }
-    /*
-     * for(I in O) {
-     *   B...
-     * }
-     *
-     * ->
-     *
-     *   DUP
-     *   <O>
-     *   SWAP
-     *   STASH
-     *   DROP
-     *   PUSH_NULL
-     *   TRY_PUSH_LOOP brend
-     * loop:
-     *   NEXT_PROP
-     *   JMP_FALSE end
-     *   SET_VAR <I>
-     *   UNSTASH
-     *   <B>
-     * next:
-     *   STASH
-     *   DROP
-     *   JMP loop
-     * end:
-     *   UNSTASH
-     *   JMP try_pop:
-     * brend:
-     *              # got here after a `break` or `continue` from a loop body:
-     *   JMP_IF_CONTINUE next
-     *
-     *              # we're not going to `continue`, so, need to remove an
-     *              # extra stuff that was needed for the NEXT_PROP
-     *
-     *   SWAP_DROP  # drop handle
-     *   SWAP_DROP  # drop <O>
-     *   SWAP_DROP  # drop the value preceding the loop
-     * try_pop:
-     *   TRY_POP
-     *
-     */
-    case AST_FOR_IN: {
-      lit_t lit;
-      bcode_off_t loop_label, loop_target, end_label, brend_label,
-          continue_label, pop_label, continue_target;
-      ast_off_t end = ast_get_skip(a, pos_after_tag, AST_END_SKIP);
+  }
+}
 
-      tag = fetch_tag(v7, bbuilder, a, ppos, &pos_after_tag);
-      /* TODO(mkm) accept any l-value */
-      if (tag == AST_VAR) {
-        tag = fetch_tag(v7, bbuilder, a, ppos, &pos_after_tag);
-        V7_CHECK_INTERNAL(tag == AST_VAR_DECL);
-        lit = string_lit(bbuilder, a, pos_after_tag);
-        ast_skip_tree(a, ppos);
-      } else {
-        V7_CHECK_INTERNAL(tag == AST_IDENT);
-        lit = string_lit(bbuilder, a, pos_after_tag);
-      }
+/*
+ * Returns 1 if the literal operand of the instruction `i` is a number or a
+ * string, and stores the value in `*v` unless `v` is NULL.
+ */
+static int bopt_lit_const(struct bopt *o, size_t i, val_t *v) {
+  char *p = o->ops + o->insns[i].off, *q = p;
+  size_t idx = bcode_get_varint(&q);
+  val_t res;
 
-      /*
-       * preserve previous statement value.
-       * We need to feed the previous value into the stash
-       * because it's required for the loop steady state.
-       *
-       * The stash register is required to simplify the steady state stack
-       * management, in particular the removal of value in 3rd position in case
-       * a of not taken exit.
-       *
-       * TODO(mkm): consider having a stash OP that moves a value to the stash
-       * register instead of copying it. The current behaviour has been
-       * optimized for the `assign` use case which seems more common.
-       */
-      bcode_op(bbuilder, OP_DUP);
-      V7_TRY(compile_expr_builder(bbuilder, a, ppos));
-      bcode_op(bbuilder, OP_SWAP);
-      bcode_op(bbuilder, OP_STASH);
-      bcode_op(bbuilder, OP_DROP);
+  if (idx >= BCODE_MAX_INLINE_TYPE_TAG) {
+    res = ((val_t *) o->bbuilder->lit.buf)[idx - BCODE_MAX_INLINE_TYPE_TAG];
+    if (!v7_is_number(res) && !v7_is_string(res)) return 0;
+  } else if (idx == BCODE_INLINE_FUNC_TYPE_TAG) {
+    return 0;
+  } else if (v == NULL) {
+    /* don't make a string just to check it */
+    return 1;
+  } else {
+    res = bcode_decode_lit(o->v7, o->bbuilder->bcode, &p);
+  }
 
-      /*
-       * OP_NEXT_PROP keeps the current position in an opaque handler.
-       * Feeding a null as initial value.
-       */
-      bcode_op(bbuilder, OP_PUSH_NULL);
+  if (v != NULL) *v = res;
+  return 1;
+}
 
-      brend_label = bcode_op_target(bbuilder, OP_TRY_PUSH_LOOP);
+/*
+ * Returns 1 if the instruction `i` pushes a primitive constant, and stores
+ * its value in `*v` unless `v` is NULL.
+ */
+static int bopt_const(struct bopt *o, size_t i, val_t *v) {
+  struct bopt_insn *insn = &o->insns[i];
+  val_t res;
 
-      /* loop: */
-      loop_target = bcode_pos(bbuilder);
+  if (insn->flags & BOPT_CONST) {
+    res = insn->val;
+  } else {
+    switch (insn->op) {
+      case OP_PUSH_UNDEFINED:
+        res = V7_UNDEFINED;
+        break;
+      case OP_PUSH_NULL:
+        res = V7_NULL;
+        break;
+      case OP_PUSH_TRUE:
+      case OP_PUSH_FALSE:
+        res = v7_mk_boolean(o->v7, insn->op == OP_PUSH_TRUE);
+        break;
+      case OP_PUSH_ZERO:
+      case OP_PUSH_ONE:
+        res = v7_mk_number(o->v7, insn->op == OP_PUSH_ONE);
+        break;
+      case OP_PUSH_LIT:
+        return bopt_lit_const(o, i, v);
+      default:
+        return 0;
+    }
+  }
 
-      /*
-       * The loop stead state begins with the following stack layout:
-       * `( S:v o h )`
-       */
+  if (v != NULL) *v = res;
+  return 1;
+}
 
-      bcode_op(bbuilder, OP_NEXT_PROP);
-      end_label = bcode_op_target(bbuilder, OP_JMP_FALSE);
-      bcode_op_lit(bbuilder, OP_SET_VAR, lit);
+/* Returns 1 if the instruction `i` just pushes a value, without side effects */
+static int bopt_pure(struct bopt *o, size_t i) {
+  switch (o->insns[i].op) {
+    case OP_DUP:
+    case OP_PUSH_THIS:
+    case OP_PUSH_LIT:
+    case OP_GET_LOCAL:
+      return 1;
+    default:
+      return bopt_const(o, i, NULL);
+  }
+}
 
-      /*
-       * The stash register contains the value of the previous statement,
-       * being it the statement before the for..in statement or
-       * the previous iteration. We move it to the data stack. It will
-       * be replaced by the values of the body statements as usual.
-       */
-      bcode_op(bbuilder, OP_UNSTASH);
+/*
+ * Effect of an instruction on the names remembered for the "is not a
+ * function" errors, see `OP_CHECK_CALL`
+ */
+enum bopt_names {
+  BOPT_NAMES_KEEP,  /* leaves them as they are */
+  BOPT_NAMES_RESET, /* resets them, like `OP_PUSH_ZERO` does */
+  BOPT_NAMES_SET,   /* sets them, like `OP_GET_VAR` does */
+  BOPT_NAMES_READ   /* might use them */
+};
 
-      /*
-       * This node is always a NOP, for compatibility
-       * with the layout of the AST_FOR node.
-       */
-      ast_skip_tree(a, ppos);
+static enum bopt_names bopt_const_names(val_t v) {
+  return v7_is_string(v) || v7_is_undefined(v) || v7_is_null(v)
+             ? BOPT_NAMES_KEEP
+             : BOPT_NAMES_RESET;
+}
 
-      V7_TRY(compile_stmts(bbuilder, a, ppos, end));
+static enum bopt_names bopt_names(struct bopt *o, size_t i) {
+  struct bopt_insn *insn = &o->insns[i];
+  char *p;
+  size_t idx;
+
+  if (insn->flags & BOPT_CONST) {
+    return bopt_const_names(insn->val);
+  }
+  switch (insn->op) {
+    case OP_PUSH_THIS:
+    case OP_PUSH_TRUE:
+    case OP_PUSH_FALSE:
+    case OP_PUSH_ZERO:
+    case OP_PUSH_ONE:
+      return BOPT_NAMES_RESET;
+    case OP_PUSH_LIT:
+      p = o->ops + insn->off;
+      idx = bcode_get_varint(&p);
+      if (idx >= BCODE_MAX_INLINE_TYPE_TAG) {
+        val_t *lits = (val_t *) o->bbuilder->lit.buf;
+        return bopt_const_names(lits[idx - BCODE_MAX_INLINE_TYPE_TAG]);
+      }
+      return idx == BCODE_INLINE_STRING_TYPE_TAG ? BOPT_NAMES_KEEP
+                                                 : BOPT_NAMES_RESET;
+    case OP_GET_VAR:
+    case OP_SAFE_GET_VAR:
+    case OP_GET_LOCAL:
+    case OP_GET_VAR_PROP:
+      return BOPT_NAMES_SET;
+    case OP_GET:
+    case OP_GET_PROP:
+    case OP_CHECK_CALL:
+      return BOPT_NAMES_READ;
+    default:
+      return BOPT_NAMES_KEEP;
+  }
+}
 
-      continue_target = bcode_pos(bbuilder);
+/*
+ * Returns 1 if replacing the code having the names effect `before` with the
+ * one having the effect `after` is not noticeable at the instruction `i`,
+ * i.e. if they are the same or the names are overwritten before being used.
+ */
+static int bopt_names_kept(struct bopt *o, enum bopt_names before,
+                           enum bopt_names after, size_t i) {
+#ifndef V7_DISABLE_CALL_ERROR_CONTEXT
+  int n;
 
-      /*
-       * Save the last body statement. If next evaluation of NEXT_PROP returns
-       * false, we'll unstash it.
-       */
-      bcode_op(bbuilder, OP_STASH);
-      bcode_op(bbuilder, OP_DROP);
+  if (before == after) return 1;
+  for (n = 0; i < o->cnt && n < BOPT_MAX_NAMES_SCAN; n++) {
+    uint8_t op = o->insns[i].op;
+    switch (bopt_names(o, i)) {
+      case BOPT_NAMES_KEEP:
+        if (op == OP_JMP) {
+          i = bopt_live(o, o->insns[i].target);
+          continue;
+        }
+        /* be conservative about the code which is not straight */
+        if ((bopt_is_jump(op) && op != OP_TRY_PUSH_CATCH &&
+             op != OP_TRY_PUSH_FINALLY && op != OP_TRY_PUSH_LOOP &&
+             op != OP_TRY_PUSH_SWITCH) ||
+            op == OP_RET || op == OP_THROW || op == OP_BREAK ||
+            op == OP_CONTINUE) {
+          return 0;
+        }
+        break;
+      case BOPT_NAMES_READ:
+        return 0;
+      default:
+        return 1;
+    }
+    i = bopt_next(o, i);
+  }
+  return 0;
+#else
+  (void) o;
+  (void) before;
+  (void) after;
+  (void) i;
+  return 1;
+#endif
+}
 
-      loop_label = bcode_op_target(bbuilder, OP_JMP);
-      bcode_patch_target(bbuilder, loop_label, loop_target);
+/* Returns the names effect of the instructions from `i` to `last` */
+static enum bopt_names bopt_seq_names(struct bopt *o, size_t i, size_t last) {
+  enum bopt_names res = BOPT_NAMES_KEEP;
+  for (; i <= last; i = bopt_next(o, i)) {
+    enum bopt_names names = bopt_names(o, i);
+    if (names != BOPT_NAMES_KEEP) res = names;
+  }
+  return res;
+}
 
-      /* end: */
-      bcode_patch_target(bbuilder, end_label, bcode_pos(bbuilder));
-      bcode_op(bbuilder, OP_UNSTASH);
+/* Returns the length of the code pushing `v`, see `bopt_emit_const()` */
+static size_t bopt_const_len(struct bopt *o, val_t v) {
+  struct v7 *v7 = o->v7;
+  uint64_t tag = v & V7_TAG_MASK;
 
-      pop_label = bcode_op_target(bbuilder, OP_JMP);
+  if (v7_is_number(v)) {
+    if (v == v7_mk_number(v7, 0) || v == v7_mk_number(v7, 1)) return 1;
+    return 1 + 1 /* tag */ + sizeof(val_t);
+  } else if (v7_is_string(v)) {
+    /* the same as `bcode_add_lit()` does */
+    if (v7->is_precompiling || tag == V7_TAG_STRING_I ||
+        tag == V7_TAG_STRING_5) {
+      size_t len;
+      v7_get_string(v7, &v, &len);
+      return 1 + 1 /* tag */ + calc_llen(len) + len + 1 /* NUL */;
+    }
+    return 1 + calc_llen(o->bbuilder->lit.len / sizeof(val_t) +
+                         BCODE_MAX_INLINE_TYPE_TAG);
+  }
+  /* `undefined`, `null`, or a boolean */
+  return 1;
+}
 
-      /* brend: */
-      bcode_patch_target(bbuilder, brend_label, bcode_pos(bbuilder));
+static void bopt_emit_const(struct bopt *o, val_t v) {
+  struct bcode_builder *bbuilder = o->bbuilder;
+  struct v7 *v7 = o->v7;
+  uint8_t op;
 
-      continue_label = bcode_op_target(bbuilder, OP_JMP_IF_CONTINUE);
-      bcode_patch_target(bbuilder, continue_label, continue_target);
+  if (v == v7_mk_number(v7, 0)) {
+    op = OP_PUSH_ZERO;
+  } else if (v == v7_mk_number(v7, 1)) {
+    op = OP_PUSH_ONE;
+  } else if (v7_is_number(v) || v7_is_string(v)) {
+    bbuilder->last_op = BCODE_NO_OP;
+    bcode_op_lit(bbuilder, OP_PUSH_LIT, bcode_add_lit(bbuilder, v));
+    return;
+  } else if (v7_is_boolean(v)) {
+    op = v7_get_bool(v7, v) ? OP_PUSH_TRUE : OP_PUSH_FALSE;
+  } else if (v7_is_null(v)) {
+    op = OP_PUSH_NULL;
+  } else {
+    op = OP_PUSH_UNDEFINED;
+  }
+  bcode_ops_append(bbuilder, &op, 1);
+}
 
-      bcode_op(bbuilder, OP_SWAP_DROP);
-      bcode_op(bbuilder, OP_SWAP_DROP);
-      bcode_op(bbuilder, OP_SWAP_DROP);
+/*
+ * Replaces the instructions from `i` to `last` with a push of the result of
+ * `op` on the constants `v1` and `v2`, unless it would take more space.
+ * Returns 1 if the code was replaced.
+ */
+static int bopt_fold(struct bopt *o, size_t i, size_t last, enum opcode op,
+                     val_t v1, val_t v2) {
+  struct bopt_insn *insn = &o->insns[i];
+  size_t j, len = 0, new_len;
+  val_t res;
 
-      /* try_pop: */
-      bcode_patch_target(bbuilder, pop_label, bcode_pos(bbuilder));
+  if (eval_const_op(o->v7, op, v1, v2, &res) != V7_OK) {
+    return 0;
+  }
 
-      bcode_op(bbuilder, OP_TRY_POP);
+  for (j = i; j <= last; j = bopt_next(o, j)) {
+    len += o->insns[j].len;
+  }
+  new_len = bopt_const_len(o, res);
+  if (new_len > len ||
+      !bopt_names_kept(o, bopt_seq_names(o, i, last), bopt_const_names(res),
+                       bopt_next(o, last))) {
+    return 0;
+  }
 
-      bbuilder->v7->is_stack_neutral = 1;
-      break;
-    }
-    /*
-     * do {
-     *   B...
-     * } while(COND);
-     *
-     * ->
-     *
-     *   TRY_PUSH_LOOP end
-     * body:
-     *   <B>
-     * cond:
-     *   <COND>
-     *   JMP_TRUE body
-     * end:
-     *   JMP_IF_CONTINUE cond
-     *   TRY_POP
-     *
-     */
-    case AST_DOWHILE: {
-      bcode_off_t end_label, continue_label, continue_target;
-      end = ast_get_skip(a, pos_after_tag, AST_DO_WHILE_COND_SKIP);
-      end_label = bcode_op_target(bbuilder, OP_TRY_PUSH_LOOP);
-      body_target = bcode_pos(bbuilder);
-      V7_TRY(compile_stmts(bbuilder, a, ppos, end));
+  for (j = bopt_next(o, i); j <= last; j = bopt_next(o, j)) {
+    bopt_kill(o, j);
+  }
+  insn->op = OP_PUSH_LIT;
+  insn->flags |= BOPT_CONST;
+  insn->val = res;
+  insn->len = new_len;
+  o->changed = 1;
+  return 1;
+}
 
-      continue_target = bcode_pos(bbuilder);
-      V7_TRY(compile_expr_builder(bbuilder, a, ppos));
-      body_label = bcode_op_target(bbuilder, OP_JMP_TRUE);
-      bcode_patch_target(bbuilder, body_label, body_target);
+/*
+ * Makes the conditional jump `i` unconditional, or removes it, along with
+ * the constants from `first` computing its condition. Returns 0 if it can't
+ * be done.
+ */
+static int bopt_resolve_jump(struct bopt *o, size_t first, size_t i,
+                             int taken) {
+  size_t next = taken ? o->insns[i].target : bopt_next(o, i), j;
 
-      bcode_patch_target(bbuilder, end_label, bcode_pos(bbuilder));
-      continue_label = bcode_op_target(bbuilder, OP_JMP_IF_CONTINUE);
-      bcode_patch_target(bbuilder, continue_label, continue_target);
-      bcode_op(bbuilder, OP_TRY_POP);
+  if (!bopt_names_kept(o, bopt_seq_names(o, first, i), BOPT_NAMES_KEEP,
+                       next)) {
+    return 0;
+  }
+  for (j = first; j < i; j = bopt_next(o, j)) {
+    bopt_kill(o, j);
+  }
+  if (taken) {
+    o->insns[i].op = OP_JMP;
+    o->insns[i].len = 1 + sizeof(bcode_off_t);
+    o->changed = 1;
+  } else {
+    bopt_kill(o, i);
+  }
+  return 1;
+}
 
-      bbuilder->v7->is_stack_neutral = 1;
-      break;
+static int bopt_same_operands(struct bopt *o, size_t i, size_t j) {
+  struct bopt_insn *a = &o->insns[i], *b = &o->insns[j];
+  return a->len == b->len &&
+         memcmp(o->ops + a->off + 1, o->ops + b->off + 1, a->len - 1) == 0;
+}
+
+/* Rewrites short instruction sequences, none of which is jumped into */
+static void bopt_peephole(struct bopt *o) {
+  struct v7 *v7 = o->v7;
+  size_t i, j, k;
+  uint8_t opj, opk;
+  val_t v1, v2;
+
+  for (i = bopt_live(o, 0); i < o->cnt; i = bopt_next(o, i)) {
+  again:
+    /* all the patterns start with a push or a store */
+    if (o->insns[i].op != OP_SET_LOCAL && !bopt_pure(o, i)) continue;
+    j = bopt_next(o, i);
+    if (j >= o->cnt || (o->insns[j].flags & BOPT_LABEL)) continue;
+    k = bopt_next(o, j);
+    opj = o->insns[j].op;
+    opk = (k < o->cnt && !(o->insns[k].flags & BOPT_LABEL)) ? o->insns[k].op
+                                                             : OP_MAX;
+
+    if (bopt_const(o, i, NULL)) {
+      if (opj >= OP_NOT && opj <= OP_POS) {
+        /* `-1`, `!0` */
+        bopt_const(o, i, &v2);
+        if (bopt_fold(o, i, j, (enum opcode) opj, V7_UNDEFINED, v2)) {
+          goto again;
+        }
+      } else if (opj == OP_ADD_LIT && bopt_lit_const(o, j, NULL)) {
+        bopt_const(o, i, &v1);
+        bopt_lit_const(o, j, &v2);
+        if (bopt_fold(o, i, j, OP_ADD, v1, v2)) goto again;
+      } else if (opj == OP_JMP_TRUE || opj == OP_JMP_FALSE) {
+        /* `if (1)`, `while (1)` */
+        bopt_const(o, i, &v1);
+        if (bopt_resolve_jump(o, i, j,
+                              v7_is_truthy(v7, v1) == (opj == OP_JMP_TRUE))) {
+          continue;
+        }
+      } else if (opj == OP_DUP && (opk == OP_JMP_TRUE || opk == OP_JMP_FALSE)) {
+        /* `&&` and `||`: the value stays on the stack */
+        bopt_const(o, i, &v1);
+        if (bopt_resolve_jump(o, j, k,
+                              v7_is_truthy(v7, v1) == (opk == OP_JMP_TRUE))) {
+          goto again;
+        }
+      } else if (k < o->cnt && bopt_const(o, j, NULL)) {
+        if (opk >= OP_ADD && opk <= OP_GE) {
+          /* `1024 * 4`, `"a" + "b"`, `1 < 2` */
+          bopt_const(o, i, &v1);
+          bopt_const(o, j, &v2);
+          if (bopt_fold(o, i, k, (enum opcode) opk, v1, v2)) goto again;
+        } else if (opk == OP_CMP_JMP_TRUE || opk == OP_CMP_JMP_FALSE) {
+          val_t res;
+          bopt_const(o, i, &v1);
+          bopt_const(o, j, &v2);
+          if (eval_const_op(v7, (enum opcode) o->insns[k].arg, v1, v2, &res) ==
+                  V7_OK &&
+              bopt_resolve_jump(o, i, k, v7_is_truthy(v7, res) ==
+                                             (opk == OP_CMP_JMP_TRUE))) {
+            continue;
+          }
+        }
+      }
     }
-    case AST_VAR: {
-      /*
-       * Var decls are hoisted when the function frame is created. Vars
-       * declared inside a `with` or `catch` block belong to the function
-       * lexical scope, and although those clauses create an inner frame
-       * no new variables should be created in it. A var decl thus
-       * behaves as a normal assignment at runtime.
-       */
-      lit_t lit;
-      end = ast_get_skip(a, pos_after_tag, AST_END_SKIP);
-      while (*ppos < end) {
-        tag = fetch_tag(v7, bbuilder, a, ppos, &pos_after_tag);
-        if (tag == AST_FUNC_DECL) {
-          /*
-           * function declarations are already set during hoisting (see
-           * `compile_local_vars()`), so, skip it.
-           *
-           * Plus, they are stack-neutral, so don't forget to set
-           * `is_stack_neutral`.
-           */
-          ast_skip_tree(a, ppos);
-          bbuilder->v7->is_stack_neutral = 1;
-        } else {
-          /*
-           * compile `var` declaration: basically it looks similar to an
-           * assignment, but it differs from an assignment is that it's
-           * stack-neutral: `1; var a = 5;` yields `1`, not `5`.
-           */
-          V7_CHECK_INTERNAL(tag == AST_VAR_DECL);
-          lit = string_lit(bbuilder, a, pos_after_tag);
-          V7_TRY(compile_expr_builder(bbuilder, a, ppos));
-          bcode_op_lit(bbuilder, OP_SET_VAR, lit);
 
-          /* `var` declaration is stack-neutral */
-          bcode_op(bbuilder, OP_DROP);
-          bbuilder->v7->is_stack_neutral = 1;
-        }
+    if (opj == OP_DROP && bopt_pure(o, i) &&
+        bopt_names_kept(o, bopt_names(o, i), BOPT_NAMES_KEEP,
+                        bopt_next(o, j))) {
+      /* `PUSH_THIS; DROP`, `DUP; DROP` */
+      bopt_kill(o, i);
+      bopt_kill(o, j);
+    } else if (o->insns[i].op == OP_SET_LOCAL && opj == OP_DROP &&
+               opk == OP_GET_LOCAL && bopt_same_operands(o, i, k) &&
+               bopt_names_kept(o, BOPT_NAMES_SET, BOPT_NAMES_KEEP,
+                               bopt_next(o, k))) {
+      /* `a = x; a` */
+      bopt_kill(o, j);
+      bopt_kill(o, k);
+      goto again;
+    }
+  }
+}
+
+/*
+ * Retargets jumps to unconditional jumps, removes jumps to the next
+ * instruction, and turns conditional jumps over an unconditional jump into
+ * a single one.
+ */
+static void bopt_thread_jumps(struct bopt *o) {
+  size_t i, n, next;
+
+  for (i = bopt_live(o, 0); i < o->cnt; i = bopt_next(o, i)) {
+    struct bopt_insn *jmp = &o->insns[i];
+    int cond = jmp->op == OP_JMP_TRUE || jmp->op == OP_JMP_FALSE ||
+               jmp->op == OP_CMP_JMP_TRUE || jmp->op == OP_CMP_JMP_FALSE;
+    size_t t;
+
+    if (jmp->op != OP_JMP && jmp->op != OP_JMP_TRUE_DROP && !cond) continue;
+
+    t = bopt_live(o, jmp->target);
+    for (n = 0; n < BOPT_MAX_JUMP_CHAIN && t < o->cnt &&
+                o->insns[t].op == OP_JMP && !(o->insns[t].flags & BOPT_CONST);
+         n++) {
+      size_t t2 = bopt_live(o, o->insns[t].target);
+      if (t2 == t) break; /* endless loop */
+      t = t2;
+    }
+    if (t != jmp->target) {
+      jmp->target = t;
+      o->changed = 1;
+    }
+
+    next = bopt_next(o, i);
+    if (t == next && jmp->op == OP_JMP) {
+      bopt_kill(o, i);
+    } else if (t == next &&
+               (jmp->op == OP_JMP_TRUE || jmp->op == OP_JMP_FALSE)) {
+      jmp->op = OP_DROP;
+      jmp->len = 1;
+      o->changed = 1;
+    } else if (cond && next < o->cnt && o->insns[next].op == OP_JMP &&
+               !(o->insns[next].flags & (BOPT_LABEL | BOPT_CONST)) &&
+               t == bopt_next(o, next)) {
+      /* `JMP_FALSE a; JMP b; a:` is `JMP_TRUE b; a:` */
+      switch (jmp->op) {
+        case OP_JMP_TRUE:
+          jmp->op = OP_JMP_FALSE;
+          break;
+        case OP_JMP_FALSE:
+          jmp->op = OP_JMP_TRUE;
+          break;
+        case OP_CMP_JMP_TRUE:
+          jmp->op = OP_CMP_JMP_FALSE;
+          break;
+        default:
+          jmp->op = OP_CMP_JMP_TRUE;
+          break;
       }
-      break;
+      jmp->target = bopt_live(o, o->insns[next].target);
+      bopt_kill(o, next);
     }
-    case AST_RETURN:
-      bcode_op(bbuilder, OP_PUSH_UNDEFINED);
-      bcode_op(bbuilder, OP_RET);
-      break;
-    case AST_VALUE_RETURN:
-      V7_TRY(compile_expr_builder(bbuilder, a, ppos));
-      bcode_op(bbuilder, OP_RET);
-      break;
-    default:
-      *ppos = pos_after_tag - 1;
-      V7_TRY(compile_expr_builder(bbuilder, a, ppos));
   }
-
-clean:
-  mbuf_free(&case_labels);
-  return rcode;
 }
 
-static enum v7_err compile_body(struct bcode_builder *bbuilder, struct ast *a,
-                                ast_off_t start, ast_off_t end, ast_off_t body,
-                                ast_off_t fvar, ast_off_t *ppos) {
-  enum v7_err rcode = V7_OK;
-  struct v7 *v7 = bbuilder->v7;
+/* Removes the code which is never executed, e.g. after `return` */
+static void bopt_sweep_unreachable(struct bopt *o, struct mbuf *stack) {
+  size_t i;
 
-#ifndef V7_FORCE_STRICT_MODE
-  /* check 'use strict' */
-  if (*ppos < end) {
-    ast_off_t tmp_pos = body;
-    if (fetch_tag(v7, bbuilder, a, &tmp_pos, NULL) == AST_USE_STRICT) {
-      bbuilder->bcode->strict_mode = 1;
-      /* move `body` offset, effectively removing `AST_USE_STRICT` from it */
-      body = tmp_pos;
-    }
+  for (i = 0; i < o->cnt; i++) {
+    o->insns[i].flags &= ~BOPT_REACHED;
   }
-#endif
 
-  /* put initial value for the function body execution */
-  bcode_op(bbuilder, OP_PUSH_UNDEFINED);
+  stack->len = 0;
+  i = bopt_live(o, 0);
+  if (i < o->cnt) {
+    mbuf_append(stack, &i, sizeof(i));
+  }
 
-  /*
-   * populate `bcode->ops` with function's local variable names. Note that we
-   * should do this *after* `OP_PUSH_UNDEFINED`, since `compile_local_vars`
-   * emits code that assigns the hoisted functions to local variables, and
-   * those statements assume that the stack contains `undefined`.
-   */
-  V7_TRY(compile_local_vars(bbuilder, a, start, fvar));
+  while (stack->len > 0) {
+    stack->len -= sizeof(i);
+    memcpy(&i, stack->buf + stack->len, sizeof(i));
 
-  /* compile body */
-  *ppos = body;
-  V7_TRY(compile_stmts(bbuilder, a, ppos, end));
+    for (; i < o->cnt && !(o->insns[i].flags & BOPT_REACHED);
+         i = bopt_next(o, i)) {
+      struct bopt_insn *insn = &o->insns[i];
+      insn->flags |= BOPT_REACHED;
 
-clean:
-  return rcode;
+      /* exception handlers and loop exits are reached via `OP_TRY_PUSH_*` */
+      if (bopt_is_jump(insn->op)) {
+        size_t t = bopt_live(o, insn->target);
+        if (t < o->cnt) {
+          mbuf_append(stack, &t, sizeof(t));
+        }
+      }
+
+      if (insn->op == OP_JMP || insn->op == OP_RET || insn->op == OP_THROW ||
+          insn->op == OP_BREAK || insn->op == OP_CONTINUE) {
+        break;
+      }
+    }
+  }
+
+  for (i = bopt_live(o, 0); i < o->cnt; i = bopt_next(o, i)) {
+    if (!(o->insns[i].flags & BOPT_REACHED)) {
+      bopt_kill(o, i);
+    }
+  }
 }
 
 /*
- * Compiles a given script and populates a bcode structure.
- * The AST must start with an AST_SCRIPT node.
+ * Drops the literals which are no longer used from the table. Returns the map
+ * from the old indices to the new ones, which should be freed by the caller.
  */
-V7_PRIVATE enum v7_err compile_script(struct v7 *v7, struct ast *a,
-                                      struct bcode *bcode) {
-  ast_off_t pos_after_tag, end, fvar, pos = 0;
-  int saved_line_no = v7->line_no;
-  enum v7_err rcode = V7_OK;
-  struct bcode_builder bbuilder;
-  enum ast_tag tag;
+static size_t *bopt_compact_lits(struct bopt *o) {
+  struct bcode_builder *bbuilder = o->bbuilder;
+  size_t cnt = bbuilder->lit.len / sizeof(val_t), i, k;
+  val_t *lits = (val_t *) bbuilder->lit.buf;
+  size_t *map;
+  const char *d;
 
-  bcode_builder_init(v7, &bbuilder, bcode);
-  v7->line_no = 1;
+  if (cnt == 0) return NULL;
+  map = (size_t *) calloc(cnt, sizeof(*map));
+  if (map == NULL) return NULL;
 
-  tag = fetch_tag(v7, &bbuilder, a, &pos, &pos_after_tag);
+  for (i = bopt_live(o, 0); i < o->cnt; i = bopt_next(o, i)) {
+    struct bopt_insn *insn = &o->insns[i];
+    char *p = o->ops + insn->off + 1;
+    if ((insn->flags & (BOPT_CONST | BOPT_TABLE_LIT)) != BOPT_TABLE_LIT) {
+      continue;
+    }
+    for (d = bopt_operands(insn->op); *d != '\0'; d++) {
+      if (*d == 'L') {
+        int llen;
+        size_t idx = decode_varint((unsigned char *) p, &llen);
+        if (idx >= BCODE_MAX_INLINE_TYPE_TAG) {
+          map[idx - BCODE_MAX_INLINE_TYPE_TAG] = 1;
+        }
+      }
+      p += bopt_operand_len(*d, p);
+    }
+  }
 
-  /* first tag should always be AST_SCRIPT */
-  assert(tag == AST_SCRIPT);
-  (void) tag;
+  for (i = k = 0; i < cnt; i++) {
+    if (map[i]) {
+      lits[k] = lits[i];
+      map[i] = k++;
+    }
+  }
 
-  end = ast_get_skip(a, pos_after_tag, AST_END_SKIP);
-  fvar = ast_get_skip(a, pos_after_tag, AST_FUNC_FIRST_VAR_SKIP) - 1;
+#if V7_ENABLE__Memory__stats
+  bbuilder->v7->bcode_lit_total_size -= bbuilder->lit.len - k * sizeof(val_t);
+#endif
+  bbuilder->lit.len = k * sizeof(val_t);
+  bbuilder->bcode->lit.len = bbuilder->lit.len;
 
-  V7_TRY(compile_body(&bbuilder, a, pos_after_tag - 1, end, pos /* body */,
-                      fvar, &pos));
+  return map;
+}
 
-clean:
+/* Returns the new offset of the code at the original offset `off` */
+static bcode_off_t bopt_map_off(struct bopt *o, size_t off) {
+  size_t i;
+  if (off < o->start) return off;
+  i = bopt_find(o, off);
+  return i < o->cnt ? o->insns[i].new_off : o->bbuilder->ops.len;
+}
 
-  bcode_builder_finalize(&bbuilder);
+#ifndef V7_DISABLE_LINE_NUMBERS
+/* Moves the line number table entries along with the instructions */
+static void bopt_remap_lines(struct bopt *o) {
+  struct bcode_builder *bbuilder = o->bbuilder;
+  const unsigned char *p = (const unsigned char *) bbuilder->lines.buf;
+  const unsigned char *end = p + bbuilder->lines.len;
+  struct mbuf lines;
+  size_t off = 0, last_off = 0, new_off = 0;
+  int line_no = 0, llen, pending = 0;
+  unsigned char buf[16];
+
+  mbuf_init(&lines, bbuilder->lines.len);
+  while (p < end) {
+    size_t cur_off;
+    int cur_line_no;
+
+    off += decode_varint(p, &llen);
+    p += llen;
+    cur_line_no = decode_varint(p, &llen);
+    p += llen;
+    cur_off = bopt_map_off(o, off);
+
+    /* an entry is overridden by the next one at the same offset */
+    if (pending && cur_off != new_off) {
+      llen = encode_varint(new_off - last_off, buf);
+      llen += encode_varint(line_no, buf + llen);
+      mbuf_append(&lines, buf, llen);
+      last_off = new_off;
+    }
+    new_off = cur_off;
+    line_no = cur_line_no;
+    pending = 1;
+  }
+  if (pending) {
+    llen = encode_varint(new_off - last_off, buf);
+    llen += encode_varint(line_no, buf + llen);
+    mbuf_append(&lines, buf, llen);
+    last_off = new_off;
+  }
+
+  mbuf_free(&bbuilder->lines);
+  bbuilder->lines = lines;
+  bbuilder->lines_off = last_off;
+}
+#endif
+
+/* Encodes the live instructions back into `o->bbuilder` */
+static void bopt_encode(struct bopt *o) {
+  struct bcode_builder *bbuilder = o->bbuilder;
+  struct mbuf old = bbuilder->ops;
+  size_t *lit_map = bopt_compact_lits(o);
+  size_t i;
+  const char *d;
 
-#ifdef V7_BCODE_DUMP
-  if (rcode == V7_OK) {
-    fprintf(stderr, "--- script ---\n");
-    dump_bcode(v7, stderr, bcode);
-  }
+  mbuf_init(&bbuilder->ops, old.len);
+#if V7_ENABLE__Memory__stats
+  bbuilder->v7->bcode_ops_size -= old.len;
 #endif
 
-  v7->line_no = saved_line_no;
+  /* names are kept intact */
+  bcode_ops_append(bbuilder, old.buf, o->start);
 
-  return rcode;
-}
+  for (i = bopt_live(o, 0); i < o->cnt; i = bopt_next(o, i)) {
+    struct bopt_insn *insn = &o->insns[i];
+    char *p = old.buf + insn->off + 1;
 
-/*
- * Compiles a given function and populates a bcode structure.
- * The AST must contain an AST_FUNC node at offset ast_off.
- */
-V7_PRIVATE enum v7_err compile_function(struct v7 *v7, struct ast *a,
-                                        ast_off_t *ppos, struct bcode *bcode) {
-  ast_off_t pos_after_tag, start, end, body, fvar;
-  const char *name;
-  size_t name_len;
-  size_t args_cnt;
-  enum v7_err rcode = V7_OK;
-  struct bcode_builder bbuilder;
-  enum ast_tag tag;
-  size_t names_end = 0;
-  bcode_builder_init(v7, &bbuilder, bcode);
-  tag = fetch_tag(v7, &bbuilder, a, ppos, &pos_after_tag);
-  start = pos_after_tag - 1;
+    insn->new_off = bbuilder->ops.len;
+    if (insn->flags & BOPT_CONST) {
+      bopt_emit_const(o, insn->val);
+      continue;
+    }
 
-  (void) tag;
-  assert(tag == AST_FUNC);
-  end = ast_get_skip(a, pos_after_tag, AST_END_SKIP);
-  body = ast_get_skip(a, pos_after_tag, AST_FUNC_BODY_SKIP);
-  fvar = ast_get_skip(a, pos_after_tag, AST_FUNC_FIRST_VAR_SKIP) - 1;
+    if ((uint8_t) old.buf[insn->off] == insn->op && !bopt_is_jump(insn->op) &&
+        !(insn->flags & BOPT_TABLE_LIT)) {
+      bcode_ops_append(bbuilder, old.buf + insn->off, insn->len);
+      continue;
+    }
 
-  /* retrieve function name */
-  tag = fetch_tag(v7, &bbuilder, a, ppos, &pos_after_tag);
-  if (tag == AST_IDENT) {
-    /* function name is provided */
-    name = ast_get_inlined_data(a, pos_after_tag, &name_len);
-    V7_TRY(bcode_add_name(&bbuilder, name, name_len, &names_end));
-  } else {
-    /* no name: anonymous function */
-    V7_TRY(bcode_add_name(&bbuilder, "", 0, &names_end));
+    /* jumps might have been rewritten, so their operands are not copied */
+    bcode_ops_append(bbuilder, &insn->op, 1);
+    for (d = bopt_operands(insn->op); *d != '\0'; d++) {
+      size_t len = bopt_operand_len(*d, p);
+      int llen;
+      size_t idx = decode_varint((unsigned char *) p, &llen);
+
+      if (*d == 'B') {
+        bcode_ops_append(bbuilder, &insn->arg, 1);
+      } else if (*d == 'T') {
+        insn->tpos = bbuilder->ops.len;
+        bcode_ops_append(bbuilder, NULL, sizeof(bcode_off_t));
+      } else if (*d == 'L' && idx >= BCODE_MAX_INLINE_TYPE_TAG &&
+                 lit_map != NULL) {
+        bcode_add_varint(bbuilder, lit_map[idx - BCODE_MAX_INLINE_TYPE_TAG] +
+                                       BCODE_MAX_INLINE_TYPE_TAG);
+      } else {
+        bcode_ops_append(bbuilder, p, len);
+      }
+      p += len;
+    }
   }
 
-  /* retrieve function's argument names */
-  for (args_cnt = 0; *ppos < body; args_cnt++) {
-    if (args_cnt > V7_ARGS_CNT_MAX) {
-      /* too many arguments */
-      rcode = v7_throwf(v7, SYNTAX_ERROR, "Too many arguments");
-      V7_THROW(V7_SYNTAX_ERROR);
+  /* removed instructions are where the next live one is */
+  for (i = o->cnt; i-- > 0;) {
+    if (o->insns[i].flags & BOPT_DEAD) {
+      o->insns[i].new_off =
+          i + 1 < o->cnt ? o->insns[i + 1].new_off : bbuilder->ops.len;
     }
-
-    tag = fetch_tag(v7, &bbuilder, a, ppos, &pos_after_tag);
-    /*
-     * TODO(dfrank): it's not actually an internal error, we get here if
-     * we compile e.g. the following: (function(1){})
-     */
-    V7_CHECK_INTERNAL(tag == AST_IDENT);
-    name = ast_get_inlined_data(a, pos_after_tag, &name_len);
-    V7_TRY(bcode_add_name(&bbuilder, name, name_len, &names_end));
   }
 
-  bcode->args_cnt = args_cnt;
-  bcode->func_name_present = 1;
-
-  V7_TRY(compile_body(&bbuilder, a, start, end, body, fvar, ppos));
-
-clean:
-  bcode_builder_finalize(&bbuilder);
-
-#ifdef V7_BCODE_DUMP
-  if (rcode == V7_OK) {
-    fprintf(stderr, "--- function ---\n");
-    dump_bcode(v7, stderr, bcode);
+  for (i = bopt_live(o, 0); i < o->cnt; i = bopt_next(o, i)) {
+    struct bopt_insn *jmp = &o->insns[i];
+    bcode_off_t target;
+    if (!bopt_is_jump(jmp->op)) continue;
+    target = jmp->target < o->cnt ? o->insns[jmp->target].new_off
+                                  : bbuilder->ops.len;
+    memcpy(bbuilder->ops.buf + jmp->tpos, &target, sizeof(target));
   }
+
+#ifndef V7_DISABLE_LINE_NUMBERS
+  bopt_remap_lines(o);
 #endif
 
-  return rcode;
+  bbuilder->last_op = BCODE_NO_OP;
+  bbuilder->prev_op = BCODE_NO_OP;
+  bbuilder->label = bbuilder->ops.len;
+
+  mbuf_free(&old);
+  free(lit_map);
 }
 
-V7_PRIVATE enum v7_err compile_expr(struct v7 *v7, struct ast *a,
-                                    ast_off_t *ppos, struct bcode *bcode) {
-  enum v7_err rcode = V7_OK;
-  struct bcode_builder bbuilder;
-  int saved_line_no = v7->line_no;
+V7_PRIVATE void bcode_optimize(struct bcode_builder *bbuilder) {
+  struct bopt o;
+  struct mbuf insns, stack;
+  int round, changed = 0;
 
-  bcode_builder_init(v7, &bbuilder, bcode);
-  v7->line_no = 1;
+  memset(&o, 0, sizeof(o));
+  o.bbuilder = bbuilder;
+  o.v7 = bbuilder->v7;
+  o.ops = bbuilder->ops.buf;
+  o.start = bcode_end_names(o.ops, bbuilder->bcode->names_cnt) - o.ops;
 
-  rcode = compile_expr_builder(&bbuilder, a, ppos);
+  /* instructions take a couple of bytes on average */
+  mbuf_init(&insns,
+            (bbuilder->ops.len - o.start) / 2 * sizeof(struct bopt_insn));
+  mbuf_init(&stack, 0);
 
-  bcode_builder_finalize(&bbuilder);
-  v7->line_no = saved_line_no;
-  return rcode;
+  if (bopt_decode(&o, &insns)) {
+    for (round = 0; round < V7_BCODE_OPT_MAX_ROUNDS; round++) {
+      bopt_sweep_unreachable(&o, &stack);
+      changed |= o.changed;
+      o.changed = 0;
+      bopt_mark_labels(&o);
+      bopt_peephole(&o);
+      bopt_thread_jumps(&o);
+      if (!o.changed) break;
+      changed = 1;
+    }
+    if (changed) {
+      bopt_encode(&o);
+    }
+  }
+
+  mbuf_free(&insns);
+  mbuf_free(&stack);
 }
+
+#endif /* V7_DISABLE_BCODE_OPT */
 #ifdef V7_MODULE_LINES
 #line 1 "./src/stdlib.c"
 #endif
@@ -25380,6 +33579,7 @@ V7_PRIVATE enum v7_err compile_expr(struct v7 *v7, struct ast *a,
 /* Amalgamated: #include "v7/src/std_object.h" */
 /* Amalgamated: #include "v7/src/std_regex.h" */
 /* Amalgamated: #include "v7/src/std_string.h" */
+/* Amalgamated: #include "v7/src/std_typedarray.h" */
 /* Amalgamated: #include "v7/src/js_stdlib.h" */
 /* Amalgamated: #include "v7/src/object.h" */
 /* Amalgamated: #include "v7/src/string.h" */
@@ -25563,7 +33763,7 @@ V7_PRIVATE enum v7_err Std_parseFloat(struct v7 *v7, v7_val_t *res) {
     p++;
   }
 
-  result = strtod(p, &end);
+  result = cs_strtod(p, &end);
 
   *res = (p == end) ? V7_TAG_NAN : v7_mk_number(v7, result);
 
@@ -25671,6 +33871,9 @@ V7_PRIVATE void init_stdlib(struct v7 *v7) {
   init_date(v7);
 #endif
   init_function(v7);
+#if V7_ENABLE__ArrayBuffer
+  init_typedarray(v7);
+#endif
   init_js_stdlib(v7);
 }
 #ifdef V7_MODULE_LINES
@@ -25872,6 +34075,8 @@ static const char * const js_functions[] = {
 #define SLRE_MAX_RANGES 32
 #define SLRE_MAX_SETS 16
 #define SLRE_MAX_REP 0xFFFF
+#define SLRE_MAX_UNROLL 256 /* max instructions of an unrolled repetition */
+#define SLRE_MAX_PREFIX 16
 
 #define SLRE_MALLOC malloc
 #define SLRE_FREE free
@@ -25978,8 +34183,14 @@ struct slre_instruction {
 
 struct slre_prog {
   struct slre_instruction *start, *end;
+  struct slre_instruction *body; /* the pattern itself, past the search loop */
   unsigned int num_captures;
+  unsigned int refcnt;
   int flags;
+  unsigned char backtrack; /* has to be run by `re_match()`, see `re_pike()` */
+  unsigned char anchored;  /* can only match at the beginning of input */
+  unsigned char prefix_len;
+  char prefix[SLRE_MAX_PREFIX]; /* literal each match starts with */
   struct slre_class charset[SLRE_MAX_SETS];
 };
 
@@ -26583,6 +34794,20 @@ static struct slre_node *re_parser(struct slre_env *e) {
   return alt;
 }
 
+static unsigned int re_nodelen(struct slre_node *nd);
+
+/*
+ * Returns the length of the counted repetition `nd` once unrolled into
+ * copies of the repeated node: `x{2,4}` becomes `xx(?:x(?:x)?)?`, and
+ * `x{2,}` becomes `xxx*`.
+ */
+static unsigned long re_unrolled_len(struct slre_node *nd) {
+  unsigned long len = re_nodelen(nd->par.xy.x);
+  unsigned long min = nd->par.xy.y.rp.min, max = nd->par.xy.y.rp.max;
+  if (max >= SLRE_MAX_REP) return min * len + len + 2;
+  return min * len + (max - min) * (len + 1);
+}
+
 static unsigned int re_nodelen(struct slre_node *nd) {
   unsigned int n = 0;
   if (!nd) return 0;
@@ -26607,6 +34832,9 @@ static unsigned int re_nodelen(struct slre_node *nd) {
           if (nd->par.xy.y.rp.max >= SLRE_MAX_REP)
             return re_nodelen(nd->par.xy.x) + 1;
         default:
+          if (re_unrolled_len(nd) <= SLRE_MAX_UNROLL) {
+            return re_unrolled_len(nd);
+          }
           n = 4;
           if (nd->par.xy.y.rp.max >= SLRE_MAX_REP) n++;
           return re_nodelen(nd->par.xy.x) + n;
@@ -26622,6 +34850,52 @@ static struct slre_instruction *re_newinst(struct slre_prog *prog, int opcode) {
   return prog->end++;
 }
 
+static void re_compile(struct slre_env *e, struct slre_node *nd);
+
+/*
+ * Compiles the counted repetition `nd` as a sequence of copies of the
+ * repeated node, see `re_unrolled_len()`. Unlike `I_REP`, which keeps its
+ * counter in the program, this can run on the Pike VM.
+ */
+static void re_compile_unrolled(struct slre_env *e, struct slre_node *nd) {
+  struct slre_instruction *first, *split, *jump;
+  unsigned int i, min = nd->par.xy.y.rp.min, max = nd->par.xy.y.rp.max;
+  unsigned int len = re_nodelen(nd->par.xy.x);
+
+  for (i = 0; i < min; i++) {
+    re_compile(e, nd->par.xy.x);
+  }
+
+  if (max >= SLRE_MAX_REP) {
+    split = re_newinst(e->prog, I_SPLIT);
+    re_compile(e, nd->par.xy.x);
+    jump = re_newinst(e->prog, I_JUMP);
+    jump->par.xy.x = split;
+    split->par.xy.x = split + 1;
+    split->par.xy.y.y = e->prog->end;
+    if (nd->par.xy.y.rp.ng) {
+      split->par.xy.y.y = split + 1;
+      split->par.xy.x = e->prog->end;
+    }
+    return;
+  }
+
+  /* Optional copies: skipping one of them skips all the following ones */
+  first = e->prog->end;
+  for (i = min; i < max; i++) {
+    re_newinst(e->prog, I_SPLIT);
+    re_compile(e, nd->par.xy.x);
+  }
+  for (split = first; split < e->prog->end; split += len + 1) {
+    split->par.xy.x = split + 1;
+    split->par.xy.y.y = e->prog->end;
+    if (nd->par.xy.y.rp.ng) {
+      split->par.xy.y.y = split + 1;
+      split->par.xy.x = e->prog->end;
+    }
+  }
+}
+
 static void re_compile(struct slre_env *e, struct slre_node *nd) {
   struct slre_instruction *inst, *split, *jump, *rep;
   unsigned int n;
@@ -26729,6 +35003,10 @@ static void re_compile(struct slre_env *e, struct slre_node *nd) {
             break;
           }
         default:
+          if (re_unrolled_len(nd) <= SLRE_MAX_UNROLL) {
+            re_compile_unrolled(e, nd);
+            break;
+          }
           inst = re_newinst(e->prog, I_REP_INI);
           inst->par.xy.y.rp.min = nd->par.xy.y.rp.min;
           inst->par.xy.y.rp.max = n;
@@ -26950,6 +35228,40 @@ static void program_print(struct slre_prog *prog) {
 }
 #endif
 
+/*
+ * Collects what the executors need to know about the compiled program: which
+ * of them can run it, and how to skip the input positions where no match can
+ * start.
+ */
+static void re_analyze(struct slre_prog *prog) {
+  struct slre_instruction *inst;
+
+  prog->refcnt = 1;
+  prog->backtrack = prog->anchored = prog->prefix_len = 0;
+  for (inst = prog->start; inst < prog->end; inst++) {
+    if (inst->opcode == I_REF || inst->opcode == I_REP) prog->backtrack = 1;
+  }
+
+  /*
+   * The body is straight-line code up to the first branch or assertion, so
+   * every match has to start with the characters it consumes up to there.
+   */
+  for (inst = prog->body; inst->opcode == I_LBRA || inst->opcode == I_RBRA;
+       inst++) {
+  }
+  if (inst->opcode == I_BOL && !(prog->flags & SLRE_FLAG_M)) {
+    prog->anchored = 1;
+  }
+  if (prog->flags & SLRE_FLAG_I) return;
+  for (; prog->prefix_len < SLRE_MAX_PREFIX; inst++) {
+    if (inst->opcode == I_CH && inst->par.c > 0 && inst->par.c < Runeself) {
+      prog->prefix[prog->prefix_len++] = (char) inst->par.c;
+    } else if (inst->opcode != I_LBRA && inst->opcode != I_RBRA) {
+      break;
+    }
+  }
+}
+
 int slre_compile(const char *pat, size_t pat_len, const char *flags,
                  volatile size_t fl_len, struct slre_prog **pr, int is_regex) {
   struct slre_env e;
@@ -27009,10 +35321,11 @@ int slre_compile(const char *pat, size_t pat_len, const char *flags,
   re_newinst(e.prog, I_ANYNL);
   jump = re_newinst(e.prog, I_JUMP);
   jump->par.xy.x = split;
-  re_newinst(e.prog, I_LBRA);
+  e.prog->body = re_newinst(e.prog, I_LBRA);
   re_compile(&e, nd);
   re_newinst(e.prog, I_RBRA);
   re_newinst(e.prog, I_END);
+  re_analyze(e.prog);
 
 #ifdef RE_TEST
   node_print(nd);
@@ -27031,8 +35344,12 @@ int slre_compile(const char *pat, size_t pat_len, const char *flags,
   return err_code;
 }
 
+void slre_retain(struct slre_prog *prog) {
+  prog->refcnt++;
+}
+
 void slre_free(struct slre_prog *prog) {
-  if (prog) {
+  if (prog && --prog->refcnt == 0) {
     SLRE_FREE(prog->start);
     SLRE_FREE(prog);
   }
@@ -27064,12 +35381,25 @@ static void free_threads(struct slre_thread *t) {
 #define RE_NO_MATCH() \
   if (!(thr = 0)) continue
 
+static int re_in_range(struct slre_class *cp, Rune c) {
+  struct slre_range *p;
+  for (p = cp->spans; p < cp->end; p++) {
+    if (p->s <= c && c <= p->e) return 1;
+  }
+  return 0;
+}
+
+static int re_in_set(struct slre_class *cp, Rune c, unsigned int flags) {
+  if (re_in_range(cp, c)) return 1;
+  return (flags & SLRE_FLAG_I) &&
+         (re_in_range(cp, tolowerrune(c)) || re_in_range(cp, toupperrune(c)));
+}
+
 static unsigned char re_match(struct slre_instruction *pc, const char *current,
                               const char *end, const char *bol,
                               unsigned int flags, struct slre_loot *loot) {
   struct slre_loot sub, tmpsub;
   Rune c, r;
-  struct slre_range *p;
   unsigned char thr;
   size_t i;
   struct slre_thread thread, *curr_thread, *tmp_thr;
@@ -27184,18 +35514,8 @@ static unsigned char re_match(struct slre_instruction *pc, const char *current,
           current += chartorune(&c, current);
           if (!c) RE_NO_MATCH();
 
-          i = 1;
-          for (p = pc->par.cp->spans; i && p < pc->par.cp->end; p++)
-            if (flags & SLRE_FLAG_I) {
-              for (r = p->s; r <= p->e; ++r)
-                if (tolowerrune(c) == tolowerrune(r)) {
-                  i = 0;
-                  break;
-                }
-            } else if (p->s <= c && c <= p->e)
-              i = 0;
-
-          if (pc->opcode == I_SET) i = !i;
+          i = re_in_set(pc->par.cp, c, flags);
+          if (pc->opcode == I_SET_N) i = !i;
           if (i) break;
           RE_NO_MATCH();
 
@@ -27228,31 +35548,348 @@ static unsigned char re_match(struct slre_instruction *pc, const char *current,
   return 0;
 }
 
+/*
+ * Pike VM: all the threads of a program run in lock step over the input, one
+ * rune at a time, and a thread is dropped when it reaches an instruction some
+ * higher priority thread has already reached at the same input position.
+ * Matching therefore takes time linear in the length of the input, unlike
+ * `re_match()` which can backtrack exponentially. Threads are kept in
+ * priority order, which gives the same results as `re_match()`: leftmost
+ * match, preferring earlier alternatives and greedy repetitions.
+ *
+ * Back references and `I_REP` counters don't fit this model, programs which
+ * use them are run by `re_match()`. Lookahead bodies are run by `re_match()`
+ * too, as assertions.
+ */
+struct slre_pike_thread {
+  struct slre_instruction *pc;
+  struct slre_cap *caps;
+};
+
+struct slre_pike_list {
+  int n;
+  struct slre_pike_thread *t;
+};
+
+/* Frame of the explicit stack used by `re_pike_add()` */
+struct slre_pike_frame {
+  struct slre_instruction *pc; /* instruction to follow, or NULL */
+  int cap;                     /* otherwise, capture to restore */
+  struct slre_cap saved;
+};
+
+struct slre_pike {
+  struct slre_prog *prog;
+  const char *bol, *end;
+  unsigned int ncaps;
+  const char **mark; /* input position each instruction was last added at */
+  struct slre_pike_frame *stack;
+  struct slre_cap *caps; /* captures of the thread being added */
+  struct slre_pike_list lists[2];
+};
+
+static int re_pike_init(struct slre_pike *vm, struct slre_prog *prog,
+                        const char *bol, const char *end) {
+  struct slre_instruction *inst;
+  size_t n = prog->end - prog->start, nthreads = 0, nframes = 1;
+  size_t i, j, ncaps = prog->num_captures, size;
+  struct slre_cap *caps;
+  char *mem;
+
+  for (inst = prog->start; inst < prog->end; inst++) {
+    switch (inst->opcode) {
+      case I_SPLIT:
+      case I_LBRA:
+      case I_RBRA:
+        nframes++;
+        break;
+      case I_LA:
+        nframes += ncaps;
+        break;
+      case I_ANY:
+      case I_ANYNL:
+      case I_CH:
+      case I_SET:
+      case I_SET_N:
+      case I_END:
+        nthreads++;
+        break;
+    }
+  }
+
+  size = n * sizeof(*vm->mark) + nframes * sizeof(*vm->stack) +
+         2 * nthreads * sizeof(struct slre_pike_thread) +
+         (2 * nthreads + 1) * ncaps * sizeof(struct slre_cap);
+  if ((mem = (char *) SLRE_MALLOC(size)) == NULL) return 0;
+
+  vm->prog = prog;
+  vm->bol = bol;
+  vm->end = end;
+  vm->ncaps = ncaps;
+  vm->stack = (struct slre_pike_frame *) mem;
+  vm->mark = (const char **) (vm->stack + nframes);
+  vm->lists[0].t = (struct slre_pike_thread *) (vm->mark + n);
+  vm->lists[1].t = vm->lists[0].t + nthreads;
+  caps = (struct slre_cap *) (vm->lists[1].t + nthreads);
+  for (i = 0; i < 2; i++) {
+    for (j = 0; j < nthreads; j++, caps += ncaps) {
+      vm->lists[i].t[j].caps = caps;
+    }
+  }
+  vm->caps = caps;
+  return 1;
+}
+
+/*
+ * Adds a thread at `pc` to the list `l`, following jumps and zero-width
+ * instructions right away, so that the list only has threads which are
+ * about to consume a rune or to report a match.
+ */
+static void re_pike_add(struct slre_pike *vm, struct slre_pike_list *l,
+                        struct slre_instruction *pc, const char *sp) {
+  struct slre_pike_frame *top = vm->stack;
+  struct slre_cap *caps = vm->caps;
+  struct slre_loot sub;
+  unsigned int flags = vm->prog->flags, i;
+  int ok;
+
+  top->pc = pc;
+  while (top >= vm->stack) {
+    if ((pc = top->pc) == NULL) {
+      caps[top->cap] = top->saved;
+      top--;
+      continue;
+    }
+    top--;
+
+    while (vm->mark[pc - vm->prog->start] != sp) {
+      vm->mark[pc - vm->prog->start] = sp;
+      switch (pc->opcode) {
+        case I_JUMP:
+          pc = pc->par.xy.x;
+          continue;
+        case I_SPLIT:
+          (++top)->pc = pc->par.xy.y.y;
+          pc = pc->par.xy.x;
+          continue;
+        case I_LBRA:
+        case I_RBRA:
+          ++top;
+          top->pc = NULL;
+          top->cap = pc->par.n;
+          top->saved = caps[pc->par.n];
+          if (pc->opcode == I_LBRA) {
+            caps[pc->par.n].start = sp;
+          } else {
+            caps[pc->par.n].end = sp;
+          }
+          pc++;
+          continue;
+        case I_BOL:
+          ok = sp == vm->bol || ((flags & SLRE_FLAG_M) && isnewline(sp[-1]));
+          break;
+        case I_EOL:
+          ok = sp >= vm->end || ((flags & SLRE_FLAG_M) && isnewline(*sp));
+          break;
+        case I_EOS:
+          ok = sp >= vm->end;
+          break;
+        case I_WORD:
+        case I_WORD_N:
+          ok = (sp > vm->bol && iswordchar(sp[-1]));
+          if (sp < vm->end && iswordchar(sp[0])) ok = !ok;
+          if (pc->opcode == I_WORD_N) ok = !ok;
+          break;
+        case I_LA:
+        case I_LA_N:
+          memcpy(sub.caps, caps, vm->ncaps * sizeof(*caps));
+          ok = re_match(pc->par.xy.x, sp, vm->end, vm->bol, flags, &sub);
+          if (pc->opcode == I_LA_N) {
+            ok = !ok;
+          } else if (ok) {
+            /* Captures made by the lookahead body are kept */
+            for (i = 0; i < vm->ncaps; i++) {
+              ++top;
+              top->pc = NULL;
+              top->cap = i;
+              top->saved = caps[i];
+              caps[i] = sub.caps[i];
+            }
+          }
+          if (ok) {
+            pc = pc->par.xy.y.y;
+            continue;
+          }
+          break;
+        default:
+          l->t[l->n].pc = pc;
+          memcpy(l->t[l->n++].caps, caps, vm->ncaps * sizeof(*caps));
+          ok = 0;
+          break;
+      }
+      if (!ok) break;
+      pc++;
+    }
+  }
+}
+
+static int re_pike_step(struct slre_instruction *pc, Rune c,
+                        unsigned int flags) {
+  switch (pc->opcode) {
+    case I_ANY:
+      return !isnewline(c);
+    case I_ANYNL:
+      return 1;
+    case I_CH:
+      return c == pc->par.c || ((flags & SLRE_FLAG_I) &&
+                                tolowerrune(c) == tolowerrune(pc->par.c));
+    case I_SET:
+      return re_in_set(pc->par.cp, c, flags);
+    case I_SET_N:
+      return !re_in_set(pc->par.cp, c, flags);
+  }
+  return 0;
+}
+
+/*
+ * Returns whether a match can start at `sp`, judging by the program's
+ * anchoring and literal prefix.
+ */
+static int re_can_start(struct slre_prog *prog, const char *sp,
+                        const char *bol, const char *end) {
+  if (prog->anchored && sp != bol) return 0;
+  return (size_t)(end - sp) >= prog->prefix_len &&
+         memcmp(sp, prog->prefix, prog->prefix_len) == 0;
+}
+
+/* Returns the first position at or after `sp` a match can start at, or NULL */
+static const char *re_scan(struct slre_prog *prog, const char *sp,
+                           const char *bol, const char *end) {
+  const char *p;
+
+  if (prog->anchored) return sp == bol ? sp : NULL;
+  if (prog->prefix_len == 0) return sp <= end ? sp : NULL;
+
+  while ((size_t)(end - sp) >= prog->prefix_len) {
+    p = (const char *) memchr(sp, prog->prefix[0],
+                              (end - sp) - prog->prefix_len + 1);
+    if (p == NULL) break;
+    if (memcmp(p + 1, prog->prefix + 1, prog->prefix_len - 1) == 0) return p;
+    sp = p + 1;
+  }
+  return NULL;
+}
+
+/* Finds the leftmost match at or after `sp` */
+static int re_pike(struct slre_pike *vm, const char *sp,
+                   struct slre_loot *loot) {
+  struct slre_pike_list *clist = &vm->lists[0], *nlist = &vm->lists[1], *tmp;
+  struct slre_prog *prog = vm->prog;
+  size_t caps_size = vm->ncaps * sizeof(struct slre_cap);
+  int matched = 0, i, len = 0;
+  Rune c;
+
+  memset(vm->mark, 0, (prog->end - prog->start) * sizeof(*vm->mark));
+  clist->n = 0;
+  for (;;) {
+    /* A new thread, of the lowest priority, for a match starting here */
+    if (!matched) {
+      if (clist->n == 0 &&
+          (sp = re_scan(prog, sp, vm->bol, vm->end)) == NULL) {
+        break;
+      }
+      if (re_can_start(prog, sp, vm->bol, vm->end)) {
+        memset(vm->caps, 0, caps_size);
+        re_pike_add(vm, clist, prog->body, sp);
+      }
+    }
+
+    c = 0;
+    if (sp < vm->end) len = chartorune(&c, sp);
+    if (clist->n == 0) {
+      if (matched || sp >= vm->end) break;
+      sp += len;
+      continue;
+    }
+    nlist->n = 0;
+    for (i = 0; i < clist->n; i++) {
+      struct slre_pike_thread *t = &clist->t[i];
+      if (t->pc->opcode == I_END) {
+        /* Threads of lower priority than a matching one are cut off */
+        memcpy(loot->caps, t->caps, caps_size);
+        matched = 1;
+        break;
+      }
+      if (c != 0 && re_pike_step(t->pc, c, prog->flags)) {
+        memcpy(vm->caps, t->caps, caps_size);
+        re_pike_add(vm, nlist, t->pc + 1, sp + len);
+      }
+    }
+    if (sp >= vm->end) break;
+
+    tmp = clist;
+    clist = nlist;
+    nlist = tmp;
+    sp += len;
+  }
+  return matched;
+}
+
+/*
+ * Finds the leftmost match at or after `sp`, using the Pike VM `vm` when
+ * available, or the backtracking matcher.
+ */
+static int re_exec(struct slre_prog *prog, struct slre_pike *vm,
+                   const char *sp, const char *bol, const char *end,
+                   struct slre_loot *loot) {
+  Rune c;
+
+  if (vm != NULL) return re_pike(vm, sp, loot);
+
+  while ((sp = re_scan(prog, sp, bol, end)) != NULL) {
+    if (re_can_start(prog, sp, bol, end) &&
+        re_match(prog->body, sp, end, bol, prog->flags, loot)) {
+      return 1;
+    }
+    if (sp >= end) break;
+    sp += chartorune(&c, sp);
+  }
+  return 0;
+}
+
 int slre_exec(struct slre_prog *prog, int flag_g, const char *start,
               const char *end, struct slre_loot *loot) {
   struct slre_loot tmpsub;
+  struct slre_pike pike, *vm = NULL;
   const char *st = start;
+  int res;
 
   if (!loot) loot = &tmpsub;
   memset(loot, 0, sizeof(*loot));
 
+  /* Fall back to backtracking if there is no memory for the Pike VM */
+  if (!prog->backtrack && re_pike_init(&pike, prog, start, end)) vm = &pike;
+
   if (!flag_g) {
     loot->num_captures = prog->num_captures;
-    return !re_match(prog->start, start, end, start, prog->flags, loot);
-  }
-
-  while (re_match(prog->start, st, end, start, prog->flags, &tmpsub)) {
-    unsigned int i;
-    st = tmpsub.caps[0].end;
-    for (i = 0; i < prog->num_captures; i++) {
-      struct slre_cap *l = &loot->caps[loot->num_captures + i];
-      struct slre_cap *s = &tmpsub.caps[i];
-      l->start = s->start;
-      l->end = s->end;
+    res = !re_exec(prog, vm, start, start, end, loot);
+  } else {
+    while (re_exec(prog, vm, st, start, end, &tmpsub)) {
+      unsigned int i;
+      st = tmpsub.caps[0].end;
+      for (i = 0; i < prog->num_captures; i++) {
+        struct slre_cap *l = &loot->caps[loot->num_captures + i];
+        struct slre_cap *s = &tmpsub.caps[i];
+        l->start = s->start;
+        l->end = s->end;
+      }
+      loot->num_captures += prog->num_captures;
     }
-    loot->num_captures += prog->num_captures;
+    res = !loot->num_captures;
   }
-  return !loot->num_captures;
+
+  if (vm != NULL) SLRE_FREE(vm->stack);
+  return res;
 }
 
 int slre_replace(struct slre_loot *loot, const char *src, size_t src_len,
@@ -27950,6 +36587,7 @@ int v7_stack_track_end(struct v7 *v7, struct stack_track_ctx *ctx) {
 /* Amalgamated: #include "v7/src/string.h" */
 /* Amalgamated: #include "v7/src/regexp.h" */
 /* Amalgamated: #include "v7/src/exec.h" */
+/* Amalgamated: #include "v7/src/std_typedarray.h" */
 
 #if V7_ENABLE__Object__getPrototypeOf
 WARN_UNUSED_RESULT
@@ -28002,6 +36640,9 @@ static enum v7_err _Obj_ownKeys(struct v7 *v7, unsigned int ignore_flags,
                                 val_t *res) {
   enum v7_err rcode = V7_OK;
   val_t obj = v7_arg(v7, 0);
+  void *h = NULL;
+  val_t name;
+  unsigned long n = 0;
 
   *res = v7_mk_dense_array(v7);
 
@@ -28010,7 +36651,16 @@ static enum v7_err _Obj_ownKeys(struct v7 *v7, unsigned int ignore_flags,
     goto clean;
   }
 
-  _Obj_append_reverse(v7, get_object_struct(obj)->properties, *res, 0,
+  /* Elements of a dense or typed array go first, in ascending order */
+  if (get_object_struct(obj)->attributes &
+      (V7_OBJ_DENSE_ARRAY | V7_OBJ_BUFFER)) {
+    while ((h = v7_next_prop2(v7, h, obj, &name, NULL, NULL)) != NULL &&
+           IS_DENSE_ITER(h)) {
+      v7_array_set(v7, *res, n++, name);
+    }
+  }
+
+  _Obj_append_reverse(v7, get_object_struct(obj)->properties, *res, n,
                       ignore_flags);
 
 clean:
@@ -28334,6 +36984,13 @@ V7_PRIVATE enum v7_err Obj_valueOf(struct v7 *v7, v7_val_t *res) {
     goto clean;
   }
 
+  /* arrays and buffers keep their storage, not a boxed value, there */
+  if (v7_is_object(this_obj) &&
+      (get_object_struct(this_obj)->attributes &
+       (V7_OBJ_DENSE_ARRAY | V7_OBJ_BUFFER))) {
+    goto clean;
+  }
+
   p = v7_get_own_property2(v7, this_obj, "", 0, _V7_PROPERTY_HIDDEN);
   if (p != NULL) {
     *res = p->value;
@@ -28348,7 +37005,7 @@ WARN_UNUSED_RESULT
 V7_PRIVATE enum v7_err Obj_toString(struct v7 *v7, v7_val_t *res) {
   enum v7_err rcode = V7_OK;
   val_t ctor, name, this_obj = v7_get_this(v7);
-  char buf[20];
+  char buf[40];
   const char *str = "Object";
   size_t name_len = ~0;
 
@@ -28364,6 +37021,11 @@ V7_PRIVATE enum v7_err Obj_toString(struct v7 *v7, v7_val_t *res) {
     str = "String";
   } else if (v7_is_callable(v7, this_obj)) {
     str = "Function";
+#if V7_ENABLE__ArrayBuffer
+  } else if (buffer_view(v7, this_obj) != NULL) {
+    /* builtin constructors have no `name` to look up */
+    str = buffer_kind_name(buffer_view(v7, this_obj)->kind);
+#endif
   } else {
     rcode = v7_get_throwing(v7, this_obj, "constructor", ~0, &ctor);
     if (rcode != V7_OK) {
@@ -28454,7 +37116,10 @@ static enum v7_err is_rigid(struct v7 *v7, v7_val_t *res, int is_frozen) {
   if (get_object_struct(arg)->attributes & V7_OBJ_NOT_EXTENSIBLE) {
     void *h = NULL;
     v7_prop_attr_t attrs;
-    while ((h = v7_next_prop(h, arg, NULL, NULL, &attrs)) != NULL) {
+    while ((h = v7_next_prop2(v7, h, arg, NULL, NULL, &attrs)) != NULL) {
+      if (attrs & _V7_PROPERTY_HIDDEN) {
+        continue;
+      }
       if (!(attrs & V7_PROPERTY_NON_CONFIGURABLE)) {
         goto clean;
       }
@@ -28581,16 +37246,12 @@ V7_PRIVATE void init_object(struct v7 *v7) {
 /* Amalgamated: #include "v7/src/primitive.h" */
 /* Amalgamated: #include "v7/src/util.h" */
 
-/*
- * TODO(dfrank): make the top of v7->call_frame to represent the current
- * frame, and thus get rid of the `CUR_LINENO()`
- */
 #ifndef V7_DISABLE_LINE_NUMBERS
-#define CALLFRAME_LINENO(call_frame) ((call_frame)->line_no)
-#define CUR_LINENO() (v7->line_no)
+#define CALLFRAME_LINENO(call_frame)                                      \
+  bcode_get_line_no(((struct v7_call_frame_bcode *) (call_frame))->bcode, \
+                    ((struct v7_call_frame_bcode *) (call_frame))->bcode_ops)
 #else
 #define CALLFRAME_LINENO(call_frame) 0
-#define CUR_LINENO() 0
 #endif
 
 WARN_UNUSED_RESULT
@@ -29060,20 +37721,500 @@ V7_PRIVATE void init_number(struct v7 *v7) {
 extern "C" {
 #endif /* __cplusplus */
 
+#ifndef V7_JSON_MAX_DEPTH
+#define V7_JSON_MAX_DEPTH 64
+#endif
+
+/* Object or array which is being filled by the JSON parser */
+struct json_frame {
+  val_t container;
+  val_t key; /* name of the next property, for objects */
+};
+
+struct json_parser {
+  struct v7 *v7;
+  const char *src;
+  const char *cur;
+  const char *end;
+  struct mbuf frames; /* of `struct json_frame`, innermost last */
+  struct mbuf buf;    /* scratch buffer for unescaped strings */
+};
+
+static void json_skip_ws(struct json_parser *p) {
+  while (p->cur < p->end && (*p->cur == ' ' || *p->cur == '\t' ||
+                             *p->cur == '\n' || *p->cur == '\r')) {
+    p->cur++;
+  }
+}
+
 WARN_UNUSED_RESULT
-V7_PRIVATE enum v7_err Json_stringify(struct v7 *v7, v7_val_t *res) {
-  val_t arg0 = v7_arg(v7, 0);
-  char buf[100], *p = v7_to_json(v7, arg0, buf, sizeof(buf));
-  *res = v7_mk_string(v7, p, strlen(p), 1);
+static enum v7_err json_syntax_error(struct json_parser *p) {
+  enum v7_err _tmp;
+  if (p->cur >= p->end) {
+    _tmp = v7_throwf(p->v7, SYNTAX_ERROR, "Unexpected end of JSON input");
+  } else {
+    _tmp = v7_throwf(p->v7, SYNTAX_ERROR,
+                     "Unexpected character in JSON at position %d",
+                     (int) (p->cur - p->src));
+  }
+  (void) _tmp;
+  return V7_SYNTAX_ERROR;
+}
 
-  if (p != buf) free(p);
+static int json_hex(const char *s, Rune *r) {
+  int i;
+  *r = 0;
+  for (i = 0; i < 4; i++) {
+    int c = s[i];
+    if (c >= '0' && c <= '9') {
+      c -= '0';
+    } else if (c >= 'a' && c <= 'f') {
+      c -= 'a' - 10;
+    } else if (c >= 'A' && c <= 'F') {
+      c -= 'A' - 10;
+    } else {
+      return 0;
+    }
+    *r = (*r << 4) | c;
+  }
+  return 1;
+}
+
+/*
+ * Parses a string literal at `p->cur` (which should point to the opening
+ * quote). If `is_key` is non-zero, the string is interned: arrays of objects
+ * usually repeat the same keys, and there's no need to allocate a new string
+ * for each of them.
+ */
+WARN_UNUSED_RESULT
+static enum v7_err json_parse_string(struct json_parser *p, int is_key,
+                                     val_t *res) {
+  const char *s = ++p->cur, *start = s;
+  size_t len;
+
+  /* fast path: no escape sequences */
+  while (s < p->end && *s != '"' && *s != '\\' && (unsigned char) *s >= 0x20) {
+    s++;
+  }
+
+  if (s < p->end && *s == '"') {
+    p->cur = s + 1;
+    len = s - start;
+  } else {
+    p->buf.len = 0;
+    mbuf_append(&p->buf, start, s - start);
+    while (s < p->end && *s != '"') {
+      char tmp[UTFmax];
+      Rune r;
+
+      if ((unsigned char) *s < 0x20) {
+        p->cur = s;
+        return json_syntax_error(p);
+      } else if (*s != '\\') {
+        mbuf_append(&p->buf, s++, 1);
+        continue;
+      }
+
+      if (++s >= p->end) {
+        break;
+      }
+      switch (*s) {
+        case '"':
+        case '\\':
+        case '/':
+          r = *s;
+          break;
+        case 'b':
+          r = '\b';
+          break;
+        case 'f':
+          r = '\f';
+          break;
+        case 'n':
+          r = '\n';
+          break;
+        case 'r':
+          r = '\r';
+          break;
+        case 't':
+          r = '\t';
+          break;
+        case 'u':
+          if (p->end - s < 5 || !json_hex(s + 1, &r)) {
+            p->cur = s;
+            return json_syntax_error(p);
+          }
+          s += 4;
+          break;
+        default:
+          p->cur = s;
+          return json_syntax_error(p);
+      }
+      s++;
+      mbuf_append(&p->buf, tmp, runetochar(tmp, &r));
+    }
+
+    if (s >= p->end) {
+      p->cur = s;
+      return json_syntax_error(p);
+    }
+
+    p->cur = s + 1;
+    start = p->buf.buf;
+    len = p->buf.len;
+  }
+
+  if (is_key) {
+    *res = intern_string(p->v7, start, len);
+  } else {
+    *res = v7_mk_string(p->v7, start, len, 1);
+  }
+  return V7_OK;
+}
+
+WARN_UNUSED_RESULT
+static enum v7_err json_parse_number(struct json_parser *p, val_t *res) {
+  const char *s = p->cur;
+  char buf[32], *num = buf;
+  size_t len;
+
+  if (s < p->end && *s == '-') s++;
+  if (s < p->end && *s == '0') {
+    s++;
+  } else if (s < p->end && isdigit((unsigned char) *s)) {
+    while (s < p->end && isdigit((unsigned char) *s)) s++;
+  } else {
+    p->cur = s;
+    return json_syntax_error(p);
+  }
+  if (s < p->end && *s == '.') {
+    if (++s >= p->end || !isdigit((unsigned char) *s)) {
+      p->cur = s;
+      return json_syntax_error(p);
+    }
+    while (s < p->end && isdigit((unsigned char) *s)) s++;
+  }
+  if (s < p->end && (*s == 'e' || *s == 'E')) {
+    s++;
+    if (s < p->end && (*s == '+' || *s == '-')) s++;
+    if (s >= p->end || !isdigit((unsigned char) *s)) {
+      p->cur = s;
+      return json_syntax_error(p);
+    }
+    while (s < p->end && isdigit((unsigned char) *s)) s++;
+  }
+
+  /* source is not necessarily NUL-terminated, so copy it for `cs_strtod()` */
+  len = s - p->cur;
+  if (len >= sizeof(buf)) {
+    p->buf.len = 0;
+    mbuf_append(&p->buf, p->cur, len);
+    mbuf_append(&p->buf, "", 1);
+    num = p->buf.buf;
+  } else {
+    memcpy(buf, p->cur, len);
+    buf[len] = '\0';
+  }
+  *res = v7_mk_number(p->v7, cs_strtod(num, NULL));
+  p->cur = s;
   return V7_OK;
 }
 
+WARN_UNUSED_RESULT
+static enum v7_err json_parse_literal(struct json_parser *p, const char *lit,
+                                      val_t v, val_t *res) {
+  size_t n = strlen(lit);
+  if ((size_t)(p->end - p->cur) < n || memcmp(p->cur, lit, n) != 0) {
+    return json_syntax_error(p);
+  }
+  p->cur += n;
+  *res = v;
+  return V7_OK;
+}
+
+/* Parses `"name" :` which starts a property of an object */
+WARN_UNUSED_RESULT
+static enum v7_err json_parse_key(struct json_parser *p, val_t *res) {
+  struct v7 *v7 = p->v7;
+  enum v7_err rcode = V7_OK;
+
+  if (p->cur >= p->end || *p->cur != '"') {
+    return json_syntax_error(p);
+  }
+  V7_TRY(json_parse_string(p, 1, res));
+  json_skip_ws(p);
+  if (p->cur >= p->end || *p->cur != ':') {
+    return json_syntax_error(p);
+  }
+  p->cur++;
+
+clean:
+  return rcode;
+}
+
+/*
+ * Builds the value from the JSON text in `p`. Nested objects and arrays are
+ * tracked in `p->frames` rather than on the C stack.
+ */
+WARN_UNUSED_RESULT
+static enum v7_err json_parse_value(struct json_parser *p, val_t *res) {
+  struct v7 *v7 = p->v7;
+  enum v7_err rcode = V7_OK;
+  struct json_frame *f;
+  val_t v = V7_UNDEFINED;
+
+  for (;;) {
+    char close = 0;
+
+    json_skip_ws(p);
+    if (p->cur >= p->end) {
+      V7_THROW(json_syntax_error(p));
+    }
+
+    switch (*p->cur) {
+      case '{':
+      case '[': {
+        struct json_frame nf;
+        if (p->frames.len / sizeof(nf) >= V7_JSON_MAX_DEPTH) {
+          rcode = v7_throwf(v7, SYNTAX_ERROR, "JSON nesting is too deep");
+          V7_THROW(V7_SYNTAX_ERROR);
+        }
+        close = *p->cur == '{' ? '}' : ']';
+        nf.container =
+            close == '}' ? v7_mk_object(v7) : v7_mk_dense_array(v7);
+        nf.key = V7_UNDEFINED;
+        p->cur++;
+        json_skip_ws(p);
+        if (p->cur < p->end && *p->cur == close) {
+          /* empty object or array */
+          p->cur++;
+          v = nf.container;
+          break;
+        }
+        if (close == '}') {
+          V7_TRY(json_parse_key(p, &nf.key));
+        }
+        mbuf_append(&p->frames, &nf, sizeof(nf));
+        continue;
+      }
+      case '"':
+        V7_TRY(json_parse_string(p, 0, &v));
+        break;
+      case 't':
+        V7_TRY(json_parse_literal(p, "true", v7_mk_boolean(v7, 1), &v));
+        break;
+      case 'f':
+        V7_TRY(json_parse_literal(p, "false", v7_mk_boolean(v7, 0), &v));
+        break;
+      case 'n':
+        V7_TRY(json_parse_literal(p, "null", V7_NULL, &v));
+        break;
+      default:
+        V7_TRY(json_parse_number(p, &v));
+        break;
+    }
+
+    /* store the value into the enclosing containers, closing completed ones */
+    for (;;) {
+      int comma = 0;
+
+      if (p->frames.len == 0) {
+        *res = v;
+        goto clean;
+      }
+      f = (struct json_frame *) (p->frames.buf + p->frames.len) - 1;
+
+      if (v7_is_undefined(f->key)) {
+        V7_TRY(v7_array_push_throwing(v7, f->container, v, NULL));
+        close = ']';
+      } else {
+        V7_TRY(set_property_v(v7, f->container, f->key, v, NULL));
+        close = '}';
+      }
+
+      json_skip_ws(p);
+      if (p->cur < p->end && *p->cur == ',') {
+        /* trailing commas are tolerated, like the JS parser did */
+        comma = 1;
+        p->cur++;
+        json_skip_ws(p);
+      }
+      if (p->cur < p->end && *p->cur == close) {
+        p->cur++;
+        v = f->container;
+        p->frames.len -= sizeof(*f);
+        continue;
+      } else if (!comma) {
+        V7_THROW(json_syntax_error(p));
+      }
+
+      if (close == '}') {
+        V7_TRY(json_parse_key(p, &f->key));
+      }
+      break;
+    }
+  }
+
+clean:
+  return rcode;
+}
+
+WARN_UNUSED_RESULT
+V7_PRIVATE enum v7_err json_parse(struct v7 *v7, const char *src, size_t len,
+                                  val_t *res) {
+  enum v7_err rcode = V7_OK;
+  struct json_parser p;
+  uint8_t saved_inhibit_gc = v7->inhibit_gc;
+  char *copy = NULL;
+
+  if (src >= v7->owned_strings.buf &&
+      src < v7->owned_strings.buf + v7->owned_strings.len) {
+    /* owned strings get reallocated as the parser creates new ones */
+    copy = (char *) malloc(len + 1);
+    memcpy(copy, src, len);
+    src = copy;
+  }
+
+  memset(&p, 0, sizeof(p));
+  p.v7 = v7;
+  p.src = p.cur = src;
+  p.end = src + len;
+  mbuf_init(&p.frames, 0);
+  mbuf_init(&p.buf, 0);
+
+  /* values under construction are not reachable from any GC root */
+  v7->inhibit_gc = 1;
+
+  V7_TRY(json_parse_value(&p, res));
+  json_skip_ws(&p);
+  if (p.cur < p.end) {
+    V7_THROW(json_syntax_error(&p));
+  }
+
+clean:
+  v7->inhibit_gc = saved_inhibit_gc;
+  mbuf_free(&p.frames);
+  mbuf_free(&p.buf);
+  free(copy);
+  return rcode;
+}
+
+/*
+ * Walks the property `name` of `holder` bottom-up, replacing each value with
+ * the result of `reviver`, as described in ECMA-262 15.12.2.
+ */
+WARN_UNUSED_RESULT
+static enum v7_err json_revive(struct v7 *v7, val_t reviver, val_t holder,
+                               val_t name, int depth, val_t *res) {
+  enum v7_err rcode = V7_OK;
+  struct gc_tmp_frame tf = new_tmp_frame(v7);
+  val_t val = V7_UNDEFINED, names = V7_UNDEFINED, args = V7_UNDEFINED;
+  val_t elem = V7_UNDEFINED, revived = V7_UNDEFINED;
+  long i, len;
+
+  tmp_stack_push(&tf, &holder);
+  tmp_stack_push(&tf, &name);
+  tmp_stack_push(&tf, &val);
+  tmp_stack_push(&tf, &names);
+  tmp_stack_push(&tf, &args);
+  tmp_stack_push(&tf, &elem);
+  tmp_stack_push(&tf, &revived);
+
+  if (depth > V7_JSON_MAX_DEPTH) {
+    rcode = v7_throwf(v7, RANGE_ERROR, "JSON nesting is too deep");
+    goto clean;
+  }
+
+  V7_TRY(v7_get_throwing_v(v7, holder, name, &val));
+
+  if (v7_is_object(val)) {
+    int is_array = v7_is_array(v7, val);
+
+    names = v7_mk_dense_array(v7);
+    if (is_array) {
+      len = v7_array_length(v7, val);
+      for (i = 0; i < len; i++) {
+        v7_array_push(v7, names, v7_mk_number(v7, i));
+      }
+    } else {
+      /* the property list is in reverse order of creation */
+      struct v7_property *prop;
+      for (prop = get_object_struct(val)->properties; prop != NULL;
+           prop = prop->next) {
+        if (!(prop->attributes &
+              (_V7_PROPERTY_HIDDEN | V7_PROPERTY_NON_ENUMERABLE))) {
+          v7_array_push(v7, names, prop->name);
+        }
+      }
+    }
+
+    len = v7_array_length(v7, names);
+    for (i = 0; i < len; i++) {
+      elem = v7_array_get(v7, names, is_array ? i : len - 1 - i);
+      V7_TRY(to_string(v7, elem, &elem, NULL, 0, NULL));
+      V7_TRY(json_revive(v7, reviver, val, elem, depth + 1, &revived));
+      if (v7_is_undefined(revived)) {
+        size_t n;
+        const char *s = v7_get_string(v7, &elem, &n);
+        v7_del(v7, val, s, n);
+      } else {
+        V7_TRY(set_property_v(v7, val, elem, revived, NULL));
+      }
+    }
+  }
+
+  args = v7_mk_dense_array(v7);
+  v7_array_push(v7, args, name);
+  v7_array_push(v7, args, val);
+  V7_TRY(b_apply(v7, reviver, holder, args, 0, res));
+
+clean:
+  tmp_frame_cleanup(&tf);
+  return rcode;
+}
+
+WARN_UNUSED_RESULT
+V7_PRIVATE enum v7_err Json_stringify(struct v7 *v7, v7_val_t *res) {
+  enum v7_err rcode = V7_OK;
+  uint8_t saved_inhibit_gc = v7->inhibit_gc;
+  struct mbuf m;
+  int emitted = 0;
+
+  mbuf_init(&m, 0);
+  /* `toJSON()` and the replacer may allocate without bound */
+  v7->inhibit_gc = 0;
+  V7_TRY(json_stringify_to_mbuf(v7, v7_arg(v7, 0), v7_arg(v7, 1),
+                                v7_arg(v7, 2), &m, &emitted));
+  *res = emitted ? v7_mk_string(v7, m.buf, m.len, 1) : V7_UNDEFINED;
+
+clean:
+  v7->inhibit_gc = saved_inhibit_gc;
+  mbuf_free(&m);
+  return rcode;
+}
+
 WARN_UNUSED_RESULT
 V7_PRIVATE enum v7_err Json_parse(struct v7 *v7, v7_val_t *res) {
-  v7_val_t arg = v7_arg(v7, 0);
-  return std_eval(v7, arg, V7_UNDEFINED, 1, res);
+  enum v7_err rcode = V7_OK;
+  val_t arg = v7_arg(v7, 0), reviver = v7_arg(v7, 1);
+  uint8_t saved_inhibit_gc = v7->inhibit_gc;
+  size_t len;
+  const char *s;
+
+  V7_TRY(to_string(v7, arg, &arg, NULL, 0, NULL));
+  s = v7_get_string(v7, &arg, &len);
+  V7_TRY(json_parse(v7, s, len, res));
+
+  if (v7_is_callable(v7, reviver)) {
+    val_t holder = v7_mk_object(v7), name = v7_mk_string(v7, "", 0, 1);
+    V7_TRY(set_property_v(v7, holder, name, *res, NULL));
+    v7->inhibit_gc = 0;
+    V7_TRY(json_revive(v7, reviver, holder, name, 0, res));
+  }
+
+clean:
+  v7->inhibit_gc = saved_inhibit_gc;
+  return rcode;
 }
 
 V7_PRIVATE void init_json(struct v7 *v7) {
@@ -29105,13 +38246,26 @@ V7_PRIVATE void init_json(struct v7 *v7) {
 /* Amalgamated: #include "v7/src/array.h" */
 /* Amalgamated: #include "v7/src/object.h" */
 /* Amalgamated: #include "v7/src/exceptions.h" */
+/* Amalgamated: #include "v7/src/string.h" */
+/* Amalgamated: #include "v7/src/bcode.h" */
 
 #if defined(__cplusplus)
 extern "C" {
 #endif /* __cplusplus */
 
+/* Comparators `Array.prototype.sort()` runs without calling into JS */
+enum a_sort_cmp {
+  A_SORT_CMP_STRING, /* no comparator given: compare as strings */
+  A_SORT_CMP_ASC,    /* `function(a, b) { return a - b; }` */
+  A_SORT_CMP_DESC,   /* `function(a, b) { return b - a; }` */
+  A_SORT_CMP_FUNC    /* any other function: call it */
+};
+
 struct a_sort_data {
   val_t sort_func;
+  enum a_sort_cmp cmp;
+  val_t key;  /* property compared by `a.key - b.key`, or `V7_UNDEFINED` */
+  val_t args; /* arguments array, reused by all the comparator calls */
 };
 
 WARN_UNUSED_RESULT
@@ -29119,13 +38273,7 @@ V7_PRIVATE enum v7_err Array_ctor(struct v7 *v7, v7_val_t *res) {
   enum v7_err rcode = V7_OK;
   unsigned long i, len;
 
-  (void) v7;
-  *res = v7_mk_array(v7);
-  /*
-   * The interpreter passes dense array to C functions.
-   * However dense array implementation is not yet complete
-   * so we don't want to propagate them at each call to Array()
-   */
+  *res = v7_mk_dense_array(v7);
   len = v7_argc(v7);
   for (i = 0; i < len; i++) {
     rcode = v7_array_set_throwing(v7, *res, i, v7_arg(v7, i), NULL);
@@ -29197,10 +38345,29 @@ V7_PRIVATE enum v7_err Array_set_length(struct v7 *v7, v7_val_t *res) {
                                      isinf(v7_get_double(v7, arg0))))) {
     rcode = v7_throwf(v7, RANGE_ERROR, "Invalid array length");
     goto clean;
+  } else if ((get_object_struct(this_obj)->attributes & V7_OBJ_DENSE_ARRAY) &&
+             (unsigned long) new_len <=
+                 2 * v7_array_length(v7, this_obj) + 16) {
+    struct mbuf *abuf = dense_array_buf(v7, this_obj);
+    long len = abuf == NULL ? 0 : (long) (abuf->len / sizeof(val_t));
+
+    if (new_len < len) {
+      abuf->len = new_len * sizeof(val_t);
+    } else if (new_len > len) {
+      rcode = v7_array_set_throwing(v7, this_obj, new_len - 1, V7_UNDEFINED,
+                                    NULL);
+      if (rcode != V7_OK) {
+        goto clean;
+      }
+    }
   } else {
     struct v7_property **p, **next;
     long index, max_index = -1;
 
+    if (get_object_struct(this_obj)->attributes & V7_OBJ_DENSE_ARRAY) {
+      dense_array_to_sparse(v7, this_obj);
+    }
+
     /* Remove all items with an index higher than new_len */
     for (p = &get_object_struct(this_obj)->properties; *p != NULL; p = next) {
       size_t n;
@@ -29208,7 +38375,7 @@ V7_PRIVATE enum v7_err Array_set_length(struct v7 *v7, v7_val_t *res) {
       next = &p[0]->next;
       index = strtol(s, NULL, 10);
       if (index >= new_len) {
-        v7_destroy_property(p);
+        v7_destroy_property(v7, p);
         *p = *next;
         next = p;
       } else if (index > max_index) {
@@ -29230,121 +38397,207 @@ clean:
   return rcode;
 }
 
+/* Returns `obj.key` as a number, or NaN if it isn't a plain data number */
+static double a_sort_key(struct v7 *v7, struct a_sort_data *sort_data,
+                         val_t obj) {
+  struct v7_property *p;
+  size_t len;
+  const char *key = v7_get_string(v7, &sort_data->key, &len);
+
+  if (!v7_is_object(obj)) return NAN;
+  p = v7_get_property(v7, obj, key, len);
+  if (p == NULL || (p->attributes & (V7_PROPERTY_GETTER | V7_PROPERTY_SETTER)) ||
+      !v7_is_number(p->value)) {
+    return NAN;
+  }
+  return v7_get_double(v7, p->value);
+}
+
+/*
+ * Compares two array elements: `*res` is negative if `*pa` goes before `*pb`,
+ * positive if it goes after, and zero if their order should be kept.
+ */
 WARN_UNUSED_RESULT
 static enum v7_err a_cmp(struct v7 *v7, void *user_data, const void *pa,
                          const void *pb, int *res) {
   enum v7_err rcode = V7_OK;
   struct a_sort_data *sort_data = (struct a_sort_data *) user_data;
-  val_t a = *(val_t *) pa, b = *(val_t *) pb, func = sort_data->sort_func;
-
-  if (v7_is_callable(v7, func)) {
-    int saved_inhibit_gc = v7->inhibit_gc;
-    val_t vres = V7_UNDEFINED, args = v7_mk_dense_array(v7);
-    v7_array_push(v7, args, a);
-    v7_array_push(v7, args, b);
-    v7->inhibit_gc = 0;
-    rcode = b_apply(v7, func, V7_UNDEFINED, args, 0, &vres);
-    if (rcode != V7_OK) {
+  val_t a = *(val_t *) pa, b = *(val_t *) pb;
+  double x, y;
+
+  switch (sort_data->cmp) {
+    case A_SORT_CMP_ASC:
+    case A_SORT_CMP_DESC:
+      if (v7_is_undefined(sort_data->key)) {
+        x = v7_is_number(a) ? v7_get_double(v7, a) : NAN;
+        y = v7_is_number(b) ? v7_get_double(v7, b) : NAN;
+      } else {
+        x = a_sort_key(v7, sort_data, a);
+        y = a_sort_key(v7, sort_data, b);
+      }
+      if (isnan(x) || isnan(y)) {
+        /* `a - b` might call `valueOf()` of an object: leave it to JS */
+        break;
+      }
+      if (sort_data->cmp == A_SORT_CMP_DESC) {
+        double t = x;
+        x = y;
+        y = t;
+      }
+      *res = x < y ? -1 : x > y;
       goto clean;
-    }
-    v7->inhibit_gc = saved_inhibit_gc;
-    *res = (int) -v7_get_double(v7, vres);
-    goto clean;
-  } else {
-    char sa[100], sb[100];
 
-    rcode = to_string(v7, a, NULL, sa, sizeof(sa), NULL);
-    if (rcode != V7_OK) {
+    case A_SORT_CMP_STRING:
+      if (v7_is_string(a) && v7_is_string(b)) {
+        size_t a_len, b_len;
+        const char *a_ptr = v7_get_string(v7, &a, &a_len);
+        const char *b_ptr = v7_get_string(v7, &b, &b_len);
+        *res = memcmp(a_ptr, b_ptr, a_len < b_len ? a_len : b_len);
+        if (*res == 0) *res = a_len < b_len ? -1 : a_len > b_len;
+      } else {
+        char sa[100], sb[100];
+
+        rcode = to_string(v7, a, NULL, sa, sizeof(sa), NULL);
+        if (rcode != V7_OK) {
+          goto clean;
+        }
+
+        /* `toString()` of `a` might have run GC */
+        b = *(val_t *) pb;
+        rcode = to_string(v7, b, NULL, sb, sizeof(sb), NULL);
+        if (rcode != V7_OK) {
+          goto clean;
+        }
+
+        sa[sizeof(sa) - 1] = sb[sizeof(sb) - 1] = '\0';
+        *res = strcmp(sa, sb);
+      }
       goto clean;
-    }
 
-    rcode = to_string(v7, b, NULL, sb, sizeof(sb), NULL);
+    case A_SORT_CMP_FUNC:
+      break;
+  }
+
+  {
+    int saved_inhibit_gc = v7->inhibit_gc;
+    val_t vres = V7_UNDEFINED;
+    v7_array_set(v7, sort_data->args, 0, a);
+    v7_array_set(v7, sort_data->args, 1, b);
+    v7->inhibit_gc = 0;
+    rcode = b_apply(v7, sort_data->sort_func, V7_UNDEFINED, sort_data->args, 0,
+                    &vres);
+    v7->inhibit_gc = saved_inhibit_gc;
     if (rcode != V7_OK) {
       goto clean;
     }
-
-    sa[sizeof(sa) - 1] = sb[sizeof(sb) - 1] = '\0';
-    *res = strcmp(sb, sa);
-    goto clean;
+    x = v7_get_double(v7, vres);
+    /* NaN keeps the order, like zero */
+    *res = isnan(x) ? 0 : x < 0 ? -1 : x > 0;
   }
 
 clean:
   return rcode;
 }
 
-WARN_UNUSED_RESULT
-static enum v7_err a_partition(struct v7 *v7, val_t *a, int l, int r,
-                               void *user_data, int *res) {
-  enum v7_err rcode = V7_OK;
-  val_t t, pivot = a[l];
-  int i = l, j = r + 1;
+/*
+ * Recognizes the numeric comparators which `a_cmp()` can run natively:
+ * `function(a, b) { return a - b; }`, or `b - a`, and the same comparing a
+ * property, `a.key - b.key`. The property name is stored in `sort_data->key`.
+ */
+static enum a_sort_cmp a_sort_detect_cmp(struct v7 *v7,
+                                         struct a_sort_data *sort_data) {
+  struct bcode *bcode;
+  char *ops, *end;
+  size_t idx[2];
+  val_t key[2] = {V7_UNDEFINED, V7_UNDEFINED};
+  int i;
 
-  for (;;) {
-    while (1) {
-      ++i;
+  if (!is_js_function(sort_data->sort_func)) return A_SORT_CMP_FUNC;
 
-      if (i <= r) {
-        int tmp = 0;
-        rcode = a_cmp(v7, user_data, &a[i], &pivot, &tmp);
-        if (rcode != V7_OK) {
-          goto clean;
-        }
+  /* frame slot 0 is the function name, slots 1 and 2 are the arguments */
+  bcode = get_js_function_struct(sort_data->sort_func)->bcode;
+  if (!bcode->frame_slots || bcode->arguments_slot ||
+      !bcode->func_name_present || bcode->args_cnt != 2) {
+    return A_SORT_CMP_FUNC;
+  }
 
-        if (tmp > 0) {
-          break;
-        }
-      } else {
-        break;
-      }
+  ops = bcode_end_names(bcode->ops.p, bcode->names_cnt);
+  end = bcode->ops.p + bcode->ops.len;
+  if (ops >= end || *ops++ != OP_PUSH_UNDEFINED) return A_SORT_CMP_FUNC;
+  for (i = 0; i < 2; i++) {
+    if (ops >= end || *ops != OP_GET_LOCAL) return A_SORT_CMP_FUNC;
+    idx[i] = bcode_get_varint(&ops);
+    ops++;
+    if (ops < end && *ops == OP_GET_PROP) {
+      key[i] = bcode_decode_lit(v7, bcode, &ops);
+      ops++;
     }
-    while (1) {
-      int tmp = 0;
-      --j;
-
-      rcode = a_cmp(v7, user_data, &a[j], &pivot, &tmp);
-      if (rcode != V7_OK) {
-        goto clean;
-      }
+  }
+  if (ops + 1 >= end || ops[0] != OP_SUB || ops[1] != OP_RET) {
+    return A_SORT_CMP_FUNC;
+  }
 
-      if (tmp <= 0) {
-        break;
-      }
-    }
-    if (i >= j) break;
-    t = a[i];
-    a[i] = a[j];
-    a[j] = t;
+  if (v7_is_undefined(key[0]) != v7_is_undefined(key[1]) ||
+      (!v7_is_undefined(key[0]) &&
+       (!v7_is_string(key[0]) || !v7_is_string(key[1]) ||
+        s_cmp(v7, key[0], key[1]) != 0))) {
+    return A_SORT_CMP_FUNC;
   }
-  t = a[l];
-  a[l] = a[j];
-  a[j] = t;
+  sort_data->key = key[0];
 
-  *res = j;
-clean:
-  return rcode;
+  if (idx[0] == 1 && idx[1] == 2) return A_SORT_CMP_ASC;
+  if (idx[0] == 2 && idx[1] == 1) return A_SORT_CMP_DESC;
+  return A_SORT_CMP_FUNC;
 }
 
+/* Length of the runs sorted by insertion before merging */
+#define A_SORT_RUN 8
+
+/*
+ * Stable merge sort of `a[0..n)`: runs of `A_SORT_RUN` elements are sorted by
+ * insertion, then merged pairwise, bottom-up, using `tmp` of `n` elements.
+ * Both arrays should be rooted: the comparator might run GC. Elements are
+ * only ever compared in place, for the same reason.
+ */
 WARN_UNUSED_RESULT
-static enum v7_err a_qsort(struct v7 *v7, val_t *a, int l, int r,
-                           void *user_data) {
+static enum v7_err a_msort(struct v7 *v7, val_t *a, val_t *tmp, size_t n,
+                           struct a_sort_data *sort_data) {
   enum v7_err rcode = V7_OK;
-  if (l < r) {
-    int j = 0;
-    rcode = a_partition(v7, a, l, r, user_data, &j);
-    if (rcode != V7_OK) {
-      goto clean;
+  size_t lo, mid, hi, i, j, k, w;
+  int cmp = 0;
+  val_t t;
+
+  for (lo = 0; lo < n; lo += A_SORT_RUN) {
+    hi = lo + A_SORT_RUN < n ? lo + A_SORT_RUN : n;
+    for (i = lo + 1; i < hi; i++) {
+      for (j = i; j > lo; j--) {
+        V7_TRY(a_cmp(v7, sort_data, &a[j - 1], &a[j], &cmp));
+        if (cmp <= 0) break;
+        t = a[j - 1];
+        a[j - 1] = a[j];
+        a[j] = t;
+      }
     }
+  }
 
-    rcode = a_qsort(v7, a, l, j - 1, user_data);
-    if (rcode != V7_OK) {
-      goto clean;
-    }
+  for (w = A_SORT_RUN; w < n; w *= 2) {
+    for (lo = 0; lo + w < n; lo += 2 * w) {
+      mid = lo + w;
+      hi = mid + w < n ? mid + w : n;
 
-    rcode = a_qsort(v7, a, j + 1, r, user_data);
-    if (rcode != V7_OK) {
-      goto clean;
+      /* Runs which are already in order, e.g. of sorted input, are skipped */
+      V7_TRY(a_cmp(v7, sort_data, &a[mid - 1], &a[mid], &cmp));
+      if (cmp <= 0) continue;
+
+      memcpy(&tmp[lo], &a[lo], (mid - lo) * sizeof(*a));
+      for (i = lo, j = mid, k = lo; i < mid && j < hi;) {
+        V7_TRY(a_cmp(v7, sort_data, &tmp[i], &a[j], &cmp));
+        a[k++] = cmp <= 0 ? tmp[i++] : a[j++];
+      }
+      while (i < mid) a[k++] = tmp[i++];
     }
   }
+
 clean:
   return rcode;
 }
@@ -29356,9 +38609,17 @@ static enum v7_err a_sort(struct v7 *v7,
                                                       const void *, int *res),
                           v7_val_t *res) {
   enum v7_err rcode = V7_OK;
-  int i = 0, len = 0;
+  int i = 0, len = 0, n = 0;
   val_t *arr = NULL;
-  val_t arg0 = v7_arg(v7, 0);
+  struct a_sort_data sort_data;
+  struct gc_tmp_frame tf = new_tmp_frame(v7);
+
+  sort_data.sort_func = v7_arg(v7, 0);
+  sort_data.key = V7_UNDEFINED;
+  sort_data.args = V7_UNDEFINED;
+  tmp_stack_push(&tf, &sort_data.sort_func);
+  tmp_stack_push(&tf, &sort_data.key);
+  tmp_stack_push(&tf, &sort_data.args);
 
   *res = v7_get_this(v7);
   len = v7_array_length(v7, *res);
@@ -29367,29 +38628,48 @@ static enum v7_err a_sort(struct v7 *v7,
     goto clean;
   }
 
-  arr = (val_t *) malloc(len * sizeof(arr[0]));
+  /* `arr` holds the elements, followed by the merge sort scratch space */
+  arr = (val_t *) malloc(2 * len * sizeof(arr[0]));
 
   assert(*res != v7->vals.global_object);
 
-  for (i = 0; i < len; i++) {
-    arr[i] = v7_array_get(v7, *res, i);
+  /* the comparator function can run GC, so the copied values are rooted */
+  for (i = 0; i < 2 * len; i++) {
+    arr[i] = V7_UNDEFINED;
+    tmp_stack_push(&tf, &arr[i]);
   }
 
-  /* TODO(dfrank): sorting_func isn't actually used! something is wrong here */
-  if (sorting_func != NULL) {
-    struct a_sort_data sort_data;
-    sort_data.sort_func = arg0;
-    rcode = a_qsort(v7, arr, 0, len - 1, &sort_data);
+  if (sorting_func == NULL) {
+    /* reverse */
+    for (i = 0; i < len; i++) {
+      arr[len - (i + 1)] = v7_array_get(v7, *res, i);
+    }
+    n = len;
+  } else {
+    /* undefined elements go last, and aren't passed to the comparator */
+    for (i = 0; i < len; i++) {
+      val_t v = v7_array_get(v7, *res, i);
+      if (!v7_is_undefined(v)) arr[n++] = v;
+    }
+
+    if (!v7_is_callable(v7, sort_data.sort_func)) {
+      sort_data.cmp = A_SORT_CMP_STRING;
+    } else {
+      sort_data.cmp = a_sort_detect_cmp(v7, &sort_data);
+      sort_data.args = v7_mk_dense_array(v7);
+    }
+    rcode = a_msort(v7, arr, arr + len, n, &sort_data);
     if (rcode != V7_OK) {
       goto clean;
     }
   }
 
   for (i = 0; i < len; i++) {
-    v7_array_set(v7, *res, i, arr[len - (i + 1)]);
+    v7_array_set(v7, *res, i, i < n ? arr[i] : V7_UNDEFINED);
   }
 
 clean:
+  tmp_frame_cleanup(&tf);
   if (arr != NULL) {
     free(arr);
   }
@@ -29531,20 +38811,32 @@ static enum v7_err a_splice(struct v7 *v7, int mutate, v7_val_t *res) {
      * space allocated for future appends.
      * TODO(mkm): figure out if trimming is better
      */
-    struct v7_property *p =
-        v7_get_own_property2(v7, this_obj, "", 0, _V7_PROPERTY_HIDDEN);
-    struct mbuf *abuf;
-    if (p == NULL) {
-      goto clean;
-    }
-    abuf = (struct mbuf *) v7_get_ptr(v7, p->value);
+    struct mbuf *abuf = dense_array_buf(v7, this_obj);
     if (abuf == NULL) {
+      /* Empty array: inserted elements are simply appended */
+      for (i = 2; i < num_args; i++) {
+        rcode = v7_array_set_throwing(v7, this_obj, i - 2, v7_arg(v7, i), NULL);
+        if (rcode != V7_OK) {
+          goto clean;
+        }
+      }
       goto clean;
     }
 
-    memmove(abuf->buf + arg0 * sizeof(val_t), abuf->buf + arg1 * sizeof(val_t),
-            (len - arg1) * sizeof(val_t));
-    abuf->len -= (arg1 - arg0) * sizeof(val_t);
+    if (arg1 > len) arg1 = len;
+    for (i = arg1 - arg0; i < elems_to_insert; i++) {
+      val_t s = V7_TAG_NOVALUE;
+      mbuf_append(abuf, (char *) &s, sizeof(val_t));
+    }
+    memmove(abuf->buf + (arg0 + elems_to_insert) * sizeof(val_t),
+            abuf->buf + arg1 * sizeof(val_t), (len - arg1) * sizeof(val_t));
+    abuf->len = (len - (arg1 - arg0) + elems_to_insert) * sizeof(val_t);
+
+    for (i = 2; i < num_args; i++) {
+      val_t v = v7_arg(v7, i);
+      ((val_t *) abuf->buf)[arg0 + i - 2] = v;
+      GC_WRITE_BARRIER(v7, v);
+    }
   } else if (mutate) {
     /* If splicing, modify this_obj array: remove spliced sub-array */
     struct v7_property **p, **next;
@@ -29557,7 +38849,7 @@ static enum v7_err a_splice(struct v7 *v7, int mutate, v7_val_t *res) {
       i = strtol(s, NULL, 10);
       if (i >= arg0 && i < arg1) {
         /* Remove items from spliced sub-array */
-        v7_destroy_property(p);
+        v7_destroy_property(v7, p);
         *p = *next;
         next = p;
       } else if (i >= arg1) {
@@ -29565,7 +38857,8 @@ static enum v7_err a_splice(struct v7 *v7, int mutate, v7_val_t *res) {
         char key[20];
         size_t n = c_snprintf(key, sizeof(key), "%ld",
                               i - (arg1 - arg0) + elems_to_insert);
-        p[0]->name = v7_mk_string(v7, key, n, 1);
+        p[0]->name = intern_string(v7, key, n);
+        v7_invalidate_ic(v7);
       }
     }
 
@@ -29594,24 +38887,21 @@ V7_PRIVATE enum v7_err Array_splice(struct v7 *v7, v7_val_t *res) {
   return a_splice(v7, 1, res);
 }
 
-static void a_prep1(struct v7 *v7, val_t t, val_t *a0, val_t *a1) {
+static void a_prep1(struct v7 *v7, val_t *a0, val_t *a1) {
   *a0 = v7_arg(v7, 0);
   *a1 = v7_arg(v7, 1);
-  if (v7_is_undefined(*a1)) {
-    *a1 = t;
-  }
 }
 
 /*
  * Call callback function `cb`, passing `this_obj` as `this`, with the
  * following arguments:
  *
- *   cb(v, n, this_obj);
+ *   cb(v, n, arr);
  *
  */
 WARN_UNUSED_RESULT
 static enum v7_err a_prep2(struct v7 *v7, val_t cb, val_t v, val_t n,
-                           val_t this_obj, val_t *res) {
+                           val_t arr, val_t this_obj, val_t *res) {
   enum v7_err rcode = V7_OK;
   int saved_inhibit_gc = v7->inhibit_gc;
   val_t args = v7_mk_dense_array(v7);
@@ -29622,7 +38912,7 @@ static enum v7_err a_prep2(struct v7 *v7, val_t cb, val_t v, val_t n,
 
   v7_array_push(v7, args, v);
   v7_array_push(v7, args, n);
-  v7_array_push(v7, args, this_obj);
+  v7_array_push(v7, args, arr);
 
   v7->inhibit_gc = 0;
   rcode = b_apply(v7, cb, this_obj, args, 0, res);
@@ -29664,7 +38954,8 @@ V7_PRIVATE enum v7_err Array_forEach(struct v7 *v7, v7_val_t *res) {
     v = v7_array_get2(v7, this_obj, i, &has);
     if (!has) continue;
 
-    rcode = a_prep2(v7, cb, v, v7_mk_number(v7, i), this_obj, res);
+    rcode = a_prep2(v7, cb, v, v7_mk_number(v7, i), this_obj, v7_arg(v7, 1),
+                    res);
     if (rcode != V7_OK) {
       goto clean;
     }
@@ -29689,7 +38980,7 @@ V7_PRIVATE enum v7_err Array_map(struct v7 *v7, v7_val_t *res) {
     rcode = v7_throwf(v7, TYPE_ERROR, "Array expected");
     goto clean;
   } else {
-    a_prep1(v7, this_obj, &arg0, &arg1);
+    a_prep1(v7, &arg0, &arg1);
     *res = v7_mk_dense_array(v7);
     len = v7_array_length(v7, this_obj);
 
@@ -29700,7 +38991,8 @@ V7_PRIVATE enum v7_err Array_map(struct v7 *v7, v7_val_t *res) {
     for (i = 0; i < len; i++) {
       v = v7_array_get2(v7, this_obj, i, &has);
       if (!has) continue;
-      rcode = a_prep2(v7, arg0, v, v7_mk_number(v7, i), arg1, &el);
+      rcode = a_prep2(v7, arg0, v, v7_mk_number(v7, i), this_obj, arg1,
+                     &el);
       if (rcode != V7_OK) {
         goto clean;
       }
@@ -29733,7 +39025,7 @@ V7_PRIVATE enum v7_err Array_every(struct v7 *v7, v7_val_t *res) {
     rcode = v7_throwf(v7, TYPE_ERROR, "Array expected");
     goto clean;
   } else {
-    a_prep1(v7, this_obj, &arg0, &arg1);
+    a_prep1(v7, &arg0, &arg1);
 
     tmp_stack_push(&vf, &arg0);
     tmp_stack_push(&vf, &arg1);
@@ -29743,7 +39035,8 @@ V7_PRIVATE enum v7_err Array_every(struct v7 *v7, v7_val_t *res) {
     for (i = 0; i < len; i++) {
       v = v7_array_get2(v7, this_obj, i, &has);
       if (!has) continue;
-      rcode = a_prep2(v7, arg0, v, v7_mk_number(v7, i), arg1, &el);
+      rcode = a_prep2(v7, arg0, v, v7_mk_number(v7, i), this_obj, arg1,
+                     &el);
       if (rcode != V7_OK) {
         goto clean;
       }
@@ -29777,7 +39070,7 @@ V7_PRIVATE enum v7_err Array_some(struct v7 *v7, v7_val_t *res) {
     rcode = v7_throwf(v7, TYPE_ERROR, "Array expected");
     goto clean;
   } else {
-    a_prep1(v7, this_obj, &arg0, &arg1);
+    a_prep1(v7, &arg0, &arg1);
 
     tmp_stack_push(&vf, &arg0);
     tmp_stack_push(&vf, &arg1);
@@ -29787,7 +39080,8 @@ V7_PRIVATE enum v7_err Array_some(struct v7 *v7, v7_val_t *res) {
     for (i = 0; i < len; i++) {
       v = v7_array_get2(v7, this_obj, i, &has);
       if (!has) continue;
-      rcode = a_prep2(v7, arg0, v, v7_mk_number(v7, i), arg1, &el);
+      rcode = a_prep2(v7, arg0, v, v7_mk_number(v7, i), this_obj, arg1,
+                     &el);
       if (rcode != V7_OK) {
         goto clean;
       }
@@ -29819,7 +39113,7 @@ V7_PRIVATE enum v7_err Array_filter(struct v7 *v7, v7_val_t *res) {
     rcode = v7_throwf(v7, TYPE_ERROR, "Array expected");
     goto clean;
   } else {
-    a_prep1(v7, this_obj, &arg0, &arg1);
+    a_prep1(v7, &arg0, &arg1);
     *res = v7_mk_dense_array(v7);
     len = v7_array_length(v7, this_obj);
 
@@ -29830,7 +39124,8 @@ V7_PRIVATE enum v7_err Array_filter(struct v7 *v7, v7_val_t *res) {
     for (i = 0; i < len; i++) {
       v = v7_array_get2(v7, this_obj, i, &has);
       if (!has) continue;
-      rcode = a_prep2(v7, arg0, v, v7_mk_number(v7, i), arg1, &el);
+      rcode = a_prep2(v7, arg0, v, v7_mk_number(v7, i), this_obj, arg1,
+                     &el);
       if (rcode != V7_OK) {
         goto clean;
       }
@@ -29854,6 +39149,7 @@ V7_PRIVATE enum v7_err Array_concat(struct v7 *v7, v7_val_t *res) {
   val_t this_obj = v7_get_this(v7);
   size_t i, j, len;
   val_t saved_args;
+  unsigned long saved_argc;
 
   if (!v7_is_array(v7, this_obj)) {
     rcode = v7_throwf(v7, TYPE_ERROR, "Array expected");
@@ -29870,12 +39166,15 @@ V7_PRIVATE enum v7_err Array_concat(struct v7 *v7, v7_val_t *res) {
    * from a cfunction.
    */
   saved_args = v7->vals.arguments;
+  saved_argc = v7->cfunc_argc;
   v7->vals.arguments = V7_UNDEFINED;
+  v7->cfunc_argc = 0;
   rcode = a_splice(v7, 1, res);
+  v7->vals.arguments = saved_args;
+  v7->cfunc_argc = saved_argc;
   if (rcode != V7_OK) {
     goto clean;
   }
-  v7->vals.arguments = saved_args;
 
   for (i = 0; i < len; i++) {
     val_t a = v7_arg(v7, i);
@@ -30768,19 +40067,14 @@ clean:
 #if V7_ENABLE__RegExp
 WARN_UNUSED_RESULT
 enum v7_err call_regex_ctor(struct v7 *v7, val_t arg, val_t *res) {
-  /* TODO(mkm): make general helper out of this */
   enum v7_err rcode = V7_OK;
-  val_t saved_args = v7->vals.arguments, args = v7_mk_dense_array(v7);
-  v7_array_push(v7, args, arg);
-  v7->vals.arguments = args;
 
-  rcode = Regex_ctor(v7, res);
-  if (rcode != V7_OK) {
-    goto clean;
-  }
-  v7->vals.arguments = saved_args;
+  /* pass `arg` on the data stack, see `call_cfunction()` */
+  mbuf_append(&v7->stack, &arg, sizeof(arg));
+  rcode = call_cfunction(v7, v7_mk_cfunction(Regex_ctor), V7_UNDEFINED,
+                         V7_UNDEFINED, 1 /* argc */, 0 /* not a ctor */, res);
+  v7->stack.len -= sizeof(arg);
 
-clean:
   return rcode;
 }
 
@@ -30868,11 +40162,23 @@ WARN_UNUSED_RESULT
 V7_PRIVATE enum v7_err Str_replace(struct v7 *v7, v7_val_t *res) {
   enum v7_err rcode = V7_OK;
   val_t this_obj = v7_get_this(v7);
+  val_t ro = V7_UNDEFINED, str_func = V7_UNDEFINED, arr = V7_UNDEFINED;
   const char *s;
   size_t s_len;
-  val_t out_str_o;
-  char *old_owned_mbuf_base = v7->owned_strings.buf;
-  char *old_owned_mbuf_end = v7->owned_strings.buf + v7->owned_strings.len;
+  /*
+   * The replace function can run GC, and new strings can reallocate the
+   * string heap, so we don't keep pointers to the string data across those:
+   * positions in the subject string are kept as offsets, and the output is
+   * accumulated in a separate buffer.
+   */
+  struct mbuf out;
+  struct gc_tmp_frame tf = new_tmp_frame(v7);
+
+  mbuf_init(&out, 0);
+  tmp_stack_push(&tf, &this_obj);
+  tmp_stack_push(&tf, &ro);
+  tmp_stack_push(&tf, &str_func);
+  tmp_stack_push(&tf, &arr);
 
   rcode = to_string(v7, this_obj, &this_obj, NULL, 0, NULL);
   if (rcode != V7_OK) {
@@ -30882,12 +40188,8 @@ V7_PRIVATE enum v7_err Str_replace(struct v7 *v7, v7_val_t *res) {
   s = v7_get_string(v7, &this_obj, &s_len);
 
   if (s_len != 0 && v7_argc(v7) > 1) {
-    const char *const str_end = s + s_len;
-    char *p = (char *) s;
-    uint32_t out_sub_num = 0;
-    val_t ro = V7_UNDEFINED, str_func = V7_UNDEFINED;
+    size_t off = 0;
     struct slre_prog *prog;
-    struct slre_cap out_sub[V7_RE_MAX_REPL_SUB], *ptok = out_sub;
     struct slre_loot loot;
     int flag_g;
 
@@ -30918,31 +40220,42 @@ V7_PRIVATE enum v7_err Str_replace(struct v7 *v7, v7_val_t *res) {
 
     do {
       int i;
-      if (slre_exec(prog, 0, p, str_end, &loot)) break;
-      if (p != loot.caps->start) {
-        ptok->start = p;
-        ptok->end = loot.caps->start;
-        ptok++;
-        out_sub_num++;
-      }
+      size_t match_start, match_end;
+
+      s = v7_get_string(v7, &this_obj, &s_len);
+      if (slre_exec(prog, 0, s + off, s + s_len, &loot)) break;
+      match_start = loot.caps[0].start - s;
+      match_end = loot.caps[0].end - s;
+      mbuf_append(&out, s + off, loot.caps[0].start - (s + off));
 
       if (v7_is_callable(v7, str_func)) { /* replace function */
+        /* offsets of the captures: `s` can move from now on */
+        size_t cap_off[SLRE_MAX_CAPS], cap_len[SLRE_MAX_CAPS];
         const char *rez_str;
         size_t rez_len;
-        val_t arr = v7_mk_dense_array(v7);
+        val_t val = V7_UNDEFINED;
+
+        for (i = 0; i < loot.num_captures; i++) {
+          cap_off[i] = loot.caps[i].start - s;
+          cap_len[i] = loot.caps[i].end - loot.caps[i].start;
+          if (loot.caps[i].start == NULL) {
+            /* the group didn't participate in the match */
+            cap_off[i] = cap_len[i] = 0;
+          }
+        }
 
+        arr = v7_mk_dense_array(v7);
         for (i = 0; i < loot.num_captures; i++) {
+          s = v7_get_string(v7, &this_obj, &s_len);
           rcode = v7_array_push_throwing(
-              v7, arr, v7_mk_string(v7, loot.caps[i].start,
-                                    loot.caps[i].end - loot.caps[i].start, 1),
-              NULL);
+              v7, arr, v7_mk_string(v7, s + cap_off[i], cap_len[i], 1), NULL);
           if (rcode != V7_OK) {
             goto clean;
           }
         }
+        s = v7_get_string(v7, &this_obj, &s_len);
         rcode = v7_array_push_throwing(
-            v7, arr, v7_mk_number(v7, utfnlen(s, loot.caps[0].start - s)),
-            NULL);
+            v7, arr, v7_mk_number(v7, utfnlen(s, cap_off[0])), NULL);
         if (rcode != V7_OK) {
           goto clean;
         }
@@ -30952,67 +40265,53 @@ V7_PRIVATE enum v7_err Str_replace(struct v7 *v7, v7_val_t *res) {
           goto clean;
         }
 
-        {
-          val_t val = V7_UNDEFINED;
-
-          rcode = b_apply(v7, str_func, this_obj, arr, 0, &val);
-          if (rcode != V7_OK) {
-            goto clean;
-          }
-
-          rcode = to_string(v7, val, &out_str_o, NULL, 0, NULL);
-          if (rcode != V7_OK) {
-            goto clean;
-          }
+        rcode = b_apply(v7, str_func, this_obj, arr, 0, &val);
+        if (rcode != V7_OK) {
+          goto clean;
         }
-        rez_str = v7_get_string(v7, &out_str_o, &rez_len);
-        if (rez_len) {
-          ptok->start = rez_str;
-          ptok->end = rez_str + rez_len;
-          ptok++;
-          out_sub_num++;
+
+        rcode = to_string(v7, val, &val, NULL, 0, NULL);
+        if (rcode != V7_OK) {
+          goto clean;
         }
+        rez_str = v7_get_string(v7, &val, &rez_len);
+        mbuf_append(&out, rez_str, rez_len);
       } else { /* replace string */
         struct slre_loot newsub;
         size_t f_len;
         const char *f_str = v7_get_string(v7, &str_func, &f_len);
         slre_replace(&loot, s, s_len, f_str, f_len, &newsub);
         for (i = 0; i < newsub.num_captures; i++) {
-          ptok->start = newsub.caps[i].start;
-          ptok->end = newsub.caps[i].end;
-          ptok++;
-          out_sub_num++;
+          mbuf_append(&out, newsub.caps[i].start,
+                      newsub.caps[i].end - newsub.caps[i].start);
         }
       }
-      p = (char *) loot.caps[0].end;
-    } while (flag_g && p < str_end);
-    if (p <= str_end) {
-      ptok->start = p;
-      ptok->end = str_end;
-      ptok++;
-      out_sub_num++;
-    }
-    out_str_o = v7_mk_string(v7, NULL, 0, 1);
-    ptok = out_sub;
-    do {
-      size_t ln = ptok->end - ptok->start;
-      const char *ps = ptok->start;
-      if (ptok->start >= old_owned_mbuf_base &&
-          ptok->start < old_owned_mbuf_end) {
-        ps += v7->owned_strings.buf - old_owned_mbuf_base;
-      }
-      out_str_o = s_concat(v7, out_str_o, v7_mk_string(v7, ps, ln, 1));
-      p += ln;
-      ptok++;
-    } while (--out_sub_num);
-
-    *res = out_str_o;
+      off = match_end;
+
+      if (match_end == match_start) {
+        /* empty match: step over a character, like `lastIndex` does */
+        Rune r;
+        int n;
+        if (off >= s_len) break;
+        s = v7_get_string(v7, &this_obj, &s_len);
+        n = chartorune(&r, s + off);
+        mbuf_append(&out, s + off, n);
+        off += n;
+      }
+    } while (flag_g && off <= s_len);
+
+    s = v7_get_string(v7, &this_obj, &s_len);
+    mbuf_append(&out, s + off, s_len - off);
+
+    *res = v7_mk_string(v7, out.buf, out.len, 1);
     goto clean;
   }
 
   *res = this_obj;
 
 clean:
+  mbuf_free(&out);
+  tmp_frame_cleanup(&tf);
   return rcode;
 }
 
@@ -31067,7 +40366,7 @@ V7_PRIVATE enum v7_err Str_slice(struct v7 *v7, v7_val_t *res) {
   enum v7_err rcode = V7_OK;
   val_t this_obj = v7_get_this(v7);
   long from = 0, to = 0;
-  size_t len;
+  size_t len, n;
   val_t so = V7_UNDEFINED;
   const char *begin, *end;
   int num_args = v7_argc(v7);
@@ -31078,8 +40377,9 @@ V7_PRIVATE enum v7_err Str_slice(struct v7 *v7, v7_val_t *res) {
   }
 
   begin = v7_get_string(v7, &so, &len);
+  n = len;
 
-  to = len = utfnlen(begin, len);
+  to = len = s_utfnlen(v7, so, begin, n);
   if (num_args > 0) {
     rcode = to_long(v7, v7_arg(v7, 0), 0, &from);
     if (rcode != V7_OK) {
@@ -31106,8 +40406,8 @@ V7_PRIVATE enum v7_err Str_slice(struct v7 *v7, v7_val_t *res) {
   }
 
   if (from > to) to = from;
-  end = utfnshift(begin, to);
-  begin = utfnshift(begin, from);
+  end = s_utfnshift(v7, so, begin, n, to);
+  begin = s_utfnshift(v7, so, begin, n, from);
 
   *res = v7_mk_string(v7, begin, end - begin, 1);
 
@@ -31128,13 +40428,15 @@ static enum v7_err s_transform(struct v7 *v7, val_t obj, Rune (*func)(Rune),
     goto clean;
   }
 
-  p = v7_get_string(v7, &s, &len);
+  v7_get_string(v7, &s, &len);
 
   /* Pass NULL to make sure we're not creating dictionary value */
   *res = v7_mk_string(v7, NULL, len, 1);
 
   {
     Rune r;
+    /* string data might have been moved by the allocation above */
+    p = v7_get_string(v7, &s, &len);
     p2 = v7_get_string(v7, res, &len);
     for (i = 0; i < len; i += n) {
       n = chartorune(&r, p + i);
@@ -31207,7 +40509,7 @@ V7_PRIVATE enum v7_err Str_length(struct v7 *v7, v7_val_t *res) {
 
   if (v7_is_string(s)) {
     const char *p = v7_get_string(v7, &s, &len);
-    len = utfnlen(p, len);
+    len = s_utfnlen(v7, s, p, len);
   }
 
   *res = v7_mk_number(v7, len);
@@ -31273,16 +40575,16 @@ WARN_UNUSED_RESULT
 static enum v7_err s_substr(struct v7 *v7, val_t s, long start, long len,
                             val_t *res) {
   enum v7_err rcode = V7_OK;
-  size_t n;
-  const char *p;
+  size_t size, n;
+  const char *p, *begin, *end;
 
   rcode = to_string(v7, s, &s, NULL, 0, NULL);
   if (rcode != V7_OK) {
     goto clean;
   }
 
-  p = v7_get_string(v7, &s, &n);
-  n = utfnlen(p, n);
+  p = v7_get_string(v7, &s, &size);
+  n = s_utfnlen(v7, s, p, size);
 
   if (start < (long) n && len > 0) {
     if (start < 0) start = (long) n + start;
@@ -31291,12 +40593,14 @@ static enum v7_err s_substr(struct v7 *v7, val_t s, long start, long len,
     if (start > (long) n) start = n;
     if (len < 0) len = 0;
     if (len > (long) n - start) len = n - start;
-    p = utfnshift(p, start);
+    begin = s_utfnshift(v7, s, p, size, start);
+    end = s_utfnshift(v7, s, p, size, start + len);
   } else {
-    len = 0;
+    begin = end = p;
   }
 
-  *res = v7_mk_string(v7, p, len, 1);
+  /* `len` is in characters, not bytes */
+  *res = v7_mk_string(v7, begin, end - begin, 1);
 
 clean:
   return rcode;
@@ -31363,6 +40667,7 @@ V7_PRIVATE enum v7_err Str_split(struct v7 *v7, v7_val_t *res) {
   enum v7_err rcode = V7_OK;
   val_t this_obj = v7_get_this(v7);
   const char *s, *s_end;
+  char *s_copy = NULL;
   size_t s_len;
   long num_args = v7_argc(v7);
   rcode = to_string(v7, this_obj, &this_obj, NULL, 0, NULL);
@@ -31370,6 +40675,19 @@ V7_PRIVATE enum v7_err Str_split(struct v7 *v7, v7_val_t *res) {
     goto clean;
   }
   s = v7_get_string(v7, &this_obj, &s_len);
+
+  /*
+   * Matches are kept as pointers into the string, but each new piece can
+   * move the string data: split a private copy instead.
+   */
+  s_copy = (char *) malloc(s_len + 1);
+  if (s_copy == NULL) {
+    rcode = v7_throwf(v7, INTERNAL_ERROR, "Out of memory");
+    goto clean;
+  }
+  memcpy(s_copy, s, s_len);
+  s_copy[s_len] = '\0';
+  s = s_copy;
   s_end = s + s_len;
 
   *res = v7_mk_dense_array(v7);
@@ -31499,6 +40817,7 @@ V7_PRIVATE enum v7_err Str_split(struct v7 *v7, v7_val_t *res) {
   }
 
 clean:
+  free(s_copy);
   return rcode;
 }
 
@@ -33187,17 +42506,23 @@ V7_PRIVATE enum v7_err rx_exec(struct v7 *v7, val_t rx, val_t vstr, int lind,
     if (!slre_exec(rp->compiled_regexp, 0, begin, end, &sub)) {
       int i;
       val_t arr = v7_mk_array(v7);
-      char *old_mbuf_base = v7->owned_strings.buf;
-      ptrdiff_t rel = 0; /* creating strings might relocate the mbuf */
+      size_t match_start = sub.caps->start - str;
+      size_t match_end = sub.caps->end - str;
 
+      /*
+       * Captures point into the string at `str`, which might be relocated by
+       * creating strings, so refer to them by offset.
+       */
       for (i = 0; i < sub.num_captures; i++, ptok++) {
-        rel = v7->owned_strings.buf - old_mbuf_base;
-        v7_array_push(v7, arr, v7_mk_string(v7, ptok->start + rel,
-                                            ptok->end - ptok->start, 1));
+        size_t off = ptok->start - str;
+        const char *cur = v7_get_string(v7, &s, &len);
+        v7_array_push(v7, arr,
+                      v7_mk_string(v7, cur + off, ptok->end - ptok->start, 1));
       }
-      if (flag_g) rp->lastIndex = utfnlen(str, sub.caps->end + rel - str);
+      str = v7_get_string(v7, &s, &len);
+      if (flag_g) rp->lastIndex = utfnlen(str, match_end);
       v7_def(v7, arr, "index", 5, V7_DESC_WRITABLE(0),
-             v7_mk_number(v7, utfnlen(str + rel, sub.caps->start - str)));
+             v7_mk_number(v7, utfnlen(str, match_start)));
       *res = arr;
       goto clean;
     } else {
@@ -33309,6 +42634,744 @@ V7_PRIVATE void init_regex(struct v7 *v7) {
 
 #endif /* V7_ENABLE__RegExp */
 #ifdef V7_MODULE_LINES
+#line 1 "./src/std_typedarray.c"
+#endif
+/*
+ * Copyright (c) 2014 Cesanta Software Limited
+ * All rights reserved
+ */
+
+/* Amalgamated: #include "v7/src/internal.h" */
+/* Amalgamated: #include "v7/src/std_typedarray.h" */
+/* Amalgamated: #include "v7/src/core.h" */
+/* Amalgamated: #include "v7/src/function.h" */
+/* Amalgamated: #include "v7/src/conversion.h" */
+/* Amalgamated: #include "v7/src/object.h" */
+/* Amalgamated: #include "v7/src/exceptions.h" */
+/* Amalgamated: #include "v7/src/primitive.h" */
+
+#if V7_ENABLE__ArrayBuffer
+
+/*
+ * `ArrayBuffer`, typed arrays and `DataView`.
+ *
+ * The bytes of a buffer live outside of the JS heap, in a malloc-ed block or
+ * in a block handed over by the embedder (see `v7_mk_array_buffer_external()`)
+ * so that C code can use them in place, without copying. Elements of typed
+ * arrays are not properties: they are read and written straight from the
+ * buffer, in the host byte order.
+ */
+
+/* Largest buffer, offset or length accepted from JS */
+#define V7_BUF_MAX_LEN 0x7fffffffUL
+
+static const unsigned char buf_elem_size[V7_BUF_KIND_MAX] = {
+    1 /* ArrayBuffer */, 1, 1, 1, 2, 2, 4, 4, 4, 8, 1 /* DataView */
+};
+
+static const char *const buf_ctor_names[V7_BUF_KIND_MAX] = {
+    "ArrayBuffer",  "Int8Array",    "Uint8Array",  "Uint8ClampedArray",
+    "Int16Array",   "Uint16Array",  "Int32Array",  "Uint32Array",
+    "Float32Array", "Float64Array", "DataView"};
+
+union buf_elem {
+  int8_t i8;
+  uint8_t u8;
+  int16_t i16;
+  uint16_t u16;
+  int32_t i32;
+  uint32_t u32;
+  float f32;
+  double f64;
+};
+
+V7_PRIVATE struct v7_buffer_view *buffer_view(struct v7 *v7, val_t obj) {
+  struct v7_property *p;
+
+  if (!v7_is_object(obj) ||
+      !(get_object_struct(obj)->attributes & V7_OBJ_BUFFER)) {
+    return NULL;
+  }
+  p = v7_get_own_property2(v7, obj, "", 0, _V7_PROPERTY_HIDDEN);
+  return p == NULL ? NULL : (struct v7_buffer_view *) v7_get_ptr(v7, p->value);
+}
+
+V7_PRIVATE struct v7_buffer_view *typed_array_view(struct v7 *v7, val_t obj) {
+  struct v7_buffer_view *bv = buffer_view(v7, obj);
+  return (bv != NULL && V7_BUF_IS_TYPED_ARRAY(bv->kind)) ? bv : NULL;
+}
+
+V7_PRIVATE const char *buffer_kind_name(enum v7_buf_kind kind) {
+  return buf_ctor_names[kind];
+}
+
+V7_PRIVATE void buffer_view_free(struct v7_buffer_view *bv) {
+  if (bv->kind == V7_BUF_ARRAY_BUFFER) {
+    if (bv->ab->free_cb != NULL) {
+      bv->ab->free_cb(bv->ab->data);
+    }
+    free(bv->ab);
+  }
+  free(bv);
+}
+
+/*
+ * Makes an object of the given kind over `ab`. Views get `buffer`, the
+ * `ArrayBuffer` owning `ab`, as a read-only property.
+ */
+static val_t mk_buffer_obj(struct v7 *v7, enum v7_buf_kind kind,
+                           struct v7_array_buffer *ab, val_t buffer,
+                           size_t offset, size_t length) {
+  struct v7_buffer_view *bv = (struct v7_buffer_view *) calloc(1, sizeof(*bv));
+  val_t obj = V7_UNDEFINED;
+
+  bv->kind = kind;
+  bv->ab = ab;
+  bv->offset = offset;
+  bv->length = length;
+
+  v7_own(v7, &buffer);
+  v7_own(v7, &obj);
+  obj = mk_object(v7, v7->vals.buffer_prototypes[kind]);
+  v7_def(v7, obj, "", 0, _V7_DESC_HIDDEN(1), v7_mk_foreign(v7, bv));
+  get_object_struct(obj)->attributes |= V7_OBJ_BUFFER;
+  if (kind != V7_BUF_ARRAY_BUFFER) {
+    v7_def(v7, obj, "buffer", 6, (V7_DESC_ENUMERABLE(0) | V7_DESC_WRITABLE(0) |
+                                  V7_DESC_CONFIGURABLE(0)),
+           buffer);
+  }
+  v7_disown(v7, &obj);
+  v7_disown(v7, &buffer);
+
+  return obj;
+}
+
+static val_t mk_array_buffer(struct v7 *v7, void *data, size_t len,
+                             v7_destructor_cb_t *free_cb) {
+  struct v7_array_buffer *ab =
+      (struct v7_array_buffer *) malloc(sizeof(*ab));
+  ab->data = (uint8_t *) data;
+  ab->len = len;
+  ab->free_cb = free_cb;
+  return mk_buffer_obj(v7, V7_BUF_ARRAY_BUFFER, ab, V7_UNDEFINED, 0, len);
+}
+
+/* Makes a zero-filled `ArrayBuffer` of `len` bytes */
+WARN_UNUSED_RESULT
+static enum v7_err alloc_array_buffer(struct v7 *v7, size_t len, val_t *res) {
+  enum v7_err rcode = V7_OK;
+  void *data = calloc(len > 0 ? len : 1, 1);
+
+  if (data == NULL) {
+    rcode = v7_throwf(v7, RANGE_ERROR, "Array buffer allocation failed");
+    goto clean;
+  }
+  *res = mk_array_buffer(v7, data, len, free);
+
+clean:
+  return rcode;
+}
+
+v7_val_t v7_mk_array_buffer(struct v7 *v7, const void *data, size_t len) {
+  void *p = calloc(len > 0 ? len : 1, 1);
+  if (p == NULL) {
+    return V7_UNDEFINED;
+  }
+  if (data != NULL) {
+    memcpy(p, data, len);
+  }
+  return mk_array_buffer(v7, p, len, free);
+}
+
+v7_val_t v7_mk_array_buffer_external(struct v7 *v7, void *data, size_t len,
+                                     v7_destructor_cb_t *free_cb) {
+  return mk_array_buffer(v7, data, len, free_cb);
+}
+
+int v7_is_array_buffer(struct v7 *v7, v7_val_t v) {
+  struct v7_buffer_view *bv = buffer_view(v7, v);
+  return bv != NULL && bv->kind == V7_BUF_ARRAY_BUFFER;
+}
+
+void *v7_get_array_buffer_data(struct v7 *v7, v7_val_t v, size_t *len) {
+  struct v7_buffer_view *bv = buffer_view(v7, v);
+  if (bv == NULL) {
+    if (len != NULL) *len = 0;
+    return NULL;
+  }
+  if (len != NULL) *len = bv->length * buf_elem_size[bv->kind];
+  return bv->ab->data + bv->offset;
+}
+
+/* Reads an element of the given kind at `p` */
+static double buf_load(enum v7_buf_kind kind, const uint8_t *p) {
+  union buf_elem u;
+  memcpy(&u, p, buf_elem_size[kind]);
+  switch (kind) {
+    case V7_BUF_INT8:
+      return u.i8;
+    case V7_BUF_INT16:
+      return u.i16;
+    case V7_BUF_UINT16:
+      return u.u16;
+    case V7_BUF_INT32:
+      return u.i32;
+    case V7_BUF_UINT32:
+      return u.u32;
+    case V7_BUF_FLOAT32:
+      return u.f32;
+    case V7_BUF_FLOAT64:
+      return u.f64;
+    default:
+      return u.u8;
+  }
+}
+
+/* Wraps `d` modulo 2^32, like the integer conversions of ECMAScript do */
+static uint32_t buf_to_uint32(double d) {
+  if (isnan(d) || isinf(d)) {
+    return 0;
+  }
+  d = fmod(d < 0 ? ceil(d) : floor(d), 4294967296.0);
+  return (uint32_t)(d < 0 ? d + 4294967296.0 : d);
+}
+
+/* Conversion of `Uint8ClampedArray`: rounds half to even */
+static uint8_t buf_clamp(double d) {
+  double f;
+  if (!(d > 0)) {
+    return 0;
+  }
+  if (d >= 255) {
+    return 255;
+  }
+  f = floor(d);
+  if (d - f > 0.5 || (d - f == 0.5 && ((int) f & 1))) {
+    f++;
+  }
+  return (uint8_t) f;
+}
+
+/* Stores `d` as an element of the given kind at `p` */
+static void buf_store(enum v7_buf_kind kind, uint8_t *p, double d) {
+  union buf_elem u;
+  switch (kind) {
+    case V7_BUF_UINT8_CLAMPED:
+      u.u8 = buf_clamp(d);
+      break;
+    case V7_BUF_INT16:
+    case V7_BUF_UINT16:
+      u.u16 = (uint16_t) buf_to_uint32(d);
+      break;
+    case V7_BUF_INT32:
+    case V7_BUF_UINT32:
+      u.u32 = buf_to_uint32(d);
+      break;
+    case V7_BUF_FLOAT32:
+      u.f32 = (float) d;
+      break;
+    case V7_BUF_FLOAT64:
+      u.f64 = d;
+      break;
+    default:
+      u.u8 = (uint8_t) buf_to_uint32(d);
+      break;
+  }
+  memcpy(p, &u, buf_elem_size[kind]);
+}
+
+V7_PRIVATE val_t
+typed_array_get(struct v7 *v7, struct v7_buffer_view *bv, unsigned long index) {
+  const uint8_t *p =
+      bv->ab->data + bv->offset + index * buf_elem_size[bv->kind];
+  return v7_mk_number(v7, buf_load(bv->kind, p));
+}
+
+WARN_UNUSED_RESULT
+V7_PRIVATE enum v7_err typed_array_set(struct v7 *v7, val_t obj,
+                                       unsigned long index, val_t v,
+                                       int *res) {
+  enum v7_err rcode = V7_OK;
+  struct v7_buffer_view *bv;
+  int ires = -1;
+
+  if (!v7_is_number(v)) {
+    v7_own(v7, &obj);
+    rcode = to_number_v(v7, v, &v);
+    v7_disown(v7, &obj);
+    if (rcode != V7_OK) {
+      goto clean;
+    }
+  }
+
+  bv = typed_array_view(v7, obj);
+  if (bv != NULL && index < bv->length) {
+    buf_store(bv->kind,
+              bv->ab->data + bv->offset + index * buf_elem_size[bv->kind],
+              v7_get_double(v7, v));
+    ires = 0;
+  }
+
+clean:
+  if (res != NULL) {
+    *res = ires;
+  }
+  return rcode;
+}
+
+/*
+ * Converts `v` to a byte length, element count or offset; `def` is used if
+ * `v` is undefined. Throws `RangeError` if the value is negative or too big.
+ */
+WARN_UNUSED_RESULT
+static enum v7_err buf_arg_size(struct v7 *v7, val_t v, size_t def,
+                                size_t *res) {
+  enum v7_err rcode = V7_OK;
+  double d;
+
+  if (v7_is_undefined(v)) {
+    *res = def;
+    goto clean;
+  }
+  V7_TRY(to_number_v(v7, v, &v));
+  d = v7_get_double(v7, v);
+  if (isnan(d)) {
+    d = 0;
+  }
+  if (d < 0 || d > V7_BUF_MAX_LEN) {
+    rcode = v7_throwf(v7, RANGE_ERROR, "Invalid length");
+    goto clean;
+  }
+  *res = (size_t) d;
+
+clean:
+  return rcode;
+}
+
+/*
+ * Converts `begin` or `end` argument of `slice()` and `subarray()`: negative
+ * values count from `len`, and the result is clamped to `[0, len]`.
+ */
+WARN_UNUSED_RESULT
+static enum v7_err buf_arg_index(struct v7 *v7, val_t v, size_t len,
+                                 size_t def, size_t *res) {
+  enum v7_err rcode = V7_OK;
+  double d;
+
+  if (v7_is_undefined(v)) {
+    *res = def;
+    goto clean;
+  }
+  V7_TRY(to_number_v(v7, v, &v));
+  d = v7_get_double(v7, v);
+  if (isnan(d)) {
+    d = 0;
+  }
+  if (d < 0) {
+    d += len;
+  }
+  *res = d < 0 ? 0 : d > len ? len : (size_t) d;
+
+clean:
+  return rcode;
+}
+
+WARN_UNUSED_RESULT
+V7_PRIVATE enum v7_err ArrayBuffer_ctor(struct v7 *v7, v7_val_t *res) {
+  enum v7_err rcode = V7_OK;
+  size_t len;
+
+  V7_TRY(buf_arg_size(v7, v7_arg(v7, 0), 0, &len));
+  V7_TRY(alloc_array_buffer(v7, len, res));
+
+clean:
+  return rcode;
+}
+
+WARN_UNUSED_RESULT
+V7_PRIVATE enum v7_err ArrayBuffer_isView(struct v7 *v7, v7_val_t *res) {
+  struct v7_buffer_view *bv = buffer_view(v7, v7_arg(v7, 0));
+  *res = v7_mk_boolean(v7, bv != NULL && bv->kind != V7_BUF_ARRAY_BUFFER);
+  return V7_OK;
+}
+
+WARN_UNUSED_RESULT
+V7_PRIVATE enum v7_err ArrayBuffer_slice(struct v7 *v7, v7_val_t *res) {
+  enum v7_err rcode = V7_OK;
+  struct v7_buffer_view *bv = buffer_view(v7, v7_get_this(v7));
+  size_t begin, end;
+
+  if (bv == NULL || bv->kind != V7_BUF_ARRAY_BUFFER) {
+    rcode = v7_throwf(v7, TYPE_ERROR, "Not an ArrayBuffer");
+    goto clean;
+  }
+  V7_TRY(buf_arg_index(v7, v7_arg(v7, 0), bv->length, 0, &begin));
+  V7_TRY(buf_arg_index(v7, v7_arg(v7, 1), bv->length, bv->length, &end));
+  if (end < begin) {
+    end = begin;
+  }
+  V7_TRY(alloc_array_buffer(v7, end - begin, res));
+  memcpy(buffer_view(v7, *res)->ab->data, bv->ab->data + begin, end - begin);
+
+clean:
+  return rcode;
+}
+
+WARN_UNUSED_RESULT
+V7_PRIVATE enum v7_err Buffer_byteLength(struct v7 *v7, v7_val_t *res) {
+  struct v7_buffer_view *bv = buffer_view(v7, v7_get_this(v7));
+  *res = v7_mk_number(
+      v7, bv == NULL ? 0 : (double) bv->length * buf_elem_size[bv->kind]);
+  return V7_OK;
+}
+
+WARN_UNUSED_RESULT
+V7_PRIVATE enum v7_err Buffer_byteOffset(struct v7 *v7, v7_val_t *res) {
+  struct v7_buffer_view *bv = buffer_view(v7, v7_get_this(v7));
+  *res = v7_mk_number(v7, bv == NULL ? 0 : (double) bv->offset);
+  return V7_OK;
+}
+
+WARN_UNUSED_RESULT
+V7_PRIVATE enum v7_err TypedArray_length(struct v7 *v7, v7_val_t *res) {
+  struct v7_buffer_view *bv = typed_array_view(v7, v7_get_this(v7));
+  *res = v7_mk_number(v7, bv == NULL ? 0 : (double) bv->length);
+  return V7_OK;
+}
+
+/*
+ * Constructor of the typed arrays:
+ *
+ * - `new Uint8Array(length)` makes a zero-filled array with a new buffer;
+ * - `new Uint8Array(buffer, byteOffset, length)` makes a view of `buffer`;
+ * - `new Uint8Array(array)` copies an array, typed array or array-like object.
+ */
+WARN_UNUSED_RESULT
+static enum v7_err typed_array_ctor(struct v7 *v7, enum v7_buf_kind kind,
+                                    val_t *res) {
+  enum v7_err rcode = V7_OK;
+  val_t arg = v7_arg(v7, 0);
+  val_t buffer = V7_UNDEFINED, obj = V7_UNDEFINED, v = V7_UNDEFINED;
+  struct v7_buffer_view *src = buffer_view(v7, arg);
+  size_t size = buf_elem_size[kind], offset = 0, length = 0, i;
+
+  v7_own(v7, &buffer);
+  v7_own(v7, &obj);
+
+  if (src != NULL && src->kind == V7_BUF_ARRAY_BUFFER) {
+    V7_TRY(buf_arg_size(v7, v7_arg(v7, 1), 0, &offset));
+    if (offset % size != 0 || offset > src->length) {
+      rcode = v7_throwf(v7, RANGE_ERROR, "Invalid offset");
+      goto clean;
+    }
+    if (v7_is_undefined(v7_arg(v7, 2)) && (src->length - offset) % size != 0) {
+      rcode = v7_throwf(v7, RANGE_ERROR, "Invalid buffer length");
+      goto clean;
+    }
+    V7_TRY(buf_arg_size(v7, v7_arg(v7, 2), (src->length - offset) / size,
+                        &length));
+    if (length > (src->length - offset) / size) {
+      rcode = v7_throwf(v7, RANGE_ERROR, "Invalid length");
+      goto clean;
+    }
+    *res = mk_buffer_obj(v7, kind, src->ab, arg, offset, length);
+    goto clean;
+  }
+
+  if (v7_is_object(arg)) {
+    V7_TRY(v7_get_throwing(v7, arg, "length", 6, &v));
+    V7_TRY(buf_arg_size(v7, v, 0, &length));
+  } else {
+    V7_TRY(buf_arg_size(v7, arg, 0, &length));
+  }
+  if (length > V7_BUF_MAX_LEN / size) {
+    rcode = v7_throwf(v7, RANGE_ERROR, "Invalid length");
+    goto clean;
+  }
+  V7_TRY(alloc_array_buffer(v7, length * size, &buffer));
+  obj = mk_buffer_obj(v7, kind, buffer_view(v7, buffer)->ab, buffer, 0, length);
+
+  if (v7_is_object(arg)) {
+    for (i = 0; i < length; i++) {
+      V7_TRY(v7_get_throwing_v(v7, arg, v7_mk_number(v7, i), &v));
+      V7_TRY(typed_array_set(v7, obj, i, v, NULL));
+    }
+  }
+  *res = obj;
+
+clean:
+  v7_disown(v7, &obj);
+  v7_disown(v7, &buffer);
+  return rcode;
+}
+
+#define DEF_TYPED_ARRAY_CTOR(name, kind)                                  \
+  WARN_UNUSED_RESULT                                                      \
+  V7_PRIVATE enum v7_err name##Array_ctor(struct v7 *v7, v7_val_t *res) { \
+    return typed_array_ctor(v7, kind, res);                               \
+  }
+
+DEF_TYPED_ARRAY_CTOR(Int8, V7_BUF_INT8)
+DEF_TYPED_ARRAY_CTOR(Uint8, V7_BUF_UINT8)
+DEF_TYPED_ARRAY_CTOR(Uint8Clamped, V7_BUF_UINT8_CLAMPED)
+DEF_TYPED_ARRAY_CTOR(Int16, V7_BUF_INT16)
+DEF_TYPED_ARRAY_CTOR(Uint16, V7_BUF_UINT16)
+DEF_TYPED_ARRAY_CTOR(Int32, V7_BUF_INT32)
+DEF_TYPED_ARRAY_CTOR(Uint32, V7_BUF_UINT32)
+DEF_TYPED_ARRAY_CTOR(Float32, V7_BUF_FLOAT32)
+DEF_TYPED_ARRAY_CTOR(Float64, V7_BUF_FLOAT64)
+
+WARN_UNUSED_RESULT
+V7_PRIVATE enum v7_err TypedArray_subarray(struct v7 *v7, v7_val_t *res) {
+  enum v7_err rcode = V7_OK;
+  val_t this_obj = v7_get_this(v7);
+  struct v7_buffer_view *bv = typed_array_view(v7, this_obj);
+  size_t begin, end;
+
+  if (bv == NULL) {
+    rcode = v7_throwf(v7, TYPE_ERROR, "Not a typed array");
+    goto clean;
+  }
+  V7_TRY(buf_arg_index(v7, v7_arg(v7, 0), bv->length, 0, &begin));
+  V7_TRY(buf_arg_index(v7, v7_arg(v7, 1), bv->length, bv->length, &end));
+  if (end < begin) {
+    end = begin;
+  }
+  *res = mk_buffer_obj(v7, bv->kind, bv->ab, v7_get(v7, this_obj, "buffer", 6),
+                       bv->offset + begin * buf_elem_size[bv->kind],
+                       end - begin);
+
+clean:
+  return rcode;
+}
+
+WARN_UNUSED_RESULT
+V7_PRIVATE enum v7_err TypedArray_set(struct v7 *v7, v7_val_t *res) {
+  enum v7_err rcode = V7_OK;
+  val_t this_obj = v7_get_this(v7), src = v7_arg(v7, 0), v = V7_UNDEFINED;
+  struct v7_buffer_view *bv = typed_array_view(v7, this_obj), *sbv;
+  size_t offset, length, i;
+  double *tmp = NULL;
+
+  if (bv == NULL) {
+    rcode = v7_throwf(v7, TYPE_ERROR, "Not a typed array");
+    goto clean;
+  }
+  V7_TRY(buf_arg_size(v7, v7_arg(v7, 1), 0, &offset));
+  sbv = typed_array_view(v7, src);
+  if (sbv != NULL) {
+    length = sbv->length;
+  } else {
+    V7_TRY(v7_get_throwing(v7, src, "length", 6, &v));
+    V7_TRY(buf_arg_size(v7, v, 0, &length));
+  }
+  if (offset > bv->length || length > bv->length - offset) {
+    rcode = v7_throwf(v7, RANGE_ERROR, "Source is too large");
+    goto clean;
+  }
+
+  if (sbv == NULL) {
+    for (i = 0; i < length; i++) {
+      V7_TRY(v7_get_throwing_v(v7, src, v7_mk_number(v7, i), &v));
+      V7_TRY(typed_array_set(v7, this_obj, offset + i, v, NULL));
+    }
+  } else if (sbv->kind == bv->kind) {
+    memmove(bv->ab->data + bv->offset + offset * buf_elem_size[bv->kind],
+            sbv->ab->data + sbv->offset, length * buf_elem_size[bv->kind]);
+  } else {
+    /* Elements are converted through doubles, the views may overlap */
+    tmp = (double *) malloc(length * sizeof(*tmp) + 1);
+    for (i = 0; i < length; i++) {
+      tmp[i] = buf_load(sbv->kind, sbv->ab->data + sbv->offset +
+                                       i * buf_elem_size[sbv->kind]);
+    }
+    for (i = 0; i < length; i++) {
+      buf_store(bv->kind, bv->ab->data + bv->offset +
+                              (offset + i) * buf_elem_size[bv->kind],
+                tmp[i]);
+    }
+  }
+  *res = V7_UNDEFINED;
+
+clean:
+  free(tmp);
+  return rcode;
+}
+
+WARN_UNUSED_RESULT
+V7_PRIVATE enum v7_err DataView_ctor(struct v7 *v7, v7_val_t *res) {
+  enum v7_err rcode = V7_OK;
+  val_t arg = v7_arg(v7, 0);
+  struct v7_buffer_view *src = buffer_view(v7, arg);
+  size_t offset, length;
+
+  if (src == NULL || src->kind != V7_BUF_ARRAY_BUFFER) {
+    rcode = v7_throwf(v7, TYPE_ERROR, "DataView needs an ArrayBuffer");
+    goto clean;
+  }
+  V7_TRY(buf_arg_size(v7, v7_arg(v7, 1), 0, &offset));
+  if (offset > src->length) {
+    rcode = v7_throwf(v7, RANGE_ERROR, "Invalid offset");
+    goto clean;
+  }
+  V7_TRY(buf_arg_size(v7, v7_arg(v7, 2), src->length - offset, &length));
+  if (length > src->length - offset) {
+    rcode = v7_throwf(v7, RANGE_ERROR, "Invalid length");
+    goto clean;
+  }
+  *res = mk_buffer_obj(v7, V7_BUF_DATA_VIEW, src->ab, arg, offset, length);
+
+clean:
+  return rcode;
+}
+
+/* Copies `n` bytes, reversing them unless `le` matches the host byte order */
+static void dv_copy(uint8_t *dst, const uint8_t *src, size_t n, int le) {
+  static const uint16_t one = 1;
+  size_t i;
+
+  if (!le == !*(const uint8_t *) &one) {
+    memcpy(dst, src, n);
+  } else {
+    for (i = 0; i < n; i++) {
+      dst[i] = src[n - 1 - i];
+    }
+  }
+}
+
+/*
+ * `DataView.prototype.getXxx(byteOffset, littleEndian)` and
+ * `DataView.prototype.setXxx(byteOffset, value, littleEndian)`.
+ * The byte order is big endian unless `littleEndian` is true.
+ */
+WARN_UNUSED_RESULT
+static enum v7_err dv_access(struct v7 *v7, enum v7_buf_kind kind, int set,
+                             val_t *res) {
+  enum v7_err rcode = V7_OK;
+  struct v7_buffer_view *bv = buffer_view(v7, v7_get_this(v7));
+  val_t v = V7_UNDEFINED;
+  size_t offset, size = buf_elem_size[kind];
+  int le = v7_is_truthy(v7, v7_arg(v7, set ? 2 : 1));
+  uint8_t tmp[sizeof(union buf_elem)];
+
+  if (bv == NULL || bv->kind != V7_BUF_DATA_VIEW) {
+    rcode = v7_throwf(v7, TYPE_ERROR, "Not a DataView");
+    goto clean;
+  }
+  V7_TRY(buf_arg_size(v7, v7_arg(v7, 0), 0, &offset));
+  if (set) {
+    V7_TRY(to_number_v(v7, v7_arg(v7, 1), &v));
+  }
+  if (offset > bv->length || bv->length - offset < size) {
+    rcode = v7_throwf(v7, RANGE_ERROR, "Offset is outside of the DataView");
+    goto clean;
+  }
+
+  if (set) {
+    buf_store(kind, tmp, v7_get_double(v7, v));
+    dv_copy(bv->ab->data + bv->offset + offset, tmp, size, le);
+    *res = V7_UNDEFINED;
+  } else {
+    dv_copy(tmp, bv->ab->data + bv->offset + offset, size, le);
+    *res = v7_mk_number(v7, buf_load(kind, tmp));
+  }
+
+clean:
+  return rcode;
+}
+
+#define DEF_DATAVIEW_ACCESSORS(name, kind)                                  \
+  WARN_UNUSED_RESULT                                                        \
+  V7_PRIVATE enum v7_err DataView_get##name(struct v7 *v7, v7_val_t *res) { \
+    return dv_access(v7, kind, 0, res);                                     \
+  }                                                                         \
+  WARN_UNUSED_RESULT                                                        \
+  V7_PRIVATE enum v7_err DataView_set##name(struct v7 *v7, v7_val_t *res) { \
+    return dv_access(v7, kind, 1, res);                                     \
+  }
+
+DEF_DATAVIEW_ACCESSORS(Int8, V7_BUF_INT8)
+DEF_DATAVIEW_ACCESSORS(Uint8, V7_BUF_UINT8)
+DEF_DATAVIEW_ACCESSORS(Int16, V7_BUF_INT16)
+DEF_DATAVIEW_ACCESSORS(Uint16, V7_BUF_UINT16)
+DEF_DATAVIEW_ACCESSORS(Int32, V7_BUF_INT32)
+DEF_DATAVIEW_ACCESSORS(Uint32, V7_BUF_UINT32)
+DEF_DATAVIEW_ACCESSORS(Float32, V7_BUF_FLOAT32)
+DEF_DATAVIEW_ACCESSORS(Float64, V7_BUF_FLOAT64)
+
+static v7_cfunction_t *const buf_ctors[V7_BUF_KIND_MAX] = {
+    ArrayBuffer_ctor,       Int8Array_ctor,   Uint8Array_ctor,
+    Uint8ClampedArray_ctor, Int16Array_ctor,  Uint16Array_ctor,
+    Int32Array_ctor,        Uint32Array_ctor, Float32Array_ctor,
+    Float64Array_ctor,      DataView_ctor};
+
+static void buf_def_getter(struct v7 *v7, val_t o, const char *name,
+                           v7_cfunction_t *f) {
+  v7_def(v7, o, name, strlen(name),
+         (V7_DESC_GETTER(1) | V7_DESC_ENUMERABLE(0)), v7_mk_cfunction(f));
+}
+
+#define DECLARE_DATAVIEW_ACCESSORS(name)                         \
+  set_cfunc_prop(v7, dv_proto, "get" #name, DataView_get##name); \
+  set_cfunc_prop(v7, dv_proto, "set" #name, DataView_set##name);
+
+V7_PRIVATE void init_typedarray(struct v7 *v7) {
+  v7_prop_attr_desc_t attr_internal =
+      (V7_DESC_ENUMERABLE(0) | V7_DESC_WRITABLE(0) | V7_DESC_CONFIGURABLE(0));
+  val_t ta_proto = v7_mk_object(v7), ctor = V7_UNDEFINED, ab_proto, dv_proto;
+  int kind;
+
+  v7_own(v7, &ta_proto);
+  v7_own(v7, &ctor);
+
+  for (kind = 0; kind < V7_BUF_KIND_MAX; kind++) {
+    const char *name = buf_ctor_names[kind];
+    val_t proto = V7_BUF_IS_TYPED_ARRAY(kind) ? mk_object(v7, ta_proto)
+                                              : v7_mk_object(v7);
+    v7->vals.buffer_prototypes[kind] = proto;
+    ctor = mk_cfunction_obj_with_proto(v7, buf_ctors[kind],
+                                       kind == V7_BUF_ARRAY_BUFFER ? 1 : 3,
+                                       proto);
+    v7_def(v7, v7->vals.global_object, name, strlen(name),
+           V7_DESC_ENUMERABLE(0), ctor);
+
+    if (V7_BUF_IS_TYPED_ARRAY(kind)) {
+      val_t size = v7_mk_number(v7, buf_elem_size[kind]);
+      v7_def(v7, ctor, "BYTES_PER_ELEMENT", 17, attr_internal, size);
+      v7_def(v7, proto, "BYTES_PER_ELEMENT", 17, attr_internal, size);
+    } else if (kind == V7_BUF_ARRAY_BUFFER) {
+      set_cfunc_prop(v7, ctor, "isView", ArrayBuffer_isView);
+    }
+  }
+
+  ab_proto = v7->vals.buffer_prototypes[V7_BUF_ARRAY_BUFFER];
+  buf_def_getter(v7, ab_proto, "byteLength", Buffer_byteLength);
+  set_cfunc_prop(v7, ab_proto, "slice", ArrayBuffer_slice);
+
+  buf_def_getter(v7, ta_proto, "length", TypedArray_length);
+  buf_def_getter(v7, ta_proto, "byteLength", Buffer_byteLength);
+  buf_def_getter(v7, ta_proto, "byteOffset", Buffer_byteOffset);
+  set_cfunc_prop(v7, ta_proto, "subarray", TypedArray_subarray);
+  set_cfunc_prop(v7, ta_proto, "set", TypedArray_set);
+
+  dv_proto = v7->vals.buffer_prototypes[V7_BUF_DATA_VIEW];
+  buf_def_getter(v7, dv_proto, "byteLength", Buffer_byteLength);
+  buf_def_getter(v7, dv_proto, "byteOffset", Buffer_byteOffset);
+  DECLARE_DATAVIEW_ACCESSORS(Int8);
+  DECLARE_DATAVIEW_ACCESSORS(Uint8);
+  DECLARE_DATAVIEW_ACCESSORS(Int16);
+  DECLARE_DATAVIEW_ACCESSORS(Uint16);
+  DECLARE_DATAVIEW_ACCESSORS(Int32);
+  DECLARE_DATAVIEW_ACCESSORS(Uint32);
+  DECLARE_DATAVIEW_ACCESSORS(Float32);
+  DECLARE_DATAVIEW_ACCESSORS(Float64);
+
+  v7_disown(v7, &ctor);
+  v7_disown(v7, &ta_proto);
+}
+
+#endif /* V7_ENABLE__ArrayBuffer */
+#ifdef V7_MODULE_LINES
 #line 1 "./src/main.c"
 #endif
 /*
@@ -33324,6 +43387,8 @@ V7_PRIVATE void init_regex(struct v7 *v7) {
 /* Amalgamated: #include "v7/src/exec.h" */
 /* Amalgamated: #include "v7/src/util.h" */
 /* Amalgamated: #include "v7/src/conversion.h" */
+/* Amalgamated: #include "v7/src/stats_public.h" */
+/* Amalgamated: #include "v7/src/heaplog_public.h" */
 /* Amalgamated: #include "common/platform.h" */
 /* Amalgamated: #include "common/cs_file.h" */
 
@@ -33354,6 +43419,19 @@ static void show_usage(char *argv[]) {
   fprintf(stderr, "%s\n", "  -vp <n>              property arena size");
 #ifdef V7_FREEZE
   fprintf(stderr, "%s\n", "  -freeze filename     dump JS heap into a file");
+#endif
+#ifdef V7_ENABLE_SNAPSHOT
+  fprintf(stderr, "%s\n", "  -snapshot filename   start from a heap snapshot");
+  fprintf(stderr, "%s\n", "  -save-snapshot filename  save heap after run");
+#endif
+#ifdef V7_ENABLE_PROFILER
+  fprintf(stderr, "%s\n", "  -prof filename       save collapsed JS stacks");
+#endif
+#ifdef V7_ENABLE_STATS
+  fprintf(stderr, "%s\n", "  -stats               dump execution stats");
+#endif
+#ifdef V7_ENABLE_HEAPLOG
+  fprintf(stderr, "%s\n", "  -heaplog filename    log heap allocations");
 #endif
   exit(EXIT_FAILURE);
 }
@@ -33384,6 +43462,82 @@ static void dump_mm_stats(struct v7 *v7) {
 }
 #endif
 
+#ifdef V7_ENABLE_STATS
+/* Number of the most frequent items of each kind shown by `-stats` */
+#define MAIN_STATS_TOP 20
+
+struct main_stat_item {
+  unsigned long count;
+  int idx;
+};
+
+static int main_stat_item_cmp(const void *a, const void *b) {
+  const struct main_stat_item *ia = (const struct main_stat_item *) a;
+  const struct main_stat_item *ib = (const struct main_stat_item *) b;
+  return ia->count < ib->count ? 1 : (ia->count > ib->count ? -1 : 0);
+}
+
+/* Prints the most frequent items of a per-item execution metric */
+static void dump_exec_stat_top(struct v7 *v7, enum v7_exec_stat_what what,
+                               int n) {
+  int nops = v7_exec_stat(v7, V7_EXEC_STAT_OPCODES, 0);
+  struct main_stat_item *items =
+      (struct main_stat_item *) malloc(n * sizeof(*items));
+  int i, cnt = 0;
+
+  if (items == NULL) return;
+  for (i = 0; i < n; i++) {
+    unsigned long count = v7_exec_stat(v7, what, i);
+    if (count > 0) {
+      items[cnt].count = count;
+      items[cnt].idx = i;
+      cnt++;
+    }
+  }
+  qsort(items, cnt, sizeof(*items), main_stat_item_cmp);
+
+  for (i = 0; i < cnt && i < MAIN_STATS_TOP; i++) {
+    int idx = items[i].idx;
+    if (what == V7_EXEC_STAT_OP_PAIR) {
+      printf("  %s %s", v7_exec_stat_op_name(idx / nops),
+             v7_exec_stat_op_name(idx % nops));
+    } else if (what == V7_EXEC_STAT_CFUNC) {
+      printf("  %s", v7_exec_stat_cfunc_name(v7, idx));
+    } else {
+      printf("  %s", v7_exec_stat_op_name(idx));
+    }
+    printf(": %lu\n", items[i].count);
+  }
+  free(items);
+}
+
+static void dump_exec_stats(struct v7 *v7) {
+  int nops = v7_exec_stat(v7, V7_EXEC_STAT_OPCODES, 0);
+  int ndepths = v7_exec_stat(v7, V7_EXEC_STAT_PROP_LOOKUP_DEPTHS, 0);
+  int i;
+
+  printf("instructions: %lu\n", v7_exec_stat(v7, V7_EXEC_STAT_OPS, 0));
+  dump_exec_stat_top(v7, V7_EXEC_STAT_OP, nops);
+  printf("instruction pairs:\n");
+  dump_exec_stat_top(v7, V7_EXEC_STAT_OP_PAIR, nops * nops);
+  printf("property lookups: %lu, objects visited: %lu\n",
+         v7_exec_stat(v7, V7_EXEC_STAT_PROP_LOOKUPS, 0),
+         v7_exec_stat(v7, V7_EXEC_STAT_PROP_LOOKUP_STEPS, 0));
+  for (i = 0; i < ndepths; i++) {
+    printf("  %d%s: %lu\n", i + 1, i + 1 == ndepths ? "+" : "",
+           v7_exec_stat(v7, V7_EXEC_STAT_PROP_LOOKUP_DEPTH, i));
+  }
+  printf("C function calls: %lu\n",
+         v7_exec_stat(v7, V7_EXEC_STAT_CFUNC_CALLS, 0));
+  dump_exec_stat_top(v7, V7_EXEC_STAT_CFUNC,
+                     v7_exec_stat(v7, V7_EXEC_STAT_CFUNCS, 0));
+  printf("GC: %lu cycles, %lu steps, %lu us\n",
+         v7_exec_stat(v7, V7_EXEC_STAT_GC_CYCLES, 0),
+         v7_exec_stat(v7, V7_EXEC_STAT_GC_STEPS, 0),
+         v7_exec_stat(v7, V7_EXEC_STAT_GC_TIME_US, 0));
+}
+#endif
+
 int v7_main(int argc, char *argv[], void (*pre_freeze_init)(struct v7 *),
             void (*pre_init)(struct v7 *), void (*post_init)(struct v7 *)) {
   int exit_rcode = EXIT_SUCCESS;
@@ -33394,6 +43548,19 @@ int v7_main(int argc, char *argv[], void (*pre_freeze_init)(struct v7 *),
   val_t res;
   int nexprs = 0;
   const char *exprs[16];
+#ifdef V7_ENABLE_SNAPSHOT
+  const char *snapshot = NULL, *save_snapshot = NULL;
+#endif
+#ifdef V7_ENABLE_PROFILER
+  const char *prof_file = NULL;
+#endif
+#ifdef V7_ENABLE_STATS
+  int exec_stats = 0;
+#endif
+#ifdef V7_ENABLE_HEAPLOG
+  const char *heaplog_file = NULL;
+  FILE *heaplog_fp = NULL;
+#endif
 
   memset(&opts, 0, sizeof(opts));
 
@@ -33433,6 +43600,32 @@ int v7_main(int argc, char *argv[], void (*pre_freeze_init)(struct v7 *),
       opts.freeze_file = argv[i + 1];
       i++;
     }
+#endif
+#ifdef V7_ENABLE_SNAPSHOT
+    else if (strcmp(argv[i], "-snapshot") == 0 && i + 1 < argc) {
+      snapshot = argv[i + 1];
+      i++;
+    } else if (strcmp(argv[i], "-save-snapshot") == 0 && i + 1 < argc) {
+      save_snapshot = argv[i + 1];
+      i++;
+    }
+#endif
+#ifdef V7_ENABLE_PROFILER
+    else if (strcmp(argv[i], "-prof") == 0 && i + 1 < argc) {
+      prof_file = argv[i + 1];
+      i++;
+    }
+#endif
+#ifdef V7_ENABLE_STATS
+    else if (strcmp(argv[i], "-stats") == 0) {
+      exec_stats = 1;
+    }
+#endif
+#ifdef V7_ENABLE_HEAPLOG
+    else if (strcmp(argv[i], "-heaplog") == 0 && i + 1 < argc) {
+      heaplog_file = argv[i + 1];
+      i++;
+    }
 #endif
   }
 
@@ -33442,26 +43635,39 @@ int v7_main(int argc, char *argv[], void (*pre_freeze_init)(struct v7 *),
   }
 #endif
 
-  v7 = v7_create_opt(opts);
   res = V7_UNDEFINED;
-
-  if (pre_freeze_init != NULL) {
-    pre_freeze_init(v7);
+#ifdef V7_ENABLE_SNAPSHOT
+  v7 = NULL;
+  if (snapshot != NULL &&
+      (v7 = v7_create_from_snapshot(snapshot, opts)) == NULL) {
+    fprintf(stderr, "Cannot load snapshot [%s]\n", snapshot);
   }
 
-#ifdef V7_FREEZE
-  /*
-   * Skip pre_init if freezing, but still execute cmdline expressions.
-   * This makes it easier to add custom code when freezing from cmdline.
-   */
-  if (opts.freeze_file == NULL) {
+  /* a snapshot already contains whatever the init hooks have made */
+  if (v7 == NULL) {
 #endif
+    v7 = v7_create_opt(opts);
 
-    if (pre_init != NULL) {
-      pre_init(v7);
+    if (pre_freeze_init != NULL) {
+      pre_freeze_init(v7);
     }
 
 #ifdef V7_FREEZE
+    /*
+     * Skip pre_init if freezing, but still execute cmdline expressions.
+     * This makes it easier to add custom code when freezing from cmdline.
+     */
+    if (opts.freeze_file == NULL) {
+#endif
+
+      if (pre_init != NULL) {
+        pre_init(v7);
+      }
+
+#ifdef V7_FREEZE
+    }
+#endif
+#ifdef V7_ENABLE_SNAPSHOT
   }
 #endif
 
@@ -33477,6 +43683,28 @@ int v7_main(int argc, char *argv[], void (*pre_freeze_init)(struct v7 *),
   (void) dump_stats;
 #endif
 
+#ifdef V7_ENABLE_PROFILER
+  if (prof_file != NULL &&
+      v7_profiler_start(v7, V7_PROFILER_DEFAULT_INTERVAL) != 0) {
+    fprintf(stderr, "Cannot start the profiler\n");
+    prof_file = NULL;
+  }
+#endif
+
+#ifdef V7_ENABLE_STATS
+  /* count the scripts only, not the initialization */
+  v7_exec_stat_reset(v7);
+#endif
+
+#ifdef V7_ENABLE_HEAPLOG
+  if (heaplog_file != NULL &&
+      ((heaplog_fp = fopen(heaplog_file, "w")) == NULL ||
+       v7_heaplog_start(v7, heaplog_fp) != 0)) {
+    fprintf(stderr, "Cannot write [%s]\n", heaplog_file);
+    exit_rcode = EXIT_FAILURE;
+  }
+#endif
+
   /* Execute inline expressions */
   for (j = 0; j < nexprs; j++) {
     enum v7_err (*exec)(struct v7 *, const char *, v7_val_t *);
@@ -33533,10 +43761,48 @@ int v7_main(int argc, char *argv[], void (*pre_freeze_init)(struct v7 *),
     }
   }
 
+#ifdef V7_ENABLE_SNAPSHOT
+  if (save_snapshot != NULL && v7_save_snapshot(v7, save_snapshot) != V7_OK) {
+    v7_print_error(stderr, v7, save_snapshot, v7_get_thrown_value(v7, NULL));
+    exit_rcode = EXIT_FAILURE;
+  }
+#endif
+
   if (post_init != NULL) {
     post_init(v7);
   }
 
+#ifdef V7_ENABLE_PROFILER
+  if (prof_file != NULL) {
+    size_t len;
+    char *stacks = v7_profiler_dump(v7, &len);
+    FILE *fp = fopen(prof_file, "w");
+    v7_profiler_stop(v7);
+    if (stacks == NULL || fp == NULL || fwrite(stacks, 1, len, fp) != len) {
+      fprintf(stderr, "Cannot write [%s]\n", prof_file);
+      exit_rcode = EXIT_FAILURE;
+    }
+    if (fp != NULL) {
+      fclose(fp);
+    }
+    free(stacks);
+  }
+#endif
+
+#ifdef V7_ENABLE_HEAPLOG
+  if (heaplog_fp != NULL) {
+    v7_heaplog_stop(v7);
+    fclose(heaplog_fp);
+  }
+#endif
+
+#ifdef V7_ENABLE_STATS
+  if (exec_stats) {
+    printf("Execution stats:\n");
+    dump_exec_stats(v7);
+  }
+#endif
+
 #if V7_ENABLE__Memory__stats
   if (dump_stats) {
     printf("Memory stats after run:\n");
@@ -101,6 +101,7 @@
 #endif
 
 #define V7_ENABLE__Array__reduce 1
+#define V7_ENABLE__ArrayBuffer 1
 #define V7_ENABLE__Blob 1
 #define V7_ENABLE__Date 1
 #define V7_ENABLE__Date__UTC 1
@@ -305,6 +306,15 @@ v7_val_t v7_arg(struct v7 *v, unsigned long i);
 /* Return the length of `arguments` */
 unsigned long v7_argc(struct v7 *v7);
 
+/*
+ * Return the arguments of the current C function as an array of `*argc`
+ * values, without creating the `arguments` object.
+ *
+ * The array lives on the interpreter stack: it is only valid until the
+ * function calls back into JS code (e.g. `v7_apply()`, `v7_exec()`).
+ */
+const v7_val_t *v7_argv(struct v7 *v7, unsigned long *argc);
+
 /*
  * Tells the GC about a JS value variable/field owned
  * by C code.
@@ -530,6 +540,15 @@ v7_val_t v7_arg(struct v7 *v, unsigned long i);
 /* Return the length of `arguments` */
 unsigned long v7_argc(struct v7 *v7);
 
+/*
+ * Return the arguments of the current C function as an array of `*argc`
+ * values, without creating the `arguments` object.
+ *
+ * The array lives on the interpreter stack: it is only valid until the
+ * function calls back into JS code (e.g. `v7_apply()`, `v7_exec()`).
+ */
+const v7_val_t *v7_argv(struct v7 *v7, unsigned long *argc);
+
 /*
  * Tells the GC about a JS value variable/field owned
  * by C code.
@@ -855,6 +874,8 @@ typedef unsigned short v7_prop_attr_t;
  * keep all offsets in one place
  */
 #define _V7_DESC_PRESERVE_VALUE (1 << 8)
+/* not a property, but a string rope node; see `V7_TAG_STRING_R` */
+#define _V7_PROPERTY_ROPE (1 << 9)
 
 /*
  * Internal helpers for `V7_DESC_...` macros
@@ -979,6 +1000,9 @@ int v7_del(struct v7 *v7, v7_val_t obj, const char *name, size_t name_len);
  *     while ((h = v7_next_prop(h, obj, &name, &val, &attrs)) != NULL) {
  *       ...
  *     }
+ *
+ * Elements of arrays are not necessarily stored as properties: use
+ * `v7_array_length()` and `v7_array_get()` to iterate over them.
  */
 void *v7_next_prop(void *handle, v7_val_t obj, v7_val_t *name, v7_val_t *value,
                    v7_prop_attr_t *attrs);
@@ -1099,6 +1123,37 @@ enum v7_err v7_array_set_throwing(struct v7 *v7, v7_val_t arr,
 /* Delete value in array `arr` at index `index`, if it exists. */
 void v7_array_del(struct v7 *v7, v7_val_t arr, unsigned long index);
 
+#if V7_ENABLE__ArrayBuffer
+
+/*
+ * Make an `ArrayBuffer` holding a copy of `len` bytes at `data`. If `data` is
+ * NULL, the buffer is filled with zeros. Returns undefined if out of memory.
+ */
+v7_val_t v7_mk_array_buffer(struct v7 *v7, const void *data, size_t len);
+
+/*
+ * Make an `ArrayBuffer` which uses `len` bytes at `data` as its storage,
+ * without copying. `data` must stay valid until the buffer is garbage
+ * collected; at that point `free_cb`, if not NULL, is called with `data`.
+ * E.g., pass `free` to hand over a malloc-ed block.
+ */
+v7_val_t v7_mk_array_buffer_external(struct v7 *v7, void *data, size_t len,
+                                     v7_destructor_cb_t *free_cb);
+
+/* Returns true if given value is an `ArrayBuffer` object */
+int v7_is_array_buffer(struct v7 *v7, v7_val_t v);
+
+/*
+ * Returns a pointer to the bytes of an `ArrayBuffer`, or to the bytes viewed
+ * by a typed array or a `DataView`, and stores their number in `len`. The
+ * bytes can be read and modified in place, while the object is alive.
+ *
+ * Returns NULL if `v` is none of those objects.
+ */
+void *v7_get_array_buffer_data(struct v7 *v7, v7_val_t v, size_t *len);
+
+#endif /* V7_ENABLE__ArrayBuffer */
+
 #if defined(__cplusplus)
 }
 #endif /* __cplusplus */
@@ -1286,6 +1341,23 @@ enum v7_err v7_stringify_throwing(struct v7 *v7, v7_val_t v, char *buf,
  */
 #define v7_to_json(a, b, c, d) v7_stringify(a, b, c, d, V7_STRINGIFY_JSON)
 
+/*
+ * Callback which receives consecutive chunks of output of
+ * `v7_stringify_to_cb()`.
+ */
+typedef void(v7_stringify_cb_t)(const char *data, size_t len, void *user_data);
+
+/*
+ * Generate JSON representation of `v` like `JSON.stringify()` does, passing
+ * it to `cb` in chunks as it's being generated, so that the whole string
+ * never has to be kept in memory. If an exception is thrown in the middle,
+ * the output is incomplete. If `v` has no JSON representation (e.g. it's
+ * `undefined`), `cb` is not called at all.
+ */
+WARN_UNUSED_RESULT
+enum v7_err v7_stringify_to_cb(struct v7 *v7, v7_val_t v,
+                               v7_stringify_cb_t *cb, void *user_data);
+
 /* Returns true if given value evaluates to true, as in `if (v)` statement. */
 int v7_is_truthy(struct v7 *v7, v7_val_t v);
 
@@ -1494,7 +1566,10 @@ enum v7_heap_stat_what {
   V7_HEAP_STAT_BCODE_LIT_TOTAL_SIZE,
   V7_HEAP_STAT_BCODE_LIT_DESER_SIZE,
   V7_HEAP_STAT_FUNC_OWNED,
-  V7_HEAP_STAT_FUNC_OWNED_MAX
+  V7_HEAP_STAT_FUNC_OWNED_MAX,
+  /* Number of times an ordinary array became dense, and vice versa */
+  V7_HEAP_STAT_ARRAY_SPARSE_TO_DENSE,
+  V7_HEAP_STAT_ARRAY_DENSE_TO_SPARSE
 };
 
 /* Returns a given heap statistics */
@@ -1513,6 +1588,293 @@ void v7_gc(struct v7 *v7, int full);
 
 #endif /* CS_V7_SRC_GC_PUBLIC_H_ */
 #ifdef V7_MODULE_LINES
+#line 1 "./src/snapshot_public.h"
+#endif
+/*
+ * Copyright (c) 2014 Cesanta Software Limited
+ * All rights reserved
+ */
+
+/*
+ * === Heap snapshots
+ *
+ * A snapshot is a binary image of the whole JS heap of an instance: objects,
+ * functions, properties, strings and the bcode of the functions. It is meant
+ * to be saved once an instance is initialized (standard library, init
+ * scripts), and loaded on the next start instead of doing the same
+ * initialization over again.
+ *
+ * Since C functions are saved by address, a snapshot can only be loaded by
+ * the same build of the same executable which saved it.
+ *
+ * Snapshots are available if V7 is built with `V7_ENABLE_SNAPSHOT`.
+ */
+
+#ifndef CS_V7_SRC_SNAPSHOT_PUBLIC_H_
+#define CS_V7_SRC_SNAPSHOT_PUBLIC_H_
+
+/* Amalgamated: #include "v7/src/core_public.h" */
+
+#ifdef V7_ENABLE_SNAPSHOT
+
+#if defined(__cplusplus)
+extern "C" {
+#endif /* __cplusplus */
+
+/*
+ * Saves a snapshot of the heap of `v7` into the file `path`. Must not be
+ * called while some code is being executed.
+ *
+ * Values owned by C code (see `v7_own()`) are not saved. The heap must not
+ * contain foreign pointers (`v7_mk_foreign()`, user data, destructors, array
+ * buffers), apart from the ones used internally by arrays, regexps and
+ * strings.
+ *
+ * Returns V7_OK on success, or V7_EXEC_EXCEPTION if the heap can't be saved
+ * or the file can't be written.
+ */
+WARN_UNUSED_RESULT
+enum v7_err v7_save_snapshot(struct v7 *v7, const char *path);
+
+/*
+ * Creates a V7 instance from a snapshot saved by `v7_save_snapshot()`,
+ * instead of initializing the standard library. The arenas get the size they
+ * had when the snapshot was saved, so arena sizes from `opts` are ignored.
+ *
+ * Returns NULL if the file can't be read, or wasn't saved by this build.
+ */
+struct v7 *v7_create_from_snapshot(const char *path,
+                                   struct v7_create_opts opts);
+
+#if defined(__cplusplus)
+}
+#endif /* __cplusplus */
+
+#endif /* V7_ENABLE_SNAPSHOT */
+
+#endif /* CS_V7_SRC_SNAPSHOT_PUBLIC_H_ */
+#ifdef V7_MODULE_LINES
+#line 1 "./src/profiler_public.h"
+#endif
+/*
+ * Copyright (c) 2014 Cesanta Software Limited
+ * All rights reserved
+ */
+
+/*
+ * === Sampling profiler
+ *
+ * The profiler periodically records the JS call stack of an instance. It
+ * reports how many times each distinct stack was seen, in the "collapsed
+ * stacks" format understood by flame graph tools (e.g. `flamegraph.pl`).
+ * There is one line per stack: the frames from the outermost one, separated
+ * by `;`, then a space and the number of samples:
+ *
+ *     app.js:10;loop (app.js:4);work (app.js:2) 42
+ *
+ * On POSIX systems, a sample is taken on each `SIGPROF`, i.e. every
+ * `interval` microseconds of CPU time used by the process. Elsewhere, a
+ * sample is taken every `interval` jumps, calls and returns made by the
+ * interpreter.
+ *
+ * Samples are taken by the interpreter itself, so the time spent in C
+ * functions is attributed to the JS code around the call.
+ *
+ * The profiler is available if V7 is built with `V7_ENABLE_PROFILER`.
+ */
+
+#ifndef CS_V7_SRC_PROFILER_PUBLIC_H_
+#define CS_V7_SRC_PROFILER_PUBLIC_H_
+
+/* Amalgamated: #include "v7/src/core_public.h" */
+
+#ifdef V7_ENABLE_PROFILER
+
+#if defined(__cplusplus)
+extern "C" {
+#endif /* __cplusplus */
+
+/*
+ * Starts profiling `v7`, dropping the samples collected so far. Only one
+ * instance can be profiled at a time, since `SIGPROF` is process-wide.
+ *
+ * Returns 0 on success, or -1 if `interval` is 0, another instance is being
+ * profiled or the timer can't be set up.
+ */
+int v7_profiler_start(struct v7 *v7, unsigned int interval);
+
+/* Stops profiling `v7`. The samples collected so far are kept. */
+void v7_profiler_stop(struct v7 *v7);
+
+/*
+ * Returns the samples collected so far as collapsed stacks, see above. The
+ * text is NUL-terminated, and its length is stored in `*len` unless `len` is
+ * NULL. The caller should `free()` it.
+ */
+char *v7_profiler_dump(struct v7 *v7, size_t *len);
+
+#if defined(__cplusplus)
+}
+#endif /* __cplusplus */
+
+#endif /* V7_ENABLE_PROFILER */
+
+#endif /* CS_V7_SRC_PROFILER_PUBLIC_H_ */
+#ifdef V7_MODULE_LINES
+#line 1 "./src/stats_public.h"
+#endif
+/*
+ * Copyright (c) 2014 Cesanta Software Limited
+ * All rights reserved
+ */
+
+/*
+ * === Execution statistics
+ *
+ * Counters of what the interpreter does: instructions and pairs of
+ * consecutive instructions executed, property lookups along prototype
+ * chains, calls of C functions and garbage collections. They tell which
+ * paths of the interpreter are worth optimizing for the given scripts.
+ *
+ * Counting slows the interpreter down, so it's only available if V7 is
+ * built with `V7_ENABLE_STATS`.
+ */
+
+#ifndef CS_V7_SRC_STATS_PUBLIC_H_
+#define CS_V7_SRC_STATS_PUBLIC_H_
+
+/* Amalgamated: #include "v7/src/core_public.h" */
+
+#ifdef V7_ENABLE_STATS
+
+#if defined(__cplusplus)
+extern "C" {
+#endif /* __cplusplus */
+
+/* Execution metric id, see `v7_exec_stat()` */
+enum v7_exec_stat_what {
+  /* Number of opcodes, i.e. the range of `idx` for the opcode counters */
+  V7_EXEC_STAT_OPCODES,
+  /* Instructions executed */
+  V7_EXEC_STAT_OPS,
+  /* Times the opcode `idx` was executed */
+  V7_EXEC_STAT_OP,
+  /*
+   * Times the opcode `idx % V7_EXEC_STAT_OPCODES` was executed right after
+   * the opcode `idx / V7_EXEC_STAT_OPCODES`
+   */
+  V7_EXEC_STAT_OP_PAIR,
+  /* Property lookups which weren't served by inline caches */
+  V7_EXEC_STAT_PROP_LOOKUPS,
+  /* Objects visited by these lookups along prototype chains */
+  V7_EXEC_STAT_PROP_LOOKUP_STEPS,
+  /* Number of groups of lookups below, i.e. the range of `idx` */
+  V7_EXEC_STAT_PROP_LOOKUP_DEPTHS,
+  /*
+   * Lookups which visited `idx + 1` objects, or more than that for the last
+   * group
+   */
+  V7_EXEC_STAT_PROP_LOOKUP_DEPTH,
+  /* Calls of C functions */
+  V7_EXEC_STAT_CFUNC_CALLS,
+  /* Number of C functions counted one by one, i.e. the range of `idx` */
+  V7_EXEC_STAT_CFUNCS,
+  /* Calls of the C function `idx`, see `v7_exec_stat_cfunc_name()` */
+  V7_EXEC_STAT_CFUNC,
+  /* Stop-the-world garbage collections */
+  V7_EXEC_STAT_GC_CYCLES,
+  /* Steps of incremental garbage collection */
+  V7_EXEC_STAT_GC_STEPS,
+  /* Time spent collecting garbage, in microseconds */
+  V7_EXEC_STAT_GC_TIME_US
+};
+
+/*
+ * Returns a given execution statistics; `idx` is only used by the per-item
+ * metrics. Returns 0 if `idx` is out of range.
+ */
+unsigned long v7_exec_stat(struct v7 *v7, enum v7_exec_stat_what what,
+                           int idx);
+
+/* Returns the name of a given opcode, or NULL if `op` is out of range */
+const char *v7_exec_stat_op_name(int op);
+
+/*
+ * Returns the name of a given C function counted by `V7_EXEC_STAT_CFUNC`,
+ * i.e. the path to it from the global object like `Math.max` or
+ * `Array.prototype.push`, or its address if it wasn't found there. Returns
+ * NULL if `idx` is out of range. The name is valid until the counters are
+ * reset.
+ */
+const char *v7_exec_stat_cfunc_name(struct v7 *v7, int idx);
+
+/* Resets all the counters */
+void v7_exec_stat_reset(struct v7 *v7);
+
+#if defined(__cplusplus)
+}
+#endif /* __cplusplus */
+
+#endif /* V7_ENABLE_STATS */
+
+#endif /* CS_V7_SRC_STATS_PUBLIC_H_ */
+#ifdef V7_MODULE_LINES
+#line 1 "./src/heaplog_public.h"
+#endif
+/*
+ * Copyright (c) 2014 Cesanta Software Limited
+ * All rights reserved
+ */
+
+/*
+ * === Heap log
+ *
+ * Log of the allocations made in the JS heap, attributed to the JS code
+ * which made them. It's meant to be read with `tools/heaplog_viewer`,
+ * possibly interleaved with the `malloc` log of the firmware. The lines are:
+ *
+ * - `hls{<site>,<arena>,<stack>}`: defines the allocation site `<site>`,
+ *   i.e. allocations in the arena `<arena>` (`object`, `function`,
+ *   `property` or `string`) made by the JS stack `<stack>`, which lists the
+ *   innermost frames from the outermost one, separated by `;`. Site 0 stands
+ *   for the allocations made after the table of sites got full.
+ * - `hl{j,<site>,<size>,<id>}`: allocation of `<size>` bytes, where `<id>`
+ *   is the hex address of an arena cell, or `s<serial>` for an owned string.
+ * - `hl{k,<id>}`: the allocation `<id>` was reclaimed by the GC.
+ *
+ * Logging slows allocations down considerably, so it's only available if V7
+ * is built with `V7_ENABLE_HEAPLOG`.
+ */
+
+#ifndef CS_V7_SRC_HEAPLOG_PUBLIC_H_
+#define CS_V7_SRC_HEAPLOG_PUBLIC_H_
+
+/* Amalgamated: #include "v7/src/core_public.h" */
+
+#ifdef V7_ENABLE_HEAPLOG
+
+#if defined(__cplusplus)
+extern "C" {
+#endif /* __cplusplus */
+
+/*
+ * Starts logging the heap allocations to `fp`, which should stay open until
+ * `v7_heaplog_stop()`. Returns 0 on success, or -1 if the heap is already
+ * being logged or there is not enough memory.
+ */
+int v7_heaplog_start(struct v7 *v7, FILE *fp);
+
+/* Stops logging the heap allocations. The log is flushed but not closed. */
+void v7_heaplog_stop(struct v7 *v7);
+
+#if defined(__cplusplus)
+}
+#endif /* __cplusplus */
+
+#endif /* V7_ENABLE_HEAPLOG */
+
+#endif /* CS_V7_SRC_HEAPLOG_PUBLIC_H_ */
+#ifdef V7_MODULE_LINES
 #line 1 "./src/util_public.h"
 #endif
 /*